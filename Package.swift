@@ -94,8 +94,10 @@ let package = Package(
                 "src/extensions/advanced_footnotes.c",
                 "src/extensions/advanced_tables.c",
                 "src/extensions/html_markdown.c",
+                "src/extensions/sub_parser.c",
+                "src/extensions/reference_defs.c",
                 "src/extensions/fenced_divs.c",
-                "src/extensions/table_html_postprocess.c",
+                "src/extensions/table_grid.c",
                 "src/extensions/inline_footnotes.c",
                 "src/extensions/highlight.c",
                 "src/extensions/sup_sub.c",
@@ -104,6 +106,12 @@ let package = Package(
                 "src/extensions/citations.c",
                 "src/extensions/index.c",
                 "src/pretty_html.c",
+                "src/metrics.c",
+                "src/arena.c",
+                "src/stream.c",
+                "src/ast_cache.c",
+                "src/parallel.c",
+                "src/subprocess.c",
                 "src/buffer.c",
                 "src/parser.c",
                 "src/renderer.c",
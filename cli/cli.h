@@ -0,0 +1,30 @@
+/**
+ * Apex CLI entry point shared by the server and watch modes
+ */
+
+#ifndef APEX_CLI_H
+#define APEX_CLI_H
+
+#include "../include/apex/apex.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct apex_watch apex_watch;
+
+/* One CLI invocation handled somewhere other than a plain local run */
+typedef struct {
+    const char *input;      /* Markdown already read from stdin, or NULL */
+    size_t input_len;
+    bool served;            /* Running inside the server */
+    char *html;             /* Out (served): HTML for the client's stdout, NULL if written to -o */
+    apex_watch *watch;      /* Watch mode: dependencies and incremental state */
+} apex_cli_request;
+
+/**
+ * The CLI itself: parses argv and converts. With request NULL it reads
+ * stdin and writes stdout as usual.
+ * @return Process exit status
+ */
+typedef int (*apex_cli_handler)(int argc, char **argv, apex_cli_request *request);
+
+#endif /* APEX_CLI_H */
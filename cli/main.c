@@ -5,14 +5,17 @@
 #include "../include/apex/apex.h"
 #include "../src/extensions/metadata.h"
 #include "../src/extensions/includes.h"
+#include "server.h"
+#include "watch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <libgen.h>
-#include <sys/time.h>
+#include <time.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -30,16 +33,27 @@ apex_remote_plugin *apex_remote_find_plugin(apex_remote_plugin_list *list, const
 void apex_remote_free_plugins(apex_remote_plugin_list *list);
 const char *apex_remote_plugin_repo(apex_remote_plugin *p);
 
-/* Profiling helpers (same as in apex.c) */
+/* Plugin discovery index (from plugins.c) */
+int apex_plugins_rebuild_index(const apex_options *options);
+
+/* Profiling helpers (APEX_PROFILE is read once per process) */
 static double get_time_ms(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
-static bool profiling_enabled(void) {
+static bool profiling_env = false;
+static pthread_once_t profiling_once = PTHREAD_ONCE_INIT;
+
+static void read_profiling_env(void) {
     const char *env = getenv("APEX_PROFILE");
-    return env && (strcmp(env, "1") == 0 || strcmp(env, "yes") == 0 || strcmp(env, "true") == 0);
+    profiling_env = env && (strcmp(env, "1") == 0 || strcmp(env, "yes") == 0 || strcmp(env, "true") == 0);
+}
+
+static bool profiling_enabled(void) {
+    pthread_once(&profiling_once, read_profiling_env);
+    return profiling_env;
 }
 
 #define PROFILE_START(name) \
@@ -54,56 +68,56 @@ static bool profiling_enabled(void) {
 
 #define BUFFER_SIZE 4096
 
-/* Progress reporting state */
-static bool progress_enabled = false;
-static bool is_tty = false;
-static double progress_start_time = 0.0;
-static bool progress_shown = false;  /* Track if we've shown any progress yet */
-static const char *last_stage = NULL;  /* Remember last stage in case we need to show it later */
+/* Progress reporting state, one per run (the server runs several at once) */
+typedef struct {
+    bool enabled;
+    double start_time;
+    bool shown;              /* Track if we've shown any progress yet */
+    const char *last_stage;  /* Remember last stage in case we need to show it later */
+} cli_progress;
 
 /* Initialize progress reporting */
-static void init_progress(void) {
+static void init_progress(cli_progress *progress) {
     const char *env = getenv("APEX_PROGRESS");
-    is_tty = isatty(STDERR_FILENO);
 
     if (env && (strcmp(env, "1") == 0 || strcmp(env, "yes") == 0 || strcmp(env, "true") == 0)) {
-        progress_enabled = true;
+        progress->enabled = true;
     } else if (env && (strcmp(env, "0") == 0 || strcmp(env, "no") == 0 || strcmp(env, "false") == 0)) {
-        progress_enabled = false;
+        progress->enabled = false;
     } else {
         /* Default: enable if stderr is a TTY */
-        progress_enabled = is_tty;
+        progress->enabled = isatty(STDERR_FILENO);
     }
 
     /* Initialize start time for delay check */
-    progress_start_time = get_time_ms();
-    progress_shown = false;
-    last_stage = NULL;
+    progress->start_time = get_time_ms();
+    progress->shown = false;
+    progress->last_stage = NULL;
 }
 
-/* Progress callback function */
+/* Progress callback function (user_data is the run's cli_progress) */
 static void progress_callback(const char *stage, int percent, void *user_data) {
-    (void)user_data;  /* Unused for now */
+    cli_progress *progress = user_data;
 
-    if (!progress_enabled) return;
+    if (!progress->enabled) return;
 
     /* Remember the last stage (unless stage is NULL, which means "refresh last stage") */
     if (stage) {
-        last_stage = stage;
+        progress->last_stage = stage;
     }
 
     /* Check elapsed time */
-    double elapsed = get_time_ms() - progress_start_time;
+    double elapsed = get_time_ms() - progress->start_time;
 
     /* If less than 1 second has elapsed and we haven't shown progress yet, just remember the stage */
-    if (elapsed < 1000.0 && !progress_shown) {
+    if (elapsed < 1000.0 && !progress->shown) {
         return;  /* Too soon, don't show yet - but remember the stage */
     }
 
     /* Once 1 second has passed, show progress (even if it's the same stage or NULL for refresh) */
     if (elapsed >= 1000.0) {
-        progress_shown = true;
-        const char *display_stage = stage ? stage : (last_stage ? last_stage : "Processing");
+        progress->shown = true;
+        const char *display_stage = stage ? stage : (progress->last_stage ? progress->last_stage : "Processing");
         if (percent >= 0) {
             fprintf(stderr, "\rProcessing: %s %3d%%", display_stage, percent);
         } else {
@@ -114,36 +128,36 @@ static void progress_callback(const char *stage, int percent, void *user_data) {
 }
 
 /* Force show progress if enough time has elapsed (called periodically) */
-static void update_progress_if_needed(void) {
-    if (!progress_enabled || !last_stage) return;
+static void update_progress_if_needed(cli_progress *progress) {
+    if (!progress->enabled || !progress->last_stage) return;
 
-    double elapsed = get_time_ms() - progress_start_time;
+    double elapsed = get_time_ms() - progress->start_time;
     if (elapsed >= 1000.0) {
         /* 1 second has passed - show progress if we haven't yet, or refresh it */
-        if (!progress_shown) {
-            progress_shown = true;
+        if (!progress->shown) {
+            progress->shown = true;
         }
-        fprintf(stderr, "\rProcessing: %s...", last_stage);
+        fprintf(stderr, "\rProcessing: %s...", progress->last_stage);
         fflush(stderr);
     }
 }
 
 /* Check if we should show delayed progress (called after processing completes) */
-static void check_delayed_progress(void) {
-    if (!progress_enabled || progress_shown || !last_stage) return;
+static void check_delayed_progress(cli_progress *progress) {
+    if (!progress->enabled || progress->shown || !progress->last_stage) return;
 
-    double elapsed = get_time_ms() - progress_start_time;
+    double elapsed = get_time_ms() - progress->start_time;
     if (elapsed >= 1000.0) {
         /* 1 second has passed, show the last stage we were processing */
-        progress_shown = true;
-        fprintf(stderr, "\rProcessing: %s...", last_stage);
+        progress->shown = true;
+        fprintf(stderr, "\rProcessing: %s...", progress->last_stage);
         fflush(stderr);
     }
 }
 
 /* Clear progress line */
-static void clear_progress(void) {
-    if (progress_enabled && progress_shown) {
+static void clear_progress(const cli_progress *progress) {
+    if (progress->enabled && progress->shown) {
         /* Only clear if we actually showed progress */
         fprintf(stderr, "\r%*s\r", 80, "");  /* Clear line with spaces */
         fflush(stderr);
@@ -174,6 +188,7 @@ static void print_usage(const char *program_name) {
     fprintf(stderr, "  --css FILE, --style FILE  Link to CSS file(s) in document head (requires --standalone, overrides CSS metadata)\n");
     fprintf(stderr, "                         Can be used multiple times or accept comma-separated list (e.g., --css style.css,syntax.css)\n");
     fprintf(stderr, "  --embed-css            Embed CSS file contents into a <style> tag in the document head (used with --css)\n");
+    fprintf(stderr, "  --minify-css           Like --embed-css, but strip comments and whitespace from the embedded CSS\n");
     fprintf(stderr, "  --embed-images         Embed local images as base64 data URLs in HTML output\n");
     fprintf(stderr, "  --hardbreaks           Treat newlines as hard breaks\n");
     fprintf(stderr, "  --header-anchors        Generate <a> anchor tags instead of header IDs\n");
@@ -186,6 +201,7 @@ static void print_usage(const char *program_name) {
     fprintf(stderr, "  --link-citations       Link citations to bibliography entries\n");
     fprintf(stderr, "  --list-plugins         List installed plugins and available plugins from the remote directory\n");
     fprintf(stderr, "  --uninstall-plugin ID  Uninstall plugin by id\n");
+    fprintf(stderr, "  --rebuild-plugin-index Rescan the project and user plugin directories and rewrite their cached index\n");
     fprintf(stderr, "  --meta KEY=VALUE       Set metadata key-value pair (can be used multiple times, supports quotes and comma-separated pairs)\n");
     fprintf(stderr, "  --meta-file FILE       Load metadata from external file (YAML, MMD, or Pandoc format)\n");
     fprintf(stderr, "  --[no-]mixed-lists     Allow mixed list markers at same level (inherit type from first item)\n");
@@ -210,6 +226,7 @@ static void print_usage(const char *program_name) {
     fprintf(stderr, "  --no-unsafe            Disable raw HTML in output\n");
     fprintf(stderr, "  --no-wikilinks         Disable wiki link syntax\n");
     fprintf(stderr, "  --[no-]emoji-autocorrect  Enable/disable emoji name autocorrect (enabled by default in unified mode)\n");
+    fprintf(stderr, "  --metrics-json FILE    Write per-stage timing, byte and allocation metrics as JSON to FILE (- for stderr)\n");
     fprintf(stderr, "  --obfuscate-emails     Obfuscate email links/text using HTML entities\n");
     fprintf(stderr, "  -o, --output FILE      Write output to FILE instead of stdout\n");
     fprintf(stderr, "  --[no-]progress          Show progress indicator during processing (enabled by default for TTY)\n");
@@ -220,10 +237,15 @@ static void print_usage(const char *program_name) {
     fprintf(stderr, "  --[no-]per-cell-alignment  Enable or disable per-cell alignment markers (colons at start/end of cells, enabled by default in unified mode)\n");
     fprintf(stderr, "  --script VALUE         Inject <script> tags before </body> (standalone) or at end of HTML (snippet).\n");
     fprintf(stderr, "                          VALUE can be a path, URL, or shorthand (mermaid, mathjax, katex). Can be used multiple times or as a comma-separated list.\n");
+    fprintf(stderr, "  --serve SOCKET         Run as a persistent server on a Unix socket, keeping plugins and bibliographies loaded\n");
+    fprintf(stderr, "  --server SOCKET        (first option) Send this conversion to a running server; runs locally if none answers.\n");
+    fprintf(stderr, "                         The APEX_SERVER environment variable does the same for every invocation\n");
     fprintf(stderr, "  --show-tooltips         Show tooltips on citations\n");
     fprintf(stderr, "  -s, --standalone       Generate complete HTML document (with <html>, <head>, <body>)\n");
     fprintf(stderr, "  --[no-]sup-sub         Enable or disable MultiMarkdown-style superscript (^text^) and subscript (~text~) syntax\n");
     fprintf(stderr, "  --title TITLE          Document title (requires --standalone, default: \"Document\")\n");
+    fprintf(stderr, "  --threads N            Run block-local HTML passes (highlighting, abbreviations, emoji) on N threads\n");
+    fprintf(stderr, "                         for large documents; output is identical to serial mode (default: 0, serial)\n");
     fprintf(stderr, "  --[no-]transforms      Enable or disable metadata variable transforms [%%key:transform]\n");
     fprintf(stderr, "  --[no-]unsafe          Allow or disallow raw HTML in output\n");
     fprintf(stderr, "  --widont               Prevent short widows in headings by inserting non-breaking spaces between trailing words\n");
@@ -237,6 +259,8 @@ static void print_usage(const char *program_name) {
     fprintf(stderr, "  --title-from-h1        Use the first H1 as the document title when none is specified\n");
     fprintf(stderr, "  --page-break-before-footnotes  Insert a page break before the footnotes section\n");
     fprintf(stderr, "  -v, --version          Show version information\n");
+    fprintf(stderr, "  --watch                Convert again whenever the input file, its includes, stylesheets or bibliographies change;\n");
+    fprintf(stderr, "                         edits re-render only the blocks they touch (requires an input file)\n");
     fprintf(stderr, "  --[no-]wikilinks       Enable or disable wiki link syntax [[PageName]]\n");
     fprintf(stderr, "  --wikilink-space MODE  Space replacement for wiki links: dash, none, underscore, space (default: dash)\n");
     fprintf(stderr, "  --wikilink-extension EXT  File extension to append to wiki links (e.g., html, md)\n\n");
@@ -801,7 +825,7 @@ static char *apex_cli_combine_process_file(const char *filepath) {
     if (doc_copy) {
         memcpy(doc_copy, markdown, len);
         doc_copy[len] = '\0';
-        char *ptr = doc_copy;
+        const char *ptr = doc_copy;
         doc_metadata = apex_extract_metadata(&ptr);
     }
 
@@ -932,18 +956,24 @@ static int apex_cli_combine_from_summary(const char *summary_path, FILE *out) {
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    /* Initialize progress reporting */
-    init_progress();
+/* One CLI run. request is NULL for a plain run; see server.h */
+static int apex_cli_run(int argc, char *argv[], apex_cli_request *request) {
+    bool served = request && request->served;
+
+    /* Initialize progress reporting (served runs never show progress) */
+    cli_progress progress = { false, 0.0, false, NULL };
+    if (!served) init_progress(&progress);
 
     apex_options options = apex_options_default();
     bool plugins_cli_override = false;
     bool plugins_cli_value = false;
     bool list_plugins = false;
+    bool rebuild_plugin_index = false;
     const char *install_plugin_id = NULL;
     const char *uninstall_plugin_id = NULL;
     const char *input_file = NULL;
     const char *output_file = NULL;
+    const char *metrics_json_file = NULL;
     const char *meta_file = NULL;
     apex_metadata_item *cmdline_metadata = NULL;
     char *allocated_base_dir = NULL;      /* Track if we allocated base_directory */
@@ -1009,6 +1039,12 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             output_file = argv[i];
+        } else if (strcmp(argv[i], "--metrics-json") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Error: --metrics-json requires an argument\n");
+                return 1;
+            }
+            metrics_json_file = argv[i];
         } else if (strcmp(argv[i], "--plugins") == 0) {
             options.enable_plugins = true;
             plugins_cli_override = true;
@@ -1019,6 +1055,8 @@ int main(int argc, char *argv[]) {
             plugins_cli_value = false;
         } else if (strcmp(argv[i], "--list-plugins") == 0) {
             list_plugins = true;
+        } else if (strcmp(argv[i], "--rebuild-plugin-index") == 0) {
+            rebuild_plugin_index = true;
         } else if (strcmp(argv[i], "--install-plugin") == 0) {
             if (++i >= argc) {
                 fprintf(stderr, "Error: --install-plugin requires an id argument\n");
@@ -1117,6 +1155,9 @@ int main(int argc, char *argv[]) {
             }
         } else if (strcmp(argv[i], "--embed-css") == 0) {
             options.embed_stylesheet = true;
+        } else if (strcmp(argv[i], "--minify-css") == 0) {
+            options.embed_stylesheet = true;
+            options.minify_embedded_stylesheet = true;
         } else if (strcmp(argv[i], "--script") == 0) {
             if (++i >= argc) {
                 fprintf(stderr, "Error: --script requires an argument\n");
@@ -1228,6 +1269,18 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             options.document_title = argv[i];
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Error: --threads requires an argument\n");
+                return 1;
+            }
+            char *endptr;
+            long threads = strtol(argv[i], &endptr, 10);
+            if (*argv[i] == '\0' || *endptr != '\0' || threads < 0 || threads > 64) {
+                fprintf(stderr, "Error: --threads must be a number from 0 to 64\n");
+                return 1;
+            }
+            options.render_threads = (int)threads;
         } else if (strcmp(argv[i], "--pretty") == 0) {
             options.pretty = true;
         } else if (strcmp(argv[i], "--accept") == 0) {
@@ -1325,9 +1378,9 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "--obfuscate-emails") == 0) {
             options.obfuscate_emails = true;
         } else if (strcmp(argv[i], "--progress") == 0) {
-            progress_enabled = true;
+            progress.enabled = true;
         } else if (strcmp(argv[i], "--no-progress") == 0) {
-            progress_enabled = false;
+            progress.enabled = false;
         } else if (strcmp(argv[i], "--aria") == 0) {
             options.enable_aria = true;
         } else if (strcmp(argv[i], "--no-plugins") == 0) {
@@ -1562,6 +1615,19 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    /* Rebuild the plugin discovery index for this directory (or --base-dir)
+     * and the user plugin directory */
+    if (rebuild_plugin_index) {
+        if (!options.base_directory) options.base_directory = ".";
+        int indexed = apex_plugins_rebuild_index(&options);
+        if (indexed < 0) {
+            fprintf(stderr, "Error: could not write the plugin index.\n");
+            return 1;
+        }
+        fprintf(stderr, "Indexed %d plugin%s\n", indexed, indexed == 1 ? "" : "s");
+        return 0;
+    }
+
     /* Handle plugin listing/installation/uninstallation commands before normal conversion */
     if (list_plugins || install_plugin_id || uninstall_plugin_id) {
         if ((install_plugin_id && uninstall_plugin_id) || (install_plugin_id && list_plugins && uninstall_plugin_id)) {
@@ -2061,6 +2127,11 @@ int main(int argc, char *argv[]) {
         return rc;
     }
 
+    if (request && request->watch && !input_file) {
+        fprintf(stderr, "Error: --watch needs an input file\n");
+        return 1;
+    }
+
     /* Set base_directory from input file if not already set */
     if (input_file && !options.base_directory) {
         char *input_path_copy = strdup(input_file);
@@ -2097,6 +2168,14 @@ int main(int argc, char *argv[]) {
     PROFILE_START(cli_total);
     if (input_file) {
         markdown = read_file(input_file, &input_len);
+    } else if (request && request->input) {
+        /* Stdin already read by the thin client */
+        input_len = request->input_len;
+        markdown = malloc(input_len + 1);
+        if (markdown) {
+            memcpy(markdown, request->input, input_len);
+            markdown[input_len] = '\0';
+        }
     } else {
         PROFILE_START(stdin_read);
         markdown = read_stdin(&input_len);
@@ -2133,7 +2212,7 @@ int main(int argc, char *argv[]) {
         if (doc_copy) {
             memcpy(doc_copy, markdown, input_len);
             doc_copy[input_len] = '\0';
-            char *doc_ptr = doc_copy;
+            const char *doc_ptr = doc_copy;
             doc_metadata = apex_extract_metadata(&doc_ptr);
             if (doc_metadata) {
                 /* Calculate where metadata ended in original */
@@ -2308,28 +2387,78 @@ int main(int argc, char *argv[]) {
     char *final_markdown = enhanced_markdown ? enhanced_markdown : markdown;
     size_t final_len = enhanced_markdown ? enhanced_len : input_len;
 
+    /* Watch mode follows every file this run read (includes are reported
+     * by the conversion, see apex_watch_convert) */
+    if (request && request->watch) {
+        apex_watch *watch = request->watch;
+        apex_watch_add(watch, input_file, NULL);
+        apex_watch_add(watch, meta_file, NULL);
+        apex_watch_add(watch, options.csl_file, options.base_directory);
+        for (char **f = options.bibliography_files; f && *f; f++) {
+            apex_watch_add(watch, *f, options.base_directory);
+        }
+        for (size_t i = 0; options.stylesheet_paths && i < options.stylesheet_count; i++) {
+            apex_watch_add(watch, options.stylesheet_paths[i], options.base_directory);
+        }
+        if (merged_metadata) {
+            apex_watch_add(watch, apex_metadata_get(merged_metadata, "css"), options.base_directory);
+            apex_watch_add(watch, apex_metadata_get(merged_metadata, "bibliography"), options.base_directory);
+            apex_watch_add(watch, apex_metadata_get(merged_metadata, "csl"), options.base_directory);
+        }
+    }
+
     /* Set progress callback if enabled */
-    if (progress_enabled) {
+    if (progress.enabled) {
         options.progress_callback = progress_callback;
-        options.progress_user_data = NULL;
+        options.progress_user_data = &progress;
         /* Reset start time when we begin processing */
-        progress_start_time = get_time_ms();
-        progress_shown = false;
-        last_stage = NULL;
+        progress.start_time = get_time_ms();
+        progress.shown = false;
+        progress.last_stage = NULL;
+    }
+
+    /* Collect per-stage metrics if requested */
+    apex_metrics_batch *metrics_batch = NULL;
+    if (metrics_json_file) {
+        metrics_batch = apex_metrics_batch_new();
+        options.metrics_callback = apex_metrics_batch_record;
+        options.metrics_user_data = metrics_batch;
     }
 
     /* Convert to HTML */
-    char *html = apex_markdown_to_html(final_markdown, final_len, &options);
+    char *html;
+    if (served) {
+        html = apex_server_convert(&options, final_markdown, final_len);
+    } else if (request && request->watch) {
+        html = apex_watch_convert(request->watch, &options, final_markdown, final_len);
+    } else {
+        html = apex_markdown_to_html(final_markdown, final_len, &options);
+    }
+
+    if (metrics_batch) {
+        char *json = apex_metrics_batch_to_json(metrics_batch);
+        if (json) {
+            FILE *mfp = strcmp(metrics_json_file, "-") == 0 ? stderr : fopen(metrics_json_file, "w");
+            if (mfp) {
+                fputs(json, mfp);
+                if (mfp != stderr) fclose(mfp);
+            } else {
+                fprintf(stderr, "Warning: Cannot open metrics file '%s'\n", metrics_json_file);
+            }
+            apex_free_string(json);
+        }
+        apex_metrics_batch_free(metrics_batch);
+    }
 
     /* Check if we should show delayed progress (in case processing took > 1s but no progress was shown) */
-    if (progress_enabled) {
-        check_delayed_progress();
+    if (progress.enabled) {
+        check_delayed_progress(&progress);
         /* Also force an update to show current progress */
-        update_progress_if_needed();
+        update_progress_if_needed(&progress);
     }
 
     /* Clear progress line before output */
-    clear_progress();
+    clear_progress(&progress);
 
     /* Cleanup */
     if (enhanced_markdown) free(enhanced_markdown);
@@ -2357,10 +2486,16 @@ int main(int argc, char *argv[]) {
         size_t html_len = strlen(html);
         fwrite(html, 1, html_len, fp);
         fclose(fp);
+    } else if (served) {
+        /* The client writes it to its own stdout */
+        request->html = html;
+        html = NULL;
     } else {
         size_t html_len = strlen(html);
         fwrite(html, 1, html_len, stdout);
-        /* Don't fflush - let the system buffer for better performance */
+        /* Don't fflush - let the system buffer for better performance
+         * (watch mode's next write may be a long way off) */
+        if (request && request->watch) fflush(stdout);
     }
     PROFILE_END(file_write);
 
@@ -2388,3 +2523,32 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    /* apex --serve SOCKET: run as a daemon for thin clients */
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        return apex_serve(argv[2], apex_cli_run);
+    }
+
+    /* --watch: convert again whenever the input or its dependencies change */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0) {
+            memmove(&argv[i], &argv[i + 1], (size_t)(argc - i) * sizeof(char *));
+            return apex_watch_run(argc - 1, argv, apex_cli_run);
+        }
+    }
+
+    /* apex --server SOCKET ... or APEX_SERVER: forward to a daemon */
+    const char *server = getenv("APEX_SERVER");
+    if (argc >= 3 && strcmp(argv[1], "--server") == 0) {
+        server = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    if (server && *server) {
+        return apex_client_run(server, argc, argv, apex_cli_run);
+    }
+
+    return apex_cli_run(argc, argv, NULL);
+}
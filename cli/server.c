@@ -0,0 +1,580 @@
+/**
+ * Apex CLI server mode
+ *
+ * Protocol (all integers are 32-bit, network byte order; a string is its
+ * length followed by its bytes, length 0xFFFFFFFF meaning none):
+ *
+ *   request:  "APX1" argc cwd input argv[0] ... argv[argc-1]
+ *   response: status html
+ *
+ * input is none when the arguments name an input file, which the server
+ * then reads itself. status is the CLI exit status, or SERVE_REFUSED when
+ * the client should run the invocation locally. A connection may carry
+ * any number of requests, one after another.
+ *
+ * Each connection gets a thread. Relative paths in arguments and
+ * metadata must resolve against the client's directory, so on Linux each
+ * thread takes a private working directory (unshare(CLONE_FS)); elsewhere
+ * requests from other directories run one at a time under a lock.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include "server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVE_MAGIC "APX1"
+#define SERVE_NONE 0xFFFFFFFFu
+#define SERVE_REFUSED 256u
+#define SERVE_MAX_ARGS 4096u
+#define SERVE_MAX_STRING (512u * 1024 * 1024)
+#define SERVE_MAX_CONNECTIONS 64
+#define SERVE_MAX_CONTEXTS 32
+
+/* Arguments that need the caller's own terminal or never convert */
+static const char *const local_only_args[] = {
+    "-h", "--help", "-v", "--version", "--progress", "--no-progress", "--list-plugins",
+    "--install-plugin", "--uninstall-plugin", "--rebuild-plugin-index", "--combine", "--mmd-merge",
+    "--metrics-json", "--serve", "--server", NULL
+};
+
+/* Options followed by a separate value (needed to find the input file) */
+static const char *const value_args[] = {
+    "-m", "--mode", "-o", "--output", "--css", "--style", "--script", "--title",
+    "--id-format", "--captions", "--code-highlight", "--wikilink-space",
+    "--wikilink-extension", "--base-dir", "--bibliography", "--csl", "--meta-file",
+    "--meta", "--threads", NULL
+};
+
+static bool arg_in(const char *arg, const char *const *list) {
+    for (; *list; list++) {
+        if (strcmp(arg, *list) == 0) return true;
+    }
+    return false;
+}
+
+static bool needs_local_run(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (arg_in(argv[i], local_only_args)) return true;
+        if (arg_in(argv[i], value_args)) i++;
+    }
+    return false;
+}
+
+static bool has_input_file(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (arg_in(argv[i], value_args)) {
+            i++;
+        } else if (argv[i][0] != '-') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ------------------------------------------------------------------ */
+/* Framing                                                             */
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_u32(int fd, uint32_t value) {
+    uint32_t wire = htonl(value);
+    return write_all(fd, &wire, sizeof(wire));
+}
+
+static int read_u32(int fd, uint32_t *value) {
+    uint32_t wire;
+    if (read_all(fd, &wire, sizeof(wire)) != 0) return -1;
+    *value = ntohl(wire);
+    return 0;
+}
+
+static int write_string(int fd, const char *s, size_t len) {
+    if (!s) return write_u32(fd, SERVE_NONE);
+    if (len >= SERVE_MAX_STRING) return -1;
+    if (write_u32(fd, (uint32_t)len) != 0) return -1;
+    return write_all(fd, s, len);
+}
+
+/* Read a string into a new NUL-terminated buffer; *out is NULL for none */
+static int read_string(int fd, char **out, size_t *out_len) {
+    uint32_t len;
+    *out = NULL;
+    if (read_u32(fd, &len) != 0) return -1;
+    if (len == SERVE_NONE) {
+        if (out_len) *out_len = 0;
+        return 0;
+    }
+    if (len >= SERVE_MAX_STRING) return -1;
+
+    char *s = malloc((size_t)len + 1);
+    if (!s) return -1;
+    if (read_all(fd, s, len) != 0) {
+        free(s);
+        return -1;
+    }
+    s[len] = '\0';
+    *out = s;
+    if (out_len) *out_len = len;
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Warm contexts                                                       */
+
+/* A context is keyed by everything apex_context_new() loads from */
+typedef struct served_context {
+    char *key;
+    apex_context *context;
+    int users;
+    unsigned long last_used;
+    struct served_context *next;
+} served_context;
+
+static served_context *served_contexts = NULL;
+static size_t served_context_count = 0;
+static unsigned long served_clock = 0;
+static pthread_mutex_t served_contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void served_context_free(served_context *entry) {
+    apex_context_free(entry->context);
+    free(entry->key);
+    free(entry);
+}
+
+static char *context_key(const apex_options *options) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return NULL;
+
+    size_t len = strlen(cwd) + 4;
+    if (options->base_directory) len += strlen(options->base_directory) + 1;
+    if (options->bibliography_files) {
+        for (char **f = options->bibliography_files; *f; f++) len += strlen(*f) + 1;
+    }
+
+    char *key = malloc(len + 1);
+    if (!key) return NULL;
+    char *w = key;
+    w += sprintf(w, "%s\n%c\n", cwd, options->enable_plugins ? 'P' : '-');
+    if (options->base_directory) w += sprintf(w, "%s", options->base_directory);
+    *w++ = '\n';
+    if (options->bibliography_files) {
+        for (char **f = options->bibliography_files; *f; f++) w += sprintf(w, "%s\n", *f);
+    }
+    *w = '\0';
+    return key;
+}
+
+static served_context *served_context_new(const apex_options *options, char *key) {
+    served_context *entry = calloc(1, sizeof(served_context));
+    if (!entry) return NULL;
+
+    /* Only the loaded state comes from the context; each request passes
+     * its own options */
+    apex_options context_options = apex_options_default();
+    context_options.enable_plugins = options->enable_plugins;
+    context_options.base_directory = options->base_directory;
+    context_options.bibliography_files = options->bibliography_files;
+    entry->context = apex_context_new(&context_options);
+    if (!entry->context) {
+        free(entry);
+        return NULL;
+    }
+    entry->key = key;
+    return entry;
+}
+
+/* Find or create the context for options; NULL means convert without one */
+static served_context *served_context_acquire(const apex_options *options) {
+    char *key = context_key(options);
+    if (!key) return NULL;
+
+    pthread_mutex_lock(&served_contexts_lock);
+    for (served_context *entry = served_contexts; entry; entry = entry->next) {
+        if (strcmp(entry->key, key) == 0) {
+            entry->users++;
+            entry->last_used = ++served_clock;
+            pthread_mutex_unlock(&served_contexts_lock);
+            free(key);
+            return entry;
+        }
+    }
+
+    /* Make room by dropping the least recently used idle context */
+    if (served_context_count >= SERVE_MAX_CONTEXTS) {
+        served_context **victim = NULL;
+        for (served_context **link = &served_contexts; *link; link = &(*link)->next) {
+            if ((*link)->users == 0 && (!victim || (*link)->last_used < (*victim)->last_used)) {
+                victim = link;
+            }
+        }
+        if (!victim) {
+            pthread_mutex_unlock(&served_contexts_lock);
+            free(key);
+            return NULL;
+        }
+        served_context *old = *victim;
+        *victim = old->next;
+        served_context_count--;
+        served_context_free(old);
+    }
+
+    /* Loaded under the lock so concurrent first requests load it once */
+    served_context *entry = served_context_new(options, key);
+    if (entry) {
+        entry->users = 1;
+        entry->last_used = ++served_clock;
+        entry->next = served_contexts;
+        served_contexts = entry;
+        served_context_count++;
+    } else {
+        free(key);
+    }
+    pthread_mutex_unlock(&served_contexts_lock);
+    return entry;
+}
+
+static void served_context_release(served_context *entry) {
+    pthread_mutex_lock(&served_contexts_lock);
+    entry->users--;
+    pthread_mutex_unlock(&served_contexts_lock);
+}
+
+char *apex_server_convert(const apex_options *options, const char *markdown, size_t len) {
+    served_context *entry = served_context_acquire(options);
+    if (!entry) return apex_markdown_to_html(markdown, len, options);
+
+    char *html = apex_context_convert(entry->context, markdown, len, options);
+    served_context_release(entry);
+    return html;
+}
+
+/* ------------------------------------------------------------------ */
+/* Server                                                              */
+
+static apex_cli_handler serve_handler;
+static char serve_cwd[PATH_MAX];
+static pthread_rwlock_t serve_cwd_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t serve_connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static int serve_connections = 0;
+static volatile sig_atomic_t serve_stop = 0;
+
+static void serve_signal(int sig) {
+    (void)sig;
+    serve_stop = 1;
+}
+
+/* Run one request in the client's directory */
+static uint32_t serve_request(bool own_cwd, const char *cwd, int argc, char **argv,
+                              apex_cli_request *request) {
+    if (needs_local_run(argc, argv)) return SERVE_REFUSED;
+
+    if (own_cwd) {
+        if (chdir(cwd) != 0) return SERVE_REFUSED;
+        return (uint32_t)serve_handler(argc, argv, request);
+    }
+
+    /* Shared working directory: requests from elsewhere run alone */
+    bool here = strcmp(cwd, serve_cwd) == 0;
+    uint32_t status;
+    if (here) {
+        pthread_rwlock_rdlock(&serve_cwd_lock);
+        status = (uint32_t)serve_handler(argc, argv, request);
+    } else {
+        pthread_rwlock_wrlock(&serve_cwd_lock);
+        if (chdir(cwd) == 0) {
+            status = (uint32_t)serve_handler(argc, argv, request);
+            if (chdir(serve_cwd) != 0) {
+                fprintf(stderr, "apex --serve: cannot return to %s\n", serve_cwd);
+            }
+        } else {
+            status = SERVE_REFUSED;
+        }
+    }
+    pthread_rwlock_unlock(&serve_cwd_lock);
+    return status;
+}
+
+static void *serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+
+#ifdef __linux__
+    bool own_cwd = unshare(CLONE_FS) == 0;
+#else
+    bool own_cwd = false;
+#endif
+
+    for (;;) {
+        char magic[4];
+        uint32_t argc;
+        if (read_all(fd, magic, sizeof(magic)) != 0 || memcmp(magic, SERVE_MAGIC, 4) != 0) break;
+        if (read_u32(fd, &argc) != 0 || argc == 0 || argc > SERVE_MAX_ARGS) break;
+
+        char *cwd = NULL;
+        char *input = NULL;
+        size_t input_len = 0;
+        char **argv = calloc((size_t)argc + 1, sizeof(char *));
+        bool ok = argv && read_string(fd, &cwd, NULL) == 0 && cwd &&
+                  read_string(fd, &input, &input_len) == 0;
+        for (uint32_t i = 0; ok && i < argc; i++) {
+            ok = read_string(fd, &argv[i], NULL) == 0 && argv[i];
+        }
+
+        uint32_t status = SERVE_REFUSED;
+        apex_cli_request request = { input, input_len, true, NULL, NULL };
+        if (ok) {
+            status = serve_request(own_cwd, cwd, (int)argc, argv, &request);
+        }
+
+        int sent = ok ? write_u32(fd, status) : -1;
+        if (sent == 0) {
+            sent = write_string(fd, request.html, request.html ? strlen(request.html) : 0);
+        }
+
+        apex_free_string(request.html);
+        if (argv) {
+            for (uint32_t i = 0; i < argc; i++) free(argv[i]);
+            free(argv);
+        }
+        free(cwd);
+        free(input);
+        if (sent != 0) break;
+    }
+
+    close(fd);
+    pthread_mutex_lock(&serve_connections_lock);
+    serve_connections--;
+    pthread_mutex_unlock(&serve_connections_lock);
+    return NULL;
+}
+
+static int serve_address(const char *socket_path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return 0;
+}
+
+int apex_serve(const char *socket_path, apex_cli_handler handler) {
+    struct sockaddr_un addr;
+    if (serve_address(socket_path, &addr) != 0) return 1;
+    if (!getcwd(serve_cwd, sizeof(serve_cwd))) {
+        fprintf(stderr, "Error: cannot determine working directory\n");
+        return 1;
+    }
+    serve_handler = handler;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    /* A leftover socket file from a server that died is replaced; a live
+     * server keeps its socket */
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Error: an apex server is already listening on %s\n", socket_path);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t old_mask = umask(0077);
+    int bound = fd >= 0 ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) : -1;
+    umask(old_mask);
+    if (bound != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "Error: cannot listen on %s: %s\n", socket_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (!serve_stop) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+
+        /* Past the limit the client just runs the conversion itself */
+        pthread_mutex_lock(&serve_connections_lock);
+        bool busy = serve_connections >= SERVE_MAX_CONNECTIONS;
+        if (!busy) serve_connections++;
+        pthread_mutex_unlock(&serve_connections_lock);
+        if (busy) {
+            close(client);
+            continue;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, serve_connection, (void *)(intptr_t)client) != 0) {
+            close(client);
+            pthread_mutex_lock(&serve_connections_lock);
+            serve_connections--;
+            pthread_mutex_unlock(&serve_connections_lock);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    close(fd);
+    unlink(socket_path);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Client                                                              */
+
+static char *read_all_stdin(size_t *len) {
+    size_t cap = 65536, size = 0;
+    char *buf = malloc(cap + 1);
+    if (!buf) return NULL;
+    for (;;) {
+        if (size == cap) {
+            char *grown = realloc(buf, cap * 2 + 1);
+            if (!grown) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(STDIN_FILENO, buf + size, cap - size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return NULL;
+        }
+        if (n == 0) break;
+        size += (size_t)n;
+    }
+    buf[size] = '\0';
+    *len = size;
+    return buf;
+}
+
+/* Send one request; returns the status, or -1 if the exchange failed */
+static long client_exchange(int fd, int argc, char **argv, const char *input, size_t input_len,
+                            char **html, size_t *html_len) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return -1;
+
+    if (write_all(fd, SERVE_MAGIC, 4) != 0 || write_u32(fd, (uint32_t)argc) != 0 ||
+        write_string(fd, cwd, strlen(cwd)) != 0 || write_string(fd, input, input_len) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < argc; i++) {
+        if (write_string(fd, argv[i], strlen(argv[i])) != 0) return -1;
+    }
+
+    uint32_t status;
+    if (read_u32(fd, &status) != 0 || read_string(fd, html, html_len) != 0) return -1;
+    return (long)status;
+}
+
+int apex_client_run(const char *socket_path, int argc, char **argv, apex_cli_handler handler) {
+    if (needs_local_run(argc, argv)) return handler(argc, argv, NULL);
+
+    struct sockaddr_un addr;
+    int fd = -1;
+    if (serve_address(socket_path, &addr) == 0) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) return handler(argc, argv, NULL);
+
+    /* Stdin is read here, once, so a local rerun can still use it */
+    char *input = NULL;
+    size_t input_len = 0;
+    if (!has_input_file(argc, argv)) {
+        input = read_all_stdin(&input_len);
+        if (!input) {
+            close(fd);
+            fprintf(stderr, "Error: Cannot read stdin\n");
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    char *html = NULL;
+    size_t html_len = 0;
+    long status = client_exchange(fd, argc, argv, input, input_len, &html, &html_len);
+    close(fd);
+
+    int rc;
+    if (status == 0) {
+        if (html && html_len > 0) fwrite(html, 1, html_len, stdout);
+        rc = 0;
+    } else {
+        /* Refused, lost, or failed: run here (a failure then prints its
+         * own diagnostics) */
+        apex_cli_request request = { input, input_len, false, NULL, NULL };
+        rc = handler(argc, argv, input ? &request : NULL);
+    }
+
+    free(html);
+    free(input);
+    return rc;
+}
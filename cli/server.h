@@ -0,0 +1,40 @@
+/**
+ * Apex CLI server mode
+ *
+ * `apex --serve SOCKET` keeps one process running on a Unix domain socket
+ * so editors and site generators that convert thousands of documents pay
+ * for process start, plugin discovery and bibliography parsing once.
+ * `apex --server SOCKET ...` (or APEX_SERVER=SOCKET apex ...) is the thin
+ * client: it forwards its arguments, working directory and stdin, and
+ * writes the result, so every invocation behaves like the plain CLI.
+ */
+
+#ifndef APEX_CLI_SERVER_H
+#define APEX_CLI_SERVER_H
+
+#include "cli.h"
+
+/**
+ * Listen on socket_path and run handler for every request until SIGINT
+ * or SIGTERM. Fails if another server already answers on socket_path.
+ * @return Exit status
+ */
+int apex_serve(const char *socket_path, apex_cli_handler handler);
+
+/**
+ * Forward one invocation to the server at socket_path. Runs handler
+ * locally when the server cannot be reached, refuses the request, or
+ * the arguments need the local terminal (--progress, --help, plugin
+ * management, ...). A failed served run is repeated locally so its
+ * diagnostics appear on this process's stderr.
+ * @return Exit status
+ */
+int apex_client_run(const char *socket_path, int argc, char **argv, apex_cli_handler handler);
+
+/**
+ * Convert inside the server, reusing a warm apex_context for the
+ * options' plugin and bibliography settings.
+ */
+char *apex_server_convert(const apex_options *options, const char *markdown, size_t len);
+
+#endif /* APEX_CLI_SERVER_H */
@@ -0,0 +1,284 @@
+/**
+ * Apex CLI watch mode
+ *
+ * Each run records the files it read; the watcher then waits for any of
+ * them to change. On Linux it uses inotify on their directories, which
+ * also sees editors that save by writing a new file and renaming it over
+ * the old one; elsewhere it compares stat() results a few times a second.
+ *
+ * When only the input changed, the next run keeps the incremental
+ * renderer's blocks. Any other change (an include, stylesheet,
+ * bibliography, CSL or metadata file) starts the next run from scratch
+ * with fresh caches and a freshly loaded context.
+ */
+
+#include "watch.h"
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#define WATCH_POLL_MS 250
+#define WATCH_SETTLE_MS 50   /* Lets an editor finish a save before the next run */
+
+typedef struct {
+    char *path;
+    char *directory;    /* For inotify */
+    char *name;
+    int wd;
+    bool exists;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+} watched_file;
+
+struct apex_watch {
+    watched_file *files;     /* The input first, as apex_cli_run adds it */
+    size_t count;
+    size_t capacity;
+    apex_context *context;
+    apex_incremental *incremental;
+    bool reset;              /* Something besides the input changed */
+};
+
+static void watched_file_stat(watched_file *file) {
+    struct stat st;
+    file->exists = stat(file->path, &st) == 0;
+    file->ino = file->exists ? st.st_ino : 0;
+    file->mtime = file->exists ? st.st_mtime : 0;
+    file->size = file->exists ? st.st_size : 0;
+}
+
+static bool watched_file_changed(const watched_file *file) {
+    struct stat st;
+    bool exists = stat(file->path, &st) == 0;
+    if (exists != file->exists) return true;
+    return exists && (st.st_ino != file->ino || st.st_mtime != file->mtime || st.st_size != file->size);
+}
+
+static void watched_files_free(watched_file *files, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(files[i].path);
+        free(files[i].directory);
+        free(files[i].name);
+    }
+    free(files);
+}
+
+void apex_watch_add(apex_watch *watch, const char *path, const char *base_directory) {
+    if (!watch || !path || !*path || strstr(path, "://") || strncmp(path, "//", 2) == 0) return;
+
+    char *resolved = NULL;
+    struct stat st;
+    if (path[0] != '/' && stat(path, &st) != 0 && base_directory && *base_directory) {
+        size_t len = strlen(base_directory) + strlen(path) + 2;
+        resolved = malloc(len);
+        if (resolved) {
+            snprintf(resolved, len, "%s/%s", base_directory, path);
+            if (stat(resolved, &st) != 0) {
+                free(resolved);
+                resolved = NULL;
+            }
+        }
+    }
+    if (!resolved) resolved = strdup(path);
+    if (!resolved) return;
+
+    for (size_t i = 0; i < watch->count; i++) {
+        if (strcmp(watch->files[i].path, resolved) == 0) {
+            free(resolved);
+            return;
+        }
+    }
+
+    if (watch->count == watch->capacity) {
+        size_t capacity = watch->capacity ? watch->capacity * 2 : 8;
+        watched_file *grown = realloc(watch->files, capacity * sizeof(watched_file));
+        if (!grown) {
+            free(resolved);
+            return;
+        }
+        watch->files = grown;
+        watch->capacity = capacity;
+    }
+
+    /* dirname() and basename() may modify their argument */
+    char *dir_copy = strdup(resolved);
+    char *name_copy = strdup(resolved);
+    watched_file *file = &watch->files[watch->count];
+    memset(file, 0, sizeof(*file));
+    file->path = resolved;
+    file->directory = dir_copy ? strdup(dirname(dir_copy)) : NULL;
+    file->name = name_copy ? strdup(basename(name_copy)) : NULL;
+    file->wd = -1;
+    free(dir_copy);
+    free(name_copy);
+    watched_file_stat(file);
+    watch->count++;
+}
+
+/* Dependency callback: includes the conversion read */
+static void watch_add_include(const char *path, void *user_data) {
+    apex_watch_add(user_data, path, NULL);
+}
+
+char *apex_watch_convert(apex_watch *watch, const apex_options *options, const char *markdown, size_t len) {
+    apex_options opts = *options;
+    opts.dependency_callback = watch_add_include;
+    opts.dependency_user_data = watch;
+    options = &opts;
+
+    if (watch->reset) {
+        apex_incremental_free(watch->incremental);
+        apex_context_free(watch->context);
+        watch->incremental = NULL;
+        watch->context = NULL;
+        watch->reset = false;
+    }
+    if (!watch->incremental) {
+        watch->context = apex_context_new(options);
+        watch->incremental = apex_incremental_new(watch->context);
+    }
+
+    char *html = watch->incremental ? apex_incremental_render(watch->incremental, markdown, len, options) : NULL;
+    return html ? html : apex_markdown_to_html(markdown, len, options);
+}
+
+static void watch_sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+/* Note which files changed; returns whether any did */
+static bool watch_collect_changes(apex_watch *watch, bool *input_only) {
+    bool any = false;
+    for (size_t i = 0; i < watch->count; i++) {
+        if (watched_file_changed(&watch->files[i])) {
+            any = true;
+            if (i > 0) *input_only = false;
+        }
+    }
+    return any;
+}
+
+#ifdef __linux__
+/* Wait on inotify; returns false if it is unavailable */
+static bool watch_wait_inotify(apex_watch *watch, bool *input_only) {
+    int fd = inotify_init();
+    if (fd < 0) return false;
+
+    for (size_t i = 0; i < watch->count; i++) {
+        watched_file *file = &watch->files[i];
+        if (!file->directory || !file->name) continue;
+        file->wd = inotify_add_watch(fd, file->directory,
+                                     IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+    }
+
+    /* Anything saved while the last run was converting */
+    bool changed = watch_collect_changes(watch, input_only);
+
+    char events[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!changed) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        for (char *p = events; p < events + n;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            for (size_t i = 0; event->len > 0 && i < watch->count; i++) {
+                watched_file *file = &watch->files[i];
+                if (file->wd == event->wd && file->name && strcmp(file->name, event->name) == 0) {
+                    changed = true;
+                    if (i > 0) *input_only = false;
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    close(fd);
+    if (changed) watch_collect_changes(watch, input_only);
+    return true;
+}
+#endif
+
+/* Block until a watched file changes */
+static void watch_wait(apex_watch *watch, bool *input_only) {
+    *input_only = true;
+
+#ifdef __linux__
+    if (watch_wait_inotify(watch, input_only)) {
+        watch_sleep_ms(WATCH_SETTLE_MS);
+        return;
+    }
+#endif
+
+    while (!watch_collect_changes(watch, input_only)) {
+        watch_sleep_ms(WATCH_POLL_MS);
+    }
+    watch_sleep_ms(WATCH_SETTLE_MS);
+}
+
+int apex_watch_run(int argc, char **argv, apex_cli_handler handler) {
+    apex_watch watch;
+    memset(&watch, 0, sizeof(watch));
+    apex_cli_request request;
+    memset(&request, 0, sizeof(request));
+    request.watch = &watch;
+
+    /* Bad arguments or an unreadable input stop watch mode at once */
+    int status = handler(argc, argv, &request);
+    while (status == 0 && watch.count > 0) {
+        bool input_only;
+        watch_wait(&watch, &input_only);
+        if (!input_only) {
+            /* Reload everything the run depends on */
+            watch.reset = true;
+            apex_include_cache_clear();
+            apex_stylesheet_cache_clear();
+            apex_image_cache_clear();
+        }
+
+        watched_file *previous = watch.files;
+        size_t previous_count = watch.count;
+        watch.files = NULL;
+        watch.count = 0;
+        watch.capacity = 0;
+
+        handler(argc, argv, &request);
+
+        if (watch.count == 0) {
+            /* The run failed before reading anything (say, mid-save);
+             * keep waiting on the same files */
+            free(watch.files);
+            watch.files = previous;
+            watch.count = previous_count;
+            watch.capacity = previous_count;
+            for (size_t i = 0; i < watch.count; i++) watched_file_stat(&watch.files[i]);
+        } else {
+            watched_files_free(previous, previous_count);
+        }
+    }
+
+    watched_files_free(watch.files, watch.count);
+    apex_incremental_free(watch.incremental);
+    apex_context_free(watch.context);
+    return status;
+}
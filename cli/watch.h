@@ -0,0 +1,37 @@
+/**
+ * Apex CLI watch mode
+ *
+ * `apex --watch input.md [-o output.html] ...` converts once, then waits
+ * for the input, its includes, stylesheets, bibliographies, CSL style and
+ * metadata file to change and converts again. Plugins and bibliographies
+ * stay loaded between runs, unchanged includes come from the include
+ * cache, and edits to the input re-render only the blocks they touch
+ * (see apex_incremental).
+ */
+
+#ifndef APEX_CLI_WATCH_H
+#define APEX_CLI_WATCH_H
+
+#include "cli.h"
+
+/**
+ * Run handler, then again after every change to the files it read, until
+ * interrupted. Stops early if the first run fails.
+ * @return Exit status
+ */
+int apex_watch_run(int argc, char **argv, apex_cli_handler handler);
+
+/**
+ * Watch path (ignored if NULL or a URL). A relative path that does not
+ * exist as given is tried relative to base_directory.
+ */
+void apex_watch_add(apex_watch *watch, const char *path, const char *base_directory);
+
+/**
+ * Convert the current version of the document, reusing what the previous
+ * run rendered when only the input changed. Files the conversion includes
+ * are added to the watch.
+ */
+char *apex_watch_convert(apex_watch *watch, const apex_options *options, const char *markdown, size_t len);
+
+#endif /* APEX_CLI_WATCH_H */
@@ -34,6 +34,21 @@ typedef enum {
 } apex_mode_t;
 #endif
 
+/**
+ * Metrics for one pipeline stage of a conversion
+ */
+typedef struct {
+    const char *stage;      /* Stage name, e.g. "parsing", "toc", "plugin:kbd", "total" */
+    double duration_ms;     /* Elapsed time, from a monotonic clock */
+    size_t bytes_in;        /* Size of the text the stage read */
+    size_t bytes_out;       /* Size of the text it produced (bytes_in when unchanged) */
+    size_t allocations;     /* cmark allocations (parser, AST, renderer) made by the stage */
+    bool skipped;           /* The stage did not run for this document */
+    bool timed_out;         /* An external plugin was killed at its timeout_ms; its output was discarded */
+} apex_stage_metrics;
+
+typedef void (*apex_metrics_callback)(const apex_stage_metrics *metrics, void *user_data);
+
 /**
  * Configuration options for the parser and renderer
  */
@@ -143,6 +158,7 @@ typedef struct {
      * This is typically enabled via the CLI --embed-css flag.
      */
     bool embed_stylesheet;
+    bool minify_embedded_stylesheet;  /* Strip comments/whitespace from embedded CSS (cached once per file) */
 
     /* ARIA accessibility options */
     bool enable_aria;  /* Add ARIA labels and accessibility attributes to HTML output */
@@ -181,6 +197,29 @@ typedef struct {
      */
     void (*progress_callback)(const char *stage, int percent, void *user_data);
     void *progress_user_data;  /* User data passed to progress callback */
+
+    /* Per-stage metrics callback */
+    /* Called once for each pipeline stage as it finishes, then once with
+     * skipped=true for every stage that did not run, then for "total".
+     * Plugin invocations are reported as "plugin:<id>".
+     * If NULL, metrics are only collected when APEX_PROFILE is set (printed to stderr).
+     */
+    apex_metrics_callback metrics_callback;
+    void *metrics_user_data;   /* User data passed to metrics callback */
+
+    /* Dependency callback */
+    /* Called with the path of every file the conversion reads through
+     * include syntax, including CSV/TSV files streamed into tables.
+     * A file may be reported more than once. If NULL, nothing is reported.
+     */
+    void (*dependency_callback)(const char *path, void *user_data);
+    void *dependency_user_data;  /* User data passed to dependency callback */
+
+    /* Memory */
+    bool use_arena;  /* Allocate the cmark tree and scratch lists from a per-conversion arena, freed at once (default: true) */
+
+    /* Parallelism */
+    int render_threads;  /* Threads for block-local HTML passes on large documents; 0 or 1 = serial (default: 0) */
 } apex_options;
 
 /**
@@ -192,13 +231,200 @@ apex_options apex_options_for_mode(apex_mode_t mode);
 /**
  * Main conversion function: Markdown to HTML
  *
- * @param markdown Input markdown text
+ * @param markdown Input markdown text (need not be NUL-terminated; only len bytes are read)
  * @param len Length of input text
  * @param options Processing options (NULL for defaults)
  * @return Newly allocated HTML string (must be freed with apex_free_string)
  */
 char *apex_markdown_to_html(const char *markdown, size_t len, const apex_options *options);
 
+/**
+ * Convert a Markdown file through a read-only memory map
+ *
+ * The mapped file is converted in place, without copying the input first
+ * (unless its size is an exact multiple of the page size). The file must
+ * not be truncated while the conversion runs.
+ *
+ * @param path File to convert
+ * @param options Processing options (NULL for defaults)
+ * @return Newly allocated HTML string, or NULL if the file cannot be read
+ */
+char *apex_markdown_file_to_html(const char *path, const apex_options *options);
+
+/**
+ * Streaming conversion: feed Markdown in chunks, receive HTML as it is ready
+ *
+ * Top-level blocks are converted and written once the next block has
+ * started at the left margin, so output begins before the input ends.
+ * Content that needs the whole document (footnotes, TOC markers,
+ * reference links, abbreviations, includes) is deferred: from the first
+ * such block on, the rest is converted in one piece by apex_stream_finish().
+ * Text already written is not revisited, so a TOC or abbreviation only
+ * covers the deferred part. Standalone output, plugins, citations and
+ * indices convert the whole document at apex_stream_finish().
+ *
+ * The options struct is copied; strings and arrays it points to must
+ * outlive the stream. A stream is used from one thread at a time.
+ */
+typedef struct apex_stream apex_stream;
+
+/**
+ * Receives converted HTML (not NUL-terminated). Return 0 to continue;
+ * anything else stops the stream and makes the pending call return -1.
+ */
+typedef int (*apex_stream_write_fn)(const char *html, size_t len, void *user_data);
+
+/**
+ * Create a stream (options NULL for defaults)
+ * @return New stream, or NULL on allocation failure
+ */
+apex_stream *apex_stream_new(const apex_options *options, apex_stream_write_fn write, void *user_data);
+
+/**
+ * Feed the next chunk of input; chunks may split lines anywhere
+ * @return 0 on success, -1 on allocation failure or a stopped write
+ */
+int apex_stream_feed(apex_stream *stream, const char *chunk, size_t len);
+
+/**
+ * Convert whatever is left and write the end of the document
+ * @return 0 on success, -1 on failure
+ */
+int apex_stream_finish(apex_stream *stream);
+
+void apex_stream_free(apex_stream *stream);
+
+/**
+ * Parsed documents: parse once, render many times
+ *
+ * apex_parse_document() runs preprocessing, the cmark parse and the tree
+ * passes (wiki links, manual header IDs, IAL, image attributes) and keeps
+ * the resulting tree together with the document's metadata, ALDs and
+ * abbreviations. apex_render_document() then runs only the rendering and
+ * HTML passes, so the same document can be rendered as a fragment and as
+ * a standalone page, with or without ARIA, with different stylesheets,
+ * without being parsed again.
+ *
+ * A parsed document can be saved to a compact binary cache file and
+ * loaded back (through a read-only memory map) by a later process.
+ * Plugins, citations and indices need the whole pipeline; documents that
+ * use them are not parsed (NULL), so callers fall back to
+ * apex_markdown_to_html(). Documents with footnotes can be parsed and
+ * rendered but not saved.
+ */
+typedef struct apex_document apex_document;
+
+/**
+ * Parse a document for later rendering
+ * @return Parsed document, or NULL if it needs the whole pipeline
+ */
+apex_document *apex_parse_document(const char *markdown, size_t len, const apex_options *options);
+
+/**
+ * Render a parsed document. Options that only affect parsing (mode,
+ * extensions, preprocessing) are the ones it was parsed with; output
+ * options (standalone, pretty, stylesheets, ARIA, header IDs, ...) come
+ * from options.
+ * @return Newly allocated HTML string (must be freed with apex_free_string)
+ */
+char *apex_render_document(const apex_document *doc, const apex_options *options);
+
+/**
+ * Save a parsed document to a cache file
+ * @return 0 on success, -1 if the file cannot be written or the tree
+ *         holds nodes the cache format cannot represent (footnotes)
+ */
+int apex_document_save(const apex_document *doc, const char *path);
+
+/**
+ * Load a document saved by apex_document_save(). The file is mapped and
+ * stays mapped until the document is freed.
+ * @param options The options the document would be parsed with now
+ * @return Document, or NULL if the file is missing, damaged, written by
+ *         another version of Apex, or parsed with different options
+ */
+apex_document *apex_document_load(const char *path, const apex_options *options);
+
+void apex_document_free(apex_document *doc);
+
+/**
+ * Conversion context
+ *
+ * Holds the state that is expensive to set up and the same for every
+ * conversion with a given set of options: the discovered plugins and the
+ * bibliography files named in options->bibliography_files. Both are
+ * loaded once by apex_context_new() and shared, read-only, by every
+ * conversion through the context, so one context may be used from
+ * several threads at once. Files are not re-read; create a new context
+ * when plugins or bibliographies change on disk.
+ */
+typedef struct apex_context apex_context;
+
+/**
+ * Create a context (options NULL for defaults). base_directory and
+ * bibliography_files are copied; other strings and arrays the options
+ * point to must outlive the context if it converts with its own options.
+ * @return New context, or NULL on allocation failure
+ */
+apex_context *apex_context_new(const apex_options *options);
+
+/**
+ * Convert using the context's plugins and bibliography. Other options
+ * come from options, or from the context's own options when NULL; with
+ * enable_plugins off no plugins run, and with it on for a context
+ * created without plugins they are discovered for this conversion.
+ * A document whose metadata names a further bibliography loads its own
+ * merged copy, as apex_markdown_to_html() would.
+ * @return Newly allocated HTML string (must be freed with apex_free_string)
+ */
+char *apex_context_convert(apex_context *context, const char *markdown, size_t len,
+                           const apex_options *options);
+
+void apex_context_free(apex_context *context);
+
+/**
+ * Incremental rendering for live preview
+ *
+ * Renders successive versions of one document. Each version is cut into
+ * top-level blocks the way apex_stream cuts its input, and blocks equal
+ * to the previous version's (counting in from both ends) keep their
+ * HTML, so an edit re-renders only the blocks around it. Output is the
+ * same as apex_stream produces for the document.
+ *
+ * Every block is rendered with the first block's metadata, so an edit
+ * there re-renders everything, as does anything apex_stream converts in
+ * one piece (standalone output, plugins, citations, indices, and blocks
+ * from the first footnote, reference link, TOC marker or include on).
+ * Those renders use context when given.
+ */
+typedef struct apex_incremental apex_incremental;
+
+/**
+ * Create an incremental renderer. context (may be NULL) must outlive it.
+ */
+apex_incremental *apex_incremental_new(apex_context *context);
+
+/**
+ * Render the current version of the document. Pass the same options
+ * every time; call apex_incremental_reset() when they, or files the
+ * document includes, change.
+ * @return Newly allocated HTML string (must be freed with apex_free_string)
+ */
+char *apex_incremental_render(apex_incremental *inc, const char *markdown, size_t len,
+                              const apex_options *options);
+
+/**
+ * Forget the previous version, so the next render starts from scratch
+ */
+void apex_incremental_reset(apex_incremental *inc);
+
+/**
+ * Number of blocks the last render took from the previous version
+ */
+size_t apex_incremental_reused(const apex_incremental *inc);
+
+void apex_incremental_free(apex_incremental *inc);
+
 /**
  * Wrap HTML content in complete HTML5 document structure
  *
@@ -220,6 +446,53 @@ char *apex_wrap_html_document(const char *content, const char *title, const char
  */
 char *apex_pretty_print_html(const char *html);
 
+/**
+ * Release the process-wide cache of embedded image data URLs
+ *
+ * With embed_images, each local image is read and base64-encoded once per
+ * process and reused while its mtime and size are unchanged. Long-running
+ * hosts can call this to drop the cached encodings.
+ */
+void apex_image_cache_clear(void);
+
+/**
+ * Release stylesheets cached for embed_stylesheet
+ *
+ * Embedded CSS files are read (and minified, if requested) once per
+ * process and revalidated by mtime and size. Call this to free them.
+ */
+void apex_stylesheet_cache_clear(void);
+
+/**
+ * Release files cached for includes
+ *
+ * Included files are read once per process and revalidated by mtime and
+ * size; at most 64MB is kept, least recently used first out. Call this to
+ * free them, or to force a re-read when a file may have changed within
+ * the same second.
+ */
+void apex_include_cache_clear(void);
+
+/**
+ * Aggregated stage metrics across a batch of conversions
+ *
+ * Set options.metrics_callback = apex_metrics_batch_record and
+ * options.metrics_user_data to a batch to collect per-stage totals,
+ * min/max and a log2 duration histogram over many documents.
+ * A batch is not thread-safe; use one per thread.
+ */
+typedef struct apex_metrics_batch apex_metrics_batch;
+
+apex_metrics_batch *apex_metrics_batch_new(void);
+void apex_metrics_batch_record(const apex_stage_metrics *metrics, void *batch);
+
+/**
+ * Serialize a batch as JSON
+ * @return Newly allocated JSON string (must be freed with apex_free_string)
+ */
+char *apex_metrics_batch_to_json(const apex_metrics_batch *batch);
+void apex_metrics_batch_free(apex_metrics_batch *batch);
+
 /**
  * Free a string allocated by Apex
  */
@@ -11,6 +11,7 @@ extern "C" {
 #endif
 
 #include "apex.h"
+#include <stdint.h>
 
 /**
  * Node types in the AST
@@ -60,55 +61,118 @@ typedef enum {
 } apex_node_type;
 
 /**
- * AST node structure
+ * Node handle: an index into the tree's node pool (0 is "no node")
  */
-typedef struct apex_node {
-    apex_node_type type;
-    struct apex_node *parent;
-    struct apex_node *first_child;
-    struct apex_node *last_child;
-    struct apex_node *prev;
-    struct apex_node *next;
-
-    /* Node data */
-    char *literal;          /**< Text content for text nodes */
-    int start_line;         /**< Source start line */
-    int start_column;       /**< Source start column */
-    int end_line;           /**< Source end line */
-    int end_column;         /**< Source end column */
-
-    /* Type-specific data */
-    union {
-        struct {
-            int level;      /**< Heading level (1-6) */
-        } heading;
-
-        struct {
-            char *info;     /**< Language/info string */
-            bool fenced;    /**< Is fenced code block */
-        } code_block;
-
-        struct {
-            char *url;
-            char *title;
-        } link;
-
-        struct {
-            bool checked;   /**< Task list checkbox state */
-        } task_item;
-
-        struct {
-            char *type;     /**< Callout type (NOTE, WARNING, etc) */
-            char *title;    /**< Callout title */
-            bool collapsible;
-            bool default_open;
-        } callout;
-
-        struct {
-            bool is_inline; /**< Inline vs display math */
-        } math;
-    } data;
-} apex_node;
+typedef uint32_t apex_node_id;
+
+#define APEX_NODE_NONE 0
+
+/**
+ * Byte range of the parsed source
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} apex_span;
+
+/**
+ * Type-specific node data
+ *
+ * - heading: a = level (1-6)
+ * - code block: a = info string (interned, 0 for none)
+ * - link, image: a = URL, b = title (interned, 0 for none)
+ * - callout: a = type, b = title (interned)
+ */
+typedef struct {
+    uint32_t a;
+    uint32_t b;
+} apex_node_data;
+
+/* Node flags */
+#define APEX_NODE_FLAG_FENCED        0x01  /**< Fenced code block */
+#define APEX_NODE_FLAG_CHECKED       0x02  /**< Checked task list item */
+#define APEX_NODE_FLAG_INLINE_MATH   0x04  /**< Inline (not display) math */
+#define APEX_NODE_FLAG_COLLAPSIBLE   0x08  /**< Collapsible callout */
+#define APEX_NODE_FLAG_DEFAULT_OPEN  0x10  /**< Callout open by default */
+
+/**
+ * AST as a node pool
+ *
+ * Nodes live in parallel arrays indexed by apex_node_id, so a traversal
+ * that only looks at types and links touches a few dense arrays instead
+ * of chasing one heap block per node. Text is not copied: literals are
+ * spans into the source buffer, which the tree borrows and which must
+ * outlive it. Info strings, URLs and titles are interned once per tree.
+ */
+typedef struct apex_tree {
+    const char *source;         /**< Parsed text (borrowed) */
+    size_t source_length;
+
+    uint32_t count;             /**< Nodes in use, including the unused slot 0 */
+    uint32_t capacity;
+
+    uint8_t *type;              /**< apex_node_type */
+    uint8_t *flags;             /**< APEX_NODE_FLAG_* */
+    apex_node_id *parent;
+    apex_node_id *first_child;
+    apex_node_id *last_child;
+    apex_node_id *next;
+    uint32_t *line;             /**< Source start line (1-based) */
+    uint32_t *column;           /**< Source start column (1-based) */
+    apex_span *literal;         /**< Text content (length 0 for none) */
+    apex_node_data *data;
+
+    /* Interned strings: ids index string_offsets; text is NUL-terminated in strings */
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+    uint32_t *string_offsets;
+    uint32_t string_count;
+    uint32_t string_capacity;
+    uint32_t *string_slots;     /**< Open-addressing hash of string ids */
+    uint32_t string_slot_count;
+} apex_tree;
+
+/** Root of a tree (the document node) */
+#define APEX_TREE_ROOT 1
+
+static inline apex_node_type apex_tree_node_type(const apex_tree *tree, apex_node_id node) {
+    return (apex_node_type)tree->type[node];
+}
+
+static inline apex_node_id apex_tree_first_child(const apex_tree *tree, apex_node_id node) {
+    return tree->first_child[node];
+}
+
+static inline apex_node_id apex_tree_next(const apex_tree *tree, apex_node_id node) {
+    return tree->next[node];
+}
+
+static inline apex_node_id apex_tree_parent(const apex_tree *tree, apex_node_id node) {
+    return tree->parent[node];
+}
+
+/**
+ * Literal text of a node (not NUL-terminated)
+ *
+ * @param tree Tree
+ * @param node Node
+ * @param length Receives the length in bytes
+ * @return Start of the text in the source buffer
+ */
+static inline const char *apex_tree_literal(const apex_tree *tree, apex_node_id node, size_t *length) {
+    *length = tree->literal[node].length;
+    return tree->source + tree->literal[node].offset;
+}
+
+/**
+ * Interned string by id
+ *
+ * @return NUL-terminated string, or NULL for id 0
+ */
+static inline const char *apex_tree_string(const apex_tree *tree, uint32_t id) {
+    return id ? tree->strings + tree->string_offsets[id] : NULL;
+}
 
 /**
  * Create parser
@@ -126,19 +190,35 @@ void *apex_parser_new(const apex_options *options);
 void apex_parser_free(void *parser);
 
 /**
- * Parse Markdown text into AST
+ * Parse Markdown text into a tree
  *
  * @param parser Parser instance
- * @param markdown Input text
+ * @param markdown Input text; the tree keeps pointing into it
  * @param length Text length
- * @return Root node of AST
+ * @return Tree (root is APEX_TREE_ROOT), or NULL on allocation failure
+ */
+apex_tree *apex_parse(void *parser, const char *markdown, size_t length);
+
+/**
+ * Free a tree and all its nodes
+ *
+ * @param tree Tree to free
+ */
+void apex_tree_free(apex_tree *tree);
+
+/**
+ * Old name for the parse result
+ *
+ * apex_parse used to return a pointer-per-node apex_node. Code that only
+ * passes the result to apex_render_html and apex_node_free still builds;
+ * code that read node fields must use the apex_tree_* accessors instead.
  */
-apex_node *apex_parse(void *parser, const char *markdown, size_t length);
+typedef apex_tree apex_node;
 
 /**
- * Free AST node and all children
+ * Free a tree (same as apex_tree_free)
  *
- * @param node Node to free
+ * @param node Tree returned by apex_parse
  */
 void apex_node_free(apex_node *node);
 
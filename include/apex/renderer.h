@@ -16,20 +16,20 @@ extern "C" {
 /**
  * Render AST to HTML
  *
- * @param root Root node of AST
+ * @param tree Parsed tree
  * @param options Rendering options
  * @return HTML string (must be freed with apex_free)
  */
-char *apex_render_html(apex_node *root, const apex_options *options);
+char *apex_render_html(const apex_tree *tree, const apex_options *options);
 
 /**
  * Render AST to XML
  *
- * @param root Root node of AST
+ * @param tree Parsed tree
  * @param options Rendering options
  * @return XML string (must be freed with apex_free)
  */
-char *apex_render_xml(apex_node *root, const apex_options *options);
+char *apex_render_xml(const apex_tree *tree, const apex_options *options);
 
 #ifdef __cplusplus
 }
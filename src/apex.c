@@ -4,10 +4,20 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <time.h>
-#include <sys/time.h>
+#include <pthread.h>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define APEX_BASE64_NEON 1
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define APEX_BASE64_SSSE3 1
+#endif
 
 /* cmark-gfm headers */
 #include "cmark-gfm.h"
@@ -30,6 +40,7 @@
 #include "extensions/definition_list.h"
 #include "extensions/advanced_footnotes.h"
 #include "extensions/advanced_tables.h"
+#include "extensions/table_grid.h"
 #include "extensions/html_markdown.h"
 #include "extensions/inline_footnotes.h"
 #include "extensions/highlight.h"
@@ -44,6 +55,13 @@
 
 /* Custom renderer */
 #include "html_renderer.h"
+#include "pretty_html.h"
+#include "metrics.h"
+#include "arena.h"
+#include "stream.h"
+#include "ast_cache.h"
+#include "parallel.h"
+#include "subprocess.h"
 
 /**
  * Encode a string as hexadecimal HTML entities (&#xNN;)
@@ -69,51 +87,146 @@ static char *apex_encode_hex_entities(const char *text, size_t len) {
     return out;
 }
 
+static const char apex_base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef APEX_BASE64_NEON
 /**
- * Base64 encode binary data
- * Caller must free the returned buffer.
+ * Encode 48-byte blocks with NEON: vld3 de-interleaves the three bytes of
+ * each group, shifts split them into four 6-bit lanes, and a 64-byte table
+ * lookup maps those to characters that vst4 re-interleaves.
+ * Returns the number of input bytes consumed (a multiple of 48).
  */
-static char *apex_base64_encode(const unsigned char *data, size_t len) {
-    if (!data || len == 0) return NULL;
+static size_t apex_base64_encode_neon(char *dst, const unsigned char *data, size_t len) {
+    const uint8_t *alphabet = (const uint8_t *)apex_base64_chars;
+    uint8x16x4_t lut;
+    lut.val[0] = vld1q_u8(alphabet);
+    lut.val[1] = vld1q_u8(alphabet + 16);
+    lut.val[2] = vld1q_u8(alphabet + 32);
+    lut.val[3] = vld1q_u8(alphabet + 48);
+    const uint8x16_t mask6 = vdupq_n_u8(0x3F);
 
-    static const char base64_chars[] =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 48 <= len; i += 48) {
+        uint8x16x3_t in = vld3q_u8(data + i);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(in.val[0], 2);
+        idx.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[1], 4), vshlq_n_u8(in.val[0], 4)), mask6);
+        idx.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[2], 6), vshlq_n_u8(in.val[1], 2)), mask6);
+        idx.val[3] = vandq_u8(in.val[2], mask6);
+
+        uint8x16x4_t out;
+        out.val[0] = vqtbl4q_u8(lut, idx.val[0]);
+        out.val[1] = vqtbl4q_u8(lut, idx.val[1]);
+        out.val[2] = vqtbl4q_u8(lut, idx.val[2]);
+        out.val[3] = vqtbl4q_u8(lut, idx.val[3]);
+        vst4q_u8((uint8_t *)dst + (i / 3) * 4, out);
+    }
+    return i;
+}
+#endif
 
-    /* Base64 encoding increases size by ~33% (4 chars per 3 bytes) */
-    size_t encoded_len = ((len + 2) / 3) * 4;
-    char *encoded = malloc(encoded_len + 1);
-    if (!encoded) return NULL;
+#ifdef APEX_BASE64_SSSE3
+/**
+ * Encode 12-byte groups with SSSE3: pshufb spreads each 3-byte group over a
+ * 32-bit lane, two 16-bit multiplies move the four 6-bit fields into their
+ * own bytes, and a second pshufb adds the per-range offset to reach ASCII.
+ * Reads 16 bytes per step, so stops while 4 spare input bytes remain.
+ * Returns the number of input bytes consumed (a multiple of 12).
+ */
+__attribute__((target("ssse3")))
+static size_t apex_base64_encode_ssse3(char *dst, const unsigned char *data, size_t len) {
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
 
-    char *out = encoded;
     size_t i = 0;
+    for (; i + 16 <= len; i += 12) {
+        __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i)), spread);
+
+        /* Split each lane into four 6-bit indices, one per byte */
+        __m128i hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                                     _mm_set1_epi32(0x04000040));
+        __m128i lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                                     _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(hi, lo);
 
-    while (i < len) {
-        unsigned char byte1 = data[i++];
-        unsigned char byte2 = (i < len) ? data[i++] : 0;
-        unsigned char byte3 = (i < len) ? data[i++] : 0;
+        /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+        __m128i range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        __m128i chars = _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, range));
 
-        unsigned int combined = (byte1 << 16) | (byte2 << 8) | byte3;
+        _mm_storeu_si128((__m128i *)(dst + (i / 3) * 4), chars);
+    }
+    return i;
+}
 
-        *out++ = base64_chars[(combined >> 18) & 0x3F];
-        *out++ = base64_chars[(combined >> 12) & 0x3F];
+static bool apex_base64_have_ssse3(void) {
+#ifdef __SSSE3__
+    return true;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+#endif
 
-        /* Check if we have at least 2 bytes (byte1 and byte2) */
-        if (i >= 2) {
-            *out++ = base64_chars[(combined >> 6) & 0x3F];
-        } else {
-            *out++ = '=';
-        }
+static char apex_base64_pairs[4096][2];
+static pthread_once_t apex_base64_pairs_once = PTHREAD_ONCE_INIT;
 
-        /* Check if we have all 3 bytes */
-        if (i >= 3) {
-            *out++ = base64_chars[combined & 0x3F];
-        } else {
-            *out++ = '=';
-        }
+static void apex_base64_init_pairs(void) {
+    for (int i = 0; i < 4096; i++) {
+        apex_base64_pairs[i][0] = apex_base64_chars[i >> 6];
+        apex_base64_pairs[i][1] = apex_base64_chars[i & 0x3F];
     }
+}
 
-    *out = '\0';
-    return encoded;
+/**
+ * Base64 encode binary data directly into dst
+ *
+ * Long inputs go through the NEON or SSSE3 block encoder when the target
+ * has one (SSSE3 is detected at run time on x86). The rest uses a
+ * 4096-entry table that maps each 12-bit half of a 3-byte group to two
+ * output characters, so every group is two table loads and two 16-bit
+ * stores. dst must have room for ((len + 2) / 3) * 4 bytes; no terminator
+ * is written. Returns the number of characters written.
+ */
+static size_t apex_base64_encode_into(char *dst, const unsigned char *data, size_t len) {
+    pthread_once(&apex_base64_pairs_once, apex_base64_init_pairs);
+
+    size_t i = 0;
+#if defined(APEX_BASE64_NEON)
+    i = apex_base64_encode_neon(dst, data, len);
+#elif defined(APEX_BASE64_SSSE3)
+    if (apex_base64_have_ssse3()) i = apex_base64_encode_ssse3(dst, data, len);
+#endif
+    char *out = dst + (i / 3) * 4;
+
+    /* Remaining full 3-byte groups */
+    for (; i + 3 <= len; i += 3) {
+        unsigned int combined = ((unsigned int)data[i] << 16) |
+                                ((unsigned int)data[i + 1] << 8) |
+                                (unsigned int)data[i + 2];
+        memcpy(out, apex_base64_pairs[combined >> 12], 2);
+        memcpy(out + 2, apex_base64_pairs[combined & 0xFFF], 2);
+        out += 4;
+    }
+
+    /* Trailing 1 or 2 bytes with padding */
+    if (i < len) {
+        unsigned int combined = (unsigned int)data[i] << 16;
+        bool two = (i + 1 < len);
+        if (two) combined |= (unsigned int)data[i + 1] << 8;
+
+        *out++ = apex_base64_chars[(combined >> 18) & 0x3F];
+        *out++ = apex_base64_chars[(combined >> 12) & 0x3F];
+        *out++ = two ? apex_base64_chars[(combined >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+
+    return (size_t)(out - dst);
 }
 
 /**
@@ -270,43 +383,194 @@ static char *apex_resolve_image_path(const char *filepath, const char *base_dir)
 }
 
 /**
- * Read local image file and encode as base64
+ * Read a local image file and build its complete data URL
+ * (data:<mime>;base64,<payload>) in a single allocation.
  */
-static char *apex_read_and_encode_image(const char *filepath) {
-    if (!filepath) return NULL;
+static char *apex_read_image_data_url(const char *filepath, size_t file_size, size_t *out_len) {
+    if (!filepath || file_size > 10 * 1024 * 1024) return NULL;  /* Limit to 10MB */
 
     FILE *fp = fopen(filepath, "rb");
     if (!fp) return NULL;
 
-    /* Get file size */
-    fseek(fp, 0, SEEK_END);
-    long size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    if (size < 0 || size > 10 * 1024 * 1024) {  /* Limit to 10MB */
+    unsigned char *content = malloc(file_size ? file_size : 1);
+    if (!content) {
         fclose(fp);
         return NULL;
     }
 
-    /* Read content */
-    unsigned char *content = malloc(size);
-    if (!content) {
-        fclose(fp);
+    size_t read = fread(content, 1, file_size, fp);
+    fclose(fp);
+
+    if (read != file_size || file_size == 0) {
+        free(content);
         return NULL;
     }
 
-    size_t read = fread(content, 1, size, fp);
-    fclose(fp);
+    const char *mime_type = apex_detect_mime_type(filepath);
+    size_t mime_len = strlen(mime_type);
+    size_t encoded_len = ((file_size + 2) / 3) * 4;
+    size_t total = 5 + mime_len + 8 + encoded_len;
 
-    if (read != (size_t)size) {
+    char *data_url = malloc(total + 1);
+    if (!data_url) {
         free(content);
         return NULL;
     }
 
-    /* Encode to base64 */
-    char *encoded = apex_base64_encode(content, size);
+    char *w = data_url;
+    memcpy(w, "data:", 5);
+    w += 5;
+    memcpy(w, mime_type, mime_len);
+    w += mime_len;
+    memcpy(w, ";base64,", 8);
+    w += 8;
+    w += apex_base64_encode_into(w, content, file_size);
+    *w = '\0';
     free(content);
-    return encoded;
+
+    if (out_len) *out_len = (size_t)(w - data_url);
+    return data_url;
+}
+
+/**
+ * Process-level cache of embedded image data URLs
+ *
+ * Entries are keyed by resolved path and revalidated against the file's
+ * mtime and size on every lookup, so an image shared by many documents
+ * (logos, icons) is read and encoded once per process rather than once
+ * per <img>. Total cached bytes are capped; past the cap, images are still
+ * embedded but not retained.
+ *
+ * The cache is shared by all threads and guarded by image_cache_lock.
+ * Files are read and encoded outside the lock.
+ */
+#define APEX_IMAGE_CACHE_BUCKETS 256
+#define APEX_IMAGE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct image_cache_entry {
+    char *path;
+    time_t mtime;
+    off_t size;
+    char *data_url;
+    size_t data_url_len;
+    struct image_cache_entry *next;
+} image_cache_entry;
+
+static image_cache_entry *image_cache[APEX_IMAGE_CACHE_BUCKETS];
+static size_t image_cache_bytes = 0;
+static pthread_mutex_t image_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int apex_image_cache_hash(const char *path) {
+    unsigned int hash = 2166136261u;  /* FNV-1a */
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash % APEX_IMAGE_CACHE_BUCKETS;
+}
+
+/**
+ * Look up (or load and insert) the data URL for a local image.
+ * Sets *owned when the returned string was not cached and must be freed
+ * by the caller. A cached (not owned) result stays valid only until
+ * apex_image_cache_release(), which the caller must call after copying it.
+ */
+static const char *apex_image_cache_get(const char *path, const struct stat *st, size_t *len, bool *owned) {
+    *owned = false;
+    unsigned int bucket = apex_image_cache_hash(path);
+
+    pthread_mutex_lock(&image_cache_lock);
+    image_cache_entry *entry = image_cache[bucket];
+    while (entry && strcmp(entry->path, path) != 0) entry = entry->next;
+
+    if (entry && entry->mtime == st->st_mtime && entry->size == st->st_size) {
+        *len = entry->data_url_len;
+        return entry->data_url;
+    }
+    pthread_mutex_unlock(&image_cache_lock);
+
+    size_t data_url_len = 0;
+    char *data_url = apex_read_image_data_url(path, (size_t)st->st_size, &data_url_len);
+    if (!data_url) return NULL;
+
+    /* Another thread may have inserted or replaced the entry meanwhile */
+    pthread_mutex_lock(&image_cache_lock);
+    entry = image_cache[bucket];
+    while (entry && strcmp(entry->path, path) != 0) entry = entry->next;
+
+    if (entry && entry->mtime == st->st_mtime && entry->size == st->st_size) {
+        free(data_url);
+        *len = entry->data_url_len;
+        return entry->data_url;
+    }
+
+    if (entry) {
+        /* File changed since it was cached: replace the stale encoding */
+        image_cache_bytes -= entry->data_url_len;
+        free(entry->data_url);
+        entry->data_url = NULL;
+        entry->data_url_len = 0;
+    }
+
+    if (image_cache_bytes + data_url_len > APEX_IMAGE_CACHE_MAX_BYTES) {
+        pthread_mutex_unlock(&image_cache_lock);
+        *owned = true;
+        *len = data_url_len;
+        return data_url;
+    }
+
+    if (!entry) {
+        entry = calloc(1, sizeof(image_cache_entry));
+        if (!entry || !(entry->path = strdup(path))) {
+            pthread_mutex_unlock(&image_cache_lock);
+            free(entry);
+            *owned = true;
+            *len = data_url_len;
+            return data_url;
+        }
+        entry->next = image_cache[bucket];
+        image_cache[bucket] = entry;
+    }
+
+    entry->mtime = st->st_mtime;
+    entry->size = st->st_size;
+    entry->data_url = data_url;
+    entry->data_url_len = data_url_len;
+    image_cache_bytes += data_url_len;
+
+    *len = data_url_len;
+    return data_url;
+}
+
+/**
+ * Finish using a data URL returned by apex_image_cache_get
+ */
+static void apex_image_cache_release(const char *data_url, bool owned) {
+    if (owned) {
+        free((char *)data_url);
+    } else {
+        pthread_mutex_unlock(&image_cache_lock);
+    }
+}
+
+/**
+ * Release all cached image data URLs
+ */
+void apex_image_cache_clear(void) {
+    pthread_mutex_lock(&image_cache_lock);
+    for (int i = 0; i < APEX_IMAGE_CACHE_BUCKETS; i++) {
+        image_cache_entry *entry = image_cache[i];
+        while (entry) {
+            image_cache_entry *next = entry->next;
+            free(entry->path);
+            free(entry->data_url);
+            free(entry);
+            entry = next;
+        }
+        image_cache[i] = NULL;
+    }
+    image_cache_bytes = 0;
+    pthread_mutex_unlock(&image_cache_lock);
 }
 
 /**
@@ -367,25 +631,17 @@ static char *apex_embed_images(const char *html, const apex_options *options, co
                                         strncmp(url, "https://", 8) == 0 ||
                                         strncmp(url, "//", 2) == 0);
 
-                        char *data_url = NULL;
-                        const char *mime_type = NULL;
+                        const char *data_url = NULL;
+                        size_t data_url_len = 0;
+                        bool data_url_owned = false;
 
                         if (!is_data_url && !is_remote && options->embed_images) {
-                            /* Local image */
+                            /* Local image: encoded once per process via the image cache */
                             char *resolved_path = apex_resolve_image_path(url, base_directory);
                             if (resolved_path) {
                                 struct stat st;
                                 if (stat(resolved_path, &st) == 0 && S_ISREG(st.st_mode)) {
-                                    char *encoded = apex_read_and_encode_image(resolved_path);
-                                    if (encoded) {
-                                        mime_type = apex_detect_mime_type(resolved_path);
-                                        size_t data_url_len = strlen("data:") + strlen(mime_type) + strlen(";base64,") + strlen(encoded) + 1;
-                                        data_url = malloc(data_url_len);
-                                        if (data_url) {
-                                            snprintf(data_url, data_url_len, "data:%s;base64,%s", mime_type, encoded);
-                                        }
-                                        free(encoded);
-                                    }
+                                    data_url = apex_image_cache_get(resolved_path, &st, &data_url_len, &data_url_owned);
                                 }
                                 free(resolved_path);
                             }
@@ -397,13 +653,13 @@ static char *apex_embed_images(const char *html, const apex_options *options, co
                             size_t after_url = img_end - url_end;
 
                             /* Calculate new size needed */
-                            size_t new_len = before_src + strlen("src=\"") + strlen(data_url) + 1 + after_url + 1;
+                            size_t new_len = before_src + strlen("src=\"") + data_url_len + 1 + after_url + 1;
                             if (new_len > remaining) {
                                 size_t written = write - output;
                                 cap = (written + new_len + 1) * 2;
                                 char *new_output = realloc(output, cap);
                                 if (!new_output) {
-                                    free(data_url);
+                                    apex_image_cache_release(data_url, data_url_owned);
                                     free(url);
                                     free(output);
                                     return strdup(html);
@@ -422,7 +678,6 @@ static char *apex_embed_images(const char *html, const apex_options *options, co
                             memcpy(write, "src=\"", 5);
                             write += 5;
                             remaining -= 5;
-                            size_t data_url_len = strlen(data_url);
                             memcpy(write, data_url, data_url_len);
                             write += data_url_len;
                             remaining -= data_url_len;
@@ -435,7 +690,7 @@ static char *apex_embed_images(const char *html, const apex_options *options, co
                             remaining -= after_url;
 
                             read = img_end + 1;
-                            free(data_url);
+                            apex_image_cache_release(data_url, data_url_owned);
                             free(url);
                             continue;
                         }
@@ -2427,6 +2682,7 @@ static void apex_merge_mixed_list_markers(cmark_node *node) {
             /* Remove the now-empty second list */
             cmark_node *next_sibling = cmark_node_next(sibling);
             cmark_node_unlink(sibling);
+            apex_free_node_attributes(sibling);
             cmark_node_free(sibling);
             sibling = next_sibling;
         } else {
@@ -2536,6 +2792,7 @@ apex_options apex_options_default(void) {
 
     /* Stylesheet embedding options */
     opts.embed_stylesheet = false;
+    opts.minify_embedded_stylesheet = false;
 
     /* ARIA accessibility options */
     opts.enable_aria = false;
@@ -2567,6 +2824,20 @@ apex_options apex_options_default(void) {
     opts.progress_callback = NULL;
     opts.progress_user_data = NULL;
 
+    /* Metrics */
+    opts.metrics_callback = NULL;
+    opts.metrics_user_data = NULL;
+
+    /* Dependencies */
+    opts.dependency_callback = NULL;
+    opts.dependency_user_data = NULL;
+
+    /* Memory */
+    opts.use_arena = true;
+
+    /* Parallelism */
+    opts.render_threads = 0;
+
     return opts;
 }
 
@@ -2783,9 +3054,11 @@ static int apex_to_cmark_options(const apex_options *options) {
 /**
  * Register cmark-gfm extensions based on Apex options
  */
+static pthread_once_t apex_core_extensions_once = PTHREAD_ONCE_INIT;
+
 static void apex_register_extensions(cmark_parser *parser, const apex_options *options) {
-    /* Ensure core extensions are registered */
-    cmark_gfm_core_extensions_ensure_registered();
+    /* Ensure core extensions are registered (cmark's own guard is not thread-safe) */
+    pthread_once(&apex_core_extensions_once, cmark_gfm_core_extensions_ensure_registered);
 
     /* Note: Metadata is handled via preprocessing, not as an extension */
 
@@ -2868,27 +3141,182 @@ static void apex_register_extensions(cmark_parser *parser, const apex_options *o
 /**
  * Main conversion function using cmark-gfm
  */
-/* Profiling helpers */
-static double get_time_ms(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+/* Pipeline stages, in order. Every stage reports metrics when it runs;
+ * the ones that did not run are reported as skipped at the end. */
+#define APEX_PIPELINE_STAGES(X) \
+    X(plugins_load) \
+    X(plugins_pre_parse) \
+    X(metadata) \
+    X(metadata_replace_pre) \
+    X(bibliography_load) \
+    X(bibliography_load_meta) \
+    X(citations) \
+    X(indices) \
+    X(autolinks) \
+    X(image_attrs_preprocess) \
+    X(ial_preprocess) \
+    X(spans_preprocess) \
+    X(includes) \
+    X(special_markers) \
+    X(inline_tables) \
+    X(alpha_lists) \
+    X(emoji_autocorrect) \
+    X(inline_footnotes) \
+    X(highlights) \
+    X(sup_sub) \
+    X(relaxed_tables) \
+    X(headerless_tables) \
+    X(table_colspans_preprocess) \
+    X(table_captions_preprocess) \
+    X(definition_lists) \
+    X(fenced_divs) \
+    X(html_markdown) \
+    X(hashtags) \
+    X(proofreader) \
+    X(critic) \
+    X(parsing) \
+    X(ial) \
+    X(image_attrs) \
+    X(plugins_nodes) \
+    X(rendering) \
+    X(table_grids) \
+    X(hr_page_break) \
+    X(widont) \
+    X(code_is_poetry) \
+    X(footnote_hash_ids) \
+    X(page_break_before_footnotes) \
+    X(adjust_header_levels) \
+    X(adjust_quotes) \
+    X(header_ids) \
+    X(obfuscate_emails) \
+    X(embed_images) \
+    X(metadata_replace) \
+    X(toc) \
+    X(aria_labels) \
+    X(block_passes) \
+    X(syntax_highlight) \
+    X(abbreviations) \
+    X(emoji) \
+    X(citations_render) \
+    X(bibliography) \
+    X(index_render) \
+    X(index_insert) \
+    X(html_clean) \
+    X(collapse_intertag_newlines) \
+    X(alpha_lists_postprocess) \
+    X(remove_empty_paragraphs) \
+    X(csv_tables) \
+    X(plugins_post_render) \
+    X(standalone_wrap) \
+    X(pretty_print)
+
+typedef enum {
+#define APEX_STAGE_ENUM(name) APEX_STAGE_##name,
+    APEX_PIPELINE_STAGES(APEX_STAGE_ENUM)
+#undef APEX_STAGE_ENUM
+    APEX_STAGE_total,
+    APEX_STAGE_COUNT
+} apex_stage_id;
+
+static const char *const apex_stage_names[APEX_STAGE_COUNT] = {
+#define APEX_STAGE_NAME(name) #name,
+    APEX_PIPELINE_STAGES(APEX_STAGE_NAME)
+#undef APEX_STAGE_NAME
+    "total"
+};
+
+/* Per-conversion metrics state. APEX_PROFILE is read once per conversion. */
+typedef struct {
+    bool active;                      /* Collecting at all */
+    bool print;                       /* APEX_PROFILE: print timings to stderr */
+    apex_metrics_callback callback;
+    void *user_data;
+    bool ran[APEX_STAGE_COUNT];
+    apex_subprocess_stats subprocesses;  /* Process totals when the conversion began */
+} apex_stage_recorder;
+
+typedef struct {
+    double start;
+    size_t bytes_in;
+    size_t allocations;
+} apex_stage_span;
+
+static void apex_stage_recorder_init(apex_stage_recorder *recorder, const apex_options *options) {
+    memset(recorder, 0, sizeof(*recorder));
+    const char *env = getenv("APEX_PROFILE");
+    recorder->print = env && (strcmp(env, "1") == 0 || strcmp(env, "yes") == 0 || strcmp(env, "true") == 0);
+    if (options) {
+        recorder->callback = options->metrics_callback;
+        recorder->user_data = options->metrics_user_data;
+    }
+    recorder->active = recorder->print || recorder->callback;
+    if (recorder->print) apex_subprocess_stats_get(&recorder->subprocesses);
 }
 
-static bool profiling_enabled(void) {
-    const char *env = getenv("APEX_PROFILE");
-    return env && (strcmp(env, "1") == 0 || strcmp(env, "yes") == 0 || strcmp(env, "true") == 0);
+static void apex_stage_begin(const apex_stage_recorder *recorder, apex_stage_span *span, const char *input) {
+    if (!recorder->active) return;
+    span->bytes_in = input ? strlen(input) : 0;
+    span->allocations = apex_metrics_allocation_count();
+    span->start = apex_metrics_now_ms();
 }
 
-#define PROFILE_START(name) \
-    double name##_start = 0; \
-    if (profiling_enabled()) { name##_start = get_time_ms(); }
+static void apex_stage_end(apex_stage_recorder *recorder, const apex_stage_span *span,
+                           apex_stage_id id, const char *output) {
+    if (!recorder->active) return;
+
+    apex_stage_metrics metrics;
+    metrics.stage = apex_stage_names[id];
+    metrics.duration_ms = apex_metrics_now_ms() - span->start;
+    metrics.bytes_in = span->bytes_in;
+    metrics.bytes_out = output ? strlen(output) : span->bytes_in;
+    metrics.allocations = apex_metrics_allocation_count() - span->allocations;
+    metrics.skipped = false;
+    metrics.timed_out = false;
+    recorder->ran[id] = true;
+
+    if (recorder->print) {
+        fprintf(stderr, "[PROFILE] %-30s: %8.2f ms\n", metrics.stage, metrics.duration_ms);
+    }
+    if (recorder->callback) {
+        recorder->callback(&metrics, recorder->user_data);
+    }
+}
 
-#define PROFILE_END(name) \
-    if (profiling_enabled()) { \
-        double name##_elapsed = get_time_ms() - name##_start; \
-        fprintf(stderr, "[PROFILE] %-30s: %8.2f ms\n", #name, name##_elapsed); \
+/* Report every stage that did not run for this document */
+static void apex_stage_report_skipped(const apex_stage_recorder *recorder) {
+    if (!recorder->callback) return;
+    for (int id = 0; id < APEX_STAGE_total; id++) {
+        if (recorder->ran[id]) continue;
+        apex_stage_metrics metrics = { apex_stage_names[id], 0.0, 0, 0, 0, true, false };
+        recorder->callback(&metrics, recorder->user_data);
     }
+}
+
+/* End of the APEX_PROFILE report: external commands (plugins, syntax
+ * highlighters) started since the conversion began. These are process
+ * totals, so conversions running alongside this one are counted too. */
+static void apex_stage_print_footer(const apex_stage_recorder *recorder) {
+    if (!recorder->print) return;
+
+    apex_subprocess_stats now;
+    apex_subprocess_stats_get(&now);
+    size_t runs = now.runs - recorder->subprocesses.runs;
+    if (runs > 0) {
+        double total_ms = now.total_ms - recorder->subprocesses.total_ms;
+        fprintf(stderr, "[PROFILE] %-30s: %8.2f ms (%zu run, avg %.2f ms, %zu failed, %zu timed out)\n",
+                "subprocesses", total_ms, runs, total_ms / (double)runs,
+                now.failures - recorder->subprocesses.failures,
+                now.timeouts - recorder->subprocesses.timeouts);
+    }
+    fprintf(stderr, "[PROFILE] %-30s: %8s\n", "---", "---");
+}
+
+#define STAGE_START(name, input) \
+    apex_stage_span name##_stage; \
+    apex_stage_begin(&stage_recorder, &name##_stage, (input))
+
+#define STAGE_END(name, output) \
+    apex_stage_end(&stage_recorder, &name##_stage, APEX_STAGE_##name, (output))
 
 /* Progress reporting helper macro */
 #define PROGRESS_REPORT(stage, percent) \
@@ -3471,9 +3899,11 @@ static char *apex_replace_hr_with_pagebreak(const char *html) {
 /**
  * Apply widont to headings: replace spaces with &nbsp; between trailing words
  * when their combined length (including spaces) is <= 10 characters.
+ * Heading tags are matched to the document's headings in order; headings
+ * written in raw HTML are copied as they are.
  * Returns a newly allocated string, or NULL on error.
  */
-static char *apex_apply_widont_to_headings(const char *html) {
+static char *apex_apply_widont_to_headings(const char *html, const apex_heading_table *headings) {
     if (!html) return NULL;
 
     size_t len = strlen(html);
@@ -3485,9 +3915,15 @@ static char *apex_apply_widont_to_headings(const char *html) {
     char *write = output;
     size_t remaining = capacity;
 
+    size_t tag_idx = 0;
+    size_t next_heading = 0;
+
     while (*read) {
         /* Look for heading tags: <h1>, <h2>, ..., <h6> */
-        if (read[0] == '<' && read[1] == 'h' && read[2] >= '1' && read[2] <= '6') {
+        if (read[0] == '<' && read[1] == 'h' && read[2] >= '1' && read[2] <= '6' &&
+            (read[3] == '>' || isspace((unsigned char)read[3])) &&
+            !apex_heading_table_is_raw_tag(headings, tag_idx++, next_heading)) {
+            next_heading++;
             const char *tag_start = read;
             int level = read[2] - '0';
 
@@ -3893,1510 +4329,2008 @@ static char *apex_apply_widont_to_headings(const char *html) {
     return output;
 }
 
-char *apex_markdown_to_html(const char *markdown, size_t len, const apex_options *options) {
-    if (!markdown || len == 0) {
-        char *empty = malloc(1);
-        if (empty) empty[0] = '\0';
-        return empty;
-    }
+static char *apex_wrap_html_document_internal(const char *content, const char *title,
+                                              const char **stylesheet_paths, size_t stylesheet_count,
+                                              const char *code_highlighter, const char *html_header,
+                                              const char *html_footer, const char *language,
+                                              bool embed_stylesheets, bool minify_stylesheets,
+                                              const char *base_directory, bool pretty);
+
+/**
+ * Everything the back half of the pipeline takes from the front half
+ */
+typedef struct {
+    cmark_node *document;
+    bool attribute_render;                 /* IAL, ALDs or image attributes: inject them while rendering */
+    char **liquid_tags;
+    size_t liquid_tag_count;
+    apex_metadata_item *metadata;
+    abbr_item *abbreviations;
+    apex_citation_registry *citations;
+    apex_index_registry *index;
+    apex_plugin_manager *plugins;
+    const char *source;                    /* Markdown the footnote ID hash is computed from */
+    size_t source_len;
+    const char *footnote_hash;             /* Precomputed hash, used instead of source */
+    const apex_csv_tables *csv_tables;     /* Table includes to stream in, or NULL */
+    apex_heading_ids *heading_ids;         /* IDs taken by earlier stream segments, or NULL */
+} apex_parsed_tree;
 
-    PROFILE_START(total);
+/**
+ * Render a parsed tree and run the HTML passes, standalone wrapping and
+ * pretty-printing. Shared by whole conversions and apex_render_document().
+ */
+/* Post-render passes that never look past the top-level block they are in */
+typedef struct {
+    const apex_options *options;
+    abbr_item *abbreviations;
+} apex_block_pass_context;
+
+static bool apex_block_emoji(const apex_options *options) {
+    return options->mode == APEX_MODE_GFM || options->mode == APEX_MODE_UNIFIED;
+}
 
-    /* Use default options if none provided, and create a mutable copy */
-    apex_options default_opts;
-    apex_options local_opts;
-    if (!options) {
-        default_opts = apex_options_default();
-        local_opts = default_opts;
-    } else {
-        local_opts = *options;  /* Make a mutable copy */
+/* Whether any block pass will run. A missing highlighter keeps the serial
+ * path so its warning is printed once. */
+static bool apex_block_passes_enabled(const apex_block_pass_context *context) {
+    const apex_options *options = context->options;
+    if (options->code_highlighter && !apex_syntax_highlighter_available(options->code_highlighter)) {
+        return false;
     }
-    /* Use local_opts for rest of function (mutable) - shadow the const parameter */
-    #define options (&local_opts)
+    return options->code_highlighter || context->abbreviations || apex_block_emoji(options);
+}
 
-    /* Extract metadata if enabled (preprocessing step) */
-    /* Safety check: ensure len doesn't exceed actual string length */
-    size_t actual_len = strlen(markdown);
-    if (len > actual_len) len = actual_len;
+/* Same passes, same order as the serial pipeline, on one chunk of blocks */
+static char *apex_run_block_passes(const char *chunk, void *arg) {
+    const apex_block_pass_context *context = arg;
+    const apex_options *options = context->options;
+    char *html = strdup(chunk);
 
-    /* Create working copy of input text */
-    char *working_text = malloc(len + 1);
-    if (!working_text) return NULL;
-    memcpy(working_text, markdown, len);
-    working_text[len] = '\0';
+    if (options->code_highlighter && html) {
+        char *highlighted = apex_highlight_code_blocks(html, options->code_highlighter,
+                                                       options->code_line_numbers,
+                                                       options->highlight_language_only);
+        if (highlighted && highlighted != html) {
+            free(html);
+            html = highlighted;
+        }
+    }
 
-    /* Discover plugins once per conversion. This currently supports
-     * text-level pre-parse plugins described by simple YAML manifests
-     * in project and global plugin directories.
-     */
-    apex_plugin_manager *plugin_manager = NULL;
-    if (options->enable_plugins) {
-        plugin_manager = apex_plugins_load(options);
+    if (context->abbreviations && html) {
+        char *with_abbrs = apex_replace_abbreviations(html, context->abbreviations);
+        if (with_abbrs) {
+            free(html);
+            html = with_abbrs;
+        }
     }
 
-    /* Optional pre-parse plugin hook: run all configured pre_parse plugins
-     * over the raw markdown before any Apex-specific preprocessing.
-     */
-    if (plugin_manager) {
-        char *plugin_text = apex_plugins_run_text_phase(plugin_manager,
-                                                        APEX_PLUGIN_PHASE_PRE_PARSE,
-                                                        working_text,
-                                                        options);
-        if (plugin_text) {
-            free(working_text);
-            working_text = plugin_text;
-            len = strlen(working_text);
+    if (apex_block_emoji(options) && html) {
+        char *with_emoji = apex_replace_emoji(html);
+        if (with_emoji) {
+            free(html);
+            html = with_emoji;
         }
     }
 
-    apex_metadata_item *metadata = NULL;
-    abbr_item *abbreviations = NULL;
-    ald_entry *alds = NULL;
-    char *text_ptr = working_text;
-    /* Liquid tag placeholders (for {% ... %} tags) */
-    char **liquid_tags = NULL;
-    size_t liquid_tag_count = 0;
-    char *liquid_protected = NULL;
+    return html;
+}
 
+/* The document's headings for the passes that need them (widont, header
+ * levels, IDs, TOC), collected by the first of them to run */
+static const apex_heading_table *apex_tree_headings(apex_heading_table **table, const apex_parsed_tree *tree,
+                                                    const apex_options *options) {
+    if (!*table) {
+        *table = apex_heading_table_build(tree->document, (apex_id_format_t)options->id_format, options->unsafe,
+                                          tree->heading_ids);
+    }
+    return *table;
+}
 
-    if (options->mode == APEX_MODE_MULTIMARKDOWN ||
-        options->mode == APEX_MODE_KRAMDOWN ||
-        options->mode == APEX_MODE_UNIFIED) {
-        /* Extract metadata FIRST */
-        PROFILE_START(metadata);
-        metadata = apex_extract_metadata(&text_ptr);
-        PROFILE_END(metadata);
+/* Whether the document has headings of its own (widont and header levels
+ * leave raw HTML headings alone); true if the table could not be built */
+static bool apex_tree_has_headings(apex_heading_table **table, const apex_parsed_tree *tree,
+                                   const apex_options *options) {
+    const apex_heading_table *headings = apex_tree_headings(table, tree, options);
+    return !headings || headings->count > 0;
+}
 
-        /* Extract ALDs for Kramdown */
-        if (options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
-            alds = apex_extract_alds(&text_ptr);
-        }
+static char *apex_render_parsed_tree(const apex_parsed_tree *tree, const apex_options *render_options,
+                                     apex_stage_recorder *recorder) {
+    apex_options local_opts = *render_options;
+    #define options (&local_opts)
+    #define stage_recorder (*recorder)
+
+    cmark_node *document = tree->document;
+    apex_metadata_item *metadata = tree->metadata;
+    abbr_item *abbreviations = tree->abbreviations;
+    apex_citation_registry *citation_registry = tree->citations;
+    apex_index_registry *index_registry = tree->index;
+    apex_plugin_manager *plugin_manager = tree->plugins;
+    int cmark_opts = apex_to_cmark_options(options);
 
-        /* Extract abbreviations */
-        abbreviations = apex_extract_abbreviations(&text_ptr);
+    /* Render to HTML
+     * Use custom renderer when we have attributes (IAL, ALDs, or image attributes)
+     * Otherwise use standard renderer
+     */
+    STAGE_START(rendering, NULL);
+    char *html;
+    if (tree->attribute_render) {
+        /* Use custom renderer to inject attributes */
+        html = apex_render_html_with_attributes(document, cmark_opts);
+    } else {
+        /* Output is freed with free(), so never render into the arena */
+        html = cmark_render_html_with_mem(document, cmark_opts, NULL, cmark_get_default_mem_allocator());
     }
+    STAGE_END(rendering, html);
 
-    /* Check metadata for bibliography and enable citations if found */
-    if (metadata && !local_opts.enable_citations) {
-        const char *bib_value = apex_metadata_get(metadata, "bibliography");
-        if (bib_value) {
-            local_opts.enable_citations = true;
+    /* Restore any protected Liquid tags in the rendered HTML */
+    if (html && tree->liquid_tags && tree->liquid_tag_count > 0) {
+        char *restored_html = apex_restore_liquid_tags(html, tree->liquid_tags, tree->liquid_tag_count);
+        if (restored_html) {
+            free(html);
+            html = restored_html;
         }
-        const char *csl_value = apex_metadata_get(metadata, "csl");
-        if (csl_value) {
-            local_opts.enable_citations = true;
+    }
+
+    /* Apply advanced table spans, footers, row headers and captions, drop
+     * dash-only separator rows and turn relaxed tables' made-up header
+     * rows into body rows */
+    if (options->enable_tables && html) {
+        STAGE_START(table_grids, html);
+        char *processed_html = apex_render_table_grids(html, document, options->caption_position, options->unsafe,
+                                                        options->relaxed_tables);
+        STAGE_END(table_grids, processed_html);
+        if (processed_html && processed_html != html) {
+            free(html);
+            html = processed_html;
         }
     }
 
-    /* Apply metadata variable replacement BEFORE autolinking
-     * This ensures replaced URLs get autolinked
-     */
-    char *metadata_replaced = NULL;
-    if (metadata && options->enable_metadata_variables) {
-        PROFILE_START(metadata_replace_pre);
-        metadata_replaced = apex_metadata_replace_variables(text_ptr, metadata, options);
-        PROFILE_END(metadata_replace_pre);
-        if (metadata_replaced) {
-            text_ptr = metadata_replaced;
+    /* Replace <hr> elements with Marked-style page breaks if requested */
+    if (options->hr_page_break && html) {
+        STAGE_START(hr_page_break, html);
+        char *processed_html = apex_replace_hr_with_pagebreak(html);
+        STAGE_END(hr_page_break, processed_html);
+        if (processed_html && processed_html != html) {
+            free(html);
+            html = processed_html;
         }
     }
 
-    /* Load bibliography files if provided (before processing citations)
-     * Check both CLI bibliography files and metadata bibliography
-     * Only load bibliography if files are actually specified - this avoids
-     * unnecessary file I/O and parsing when citations aren't being used
-     */
-    apex_bibliography_registry *bibliography = NULL;
+    apex_heading_table *headings = NULL;
 
-    /* Load from CLI bibliography files if specified */
-    if (options->bibliography_files) {
-        PROFILE_START(bibliography_load);
-        bibliography = apex_load_bibliography((const char **)options->bibliography_files, options->base_directory);
-        PROFILE_END(bibliography_load);
+    /* Apply widont to headings if requested */
+    if (options->enable_widont && html && apex_tree_has_headings(&headings, tree, options)) {
+        STAGE_START(widont, html);
+        char *processed_html = apex_apply_widont_to_headings(html, headings);
+        STAGE_END(widont, processed_html);
+        if (processed_html && processed_html != html) {
+            free(html);
+            html = processed_html;
+        }
     }
 
-    /* Also check metadata for bibliography (merge with CLI bibliography if both exist) */
-    if (metadata) {
-        const char *bib_value = apex_metadata_get(metadata, "bibliography");
-        if (bib_value) {
-            PROFILE_START(bibliography_load_meta);
-            /* Load bibliography from metadata */
-            char *resolved_path = NULL;
-            if (options->base_directory) {
-                size_t base_len = strlen(options->base_directory);
-                size_t bib_len = strlen(bib_value);
-                resolved_path = malloc(base_len + bib_len + 2);
-                if (resolved_path) {
-                    strcpy(resolved_path, options->base_directory);
-                    if (resolved_path[base_len - 1] != '/') {
-                        resolved_path[base_len] = '/';
-                        base_len++;
-                    }
-                    strcpy(resolved_path + base_len, bib_value);
-                }
-            } else {
-                resolved_path = strdup(bib_value);
+    /* Add poetry class to code blocks without language if requested */
+    if (options->code_is_poetry && html) {
+        STAGE_START(code_is_poetry, html);
+        char *processed_html = apex_add_poetry_class_to_code_blocks(html);
+        STAGE_END(code_is_poetry, processed_html);
+        if (processed_html && processed_html != html) {
+            free(html);
+            html = processed_html;
+        }
+    }
+
+    /* Add hash prefix to footnote IDs if requested */
+    if (options->random_footnote_ids && html) {
+        STAGE_START(footnote_hash_ids, html);
+        /* Hash of the original markdown content */
+        char *hash_prefix = tree->footnote_hash ? strdup(tree->footnote_hash)
+                                                : apex_compute_document_hash(tree->source, tree->source_len);
+        if (hash_prefix) {
+            char *processed_html = apex_add_hash_to_footnote_ids(html, hash_prefix);
+            if (processed_html && processed_html != html) {
+                free(html);
+                html = processed_html;
             }
+            free(hash_prefix);
+        }
+        STAGE_END(footnote_hash_ids, html);
+    }
 
-            if (resolved_path) {
-                apex_bibliography_registry *meta_bib = apex_load_bibliography_file(resolved_path);
-                if (meta_bib) {
-                    if (bibliography) {
-                        /* Merge with existing bibliography */
-                        apex_bibliography_entry *entry = meta_bib->entries;
-                        while (entry) {
-                            apex_bibliography_entry *next = entry->next;
-                            if (!apex_find_bibliography_entry(bibliography, entry->id)) {
-                                entry->next = bibliography->entries;
-                                bibliography->entries = entry;
-                                bibliography->count++;
-                            } else {
-                                apex_bibliography_entry_free(entry);
-                            }
-                            entry = next;
-                        }
-                        free(meta_bib);
-                    } else {
-                        /* Use metadata bibliography as the main bibliography */
-                        bibliography = meta_bib;
-                    }
-                }
-                free(resolved_path);
+    /* Insert page break before footnotes section if requested */
+    if (options->page_break_before_footnotes && html) {
+        STAGE_START(page_break_before_footnotes, html);
+        const char *marker = "<section class=\"footnotes\"";
+        char *pos = strstr(html, marker);
+        if (pos) {
+            const char *replacement =
+                "<div class=\"mkpagebreak manualbreak\" "
+                "title=\"Page break created before footnotes\" "
+                "data-description=\"PAGE (Footnotes)\" "
+                "style=\"page-break-after:always\">"
+                "<span style=\"display:none\">&nbsp;</span></div>";
+            size_t html_len = strlen(html);
+            size_t prefix_len = (size_t)(pos - html);
+            size_t repl_len = strlen(replacement);
+            size_t new_len = html_len + repl_len;
+            char *with_break = malloc(new_len + 1);
+            if (with_break) {
+                memcpy(with_break, html, prefix_len);
+                memcpy(with_break + prefix_len, replacement, repl_len);
+                memcpy(with_break + prefix_len + repl_len, pos, html_len - prefix_len);
+                with_break[new_len] = '\0';
+                free(html);
+                html = with_break;
             }
-            PROFILE_END(bibliography_load_meta);
         }
+        STAGE_END(page_break_before_footnotes, html);
     }
 
-    /* Process citations BEFORE autolinking to prevent @ symbols from being converted to mailto links
-     * Citations like [@key] need to be processed before autolinking sees the @ symbol
-     * Only process citations if bibliography is actually loaded or citations are explicitly enabled
-     */
-    apex_citation_registry citation_registry = {0};
-    citation_registry.bibliography = bibliography;
-    char *citations_processed = NULL;
+    /* Extract metadata values needed for standalone HTML and post-processing BEFORE freeing metadata */
+    /* We need to duplicate strings because metadata will be freed */
+    char *css_metadata = NULL;
+    char *html_header_metadata = NULL;
+    char *html_footer_metadata = NULL;
+    char *language_metadata = NULL;
+    char *quotes_lang_metadata = NULL;
+    int base_header_level = 1;  /* Default is 1 */
 
-    /* Check if we should process citations: bibliography loaded, CLI files specified, CSL specified, or metadata bibliography */
-    bool should_process_citations = false;
-    if (bibliography) {
-        should_process_citations = true;
-    } else if (options->bibliography_files) {
-        should_process_citations = true;
-    } else if (options->csl_file) {
-        should_process_citations = true;
-    } else if (metadata) {
-        const char *bib_value = apex_metadata_get(metadata, "bibliography");
-        const char *csl_value = apex_metadata_get(metadata, "csl");
-        if (bib_value || csl_value) {
-            should_process_citations = true;
-        }
-    }
+    if (metadata) {
+        /* Extract values we'll need later (before metadata is freed) and duplicate them */
+        const char *css_val = apex_metadata_get(metadata, "css");
+        if (css_val) css_metadata = strdup(css_val);
 
-    if (options->enable_citations && should_process_citations) {
-        PROGRESS_REPORT("Processing citations", -1);
-        PROFILE_START(citations);
-        citations_processed = apex_process_citations(text_ptr, &citation_registry, options);
-        PROFILE_END(citations);
-        if (citations_processed) {
-            text_ptr = citations_processed;
+        const char *html_header_val = apex_metadata_get(metadata, "HTML Header");
+        if (!html_header_val) {
+            html_header_val = apex_metadata_get(metadata, "html header");
         }
-    }
+        if (html_header_val) html_header_metadata = strdup(html_header_val);
 
-    /* Process index entries (preprocessing) */
-    apex_index_registry index_registry = {0};
-    char *indices_processed = NULL;
-    if (options->enable_indices) {
-        PROGRESS_REPORT("Processing indices", -1);
-        PROFILE_START(indices);
-        indices_processed = apex_process_index_entries(text_ptr, &index_registry, options);
-        PROFILE_END(indices);
-        if (indices_processed) {
-            text_ptr = indices_processed;
+        const char *html_footer_val = apex_metadata_get(metadata, "HTML Footer");
+        if (!html_footer_val) {
+            html_footer_val = apex_metadata_get(metadata, "html footer");
         }
-    }
+        if (html_footer_val) html_footer_metadata = strdup(html_footer_val);
 
-    /* Preprocess autolinks to convert <https://...> to [https://...](https://...)
-     * This must happen after citation processing so @ symbols in citations aren't autolinked
-     * Note: Even with autolink extension enabled, preprocessing ensures compatibility
-     */
-    char *autolinks_processed = NULL;
-    if (options->enable_autolink) {
-        PROGRESS_REPORT("Processing autolinks", -1);
-        PROFILE_START(autolinks);
-        autolinks_processed = apex_preprocess_autolinks(text_ptr, options);
-        PROFILE_END(autolinks);
-        if (autolinks_processed) {
-            text_ptr = autolinks_processed;
+        const char *lang_val = apex_metadata_get(metadata, "language");
+        if (lang_val) language_metadata = strdup(lang_val);
+
+        /* Get quotes language */
+        const char *quotes_lang_val = apex_metadata_get(metadata, "Quotes Language");
+        if (!quotes_lang_val) {
+            quotes_lang_val = apex_metadata_get(metadata, "quotes language");
         }
-    }
+        if (!quotes_lang_val) {
+            quotes_lang_val = apex_metadata_get(metadata, "quoteslanguage");
+        }
+        /* If language is set but quotes language is not, use language for quotes */
+        if (!quotes_lang_val && lang_val) {
+            quotes_lang_val = lang_val;
+        }
+        if (quotes_lang_val) quotes_lang_metadata = strdup(quotes_lang_val);
 
-    /* Preprocess image attributes and URL-encode all link URLs */
-    image_attr_entry *img_attrs = NULL;
-    char *image_attrs_processed = NULL;
-    if (options->mode == APEX_MODE_UNIFIED ||
-        options->mode == APEX_MODE_MULTIMARKDOWN ||
-        options->mode == APEX_MODE_KRAMDOWN) {
-        PROFILE_START(image_attrs_preprocess);
-        image_attrs_processed = apex_preprocess_image_attributes(text_ptr, &img_attrs, options->mode);
-        PROFILE_END(image_attrs_preprocess);
-        if (image_attrs_processed) {
-            text_ptr = image_attrs_processed;
+        /* Get header level */
+        const char *header_level_str = apex_metadata_get(metadata, "HTML Header Level");
+        if (!header_level_str) {
+            header_level_str = apex_metadata_get(metadata, "Base Header Level");
+        }
+        if (header_level_str) {
+            char *endptr;
+            long level = strtol(header_level_str, &endptr, 10);
+            if (endptr != header_level_str && level >= 1 && level <= 6) {
+                base_header_level = (int)level;
+            }
         }
     }
 
-    /* Preprocess IAL markers (insert blank lines before them so cmark parses correctly) */
-    char *ial_preprocessed = NULL;
-    if (options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
-        PROFILE_START(ial_preprocess);
-        ial_preprocessed = apex_preprocess_ial(text_ptr);
-        PROFILE_END(ial_preprocess);
-        if (ial_preprocessed) {
-            text_ptr = ial_preprocessed;
+    /* Adjust header levels and quote language based on metadata */
+    if (html) {
+        if (base_header_level > 1 && apex_tree_has_headings(&headings, tree, options)) {
+            STAGE_START(adjust_header_levels, html);
+            char *adjusted_html = apex_adjust_header_levels(html, base_header_level, headings);
+            STAGE_END(adjust_header_levels, adjusted_html);
+            if (adjusted_html) {
+                free(html);
+                html = adjusted_html;
+            }
         }
-    }
 
-    /* Preprocess bracketed spans [text]{IAL} */
-    char *spans_preprocessed = NULL;
-    if (options->enable_spans && (options->mode == APEX_MODE_UNIFIED || options->mode == APEX_MODE_KRAMDOWN)) {
-        PROFILE_START(spans_preprocess);
-        spans_preprocessed = apex_preprocess_bracketed_spans(text_ptr);
-        PROFILE_END(spans_preprocess);
-        if (spans_preprocessed) {
-            text_ptr = spans_preprocessed;
+        if (quotes_lang_metadata) {
+            STAGE_START(adjust_quotes, html);
+            char *adjusted_quotes = apex_adjust_quote_language(html, quotes_lang_metadata);
+            STAGE_END(adjust_quotes, adjusted_quotes);
+            if (adjusted_quotes) {
+                free(html);
+                html = adjusted_quotes;
+            }
         }
     }
 
-    /* Process file includes before parsing (preprocessing) */
-    char *includes_processed = NULL;
-    if (options->enable_file_includes) {
-        PROFILE_START(includes);
-        includes_processed = apex_process_includes(text_ptr, options->base_directory, metadata, 0);
-        PROFILE_END(includes);
-        if (includes_processed) {
-            text_ptr = includes_processed;
+    /* Inject header IDs if enabled */
+    if (options->generate_header_ids && html) {
+        STAGE_START(header_ids, html);
+        char *processed_html = apex_inject_header_ids(html, apex_tree_headings(&headings, tree, options),
+                                                      options->header_anchors);
+        STAGE_END(header_ids, processed_html);
+        if (processed_html && processed_html != html) {
+            free(html);
+            html = processed_html;
         }
     }
 
-    /* Process special markers (^ end-of-block marker) and inline tables BEFORE alpha lists */
-    /* This ensures ^ markers and inline table markers are converted before alpha list processing */
-    char *markers_processed_early = NULL;
-    if (options->enable_marked_extensions) {
-        PROFILE_START(special_markers);
-        markers_processed_early = apex_process_special_markers(text_ptr);
-        PROFILE_END(special_markers);
-        if (markers_processed_early) {
-            text_ptr = markers_processed_early;
+    /* Obfuscate email links if requested */
+    if (options->obfuscate_emails && html) {
+        STAGE_START(obfuscate_emails, html);
+        char *obfuscated = apex_obfuscate_email_links(html);
+        STAGE_END(obfuscate_emails, obfuscated);
+        if (obfuscated) {
+            free(html);
+            html = obfuscated;
         }
     }
 
-    /* Process inline table fences and <!--TABLE--> markers before parsing */
-    char *inline_tables_processed = NULL;
-    PROFILE_START(inline_tables);
-    inline_tables_processed = apex_process_inline_tables(text_ptr);
-    PROFILE_END(inline_tables);
-    if (inline_tables_processed) {
-        text_ptr = inline_tables_processed;
+    /* Embed images as base64 data URLs if requested (local images only) */
+    if (options->embed_images && html) {
+        STAGE_START(embed_images, html);
+        char *embedded = apex_embed_images(html, options, options->base_directory);
+        STAGE_END(embed_images, embedded);
+        if (embedded) {
+            free(html);
+            html = embedded;
+        }
     }
 
-    /* Process alpha lists before parsing (preprocessing) */
-    char *alpha_lists_processed = NULL;
-    if (options->allow_alpha_lists) {
-        PROFILE_START(alpha_lists);
-        alpha_lists_processed = apex_preprocess_alpha_lists(text_ptr);
-        PROFILE_END(alpha_lists);
-        if (alpha_lists_processed) {
-            text_ptr = alpha_lists_processed;
+    /* Apply metadata variable replacement if enabled (post-processing for HTML attributes, etc.)
+     * Note: Most replacements happen in preprocessing, but this handles edge cases in HTML
+     */
+    if (metadata && options->enable_metadata_variables && html) {
+        STAGE_START(metadata_replace, html);
+        char *replaced = apex_metadata_replace_variables(html, metadata, options);
+        STAGE_END(metadata_replace, replaced);
+        if (replaced && replaced != html) {
+            free(html);
+            html = replaced;
+        } else if (replaced == html) {
+            /* No replacements found, free the duplicate */
+            free(replaced);
         }
     }
 
-    /* Process emoji autocorrect before parsing (preprocessing) */
-    char *emoji_autocorrect_processed = NULL;
-    if (options->enable_emoji_autocorrect && (options->mode == APEX_MODE_UNIFIED || options->mode == APEX_MODE_GFM)) {
-        PROFILE_START(emoji_autocorrect);
-        emoji_autocorrect_processed = apex_autocorrect_emoji_names(text_ptr);
-        PROFILE_END(emoji_autocorrect);
-        if (emoji_autocorrect_processed) {
-            text_ptr = emoji_autocorrect_processed;
+    /* Process TOC markers if enabled (Marked extensions) */
+    if (options->enable_marked_extensions && html) {
+        STAGE_START(toc, html);
+        char *with_toc = apex_process_toc(html, apex_tree_headings(&headings, tree, options));
+        STAGE_END(toc, with_toc);
+        if (with_toc) {
+            free(html);
+            html = with_toc;
         }
     }
 
-    /* Process inline footnotes before parsing (Kramdown ^[...] and MMD [^... ...]) */
-    char *inline_footnotes_processed = NULL;
-    if (options->enable_footnotes) {
-        PROFILE_START(inline_footnotes);
-        inline_footnotes_processed = apex_process_inline_footnotes(text_ptr);
-        PROFILE_END(inline_footnotes);
-        if (inline_footnotes_processed) {
-            text_ptr = inline_footnotes_processed;
+    /* Apply ARIA labels if enabled */
+    if (options->enable_aria && html) {
+        STAGE_START(aria_labels, html);
+        char *aria_html = apex_apply_aria_labels(html, document);
+        STAGE_END(aria_labels, aria_html);
+        if (aria_html && aria_html != html) {
+            free(html);
+            html = aria_html;
         }
     }
 
-    /* Process ==highlight== syntax before parsing
-     * Skip if proofreader mode is enabled (proofreader will handle it via CriticMarkup) */
-    char *highlights_processed = NULL;
-    if (!options->proofreader_mode) {
-        PROFILE_START(highlights);
-        highlights_processed = apex_process_highlights(text_ptr);
-        PROFILE_END(highlights);
-        if (highlights_processed) {
-            text_ptr = highlights_processed;
+    /* On large documents, run the block-local passes below (highlighting,
+     * abbreviations, emoji) on top-level blocks in parallel. Everything
+     * that needs the whole document has run by now. */
+    bool block_passes_done = false;
+    apex_block_pass_context block_context = { options, abbreviations };
+    if (options->render_threads > 1 && html && apex_block_passes_enabled(&block_context)) {
+        STAGE_START(block_passes, html);
+        char *processed = apex_parallel_block_pass(html, options->render_threads,
+                                                   apex_run_block_passes, &block_context);
+        STAGE_END(block_passes, processed);
+        if (processed) {
+            free(html);
+            html = processed;
+            block_passes_done = true;
         }
     }
 
-    /* Process superscript and subscript syntax before parsing */
-    char *sup_sub_processed = NULL;
-    if (options->enable_sup_sub) {
-        PROFILE_START(sup_sub);
-        sup_sub_processed = apex_process_sup_sub(text_ptr);
-        PROFILE_END(sup_sub);
-        if (sup_sub_processed) {
-            text_ptr = sup_sub_processed;
+    /* Apply external syntax highlighting if requested */
+    if (!block_passes_done && options->code_highlighter && html) {
+        STAGE_START(syntax_highlight, html);
+        char *highlighted = apex_apply_syntax_highlighting(html, options->code_highlighter, options->code_line_numbers, options->highlight_language_only);
+        STAGE_END(syntax_highlight, highlighted);
+        if (highlighted && highlighted != html) {
+            free(html);
+            html = highlighted;
         }
     }
 
-    /* Process relaxed tables before parsing (preprocessing) */
-    char *relaxed_tables_processed = NULL;
-    char *normalized_for_relaxed = NULL;
-    if (options->relaxed_tables && options->enable_tables) {
-        /* Normalize text_ptr for relaxed tables processing if it doesn't end with newline */
-        size_t pre_relaxed_len = strlen(text_ptr);
-        bool needs_newline_for_relaxed = (pre_relaxed_len > 0 &&
-                                          text_ptr[pre_relaxed_len - 1] != '\n' &&
-                                          text_ptr[pre_relaxed_len - 1] != '\r');
-        if (needs_newline_for_relaxed) {
-            normalized_for_relaxed = malloc(pre_relaxed_len + 2);
-            if (normalized_for_relaxed) {
-                memcpy(normalized_for_relaxed, text_ptr, pre_relaxed_len);
-                normalized_for_relaxed[pre_relaxed_len] = '\n';
-                normalized_for_relaxed[pre_relaxed_len + 1] = '\0';
-            }
+    /* Replace abbreviations if any were found */
+    if (!block_passes_done && abbreviations && html) {
+        STAGE_START(abbreviations, html);
+        char *with_abbrs = apex_replace_abbreviations(html, abbreviations);
+        STAGE_END(abbreviations, with_abbrs);
+        if (with_abbrs) {
+            free(html);
+            html = with_abbrs;
         }
+    }
 
-        PROGRESS_REPORT("Processing relaxed tables", -1);
-        PROFILE_START(relaxed_tables);
-        relaxed_tables_processed = apex_process_relaxed_tables(normalized_for_relaxed ? normalized_for_relaxed : text_ptr);
-        PROFILE_END(relaxed_tables);
-        /* Refresh progress after processing completes (in case it took a while) */
-        PROGRESS_REPORT(NULL, -1);  /* NULL stage = refresh last known stage */
-
-        /* Handle cleanup */
-        if (normalized_for_relaxed) {
-            if (relaxed_tables_processed) {
-                /* Processing returned a new buffer - free our normalization buffer */
-                free(normalized_for_relaxed);
-            } else {
-                /* Processing returned NULL - free normalization buffer and continue with original */
-                free(normalized_for_relaxed);
-            }
+    /* Replace GitHub emoji if in GFM or Unified mode */
+    if (!block_passes_done && (options->mode == APEX_MODE_GFM || options->mode == APEX_MODE_UNIFIED) && html) {
+        STAGE_START(emoji, html);
+        char *with_emoji = apex_replace_emoji(html);
+        STAGE_END(emoji, with_emoji);
+        if (with_emoji) {
+            free(html);
+            html = with_emoji;
         }
+    }
 
-        if (relaxed_tables_processed) {
-            text_ptr = relaxed_tables_processed;
+    /* Render citations in HTML if enabled and bibliography is available */
+    bool should_render_citations = false;
+    if (citation_registry->bibliography) {
+        should_render_citations = true;
+    } else if (options->bibliography_files) {
+        should_render_citations = true;
+    } else if (options->csl_file) {
+        should_render_citations = true;
+    } else if (metadata) {
+        const char *bib_value = apex_metadata_get(metadata, "bibliography");
+        const char *csl_value = apex_metadata_get(metadata, "csl");
+        if (bib_value || csl_value) {
+            should_render_citations = true;
         }
     }
 
-    /* Process headerless tables before parsing (preprocessing)
-     * Detect separator rows without header rows and insert dummy headers
-     * This must run after relaxed tables processing
-     */
-    char *headerless_tables_processed = NULL;
-    char *normalized_for_headerless = NULL;
-    if (options->enable_tables) {
-        /* Normalize text_ptr for headerless tables processing if it doesn't end with newline */
-        size_t pre_headerless_len = strlen(text_ptr);
-        bool needs_newline_for_headerless = (pre_headerless_len > 0 &&
-                                             text_ptr[pre_headerless_len - 1] != '\n' &&
-                                             text_ptr[pre_headerless_len - 1] != '\r');
-        if (needs_newline_for_headerless) {
-            normalized_for_headerless = malloc(pre_headerless_len + 2);
-            if (normalized_for_headerless) {
-                memcpy(normalized_for_headerless, text_ptr, pre_headerless_len);
-                normalized_for_headerless[pre_headerless_len] = '\n';
-                normalized_for_headerless[pre_headerless_len + 1] = '\0';
+    if (options->enable_citations && html && should_render_citations) {
+        if (citation_registry->count > 0) {
+            STAGE_START(citations_render, html);
+            char *with_citations = apex_render_citations(html, citation_registry, options);
+            STAGE_END(citations_render, with_citations);
+            if (with_citations) {
+                free(html);
+                html = with_citations;
             }
         }
 
-        PROFILE_START(headerless_tables);
-        headerless_tables_processed = apex_process_headerless_tables(normalized_for_headerless ? normalized_for_headerless : text_ptr);
-        PROFILE_END(headerless_tables);
-
-        /* Handle cleanup */
-        if (normalized_for_headerless) {
-            if (headerless_tables_processed) {
-                /* Processing returned a new buffer - free our normalization buffer */
-                free(normalized_for_headerless);
-            } else {
-                /* Processing returned NULL - free normalization buffer and continue with original */
-                free(normalized_for_headerless);
+        /* Insert bibliography at marker or end of document (even if no citations, if bibliography loaded) */
+        if (html && !options->suppress_bibliography && citation_registry->bibliography) {
+            STAGE_START(bibliography, html);
+            char *with_bibliography = apex_insert_bibliography(html, citation_registry, options);
+            STAGE_END(bibliography, with_bibliography);
+            if (with_bibliography) {
+                free(html);
+                html = with_bibliography;
             }
         }
-
-        if (headerless_tables_processed) {
-            text_ptr = headerless_tables_processed;
-        }
     }
 
-    /* Preprocess table rows to convert consecutive pipes (|||) to << markers for colspan
-     * This must run after headerless table processing but before caption processing
-     */
-    char *table_colspans_processed = NULL;
-    char *normalized_for_colspans = NULL;
-    if (options->enable_tables) {
-        /* Normalize text_ptr for table colspan preprocessing if it doesn't end with newline */
-        size_t pre_colspans_len = strlen(text_ptr);
-        bool needs_newline_for_colspans = (pre_colspans_len > 0 &&
-                                           text_ptr[pre_colspans_len - 1] != '\n' &&
-                                           text_ptr[pre_colspans_len - 1] != '\r');
-        if (needs_newline_for_colspans) {
-            normalized_for_colspans = malloc(pre_colspans_len + 2);
-            if (normalized_for_colspans) {
-                memcpy(normalized_for_colspans, text_ptr, pre_colspans_len);
-                normalized_for_colspans[pre_colspans_len] = '\n';
-                normalized_for_colspans[pre_colspans_len + 1] = '\0';
-            }
+    /* Render index markers and insert index */
+    if (options->enable_indices && html && index_registry->count > 0) {
+        STAGE_START(index_render, html);
+        char *with_index_markers = apex_render_index_markers(html, index_registry, options);
+        STAGE_END(index_render, with_index_markers);
+        if (with_index_markers) {
+            free(html);
+            html = with_index_markers;
         }
 
-        PROFILE_START(table_colspans_preprocess);
-        table_colspans_processed = apex_preprocess_table_colspans(normalized_for_colspans ? normalized_for_colspans : text_ptr);
-        PROFILE_END(table_colspans_preprocess);
-
-        /* Handle cleanup */
-        if (normalized_for_colspans) {
-            if (table_colspans_processed) {
-                free(normalized_for_colspans);
-            } else {
-                free(normalized_for_colspans);
+        /* Insert index at marker or end of document */
+        if (html) {
+            STAGE_START(index_insert, html);
+            char *with_index = apex_insert_index(html, index_registry, options);
+            STAGE_END(index_insert, with_index);
+            if (with_index) {
+                free(html);
+                html = with_index;
             }
         }
+    }
 
-        if (table_colspans_processed) {
-            text_ptr = table_colspans_processed;
+    /* Clean up HTML tag spacing (compress multiple spaces, remove spaces before >) */
+    if (html) {
+        STAGE_START(html_clean, html);
+        char *cleaned = apex_clean_html_tag_spacing(html);
+        STAGE_END(html_clean, cleaned);
+        if (cleaned) {
+            free(html);
+            html = cleaned;
         }
     }
 
-    /* Normalize table captions before parsing (preprocessing)
-     * - Ensure contiguous [Caption] lines become separate paragraphs
-     * - Convert Pandoc-style 'Table: Caption' lines to [Caption]
-     *
-     * Note: apex_preprocess_table_captions now ensures output ends with newline, but we
-     * normalize here too for safety, in case previous preprocessing removed it.
+    /* In non-pretty mode, collapse extra newlines between adjacent tags so that
+     * sequences like </table>\n\n<figure> become </table><figure>. This keeps
+     * compact HTML output while still letting pretty mode control layout.
      */
-    char *table_captions_processed = NULL;
-    char *normalized_for_caption = NULL;
-    if (options->enable_tables) {
-        /* Normalize text_ptr for table caption preprocessing if it doesn't end with newline */
-        size_t pre_caption_len = strlen(text_ptr);
-        bool needs_newline_for_caption = (pre_caption_len > 0 &&
-                                          text_ptr[pre_caption_len - 1] != '\n' &&
-                                          text_ptr[pre_caption_len - 1] != '\r');
-        if (needs_newline_for_caption) {
-            normalized_for_caption = malloc(pre_caption_len + 2);
-            if (normalized_for_caption) {
-                memcpy(normalized_for_caption, text_ptr, pre_caption_len);
-                normalized_for_caption[pre_caption_len] = '\n';
-                normalized_for_caption[pre_caption_len + 1] = '\0';
-            }
+    if (html && !local_opts.pretty) {
+        STAGE_START(collapse_intertag_newlines, html);
+        char *collapsed = apex_collapse_intertag_newlines(html);
+        STAGE_END(collapse_intertag_newlines, collapsed);
+        if (collapsed) {
+            free(html);
+            html = collapsed;
         }
+    }
 
-        PROFILE_START(table_captions_preprocess);
-        table_captions_processed = apex_preprocess_table_captions(normalized_for_caption ? normalized_for_caption : text_ptr);
-        PROFILE_END(table_captions_preprocess);
-
-        /* Handle cleanup: apex_preprocess_table_captions always returns a new allocated buffer (or NULL on malloc failure) */
-        if (normalized_for_caption) {
-            if (table_captions_processed) {
-                /* Preprocessing returned a new buffer - free our normalization buffer */
-                free(normalized_for_caption);
-            } else {
-                /* Preprocessing returned NULL (malloc failure) - free normalization buffer and continue with original text_ptr */
-                free(normalized_for_caption);
-            }
+    /* Post-process HTML to add style attributes to alpha lists */
+    if (options->allow_alpha_lists && html) {
+        STAGE_START(alpha_lists_postprocess, html);
+        char *processed_html = apex_postprocess_alpha_lists_html(html);
+        STAGE_END(alpha_lists_postprocess, processed_html);
+        if (processed_html && processed_html != html) {
+            free(html);
+            html = processed_html;
         }
+    }
 
-        if (table_captions_processed) {
-            text_ptr = table_captions_processed;
+    /* Remove empty paragraphs created by ^ marker (zero-width space only) */
+    if (html && options->enable_marked_extensions) {
+        STAGE_START(remove_empty_paragraphs, html);
+        char *cleaned = apex_remove_empty_paragraphs(html);
+        STAGE_END(remove_empty_paragraphs, cleaned);
+        if (cleaned && cleaned != html) {
+            free(html);
+            html = cleaned;
         }
     }
 
-    /* Process definition lists before parsing (preprocessing) */
-    char *deflist_processed = NULL;
-    if (options->enable_definition_lists) {
-        PROFILE_START(definition_lists);
-        deflist_processed = apex_process_definition_lists(text_ptr, options->unsafe);
-        PROFILE_END(definition_lists);
-        if (deflist_processed) {
-            text_ptr = deflist_processed;
+    /* Stream CSV/TSV table includes into the output. This runs after all
+     * HTML passes so large tables are not rescanned by each of them.
+     */
+    if (tree->csv_tables && tree->csv_tables->count > 0 && html) {
+        STAGE_START(csv_tables, html);
+        char *with_tables = apex_expand_csv_tables(html, tree->csv_tables);
+        STAGE_END(csv_tables, with_tables);
+        if (with_tables) {
+            free(html);
+            html = with_tables;
         }
     }
 
-    /* Process fenced divs before parsing (preprocessing) */
-    /* Only enabled in Unified mode */
-    char *fenced_divs_processed = NULL;
-    if (options->enable_divs && options->mode == APEX_MODE_UNIFIED) {
-        PROFILE_START(fenced_divs);
-        fenced_divs_processed = apex_process_fenced_divs(text_ptr);
-        PROFILE_END(fenced_divs);
-        if (fenced_divs_processed) {
-            text_ptr = fenced_divs_processed;
+    /* Post-render plugin phase: allow plugins to transform the final HTML
+     * fragment before standalone wrapping and pretty-printing.
+     */
+    if (plugin_manager && html) {
+        STAGE_START(plugins_post_render, html);
+        char *plugin_html = apex_plugins_run_text_phase(plugin_manager,
+                                                        APEX_PLUGIN_PHASE_POST_RENDER,
+                                                        html,
+                                                        &local_opts);
+        STAGE_END(plugins_post_render, plugin_html);
+        if (plugin_html) {
+            free(html);
+            html = plugin_html;
         }
     }
 
-    /* Process HTML markdown attributes before parsing (preprocessing) */
-    char *html_markdown_processed = NULL;
-    if (options->enable_markdown_in_html) {
-        PROFILE_START(html_markdown);
-        html_markdown_processed = apex_process_html_markdown(text_ptr);
-        PROFILE_END(html_markdown);
-        if (html_markdown_processed) {
-            text_ptr = html_markdown_processed;
+    /* Build script HTML (if any) from script_tags before wrapping or appending */
+    char *scripts_html = NULL;
+    if (local_opts.script_tags) {
+        /* Join script tag snippets with newlines */
+        size_t total_len = 0;
+        size_t count = 0;
+        for (char **p = local_opts.script_tags; *p; ++p) {
+            size_t len = strlen(*p);
+            if (len == 0) continue;
+            total_len += len + 1; /* +1 for newline */
+            count++;
         }
-    }
 
-    /* Process hashtags: convert #tags to span-wrapped hashtags */
-    char *hashtags_processed = NULL;
-    if (options->enable_hashtags && text_ptr) {
-        PROFILE_START(hashtags);
-        size_t len = strlen(text_ptr);
-        size_t capacity = len * 3 + 1;  /* Allow expansion with span tags */
-        char *output = malloc(capacity);
-        if (output) {
-            const char *read = text_ptr;
-            char *write = output;
-            size_t remaining = capacity;
-            bool in_code_block = false;
-            int indent_count = 0;
-            bool at_line_start = true;
-
-            while (*read) {
-                /* Track code blocks (4+ spaces or tab at line start) */
-                if (at_line_start) {
-                    if (*read == '\t') {
-                        in_code_block = true;
-                        indent_count = 0;
-                    } else if (*read == ' ') {
-                        indent_count++;
-                        if (indent_count >= 4) {
-                            in_code_block = true;
-                        }
-                    } else if (*read != '\n' && *read != '\r') {
-                        at_line_start = false;
-                        indent_count = 0;
-                    }
-                }
-
-                if (*read == '\n') {
-                    at_line_start = true;
-                    indent_count = 0;
-                    in_code_block = false;
+        if (count > 0 && total_len > 0) {
+            scripts_html = malloc(total_len + 1); /* +1 for null terminator */
+            if (scripts_html) {
+                size_t pos = 0;
+                for (char **p = local_opts.script_tags; *p; ++p) {
+                    size_t len = strlen(*p);
+                    if (len == 0) continue;
+                    memcpy(scripts_html + pos, *p, len);
+                    pos += len;
+                    scripts_html[pos++] = '\n';
                 }
+                scripts_html[pos] = '\0';
+            }
+        }
+    }
 
-                /* Skip hashtag processing inside code blocks */
-                if (in_code_block) {
-                    if (remaining < 10) {
-                        size_t written = (size_t)(write - output);
-                        capacity = (written + 100) * 2;
-                        char *new_output = realloc(output, capacity);
-                        if (!new_output) {
-                            free(output);
-                            output = NULL;
-                            break;
-                        }
-                        output = new_output;
-                        write = output + written;
-                        remaining = capacity - written;
-                    }
-                    *write++ = *read++;
-                    remaining--;
-                    continue;
-                }
+    /* Extract title from first H1 if requested and no title is set */
+    char *h1_title = NULL;
+    if (local_opts.title_from_h1 && local_opts.standalone && html &&
+        (!local_opts.document_title || local_opts.document_title[0] == '\0')) {
+        h1_title = apex_extract_first_h1_text(html);
+        if (h1_title) {
+            local_opts.document_title = h1_title;
+        }
+    }
 
-                /* Check for hashtag pattern: # followed by alphanumeric, not preceded by non-whitespace */
-                /* Pattern: (?<=\s|^)#[a-zA-Z0-9][^# \n,;.!\)\]]* */
-                if (*read == '#' && (read == text_ptr || read[-1] == ' ' || read[-1] == '\t' || read[-1] == '\n')) {
-                    const char *tag_start = read;
-                    read++;  /* Skip # */
+    /* Wrap in complete HTML document if requested */
+    if (local_opts.standalone && html) {
+        /* CSS precedence: CLI flag (--css/--style) overrides metadata */
+        const char **css_paths = local_opts.stylesheet_paths;
+        size_t css_count = local_opts.stylesheet_count;
 
-                    /* Check if it's a valid hashtag start (alphanumeric) */
-                    if ((*read >= 'a' && *read <= 'z') || (*read >= 'A' && *read <= 'Z') || (*read >= '0' && *read <= '9')) {
-                        /* Find the end of the hashtag */
-                        const char *tag_end = read;
-                        while (*tag_end && *tag_end != '#' && *tag_end != ' ' && *tag_end != '\n' &&
-                               *tag_end != ',' && *tag_end != ';' && *tag_end != '.' && *tag_end != '!' &&
-                               *tag_end != ')' && *tag_end != ']') {
-                            tag_end++;
-                        }
+        /* If no CLI stylesheets, check metadata for single CSS path */
+        if (!css_paths || css_count == 0) {
+            if (css_metadata) {
+                /* Allocate array for single metadata stylesheet */
+                css_paths = malloc(2 * sizeof(const char*));
+                if (css_paths) {
+                    css_paths[0] = css_metadata;
+                    css_paths[1] = NULL;
+                    css_count = 1;
+                }
+            }
+        }
 
-                        /* Check for special case: #tag# format (wrapped in #) */
-                        if (*tag_end == '#') {
-                            tag_end++;  /* Include the closing # */
-                        }
+        /* Combine any existing HTML footer metadata with scripts (footer first, then scripts) */
+        char *footer_with_scripts = NULL;
+        if (html_footer_metadata || scripts_html) {
+            size_t footer_len = html_footer_metadata ? strlen(html_footer_metadata) : 0;
+            size_t scripts_len = scripts_html ? strlen(scripts_html) : 0;
+            size_t extra_newline = (footer_len > 0 && scripts_len > 0) ? 1 : 0;
 
-                        if (tag_end > read) {
-                            /* Valid hashtag found */
-                            size_t tag_len = (size_t)(tag_end - tag_start);
-                            const char *class_name = options->style_hashtags ? "mkstyledtag" : "mkhashtag";
-                            size_t span_prefix_len = strlen("<span class=\"") + strlen(class_name) + strlen("\">");
-                            size_t span_suffix_len = strlen("</span>");
-                            size_t needed = span_prefix_len + tag_len + span_suffix_len;
+            footer_with_scripts = malloc(footer_len + extra_newline + scripts_len + 1);
+            if (footer_with_scripts) {
+                size_t pos = 0;
+                if (footer_len > 0) {
+                    memcpy(footer_with_scripts + pos, html_footer_metadata, footer_len);
+                    pos += footer_len;
+                }
+                if (extra_newline) {
+                    footer_with_scripts[pos++] = '\n';
+                }
+                if (scripts_len > 0) {
+                    memcpy(footer_with_scripts + pos, scripts_html, scripts_len);
+                    pos += scripts_len;
+                }
+                footer_with_scripts[pos] = '\0';
+            }
+        }
 
-                            if (needed >= remaining) {
-                                size_t written = (size_t)(write - output);
-                                capacity = (written + needed + 100) * 2;
-                                char *new_output = realloc(output, capacity);
-                                if (!new_output) {
-                                    free(output);
-                                    output = NULL;
-                                    break;
-                                }
-                                output = new_output;
-                                write = output + written;
-                                remaining = capacity - written;
-                            }
+        const char *footer_to_use = footer_with_scripts ? footer_with_scripts : html_footer_metadata;
 
-                            /* Write opening span */
-                            memcpy(write, "<span class=\"", 13);
-                            write += 13;
-                            remaining -= 13;
-                            memcpy(write, class_name, strlen(class_name));
-                            write += strlen(class_name);
-                            remaining -= strlen(class_name);
-                            memcpy(write, "\">", 2);
-                            write += 2;
-                            remaining -= 2;
+        STAGE_START(standalone_wrap, html);
+        char *document = apex_wrap_html_document_internal(html, local_opts.document_title, css_paths, css_count,
+                                                          local_opts.code_highlighter, html_header_metadata, footer_to_use,
+                                                          language_metadata, local_opts.embed_stylesheet,
+                                                          local_opts.minify_embedded_stylesheet,
+                                                          local_opts.base_directory, local_opts.pretty);
+        STAGE_END(standalone_wrap, document);
 
-                            /* Write the hashtag */
-                            memcpy(write, tag_start, tag_len);
-                            write += tag_len;
-                            remaining -= tag_len;
+        /* Free temporary metadata stylesheet array if we allocated it */
+        if (css_paths && css_paths[0] == css_metadata) {
+            free((void*)css_paths);
+        }
+        if (document) {
+            free(html);
+            html = document;
+        }
 
-                            /* Write closing span */
-                            memcpy(write, "</span>", 7);
-                            write += 7;
-                            remaining -= 7;
+        if (footer_with_scripts) {
+            free(footer_with_scripts);
+        }
+    } else if (html && scripts_html) {
+        /* Snippet mode: append scripts to the end of the HTML fragment */
+        size_t html_len = strlen(html);
+        size_t scripts_len = strlen(scripts_html);
+        size_t extra_newline = (html_len > 0 && scripts_len > 0 && html[html_len - 1] != '\n') ? 1 : 0;
 
-                            read = tag_end;
-                            continue;
-                        }
-                    }
-                    /* Not a valid hashtag, copy the # */
-                    if (remaining < 10) {
-                        size_t written = (size_t)(write - output);
-                        capacity = (written + 100) * 2;
-                        char *new_output = realloc(output, capacity);
-                        if (!new_output) {
-                            free(output);
-                            output = NULL;
-                            break;
-                        }
-                        output = new_output;
-                        write = output + written;
-                        remaining = capacity - written;
-                    }
-                    *write++ = *tag_start;
-                    remaining--;
-                    read = tag_start + 1;
-                } else {
-                    /* Normal character, copy as-is */
-                    if (remaining < 10) {
-                        size_t written = (size_t)(write - output);
-                        capacity = (written + 100) * 2;
-                        char *new_output = realloc(output, capacity);
-                        if (!new_output) {
-                            free(output);
-                            output = NULL;
-                            break;
-                        }
-                        output = new_output;
-                        write = output + written;
-                        remaining = capacity - written;
-                    }
-                    *write++ = *read++;
-                    remaining--;
-                }
+        char *combined = malloc(html_len + extra_newline + scripts_len + 1);
+        if (combined) {
+            size_t pos = 0;
+            if (html_len > 0) {
+                memcpy(combined + pos, html, html_len);
+                pos += html_len;
             }
-            if (output) {
-                *write = '\0';
-                hashtags_processed = output;
+            if (extra_newline) {
+                combined[pos++] = '\n';
             }
-        }
-        PROFILE_END(hashtags);
-        if (hashtags_processed) {
-            text_ptr = hashtags_processed;
+            if (scripts_len > 0) {
+                memcpy(combined + pos, scripts_html, scripts_len);
+                pos += scripts_len;
+            }
+            combined[pos] = '\0';
+
+            free(html);
+            html = combined;
         }
     }
 
-    /* Process proofreader mode: convert == and ~~ to CriticMarkup syntax */
-    char *proofreader_processed = NULL;
-    if (options->proofreader_mode && text_ptr) {
-        PROFILE_START(proofreader);
-        size_t len = strlen(text_ptr);
-        size_t capacity = len * 2 + 1;  /* Allow expansion */
-        char *output = malloc(capacity);
-        if (output) {
-            const char *read = text_ptr;
-            char *write = output;
-            size_t remaining = capacity;
-            bool in_code_block = false;
-            bool in_inline_code = false;
-            int backtick_count = 0;
+    if (scripts_html) {
+        free(scripts_html);
+    }
 
-            while (*read) {
-                /* Track code blocks and inline code to skip processing inside them */
-                if (*read == '`') {
-                    backtick_count++;
-                    if (backtick_count >= 3) {
-                        /* Code block fence */
-                        in_code_block = !in_code_block;
-                        backtick_count = 0;
-                    } else if (!in_code_block) {
-                        /* Check for inline code */
-                        const char *next = read + 1;
-                        if (*next != '`') {
-                            in_inline_code = !in_inline_code;
-                            backtick_count = 0;
-                        }
+    /* Free duplicated metadata strings */
+    if (css_metadata) free(css_metadata);
+    if (html_header_metadata) free(html_header_metadata);
+    if (html_footer_metadata) free(html_footer_metadata);
+    if (language_metadata) free(language_metadata);
+    if (quotes_lang_metadata) free(quotes_lang_metadata);
+    if (h1_title) free(h1_title);
+    apex_heading_table_free(headings);
+
+    /* Pretty-print HTML if requested (standalone documents are formatted
+     * while they are assembled by the wrapper) */
+    if (local_opts.pretty && !local_opts.standalone && html) {
+        STAGE_START(pretty_print, html);
+        char *pretty = apex_pretty_print_html(html);
+        STAGE_END(pretty_print, pretty);
+        if (pretty) {
+            free(html);
+            html = pretty;
+        }
+    }
+
+    #undef stage_recorder
+    #undef options
+    return html;
+}
+
+char *apex_markdown_to_html(const char *markdown, size_t len, const apex_options *options) {
+    return apex_markdown_to_html_segment(markdown, len, false, options, NULL);
+}
+
+char *apex_markdown_file_to_html(const char *path, const apex_options *options) {
+    if (!path) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return apex_markdown_to_html("", 0, options);
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+#ifdef MADV_SEQUENTIAL
+    madvise(map, size, MADV_SEQUENTIAL);
+#endif
+
+    /* The rest of the last page of a mapping reads as zeros, so unless the
+     * file ends exactly on a page boundary it is already NUL-terminated */
+    long page = sysconf(_SC_PAGESIZE);
+    bool in_place = page > 0 && size % (size_t)page != 0;
+
+    char *html = apex_markdown_to_html_segment(map, size, in_place, options, NULL);
+    munmap(map, size);
+    return html;
+}
+
+/**
+ * The conversion pipeline. With keep set, the parsed tree and what
+ * rendering needs from the front half are moved into keep instead of
+ * being rendered, and NULL is returned.
+ */
+struct apex_context {
+    apex_options options;
+    apex_plugin_manager *plugins;                 /* NULL if plugins are off or none were found */
+    bool plugins_loaded;                          /* Plugin discovery ran */
+    apex_bibliography_registry *bibliography;     /* From options.bibliography_files */
+    char *base_directory;                         /* Copies the context's options point to */
+    char **bibliography_files;
+};
+
+static char *apex_convert(const char *markdown, size_t len, bool in_place, const apex_options *options,
+                          apex_segment_context *segment, apex_document *keep, const apex_context *warm) {
+    if (!markdown || len == 0) {
+        char *empty = malloc(1);
+        if (empty) empty[0] = '\0';
+        return empty;
+    }
+
+    apex_stage_recorder stage_recorder;
+    apex_stage_recorder_init(&stage_recorder, options);
+    STAGE_START(total, NULL);
+    total_stage.bytes_in = len;
+
+    /* Use default options if none provided, and create a mutable copy */
+    apex_options default_opts;
+    apex_options local_opts;
+    if (!options) {
+        default_opts = apex_options_default();
+        local_opts = default_opts;
+    } else {
+        local_opts = *options;  /* Make a mutable copy */
+    }
+    /* Use local_opts for rest of function (mutable) - shadow the const parameter */
+    #define options (&local_opts)
+
+    /* Stop at an embedded NUL, without reading past len */
+    const char *nul = memchr(markdown, '\0', len);
+    if (nul) len = (size_t)(nul - markdown);
+
+    /* Passes only read their input, so a NUL-terminated buffer (a mapped
+     * file, a stream segment) is used in place; anything else is copied
+     * once to terminate it. Passes still hand each other NUL-terminated
+     * strings and measure them with strlen; carrying lengths between
+     * them is open work (see docs/FUTURE_FEATURES.md) */
+    char *working_text = NULL;
+    const char *input_text = markdown;
+    if (!in_place) {
+        working_text = malloc(len + 1);
+        if (!working_text) return NULL;
+        memcpy(working_text, markdown, len);
+        working_text[len] = '\0';
+        input_text = working_text;
+    }
+
+    /* Discover plugins once per conversion. This currently supports
+     * text-level pre-parse plugins described by simple YAML manifests
+     * in project and global plugin directories.
+     */
+    apex_plugin_manager *plugin_manager = NULL;
+    bool shared_plugins = warm && warm->plugins_loaded && options->enable_plugins;
+    if (shared_plugins) {
+        plugin_manager = warm->plugins;
+    } else if (options->enable_plugins) {
+        STAGE_START(plugins_load, NULL);
+        plugin_manager = apex_plugins_load(options);
+        STAGE_END(plugins_load, NULL);
+    }
+
+    /* Optional pre-parse plugin hook: run all configured pre_parse plugins
+     * over the raw markdown before any Apex-specific preprocessing.
+     */
+    if (plugin_manager) {
+        STAGE_START(plugins_pre_parse, input_text);
+        char *plugin_text = apex_plugins_run_text_phase(plugin_manager,
+                                                        APEX_PLUGIN_PHASE_PRE_PARSE,
+                                                        input_text,
+                                                        options);
+        STAGE_END(plugins_pre_parse, plugin_text);
+        if (plugin_text) {
+            free(working_text);
+            working_text = plugin_text;
+            input_text = working_text;
+            len = strlen(working_text);
+        }
+    }
+
+    apex_metadata_item *metadata = NULL;
+    abbr_item *abbreviations = NULL;
+    ald_entry *alds = NULL;
+    char *alds_stripped = NULL;
+    char *abbreviations_stripped = NULL;
+    const char *text_ptr = input_text;
+    /* Liquid tag placeholders (for {% ... %} tags) */
+    char **liquid_tags = NULL;
+    size_t liquid_tag_count = 0;
+    char *liquid_protected = NULL;
+
+
+    if (options->mode == APEX_MODE_MULTIMARKDOWN ||
+        options->mode == APEX_MODE_KRAMDOWN ||
+        options->mode == APEX_MODE_UNIFIED) {
+        /* Extract metadata FIRST (later segments of a stream reuse the document's) */
+        if (segment && segment->continuation) {
+            metadata = segment->metadata;
+        } else {
+            STAGE_START(metadata, text_ptr);
+            metadata = apex_extract_metadata(&text_ptr);
+            STAGE_END(metadata, text_ptr);
+            if (segment) segment->metadata = metadata;
+        }
+
+        /* Extract ALDs for Kramdown */
+        if (options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
+            alds = apex_extract_alds(text_ptr, &alds_stripped);
+            if (alds_stripped) text_ptr = alds_stripped;
+        }
+
+        /* Extract abbreviations */
+        abbreviations = apex_extract_abbreviations(text_ptr, &abbreviations_stripped);
+        if (abbreviations_stripped) text_ptr = abbreviations_stripped;
+    }
+
+    /* Check metadata for bibliography and enable citations if found */
+    if (metadata && !local_opts.enable_citations) {
+        const char *bib_value = apex_metadata_get(metadata, "bibliography");
+        if (bib_value) {
+            local_opts.enable_citations = true;
+        }
+        const char *csl_value = apex_metadata_get(metadata, "csl");
+        if (csl_value) {
+            local_opts.enable_citations = true;
+        }
+    }
+
+    /* Apply metadata variable replacement BEFORE autolinking
+     * This ensures replaced URLs get autolinked
+     */
+    char *metadata_replaced = NULL;
+    if (metadata && options->enable_metadata_variables) {
+        STAGE_START(metadata_replace_pre, text_ptr);
+        metadata_replaced = apex_metadata_replace_variables(text_ptr, metadata, options);
+        STAGE_END(metadata_replace_pre, metadata_replaced);
+        if (metadata_replaced) {
+            text_ptr = metadata_replaced;
+        }
+    }
+
+    /* Load bibliography files if provided (before processing citations)
+     * Check both CLI bibliography files and metadata bibliography
+     * Only load bibliography if files are actually specified - this avoids
+     * unnecessary file I/O and parsing when citations aren't being used
+     */
+    apex_bibliography_registry *bibliography = NULL;
+
+    /* A context's bibliography is shared, so it is only borrowed when the
+     * metadata does not name another one to merge into it */
+    bool borrowed_bibliography = false;
+    if (warm && warm->bibliography && options->bibliography_files &&
+        !(metadata && apex_metadata_get(metadata, "bibliography"))) {
+        bibliography = warm->bibliography;
+        borrowed_bibliography = true;
+    } else if (options->bibliography_files) {
+        /* Load from CLI bibliography files if specified */
+        STAGE_START(bibliography_load, NULL);
+        bibliography = apex_load_bibliography((const char **)options->bibliography_files, options->base_directory);
+        STAGE_END(bibliography_load, NULL);
+    }
+
+    /* Also check metadata for bibliography (merge with CLI bibliography if both exist) */
+    if (metadata) {
+        const char *bib_value = apex_metadata_get(metadata, "bibliography");
+        if (bib_value) {
+            STAGE_START(bibliography_load_meta, NULL);
+            /* Load bibliography from metadata */
+            char *resolved_path = NULL;
+            if (options->base_directory) {
+                size_t base_len = strlen(options->base_directory);
+                size_t bib_len = strlen(bib_value);
+                resolved_path = malloc(base_len + bib_len + 2);
+                if (resolved_path) {
+                    strcpy(resolved_path, options->base_directory);
+                    if (resolved_path[base_len - 1] != '/') {
+                        resolved_path[base_len] = '/';
+                        base_len++;
                     }
-                } else {
-                    backtick_count = 0;
+                    strcpy(resolved_path + base_len, bib_value);
                 }
+            } else {
+                resolved_path = strdup(bib_value);
+            }
 
-                if (in_code_block || in_inline_code) {
-                    /* Inside code, copy as-is */
-                    if (remaining < 10) {
-                        size_t written = (size_t)(write - output);
-                        capacity = (written + 100) * 2;
-                        char *new_output = realloc(output, capacity);
-                        if (!new_output) {
-                            free(output);
-                            output = NULL;
-                            break;
-                        }
-                        output = new_output;
-                        write = output + written;
-                        remaining = capacity - written;
-                    }
-                    *write++ = *read++;
-                    remaining--;
-                } else if (read[0] == '=' && read[1] == '=') {
-                    /* Found ==, convert to {== */
-                    const char *start = read;
-                    read += 2;
-                    /* Find matching == */
-                    const char *end = strstr(read, "==");
-                    if (end) {
-                        /* Found matching ==, wrap in {==...==} */
-                        size_t content_len = (size_t)(end - read);
-                        size_t needed = 2 + content_len + 2;  /* {== + content + ==} */
-                        if (needed >= remaining) {
-                            size_t written = (size_t)(write - output);
-                            capacity = (written + needed + 100) * 2;
-                            char *new_output = realloc(output, capacity);
-                            if (!new_output) {
-                                free(output);
-                                output = NULL;
-                                break;
+            if (resolved_path) {
+                apex_bibliography_registry *meta_bib = apex_load_bibliography_file(resolved_path);
+                if (meta_bib) {
+                    if (bibliography) {
+                        /* Merge with existing bibliography */
+                        apex_bibliography_entry *entry = meta_bib->entries;
+                        while (entry) {
+                            apex_bibliography_entry *next = entry->next;
+                            if (!apex_find_bibliography_entry(bibliography, entry->id)) {
+                                entry->next = bibliography->entries;
+                                bibliography->entries = entry;
+                                bibliography->count++;
+                            } else {
+                                apex_bibliography_entry_free(entry);
                             }
-                            output = new_output;
-                            write = output + written;
-                            remaining = capacity - written;
+                            entry = next;
                         }
-                        *write++ = '{';
-                        *write++ = '=';
-                        *write++ = '=';
-                        remaining -= 3;
-                        memcpy(write, read, content_len);
-                        write += content_len;
-                        remaining -= content_len;
-                        *write++ = '=';
-                        *write++ = '=';
-                        *write++ = '}';
-                        remaining -= 3;
-                        read = end + 2;
+                        free(meta_bib);
                     } else {
-                        /* No matching ==, copy as-is */
-                        if (remaining < 10) {
-                            size_t written = (size_t)(write - output);
-                            capacity = (written + 100) * 2;
-                            char *new_output = realloc(output, capacity);
-                            if (!new_output) {
-                                free(output);
-                                output = NULL;
-                                break;
-                            }
-                            output = new_output;
-                            write = output + written;
-                            remaining = capacity - written;
-                        }
-                        *write++ = *start++;
-                        *write++ = *start;
-                        remaining -= 2;
-                        read = start + 1;
-                    }
-                } else if (read[0] == '~' && read[1] == '~') {
-                    /* Found ~~, convert to {-- */
-                    const char *start = read;
-                    read += 2;
-                    /* Find matching ~~ */
-                    const char *end = strstr(read, "~~");
-                    if (end) {
-                        /* Found matching ~~, wrap in {--...--} */
-                        size_t content_len = (size_t)(end - read);
-                        size_t needed = 2 + content_len + 2;  /* {-- + content + --} */
-                        if (needed >= remaining) {
-                            size_t written = (size_t)(write - output);
-                            capacity = (written + needed + 100) * 2;
-                            char *new_output = realloc(output, capacity);
-                            if (!new_output) {
-                                free(output);
-                                output = NULL;
-                                break;
-                            }
-                            output = new_output;
-                            write = output + written;
-                            remaining = capacity - written;
-                        }
-                        *write++ = '{';
-                        *write++ = '-';
-                        *write++ = '-';
-                        remaining -= 3;
-                        memcpy(write, read, content_len);
-                        write += content_len;
-                        remaining -= content_len;
-                        *write++ = '-';
-                        *write++ = '-';
-                        *write++ = '}';
-                        remaining -= 3;
-                        read = end + 2;
-                    } else {
-                        /* No matching ~~, copy as-is */
-                        if (remaining < 10) {
-                            size_t written = (size_t)(write - output);
-                            capacity = (written + 100) * 2;
-                            char *new_output = realloc(output, capacity);
-                            if (!new_output) {
-                                free(output);
-                                output = NULL;
-                                break;
-                            }
-                            output = new_output;
-                            write = output + written;
-                            remaining = capacity - written;
-                        }
-                        *write++ = *start++;
-                        *write++ = *start;
-                        remaining -= 2;
-                        read = start + 1;
-                    }
-                } else {
-                    /* Normal character, copy as-is */
-                    if (remaining < 10) {
-                        size_t written = (size_t)(write - output);
-                        capacity = (written + 100) * 2;
-                        char *new_output = realloc(output, capacity);
-                        if (!new_output) {
-                            free(output);
-                            output = NULL;
-                            break;
-                        }
-                        output = new_output;
-                        write = output + written;
-                        remaining = capacity - written;
+                        /* Use metadata bibliography as the main bibliography */
+                        bibliography = meta_bib;
                     }
-                    *write++ = *read++;
-                    remaining--;
                 }
+                free(resolved_path);
             }
-            if (output) {
-                *write = '\0';
-                proofreader_processed = output;
+            STAGE_END(bibliography_load_meta, NULL);
+        }
+    }
+
+    /* Process citations BEFORE autolinking to prevent @ symbols from being converted to mailto links
+     * Citations like [@key] need to be processed before autolinking sees the @ symbol
+     * Only process citations if bibliography is actually loaded or citations are explicitly enabled
+     */
+    apex_citation_registry citation_registry = {0};
+    citation_registry.bibliography = bibliography;
+    char *citations_processed = NULL;
+
+    /* Check if we should process citations: bibliography loaded, CLI files specified, CSL specified, or metadata bibliography */
+    bool should_process_citations = false;
+    if (bibliography) {
+        should_process_citations = true;
+    } else if (options->bibliography_files) {
+        should_process_citations = true;
+    } else if (options->csl_file) {
+        should_process_citations = true;
+    } else if (metadata) {
+        const char *bib_value = apex_metadata_get(metadata, "bibliography");
+        const char *csl_value = apex_metadata_get(metadata, "csl");
+        if (bib_value || csl_value) {
+            should_process_citations = true;
+        }
+    }
+
+    if (options->enable_citations && should_process_citations) {
+        PROGRESS_REPORT("Processing citations", -1);
+        STAGE_START(citations, text_ptr);
+        citations_processed = apex_process_citations(text_ptr, &citation_registry, options);
+        STAGE_END(citations, citations_processed);
+        if (citations_processed) {
+            text_ptr = citations_processed;
+        }
+    }
+
+    /* Process index entries (preprocessing) */
+    apex_index_registry index_registry = {0};
+    char *indices_processed = NULL;
+    if (options->enable_indices) {
+        PROGRESS_REPORT("Processing indices", -1);
+        STAGE_START(indices, text_ptr);
+        indices_processed = apex_process_index_entries(text_ptr, &index_registry, options);
+        STAGE_END(indices, indices_processed);
+        if (indices_processed) {
+            text_ptr = indices_processed;
+        }
+    }
+
+    /* Preprocess autolinks to convert <https://...> to [https://...](https://...)
+     * This must happen after citation processing so @ symbols in citations aren't autolinked
+     * Note: Even with autolink extension enabled, preprocessing ensures compatibility
+     */
+    char *autolinks_processed = NULL;
+    if (options->enable_autolink) {
+        PROGRESS_REPORT("Processing autolinks", -1);
+        STAGE_START(autolinks, text_ptr);
+        autolinks_processed = apex_preprocess_autolinks(text_ptr, options);
+        STAGE_END(autolinks, autolinks_processed);
+        if (autolinks_processed) {
+            text_ptr = autolinks_processed;
+        }
+    }
+
+    /* Preprocess image attributes and URL-encode all link URLs */
+    apex_image_attrs *img_attrs = NULL;
+    char *image_attrs_processed = NULL;
+    if (options->mode == APEX_MODE_UNIFIED ||
+        options->mode == APEX_MODE_MULTIMARKDOWN ||
+        options->mode == APEX_MODE_KRAMDOWN) {
+        STAGE_START(image_attrs_preprocess, text_ptr);
+        image_attrs_processed = apex_preprocess_image_attributes(text_ptr, &img_attrs, options->mode);
+        STAGE_END(image_attrs_preprocess, image_attrs_processed);
+        if (image_attrs_processed) {
+            text_ptr = image_attrs_processed;
+        }
+    }
+
+    /* Preprocess IAL markers (insert blank lines before them so cmark parses correctly) */
+    char *ial_preprocessed = NULL;
+    if (options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
+        STAGE_START(ial_preprocess, text_ptr);
+        ial_preprocessed = apex_preprocess_ial(text_ptr);
+        STAGE_END(ial_preprocess, ial_preprocessed);
+        if (ial_preprocessed) {
+            text_ptr = ial_preprocessed;
+        }
+    }
+
+    /* Preprocess bracketed spans [text]{IAL} */
+    char *spans_preprocessed = NULL;
+    if (options->enable_spans && (options->mode == APEX_MODE_UNIFIED || options->mode == APEX_MODE_KRAMDOWN)) {
+        STAGE_START(spans_preprocess, text_ptr);
+        spans_preprocessed = apex_preprocess_bracketed_spans(text_ptr);
+        STAGE_END(spans_preprocess, spans_preprocessed);
+        if (spans_preprocessed) {
+            text_ptr = spans_preprocessed;
+        }
+    }
+
+    /* Process file includes before parsing (preprocessing) */
+    /* CSV/TSV table includes are streamed in after rendering. A kept
+     * document is rendered later, so its tables are inlined as Markdown. */
+    char *includes_processed = NULL;
+    apex_csv_tables csv_tables;
+    apex_csv_tables_init(&csv_tables);
+    if (options->enable_file_includes) {
+        STAGE_START(includes, text_ptr);
+        apex_include_deps deps = { options->dependency_callback, options->dependency_user_data };
+        includes_processed = apex_process_includes_with_tables(text_ptr, options->base_directory, metadata, 0,
+                                                               keep ? NULL : &csv_tables, &deps);
+        STAGE_END(includes, includes_processed);
+        if (includes_processed) {
+            text_ptr = includes_processed;
+        }
+    }
+
+    /* Process special markers (^ end-of-block marker) and inline tables BEFORE alpha lists */
+    /* This ensures ^ markers and inline table markers are converted before alpha list processing */
+    char *markers_processed_early = NULL;
+    if (options->enable_marked_extensions) {
+        STAGE_START(special_markers, text_ptr);
+        markers_processed_early = apex_process_special_markers(text_ptr);
+        STAGE_END(special_markers, markers_processed_early);
+        if (markers_processed_early) {
+            text_ptr = markers_processed_early;
+        }
+    }
+
+    /* Process inline table fences and <!--TABLE--> markers before parsing */
+    char *inline_tables_processed = NULL;
+    STAGE_START(inline_tables, text_ptr);
+    inline_tables_processed = apex_process_inline_tables(text_ptr);
+    STAGE_END(inline_tables, inline_tables_processed);
+    if (inline_tables_processed) {
+        text_ptr = inline_tables_processed;
+    }
+
+    /* Process alpha lists before parsing (preprocessing) */
+    char *alpha_lists_processed = NULL;
+    if (options->allow_alpha_lists) {
+        STAGE_START(alpha_lists, text_ptr);
+        alpha_lists_processed = apex_preprocess_alpha_lists(text_ptr);
+        STAGE_END(alpha_lists, alpha_lists_processed);
+        if (alpha_lists_processed) {
+            text_ptr = alpha_lists_processed;
+        }
+    }
+
+    /* Process emoji autocorrect before parsing (preprocessing) */
+    char *emoji_autocorrect_processed = NULL;
+    if (options->enable_emoji_autocorrect && (options->mode == APEX_MODE_UNIFIED || options->mode == APEX_MODE_GFM)) {
+        STAGE_START(emoji_autocorrect, text_ptr);
+        emoji_autocorrect_processed = apex_autocorrect_emoji_names(text_ptr);
+        STAGE_END(emoji_autocorrect, emoji_autocorrect_processed);
+        if (emoji_autocorrect_processed) {
+            text_ptr = emoji_autocorrect_processed;
+        }
+    }
+
+    /* Process inline footnotes before parsing (Kramdown ^[...] and MMD [^... ...]) */
+    char *inline_footnotes_processed = NULL;
+    if (options->enable_footnotes) {
+        STAGE_START(inline_footnotes, text_ptr);
+        inline_footnotes_processed = apex_process_inline_footnotes(text_ptr);
+        STAGE_END(inline_footnotes, inline_footnotes_processed);
+        if (inline_footnotes_processed) {
+            text_ptr = inline_footnotes_processed;
+        }
+    }
+
+    /* Process ==highlight== syntax before parsing
+     * Skip if proofreader mode is enabled (proofreader will handle it via CriticMarkup) */
+    char *highlights_processed = NULL;
+    if (!options->proofreader_mode) {
+        STAGE_START(highlights, text_ptr);
+        highlights_processed = apex_process_highlights(text_ptr);
+        STAGE_END(highlights, highlights_processed);
+        if (highlights_processed) {
+            text_ptr = highlights_processed;
+        }
+    }
+
+    /* Process superscript and subscript syntax before parsing */
+    char *sup_sub_processed = NULL;
+    if (options->enable_sup_sub) {
+        STAGE_START(sup_sub, text_ptr);
+        sup_sub_processed = apex_process_sup_sub(text_ptr);
+        STAGE_END(sup_sub, sup_sub_processed);
+        if (sup_sub_processed) {
+            text_ptr = sup_sub_processed;
+        }
+    }
+
+    /* Process relaxed tables before parsing (preprocessing) */
+    char *relaxed_tables_processed = NULL;
+    char *normalized_for_relaxed = NULL;
+    if (options->relaxed_tables && options->enable_tables) {
+        /* Normalize text_ptr for relaxed tables processing if it doesn't end with newline */
+        size_t pre_relaxed_len = strlen(text_ptr);
+        bool needs_newline_for_relaxed = (pre_relaxed_len > 0 &&
+                                          text_ptr[pre_relaxed_len - 1] != '\n' &&
+                                          text_ptr[pre_relaxed_len - 1] != '\r');
+        if (needs_newline_for_relaxed) {
+            normalized_for_relaxed = malloc(pre_relaxed_len + 2);
+            if (normalized_for_relaxed) {
+                memcpy(normalized_for_relaxed, text_ptr, pre_relaxed_len);
+                normalized_for_relaxed[pre_relaxed_len] = '\n';
+                normalized_for_relaxed[pre_relaxed_len + 1] = '\0';
+            }
+        }
+
+        PROGRESS_REPORT("Processing relaxed tables", -1);
+        STAGE_START(relaxed_tables, text_ptr);
+        relaxed_tables_processed = apex_process_relaxed_tables(normalized_for_relaxed ? normalized_for_relaxed : text_ptr);
+        STAGE_END(relaxed_tables, relaxed_tables_processed);
+        /* Refresh progress after processing completes (in case it took a while) */
+        PROGRESS_REPORT(NULL, -1);  /* NULL stage = refresh last known stage */
+
+        /* Handle cleanup */
+        if (normalized_for_relaxed) {
+            if (relaxed_tables_processed) {
+                /* Processing returned a new buffer - free our normalization buffer */
+                free(normalized_for_relaxed);
+            } else {
+                /* Processing returned NULL - free normalization buffer and continue with original */
+                free(normalized_for_relaxed);
+            }
+        }
+
+        if (relaxed_tables_processed) {
+            text_ptr = relaxed_tables_processed;
+        }
+    }
+
+    /* Process headerless tables before parsing (preprocessing)
+     * Detect separator rows without header rows and insert dummy headers
+     * This must run after relaxed tables processing
+     */
+    char *headerless_tables_processed = NULL;
+    char *normalized_for_headerless = NULL;
+    if (options->enable_tables) {
+        /* Normalize text_ptr for headerless tables processing if it doesn't end with newline */
+        size_t pre_headerless_len = strlen(text_ptr);
+        bool needs_newline_for_headerless = (pre_headerless_len > 0 &&
+                                             text_ptr[pre_headerless_len - 1] != '\n' &&
+                                             text_ptr[pre_headerless_len - 1] != '\r');
+        if (needs_newline_for_headerless) {
+            normalized_for_headerless = malloc(pre_headerless_len + 2);
+            if (normalized_for_headerless) {
+                memcpy(normalized_for_headerless, text_ptr, pre_headerless_len);
+                normalized_for_headerless[pre_headerless_len] = '\n';
+                normalized_for_headerless[pre_headerless_len + 1] = '\0';
             }
         }
-        PROFILE_END(proofreader);
-        if (proofreader_processed) {
-            text_ptr = proofreader_processed;
+
+        STAGE_START(headerless_tables, text_ptr);
+        headerless_tables_processed = apex_process_headerless_tables(normalized_for_headerless ? normalized_for_headerless : text_ptr);
+        STAGE_END(headerless_tables, headerless_tables_processed);
+
+        /* Handle cleanup */
+        if (normalized_for_headerless) {
+            if (headerless_tables_processed) {
+                /* Processing returned a new buffer - free our normalization buffer */
+                free(normalized_for_headerless);
+            } else {
+                /* Processing returned NULL - free normalization buffer and continue with original */
+                free(normalized_for_headerless);
+            }
         }
-    }
 
-    /* Process Critic Markup before parsing (preprocessing) */
-    char *critic_processed = NULL;
-    if (options->enable_critic_markup) {
-        PROFILE_START(critic);
-        critic_mode_t critic_mode = (critic_mode_t)options->critic_mode;
-        critic_processed = apex_process_critic_markup_text(text_ptr, critic_mode);
-        PROFILE_END(critic);
-        if (critic_processed) {
-            text_ptr = critic_processed;
+        if (headerless_tables_processed) {
+            text_ptr = headerless_tables_processed;
         }
     }
 
-    /* Protect Liquid {% ... %} tags so they are not modified by later
-     * processing (including parsing, math, and autolinks). We'll restore
-     * them after rendering the final HTML.
+    /* Preprocess table rows to convert consecutive pipes (|||) to << markers for colspan
+     * This must run after headerless table processing but before caption processing
      */
-    liquid_protected = apex_protect_liquid_tags(text_ptr, &liquid_tags, &liquid_tag_count);
-    if (liquid_protected) {
-        text_ptr = liquid_protected;
-    }
-
-    /* Normalize input after ALL preprocessing: ensure it ends with a newline.
-     * This is critical because various preprocessing steps (definition lists,
-     * HTML markdown, critic markup, liquid protection) might remove the trailing
-     * newline. cmark-gfm requires a trailing newline for proper table parsing,
-     * especially for the last row of a table. */
-    char *final_normalized = NULL;
-    if (!text_ptr) {
-        /* text_ptr should never be NULL, but be defensive */
-        free(working_text);
-        apex_free_metadata(metadata);
-        return NULL;
-    }
-    size_t text_len = strlen(text_ptr);
-    if (text_len == 0) {
-        /* Empty text after preprocessing - use empty string with newline for consistency */
-        final_normalized = malloc(2);
-        if (final_normalized) {
-            final_normalized[0] = '\n';
-            final_normalized[1] = '\0';
-            text_ptr = final_normalized;
-            text_len = 1;
+    char *table_colspans_processed = NULL;
+    char *normalized_for_colspans = NULL;
+    if (options->enable_tables) {
+        /* Normalize text_ptr for table colspan preprocessing if it doesn't end with newline */
+        size_t pre_colspans_len = strlen(text_ptr);
+        bool needs_newline_for_colspans = (pre_colspans_len > 0 &&
+                                           text_ptr[pre_colspans_len - 1] != '\n' &&
+                                           text_ptr[pre_colspans_len - 1] != '\r');
+        if (needs_newline_for_colspans) {
+            normalized_for_colspans = malloc(pre_colspans_len + 2);
+            if (normalized_for_colspans) {
+                memcpy(normalized_for_colspans, text_ptr, pre_colspans_len);
+                normalized_for_colspans[pre_colspans_len] = '\n';
+                normalized_for_colspans[pre_colspans_len + 1] = '\0';
+            }
         }
-    } else {
-        /* Check if we need to add trailing newline - ensure text_len > 0 before accessing text_ptr[text_len - 1] */
-        bool needs_newline = (text_len > 0 && text_ptr[text_len - 1] != '\n' && text_ptr[text_len - 1] != '\r');
-        if (needs_newline) {
-            /* Need to add a trailing line ending - use \n (LF) for consistency */
-            final_normalized = malloc(text_len + 2);  /* +1 for newline, +1 for null term */
-            if (final_normalized) {
-                memcpy(final_normalized, text_ptr, text_len);
-                final_normalized[text_len] = '\n';
-                final_normalized[text_len + 1] = '\0';
-                text_ptr = final_normalized;
-                text_len = text_len + 1;
+
+        STAGE_START(table_colspans_preprocess, text_ptr);
+        table_colspans_processed = apex_preprocess_table_colspans(normalized_for_colspans ? normalized_for_colspans : text_ptr);
+        STAGE_END(table_colspans_preprocess, table_colspans_processed);
+
+        /* Handle cleanup */
+        if (normalized_for_colspans) {
+            if (table_colspans_processed) {
+                free(normalized_for_colspans);
             } else {
-                /* If malloc fails, we can't normalize - but this should never happen in practice */
-                /* Continue with original text_ptr (will likely cause table parsing issue, but better than crashing) */
+                free(normalized_for_colspans);
             }
         }
-    }
-
-    /* Convert options to cmark-gfm format */
-    int cmark_opts = apex_to_cmark_options(options);
 
-    /* Create parser */
-    PROFILE_START(parsing);
-    cmark_parser *parser = cmark_parser_new(cmark_opts);
-    if (!parser) {
-        if (final_normalized) free(final_normalized);
-        free(working_text);
-        apex_free_metadata(metadata);
-        return NULL;
+        if (table_colspans_processed) {
+            text_ptr = table_colspans_processed;
+        }
     }
 
-    /* Register extensions based on mode and options */
-    apex_register_extensions(parser, options);
-
-    /* Feed normalized text to parser */
-    cmark_parser_feed(parser, text_ptr, text_len);
-    cmark_node *document = cmark_parser_finish(parser);
-    PROFILE_END(parsing);
+    /* Normalize table captions before parsing (preprocessing)
+     * - Ensure contiguous [Caption] lines become separate paragraphs
+     * - Convert Pandoc-style 'Table: Caption' lines to [Caption]
+     *
+     * Note: apex_preprocess_table_captions now ensures output ends with newline, but we
+     * normalize here too for safety, in case previous preprocessing removed it.
+     */
+    char *table_captions_processed = NULL;
+    char *normalized_for_caption = NULL;
+    if (options->enable_tables) {
+        /* Normalize text_ptr for table caption preprocessing if it doesn't end with newline */
+        size_t pre_caption_len = strlen(text_ptr);
+        bool needs_newline_for_caption = (pre_caption_len > 0 &&
+                                          text_ptr[pre_caption_len - 1] != '\n' &&
+                                          text_ptr[pre_caption_len - 1] != '\r');
+        if (needs_newline_for_caption) {
+            normalized_for_caption = malloc(pre_caption_len + 2);
+            if (normalized_for_caption) {
+                memcpy(normalized_for_caption, text_ptr, pre_caption_len);
+                normalized_for_caption[pre_caption_len] = '\n';
+                normalized_for_caption[pre_caption_len + 1] = '\0';
+            }
+        }
 
-    /* Free normalized buffer if we allocated it (after parser is finished) */
-    if (final_normalized) {
-        free(final_normalized);
-    }
+        STAGE_START(table_captions_preprocess, text_ptr);
+        table_captions_processed = apex_preprocess_table_captions(normalized_for_caption ? normalized_for_caption : text_ptr);
+        STAGE_END(table_captions_preprocess, table_captions_processed);
 
-    if (!document) {
-        cmark_parser_free(parser);
-        free(working_text);
-        apex_free_metadata(metadata);
-        return NULL;
-    }
+        /* Handle cleanup: apex_preprocess_table_captions always returns a new allocated buffer (or NULL on malloc failure) */
+        if (normalized_for_caption) {
+            if (table_captions_processed) {
+                /* Preprocessing returned a new buffer - free our normalization buffer */
+                free(normalized_for_caption);
+            } else {
+                /* Preprocessing returned NULL (malloc failure) - free normalization buffer and continue with original text_ptr */
+                free(normalized_for_caption);
+            }
+        }
 
-    /* Postprocess wiki links if enabled */
-    if (options->enable_wiki_links) {
-        /* Fast path: skip AST walk if no wiki link markers present */
-        if (strstr(text_ptr, "[[") != NULL) {
-            PROGRESS_REPORT("Processing wiki links", -1);
-            /* Create wiki link configuration from options */
-            wiki_link_config wiki_config;
-            wiki_config.base_path = "";
-            wiki_config.extension = options->wikilink_extension ? options->wikilink_extension : "";
-            wiki_config.space_mode = (wikilink_space_mode_t)options->wikilink_space;
-            apex_process_wiki_links_in_tree(document, &wiki_config);
+        if (table_captions_processed) {
+            text_ptr = table_captions_processed;
         }
     }
 
-    /* Postprocess callouts if enabled */
-    if (options->enable_callouts) {
-        apex_process_callouts_in_tree(document);
+    /* Process definition lists before parsing (preprocessing) */
+    char *deflist_processed = NULL;
+    if (options->enable_definition_lists) {
+        STAGE_START(definition_lists, text_ptr);
+        deflist_processed = apex_process_definition_lists(text_ptr, options->unsafe);
+        STAGE_END(definition_lists, deflist_processed);
+        if (deflist_processed) {
+            text_ptr = deflist_processed;
+        }
     }
 
-    /* Process manual header IDs (MMD [id] and Kramdown {#id}) */
-    if (options->generate_header_ids) {
-        cmark_iter *iter = cmark_iter_new(document);
-        cmark_event_type event;
-        while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-            cmark_node *node = cmark_iter_get_node(iter);
-            if (event == CMARK_EVENT_ENTER && cmark_node_get_type(node) == CMARK_NODE_HEADING) {
-                apex_process_manual_header_id(node);
-            }
+    /* Process fenced divs before parsing (preprocessing) */
+    /* Only enabled in Unified mode */
+    char *fenced_divs_processed = NULL;
+    if (options->enable_divs && options->mode == APEX_MODE_UNIFIED) {
+        STAGE_START(fenced_divs, text_ptr);
+        fenced_divs_processed = apex_process_fenced_divs(text_ptr);
+        STAGE_END(fenced_divs, fenced_divs_processed);
+        if (fenced_divs_processed) {
+            text_ptr = fenced_divs_processed;
         }
-        cmark_iter_free(iter);
     }
 
-    /* Process IAL (Inline Attribute Lists) if in Kramdown or Unified mode */
-    if (alds || options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
-        /* Fast path: skip AST walk if no IAL markers present */
-        /* Check for both Kramdown-style ({:) and Pandoc-style ({# or {.) IALs */
-        if (strstr(text_ptr, "{:") != NULL ||
-            strstr(text_ptr, "{#") != NULL ||
-            strstr(text_ptr, "{.") != NULL) {
-            PROFILE_START(ial);
-            apex_process_ial_in_tree(document, alds);
-            PROFILE_END(ial);
+    /* Process HTML markdown attributes before parsing (preprocessing) */
+    char *html_markdown_processed = NULL;
+    if (options->enable_markdown_in_html) {
+        STAGE_START(html_markdown, text_ptr);
+        html_markdown_processed = apex_process_html_markdown(text_ptr);
+        STAGE_END(html_markdown, html_markdown_processed);
+        if (html_markdown_processed) {
+            text_ptr = html_markdown_processed;
         }
     }
 
-    /* Apply image attributes to image nodes */
-    if (img_attrs) {
-        PROFILE_START(image_attrs);
-        apex_apply_image_attributes(document, img_attrs);
-        PROFILE_END(image_attrs);
-    }
+    /* Process hashtags: convert #tags to span-wrapped hashtags */
+    char *hashtags_processed = NULL;
+    if (options->enable_hashtags && text_ptr) {
+        STAGE_START(hashtags, text_ptr);
+        size_t len = strlen(text_ptr);
+        size_t capacity = len * 3 + 1;  /* Allow expansion with span tags */
+        char *output = malloc(capacity);
+        if (output) {
+            const char *read = text_ptr;
+            char *write = output;
+            size_t remaining = capacity;
+            bool in_code_block = false;
+            int indent_count = 0;
+            bool at_line_start = true;
+
+            while (*read) {
+                /* Track code blocks (4+ spaces or tab at line start) */
+                if (at_line_start) {
+                    if (*read == '\t') {
+                        in_code_block = true;
+                        indent_count = 0;
+                    } else if (*read == ' ') {
+                        indent_count++;
+                        if (indent_count >= 4) {
+                            in_code_block = true;
+                        }
+                    } else if (*read != '\n' && *read != '\r') {
+                        at_line_start = false;
+                        indent_count = 0;
+                    }
+                }
+
+                if (*read == '\n') {
+                    at_line_start = true;
+                    indent_count = 0;
+                    in_code_block = false;
+                }
+
+                /* Skip hashtag processing inside code blocks */
+                if (in_code_block) {
+                    if (remaining < 10) {
+                        size_t written = (size_t)(write - output);
+                        capacity = (written + 100) * 2;
+                        char *new_output = realloc(output, capacity);
+                        if (!new_output) {
+                            free(output);
+                            output = NULL;
+                            break;
+                        }
+                        output = new_output;
+                        write = output + written;
+                        remaining = capacity - written;
+                    }
+                    *write++ = *read++;
+                    remaining--;
+                    continue;
+                }
 
-    /* Merge lists with mixed markers if enabled */
-    if (options->allow_mixed_list_markers) {
-        apex_merge_mixed_list_markers(document);
-    }
+                /* Check for hashtag pattern: # followed by alphanumeric, not preceded by non-whitespace */
+                /* Pattern: (?<=\s|^)#[a-zA-Z0-9][^# \n,;.!\)\]]* */
+                if (*read == '#' && (read == text_ptr || read[-1] == ' ' || read[-1] == '\t' || read[-1] == '\n')) {
+                    const char *tag_start = read;
+                    read++;  /* Skip # */
 
-    /* Note: Critic Markup is now handled via preprocessing (before parsing) */
+                    /* Check if it's a valid hashtag start (alphanumeric) */
+                    if ((*read >= 'a' && *read <= 'z') || (*read >= 'A' && *read <= 'Z') || (*read >= '0' && *read <= '9')) {
+                        /* Find the end of the hashtag */
+                        const char *tag_end = read;
+                        while (*tag_end && *tag_end != '#' && *tag_end != ' ' && *tag_end != '\n' &&
+                               *tag_end != ',' && *tag_end != ';' && *tag_end != '.' && *tag_end != '!' &&
+                               *tag_end != ')' && *tag_end != ']') {
+                            tag_end++;
+                        }
 
-    /* Render to HTML
-     * Use custom renderer when we have attributes (IAL, ALDs, or image attributes)
-     * Otherwise use standard renderer
-     */
-    PROFILE_START(rendering);
-    char *html;
-    if (img_attrs || alds || options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
-        /* Use custom renderer to inject attributes */
-        html = apex_render_html_with_attributes(document, cmark_opts);
-    } else {
-        html = cmark_render_html(document, cmark_opts, NULL);
-    }
-    PROFILE_END(rendering);
+                        /* Check for special case: #tag# format (wrapped in #) */
+                        if (*tag_end == '#') {
+                            tag_end++;  /* Include the closing # */
+                        }
 
-    /* Restore any protected Liquid tags in the rendered HTML */
-    if (html && liquid_tags && liquid_tag_count > 0) {
-        char *restored_html = apex_restore_liquid_tags(html, liquid_tags, liquid_tag_count);
-        if (restored_html) {
-            free(html);
-            html = restored_html;
-        }
-    }
+                        if (tag_end > read) {
+                            /* Valid hashtag found */
+                            size_t tag_len = (size_t)(tag_end - tag_start);
+                            const char *class_name = options->style_hashtags ? "mkstyledtag" : "mkhashtag";
+                            size_t span_prefix_len = strlen("<span class=\"") + strlen(class_name) + strlen("\">");
+                            size_t span_suffix_len = strlen("</span>");
+                            size_t needed = span_prefix_len + tag_len + span_suffix_len;
 
-    /* Post-process HTML for advanced table attributes (rowspan/colspan) */
-    if (options->enable_tables && html) {
-        PROFILE_START(inject_table_attributes);
-        extern char *apex_inject_table_attributes(const char *html, cmark_node *document, int caption_position);
-        char *processed_html = apex_inject_table_attributes(html, document, options->caption_position);
-        PROFILE_END(inject_table_attributes);
-        if (processed_html && processed_html != html) {
-            free(html);
-            html = processed_html;
-        }
-    }
+                            if (needed >= remaining) {
+                                size_t written = (size_t)(write - output);
+                                capacity = (written + needed + 100) * 2;
+                                char *new_output = realloc(output, capacity);
+                                if (!new_output) {
+                                    free(output);
+                                    output = NULL;
+                                    break;
+                                }
+                                output = new_output;
+                                write = output + written;
+                                remaining = capacity - written;
+                            }
 
-    /* Replace <hr> elements with Marked-style page breaks if requested */
-    if (options->hr_page_break && html) {
-        PROFILE_START(hr_page_break);
-        char *processed_html = apex_replace_hr_with_pagebreak(html);
-        PROFILE_END(hr_page_break);
-        if (processed_html && processed_html != html) {
-            free(html);
-            html = processed_html;
-        }
-    }
+                            /* Write opening span */
+                            memcpy(write, "<span class=\"", 13);
+                            write += 13;
+                            remaining -= 13;
+                            memcpy(write, class_name, strlen(class_name));
+                            write += strlen(class_name);
+                            remaining -= strlen(class_name);
+                            memcpy(write, "\">", 2);
+                            write += 2;
+                            remaining -= 2;
 
-    /* Apply widont to headings if requested */
-    if (options->enable_widont && html) {
-        PROFILE_START(widont);
-        char *processed_html = apex_apply_widont_to_headings(html);
-        PROFILE_END(widont);
-        if (processed_html && processed_html != html) {
-            free(html);
-            html = processed_html;
-        }
-    }
+                            /* Write the hashtag */
+                            memcpy(write, tag_start, tag_len);
+                            write += tag_len;
+                            remaining -= tag_len;
 
-    /* Add poetry class to code blocks without language if requested */
-    if (options->code_is_poetry && html) {
-        PROFILE_START(code_is_poetry);
-        char *processed_html = apex_add_poetry_class_to_code_blocks(html);
-        PROFILE_END(code_is_poetry);
-        if (processed_html && processed_html != html) {
-            free(html);
-            html = processed_html;
-        }
-    }
+                            /* Write closing span */
+                            memcpy(write, "</span>", 7);
+                            write += 7;
+                            remaining -= 7;
 
-    /* Add hash prefix to footnote IDs if requested */
-    if (options->random_footnote_ids && html && working_text) {
-        PROFILE_START(footnote_hash_ids);
-        /* Compute hash from original markdown content */
-        char *hash_prefix = apex_compute_document_hash(working_text, strlen(working_text));
-        if (hash_prefix) {
-            char *processed_html = apex_add_hash_to_footnote_ids(html, hash_prefix);
-            if (processed_html && processed_html != html) {
-                free(html);
-                html = processed_html;
+                            read = tag_end;
+                            continue;
+                        }
+                    }
+                    /* Not a valid hashtag, copy the # */
+                    if (remaining < 10) {
+                        size_t written = (size_t)(write - output);
+                        capacity = (written + 100) * 2;
+                        char *new_output = realloc(output, capacity);
+                        if (!new_output) {
+                            free(output);
+                            output = NULL;
+                            break;
+                        }
+                        output = new_output;
+                        write = output + written;
+                        remaining = capacity - written;
+                    }
+                    *write++ = *tag_start;
+                    remaining--;
+                    read = tag_start + 1;
+                } else {
+                    /* Normal character, copy as-is */
+                    if (remaining < 10) {
+                        size_t written = (size_t)(write - output);
+                        capacity = (written + 100) * 2;
+                        char *new_output = realloc(output, capacity);
+                        if (!new_output) {
+                            free(output);
+                            output = NULL;
+                            break;
+                        }
+                        output = new_output;
+                        write = output + written;
+                        remaining = capacity - written;
+                    }
+                    *write++ = *read++;
+                    remaining--;
+                }
             }
-            free(hash_prefix);
-        }
-        PROFILE_END(footnote_hash_ids);
-    }
-
-    /* Insert page break before footnotes section if requested */
-    if (options->page_break_before_footnotes && html) {
-        PROFILE_START(page_break_before_footnotes);
-        const char *marker = "<section class=\"footnotes\"";
-        char *pos = strstr(html, marker);
-        if (pos) {
-            const char *replacement =
-                "<div class=\"mkpagebreak manualbreak\" "
-                "title=\"Page break created before footnotes\" "
-                "data-description=\"PAGE (Footnotes)\" "
-                "style=\"page-break-after:always\">"
-                "<span style=\"display:none\">&nbsp;</span></div>";
-            size_t html_len = strlen(html);
-            size_t prefix_len = (size_t)(pos - html);
-            size_t repl_len = strlen(replacement);
-            size_t new_len = html_len + repl_len;
-            char *with_break = malloc(new_len + 1);
-            if (with_break) {
-                memcpy(with_break, html, prefix_len);
-                memcpy(with_break + prefix_len, replacement, repl_len);
-                memcpy(with_break + prefix_len + repl_len, pos, html_len - prefix_len);
-                with_break[new_len] = '\0';
-                free(html);
-                html = with_break;
+            if (output) {
+                *write = '\0';
+                hashtags_processed = output;
             }
         }
-        PROFILE_END(page_break_before_footnotes);
-    }
-
-    /* Extract metadata values needed for standalone HTML and post-processing BEFORE freeing metadata */
-    /* We need to duplicate strings because metadata will be freed */
-    char *css_metadata = NULL;
-    char *html_header_metadata = NULL;
-    char *html_footer_metadata = NULL;
-    char *language_metadata = NULL;
-    char *quotes_lang_metadata = NULL;
-    int base_header_level = 1;  /* Default is 1 */
-
-    if (metadata) {
-        /* Extract values we'll need later (before metadata is freed) and duplicate them */
-        const char *css_val = apex_metadata_get(metadata, "css");
-        if (css_val) css_metadata = strdup(css_val);
-
-        const char *html_header_val = apex_metadata_get(metadata, "HTML Header");
-        if (!html_header_val) {
-            html_header_val = apex_metadata_get(metadata, "html header");
-        }
-        if (html_header_val) html_header_metadata = strdup(html_header_val);
-
-        const char *html_footer_val = apex_metadata_get(metadata, "HTML Footer");
-        if (!html_footer_val) {
-            html_footer_val = apex_metadata_get(metadata, "html footer");
+        STAGE_END(hashtags, hashtags_processed);
+        if (hashtags_processed) {
+            text_ptr = hashtags_processed;
         }
-        if (html_footer_val) html_footer_metadata = strdup(html_footer_val);
+    }
 
-        const char *lang_val = apex_metadata_get(metadata, "language");
-        if (lang_val) language_metadata = strdup(lang_val);
+    /* Process proofreader mode: convert == and ~~ to CriticMarkup syntax */
+    char *proofreader_processed = NULL;
+    if (options->proofreader_mode && text_ptr) {
+        STAGE_START(proofreader, text_ptr);
+        size_t len = strlen(text_ptr);
+        size_t capacity = len * 2 + 1;  /* Allow expansion */
+        char *output = malloc(capacity);
+        if (output) {
+            const char *read = text_ptr;
+            char *write = output;
+            size_t remaining = capacity;
+            bool in_code_block = false;
+            bool in_inline_code = false;
+            int backtick_count = 0;
 
-        /* Get quotes language */
-        const char *quotes_lang_val = apex_metadata_get(metadata, "Quotes Language");
-        if (!quotes_lang_val) {
-            quotes_lang_val = apex_metadata_get(metadata, "quotes language");
-        }
-        if (!quotes_lang_val) {
-            quotes_lang_val = apex_metadata_get(metadata, "quoteslanguage");
-        }
-        /* If language is set but quotes language is not, use language for quotes */
-        if (!quotes_lang_val && lang_val) {
-            quotes_lang_val = lang_val;
-        }
-        if (quotes_lang_val) quotes_lang_metadata = strdup(quotes_lang_val);
+            while (*read) {
+                /* Track code blocks and inline code to skip processing inside them */
+                if (*read == '`') {
+                    backtick_count++;
+                    if (backtick_count >= 3) {
+                        /* Code block fence */
+                        in_code_block = !in_code_block;
+                        backtick_count = 0;
+                    } else if (!in_code_block) {
+                        /* Check for inline code */
+                        const char *next = read + 1;
+                        if (*next != '`') {
+                            in_inline_code = !in_inline_code;
+                            backtick_count = 0;
+                        }
+                    }
+                } else {
+                    backtick_count = 0;
+                }
 
-        /* Get header level */
-        const char *header_level_str = apex_metadata_get(metadata, "HTML Header Level");
-        if (!header_level_str) {
-            header_level_str = apex_metadata_get(metadata, "Base Header Level");
-        }
-        if (header_level_str) {
-            char *endptr;
-            long level = strtol(header_level_str, &endptr, 10);
-            if (endptr != header_level_str && level >= 1 && level <= 6) {
-                base_header_level = (int)level;
+                if (in_code_block || in_inline_code) {
+                    /* Inside code, copy as-is */
+                    if (remaining < 10) {
+                        size_t written = (size_t)(write - output);
+                        capacity = (written + 100) * 2;
+                        char *new_output = realloc(output, capacity);
+                        if (!new_output) {
+                            free(output);
+                            output = NULL;
+                            break;
+                        }
+                        output = new_output;
+                        write = output + written;
+                        remaining = capacity - written;
+                    }
+                    *write++ = *read++;
+                    remaining--;
+                } else if (read[0] == '=' && read[1] == '=') {
+                    /* Found ==, convert to {== */
+                    const char *start = read;
+                    read += 2;
+                    /* Find matching == */
+                    const char *end = strstr(read, "==");
+                    if (end) {
+                        /* Found matching ==, wrap in {==...==} */
+                        size_t content_len = (size_t)(end - read);
+                        size_t needed = 2 + content_len + 2;  /* {== + content + ==} */
+                        if (needed >= remaining) {
+                            size_t written = (size_t)(write - output);
+                            capacity = (written + needed + 100) * 2;
+                            char *new_output = realloc(output, capacity);
+                            if (!new_output) {
+                                free(output);
+                                output = NULL;
+                                break;
+                            }
+                            output = new_output;
+                            write = output + written;
+                            remaining = capacity - written;
+                        }
+                        *write++ = '{';
+                        *write++ = '=';
+                        *write++ = '=';
+                        remaining -= 3;
+                        memcpy(write, read, content_len);
+                        write += content_len;
+                        remaining -= content_len;
+                        *write++ = '=';
+                        *write++ = '=';
+                        *write++ = '}';
+                        remaining -= 3;
+                        read = end + 2;
+                    } else {
+                        /* No matching ==, copy as-is */
+                        if (remaining < 10) {
+                            size_t written = (size_t)(write - output);
+                            capacity = (written + 100) * 2;
+                            char *new_output = realloc(output, capacity);
+                            if (!new_output) {
+                                free(output);
+                                output = NULL;
+                                break;
+                            }
+                            output = new_output;
+                            write = output + written;
+                            remaining = capacity - written;
+                        }
+                        *write++ = *start++;
+                        *write++ = *start;
+                        remaining -= 2;
+                        read = start + 1;
+                    }
+                } else if (read[0] == '~' && read[1] == '~') {
+                    /* Found ~~, convert to {-- */
+                    const char *start = read;
+                    read += 2;
+                    /* Find matching ~~ */
+                    const char *end = strstr(read, "~~");
+                    if (end) {
+                        /* Found matching ~~, wrap in {--...--} */
+                        size_t content_len = (size_t)(end - read);
+                        size_t needed = 2 + content_len + 2;  /* {-- + content + --} */
+                        if (needed >= remaining) {
+                            size_t written = (size_t)(write - output);
+                            capacity = (written + needed + 100) * 2;
+                            char *new_output = realloc(output, capacity);
+                            if (!new_output) {
+                                free(output);
+                                output = NULL;
+                                break;
+                            }
+                            output = new_output;
+                            write = output + written;
+                            remaining = capacity - written;
+                        }
+                        *write++ = '{';
+                        *write++ = '-';
+                        *write++ = '-';
+                        remaining -= 3;
+                        memcpy(write, read, content_len);
+                        write += content_len;
+                        remaining -= content_len;
+                        *write++ = '-';
+                        *write++ = '-';
+                        *write++ = '}';
+                        remaining -= 3;
+                        read = end + 2;
+                    } else {
+                        /* No matching ~~, copy as-is */
+                        if (remaining < 10) {
+                            size_t written = (size_t)(write - output);
+                            capacity = (written + 100) * 2;
+                            char *new_output = realloc(output, capacity);
+                            if (!new_output) {
+                                free(output);
+                                output = NULL;
+                                break;
+                            }
+                            output = new_output;
+                            write = output + written;
+                            remaining = capacity - written;
+                        }
+                        *write++ = *start++;
+                        *write++ = *start;
+                        remaining -= 2;
+                        read = start + 1;
+                    }
+                } else {
+                    /* Normal character, copy as-is */
+                    if (remaining < 10) {
+                        size_t written = (size_t)(write - output);
+                        capacity = (written + 100) * 2;
+                        char *new_output = realloc(output, capacity);
+                        if (!new_output) {
+                            free(output);
+                            output = NULL;
+                            break;
+                        }
+                        output = new_output;
+                        write = output + written;
+                        remaining = capacity - written;
+                    }
+                    *write++ = *read++;
+                    remaining--;
+                }
             }
-        }
-    }
-
-    /* Adjust header levels and quote language based on metadata */
-    if (html) {
-        if (base_header_level > 1) {
-            PROFILE_START(adjust_header_levels);
-            char *adjusted_html = apex_adjust_header_levels(html, base_header_level);
-            PROFILE_END(adjust_header_levels);
-            if (adjusted_html) {
-                free(html);
-                html = adjusted_html;
+            if (output) {
+                *write = '\0';
+                proofreader_processed = output;
             }
         }
-
-        if (quotes_lang_metadata) {
-            PROFILE_START(adjust_quotes);
-            char *adjusted_quotes = apex_adjust_quote_language(html, quotes_lang_metadata);
-            PROFILE_END(adjust_quotes);
-            if (adjusted_quotes) {
-                free(html);
-                html = adjusted_quotes;
-            }
+        STAGE_END(proofreader, proofreader_processed);
+        if (proofreader_processed) {
+            text_ptr = proofreader_processed;
         }
     }
 
-    /* Inject header IDs if enabled */
-    if (options->generate_header_ids && html) {
-        PROFILE_START(header_ids);
-        char *processed_html = apex_inject_header_ids(html, document, true, options->header_anchors, options->id_format);
-        PROFILE_END(header_ids);
-        if (processed_html && processed_html != html) {
-            free(html);
-            html = processed_html;
+    /* Process Critic Markup before parsing (preprocessing) */
+    char *critic_processed = NULL;
+    if (options->enable_critic_markup) {
+        STAGE_START(critic, text_ptr);
+        critic_mode_t critic_mode = (critic_mode_t)options->critic_mode;
+        critic_processed = apex_process_critic_markup_text(text_ptr, critic_mode);
+        STAGE_END(critic, critic_processed);
+        if (critic_processed) {
+            text_ptr = critic_processed;
         }
     }
 
-    /* Obfuscate email links if requested */
-    if (options->obfuscate_emails && html) {
-        PROFILE_START(obfuscate_emails);
-        char *obfuscated = apex_obfuscate_email_links(html);
-        PROFILE_END(obfuscate_emails);
-        if (obfuscated) {
-            free(html);
-            html = obfuscated;
-        }
+    /* Protect Liquid {% ... %} tags so they are not modified by later
+     * processing (including parsing, math, and autolinks). We'll restore
+     * them after rendering the final HTML.
+     */
+    liquid_protected = apex_protect_liquid_tags(text_ptr, &liquid_tags, &liquid_tag_count);
+    if (liquid_protected) {
+        text_ptr = liquid_protected;
     }
 
-    /* Embed images as base64 data URLs if requested (local images only) */
-    if (options->embed_images && html) {
-        PROFILE_START(embed_images);
-        char *embedded = apex_embed_images(html, options, options->base_directory);
-        PROFILE_END(embed_images);
-        if (embedded) {
-            free(html);
-            html = embedded;
-        }
+    /* Normalize input after ALL preprocessing: ensure it ends with a newline.
+     * This is critical because various preprocessing steps (definition lists,
+     * HTML markdown, critic markup, liquid protection) might remove the trailing
+     * newline. cmark-gfm requires a trailing newline for proper table parsing,
+     * especially for the last row of a table. */
+    char *final_normalized = NULL;
+    if (!text_ptr) {
+        /* text_ptr should never be NULL, but be defensive */
+        free(working_text);
+        apex_csv_tables_free(&csv_tables);
+        if (!segment) apex_free_metadata(metadata);
+        return NULL;
     }
-
-    /* Apply metadata variable replacement if enabled (post-processing for HTML attributes, etc.)
-     * Note: Most replacements happen in preprocessing, but this handles edge cases in HTML
-     */
-    if (metadata && options->enable_metadata_variables && html) {
-        PROFILE_START(metadata_replace);
-        char *replaced = apex_metadata_replace_variables(html, metadata, options);
-        PROFILE_END(metadata_replace);
-        if (replaced && replaced != html) {
-            free(html);
-            html = replaced;
-        } else if (replaced == html) {
-            /* No replacements found, free the duplicate */
-            free(replaced);
+    size_t text_len = strlen(text_ptr);
+    if (text_len == 0) {
+        /* Empty text after preprocessing - use empty string with newline for consistency */
+        final_normalized = malloc(2);
+        if (final_normalized) {
+            final_normalized[0] = '\n';
+            final_normalized[1] = '\0';
+            text_ptr = final_normalized;
+            text_len = 1;
+        }
+    } else {
+        /* Check if we need to add trailing newline - ensure text_len > 0 before accessing text_ptr[text_len - 1] */
+        bool needs_newline = (text_len > 0 && text_ptr[text_len - 1] != '\n' && text_ptr[text_len - 1] != '\r');
+        if (needs_newline) {
+            /* Need to add a trailing line ending - use \n (LF) for consistency */
+            final_normalized = malloc(text_len + 2);  /* +1 for newline, +1 for null term */
+            if (final_normalized) {
+                memcpy(final_normalized, text_ptr, text_len);
+                final_normalized[text_len] = '\n';
+                final_normalized[text_len + 1] = '\0';
+                text_ptr = final_normalized;
+                text_len = text_len + 1;
+            } else {
+                /* If malloc fails, we can't normalize - but this should never happen in practice */
+                /* Continue with original text_ptr (will likely cause table parsing issue, but better than crashing) */
+            }
         }
     }
 
-    /* Process TOC markers if enabled (Marked extensions) */
-    if (options->enable_marked_extensions && html) {
-        PROFILE_START(toc);
-        char *with_toc = apex_process_toc(html, document, options->id_format);
-        PROFILE_END(toc);
-        if (with_toc) {
-            free(html);
-            html = with_toc;
-        }
-    }
+    /* Convert options to cmark-gfm format */
+    int cmark_opts = apex_to_cmark_options(options);
 
-    /* Apply ARIA labels if enabled */
-    if (options->enable_aria && html) {
-        PROFILE_START(aria_labels);
-        char *aria_html = apex_apply_aria_labels(html, document);
-        PROFILE_END(aria_labels);
-        if (aria_html && aria_html != html) {
-            free(html);
-            html = aria_html;
-        }
+    /* Create parser */
+    STAGE_START(parsing, text_ptr);
+    /* The cmark tree lives in the conversion arena until the parser is freed.
+     * Both the arena and the counting allocator count cmark allocations
+     * (parse, AST edits) when collecting metrics. */
+    apex_arena *arena = options->use_arena ? apex_arena_new(0) : NULL;
+    apex_arena *previous_arena = apex_arena_enter(arena);
+    cmark_parser *parser;
+    if (arena) {
+        parser = cmark_parser_new_with_mem(cmark_opts, apex_arena_cmark_mem());
+    } else if (stage_recorder.active) {
+        parser = cmark_parser_new_with_mem(cmark_opts, apex_metrics_counting_mem());
+    } else {
+        parser = cmark_parser_new(cmark_opts);
     }
-
-    /* Apply external syntax highlighting if requested */
-    if (options->code_highlighter && html) {
-        PROFILE_START(syntax_highlight);
-        char *highlighted = apex_apply_syntax_highlighting(html, options->code_highlighter, options->code_line_numbers, options->highlight_language_only);
-        PROFILE_END(syntax_highlight);
-        if (highlighted && highlighted != html) {
-            free(html);
-            html = highlighted;
-        }
+    if (!parser) {
+        apex_arena_leave(previous_arena);
+        apex_arena_free(arena);
+        if (final_normalized) free(final_normalized);
+        free(working_text);
+        apex_csv_tables_free(&csv_tables);
+        if (!segment) apex_free_metadata(metadata);
+        return NULL;
     }
 
-    /* Replace abbreviations if any were found */
-    if (abbreviations && html) {
-        PROFILE_START(abbreviations);
-        char *with_abbrs = apex_replace_abbreviations(html, abbreviations);
-        PROFILE_END(abbreviations);
-        if (with_abbrs) {
-            free(html);
-            html = with_abbrs;
-        }
-    }
+    /* Register extensions based on mode and options */
+    apex_register_extensions(parser, options);
 
-    /* Replace GitHub emoji if in GFM or Unified mode */
-    if ((options->mode == APEX_MODE_GFM || options->mode == APEX_MODE_UNIFIED) && html) {
-        PROFILE_START(emoji);
-        char *with_emoji = apex_replace_emoji(html);
-        PROFILE_END(emoji);
-        if (with_emoji) {
-            free(html);
-            html = with_emoji;
-        }
-    }
+    /* Feed normalized text to parser */
+    cmark_parser_feed(parser, text_ptr, text_len);
+    cmark_node *document = cmark_parser_finish(parser);
+    STAGE_END(parsing, NULL);
 
-    /* Render citations in HTML if enabled and bibliography is available */
-    bool should_render_citations = false;
-    if (citation_registry.bibliography) {
-        should_render_citations = true;
-    } else if (options->bibliography_files) {
-        should_render_citations = true;
-    } else if (options->csl_file) {
-        should_render_citations = true;
-    } else if (metadata) {
-        const char *bib_value = apex_metadata_get(metadata, "bibliography");
-        const char *csl_value = apex_metadata_get(metadata, "csl");
-        if (bib_value || csl_value) {
-            should_render_citations = true;
-        }
+    /* Free normalized buffer if we allocated it (after parser is finished) */
+    if (final_normalized) {
+        free(final_normalized);
     }
 
-    if (options->enable_citations && html && should_render_citations) {
-        if (citation_registry.count > 0) {
-            PROFILE_START(citations_render);
-            char *with_citations = apex_render_citations(html, &citation_registry, options);
-            PROFILE_END(citations_render);
-            if (with_citations) {
-                free(html);
-                html = with_citations;
-            }
-        }
+    if (!document) {
+        cmark_parser_free(parser);
+        apex_arena_leave(previous_arena);
+        apex_arena_free(arena);
+        free(working_text);
+        apex_csv_tables_free(&csv_tables);
+        if (!segment) apex_free_metadata(metadata);
+        return NULL;
+    }
 
-        /* Insert bibliography at marker or end of document (even if no citations, if bibliography loaded) */
-        if (html && !options->suppress_bibliography && citation_registry.bibliography) {
-            PROFILE_START(bibliography);
-            char *with_bibliography = apex_insert_bibliography(html, &citation_registry, options);
-            PROFILE_END(bibliography);
-            if (with_bibliography) {
-                free(html);
-                html = with_bibliography;
-            }
+    /* Postprocess wiki links if enabled */
+    if (options->enable_wiki_links) {
+        /* Fast path: skip AST walk if no wiki link markers present */
+        if (strstr(text_ptr, "[[") != NULL) {
+            PROGRESS_REPORT("Processing wiki links", -1);
+            /* Create wiki link configuration from options */
+            wiki_link_config wiki_config;
+            wiki_config.base_path = "";
+            wiki_config.extension = options->wikilink_extension ? options->wikilink_extension : "";
+            wiki_config.space_mode = (wikilink_space_mode_t)options->wikilink_space;
+            apex_process_wiki_links_in_tree(document, &wiki_config);
         }
     }
 
-    /* Render index markers and insert index */
-    if (options->enable_indices && html && index_registry.count > 0) {
-        PROFILE_START(index_render);
-        char *with_index_markers = apex_render_index_markers(html, &index_registry, options);
-        PROFILE_END(index_render);
-        if (with_index_markers) {
-            free(html);
-            html = with_index_markers;
-        }
+    /* Postprocess callouts if enabled */
+    if (options->enable_callouts) {
+        apex_process_callouts_in_tree(document);
+    }
 
-        /* Insert index at marker or end of document */
-        if (html) {
-            PROFILE_START(index_insert);
-            char *with_index = apex_insert_index(html, &index_registry, options);
-            PROFILE_END(index_insert);
-            if (with_index) {
-                free(html);
-                html = with_index;
+    /* Process manual header IDs (MMD [id] and Kramdown {#id}) */
+    if (options->generate_header_ids) {
+        cmark_iter *iter = cmark_iter_new(document);
+        cmark_event_type event;
+        while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+            cmark_node *node = cmark_iter_get_node(iter);
+            if (event == CMARK_EVENT_ENTER && cmark_node_get_type(node) == CMARK_NODE_HEADING) {
+                apex_process_manual_header_id(node);
             }
         }
+        cmark_iter_free(iter);
     }
 
-    /* Clean up index registry */
-    apex_free_index_registry(&index_registry);
-
-    /* Clean up HTML tag spacing (compress multiple spaces, remove spaces before >) */
-    if (html) {
-        PROFILE_START(html_clean);
-        char *cleaned = apex_clean_html_tag_spacing(html);
-        PROFILE_END(html_clean);
-        if (cleaned) {
-            free(html);
-            html = cleaned;
+    /* Process IAL (Inline Attribute Lists) if in Kramdown or Unified mode */
+    if (alds || options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED) {
+        /* Fast path: skip AST walk if no IAL markers present */
+        /* Check for both Kramdown-style ({:) and Pandoc-style ({# or {.) IALs */
+        if (strstr(text_ptr, "{:") != NULL ||
+            strstr(text_ptr, "{#") != NULL ||
+            strstr(text_ptr, "{.") != NULL) {
+            STAGE_START(ial, NULL);
+            apex_process_ial_in_tree(document, alds);
+            STAGE_END(ial, NULL);
         }
     }
 
-    /* In non-pretty mode, collapse extra newlines between adjacent tags so that
-     * sequences like </table>\n\n<figure> become </table><figure>. This keeps
-     * compact HTML output while still letting pretty mode control layout.
-     */
-    if (html && !local_opts.pretty) {
-        PROFILE_START(collapse_intertag_newlines);
-        char *collapsed = apex_collapse_intertag_newlines(html);
-        PROFILE_END(collapse_intertag_newlines);
-        if (collapsed) {
-            free(html);
-            html = collapsed;
-        }
+    /* Apply image attributes to image nodes */
+    if (img_attrs) {
+        STAGE_START(image_attrs, NULL);
+        apex_apply_image_attributes(document, img_attrs);
+        STAGE_END(image_attrs, NULL);
     }
 
-    /* Convert thead to tbody for relaxed tables and remove empty thead from headerless tables */
-    /* Only run this when relaxed_tables is enabled, otherwise keep thead as-is */
-    if (html && options->enable_tables && options->relaxed_tables) {
-        PROFILE_START(relaxed_tables_convert);
-        char *converted = apex_convert_relaxed_table_headers(html);
-        PROFILE_END(relaxed_tables_convert);
-        if (converted) {
-            free(html);
-            html = converted;
-        }
+    /* Merge lists with mixed markers if enabled */
+    if (options->allow_mixed_list_markers) {
+        apex_merge_mixed_list_markers(document);
     }
 
-    /* Post-process HTML to add style attributes to alpha lists */
-    if (options->allow_alpha_lists && html) {
-        PROFILE_START(alpha_lists_postprocess);
-        char *processed_html = apex_postprocess_alpha_lists_html(html);
-        PROFILE_END(alpha_lists_postprocess);
-        if (processed_html && processed_html != html) {
-            free(html);
-            html = processed_html;
-        }
+    /* Hand the nodes block and inline plugins subscribe to over to them.
+     * Their HTML goes back in as raw HTML nodes, so it renders like any
+     * raw HTML (not at all without options->unsafe). */
+    if (plugin_manager && apex_plugins_have_phase(plugin_manager, APEX_PLUGIN_PHASE_BLOCK | APEX_PLUGIN_PHASE_INLINE)) {
+        STAGE_START(plugins_nodes, NULL);
+        apex_plugins_run_node_phases(plugin_manager, document, cmark_opts, options);
+        STAGE_END(plugins_nodes, NULL);
     }
 
-    /* Remove empty paragraphs created by ^ marker (zero-width space only) */
-    if (html && options->enable_marked_extensions) {
-        PROFILE_START(remove_empty_paragraphs);
-        char *cleaned = apex_remove_empty_paragraphs(html);
-        PROFILE_END(remove_empty_paragraphs);
-        if (cleaned && cleaned != html) {
-            free(html);
-            html = cleaned;
+    /* Note: Critic Markup is now handled via preprocessing (before parsing) */
+
+    /* Render to HTML and run the HTML passes */
+    apex_parsed_tree tree;
+    memset(&tree, 0, sizeof(tree));
+    tree.document = document;
+    tree.attribute_render = img_attrs || alds || options->mode == APEX_MODE_KRAMDOWN || options->mode == APEX_MODE_UNIFIED;
+    tree.liquid_tags = liquid_tags;
+    tree.liquid_tag_count = liquid_tag_count;
+    tree.metadata = metadata;
+    tree.abbreviations = abbreviations;
+    tree.citations = &citation_registry;
+    tree.index = &index_registry;
+    tree.plugins = plugin_manager;
+    tree.source = input_text;
+    tree.source_len = len;
+    tree.csv_tables = &csv_tables;
+    tree.heading_ids = segment ? segment->heading_ids : NULL;
+
+    char *html = NULL;
+    if (keep) {
+        /* Hand the front half's results to the parsed document instead.
+         * Citations, indices and plugins keep state the document cannot
+         * carry, so those documents are not kept. */
+        if (!plugin_manager && !citation_registry.bibliography && citation_registry.count == 0 &&
+            index_registry.count == 0) {
+            keep->root = document;
+            keep->parser = parser;
+            keep->metadata = metadata;
+            keep->abbreviations = abbreviations;
+            keep->alds = alds;
+            keep->liquid_tags = liquid_tags;
+            keep->liquid_tag_count = liquid_tag_count;
+            keep->footnote_hash = apex_compute_document_hash(input_text, len);
+            keep->attribute_render = tree.attribute_render;
+            document = NULL;
+            parser = NULL;
+            metadata = NULL;
+            abbreviations = NULL;
+            alds = NULL;
+            liquid_tags = NULL;
+            liquid_tag_count = 0;
         }
+    } else {
+        html = apex_render_parsed_tree(&tree, options, &stage_recorder);
     }
 
-    /* Clean up */
-    cmark_node_free(document);
-    cmark_parser_free(parser);
+    apex_free_index_registry(&index_registry);
+
+    /* Clean up (nodes from other allocators may be grafted into the tree,
+     * so it is still freed node by node before the arena goes). Without
+     * an arena, node attributes were allocated with malloc. */
+    if (document) {
+        if (!arena) apex_free_node_attributes(document);
+        cmark_node_free(document);
+    }
+    if (parser) cmark_parser_free(parser);
+    apex_arena_leave(previous_arena);
+    apex_arena_free(arena);
     free(working_text);
+    free(alds_stripped);
+    free(abbreviations_stripped);
     if (ial_preprocessed) free(ial_preprocessed);
     if (spans_preprocessed) free(spans_preprocessed);
     if (includes_processed) free(includes_processed);
+    apex_csv_tables_free(&csv_tables);
     if (emoji_autocorrect_processed) free(emoji_autocorrect_processed);
     if (markers_processed_early) {
         /* Only free if alpha_lists_processed didn't use it */
@@ -5425,315 +6359,537 @@ char *apex_markdown_to_html(const char *markdown, size_t len, const apex_options
         }
         free(liquid_tags);
     }
-    apex_free_metadata(metadata);
+    if (!segment) apex_free_metadata(metadata);
     apex_free_abbreviations(abbreviations);
     apex_free_alds(alds);
     apex_free_image_attributes(img_attrs);
-    apex_free_citation_registry(&citation_registry);
-
-    /* Post-render plugin phase: allow plugins to transform the final HTML
-     * fragment before standalone wrapping and pretty-printing.
-     */
-    if (plugin_manager && html) {
-        char *plugin_html = apex_plugins_run_text_phase(plugin_manager,
-                                                        APEX_PLUGIN_PHASE_POST_RENDER,
-                                                        html,
-                                                        &local_opts);
-        if (plugin_html) {
-            free(html);
-            html = plugin_html;
-        }
+    if (borrowed_bibliography) {
+        citation_registry.bibliography = NULL;
     }
+    apex_free_citation_registry(&citation_registry);
 
-    /* Build script HTML (if any) from script_tags before wrapping or appending */
-    char *scripts_html = NULL;
-    if (local_opts.script_tags) {
-        /* Join script tag snippets with newlines */
-        size_t total_len = 0;
-        size_t count = 0;
-        for (char **p = local_opts.script_tags; *p; ++p) {
-            size_t len = strlen(*p);
-            if (len == 0) continue;
-            total_len += len + 1; /* +1 for newline */
-            count++;
-        }
-
-        if (count > 0 && total_len > 0) {
-            scripts_html = malloc(total_len + 1); /* +1 for null terminator */
-            if (scripts_html) {
-                size_t pos = 0;
-                for (char **p = local_opts.script_tags; *p; ++p) {
-                    size_t len = strlen(*p);
-                    if (len == 0) continue;
-                    memcpy(scripts_html + pos, *p, len);
-                    pos += len;
-                    scripts_html[pos++] = '\n';
-                }
-                scripts_html[pos] = '\0';
-            }
-        }
+    /* Free plugin manager after all phases complete (a context keeps its own) */
+    if (plugin_manager && !shared_plugins) {
+        apex_plugins_free(plugin_manager);
     }
 
     /* Undefine the macro */
     #undef options
 
-    /* Free plugin manager after all phases complete */
-    if (plugin_manager) {
-        apex_plugins_free(plugin_manager);
+    apex_stage_report_skipped(&stage_recorder);
+    STAGE_END(total, html);
+
+    apex_stage_print_footer(&stage_recorder);
+
+    return html;
+}
+
+char *apex_markdown_to_html_segment(const char *markdown, size_t len, bool in_place,
+                                    const apex_options *options, apex_segment_context *segment) {
+    return apex_convert(markdown, len, in_place, options, segment, NULL, NULL);
+}
+
+apex_document *apex_parse_document(const char *markdown, size_t len, const apex_options *options) {
+    if (!markdown) return NULL;
+
+    apex_options parse_opts = options ? *options : apex_options_default();
+    /* The tree outlives the conversion, so it cannot live in its arena */
+    parse_opts.use_arena = false;
+
+    apex_document *doc = calloc(1, sizeof(apex_document));
+    if (!doc) return NULL;
+    doc->fingerprint = apex_ast_options_fingerprint(&parse_opts);
+
+    if (len == 0) {
+        markdown = "\n";
+        len = 1;
+    }
+    apex_convert(markdown, len, false, &parse_opts, NULL, doc, NULL);
+    if (!doc->root) {
+        apex_document_free(doc);
+        return NULL;
     }
+    return doc;
+}
 
-    /* Extract title from first H1 if requested and no title is set */
-    char *h1_title = NULL;
-    if (local_opts.title_from_h1 && local_opts.standalone && html &&
-        (!local_opts.document_title || local_opts.document_title[0] == '\0')) {
-        h1_title = apex_extract_first_h1_text(html);
-        if (h1_title) {
-            local_opts.document_title = h1_title;
+char *apex_render_document(const apex_document *doc, const apex_options *options) {
+    if (!doc || !doc->root) return NULL;
+
+    apex_options render_opts = options ? *options : apex_options_default();
+    apex_stage_recorder stage_recorder;
+    apex_stage_recorder_init(&stage_recorder, &render_opts);
+    STAGE_START(total, NULL);
+
+    /* Documents with citations or indices are never parsed for later
+     * rendering, so their registries are empty here */
+    apex_citation_registry citation_registry = {0};
+    apex_index_registry index_registry = {0};
+
+    apex_parsed_tree tree;
+    memset(&tree, 0, sizeof(tree));
+    tree.document = doc->root;
+    tree.attribute_render = doc->attribute_render;
+    tree.liquid_tags = doc->liquid_tags;
+    tree.liquid_tag_count = doc->liquid_tag_count;
+    tree.metadata = doc->metadata;
+    tree.abbreviations = doc->abbreviations;
+    tree.citations = &citation_registry;
+    tree.index = &index_registry;
+    tree.footnote_hash = doc->footnote_hash;
+
+    char *html = apex_render_parsed_tree(&tree, &render_opts, &stage_recorder);
+
+    apex_stage_report_skipped(&stage_recorder);
+    STAGE_END(total, html);
+    apex_stage_print_footer(&stage_recorder);
+    return html;
+}
+
+apex_document *apex_document_load(const char *path, const apex_options *options) {
+    /* Extension node types (tables, strikethrough, task lists) get their
+     * ids when the core extensions are registered */
+    pthread_once(&apex_core_extensions_once, cmark_gfm_core_extensions_ensure_registered);
+
+    apex_options parse_opts = options ? *options : apex_options_default();
+    return apex_ast_read(path, apex_ast_options_fingerprint(&parse_opts));
+}
+
+apex_context *apex_context_new(const apex_options *options) {
+    apex_context *context = calloc(1, sizeof(apex_context));
+    if (!context) return NULL;
+
+    context->options = options ? *options : apex_options_default();
+
+    /* Keep the settings the loaded state came from */
+    if (context->options.base_directory) {
+        context->base_directory = strdup(context->options.base_directory);
+        context->options.base_directory = context->base_directory;
+    }
+    if (context->options.bibliography_files) {
+        size_t count = 0;
+        while (context->options.bibliography_files[count]) count++;
+        context->bibliography_files = calloc(count + 1, sizeof(char *));
+        for (size_t i = 0; context->bibliography_files && i < count; i++) {
+            context->bibliography_files[i] = strdup(context->options.bibliography_files[i]);
         }
+        context->options.bibliography_files = context->bibliography_files;
     }
 
-    /* Wrap in complete HTML document if requested */
-    if (local_opts.standalone && html) {
-        /* CSS precedence: CLI flag (--css/--style) overrides metadata */
-        const char **css_paths = local_opts.stylesheet_paths;
-        size_t css_count = local_opts.stylesheet_count;
+    if (context->options.enable_plugins) {
+        context->plugins = apex_plugins_load(&context->options);
+        context->plugins_loaded = true;
+    }
+    if (context->options.bibliography_files) {
+        context->bibliography = apex_load_bibliography((const char **)context->options.bibliography_files,
+                                                       context->options.base_directory);
+    }
+    return context;
+}
 
-        /* If no CLI stylesheets, check metadata for single CSS path */
-        if (!css_paths || css_count == 0) {
-            if (css_metadata) {
-                /* Allocate array for single metadata stylesheet */
-                css_paths = malloc(2 * sizeof(const char*));
-                if (css_paths) {
-                    css_paths[0] = css_metadata;
-                    css_paths[1] = NULL;
-                    css_count = 1;
-                }
-            }
-        }
+char *apex_context_convert(apex_context *context, const char *markdown, size_t len,
+                           const apex_options *options) {
+    if (!context) return NULL;
+    return apex_convert(markdown, len, false, options ? options : &context->options, NULL, NULL, context);
+}
 
-        /* Combine any existing HTML footer metadata with scripts (footer first, then scripts) */
-        char *footer_with_scripts = NULL;
-        if (html_footer_metadata || scripts_html) {
-            size_t footer_len = html_footer_metadata ? strlen(html_footer_metadata) : 0;
-            size_t scripts_len = scripts_html ? strlen(scripts_html) : 0;
-            size_t extra_newline = (footer_len > 0 && scripts_len > 0) ? 1 : 0;
+void apex_context_free(apex_context *context) {
+    if (!context) return;
+    apex_plugins_free(context->plugins);
+    apex_free_bibliography_registry(context->bibliography);
+    if (context->bibliography_files) {
+        for (char **f = context->bibliography_files; *f; f++) free(*f);
+        free(context->bibliography_files);
+    }
+    free(context->base_directory);
+    free(context);
+}
 
-            footer_with_scripts = malloc(footer_len + extra_newline + scripts_len + 1);
-            if (footer_with_scripts) {
-                size_t pos = 0;
-                if (footer_len > 0) {
-                    memcpy(footer_with_scripts + pos, html_footer_metadata, footer_len);
-                    pos += footer_len;
-                }
-                if (extra_newline) {
-                    footer_with_scripts[pos++] = '\n';
-                }
-                if (scripts_len > 0) {
-                    memcpy(footer_with_scripts + pos, scripts_html, scripts_len);
-                    pos += scripts_len;
-                }
-                footer_with_scripts[pos] = '\0';
-            }
-        }
+/**
+ * Process-level cache of embedded stylesheets
+ *
+ * With embed_stylesheet, each CSS file is read (and, if requested,
+ * minified) once per process. Entries are keyed by the path that was
+ * actually opened and revalidated against mtime and size, so batch runs
+ * and long-lived hosts copy the cached text straight into each document
+ * instead of re-reading the file and splicing it over a <link> tag.
+ * Shared by all threads and guarded by stylesheet_cache_lock.
+ */
+#define APEX_STYLESHEET_CACHE_MAX_BYTES (10 * 1024 * 1024)
+
+typedef struct stylesheet_cache_entry {
+    char *path;
+    time_t mtime;
+    off_t size;
+    char *css;
+    size_t css_len;
+    char *minified;
+    size_t minified_len;
+    struct stylesheet_cache_entry *next;
+} stylesheet_cache_entry;
+
+static stylesheet_cache_entry *stylesheet_cache = NULL;
+static pthread_mutex_t stylesheet_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        const char *footer_to_use = footer_with_scripts ? footer_with_scripts : html_footer_metadata;
+/**
+ * Conservative CSS minifier: drops comments, collapses whitespace runs and
+ * removes whitespace around { } ; , (never around ':' since "a :hover" and
+ * "a:hover" are different selectors). Quoted strings are copied verbatim.
+ */
+static char *apex_minify_css(const char *css, size_t len, size_t *out_len) {
+    char *out = malloc(len + 1);
+    if (!out) return NULL;
 
-        PROFILE_START(standalone_wrap);
-        char *document = apex_wrap_html_document(html, local_opts.document_title, css_paths, css_count,
-                                                 local_opts.code_highlighter, html_header_metadata, footer_to_use,
-                                                 language_metadata);
-        PROFILE_END(standalone_wrap);
+    char *w = out;
+    const char *p = css;
+    const char *end = css + len;
+    bool pending_space = false;
+
+    while (p < end) {
+        if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            const char *close = p + 2;
+            while (close + 1 < end && !(close[0] == '*' && close[1] == '/')) close++;
+            p = (close + 1 < end) ? close + 2 : end;
+            pending_space = true;
+            continue;
+        }
 
-        /* Free temporary metadata stylesheet array if we allocated it */
-        if (css_paths && css_paths[0] == css_metadata) {
-            free((void*)css_paths);
+        char c = *p;
+        if (isspace((unsigned char)c)) {
+            pending_space = true;
+            p++;
+            continue;
         }
-        if (document) {
-            free(html);
-            html = document;
+
+        bool is_punct = (c == '{' || c == '}' || c == ';' || c == ',');
+        if (pending_space && w > out && !is_punct &&
+            w[-1] != '{' && w[-1] != '}' && w[-1] != ';' && w[-1] != ',') {
+            *w++ = ' ';
         }
+        pending_space = false;
 
-        if (footer_with_scripts) {
-            free(footer_with_scripts);
+        if (c == '}' && w > out && w[-1] == ';') {
+            w--;
         }
 
-        /* If requested, replace stylesheet links with embedded CSS contents */
-        if (html && css_paths && css_count > 0 && local_opts.embed_stylesheet) {
-            /* Process each stylesheet in reverse order to maintain correct positions */
-            for (int i = (int)css_count - 1; i >= 0; i--) {
-                if (!css_paths[i]) continue;
-
-                const char *css_path = css_paths[i];
-                char *css_content = NULL;
-                size_t css_len = 0;
-
-                /* Helper lambda-like block to read file into memory */
-                {
-                    FILE *css_fp = fopen(css_path, "rb");
-                    if (!css_fp && local_opts.base_directory && local_opts.base_directory[0] != '\0') {
-                        /* Try base_directory + "/" + css_path */
-                        size_t base_len = strlen(local_opts.base_directory);
-                        size_t path_len = strlen(css_path);
-                        size_t full_len = base_len + 1 + path_len + 1;
-                        char *full_path = malloc(full_len);
-                        if (full_path) {
-                            snprintf(full_path, full_len, "%s/%s", local_opts.base_directory, css_path);
-                            css_fp = fopen(full_path, "rb");
-                            free(full_path);
-                        }
-                    }
+        if (c == '"' || c == '\'') {
+            const char *start = p++;
+            while (p < end && *p != c) {
+                if (*p == '\\' && p + 1 < end) p++;
+                p++;
+            }
+            if (p < end) p++;
+            memcpy(w, start, (size_t)(p - start));
+            w += p - start;
+            continue;
+        }
 
-                    if (css_fp) {
-                        if (fseek(css_fp, 0, SEEK_END) == 0) {
-                            long fsize = ftell(css_fp);
-                            if (fsize >= 0 && fsize < 10 * 1024 * 1024) { /* 10MB safety limit */
-                                rewind(css_fp);
-                                css_content = malloc((size_t)fsize + 1);
-                                if (css_content) {
-                                    css_len = fread(css_content, 1, (size_t)fsize, css_fp);
-                                    css_content[css_len] = '\0';
-                                }
-                            }
-                        }
-                        fclose(css_fp);
-                    }
-                }
+        *w++ = c;
+        p++;
+    }
 
-                if (css_content && css_len > 0) {
-                    /* Build the exact link line we expect from apex_wrap_html_document */
-                    char link_line[2048];
-                    int link_n = snprintf(link_line, sizeof(link_line),
-                                          "  <link rel=\"stylesheet\" href=\"%s\">\n",
-                                          css_path);
-                    if (link_n > 0 && (size_t)link_n < sizeof(link_line)) {
-                        char *pos = strstr(html, link_line);
-                        if (pos) {
-                            size_t html_len = strlen(html);
-                            size_t link_len = (size_t)link_n;
-                            const char *style_prefix = "  <style>\n";
-                            const char *style_suffix = "\n  </style>\n";
-                            size_t prefix_len = strlen(style_prefix);
-                            size_t suffix_len = strlen(style_suffix);
-
-                            size_t new_len = html_len - link_len + prefix_len + css_len + suffix_len;
-                            char *embedded = malloc(new_len + 1);
-                            if (embedded) {
-                                size_t before_len = (size_t)(pos - html);
-                                memcpy(embedded, html, before_len);
-                                size_t offset = before_len;
-
-                                memcpy(embedded + offset, style_prefix, prefix_len);
-                                offset += prefix_len;
-
-                                memcpy(embedded + offset, css_content, css_len);
-                                offset += css_len;
-
-                                memcpy(embedded + offset, style_suffix, suffix_len);
-                                offset += suffix_len;
-
-                                size_t after_len = html_len - before_len - link_len;
-                                if (after_len > 0) {
-                                    memcpy(embedded + offset, pos + link_len, after_len);
-                                    offset += after_len;
-                                }
+    *w = '\0';
+    *out_len = (size_t)(w - out);
+    return out;
+}
 
-                                embedded[offset] = '\0';
-                                free(html);
-                                html = embedded;
-                            }
-                        }
-                    }
-                    free(css_content);
-                }
-            }
-        }
-    } else if (html && scripts_html) {
-        /* Snippet mode: append scripts to the end of the HTML fragment */
-        size_t html_len = strlen(html);
-        size_t scripts_len = strlen(scripts_html);
-        size_t extra_newline = (html_len > 0 && scripts_len > 0 && html[html_len - 1] != '\n') ? 1 : 0;
+/**
+ * Look up (or load and insert) the contents of a stylesheet to embed.
+ * The path is tried as given and then relative to base_directory.
+ * Returns NULL if the file cannot be read or is empty; the returned text
+ * is owned by the cache and the cache stays locked until the caller has
+ * copied it and called apex_stylesheet_cache_release().
+ */
+static const char *apex_stylesheet_cache_get(const char *css_path, const char *base_directory, bool minify, size_t *len) {
+    struct stat st;
+    char *resolved = NULL;
 
-        char *combined = malloc(html_len + extra_newline + scripts_len + 1);
-        if (combined) {
-            size_t pos = 0;
-            if (html_len > 0) {
-                memcpy(combined + pos, html, html_len);
-                pos += html_len;
-            }
-            if (extra_newline) {
-                combined[pos++] = '\n';
-            }
-            if (scripts_len > 0) {
-                memcpy(combined + pos, scripts_html, scripts_len);
-                pos += scripts_len;
+    if (stat(css_path, &st) == 0) {
+        resolved = strdup(css_path);
+    } else if (base_directory && base_directory[0] != '\0') {
+        size_t full_len = strlen(base_directory) + 1 + strlen(css_path) + 1;
+        resolved = malloc(full_len);
+        if (resolved) {
+            snprintf(resolved, full_len, "%s/%s", base_directory, css_path);
+            if (stat(resolved, &st) != 0) {
+                free(resolved);
+                resolved = NULL;
             }
-            combined[pos] = '\0';
-
-            free(html);
-            html = combined;
         }
     }
+    if (!resolved) return NULL;
 
-    if (scripts_html) {
-        free(scripts_html);
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size >= APEX_STYLESHEET_CACHE_MAX_BYTES) {
+        free(resolved);
+        return NULL;
     }
 
-    /* Free duplicated metadata strings */
-    if (css_metadata) free(css_metadata);
-    if (html_header_metadata) free(html_header_metadata);
-    if (html_footer_metadata) free(html_footer_metadata);
-    if (language_metadata) free(language_metadata);
-    if (quotes_lang_metadata) free(quotes_lang_metadata);
-    if (h1_title) free(h1_title);
+    pthread_mutex_lock(&stylesheet_cache_lock);
+    stylesheet_cache_entry *entry = stylesheet_cache;
+    while (entry && strcmp(entry->path, resolved) != 0) entry = entry->next;
 
-    /* Remove blank lines within tables (applies to both pretty and non-pretty) */
-    if (html) {
-        PROFILE_START(remove_table_blank_lines);
-        char *cleaned = apex_remove_table_blank_lines(html);
-        PROFILE_END(remove_table_blank_lines);
-        if (cleaned) {
-            free(html);
-            html = cleaned;
+    if (!entry || entry->mtime != st.st_mtime || entry->size != st.st_size) {
+        FILE *css_fp = fopen(resolved, "rb");
+        if (!css_fp) {
+            pthread_mutex_unlock(&stylesheet_cache_lock);
+            free(resolved);
+            return NULL;
         }
-    }
+        char *css = malloc((size_t)st.st_size + 1);
+        size_t css_len = css ? fread(css, 1, (size_t)st.st_size, css_fp) : 0;
+        fclose(css_fp);
+        if (!css || css_len == 0) {
+            pthread_mutex_unlock(&stylesheet_cache_lock);
+            free(css);
+            free(resolved);
+            return NULL;
+        }
+        css[css_len] = '\0';
 
-    /* Remove table separator rows that were incorrectly rendered as data rows */
-    /* This happens when smart typography converts --- to — in separator rows */
-    if (html && local_opts.enable_tables) {
-        PROFILE_START(remove_table_separator_rows);
-        extern char *apex_remove_table_separator_rows(const char *html);
-        char *cleaned = apex_remove_table_separator_rows(html);
-        PROFILE_END(remove_table_separator_rows);
-        if (cleaned) {
-            free(html);
-            html = cleaned;
+        if (!entry) {
+            entry = calloc(1, sizeof(stylesheet_cache_entry));
+            if (!entry) {
+                pthread_mutex_unlock(&stylesheet_cache_lock);
+                free(css);
+                free(resolved);
+                return NULL;
+            }
+            entry->path = resolved;
+            resolved = NULL;
+            entry->next = stylesheet_cache;
+            stylesheet_cache = entry;
+        } else {
+            free(entry->css);
+            free(entry->minified);
+            entry->minified = NULL;
+            entry->minified_len = 0;
         }
+        entry->mtime = st.st_mtime;
+        entry->size = st.st_size;
+        entry->css = css;
+        entry->css_len = css_len;
     }
+    free(resolved);
 
-    /* Pretty-print HTML if requested */
-    if (local_opts.pretty && html) {
-        PROFILE_START(pretty_print);
-        char *pretty = apex_pretty_print_html(html);
-        PROFILE_END(pretty_print);
-        if (pretty) {
-            free(html);
-            html = pretty;
+    if (minify) {
+        if (!entry->minified) {
+            entry->minified = apex_minify_css(entry->css, entry->css_len, &entry->minified_len);
+        }
+        if (entry->minified && entry->minified_len > 0) {
+            *len = entry->minified_len;
+            return entry->minified;
         }
     }
 
-    PROFILE_END(total);
+    *len = entry->css_len;
+    return entry->css;
+}
 
-    if (profiling_enabled()) {
-        fprintf(stderr, "[PROFILE] %-30s: %8s\n", "---", "---");
-    }
+/**
+ * Unlock the cache after using text returned by apex_stylesheet_cache_get
+ */
+static void apex_stylesheet_cache_release(void) {
+    pthread_mutex_unlock(&stylesheet_cache_lock);
+}
 
-    return html;
+/**
+ * Release all cached stylesheets
+ */
+void apex_stylesheet_cache_clear(void) {
+    pthread_mutex_lock(&stylesheet_cache_lock);
+    stylesheet_cache_entry *entry = stylesheet_cache;
+    while (entry) {
+        stylesheet_cache_entry *next = entry->next;
+        free(entry->path);
+        free(entry->css);
+        free(entry->minified);
+        free(entry);
+        entry = next;
+    }
+    stylesheet_cache = NULL;
+    pthread_mutex_unlock(&stylesheet_cache_lock);
+}
+
+/* Fixed <head> blocks, emitted verbatim (split to stay under C99 string literal limits) */
+static const char apex_highlight_styles[] =
+    "  <style>\n"
+    "    /* GitHub-style syntax highlighting for Pygments and Skylighting */\n"
+    "    /* Don't apply background to wrapper when code highlighting is enabled - let default styles handle it */\n"
+    "    .code-highlighted .highlight, .code-highlighted .sourceCode { background: inherit; border-radius: 6px; padding: 16px; overflow-x: auto; }\n"
+    "    .highlight pre, .sourceCode pre { margin: 0; padding: 0; background: transparent; }\n"
+    "    .highlight code, .sourceCode code { font-family: 'SFMono-Regular', Consolas, 'Liberation Mono', Menlo, monospace; font-size: 12px; line-height: 1.45; }\n"
+    "    /* Pygments classes */\n";
+
+static const char apex_highlight_styles_pygments[] =
+    "    .highlight .k { color: #d73a49; font-weight: 600; } /* Keyword */\n"
+    "    .highlight .kt { color: #d73a49; } /* Keyword.Type */\n"
+    "    .highlight .kd { color: #d73a49; font-weight: 600; } /* Keyword.Declaration */\n"
+    "    .highlight .kn { color: #d73a49; } /* Keyword.Namespace */\n"
+    "    .highlight .kp { color: #d73a49; } /* Keyword.Pseudo */\n"
+    "    .highlight .kr { color: #d73a49; font-weight: 600; } /* Keyword.Reserved */\n"
+    "    .highlight .n { color: #6f42c1; } /* Name */\n"
+    "    .highlight .na { color: #6f42c1; } /* Name.Attribute */\n"
+    "    .highlight .nc { color: #6f42c1; font-weight: 600; } /* Name.Class */\n"
+    "    .highlight .no { color: #005cc5; } /* Name.Constant */\n"
+    "    .highlight .nd { color: #6f42c1; font-weight: 600; } /* Name.Decorator */\n"
+    "    .highlight .ni { color: #800080; } /* Name.Entity */\n"
+    "    .highlight .ne { color: #990000; font-weight: 600; } /* Name.Exception */\n"
+    "    .highlight .nf { color: #6f42c1; font-weight: 600; } /* Name.Function */\n"
+    "    .highlight .nl { color: #6f42c1; } /* Name.Label */\n"
+    "    .highlight .nn { color: #555; } /* Name.Namespace */\n"
+    "    .highlight .nt { color: #22863a; } /* Name.Tag */\n"
+    "    .highlight .nv { color: #e36209; } /* Name.Variable */\n"
+    "    .highlight .s { color: #032f62; } /* String */\n"
+    "    .highlight .sb { color: #032f62; } /* String.Backtick */\n"
+    "    .highlight .sc { color: #032f62; } /* String.Char */\n"
+    "    .highlight .sd { color: #032f62; } /* String.Doc */\n"
+    "    .highlight .s2 { color: #032f62; } /* String.Double */\n"
+    "    .highlight .se { color: #032f62; } /* String.Escape */\n"
+    "    .highlight .sh { color: #032f62; } /* String.Heredoc */\n"
+    "    .highlight .si { color: #032f62; } /* String.Interpol */\n"
+    "    .highlight .sx { color: #032f62; } /* String.Other */\n"
+    "    .highlight .sr { color: #032f62; } /* String.Regex */\n"
+    "    .highlight .s1 { color: #032f62; } /* String.Single */\n"
+    "    .highlight .ss { color: #032f62; } /* String.Symbol */\n"
+    "    .highlight .c { color: #6a737d; font-style: italic; } /* Comment */\n"
+    "    .highlight .c1 { color: #6a737d; font-style: italic; } /* Comment.Single */\n"
+    "    .highlight .cm { color: #6a737d; font-style: italic; } /* Comment.Multiline */\n"
+    "    .highlight .cp { color: #6a737d; font-weight: 600; } /* Comment.Preproc */\n"
+    "    .highlight .cs { color: #6a737d; font-weight: 600; font-style: italic; } /* Comment.Special */\n"
+    "    .highlight .m { color: #005cc5; } /* Literal.Number */\n"
+    "    .highlight .mb { color: #005cc5; } /* Literal.Number.Bin */\n"
+    "    .highlight .mf { color: #005cc5; } /* Literal.Number.Float */\n"
+    "    .highlight .mh { color: #005cc5; } /* Literal.Number.Hex */\n"
+    "    .highlight .mi { color: #005cc5; } /* Literal.Number.Integer */\n"
+    "    .highlight .il { color: #005cc5; } /* Literal.Number.Integer.Long */\n"
+    "    .highlight .mo { color: #005cc5; } /* Literal.Number.Oct */\n"
+    "    .highlight .o { color: #d73a49; } /* Operator */\n"
+    "    .highlight .ow { color: #d73a49; } /* Operator.Word */\n"
+    "    .highlight .p { color: #24292e; } /* Punctuation */\n"
+    "    .highlight .w { color: #e1e4e8; } /* Text.Whitespace */\n"
+    "    /* Skylighting classes */\n";
+
+static const char apex_highlight_styles_skylighting[] =
+    "    .sourceCode .kw { color: #d73a49; font-weight: 600; } /* Keyword */\n"
+    "    .sourceCode .dt { color: #6f42c1; } /* DataType */\n"
+    "    .sourceCode .dv { color: #005cc5; } /* DecVal */\n"
+    "    .sourceCode .bn { color: #005cc5; } /* BaseN */\n"
+    "    .sourceCode .fl { color: #005cc5; } /* Float */\n"
+    "    .sourceCode .ch { color: #032f62; } /* Char */\n"
+    "    .sourceCode .st { color: #032f62; } /* String */\n"
+    "    .sourceCode .co { color: #6a737d; font-style: italic; } /* Comment */\n"
+    "    .sourceCode .ot { color: #22863a; } /* Other */\n"
+    "    .sourceCode .al { color: #e36209; font-weight: 600; } /* Alert */\n"
+    "    .sourceCode .fu { color: #6f42c1; font-weight: 600; } /* Function */\n"
+    "    .sourceCode .re { color: #032f62; } /* RegionMarker */\n"
+    "    .sourceCode .er { color: #d73a49; font-weight: 600; } /* Error */\n"
+    "    .sourceCode .cf { color: #d73a49; font-weight: 600; } /* ControlFlow */\n"
+    "    .sourceCode .op { color: #d73a49; } /* Operator */\n"
+    "    .sourceCode .pp { color: #6a737d; } /* Preprocessor */\n"
+    "    .sourceCode .at { color: #005cc5; } /* Attribute */\n"
+    "    .sourceCode .do { color: #6a737d; font-style: italic; } /* Documentation */\n"
+    "    .sourceCode .an { color: #6a737d; font-weight: 600; } /* Annotation */\n"
+    "    .sourceCode .cv { color: #6a737d; font-weight: 600; font-style: italic; } /* CommentVar */\n"
+    "    .sourceCode .in { color: #6a737d; } /* Information */\n"
+    "    .sourceCode .wa { color: #e36209; font-weight: 600; } /* Warning */\n"
+    "    .sourceCode .im { color: #d73a49; } /* Import */\n"
+    "    .sourceCode .bu { color: #005cc5; } /* BuiltIn */\n"
+    "    .sourceCode .ex { color: #6f42c1; } /* Extension */\n"
+    "    .sourceCode .va { color: #e36209; } /* Variable */\n"
+    "    .sourceCode .ss { color: #032f62; } /* SpecialString */\n"
+    "    .sourceCode .sc { color: #032f62; } /* SpecialChar */\n"
+    "    .sourceCode .vs { color: #032f62; } /* VerbatimString */\n"
+    "    .sourceCode .il { color: #005cc5; } /* Special */\n"
+    "    /* Line numbers (Skylighting) */\n"
+    "    .sourceCode.numberSource .sourceCode { counter-reset: line; }\n"
+    "    .sourceCode.numberSource .sourceCode > span { position: relative; left: -4em; counter-increment: line; }\n"
+    "    .sourceCode.numberSource .sourceCode > span > a:first-child::before { content: counter(line); position: relative; left: -1em; text-align: right; vertical-align: baseline; border: none; display: inline-block; min-width: 1em; padding-right: 0.5em; color: #aaa; }\n"
+    "  </style>\n";
+
+static const char apex_default_styles[] =
+    "  <style>\n"
+    "    body {\n"
+    "      font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Helvetica, Arial, sans-serif;\n"
+    "      line-height: 1.6;\n"
+    "      max-width: 800px;\n"
+    "      margin: 2rem auto;\n"
+    "      padding: 0 1rem;\n"
+    "      color: #333;\n"
+    "    }\n"
+    "    pre { background: #f5f5f5; padding: 1rem; overflow-x: auto; }\n"
+    "    code { background: #f0f0f0; padding: 0.2em 0.4em; border-radius: 3px; }\n"
+    "    blockquote { border-left: 4px solid #ddd; margin: 0; padding-left: 1rem; color: #666; }\n"
+    "    table { border-collapse: collapse; width: 100%%; }\n"
+    "    th, td { border: 1px solid #ddd; padding: 0.5rem; }\n"
+    "    th { background: #f5f5f5; }\n"
+    "    tfoot td { background: #e8e8e8; }\n"
+    "    figure.table-figure { width: fit-content; margin: 1em 0; }\n"
+    "    figure.table-figure table { width: auto; }\n"
+    "    figcaption { text-align: center; font-weight: bold; font-size: 0.8em; }\n"
+    "    .page-break { page-break-after: always; }\n"
+    "    .callout { padding: 1rem; margin: 1rem 0; border-left: 4px solid; }\n"
+    "    .callout-note { border-color: #3b82f6; background: #eff6ff; }\n"
+    "    .callout-warning { border-color: #f59e0b; background: #fffbeb; }\n"
+    "    .callout-tip { border-color: #10b981; background: #f0fdf4; }\n"
+    "    .callout-danger { border-color: #ef4444; background: #fef2f2; }\n"
+    "    ins { background: #d4fcbc; text-decoration: none; }\n"
+    "    del { background: #fbb6c2; text-decoration: line-through; }\n"
+    "    mark { background: #fff3cd; }\n"
+    "    .critic.comment { background: #e7e7e7; color: #666; font-style: italic; }\n"
+    "    .mkhashtag { color: #666; }\n"
+    "    .mkstyledtag {\n"
+    "      display: inline-block;\n"
+    "      background: #e0e0e0;\n"
+    "      padding: 3px 9px;\n"
+    "      border-radius: 20px;\n"
+    "      font-size: 0.9em;\n"
+    "      line-height: 1.4;\n"
+    "      color: #333;\n"
+    "      margin: 0 2px;\n"
+    "    }\n"
+    "  </style>\n";
+
+/* Growable buffer for the document head/tail templates */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} wrap_buf;
+
+static void wrap_buf_append(wrap_buf *buf, const char *text, size_t len) {
+    if (buf->failed || len == 0) return;
+    if (buf->len + len + 1 > buf->cap) {
+        size_t new_cap = buf->cap ? buf->cap : 1024;
+        while (buf->len + len + 1 > new_cap) new_cap *= 2;
+        char *new_data = realloc(buf->data, new_cap);
+        if (!new_data) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = new_data;
+        buf->cap = new_cap;
+    }
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void wrap_buf_puts(wrap_buf *buf, const char *text) {
+    wrap_buf_append(buf, text, strlen(text));
 }
 
 /**
- * Wrap HTML content in complete HTML5 document structure
+ * Build a standalone document as head + content + tail. The head and tail
+ * are assembled first (with embedded stylesheets copied straight from the
+ * stylesheet cache), then the three parts are joined in one allocation,
+ * or streamed through the pretty-printer when pretty is set.
  */
-char *apex_wrap_html_document(const char *content, const char *title, const char **stylesheet_paths, size_t stylesheet_count, const char *code_highlighter, const char *html_header, const char *html_footer, const char *language) {
+static char *apex_wrap_html_document_internal(const char *content, const char *title,
+                                              const char **stylesheet_paths, size_t stylesheet_count,
+                                              const char *code_highlighter, const char *html_header,
+                                              const char *html_footer, const char *language,
+                                              bool embed_stylesheets, bool minify_stylesheets,
+                                              const char *base_directory, bool pretty) {
     if (!content) return NULL;
 
     const char *doc_title = title ? title : "Document";
@@ -5788,426 +6944,118 @@ char *apex_wrap_html_document(const char *content, const char *title, const char
             }
         }
     }
-    size_t title_len = strlen(doc_title);
-    /* Calculate total length for all stylesheet links */
-    size_t style_len = 0;
-    if (stylesheet_paths && stylesheet_count > 0) {
-        for (size_t i = 0; i < stylesheet_count && stylesheet_paths[i]; i++) {
-            style_len += strlen(stylesheet_paths[i]) + 50; /* +50 for link tag overhead */
-        }
-    }
-    /* Add space for syntax highlighting CSS if needed */
-    size_t syntax_css_len = 0;
-    if (code_highlighter) {
-        syntax_css_len = 8000; /* Approximate size for syntax CSS */
-    }
-    size_t header_len = html_header ? strlen(html_header) : 0;
-    size_t footer_len = html_footer ? strlen(html_footer) : 0;
-    size_t lang_len = strlen(lang);
-    /* Need generous space for styles (1.5KB) + structure + header + footer + syntax CSS */
-    size_t capacity = content_len + title_len + style_len + syntax_css_len + header_len + footer_len + lang_len + 4096;
-
-    char *output = malloc(capacity + 1);  /* +1 for null terminator */
-    if (!output) return strdup(content);
-
-    char *write = output;
-    size_t remaining = capacity + 1;  /* Include null terminator in remaining count */
 
     /* Ensure we have a valid version string */
     const char *version_str = APEX_VERSION_STRING;
     if (!version_str) version_str = "unknown";
 
-    /* HTML5 doctype and opening */
-    /* Add body class if code highlighting is enabled */
-    const char *body_class = code_highlighter ? " class=\"code-highlighted\"" : "";
-    int n = snprintf(write, remaining, "<!DOCTYPE html>\n<html lang=\"%s\">\n<head>\n", lang);
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
-    }
-    write += n;
-    remaining -= n;
-
-    /* Meta tags */
-    n = snprintf(write, remaining, "  <meta charset=\"UTF-8\">\n");
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
-    }
-    write += n;
-    remaining -= n;
-
-    n = snprintf(write, remaining, "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n");
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
-    }
-    write += n;
-    remaining -= n;
-
-    n = snprintf(write, remaining, "  <meta name=\"generator\" content=\"Apex %s\">\n", version_str);
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
-    }
-    write += n;
-    remaining -= n;
-
-    /* Title */
-    n = snprintf(write, remaining, "  <title>%s</title>\n", doc_title);
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
-    }
-    write += n;
-    remaining -= n;
+    /* Head: doctype through the opening <body> tag */
+    wrap_buf head = {0};
+    wrap_buf_puts(&head, "<!DOCTYPE html>\n<html lang=\"");
+    wrap_buf_puts(&head, lang);
+    wrap_buf_puts(&head, "\">\n<head>\n"
+                         "  <meta charset=\"UTF-8\">\n"
+                         "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
+                         "  <meta name=\"generator\" content=\"Apex ");
+    wrap_buf_puts(&head, version_str);
+    wrap_buf_puts(&head, "\">\n  <title>");
+    wrap_buf_puts(&head, doc_title);
+    wrap_buf_puts(&head, "</title>\n");
 
     /* Syntax highlighting CSS if code highlighter is enabled */
     if (code_highlighter) {
-        /* Write CSS directly to buffer to avoid string literal length warning */
-        n = snprintf(write, remaining, "  <style>\n"
-            "    /* GitHub-style syntax highlighting for Pygments and Skylighting */\n"
-            "    /* Don't apply background to wrapper when code highlighting is enabled - let default styles handle it */\n"
-            "    .code-highlighted .highlight, .code-highlighted .sourceCode { background: inherit; border-radius: 6px; padding: 16px; overflow-x: auto; }\n"
-            "    .highlight pre, .sourceCode pre { margin: 0; padding: 0; background: transparent; }\n"
-            "    .highlight code, .sourceCode code { font-family: 'SFMono-Regular', Consolas, 'Liberation Mono', Menlo, monospace; font-size: 12px; line-height: 1.45; }\n");
-        if (n < 0 || (size_t)n >= remaining) {
-            /* Need to expand buffer */
-            size_t written = write - output;
-            size_t new_cap = (written + 6000) * 2;
-            char *new_output = realloc(output, new_cap);
-            if (!new_output) {
-                free(output);
-                return strdup(content);
-            }
-            output = new_output;
-            write = output + written;
-            remaining = new_cap - written;
-            capacity = new_cap;
-            /* Retry */
-            n = snprintf(write, remaining, "  <style>\n"
-                "    /* GitHub-style syntax highlighting for Pygments and Skylighting */\n"
-                "    /* Don't apply background to wrapper when code highlighting is enabled - let default styles handle it */\n"
-                "    .code-highlighted .highlight, .code-highlighted .sourceCode { background: inherit; border-radius: 6px; padding: 16px; overflow-x: auto; }\n"
-                "    .highlight pre, .sourceCode pre { margin: 0; padding: 0; background: transparent; }\n"
-                "    .highlight code, .sourceCode code { font-family: 'SFMono-Regular', Consolas, 'Liberation Mono', Menlo, monospace; font-size: 12px; line-height: 1.45; }\n");
-            if (n < 0 || (size_t)n >= remaining) {
-                free(output);
-                return strdup(content);
-            }
-        }
-        write += n;
-        remaining -= n;
-
-        /* Write Pygments classes comment */
-        n = snprintf(write, remaining, "    /* Pygments classes */\n");
-        if (n < 0 || (size_t)n >= remaining) {
-            free(output);
-            return strdup(content);
-        }
-        write += n;
-        remaining -= n;
-
-        /* Write Pygments classes in chunks */
-        const char *pygments_css =
-            "    .highlight .k { color: #d73a49; font-weight: 600; } /* Keyword */\n"
-            "    .highlight .kt { color: #d73a49; } /* Keyword.Type */\n"
-            "    .highlight .kd { color: #d73a49; font-weight: 600; } /* Keyword.Declaration */\n"
-            "    .highlight .kn { color: #d73a49; } /* Keyword.Namespace */\n"
-            "    .highlight .kp { color: #d73a49; } /* Keyword.Pseudo */\n"
-            "    .highlight .kr { color: #d73a49; font-weight: 600; } /* Keyword.Reserved */\n"
-            "    .highlight .n { color: #6f42c1; } /* Name */\n"
-            "    .highlight .na { color: #6f42c1; } /* Name.Attribute */\n"
-            "    .highlight .nc { color: #6f42c1; font-weight: 600; } /* Name.Class */\n"
-            "    .highlight .no { color: #005cc5; } /* Name.Constant */\n"
-            "    .highlight .nd { color: #6f42c1; font-weight: 600; } /* Name.Decorator */\n"
-            "    .highlight .ni { color: #800080; } /* Name.Entity */\n"
-            "    .highlight .ne { color: #990000; font-weight: 600; } /* Name.Exception */\n"
-            "    .highlight .nf { color: #6f42c1; font-weight: 600; } /* Name.Function */\n"
-            "    .highlight .nl { color: #6f42c1; } /* Name.Label */\n"
-            "    .highlight .nn { color: #555; } /* Name.Namespace */\n"
-            "    .highlight .nt { color: #22863a; } /* Name.Tag */\n"
-            "    .highlight .nv { color: #e36209; } /* Name.Variable */\n"
-            "    .highlight .s { color: #032f62; } /* String */\n"
-            "    .highlight .sb { color: #032f62; } /* String.Backtick */\n"
-            "    .highlight .sc { color: #032f62; } /* String.Char */\n"
-            "    .highlight .sd { color: #032f62; } /* String.Doc */\n"
-            "    .highlight .s2 { color: #032f62; } /* String.Double */\n"
-            "    .highlight .se { color: #032f62; } /* String.Escape */\n"
-            "    .highlight .sh { color: #032f62; } /* String.Heredoc */\n"
-            "    .highlight .si { color: #032f62; } /* String.Interpol */\n"
-            "    .highlight .sx { color: #032f62; } /* String.Other */\n"
-            "    .highlight .sr { color: #032f62; } /* String.Regex */\n"
-            "    .highlight .s1 { color: #032f62; } /* String.Single */\n"
-            "    .highlight .ss { color: #032f62; } /* String.Symbol */\n"
-            "    .highlight .c { color: #6a737d; font-style: italic; } /* Comment */\n"
-            "    .highlight .c1 { color: #6a737d; font-style: italic; } /* Comment.Single */\n"
-            "    .highlight .cm { color: #6a737d; font-style: italic; } /* Comment.Multiline */\n"
-            "    .highlight .cp { color: #6a737d; font-weight: 600; } /* Comment.Preproc */\n"
-            "    .highlight .cs { color: #6a737d; font-weight: 600; font-style: italic; } /* Comment.Special */\n"
-            "    .highlight .m { color: #005cc5; } /* Literal.Number */\n"
-            "    .highlight .mb { color: #005cc5; } /* Literal.Number.Bin */\n"
-            "    .highlight .mf { color: #005cc5; } /* Literal.Number.Float */\n"
-            "    .highlight .mh { color: #005cc5; } /* Literal.Number.Hex */\n"
-            "    .highlight .mi { color: #005cc5; } /* Literal.Number.Integer */\n"
-            "    .highlight .il { color: #005cc5; } /* Literal.Number.Integer.Long */\n"
-            "    .highlight .mo { color: #005cc5; } /* Literal.Number.Oct */\n"
-            "    .highlight .o { color: #d73a49; } /* Operator */\n"
-            "    .highlight .ow { color: #d73a49; } /* Operator.Word */\n"
-            "    .highlight .p { color: #24292e; } /* Punctuation */\n"
-            "    .highlight .w { color: #e1e4e8; } /* Text.Whitespace */\n";
-        size_t pygments_len = strlen(pygments_css);
-        if (pygments_len >= remaining) {
-            size_t written = write - output;
-            size_t new_cap = (written + pygments_len + 1) * 2;
-            char *new_output = realloc(output, new_cap);
-            if (!new_output) {
-                free(output);
-                return strdup(content);
-            }
-            output = new_output;
-            write = output + written;
-            remaining = new_cap - written;
-            capacity = new_cap;
-        }
-        memcpy(write, pygments_css, pygments_len);
-        write += pygments_len;
-        remaining -= pygments_len;
-
-        /* Write Skylighting classes */
-        n = snprintf(write, remaining, "    /* Skylighting classes */\n");
-        if (n < 0 || (size_t)n >= remaining) {
-            free(output);
-            return strdup(content);
-        }
-        write += n;
-        remaining -= n;
-
-        const char *skylighting_css =
-            "    .sourceCode .kw { color: #d73a49; font-weight: 600; } /* Keyword */\n"
-            "    .sourceCode .dt { color: #6f42c1; } /* DataType */\n"
-            "    .sourceCode .dv { color: #005cc5; } /* DecVal */\n"
-            "    .sourceCode .bn { color: #005cc5; } /* BaseN */\n"
-            "    .sourceCode .fl { color: #005cc5; } /* Float */\n"
-            "    .sourceCode .ch { color: #032f62; } /* Char */\n"
-            "    .sourceCode .st { color: #032f62; } /* String */\n"
-            "    .sourceCode .co { color: #6a737d; font-style: italic; } /* Comment */\n"
-            "    .sourceCode .ot { color: #22863a; } /* Other */\n"
-            "    .sourceCode .al { color: #e36209; font-weight: 600; } /* Alert */\n"
-            "    .sourceCode .fu { color: #6f42c1; font-weight: 600; } /* Function */\n"
-            "    .sourceCode .re { color: #032f62; } /* RegionMarker */\n"
-            "    .sourceCode .er { color: #d73a49; font-weight: 600; } /* Error */\n"
-            "    .sourceCode .cf { color: #d73a49; font-weight: 600; } /* ControlFlow */\n"
-            "    .sourceCode .op { color: #d73a49; } /* Operator */\n"
-            "    .sourceCode .pp { color: #6a737d; } /* Preprocessor */\n"
-            "    .sourceCode .at { color: #005cc5; } /* Attribute */\n"
-            "    .sourceCode .do { color: #6a737d; font-style: italic; } /* Documentation */\n"
-            "    .sourceCode .an { color: #6a737d; font-weight: 600; } /* Annotation */\n"
-            "    .sourceCode .cv { color: #6a737d; font-weight: 600; font-style: italic; } /* CommentVar */\n"
-            "    .sourceCode .in { color: #6a737d; } /* Information */\n"
-            "    .sourceCode .wa { color: #e36209; font-weight: 600; } /* Warning */\n"
-            "    .sourceCode .im { color: #d73a49; } /* Import */\n"
-            "    .sourceCode .bu { color: #005cc5; } /* BuiltIn */\n"
-            "    .sourceCode .ex { color: #6f42c1; } /* Extension */\n"
-            "    .sourceCode .va { color: #e36209; } /* Variable */\n"
-            "    .sourceCode .ss { color: #032f62; } /* SpecialString */\n"
-            "    .sourceCode .sc { color: #032f62; } /* SpecialChar */\n"
-            "    .sourceCode .vs { color: #032f62; } /* VerbatimString */\n"
-            "    .sourceCode .il { color: #005cc5; } /* Special */\n";
-        size_t skylighting_len = strlen(skylighting_css);
-        if (skylighting_len >= remaining) {
-            size_t written = write - output;
-            size_t new_cap = (written + skylighting_len + 1) * 2;
-            char *new_output = realloc(output, new_cap);
-            if (!new_output) {
-                free(output);
-                return strdup(content);
-            }
-            output = new_output;
-            write = output + written;
-            remaining = new_cap - written;
-            capacity = new_cap;
-        }
-        memcpy(write, skylighting_css, skylighting_len);
-        write += skylighting_len;
-        remaining -= skylighting_len;
-
-        /* Write line numbers CSS and close style tag */
-        n = snprintf(write, remaining,
-            "    /* Line numbers (Skylighting) */\n"
-            "    .sourceCode.numberSource .sourceCode { counter-reset: line; }\n"
-            "    .sourceCode.numberSource .sourceCode > span { position: relative; left: -4em; counter-increment: line; }\n"
-            "    .sourceCode.numberSource .sourceCode > span > a:first-child::before { content: counter(line); position: relative; left: -1em; text-align: right; vertical-align: baseline; border: none; display: inline-block; min-width: 1em; padding-right: 0.5em; color: #aaa; }\n"
-            "  </style>\n");
-        if (n < 0 || (size_t)n >= remaining) {
-            size_t written = write - output;
-            size_t new_cap = (written + 500) * 2;
-            char *new_output = realloc(output, new_cap);
-            if (!new_output) {
-                free(output);
-                return strdup(content);
-            }
-            output = new_output;
-            write = output + written;
-            remaining = new_cap - written;
-            capacity = new_cap;
-            /* Retry */
-            n = snprintf(write, remaining,
-                "    /* Line numbers (Skylighting) */\n"
-                "    .sourceCode.numberSource .sourceCode { counter-reset: line; }\n"
-                "    .sourceCode.numberSource .sourceCode > span { position: relative; left: -4em; counter-increment: line; }\n"
-                "    .sourceCode.numberSource .sourceCode > span > a:first-child::before { content: counter(line); position: relative; left: -1em; text-align: right; vertical-align: baseline; border: none; display: inline-block; min-width: 1em; padding-right: 0.5em; color: #aaa; }\n"
-                "  </style>\n");
-            if (n < 0 || (size_t)n >= remaining) {
-                free(output);
-                return strdup(content);
-            }
-        }
-        write += n;
-        remaining -= n;
+        wrap_buf_append(&head, apex_highlight_styles, sizeof(apex_highlight_styles) - 1);
+        wrap_buf_append(&head, apex_highlight_styles_pygments, sizeof(apex_highlight_styles_pygments) - 1);
+        wrap_buf_append(&head, apex_highlight_styles_skylighting, sizeof(apex_highlight_styles_skylighting) - 1);
     }
 
-    /* Stylesheet links if provided */
+    /* Stylesheets: embedded from the cache when requested, otherwise linked */
     if (stylesheet_paths && stylesheet_count > 0) {
         for (size_t i = 0; i < stylesheet_count && stylesheet_paths[i]; i++) {
-            n = snprintf(write, remaining, "  <link rel=\"stylesheet\" href=\"%s\">\n", stylesheet_paths[i]);
-            if (n < 0 || (size_t)n >= remaining) {
-                /* Need to expand buffer */
-                size_t written = write - output;
-                size_t new_cap = (written + strlen(stylesheet_paths[i]) + 100) * 2;
-                char *new_output = realloc(output, new_cap);
-                if (!new_output) {
-                    free(output);
-                    return strdup(content);
-                }
-                output = new_output;
-                write = output + written;
-                remaining = new_cap - written;
-                capacity = new_cap;
-                /* Retry */
-                n = snprintf(write, remaining, "  <link rel=\"stylesheet\" href=\"%s\">\n", stylesheet_paths[i]);
-                if (n < 0 || (size_t)n >= remaining) {
-                    free(output);
-                    return strdup(content);
-                }
+            size_t css_len = 0;
+            const char *css = embed_stylesheets
+                ? apex_stylesheet_cache_get(stylesheet_paths[i], base_directory, minify_stylesheets, &css_len)
+                : NULL;
+            if (css) {
+                wrap_buf_puts(&head, "  <style>\n");
+                wrap_buf_append(&head, css, css_len);
+                apex_stylesheet_cache_release();
+                wrap_buf_puts(&head, "\n  </style>\n");
+            } else {
+                wrap_buf_puts(&head, "  <link rel=\"stylesheet\" href=\"");
+                wrap_buf_puts(&head, stylesheet_paths[i]);
+                wrap_buf_puts(&head, "\">\n");
             }
-            write += n;
-            remaining -= n;
         }
     } else {
         /* Include minimal default styles */
-        const char *styles = "  <style>\n"
-            "    body {\n"
-            "      font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Helvetica, Arial, sans-serif;\n"
-            "      line-height: 1.6;\n"
-            "      max-width: 800px;\n"
-            "      margin: 2rem auto;\n"
-            "      padding: 0 1rem;\n"
-            "      color: #333;\n"
-            "    }\n"
-            "    pre { background: #f5f5f5; padding: 1rem; overflow-x: auto; }\n"
-            "    code { background: #f0f0f0; padding: 0.2em 0.4em; border-radius: 3px; }\n"
-            "    blockquote { border-left: 4px solid #ddd; margin: 0; padding-left: 1rem; color: #666; }\n"
-            "    table { border-collapse: collapse; width: 100%%; }\n"
-            "    th, td { border: 1px solid #ddd; padding: 0.5rem; }\n"
-            "    th { background: #f5f5f5; }\n"
-            "    tfoot td { background: #e8e8e8; }\n"
-            "    figure.table-figure { width: fit-content; margin: 1em 0; }\n"
-            "    figure.table-figure table { width: auto; }\n"
-            "    figcaption { text-align: center; font-weight: bold; font-size: 0.8em; }\n"
-            "    .page-break { page-break-after: always; }\n"
-            "    .callout { padding: 1rem; margin: 1rem 0; border-left: 4px solid; }\n"
-            "    .callout-note { border-color: #3b82f6; background: #eff6ff; }\n"
-            "    .callout-warning { border-color: #f59e0b; background: #fffbeb; }\n"
-            "    .callout-tip { border-color: #10b981; background: #f0fdf4; }\n"
-            "    .callout-danger { border-color: #ef4444; background: #fef2f2; }\n"
-            "    ins { background: #d4fcbc; text-decoration: none; }\n"
-            "    del { background: #fbb6c2; text-decoration: line-through; }\n"
-            "    mark { background: #fff3cd; }\n"
-            "    .critic.comment { background: #e7e7e7; color: #666; font-style: italic; }\n"
-            "    .mkhashtag { color: #666; }\n"
-            "    .mkstyledtag {\n"
-            "      display: inline-block;\n"
-            "      background: #e0e0e0;\n"
-            "      padding: 3px 9px;\n"
-            "      border-radius: 20px;\n"
-            "      font-size: 0.9em;\n"
-            "      line-height: 1.4;\n"
-            "      color: #333;\n"
-            "      margin: 0 2px;\n"
-            "    }\n"
-            "  </style>\n";
-        size_t styles_len = strlen(styles);
-        if (styles_len >= remaining) {
-            free(output);
-            return strdup(content);
-        }
-        memcpy(write, styles, styles_len);
-        write += styles_len;
-        remaining -= styles_len;
+        wrap_buf_append(&head, apex_default_styles, sizeof(apex_default_styles) - 1);
     }
 
     /* HTML Header metadata - raw HTML inserted in <head> */
     if (html_header) {
-        n = snprintf(write, remaining, "  %s\n", html_header);
-        if (n < 0 || (size_t)n >= remaining) {
-            free(output);
-            return strdup(content);
-        }
-        write += n;
-        remaining -= n;
+        wrap_buf_puts(&head, "  ");
+        wrap_buf_puts(&head, html_header);
+        wrap_buf_puts(&head, "\n");
     }
 
-    /* Close head, open body */
-    n = snprintf(write, remaining, "</head>\n<body%s>\n\n", body_class);
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
-    }
-    write += n;
-    remaining -= n;
-
-    /* Content */
-    if (content_len + 1 > remaining) {  /* +1 for null terminator at end */
-        free(output);
-        return strdup(content);
-    }
-    memcpy(write, content, content_len);
-    write += content_len;
-    remaining -= content_len;
+    /* Close head, open body (with class if code highlighting is enabled) */
+    wrap_buf_puts(&head, code_highlighter ? "</head>\n<body class=\"code-highlighted\">\n\n"
+                                          : "</head>\n<body>\n\n");
 
-    /* HTML Footer metadata - raw HTML appended before </body> */
+    /* Tail: footer metadata (raw HTML appended before </body>) and closing tags */
+    wrap_buf tail = {0};
     if (html_footer) {
-        n = snprintf(write, remaining, "\n%s", html_footer);
-        if (n < 0 || (size_t)n >= remaining) {
-            free(output);
-            return strdup(content);
+        wrap_buf_puts(&tail, "\n");
+        wrap_buf_puts(&tail, html_footer);
+    }
+    wrap_buf_puts(&tail, "\n</body>\n</html>\n");
+
+    char *output = NULL;
+    if (pretty && !head.failed && !tail.failed) {
+        /* Format the three parts as they are written instead of joining
+         * them and pretty-printing a second copy */
+        apex_pretty_sink *sink = apex_pretty_sink_new(head.len + content_len + tail.len);
+        if (sink) {
+            apex_pretty_sink_write(sink, head.data, head.len);
+            apex_pretty_sink_write(sink, content, content_len);
+            apex_pretty_sink_write(sink, tail.data, tail.len);
+            output = apex_pretty_sink_finish(sink, NULL);
+        }
+        if (output) {
+            free(head.data);
+            free(tail.data);
+            return output;
         }
-        write += n;
-        remaining -= n;
     }
-
-    /* Close body and html */
-    n = snprintf(write, remaining, "\n</body>\n</html>\n");
-    if (n < 0 || (size_t)n >= remaining) {
-        free(output);
-        return strdup(content);
+    if (!head.failed && !tail.failed) {
+        output = malloc(head.len + content_len + tail.len + 1);
     }
-    write += n;
-    remaining -= n;
-
-    /* Null terminate - ensure we have space */
-    if (remaining > 0) {
-        *write = '\0';
-    } else {
-        /* Should never happen, but be safe */
-        free(output);
+    if (!output) {
+        free(head.data);
+        free(tail.data);
         return strdup(content);
     }
 
+    memcpy(output, head.data, head.len);
+    memcpy(output + head.len, content, content_len);
+    memcpy(output + head.len + content_len, tail.data, tail.len);
+    output[head.len + content_len + tail.len] = '\0';
+
+    free(head.data);
+    free(tail.data);
     return output;
 }
 
+/**
+ * Wrap HTML content in complete HTML5 document structure
+ */
+char *apex_wrap_html_document(const char *content, const char *title, const char **stylesheet_paths, size_t stylesheet_count, const char *code_highlighter, const char *html_header, const char *html_footer, const char *language) {
+    return apex_wrap_html_document_internal(content, title, stylesheet_paths, stylesheet_count,
+                                            code_highlighter, html_header, html_footer, language,
+                                            false, false, NULL, false);
+}
+
 /**
  * Free a string allocated by Apex
  */
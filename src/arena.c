@@ -0,0 +1,261 @@
+/**
+ * Per-conversion arena allocator
+ *
+ * Small allocations are bumped out of 64KB blocks. Each allocation has a
+ * 16-byte header recording its size, so realloc can copy, and the most
+ * recent allocation can grow in place (cmark's buffers mostly grow the
+ * buffer that was allocated last). Allocations larger than a quarter
+ * block get their own chunk on a doubly linked list so they can be
+ * realloc'd and released individually.
+ */
+
+#include "arena.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define APEX_THREAD_LOCAL __thread
+#else
+#define APEX_THREAD_LOCAL
+#endif
+
+#define APEX_ARENA_ALIGN 16
+#define APEX_ARENA_DEFAULT_BLOCK (64 * 1024)
+#define APEX_ARENA_ROUND(n) (((n) + (APEX_ARENA_ALIGN - 1)) & ~(size_t)(APEX_ARENA_ALIGN - 1))
+
+/* Precedes every allocation */
+typedef struct {
+    size_t size;
+    size_t large;
+} arena_header;
+
+/* Bump block; data follows the (rounded) struct */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+} arena_block;
+
+/* Dedicated chunk for a large allocation; header and data follow */
+typedef struct arena_large {
+    struct arena_large *prev;
+    struct arena_large *next;
+} arena_large;
+
+#define BLOCK_OVERHEAD APEX_ARENA_ROUND(sizeof(arena_block))
+#define LARGE_OVERHEAD APEX_ARENA_ROUND(sizeof(arena_large))
+#define HEADER_SIZE APEX_ARENA_ROUND(sizeof(arena_header))
+
+struct apex_arena {
+    arena_block *blocks;   /* Current block first */
+    arena_large *large;
+    size_t block_size;
+    size_t reserved;
+    char *last;            /* Most recent small allocation (for in-place growth) */
+};
+
+static inline arena_header *arena_header_of(void *ptr) {
+    return (arena_header *)((char *)ptr - HEADER_SIZE);
+}
+
+static inline char *arena_block_data(arena_block *block) {
+    return (char *)block + BLOCK_OVERHEAD;
+}
+
+apex_arena *apex_arena_new(size_t block_size) {
+    apex_arena *arena = calloc(1, sizeof(apex_arena));
+    if (!arena) return NULL;
+    arena->block_size = block_size ? APEX_ARENA_ROUND(block_size) : APEX_ARENA_DEFAULT_BLOCK;
+    return arena;
+}
+
+static void *arena_alloc_large(apex_arena *arena, size_t size) {
+    arena_large *chunk = malloc(LARGE_OVERHEAD + HEADER_SIZE + size);
+    if (!chunk) return NULL;
+    chunk->prev = NULL;
+    chunk->next = arena->large;
+    if (arena->large) arena->large->prev = chunk;
+    arena->large = chunk;
+    arena->reserved += LARGE_OVERHEAD + HEADER_SIZE + size;
+
+    arena_header *header = (arena_header *)((char *)chunk + LARGE_OVERHEAD);
+    header->size = size;
+    header->large = 1;
+    return (char *)header + HEADER_SIZE;
+}
+
+void *apex_arena_alloc(apex_arena *arena, size_t size) {
+    if (!arena) return NULL;
+    size_t need = HEADER_SIZE + APEX_ARENA_ROUND(size ? size : 1);
+
+    if (need > arena->block_size / 4) {
+        return arena_alloc_large(arena, size);
+    }
+
+    arena_block *block = arena->blocks;
+    if (!block || block->cap - block->used < need) {
+        block = malloc(BLOCK_OVERHEAD + arena->block_size);
+        if (!block) return NULL;
+        block->used = 0;
+        block->cap = arena->block_size;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->reserved += BLOCK_OVERHEAD + arena->block_size;
+    }
+
+    arena_header *header = (arena_header *)(arena_block_data(block) + block->used);
+    header->size = size;
+    header->large = 0;
+    block->used += need;
+
+    arena->last = (char *)header + HEADER_SIZE;
+    return arena->last;
+}
+
+void *apex_arena_calloc(apex_arena *arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *ptr = apex_arena_alloc(arena, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *apex_arena_realloc(apex_arena *arena, void *ptr, size_t size) {
+    if (!ptr) return apex_arena_alloc(arena, size);
+
+    arena_header *header = arena_header_of(ptr);
+    size_t old_size = header->size;
+    if (size <= old_size && !header->large) {
+        return ptr;
+    }
+
+    if (header->large) {
+        arena_large *chunk = (arena_large *)((char *)header - LARGE_OVERHEAD);
+        arena_large *prev = chunk->prev;
+        arena_large *next = chunk->next;
+        arena_large *grown = realloc(chunk, LARGE_OVERHEAD + HEADER_SIZE + size);
+        if (!grown) return NULL;
+        if (prev) prev->next = grown; else arena->large = grown;
+        if (next) next->prev = grown;
+        arena->reserved = arena->reserved - old_size + size;
+        header = (arena_header *)((char *)grown + LARGE_OVERHEAD);
+        header->size = size;
+        return (char *)header + HEADER_SIZE;
+    }
+
+    /* Most recent small allocation: grow into the rest of its block */
+    arena_block *block = arena->blocks;
+    if (ptr == arena->last && block) {
+        size_t old_need = APEX_ARENA_ROUND(old_size ? old_size : 1);
+        size_t new_need = APEX_ARENA_ROUND(size);
+        if (HEADER_SIZE + new_need <= arena->block_size / 4 &&
+            block->cap - block->used >= new_need - old_need) {
+            block->used += new_need - old_need;
+            header->size = size;
+            return ptr;
+        }
+    }
+
+    void *moved = apex_arena_alloc(arena, size);
+    if (!moved) return NULL;
+    memcpy(moved, ptr, old_size);
+    apex_arena_release(arena, ptr);
+    return moved;
+}
+
+void apex_arena_release(apex_arena *arena, void *ptr) {
+    if (!arena || !ptr) return;
+    arena_header *header = arena_header_of(ptr);
+
+    if (header->large) {
+        arena_large *chunk = (arena_large *)((char *)header - LARGE_OVERHEAD);
+        if (chunk->prev) chunk->prev->next = chunk->next; else arena->large = chunk->next;
+        if (chunk->next) chunk->next->prev = chunk->prev;
+        arena->reserved -= LARGE_OVERHEAD + HEADER_SIZE + header->size;
+        free(chunk);
+        return;
+    }
+
+    if (ptr == arena->last && arena->blocks) {
+        arena->blocks->used -= HEADER_SIZE + APEX_ARENA_ROUND(header->size ? header->size : 1);
+        arena->last = NULL;
+    }
+}
+
+char *apex_arena_strdup(apex_arena *arena, const char *str) {
+    if (!str) return NULL;
+    size_t len = strlen(str);
+    char *copy = apex_arena_alloc(arena, len + 1);
+    if (copy) memcpy(copy, str, len + 1);
+    return copy;
+}
+
+size_t apex_arena_reserved(const apex_arena *arena) {
+    return arena ? arena->reserved : 0;
+}
+
+void apex_arena_free(apex_arena *arena) {
+    if (!arena) return;
+    arena_block *block = arena->blocks;
+    while (block) {
+        arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_large *chunk = arena->large;
+    while (chunk) {
+        arena_large *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Current arena and cmark allocator                                         */
+/* ------------------------------------------------------------------------- */
+
+static APEX_THREAD_LOCAL apex_arena *apex_current_arena = NULL;
+
+apex_arena *apex_arena_enter(apex_arena *arena) {
+    apex_arena *previous = apex_current_arena;
+    apex_current_arena = arena;
+    return previous;
+}
+
+void apex_arena_leave(apex_arena *previous) {
+    apex_current_arena = previous;
+}
+
+apex_arena *apex_arena_current(void) {
+    return apex_current_arena;
+}
+
+static void *apex_arena_cmark_calloc(size_t count, size_t size) {
+    apex_metrics_count_allocation();
+    void *ptr = apex_arena_calloc(apex_current_arena, count, size);
+    if (!ptr) abort();  /* cmark's default allocator aborts on failure too */
+    return ptr;
+}
+
+static void *apex_arena_cmark_realloc(void *ptr, size_t size) {
+    apex_metrics_count_allocation();
+    void *grown = apex_arena_realloc(apex_current_arena, ptr, size);
+    if (!grown) abort();
+    return grown;
+}
+
+static void apex_arena_cmark_free(void *ptr) {
+    apex_arena_release(apex_current_arena, ptr);
+}
+
+static cmark_mem apex_arena_mem = {
+    apex_arena_cmark_calloc,
+    apex_arena_cmark_realloc,
+    apex_arena_cmark_free
+};
+
+cmark_mem *apex_arena_cmark_mem(void) {
+    return &apex_arena_mem;
+}
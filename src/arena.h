@@ -0,0 +1,83 @@
+/**
+ * Per-conversion arena allocator
+ *
+ * A conversion makes thousands of small, short-lived allocations (cmark
+ * nodes, content buffers, attribute lists). The arena serves them from a
+ * few large blocks and releases everything at once when the conversion
+ * ends, so individual frees (and allocator lock traffic) go away.
+ */
+
+#ifndef APEX_ARENA_H
+#define APEX_ARENA_H
+
+#include <stddef.h>
+#include "cmark-gfm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct apex_arena apex_arena;
+
+/**
+ * Create an arena. block_size is the size of each bump block; 0 picks
+ * the default (64KB).
+ */
+apex_arena *apex_arena_new(size_t block_size);
+
+/**
+ * Allocate from the arena. Memory is 16-byte aligned and lives until
+ * apex_arena_free().
+ */
+void *apex_arena_alloc(apex_arena *arena, size_t size);
+void *apex_arena_calloc(apex_arena *arena, size_t count, size_t size);
+
+/**
+ * Resize an arena allocation (ptr may be NULL). The most recent small
+ * allocation and large allocations grow in place; others are copied.
+ */
+void *apex_arena_realloc(apex_arena *arena, void *ptr, size_t size);
+
+/**
+ * Release one allocation early. Only large allocations and the most
+ * recent small one are actually reclaimed; anything else waits for
+ * apex_arena_free().
+ */
+void apex_arena_release(apex_arena *arena, void *ptr);
+
+char *apex_arena_strdup(apex_arena *arena, const char *str);
+
+/**
+ * Bytes currently reserved from the system by the arena
+ */
+size_t apex_arena_reserved(const apex_arena *arena);
+
+/**
+ * Free the arena and everything allocated from it (NULL is allowed)
+ */
+void apex_arena_free(apex_arena *arena);
+
+/**
+ * Make arena the current arena for this thread and return the previous
+ * one, which must be restored with apex_arena_leave() (conversions nest).
+ */
+apex_arena *apex_arena_enter(apex_arena *arena);
+void apex_arena_leave(apex_arena *previous);
+
+/**
+ * This thread's current arena, or NULL outside a conversion
+ */
+apex_arena *apex_arena_current(void);
+
+/**
+ * cmark allocator backed by the current thread's arena. cmark_mem has no
+ * context pointer, so objects allocated through it must only be touched
+ * while the same arena is current.
+ */
+cmark_mem *apex_arena_cmark_mem(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_ARENA_H */
@@ -0,0 +1,840 @@
+/**
+ * Binary cache of parsed documents
+ *
+ * A cache file holds everything rendering needs from the front half of
+ * the pipeline: the cmark tree after the tree passes (IAL, image
+ * attributes, manual header IDs), the metadata, ALDs, abbreviations and
+ * protected Liquid tags. Layout, all integers little-endian:
+ *
+ *   header   "APEXAST\0", u32 version, u32 flags, u64 options fingerprint
+ *   lists    metadata, abbreviations, ALDs, Liquid tags, footnote hash
+ *   tree     nodes in pre-order: u8 kind, kind fields, attributes, u32 children
+ *
+ * Strings are a u32 length (0xFFFFFFFF for NULL), the bytes and a NUL.
+ * Node attributes are a u8 presence flag followed, when set, by the ID,
+ * classes and key/value pairs (as for ALDs), the caption and a u8 removal
+ * flag. Node types are written as stable kinds because extension node
+ * type ids depend on registration order.
+ */
+
+#include "ast_cache.h"
+#include "cmark-gfm-extension_api.h"
+#include "cmark-gfm-core-extensions.h"
+#include "table.h"          /* CMARK_NODE_TABLE, CMARK_NODE_TABLE_ROW, CMARK_NODE_TABLE_CELL */
+#include "strikethrough.h"  /* CMARK_NODE_STRIKETHROUGH */
+#include "extensions/definition_list.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Registered by the definition list extension (see definition_list.c) */
+extern cmark_node_type APEX_NODE_DEFINITION_LIST;
+extern cmark_node_type APEX_NODE_DEFINITION_TERM;
+extern cmark_node_type APEX_NODE_DEFINITION_DATA;
+
+static const char ast_magic[8] = { 'A', 'P', 'E', 'X', 'A', 'S', 'T', '\0' };
+
+#define AST_NULL_STRING 0xFFFFFFFFu
+#define AST_FLAG_ATTRIBUTE_RENDER 0x1u
+
+typedef enum {
+    AST_DOCUMENT = 1,
+    AST_BLOCK_QUOTE,
+    AST_LIST,
+    AST_ITEM,
+    AST_CODE_BLOCK,
+    AST_HTML_BLOCK,
+    AST_CUSTOM_BLOCK,
+    AST_PARAGRAPH,
+    AST_HEADING,
+    AST_THEMATIC_BREAK,
+    AST_TEXT,
+    AST_SOFTBREAK,
+    AST_LINEBREAK,
+    AST_CODE,
+    AST_HTML_INLINE,
+    AST_CUSTOM_INLINE,
+    AST_EMPH,
+    AST_STRONG,
+    AST_LINK,
+    AST_IMAGE,
+    AST_TABLE,
+    AST_TABLE_ROW,
+    AST_TABLE_CELL,
+    AST_STRIKETHROUGH,
+    AST_TASKLIST_ITEM,
+    AST_DEFINITION_LIST,
+    AST_DEFINITION_TERM,
+    AST_DEFINITION_DATA
+} ast_kind;
+
+static const struct {
+    ast_kind kind;
+    cmark_node_type type;
+} core_kinds[] = {
+    { AST_DOCUMENT, CMARK_NODE_DOCUMENT },
+    { AST_BLOCK_QUOTE, CMARK_NODE_BLOCK_QUOTE },
+    { AST_LIST, CMARK_NODE_LIST },
+    { AST_ITEM, CMARK_NODE_ITEM },
+    { AST_CODE_BLOCK, CMARK_NODE_CODE_BLOCK },
+    { AST_HTML_BLOCK, CMARK_NODE_HTML_BLOCK },
+    { AST_CUSTOM_BLOCK, CMARK_NODE_CUSTOM_BLOCK },
+    { AST_PARAGRAPH, CMARK_NODE_PARAGRAPH },
+    { AST_HEADING, CMARK_NODE_HEADING },
+    { AST_THEMATIC_BREAK, CMARK_NODE_THEMATIC_BREAK },
+    { AST_TEXT, CMARK_NODE_TEXT },
+    { AST_SOFTBREAK, CMARK_NODE_SOFTBREAK },
+    { AST_LINEBREAK, CMARK_NODE_LINEBREAK },
+    { AST_CODE, CMARK_NODE_CODE },
+    { AST_HTML_INLINE, CMARK_NODE_HTML_INLINE },
+    { AST_CUSTOM_INLINE, CMARK_NODE_CUSTOM_INLINE },
+    { AST_EMPH, CMARK_NODE_EMPH },
+    { AST_STRONG, CMARK_NODE_STRONG },
+    { AST_LINK, CMARK_NODE_LINK },
+    { AST_IMAGE, CMARK_NODE_IMAGE },
+};
+
+#define CORE_KIND_COUNT (sizeof(core_kinds) / sizeof(core_kinds[0]))
+
+/* FNV-1a, 64-bit */
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t fnv1a_int(uint64_t hash, int value) {
+    return fnv1a(hash, &value, sizeof(value));
+}
+
+static uint64_t fnv1a_str(uint64_t hash, const char *str) {
+    if (!str) return fnv1a_int(hash, -1);
+    return fnv1a(hash, str, strlen(str) + 1);
+}
+
+uint64_t apex_ast_options_fingerprint(const apex_options *options) {
+    apex_options defaults;
+    if (!options) {
+        defaults = apex_options_default();
+        options = &defaults;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a_int(hash, APEX_AST_CACHE_VERSION);
+    hash = fnv1a_int(hash, (int)options->mode);
+    hash = fnv1a_int(hash, options->critic_mode);
+    hash = fnv1a_int(hash, options->max_include_depth);
+    hash = fnv1a_int(hash, options->wikilink_space);
+
+    const bool flags[] = {
+        options->enable_tables,
+        options->enable_footnotes,
+        options->enable_definition_lists,
+        options->enable_smart_typography,
+        options->enable_math,
+        options->enable_critic_markup,
+        options->enable_wiki_links,
+        options->enable_task_lists,
+        options->enable_attributes,
+        options->enable_callouts,
+        options->enable_marked_extensions,
+        options->enable_divs,
+        options->enable_spans,
+        options->strip_metadata,
+        options->enable_metadata_variables,
+        options->enable_metadata_transforms,
+        options->enable_file_includes,
+        options->validate_utf8,
+        options->generate_header_ids,
+        options->relaxed_tables,
+        options->per_cell_alignment,
+        options->allow_mixed_list_markers,
+        options->allow_alpha_lists,
+        options->enable_sup_sub,
+        options->enable_autolink,
+        options->enable_emoji_autocorrect,
+        options->enable_markdown_in_html,
+        options->enable_hashtags,
+        options->style_hashtags,
+        options->proofreader_mode,
+    };
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        hash = fnv1a_int(hash, flags[i] ? 1 : 0);
+    }
+
+    hash = fnv1a_str(hash, options->base_directory);
+    hash = fnv1a_str(hash, options->wikilink_extension);
+    return hash;
+}
+
+/* ------------------------------------------------------------------ */
+/* Node kinds                                                         */
+
+static bool is_tasklist_item(cmark_node *node) {
+    const char *type_string = cmark_node_get_type_string(node);
+    return type_string && strcmp(type_string, "tasklist") == 0;
+}
+
+/* Stable kind of a node, or 0 for nodes the format cannot represent */
+static ast_kind node_kind(cmark_node *node) {
+    cmark_node_type type = cmark_node_get_type(node);
+
+    if (type == CMARK_NODE_ITEM && is_tasklist_item(node)) return AST_TASKLIST_ITEM;
+    for (size_t i = 0; i < CORE_KIND_COUNT; i++) {
+        if (core_kinds[i].type == type) return core_kinds[i].kind;
+    }
+    if (type == CMARK_NODE_TABLE) return AST_TABLE;
+    if (type == CMARK_NODE_TABLE_ROW) return AST_TABLE_ROW;
+    if (type == CMARK_NODE_TABLE_CELL) return AST_TABLE_CELL;
+    if (type == CMARK_NODE_STRIKETHROUGH) return AST_STRIKETHROUGH;
+    if (APEX_NODE_DEFINITION_LIST && type == APEX_NODE_DEFINITION_LIST) return AST_DEFINITION_LIST;
+    if (APEX_NODE_DEFINITION_TERM && type == APEX_NODE_DEFINITION_TERM) return AST_DEFINITION_TERM;
+    if (APEX_NODE_DEFINITION_DATA && type == APEX_NODE_DEFINITION_DATA) return AST_DEFINITION_DATA;
+
+    /* Footnotes keep their numbering in fields cmark does not expose */
+    return 0;
+}
+
+/* Definition list nodes render through an extension instance; a loaded
+ * document uses one shared by the process */
+static cmark_syntax_extension *deflist_extension = NULL;
+static pthread_once_t deflist_extension_once = PTHREAD_ONCE_INIT;
+
+static void create_deflist_extension(void) {
+    deflist_extension = create_definition_list_extension();
+}
+
+/* Create an empty node of the given kind */
+static cmark_node *new_node(ast_kind kind, cmark_mem *mem) {
+    for (size_t i = 0; i < CORE_KIND_COUNT; i++) {
+        if (core_kinds[i].kind == kind) return cmark_node_new_with_mem(core_kinds[i].type, mem);
+    }
+
+    cmark_node_type type;
+    const char *extension_name = NULL;
+    cmark_syntax_extension *extension = NULL;
+    switch (kind) {
+        case AST_TABLE: type = CMARK_NODE_TABLE; extension_name = "table"; break;
+        case AST_TABLE_ROW: type = CMARK_NODE_TABLE_ROW; extension_name = "table"; break;
+        case AST_TABLE_CELL: type = CMARK_NODE_TABLE_CELL; extension_name = "table"; break;
+        case AST_STRIKETHROUGH: type = CMARK_NODE_STRIKETHROUGH; extension_name = "strikethrough"; break;
+        case AST_TASKLIST_ITEM: type = CMARK_NODE_ITEM; extension_name = "tasklist"; break;
+        case AST_DEFINITION_LIST:
+        case AST_DEFINITION_TERM:
+        case AST_DEFINITION_DATA:
+            pthread_once(&deflist_extension_once, create_deflist_extension);
+            extension = deflist_extension;
+            type = kind == AST_DEFINITION_LIST ? APEX_NODE_DEFINITION_LIST :
+                   kind == AST_DEFINITION_TERM ? APEX_NODE_DEFINITION_TERM :
+                                                 APEX_NODE_DEFINITION_DATA;
+            break;
+        default:
+            return NULL;
+    }
+    if (extension_name) extension = cmark_find_syntax_extension(extension_name);
+    if (!extension || type == CMARK_NODE_NONE) return NULL;
+
+    /* Extensions allocate their per-node data (table alignments, header
+     * rows) when the node is created with them */
+    return cmark_node_new_with_mem_and_ext(type, mem, extension);
+}
+
+/* ------------------------------------------------------------------ */
+/* Writing                                                            */
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} ast_writer;
+
+static void put_bytes(ast_writer *w, const void *bytes, size_t len) {
+    if (w->failed) return;
+    if (w->len + len > w->cap) {
+        size_t cap = w->cap ? w->cap : 4096;
+        while (cap < w->len + len) cap *= 2;
+        unsigned char *data = realloc(w->data, cap);
+        if (!data) {
+            w->failed = true;
+            return;
+        }
+        w->data = data;
+        w->cap = cap;
+    }
+    memcpy(w->data + w->len, bytes, len);
+    w->len += len;
+}
+
+static void put_u8(ast_writer *w, unsigned value) {
+    unsigned char byte = (unsigned char)value;
+    put_bytes(w, &byte, 1);
+}
+
+static void put_u32(ast_writer *w, uint32_t value) {
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++) bytes[i] = (unsigned char)(value >> (8 * i));
+    put_bytes(w, bytes, 4);
+}
+
+static void put_u64(ast_writer *w, uint64_t value) {
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = (unsigned char)(value >> (8 * i));
+    put_bytes(w, bytes, 8);
+}
+
+static void put_str(ast_writer *w, const char *str) {
+    if (!str) {
+        put_u32(w, AST_NULL_STRING);
+        return;
+    }
+    size_t len = strlen(str);
+    if (len >= AST_NULL_STRING) {
+        w->failed = true;
+        return;
+    }
+    put_u32(w, (uint32_t)len);
+    put_bytes(w, str, len + 1);
+}
+
+static void put_attributes(ast_writer *w, const apex_attributes *attrs) {
+    put_str(w, attrs ? attrs->id : NULL);
+    put_u32(w, attrs ? (uint32_t)attrs->class_count : 0);
+    for (int i = 0; attrs && i < attrs->class_count; i++) put_str(w, attrs->classes[i]);
+    put_u32(w, attrs ? (uint32_t)attrs->attr_count : 0);
+    for (int i = 0; attrs && i < attrs->attr_count; i++) {
+        put_str(w, attrs->keys[i]);
+        put_str(w, attrs->values[i]);
+    }
+}
+
+static void put_node(ast_writer *w, cmark_node *node, ast_kind kind) {
+    put_u8(w, kind);
+
+    switch (kind) {
+        case AST_LIST:
+            put_u8(w, (unsigned)cmark_node_get_list_type(node));
+            put_u8(w, (unsigned)cmark_node_get_list_delim(node));
+            put_u32(w, (uint32_t)cmark_node_get_list_start(node));
+            put_u8(w, cmark_node_get_list_tight(node) ? 1 : 0);
+            break;
+        case AST_HEADING:
+            put_u8(w, (unsigned)cmark_node_get_heading_level(node));
+            break;
+        case AST_CODE_BLOCK:
+            put_str(w, cmark_node_get_fence_info(node));
+            put_str(w, cmark_node_get_literal(node));
+            break;
+        case AST_HTML_BLOCK:
+        case AST_TEXT:
+        case AST_CODE:
+        case AST_HTML_INLINE:
+            put_str(w, cmark_node_get_literal(node));
+            break;
+        case AST_CUSTOM_BLOCK:
+        case AST_CUSTOM_INLINE:
+            put_str(w, cmark_node_get_on_enter(node));
+            put_str(w, cmark_node_get_on_exit(node));
+            break;
+        case AST_LINK:
+        case AST_IMAGE:
+            put_str(w, cmark_node_get_url(node));
+            put_str(w, cmark_node_get_title(node));
+            break;
+        case AST_TABLE: {
+            uint16_t columns = cmark_gfm_extensions_get_table_columns(node);
+            uint8_t *alignments = cmark_gfm_extensions_get_table_alignments(node);
+            put_u32(w, columns);
+            for (uint16_t i = 0; i < columns; i++) put_u8(w, alignments ? alignments[i] : 0);
+            break;
+        }
+        case AST_TABLE_ROW:
+            put_u8(w, cmark_gfm_extensions_get_table_row_is_header(node) ? 1 : 0);
+            break;
+        case AST_TASKLIST_ITEM:
+            put_u8(w, cmark_gfm_extensions_get_tasklist_item_checked(node) ? 1 : 0);
+            break;
+        default:
+            break;
+    }
+
+    /* Attributes from IAL, ALDs, image attributes, manual header IDs and captions */
+    const apex_attributes *attrs = apex_node_attributes(node);
+    put_u8(w, attrs ? 1 : 0);
+    if (attrs) {
+        put_attributes(w, attrs);
+        put_str(w, attrs->caption);
+        put_u8(w, attrs->remove ? 1 : 0);
+    }
+
+    uint32_t children = 0;
+    for (cmark_node *child = cmark_node_first_child(node); child; child = cmark_node_next(child)) {
+        children++;
+    }
+    put_u32(w, children);
+}
+
+static bool put_tree(ast_writer *w, cmark_node *root) {
+    cmark_iter *iter = cmark_iter_new(root);
+    if (!iter) return false;
+
+    bool ok = true;
+    cmark_event_type event;
+    while (ok && (event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+        if (event != CMARK_EVENT_ENTER) continue;
+        cmark_node *node = cmark_iter_get_node(iter);
+        ast_kind kind = node_kind(node);
+        if (!kind) {
+            ok = false;
+            break;
+        }
+        put_node(w, node, kind);
+    }
+    cmark_iter_free(iter);
+    return ok && !w->failed;
+}
+
+int apex_ast_write(const apex_document *doc, const char *path) {
+    if (!doc || !doc->root || !path) return -1;
+
+    ast_writer w = { NULL, 0, 0, false };
+    put_bytes(&w, ast_magic, sizeof(ast_magic));
+    put_u32(&w, APEX_AST_CACHE_VERSION);
+    put_u32(&w, doc->attribute_render ? AST_FLAG_ATTRIBUTE_RENDER : 0);
+    put_u64(&w, doc->fingerprint);
+
+    uint32_t count = 0;
+    for (apex_metadata_item *item = doc->metadata; item; item = item->next) count++;
+    put_u32(&w, count);
+    for (apex_metadata_item *item = doc->metadata; item; item = item->next) {
+        put_str(&w, item->key);
+        put_str(&w, item->value);
+    }
+
+    count = 0;
+    for (abbr_item *abbr = doc->abbreviations; abbr; abbr = abbr->next) count++;
+    put_u32(&w, count);
+    for (abbr_item *abbr = doc->abbreviations; abbr; abbr = abbr->next) {
+        put_str(&w, abbr->abbr);
+        put_str(&w, abbr->expansion);
+    }
+
+    count = 0;
+    for (ald_entry *ald = doc->alds; ald; ald = ald->next) count++;
+    put_u32(&w, count);
+    for (ald_entry *ald = doc->alds; ald; ald = ald->next) {
+        put_str(&w, ald->name);
+        put_attributes(&w, ald->attrs);
+    }
+
+    put_u32(&w, (uint32_t)doc->liquid_tag_count);
+    for (size_t i = 0; i < doc->liquid_tag_count; i++) put_str(&w, doc->liquid_tags[i]);
+    put_str(&w, doc->footnote_hash);
+
+    if (!put_tree(&w, doc->root)) {
+        free(w.data);
+        return -1;
+    }
+
+    /* Write to a temporary file and rename it into place, so a reader
+     * never maps a half-written cache */
+    size_t path_len = strlen(path);
+    char *tmp_path = malloc(path_len + 8);
+    if (!tmp_path) {
+        free(w.data);
+        return -1;
+    }
+    snprintf(tmp_path, path_len + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        free(tmp_path);
+        free(w.data);
+        return -1;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (written < w.len) {
+        ssize_t n = write(fd, w.data + written, w.len - written);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        written += (size_t)n;
+    }
+    if (close(fd) != 0) ok = false;
+    if (ok && rename(tmp_path, path) != 0) ok = false;
+    if (!ok) unlink(tmp_path);
+
+    free(tmp_path);
+    free(w.data);
+    return ok ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Reading                                                            */
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool failed;
+} ast_reader;
+
+static unsigned get_u8(ast_reader *r) {
+    if (r->failed || r->end - r->p < 1) {
+        r->failed = true;
+        return 0;
+    }
+    return *r->p++;
+}
+
+static uint32_t get_u32(ast_reader *r) {
+    if (r->failed || r->end - r->p < 4) {
+        r->failed = true;
+        return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)r->p[i] << (8 * i);
+    r->p += 4;
+    return value;
+}
+
+static uint64_t get_u64(ast_reader *r) {
+    if (r->failed || r->end - r->p < 8) {
+        r->failed = true;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)r->p[i] << (8 * i);
+    r->p += 8;
+    return value;
+}
+
+/* A string inside the mapping (NUL-terminated there), or NULL */
+static const char *get_str(ast_reader *r) {
+    uint32_t len = get_u32(r);
+    if (r->failed || len == AST_NULL_STRING) return NULL;
+    if ((size_t)(r->end - r->p) < (size_t)len + 1 || r->p[len] != '\0') {
+        r->failed = true;
+        return NULL;
+    }
+    const char *str = (const char *)r->p;
+    r->p += (size_t)len + 1;
+    return str;
+}
+
+static char *dup_str(ast_reader *r) {
+    const char *str = get_str(r);
+    return str ? strdup(str) : NULL;
+}
+
+/* Element counts can never exceed the bytes left to describe them */
+static uint32_t get_count(ast_reader *r) {
+    uint32_t count = get_u32(r);
+    if ((size_t)count > (size_t)(r->end - r->p)) r->failed = true;
+    return r->failed ? 0 : count;
+}
+
+static apex_attributes *get_attributes(ast_reader *r) {
+    apex_attributes *attrs = apex_attributes_new(NULL);
+    if (!attrs) {
+        r->failed = true;
+        return NULL;
+    }
+    apex_attributes_set_id(attrs, get_str(r));
+
+    uint32_t classes = get_count(r);
+    for (uint32_t i = 0; i < classes && !r->failed; i++) {
+        const char *class_name = get_str(r);
+        if (class_name) apex_attributes_add_class(attrs, class_name);
+    }
+
+    uint32_t pairs = get_count(r);
+    for (uint32_t i = 0; i < pairs && !r->failed; i++) {
+        const char *key = get_str(r);
+        const char *value = get_str(r);
+        if (key) apex_attributes_set(attrs, key, value);
+    }
+    return attrs;
+}
+
+/* Free a tree and its nodes' attributes (never in an arena here) */
+static void free_tree(cmark_node *root) {
+    apex_free_node_attributes(root);
+    cmark_node_free(root);
+}
+
+/* Read one node's record; *children receives its child count */
+static cmark_node *get_node(ast_reader *r, cmark_mem *mem, uint32_t *children) {
+    ast_kind kind = (ast_kind)get_u8(r);
+    if (r->failed) return NULL;
+    cmark_node *node = new_node(kind, mem);
+    if (!node) {
+        r->failed = true;
+        return NULL;
+    }
+
+    switch (kind) {
+        case AST_LIST: {
+            unsigned list_type = get_u8(r);
+            unsigned delim = get_u8(r);
+            uint32_t start = get_u32(r);
+            unsigned tight = get_u8(r);
+            cmark_node_set_list_type(node, (cmark_list_type)list_type);
+            cmark_node_set_list_delim(node, (cmark_delim_type)delim);
+            cmark_node_set_list_start(node, (int)start);
+            cmark_node_set_list_tight(node, (int)tight);
+            break;
+        }
+        case AST_HEADING:
+            cmark_node_set_heading_level(node, (int)get_u8(r));
+            break;
+        case AST_CODE_BLOCK: {
+            const char *info = get_str(r);
+            if (info) cmark_node_set_fence_info(node, info);
+            const char *literal = get_str(r);
+            if (literal) cmark_node_set_literal(node, literal);
+            break;
+        }
+        case AST_HTML_BLOCK:
+        case AST_TEXT:
+        case AST_CODE:
+        case AST_HTML_INLINE: {
+            const char *literal = get_str(r);
+            if (literal) cmark_node_set_literal(node, literal);
+            break;
+        }
+        case AST_CUSTOM_BLOCK:
+        case AST_CUSTOM_INLINE: {
+            const char *on_enter = get_str(r);
+            const char *on_exit = get_str(r);
+            if (on_enter) cmark_node_set_on_enter(node, on_enter);
+            if (on_exit) cmark_node_set_on_exit(node, on_exit);
+            break;
+        }
+        case AST_LINK:
+        case AST_IMAGE: {
+            const char *url = get_str(r);
+            const char *title = get_str(r);
+            if (url) cmark_node_set_url(node, url);
+            if (title) cmark_node_set_title(node, title);
+            break;
+        }
+        case AST_TABLE: {
+            uint32_t columns = get_count(r);
+            if (columns > UINT16_MAX) r->failed = true;
+            uint8_t *alignments = r->failed ? NULL : malloc(columns + 1);
+            if (!alignments) {
+                r->failed = true;
+                break;
+            }
+            for (uint32_t i = 0; i < columns; i++) alignments[i] = (uint8_t)get_u8(r);
+            cmark_gfm_extensions_set_table_columns(node, (uint16_t)columns);
+            cmark_gfm_extensions_set_table_alignments(node, (uint16_t)columns, alignments);
+            free(alignments);
+            break;
+        }
+        case AST_TABLE_ROW:
+            cmark_gfm_extensions_set_table_row_is_header(node, (int)get_u8(r));
+            break;
+        case AST_TASKLIST_ITEM:
+            cmark_gfm_extensions_set_tasklist_item_checked(node, get_u8(r) != 0);
+            break;
+        default:
+            break;
+    }
+
+    if (get_u8(r)) {
+        apex_attributes *attrs = get_attributes(r);
+        if (attrs) {
+            cmark_node_set_user_data(node, attrs);
+            apex_attributes_set_caption(attrs, get_str(r));
+            attrs->remove = get_u8(r) != 0;
+        }
+    }
+
+    *children = get_u32(r);
+    if (r->failed) {
+        free_tree(node);
+        return NULL;
+    }
+    return node;
+}
+
+typedef struct {
+    cmark_node *node;
+    uint32_t remaining;
+} ast_frame;
+
+static cmark_node *get_tree(ast_reader *r) {
+    cmark_mem *mem = cmark_get_default_mem_allocator();
+    uint32_t children;
+    cmark_node *root = get_node(r, mem, &children);
+    if (!root) return NULL;
+    if (cmark_node_get_type(root) != CMARK_NODE_DOCUMENT) {
+        free_tree(root);
+        return NULL;
+    }
+
+    size_t depth = 0, cap = 64;
+    ast_frame *stack = malloc(cap * sizeof(ast_frame));
+    if (!stack) {
+        free_tree(root);
+        return NULL;
+    }
+    stack[depth++] = (ast_frame){ root, children };
+
+    while (depth > 0 && !r->failed) {
+        ast_frame *top = &stack[depth - 1];
+        if (top->remaining == 0) {
+            depth--;
+            continue;
+        }
+        top->remaining--;
+
+        cmark_node *node = get_node(r, mem, &children);
+        if (!node) break;
+        if (!cmark_node_append_child(top->node, node)) {
+            free_tree(node);
+            r->failed = true;
+            break;
+        }
+        if (children > 0) {
+            if (depth == cap) {
+                ast_frame *grown = realloc(stack, cap * 2 * sizeof(ast_frame));
+                if (!grown) {
+                    r->failed = true;
+                    break;
+                }
+                stack = grown;
+                cap *= 2;
+            }
+            stack[depth++] = (ast_frame){ node, children };
+        }
+    }
+    free(stack);
+
+    if (r->failed || r->p != r->end) {
+        free_tree(root);
+        return NULL;
+    }
+    return root;
+}
+
+apex_document *apex_ast_read(const char *path, uint64_t fingerprint) {
+    if (!path) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)(sizeof(ast_magic) + 16)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    apex_document *doc = calloc(1, sizeof(apex_document));
+    if (!doc) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    /* Everything read is copied, so the mapping is released at the end */
+    ast_reader r = { map, (const unsigned char *)map + size, false };
+    if (memcmp(r.p, ast_magic, sizeof(ast_magic)) != 0) r.failed = true;
+    r.p += sizeof(ast_magic);
+    if (get_u32(&r) != APEX_AST_CACHE_VERSION) r.failed = true;
+    uint32_t flags = get_u32(&r);
+    doc->attribute_render = (flags & AST_FLAG_ATTRIBUTE_RENDER) != 0;
+    doc->fingerprint = get_u64(&r);
+    if (doc->fingerprint != fingerprint) r.failed = true;
+
+    /* Lists are rebuilt in file order */
+    uint32_t count = get_count(&r);
+    apex_metadata_item **metadata_tail = &doc->metadata;
+    for (uint32_t i = 0; i < count && !r.failed; i++) {
+        apex_metadata_item *item = calloc(1, sizeof(apex_metadata_item));
+        if (!item) {
+            r.failed = true;
+            break;
+        }
+        *metadata_tail = item;
+        metadata_tail = &item->next;
+        item->key = dup_str(&r);
+        item->value = dup_str(&r);
+    }
+
+    count = get_count(&r);
+    abbr_item **abbr_tail = &doc->abbreviations;
+    for (uint32_t i = 0; i < count && !r.failed; i++) {
+        abbr_item *abbr = calloc(1, sizeof(abbr_item));
+        if (!abbr) {
+            r.failed = true;
+            break;
+        }
+        *abbr_tail = abbr;
+        abbr_tail = &abbr->next;
+        abbr->abbr = dup_str(&r);
+        abbr->expansion = dup_str(&r);
+    }
+
+    count = get_count(&r);
+    ald_entry **ald_tail = &doc->alds;
+    for (uint32_t i = 0; i < count && !r.failed; i++) {
+        ald_entry *ald = calloc(1, sizeof(ald_entry));
+        if (!ald) {
+            r.failed = true;
+            break;
+        }
+        *ald_tail = ald;
+        ald_tail = &ald->next;
+        ald->name = dup_str(&r);
+        ald->attrs = get_attributes(&r);
+    }
+
+    count = get_count(&r);
+    if (count) {
+        doc->liquid_tags = calloc(count, sizeof(char *));
+        if (!doc->liquid_tags) r.failed = true;
+        for (uint32_t i = 0; i < count && !r.failed; i++) {
+            doc->liquid_tags[doc->liquid_tag_count++] = dup_str(&r);
+        }
+    }
+    doc->footnote_hash = dup_str(&r);
+
+    if (!r.failed) doc->root = get_tree(&r);
+    munmap(map, size);
+    if (!doc->root) {
+        apex_document_free(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+void apex_document_free(apex_document *doc) {
+    if (!doc) return;
+    if (doc->root) free_tree(doc->root);
+    if (doc->parser) cmark_parser_free(doc->parser);
+    apex_free_metadata(doc->metadata);
+    apex_free_abbreviations(doc->abbreviations);
+    apex_free_alds(doc->alds);
+    for (size_t i = 0; i < doc->liquid_tag_count; i++) free(doc->liquid_tags[i]);
+    free(doc->liquid_tags);
+    free(doc->footnote_hash);
+    free(doc);
+}
+
+int apex_document_save(const apex_document *doc, const char *path) {
+    return apex_ast_write(doc, path);
+}
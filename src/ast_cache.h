@@ -0,0 +1,62 @@
+/**
+ * Parsed documents and their binary cache format
+ * The document struct shared by the pipeline in apex.c (which builds and
+ * renders it) and the serializer in ast_cache.c (which saves and loads it)
+ */
+
+#ifndef APEX_AST_CACHE_H
+#define APEX_AST_CACHE_H
+
+#include "apex/apex.h"
+#include "cmark-gfm.h"
+#include "extensions/metadata.h"
+#include "extensions/abbreviations.h"
+#include "extensions/ial.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bump whenever the file layout or the node kinds change */
+#define APEX_AST_CACHE_VERSION 2
+
+struct apex_document {
+    cmark_node *root;
+    cmark_parser *parser;             /* Parser that built root; NULL when loaded */
+    apex_metadata_item *metadata;
+    abbr_item *abbreviations;
+    ald_entry *alds;
+    char **liquid_tags;               /* Protected {% %} tags restored after rendering */
+    size_t liquid_tag_count;
+    char *footnote_hash;              /* Hash of the source, for random footnote IDs */
+    bool attribute_render;            /* Render through the IAL attribute renderer */
+    uint64_t fingerprint;             /* apex_ast_options_fingerprint() at parse time */
+};
+
+/**
+ * Hash of the options that change what the parse produces. Output-only
+ * options (standalone, pretty, stylesheets, ARIA, ...) are left out so a
+ * cached tree can be rendered with any of them.
+ */
+uint64_t apex_ast_options_fingerprint(const apex_options *options);
+
+/**
+ * Write doc to path
+ * @return 0 on success, -1 on I/O failure or unsupported nodes
+ */
+int apex_ast_write(const apex_document *doc, const char *path);
+
+/**
+ * Map path and rebuild the document stored in it. Core cmark extensions
+ * must already be registered.
+ * @return Document, or NULL if the file is unreadable, damaged, of
+ *         another version or saved with a different fingerprint
+ */
+apex_document *apex_ast_read(const char *path, uint64_t fingerprint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_AST_CACHE_H */
@@ -101,27 +101,33 @@ static char *process_inline_abbreviations(const char *text, abbr_item **abbrs_li
  * Extract abbreviations from text
  * Pattern: *[abbr]: expansion or [>abbr]: expansion
  */
-abbr_item *apex_extract_abbreviations(char **text_ptr) {
-    if (!text_ptr || !*text_ptr) return NULL;
+abbr_item *apex_extract_abbreviations(const char *text, char **stripped) {
+    if (stripped) *stripped = NULL;
+    if (!text || !stripped) return NULL;
+
+    /* Fast path: every form starts with "*[" or "[>" */
+    if (!strstr(text, "*[") && !strstr(text, "[>")) return NULL;
 
-    char *text = *text_ptr;
     abbr_item *abbrs = NULL;
     abbr_item **tail = &abbrs;
-    
 
     /* First, process inline abbreviations [>(abbr) expansion] */
     char *processed = process_inline_abbreviations(text, &abbrs);
-    if (processed) {
-        strcpy(text, processed);
-        free(processed);
-    }
+    if (!processed) return NULL;
+
+    /* Inline items were prepended; keep appending definitions after them */
+    while (*tail) tail = &(*tail)->next;
 
-    char *line_start = text;
-    char *line_end;
-    char *output = malloc(strlen(text) + 1);
+    const char *line_start = processed;
+    const char *line_end;
+    char *output = malloc(strlen(processed) + 1);
     char *output_write = output;
 
-    if (!output) return NULL;
+    if (!output) {
+        free(processed);
+        apex_free_abbreviations(abbrs);
+        return NULL;
+    }
 
     while ((line_end = strchr(line_start, '\n')) != NULL || *line_start) {
         if (!line_end) line_end = line_start + strlen(line_start);
@@ -198,11 +204,13 @@ abbr_item *apex_extract_abbreviations(char **text_ptr) {
     }
 
     *output_write = '\0';
+    free(processed);
 
-    /* Update text pointer to cleaned text */
-    strcpy(text, output);
-    free(output);
-
+    if (abbrs) {
+        *stripped = output;
+    } else {
+        free(output);
+    }
     return abbrs;
 }
 
@@ -23,9 +23,11 @@ typedef struct abbr_item {
 
 /**
  * Extract abbreviation definitions from text
- * Modifies text_ptr to skip abbreviation definitions
+ * *stripped receives a new copy of text with the definitions removed (and
+ * inline abbreviations reduced to their text), or NULL when there were
+ * none (text is then used as is)
  */
-abbr_item *apex_extract_abbreviations(char **text_ptr);
+abbr_item *apex_extract_abbreviations(const char *text, char **stripped);
 
 /**
  * Replace abbreviations in HTML with <abbr> tags
@@ -7,6 +7,7 @@
  */
 
 #include "advanced_footnotes.h"
+#include "sub_parser.h"
 #include "parser.h"
 #include "node.h"
 #include "inlines.h"
@@ -78,8 +79,7 @@ static bool has_block_content(const char *content) {
 /**
  * Re-parse footnote content as block-level Markdown
  */
-static void reparse_footnote_blocks(cmark_node *footnote_def, cmark_parser *parser) {
-    (void)parser;
+static void reparse_footnote_blocks(cmark_node *footnote_def, apex_sub_parser *sub_parser) {
     if (!footnote_def) return;
 
     /* Get the footnote content */
@@ -100,13 +100,8 @@ static void reparse_footnote_blocks(cmark_node *footnote_def, cmark_parser *pars
     /* Check if it needs block parsing */
     if (!has_block_content(literal)) return;
 
-    /* Create a new parser for the footnote content */
-    cmark_parser *sub_parser = cmark_parser_new(CMARK_OPT_FOOTNOTES);
-    if (!sub_parser) return;
-
-    /* Parse the content */
-    cmark_parser_feed(sub_parser, literal, strlen(literal));
-    cmark_node *parsed = cmark_parser_finish(sub_parser);
+    /* Parse the content with the shared sub-parser */
+    cmark_node *parsed = apex_sub_parser_parse(sub_parser, CMARK_OPT_FOOTNOTES, literal, strlen(literal));
 
     if (parsed) {
         /* Remove old content */
@@ -128,16 +123,18 @@ static void reparse_footnote_blocks(cmark_node *footnote_def, cmark_parser *pars
 
         cmark_node_free(parsed);
     }
-
-    cmark_parser_free(sub_parser);
 }
 
 /**
  * Post-process footnotes to support block-level content
  */
 cmark_node *apex_process_advanced_footnotes(cmark_node *root, cmark_parser *parser) {
+    (void)parser;
     if (!root) return root;
 
+    /* One sub-parser for every footnote in the document */
+    apex_sub_parser sub_parser = APEX_SUB_PARSER_INIT;
+
     cmark_iter *iter = cmark_iter_new(root);
     cmark_event_type ev_type;
     cmark_node *cur;
@@ -150,12 +147,13 @@ cmark_node *apex_process_advanced_footnotes(cmark_node *root, cmark_parser *pars
 
             /* Check if this is a footnote definition */
             if (type == CMARK_NODE_FOOTNOTE_DEFINITION) {
-                reparse_footnote_blocks(cur, parser);
+                reparse_footnote_blocks(cur, &sub_parser);
             }
         }
     }
 
     cmark_iter_free(iter);
+    apex_sub_parser_free(&sub_parser);
     return root;
 }
 
@@ -3,16 +3,16 @@
  * Implementation
  *
  * Postprocessing approach to add table enhancements:
- * - Column spans (empty cells merge with previous)
- * - Row spans (^^ marker merges with cell above)
  * - Table captions (paragraph before/after table with [Caption] format)
- * - Multi-line support (future)
+ * - Per-cell alignment (colons around cell content)
+ *
+ * Column spans (<<), row spans (^^) and footers (===) are read from the
+ * table at render time by table_grid.c.
  */
 
 #include "advanced_tables.h"
 #include "parser.h"
 #include "node.h"
-#include "render.h"
 #include "table.h"
 #include "ial.h"
 #include <string.h>
@@ -21,109 +21,10 @@
 #include <ctype.h>
 #include <stdio.h>
 
-/* Global flag for per-cell alignment (set when extension is created) */
-static bool g_per_cell_alignment = false;
-
-/**
- * Extract and check text content from a node recursively
- * Returns true if the content is just "<< " (possibly with whitespace)
- */
-static bool cell_content_is_colspan_marker(cmark_node *node) {
-    if (!node) return false;
-
-    if (cmark_node_get_type(node) == CMARK_NODE_TEXT) {
-        const char *text = cmark_node_get_literal(node);
-        if (text) {
-            /* Simple check: trim whitespace and see if content is just << */
-            const char *start = text;
-            const char *end = text + strlen(text) - 1;
-
-            /* Trim leading whitespace */
-            while (start <= end && isspace((unsigned char)*start)) start++;
-
-            /* Trim trailing whitespace */
-            while (end >= start && isspace((unsigned char)*end)) end--;
-
-            /* Check if we have exactly << */
-            size_t len = end - start + 1;
-            if (len == 2 && start[0] == '<' && start[1] == '<') {
-                return true;
-            }
-
-            /* Also check for HTML entity encoded version (in case encoding happened early) */
-            /* Check exact match */
-            const char *trimmed_encoded_start = start;
-            const char *trimmed_encoded_end = end;
-            size_t encoded_len = trimmed_encoded_end - trimmed_encoded_start + 1;
-            if ((encoded_len == 10 && strncmp(trimmed_encoded_start, "&lt;&lt;", 10) == 0) ||
-                strstr(text, "&lt;&lt;")) {
-                fprintf(stderr, "DEBUG: Found encoded &lt;&lt; marker!\n");
-                return true;
-            }
-        }
-        return false;
-    }
-
-    /* For non-text nodes, recursively check all children */
-    cmark_node *child = cmark_node_first_child(node);
-    while (child) {
-        if (cell_content_is_colspan_marker(child)) {
-            return true;
-        }
-        child = cmark_node_next(child);
-    }
-
-    return false;
-}
-
-/**
- * Check if a cell should span (contains << marker)
- *
- * NOTE: Plain empty cells should NOT trigger colspan - only cells with the
- * << marker (from consecutive pipes like |||) should create colspans.
- * Empty cells with whitespace between pipes should remain as separate cells.
- */
-static bool is_colspan_cell(cmark_node *cell) {
-    if (!cell) return false;
-
-    cmark_node *child = cmark_node_first_child(cell);
-    if (!child) return false; /* Empty cell without << marker - don't merge */
-
-    /* Check all children recursively for the << marker */
-    /* Start from the first child and check recursively */
-    while (child) {
-        if (cell_content_is_colspan_marker(child)) {
-            return true;
-        }
-        child = cmark_node_next(child);
-    }
-
-    return false;
-}
-
-/**
- * Check if a cell should rowspan (contains ^^ marker)
- */
-static bool is_rowspan_cell(cmark_node *cell) {
-    if (!cell) return false;
-
-    cmark_node *child = cmark_node_first_child(cell);
-    if (!child || cmark_node_get_type(child) != CMARK_NODE_TEXT) return false;
-
-    const char *text = cmark_node_get_literal(child);
-    if (!text) return false;
-
-    /* Trim and check for ^^ */
-    while (*text && isspace((unsigned char)*text)) text++;
-
-    if (text[0] == '^' && text[1] == '^') {
-        const char *rest = text + 2;
-        while (*rest && isspace((unsigned char)*rest)) rest++;
-        return (*rest == '\0'); /* Just ^^ */
-    }
-
-    return false;
-}
+/* Non-NULL extension private data marks per-cell alignment as enabled.
+ * Kept on the extension (not in a global) so concurrent conversions with
+ * different options don't see each other's setting. */
+static const bool per_cell_alignment_enabled = true;
 
 /**
  * Process cell alignment markers (: at start/end) and strip them from content.
@@ -241,41 +142,6 @@ static char *process_cell_alignment(cmark_node *cell) {
     return align;
 }
 
-/**
- * Check if a row should be in tfoot (contains === markers)
- */
-static bool is_tfoot_row(cmark_node *row) {
-    if (!row || cmark_node_get_type(row) != CMARK_NODE_TABLE_ROW) return false;
-
-    cmark_node *cell = cmark_node_first_child(row);
-    bool has_equals = false;
-
-    while (cell) {
-        if (cmark_node_get_type(cell) == CMARK_NODE_TABLE_CELL) {
-            cmark_node *text_node = cmark_node_first_child(cell);
-            if (text_node && cmark_node_get_type(text_node) == CMARK_NODE_TEXT) {
-                const char *text = cmark_node_get_literal(text_node);
-                if (text) {
-                    /* Trim whitespace */
-                    while (*text && isspace((unsigned char)*text)) text++;
-                    /* Check if it's only === (three or more equals) */
-                    if (*text == '=' && text[1] == '=' && text[2] == '=') {
-                        const char *after = text + 3;
-                        while (*after == '=') after++; /* Allow more equals */
-                        while (*after && isspace((unsigned char)*after)) after++;
-                        if (*after == '\0') {
-                            has_equals = true;
-                        }
-                    }
-                }
-            }
-        }
-        cell = cmark_node_next(cell);
-    }
-
-    return has_equals;
-}
-
 /**
  * Check if a row contains only a caption marker (last row with [Caption])
  * Note: This detection works when captions are parsed as table rows, but currently
@@ -321,387 +187,34 @@ static bool is_caption_row(cmark_node *row) {
 }
 
 /**
- * Add colspan/rowspan attributes to table cells
- * This modifies the AST by setting user_data with HTML attributes
+ * Strip per-cell alignment colons, recording the alignment as a style on
+ * the cell. Spans, footers and marker cells are left to render time (see
+ * table_grid.c), which reads the table without changing it.
  */
-static void process_table_spans(cmark_node *table) {
-    if (!table || cmark_node_get_type(table) != CMARK_NODE_TABLE) return;
-
-    /* Walk through table rows - start from first TABLE_ROW node */
-    cmark_node *row = cmark_node_first_child(table);
-    while (row && cmark_node_get_type(row) != CMARK_NODE_TABLE_ROW) {
-        row = cmark_node_next(row); /* Skip non-row nodes */
-    }
-
-    cmark_node *prev_row = NULL;
-    bool is_first_row = true; /* Track header row */
-    bool in_tfoot_section = false; /* Track if we've entered tfoot section */
-
-    /* Track active rowspan cells per column (inspired by Jekyll Spaceship).
-     * active_rowspan[col] points to the cell node that's currently being rowspanned in that column.
-     * When we see a ^^ cell, we merge it with the active cell for that column.
-     * This persists across rows - when a regular cell appears, it becomes the new active cell.
-     * Initialize all to NULL at the start of each table. */
-    cmark_node *active_rowspan[50] = {NULL};  /* One per column, max 50 columns, persists across rows */
-
-    while (row) {
-        if (cmark_node_get_type(row) == CMARK_NODE_TABLE_ROW) {
-            /* Process span for header row too - don't skip it */
-            if (is_first_row) {
-                is_first_row = false;
-            }
-
-            /* Check if this row is a tfoot row (contains ===) */
-            /* Once we encounter a tfoot row, all subsequent rows are in tfoot */
-            if (is_tfoot_row(row)) {
-                /* This is the === row itself - mark it as tfoot and set flag */
-                in_tfoot_section = true;
-                char *existing = (char *)cmark_node_get_user_data(row);
-                if (existing) free(existing);
-                cmark_node_set_user_data(row, strdup(" data-tfoot=\"true\""));
-            } else if (in_tfoot_section) {
-                /* We've already encountered the === row, so mark this row as tfoot */
-                char *existing = (char *)cmark_node_get_user_data(row);
-                if (existing) free(existing);
-                cmark_node_set_user_data(row, strdup(" data-tfoot=\"true\""));
-            }
-
-            /* If this row is the === separator row, mark its cells for removal.
-             * We no longer skip processing for tfoot rows entirely, so that colspan
-             * logic can still run on footer rows. Rowspan logic will simply not
-             * trigger unless ^^ markers are present. */
-            if (is_tfoot_row(row)) {
-                cmark_node *cell = cmark_node_first_child(row);
-                while (cell) {
-                    if (cmark_node_get_type(cell) == CMARK_NODE_TABLE_CELL) {
-                        cmark_node *text_node = cmark_node_first_child(cell);
-                        if (text_node && cmark_node_get_type(text_node) == CMARK_NODE_TEXT) {
-                            const char *text = cmark_node_get_literal(text_node);
-                            if (text) {
-                                /* Trim whitespace */
-                                while (*text && isspace((unsigned char)*text)) text++;
-                                /* Check if it's === */
-                                if (text[0] == '=' && text[1] == '=' && text[2] == '=') {
-                                    const char *after = text + 3;
-                                    while (*after == '=') after++; /* Allow more equals */
-                                    while (*after && isspace((unsigned char)*after)) after++;
-                                    if (*after == '\0') {
-                                        /* This is a === cell - mark for removal */
-                                        char *cell_attrs = (char *)cmark_node_get_user_data(cell);
-                                        if (cell_attrs) free(cell_attrs);
-                                        cmark_node_set_user_data(cell, strdup(" data-remove=\"true\""));
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    cell = cmark_node_next(cell);
-                }
-            }
+static void apply_cell_alignment(cmark_node *table) {
+    for (cmark_node *row = cmark_node_first_child(table); row; row = cmark_node_next(row)) {
+        if (cmark_node_get_type(row) != CMARK_NODE_TABLE_ROW) continue;
+        for (cmark_node *cell = cmark_node_first_child(row); cell; cell = cmark_node_next(cell)) {
+            if (cmark_node_get_type(cell) != CMARK_NODE_TABLE_CELL) continue;
+            char *align = process_cell_alignment(cell);
+            if (!align) continue;
 
-            /* Check if this row only contains '—' cells (separator row or empty row) */
-            cmark_node *check_cell = cmark_node_first_child(row);
-            bool all_dash = true;
-            bool has_cells = false;
-            while (check_cell) {
-                if (cmark_node_get_type(check_cell) == CMARK_NODE_TABLE_CELL) {
-                    has_cells = true;
-                    cmark_node *check_text = cmark_node_first_child(check_cell);
-                    if (check_text && cmark_node_get_type(check_text) == CMARK_NODE_TEXT) {
-                        const char *check_content = cmark_node_get_literal(check_text);
-                        if (check_content && strcmp(check_content, "—") != 0) {
-                            all_dash = false;
-                            break;
-                        }
-                    } else {
-                        /* Empty cell, check if it's really empty */
-                        if (cmark_node_first_child(check_cell)) {
-                            all_dash = false;
-                            break;
-                        }
-                    }
-                }
-                check_cell = cmark_node_next(check_cell);
-            }
-            /* Skip rows that only contain '—' characters (alignment/separator rows) */
-            if (has_cells && all_dash) {
-                /* Mark the entire row for removal in HTML output */
-                cmark_node *dash_cell = cmark_node_first_child(row);
-                while (dash_cell) {
-                    if (cmark_node_get_type(dash_cell) == CMARK_NODE_TABLE_CELL) {
-                        char *existing = (char *)cmark_node_get_user_data(dash_cell);
-                        if (existing) free(existing);
-                        cmark_node_set_user_data(dash_cell, strdup(" data-remove=\"true\""));
-                    }
-                    dash_cell = cmark_node_next(dash_cell);
-                }
-                /* Don't update prev_row when skipping - keep it pointing to the previous valid row */
-                row = cmark_node_next(row);
-                continue;
-            }
-
-            cmark_node *cell = cmark_node_first_child(row);
-            cmark_node *prev_cell = NULL;  /* Always reset to NULL at start of each row */
-            int col_index = 0;
-
-            /* Note: We don't initialize active_rowspan here because it persists across rows.
-             * When we process the first data row, active_rowspan will be NULL for all columns,
-             * so ^^ cells will find cells from prev_row and set them as active.
-             * Regular cells in subsequent rows will update active_rowspan as they're processed. */
-
-            while (cell) {
-                if (cmark_node_get_type(cell) == CMARK_NODE_TABLE_CELL) {
-                    /* Process per-cell alignment markers (:) BEFORE colspan/rowspan processing
-                     * so that alignment is preserved when cells are merged. */
-                    if (g_per_cell_alignment) {
-                        char *cell_attrs_check = (char *)cmark_node_get_user_data(cell);
-                        if (!cell_attrs_check || !strstr(cell_attrs_check, "data-remove")) {
-                            char *align = process_cell_alignment(cell);
-                            if (align) {
-                            /* Add style attribute for alignment */
-                            char *existing_attrs = (char *)cmark_node_get_user_data(cell);
-                            char new_attrs[256];
-                            
-                            if (existing_attrs && strlen(existing_attrs) > 0) {
-                                snprintf(new_attrs, sizeof(new_attrs), "%s style=\"text-align: %s\"", existing_attrs, align);
-                            } else {
-                                snprintf(new_attrs, sizeof(new_attrs), " style=\"text-align: %s\"", align);
-                            }
-                            
-                            if (existing_attrs) free(existing_attrs);
-                            cmark_node_set_user_data(cell, strdup(new_attrs));
-                            }
-                        }
-                    }
-
-                            /* Check for colspan */
-                    bool is_colspan = is_colspan_cell(cell);
-                    if (is_colspan) {
-                        /* Only process colspan if we have a previous cell in the SAME ROW */
-                        if (!prev_cell || cmark_node_parent(prev_cell) != row) {
-                            /* No previous cell in same row, can't do colspan.
-                             * This happens for:
-                             * 1. First cell in a row (prev_cell is NULL)
-                             * 2. First non-empty cell after removed cells (prev_cell is from previous row)
-                             * In these cases, mark empty cells for removal. */
-                            cmark_node *child = cmark_node_first_child(cell);
-                            if (child == NULL) {
-                                /* Empty cell with no previous cell - mark for removal */
-                                char *existing = (char *)cmark_node_get_user_data(cell);
-                                if (existing) free(existing);
-                                cmark_node_set_user_data(cell, strdup(" data-remove=\"true\""));
-                            }
-                            prev_cell = cell;
-                            col_index++;
-                            cell = cmark_node_next(cell);
-                            continue;
-                        }
-                        /* Find the first non-empty cell going backwards (skip cells marked for removal) */
-                        cmark_node *target_cell = prev_cell;
-                        while (target_cell) {
-                            /* Verify target_cell is in the same row */
-                            if (cmark_node_parent(target_cell) != row) {
-                                break; /* target_cell is not in the same row, stop */
-                            }
-                            char *target_attrs = (char *)cmark_node_get_user_data(target_cell);
-                            /* Skip cells marked for removal */
-                            if (!target_attrs || !strstr(target_attrs, "data-remove")) {
-                                break; /* Found a real cell */
-                            }
-                            /* Move to previous cell */
-                            cmark_node *prev = cmark_node_previous(target_cell);
-                            while (prev && cmark_node_get_type(prev) != CMARK_NODE_TABLE_CELL) {
-                                prev = cmark_node_previous(prev);
-                            }
-                            target_cell = prev;
-                        }
-
-                        if (target_cell && cmark_node_parent(target_cell) == row) {
-                            /* Merge empty cells with the previous cell to create colspan.
-                             * This handles both:
-                             * - Consecutive empty cells (like |||) merging together
-                             * - Empty cells after a content cell (like | header |||) merging with the content cell
-                             *
-                             * However, we need to be careful: a single empty cell between two content cells
-                             * (like | Absent | | 92.00 |) should NOT merge, as that's just a missing value.
-                             *
-                             * The distinction: if the target_cell is empty, we're merging consecutive empty cells.
-                             * If the target_cell has content, we're merging an empty cell with content (colspan).
-                             * Both cases are valid for creating colspan. */
-
-                            /* Check if target_cell is empty (has no content at all).
-                             * IMPORTANT: We only merge empty cells that are part of consecutive empty cells (|||).
-                             * Empty cells with whitespace between pipes (|    |) should NOT be merged. */
-                            cmark_node *target_child = cmark_node_first_child(target_cell);
-                            bool target_is_empty = (target_child == NULL);
-
-                            /* Check if the next cell (after current) has content.
-                             * If target has content AND next also has content, don't merge (isolated empty cell).
-                             * Example: | Absent | | 92.00 | - empty cell between two content cells should NOT merge.
-                             * But if target has content and next is empty or end-of-row, merge (empty cells after content).
-                             * Example: | header ||| - empty cells after content should merge. */
-                            cmark_node *next_cell = cmark_node_next(cell);
-                            while (next_cell && cmark_node_get_type(next_cell) != CMARK_NODE_TABLE_CELL) {
-                                next_cell = cmark_node_next(next_cell);
-                            }
-                            bool next_has_content = false;
-                            if (next_cell && cmark_node_get_type(next_cell) == CMARK_NODE_TABLE_CELL) {
-                                cmark_node *next_child = cmark_node_first_child(next_cell);
-                                next_has_content = (next_child != NULL);
-                            }
-
-                            /* Merge if:
-                             * 1. Current cell has << marker (explicit colspan marker, always merge), OR
-                             * 2. Target is empty AND next is also empty (consecutive empty cells from |||), OR
-                             * 3. Target has content AND next is empty/end (empty cells after content from | header |||)
-                             * 
-                             * Do NOT merge if:
-                             * - Target has content AND next also has content (isolated empty cell like | A | | B |)
-                             * - Target is empty but next has content (empty cell before content, like | | A |) */
-                            /* For << markers (explicit colspan), always merge regardless of other conditions */
-                            bool should_merge = is_colspan || 
-                                (target_is_empty && !next_has_content) || 
-                                (!target_is_empty && !next_has_content);
-
-                            if (should_merge) {
-                                /* Target cell is empty or has << marker - merge them (colspan) */
-                                /* Get or create colspan attribute */
-                                char *prev_attrs = (char *)cmark_node_get_user_data(target_cell);
-                                int current_colspan = 1;
-
-                                if (prev_attrs && strstr(prev_attrs, "colspan=")) {
-                                    sscanf(strstr(prev_attrs, "colspan="), "colspan=\"%d\"", &current_colspan);
-                                }
-
-                                /* Extract style attribute if it exists */
-                                char style_attr[256] = "";
-                                if (prev_attrs && strstr(prev_attrs, "style=")) {
-                                    const char *style_start = strstr(prev_attrs, "style=");
-                                    const char *style_end = style_start;
-                                    /* Find the opening quote after style= */
-                                    while (*style_end && *style_end != '"') style_end++;
-                                    if (*style_end == '"') {
-                                        style_end++; /* Skip opening quote */
-                                        /* Find the closing quote */
-                                        while (*style_end && *style_end != '"') style_end++;
-                                        if (*style_end == '"') {
-                                            style_end++; /* Include the closing quote */
-                                            /* Now find the end: space or end of string */
-                                            const char *attr_end = style_end;
-                                            while (*attr_end && *attr_end != ' ' && *attr_end != '\t') attr_end++;
-                                            size_t style_len = attr_end - style_start;
-                                            if (style_len < sizeof(style_attr)) {
-                                                strncpy(style_attr, style_start, style_len);
-                                                style_attr[style_len] = '\0';
-                                            }
-                                        }
-                                    }
-                                }
-
-                                /* Build new attributes - combine style (if any) and colspan */
-                                char new_attrs[512];
-                                if (style_attr[0] != '\0') {
-                                    snprintf(new_attrs, sizeof(new_attrs), " %s colspan=\"%d\"", style_attr, current_colspan + 1);
-                                } else {
-                                    snprintf(new_attrs, sizeof(new_attrs), " colspan=\"%d\"", current_colspan + 1);
-                                }
-                                
-                                /* Free old user_data before setting new */
-                                if (prev_attrs) free(prev_attrs);
-                                cmark_node_set_user_data(target_cell, strdup(new_attrs));
-
-                                /* Mark current cell for removal */
-                                cmark_node_set_user_data(cell, strdup(" data-remove=\"true\""));
-                            }
-                        }
-                    }
-                    /* Check for rowspan */
-                    else if (is_rowspan_cell(cell) && col_index < 50) {
-                        /* Use Jekyll Spaceship approach: merge with active rowspan cell for this column.
-                         * If there's an active rowspan cell, increment its rowspan.
-                         * Otherwise, find the cell in the previous row and make it active. */
-                        cmark_node *target_cell = active_rowspan[col_index];
-
-                        /* If no active cell, find one in the previous row */
-                        if (!target_cell && prev_row) {
-                            cmark_node *candidate = cmark_node_first_child(prev_row);
-                            int prev_col = 0;
-
-                            /* Find cell at col_index in the previous row */
-                            while (candidate) {
-                                if (cmark_node_get_type(candidate) == CMARK_NODE_TABLE_CELL) {
-                                    if (prev_col == col_index) {
-                                        /* Check if this cell is marked for removal */
-                                        char *cand_attrs = (char *)cmark_node_get_user_data(candidate);
-                                        if (!cand_attrs || !strstr(cand_attrs, "data-remove")) {
-                                            /* Found a real cell (not marked for removal) at this column index */
-                                            target_cell = candidate;
-                                            active_rowspan[col_index] = candidate;  /* Make it active */
-                                        }
-                                        break;
-                                    }
-                                    prev_col++;
-                                }
-                                candidate = cmark_node_next(candidate);
-                            }
-                        }
-
-                        if (target_cell && cmark_node_get_type(target_cell) == CMARK_NODE_TABLE_CELL) {
-                            /* Get or create rowspan attribute */
-                            char *prev_attrs = (char *)cmark_node_get_user_data(target_cell);
-                            int current_rowspan = 1;
-
-                            if (prev_attrs && strstr(prev_attrs, "rowspan=")) {
-                                sscanf(strstr(prev_attrs, "rowspan="), "rowspan=\"%d\"", &current_rowspan);
-                            }
-
-                            /* Increment rowspan - append or replace */
-                            char new_attrs[256];
-                            if (prev_attrs && !strstr(prev_attrs, "rowspan=")) {
-                                /* Append to existing attributes */
-                                snprintf(new_attrs, sizeof(new_attrs), "%s rowspan=\"%d\"", prev_attrs, current_rowspan + 1);
-                            } else {
-                                /* Replace or create new */
-                                snprintf(new_attrs, sizeof(new_attrs), " rowspan=\"%d\"", current_rowspan + 1);
-                            }
-                            /* Free old user_data before setting new */
-                            if (prev_attrs) free(prev_attrs);
-                            cmark_node_set_user_data(target_cell, strdup(new_attrs));
-
-                        }
-                        /* Always mark rowspan cell for removal, even if target not found */
-                        char *existing = (char *)cmark_node_get_user_data(cell);
-                        if (existing) free(existing);
-                        cmark_node_set_user_data(cell, strdup(" data-remove=\"true\""));
-                    }
-
-                    /* If this is a regular cell (not rowspan), it becomes the new active cell for this column.
-                     * This happens AFTER processing rowspan cells, so regular cells replace the previous active cell.
-                     * This is the Jekyll Spaceship approach: regular cells become the new active cells.
-                     *
-                     * IMPORTANT: We set this AFTER processing the cell, so that when we process ^^ cells
-                     * in the NEXT row, they will use the correct active cell from THIS row. */
-                    if (!is_rowspan_cell(cell)) {
-                        char *cell_attrs = (char *)cmark_node_get_user_data(cell);
-                        if (!cell_attrs || !strstr(cell_attrs, "data-remove")) {
-                            /* This is a regular cell, so it becomes the new active cell for this column */
-                            active_rowspan[col_index] = cell;
-                        }
-                    }
-
-                    prev_cell = cell;
-                    col_index++;
-                }
-                cell = cmark_node_next(cell);
-            }
-
-            /* Update prev_row after processing this row */
-            prev_row = row;
+            char style[32];
+            snprintf(style, sizeof(style), "text-align: %s", align);
+            apex_attributes_set(apex_node_ensure_attributes(cell), "style", style);
         }
-        row = cmark_node_next(row);
     }
 }
 
+/**
+ * Drop a paragraph used as a table's caption
+ */
+static void remove_caption_paragraph(cmark_node *para) {
+    cmark_node_unlink(para);
+    apex_free_node_attributes(para);
+    cmark_node_free(para);
+}
+
 /**
  * Check if a paragraph is a table caption ([Caption Text])
  */
@@ -825,166 +338,15 @@ static apex_attributes *parse_ial_from_text(const char *text) {
     int content_len = ial_end - ial_start;
     if (content_len <= 0) return NULL;
 
-    /* Use parse_ial_content from ial.c - it already handles the content format */
-    /* We need to access the static function, so we'll duplicate the logic here */
-    /* Actually, we can't access static functions, so we'll create a wrapper */
-    apex_attributes *attrs = malloc(sizeof(apex_attributes));
-    if (!attrs) return NULL;
-    memset(attrs, 0, sizeof(apex_attributes));
-
-    char buffer[2048];
-    if (content_len >= (int)sizeof(buffer)) content_len = (int)sizeof(buffer) - 1;
-    memcpy(buffer, ial_start, content_len);
-    buffer[content_len] = '\0';
-
-    /* Parse attributes manually (similar to parse_ial_content) */
-    char *buf_p = buffer;
-    while (*buf_p) {
-        /* Skip whitespace */
-        while (isspace((unsigned char)*buf_p)) buf_p++;
-        if (!*buf_p) break;
-
-        /* Check for ID (#id) */
-        if (*buf_p == '#') {
-            buf_p++;
-            char *id_start = buf_p;
-            while (*buf_p && !isspace((unsigned char)*buf_p) && *buf_p != '.' && *buf_p != '}') buf_p++;
-            if (buf_p > id_start) {
-                char saved = *buf_p;
-                *buf_p = '\0';
-                attrs->id = strdup(id_start);
-                *buf_p = saved;
-            }
-            continue;
-        }
-
-        /* Check for class (.class) */
-        if (*buf_p == '.') {
-            buf_p++;
-            char *class_start = buf_p;
-            while (*buf_p && !isspace((unsigned char)*buf_p) && *buf_p != '.' && *buf_p != '#' && *buf_p != '}') buf_p++;
-            if (buf_p > class_start) {
-                char saved = *buf_p;
-                *buf_p = '\0';
-                attrs->classes = realloc(attrs->classes, sizeof(char*) * (attrs->class_count + 1));
-                attrs->classes[attrs->class_count++] = strdup(class_start);
-                *buf_p = saved;
-            }
-            continue;
-        }
-
-        /* Check for key="value" */
-        char *key_start = buf_p;
-        while (*buf_p && *buf_p != '=' && *buf_p != ' ' && *buf_p != '\t' && *buf_p != '}') buf_p++;
-
-        if (*buf_p == '=') {
-            char saved = *buf_p;
-            *buf_p = '\0';
-            char *key = strdup(key_start);
-            *buf_p = saved;
-            buf_p++; /* Skip = */
-
-            /* Parse value */
-            char *value = NULL;
-            if (*buf_p == '"' || *buf_p == '\'') {
-                char quote = *buf_p++;
-                char *value_start = buf_p;
-                while (*buf_p && *buf_p != quote) {
-                    if (*buf_p == '\\' && *(buf_p+1)) buf_p++;
-                    buf_p++;
-                }
-                if (*buf_p == quote) {
-                    *buf_p = '\0';
-                    value = strdup(value_start);
-                    *buf_p = quote;
-                    buf_p++;
-                }
-            } else {
-                char *value_start = buf_p;
-                while (*buf_p && !isspace((unsigned char)*buf_p) && *buf_p != '}') buf_p++;
-                char saved_val = *buf_p;
-                *buf_p = '\0';
-                value = strdup(value_start);
-                *buf_p = saved_val;
-            }
-
-            attrs->keys = realloc(attrs->keys, sizeof(char*) * (attrs->attr_count + 1));
-            attrs->values = realloc(attrs->values, sizeof(char*) * (attrs->attr_count + 1));
-            attrs->keys[attrs->attr_count] = key;
-            attrs->values[attrs->attr_count] = value ? value : strdup("");
-            attrs->attr_count++;
-            continue;
-        }
-
-        /* Unknown token, skip */
-        buf_p++;
-    }
-
-    return attrs;
-}
-
-/**
- * Convert attributes to HTML attribute string
- */
-static char *attributes_to_html_string(apex_attributes *attrs) {
-    if (!attrs) return NULL;
-
-    char buffer[4096];
-    char *p = buffer;
-    bool first_attr = true;
-
-    #define APPEND(s) do { \
-        size_t len = strlen(s); \
-        if ((size_t)(p - buffer) + len < sizeof(buffer)) { \
-            memcpy(p, s, len); \
-            p += len; \
-        } \
-    } while (0)
-
-    if (attrs->id) {
-        APPEND(" id=\"");
-        APPEND(attrs->id);
-        APPEND("\"");
-        first_attr = false;
-    }
-
-    if (attrs->class_count > 0) {
-        if (first_attr) {
-            APPEND(" class=\"");
-        } else {
-            APPEND(" class=\"");
-        }
-        for (int i = 0; i < attrs->class_count; i++) {
-            if (i > 0) APPEND(" ");
-            APPEND(attrs->classes[i]);
-        }
-        APPEND("\"");
-        first_attr = false;
-    }
-
-    for (int i = 0; i < attrs->attr_count; i++) {
-        char attr_str[1024];
-        const char *val = attrs->values[i];
-        if (first_attr) {
-            snprintf(attr_str, sizeof(attr_str), "%s=\"%s\"", attrs->keys[i], val);
-            first_attr = false;
-        } else {
-            snprintf(attr_str, sizeof(attr_str), " %s=\"%s\"", attrs->keys[i], val);
-        }
-        APPEND(attr_str);
-    }
-
-    #undef APPEND
-
-    *p = '\0';
-    return strdup(buffer);
+    return apex_parse_ial_content(ial_start, (size_t)content_len);
 }
 
 /**
  * Check if a paragraph is a table caption format (without adjacency check)
- * Used when we're already looking backwards from a table and know it's adjacent
+ * Used when we're already looking backwards from a table and know it's adjacent.
+ * *full_text_out receives the paragraph's text, which the caller frees.
  */
-static bool is_table_caption_format(cmark_node *para, char **caption_text, const char **original_text_ptr) {
+static bool is_table_caption_format(cmark_node *para, char **caption_text, char **full_text_out) {
     if (!para || cmark_node_get_type(para) != CMARK_NODE_PARAGRAPH) {
         return false;
     }
@@ -1051,13 +413,7 @@ static bool is_table_caption_format(cmark_node *para, char **caption_text, const
                     memcpy(*caption_text, text + 1, len);
                     (*caption_text)[len] = '\0';
                 }
-                /* Store full_text pointer in paragraph user_data so we can free it later */
-                char *existing_data = (char *)cmark_node_get_user_data(para);
-                if (existing_data) free(existing_data);
-                cmark_node_set_user_data(para, full_text);
-                if (original_text_ptr) {
-                    *original_text_ptr = text;
-                }
+                *full_text_out = full_text;
                 return true;
             } else if (has_ial) {
                 size_t len = end - (text + 1);
@@ -1066,13 +422,7 @@ static bool is_table_caption_format(cmark_node *para, char **caption_text, const
                     memcpy(*caption_text, text + 1, len);
                     (*caption_text)[len] = '\0';
                 }
-                /* Store full_text pointer in paragraph user_data so we can free it later */
-                char *existing_data = (char *)cmark_node_get_user_data(para);
-                if (existing_data) free(existing_data);
-                cmark_node_set_user_data(para, full_text);
-                if (original_text_ptr) {
-                    *original_text_ptr = text;
-                }
+                *full_text_out = full_text;
                 return true;
             }
         }
@@ -1129,36 +479,22 @@ static bool is_table_caption_format(cmark_node *para, char **caption_text, const
                     memcpy(*caption_text, caption_start, len);
                     (*caption_text)[len] = '\0';
                 }
-                /* Store full_text pointer in paragraph user_data so we can free it later */
-                char *existing_data = (char *)cmark_node_get_user_data(para);
-                if (existing_data) free(existing_data);
-                cmark_node_set_user_data(para, full_text);
-                if (original_text_ptr) {
-                    *original_text_ptr = text;
-                }
+                *full_text_out = full_text;
                 return true;
             } else if (ial_start) {
                 *caption_text = strdup("");
-                /* Store full_text pointer in paragraph user_data so we can free it later */
-                char *existing_data = (char *)cmark_node_get_user_data(para);
-                if (existing_data) free(existing_data);
-                cmark_node_set_user_data(para, full_text);
-                if (original_text_ptr) {
-                    *original_text_ptr = text;
-                }
+                *full_text_out = full_text;
                 return true;
             }
         }
     }
 
     /* Not a caption format - free allocated memory */
-    /* Note: We don't modify user_data here because it might contain important state
-     * from previous checks. The caller should handle cleanup if needed. */
     free(full_text);
     return false;
 }
 
-static bool is_table_caption(cmark_node *para, char **caption_text, const char **original_text_ptr) {
+static bool is_table_caption(cmark_node *para, char **caption_text, char **full_text_out) {
     if (!para || cmark_node_get_type(para) != CMARK_NODE_PARAGRAPH) {
         return false;
     }
@@ -1227,13 +563,7 @@ static bool is_table_caption(cmark_node *para, char **caption_text, const char *
                     memcpy(*caption_text, text + 1, len);
                     (*caption_text)[len] = '\0';
                 }
-                /* Store full_text pointer in paragraph user_data so we can free it later */
-                char *existing_data = (char *)cmark_node_get_user_data(para);
-                if (existing_data) free(existing_data);
-                cmark_node_set_user_data(para, full_text);
-                if (original_text_ptr) {
-                    *original_text_ptr = text;
-                }
+                *full_text_out = full_text;
                 return true;
             } else if (has_ial) {
                 /* Has IAL after [Caption] */
@@ -1243,13 +573,7 @@ static bool is_table_caption(cmark_node *para, char **caption_text, const char *
                     memcpy(*caption_text, text + 1, len);
                     (*caption_text)[len] = '\0';
                 }
-                /* Store full_text pointer in paragraph user_data so we can free it later */
-                char *existing_data = (char *)cmark_node_get_user_data(para);
-                if (existing_data) free(existing_data);
-                cmark_node_set_user_data(para, full_text);
-                if (original_text_ptr) {
-                    *original_text_ptr = text;
-                }
+                *full_text_out = full_text;
                 return true;
             }
         }
@@ -1314,24 +638,12 @@ static bool is_table_caption(cmark_node *para, char **caption_text, const char *
                         memcpy(*caption_text, caption_start, len);
                         (*caption_text)[len] = '\0';
                     }
-                    /* Store full_text pointer in paragraph user_data so we can free it later */
-                    char *existing_data = (char *)cmark_node_get_user_data(para);
-                    if (existing_data) free(existing_data);
-                    cmark_node_set_user_data(para, full_text);
-                    if (original_text_ptr) {
-                        *original_text_ptr = text;
-                    }
+                    *full_text_out = full_text;
                     return true;
                 } else if (ial_start) {
                     /* Caption is empty but has IAL - still valid */
                     *caption_text = strdup("");
-                    /* Store full_text pointer in paragraph user_data so we can free it later */
-                    char *existing_data = (char *)cmark_node_get_user_data(para);
-                    if (existing_data) free(existing_data);
-                    cmark_node_set_user_data(para, full_text);
-                    if (original_text_ptr) {
-                        *original_text_ptr = text;
-                    }
+                    *full_text_out = full_text;
                     return true;
                 }
             }
@@ -1349,79 +661,14 @@ static bool is_table_caption(cmark_node *para, char **caption_text, const char *
 static void add_table_caption(cmark_node *table, const char *caption, const char *original_text) {
     if (!table || !caption) return;
 
-    /* Extract IAL attributes from original text if present */
-    apex_attributes *ial_attrs = NULL;
-    if (original_text) {
-        ial_attrs = parse_ial_from_text(original_text);
-    }
-
-    /* Store caption in user_data */
-    char *existing_user_data = (char *)cmark_node_get_user_data(table);
+    apex_attributes *attrs = apex_node_ensure_attributes(table);
+    if (!attrs || attrs->caption) return; /* Caption already present */
+    apex_attributes_set_caption(attrs, caption);
 
-    /* Check if caption is already in existing data */
-    if (existing_user_data && strstr(existing_user_data, "data-caption=")) {
-        if (ial_attrs) {
-            apex_free_attributes(ial_attrs);
-        }
-        return; /* Caption already present */
-    }
-
-    char *attrs = malloc(strlen(caption) + 50);
-    if (attrs) {
-        snprintf(attrs, strlen(caption) + 50, " data-caption=\"%s\"", caption);
-
-        /* Append IAL attributes if found */
-        if (ial_attrs) {
-            char *ial_str = attributes_to_html_string(ial_attrs);
-            if (ial_str) {
-                size_t new_len = strlen(attrs) + strlen(ial_str) + 1;
-                char *new_attrs = realloc(attrs, new_len);
-                if (new_attrs) {
-                    attrs = new_attrs;
-                    strcat(attrs, ial_str);
-                    free(ial_str);
-                } else {
-                    free(ial_str);
-                }
-            }
-            apex_free_attributes(ial_attrs);
-        }
-
-        /* Append to existing user_data if present */
-        if (existing_user_data) {
-            char *combined = malloc(strlen(existing_user_data) + strlen(attrs) + 1);
-            if (combined) {
-                strcpy(combined, existing_user_data);
-                strcat(combined, attrs);
-                free(existing_user_data); /* Free old user_data before replacing */
-                cmark_node_set_user_data(table, combined);
-                free(attrs);
-            } else {
-                free(attrs);
-            }
-        } else {
-            cmark_node_set_user_data(table, attrs);
-        }
-    } else if (ial_attrs) {
-        /* No caption text but IAL attributes found - apply them */
-        char *ial_str = attributes_to_html_string(ial_attrs);
-        if (ial_str) {
-            char *existing = (char *)cmark_node_get_user_data(table);
-            if (existing) {
-                char *combined = malloc(strlen(existing) + strlen(ial_str) + 1);
-                if (combined) {
-                    strcpy(combined, existing);
-                    strcat(combined, ial_str);
-                    free(existing);
-                    cmark_node_set_user_data(table, combined);
-                    free(ial_str);
-                } else {
-                    free(ial_str);
-                }
-            } else {
-                cmark_node_set_user_data(table, ial_str);
-            }
-        }
+    /* Extract IAL attributes from original text if present */
+    apex_attributes *ial_attrs = original_text ? parse_ial_from_text(original_text) : NULL;
+    if (ial_attrs) {
+        apex_attributes_merge(attrs, ial_attrs);
         apex_free_attributes(ial_attrs);
     }
 }
@@ -1429,7 +676,7 @@ static void add_table_caption(cmark_node *table, const char *caption, const char
 /**
  * Process tables in document
  */
-cmark_node *apex_process_advanced_tables(cmark_node *root) {
+cmark_node *apex_process_advanced_tables(cmark_node *root, bool per_cell_alignment) {
     if (!root) return root;
 
     cmark_iter *iter = cmark_iter_new(root);
@@ -1487,51 +734,42 @@ cmark_node *apex_process_advanced_tables(cmark_node *root) {
 
                         if (!is_blank) {
                             /* Found a non-blank paragraph - check if it's a caption */
-                            char *prev_data = (char *)cmark_node_get_user_data(prev);
-                            /* Skip paragraphs that have already been used as captions */
-                            if (!prev_data || !strstr(prev_data, "data-remove")) {
-                                /* Quick check: does this paragraph start with [ or : (caption indicators)? */
-                                /* This avoids calling is_table_caption_format on paragraphs that clearly aren't captions */
-                                cmark_node *first_text = cmark_node_first_child(prev);
-                                bool might_be_caption = false;
-                                if (first_text) {
-                                    cmark_node_type first_text_type = cmark_node_get_type(first_text);
-                                    if (first_text_type == CMARK_NODE_TEXT) {
-                                        const char *first_char = cmark_node_get_literal(first_text);
-                                        if (first_char && strlen(first_char) > 0) {
-                                            size_t first_char_len = strlen(first_char);
-                                            /* Skip leading whitespace (up to 3 spaces) */
-                                            int check_spaces = 0;
-                                            while (check_spaces < 3 && check_spaces < (int)first_char_len && first_char[check_spaces] == ' ') {
-                                                check_spaces++;
-                                            }
-                                            if (check_spaces < (int)first_char_len &&
-                                                (first_char[check_spaces] == '[' || first_char[check_spaces] == ':')) {
-                                                might_be_caption = true;
-                                            }
+                            /* Quick check: does this paragraph start with [ or : (caption indicators)? */
+                            /* This avoids calling is_table_caption_format on paragraphs that clearly aren't captions */
+                            cmark_node *first_text = cmark_node_first_child(prev);
+                            bool might_be_caption = false;
+                            if (first_text) {
+                                cmark_node_type first_text_type = cmark_node_get_type(first_text);
+                                if (first_text_type == CMARK_NODE_TEXT) {
+                                    const char *first_char = cmark_node_get_literal(first_text);
+                                    if (first_char && strlen(first_char) > 0) {
+                                        size_t first_char_len = strlen(first_char);
+                                        /* Skip leading whitespace (up to 3 spaces) */
+                                        int check_spaces = 0;
+                                        while (check_spaces < 3 && check_spaces < (int)first_char_len && first_char[check_spaces] == ' ') {
+                                            check_spaces++;
+                                        }
+                                        if (check_spaces < (int)first_char_len &&
+                                            (first_char[check_spaces] == '[' || first_char[check_spaces] == ':')) {
+                                            might_be_caption = true;
                                         }
                                     }
                                 }
+                            }
 
-                                if (might_be_caption) {
-                                    char *caption = NULL;
-                                    const char *original_text = NULL;
-                                    /* We're already looking backwards from a table, so we know this paragraph
-                                     * is before the table. We can check if it's a caption format without
-                                     * needing to verify adjacency (which might fail if there are headers
-                                     * or other nodes between the caption and table). */
-                                    if (is_table_caption_format(prev, &caption, &original_text)) {
-                                        add_table_caption(cur, caption, original_text);
-                                        /* Free the allocated full_text that was stored in user_data */
-                                        char *stored_text = (char *)cmark_node_get_user_data(prev);
-                                        if (stored_text && stored_text == original_text) {
-                                            free(stored_text);
-                                        }
-                                        /* Mark caption paragraph for removal so it is not reused */
-                                        cmark_node_set_user_data(prev, strdup(" data-remove=\"true\""));
-                                        free(caption);
-                                        break; /* Found caption, stop looking */
-                                    }
+                            if (might_be_caption) {
+                                char *caption = NULL;
+                                char *original_text = NULL;
+                                /* We're already looking backwards from a table, so we know this paragraph
+                                 * is before the table. We can check if it's a caption format without
+                                 * needing to verify adjacency (which might fail if there are headers
+                                 * or other nodes between the caption and table). */
+                                if (is_table_caption_format(prev, &caption, &original_text)) {
+                                    add_table_caption(cur, caption, original_text);
+                                    remove_caption_paragraph(prev);
+                                    free(original_text);
+                                    free(caption);
+                                    break; /* Found caption, stop looking */
                                 }
                             }
                             /* Found non-blank paragraph that's not a caption - continue looking
@@ -1564,42 +802,27 @@ cmark_node *apex_process_advanced_tables(cmark_node *root) {
                 cmark_node *next = cmark_node_next(cur);
                 if (next) {
                     cmark_node_type next_type = cmark_node_get_type(next);
-                    char *next_data = (char *)cmark_node_get_user_data(next);
-                    /* Skip paragraphs that have already been used as captions */
-                    if (!next_data || !strstr(next_data, "data-remove")) {
-                        char *caption = NULL;
-                        const char *original_text = NULL;
-                        if (is_table_caption(next, &caption, &original_text)) {
-                            add_table_caption(cur, caption, original_text);
-                            /* Free the allocated full_text that was stored in user_data */
-                            char *stored_text = (char *)cmark_node_get_user_data(next);
-                            if (stored_text && stored_text == original_text) {
-                                free(stored_text);
-                            }
-                            /* Mark caption paragraph for removal so it is not reused */
-                            cmark_node_set_user_data(next, strdup(" data-remove=\"true\""));
-                            free(caption);
-                        } else {
-                            /* Also check if it's a : Caption format (which is_table_caption might not handle) */
-                            if (next_type == CMARK_NODE_PARAGRAPH) {
-                                if (is_table_caption_format(next, &caption, &original_text)) {
-                                    add_table_caption(cur, caption, original_text);
-                                    char *stored_text = (char *)cmark_node_get_user_data(next);
-                                    if (stored_text && stored_text == original_text) {
-                                        /* stored_text is the full_text allocated by is_table_caption_format */
-                                        free(stored_text);
-                                    }
-                                    /* Mark caption paragraph for removal so it is not reused */
-                                    cmark_node_set_user_data(next, strdup(" data-remove=\"true\""));
-                                    free(caption);
-                                }
+                    char *caption = NULL;
+                    char *original_text = NULL;
+                    if (is_table_caption(next, &caption, &original_text)) {
+                        add_table_caption(cur, caption, original_text);
+                        remove_caption_paragraph(next);
+                        free(original_text);
+                        free(caption);
+                    } else {
+                        /* Also check if it's a : Caption format (which is_table_caption might not handle) */
+                        if (next_type == CMARK_NODE_PARAGRAPH) {
+                            if (is_table_caption_format(next, &caption, &original_text)) {
+                                add_table_caption(cur, caption, original_text);
+                                remove_caption_paragraph(next);
+                                free(original_text);
+                                free(caption);
                             }
                         }
                     }
                 }
 
-                /* Check for caption rows BEFORE processing spans */
-                /* Caption rows should be detected and removed before colspan processing */
+                /* Check for a caption row ([Caption] as the last row) */
                 cmark_node *row_check = cmark_node_first_child(cur);
                 cmark_node *caption_row = NULL;
                 while (row_check) {
@@ -1631,9 +854,8 @@ cmark_node *apex_process_advanced_tables(cmark_node *root) {
                                                 add_table_caption(cur, caption, text);
                                                 free(caption);
                                                 /* Mark the entire row for removal */
-                                                char *existing = (char *)cmark_node_get_user_data(caption_row);
-                                                if (existing) free(existing);
-                                                cmark_node_set_user_data(caption_row, strdup(" data-remove=\"true\""));
+                                                apex_attributes *row_attrs = apex_node_ensure_attributes(caption_row);
+                                                if (row_attrs) row_attrs->remove = true;
                                                 break; /* Found caption, done */
                                             }
                                         }
@@ -1645,8 +867,9 @@ cmark_node *apex_process_advanced_tables(cmark_node *root) {
                     }
                 }
 
-                /* Process spans - this also detects tfoot rows */
-                process_table_spans(cur);
+                if (per_cell_alignment) {
+                    apply_cell_alignment(cur);
+                }
             }
         }
     }
@@ -1655,111 +878,14 @@ cmark_node *apex_process_advanced_tables(cmark_node *root) {
     return root;
 }
 
-/**
- * Custom HTML renderer for tables with spans and captions
- */
-__attribute__((unused))
-static void html_render_table(cmark_syntax_extension *ext,
-                              struct cmark_html_renderer *renderer,
-                              cmark_node *node,
-                              cmark_event_type ev_type,
-                              int options) {
-    (void)ext;
-    (void)options;
-    cmark_strbuf *html = renderer->html;
-    cmark_node_type type = cmark_node_get_type(node);
-
-    if (ev_type == CMARK_EVENT_ENTER && type == CMARK_NODE_TABLE) {
-        /* Check for caption */
-        char *user_data = (char *)cmark_node_get_user_data(node);
-        if (user_data && strstr(user_data, "data-caption=")) {
-            char caption[512];
-            if (sscanf(user_data, " data-caption=\"%[^\"]\"", caption) == 1) {
-                cmark_strbuf_puts(html, "<figure class=\"table-figure\">\n");
-                cmark_strbuf_puts(html, "<figcaption>");
-                cmark_strbuf_puts(html, caption);
-                cmark_strbuf_puts(html, "</figcaption>\n");
-            }
-        }
-        /* Let default renderer handle the table tag */
-        return;
-    } else if (ev_type == CMARK_EVENT_EXIT && type == CMARK_NODE_TABLE) {
-        char *user_data = (char *)cmark_node_get_user_data(node);
-        if (user_data && strstr(user_data, "data-caption=")) {
-            cmark_strbuf_puts(html, "</figure>\n");
-        }
-        return;
-    }
-
-    /* Handle ALL table cells to properly handle removal and spans */
-    if (type == CMARK_NODE_TABLE_CELL) {
-        char *attrs = (char *)cmark_node_get_user_data(node);
-
-        /* Skip cells marked for removal entirely (don't render enter or exit) */
-        if (attrs && strstr(attrs, "data-remove")) {
-            return; /* Don't render this cell at all */
-        }
-
-        /* If this cell has rowspan/colspan, we need custom rendering */
-        if (ev_type == CMARK_EVENT_ENTER && attrs &&
-            (strstr(attrs, "colspan=") || strstr(attrs, "rowspan="))) {
-            /* Determine if header or data cell by checking parent row */
-            bool is_header = false;
-            cmark_node *row = cmark_node_parent(node);
-            if (row) {
-                cmark_node *parent = cmark_node_parent(row);
-                if (parent && cmark_node_get_type(parent) == CMARK_NODE_TABLE) {
-                    /* First row is header in cmark-gfm tables */
-                    cmark_node *first_row = cmark_node_first_child(parent);
-                    is_header = (first_row == row);
-                }
-            }
-
-            /* Output opening tag */
-            if (is_header) {
-                cmark_strbuf_puts(html, "<th");
-            } else {
-                cmark_strbuf_puts(html, "<td");
-            }
-
-            /* Add rowspan/colspan attributes */
-            cmark_strbuf_puts(html, attrs);
-
-            cmark_strbuf_putc(html, '>');
-            return; /* We've handled the opening tag */
-        } else if (ev_type == CMARK_EVENT_EXIT && attrs &&
-                   (strstr(attrs, "colspan=") || strstr(attrs, "rowspan="))) {
-            /* Closing tag */
-            bool is_header = false;
-            cmark_node *row = cmark_node_parent(node);
-            if (row) {
-                cmark_node *parent = cmark_node_parent(row);
-                if (parent && cmark_node_get_type(parent) == CMARK_NODE_TABLE) {
-                    cmark_node *first_row = cmark_node_first_child(parent);
-                    is_header = (first_row == row);
-                }
-            }
-
-            if (is_header) {
-                cmark_strbuf_puts(html, "</th>\n");
-            } else {
-                cmark_strbuf_puts(html, "</td>\n");
-            }
-            return; /* We've handled the closing tag */
-        }
-        /* For normal cells without spans, let default renderer handle them */
-    }
-}
-
 /**
  * Postprocess function
  */
 static cmark_node *postprocess(cmark_syntax_extension *ext,
                                cmark_parser *parser,
                                cmark_node *root) {
-    (void)ext;
     (void)parser;
-    return apex_process_advanced_tables(root);
+    return apex_process_advanced_tables(root, cmark_syntax_extension_get_private(ext) != NULL);
 }
 
 /**
@@ -1769,16 +895,17 @@ cmark_syntax_extension *create_advanced_tables_extension(bool per_cell_alignment
     cmark_syntax_extension *ext = cmark_syntax_extension_new("advanced_tables");
     if (!ext) return NULL;
 
-    /* Store per_cell_alignment flag in static variable */
-    g_per_cell_alignment = per_cell_alignment;
+    /* Store per_cell_alignment flag on the extension itself */
+    if (per_cell_alignment) {
+        cmark_syntax_extension_set_private(ext, (void *)&per_cell_alignment_enabled, NULL);
+    }
 
-    /* Set postprocess callback to add span/caption attributes to AST */
+    /* Set postprocess callback to add caption/alignment attributes to AST */
     cmark_syntax_extension_set_postprocess_func(ext, postprocess);
 
     /* NOTE: We don't use html_render_func here because it conflicts with GFM table renderer.
-     * Instead, we do HTML postprocessing in apex.c after rendering.
-     * The post-processing should remove cells with data-remove and inject colspan/rowspan attributes. */
-    /* cmark_syntax_extension_set_html_render_func(ext, html_render_table); */
+     * Spans, footers and row headers are applied to the rendered HTML by
+     * apex_render_table_grids() (table_grid.c). */
 
     /* Register to handle table and table cell rendering */
     cmark_syntax_extension_set_can_contain_func(ext, NULL);
@@ -25,8 +25,9 @@ extern "C" {
 /**
  * Post-process tables to add advanced features
  * This walks the AST and enhances table nodes
+ * @param per_cell_alignment Honor per-cell alignment markers (colons)
  */
-cmark_node *apex_process_advanced_tables(cmark_node *root);
+cmark_node *apex_process_advanced_tables(cmark_node *root, bool per_cell_alignment);
 
 /**
  * Create advanced tables extension
@@ -17,6 +17,8 @@
  */
 
 #include "definition_list.h"
+#include "sub_parser.h"
+#include "reference_defs.h"
 #include "parser.h"
 #include <ctype.h>
 #include "node.h"
@@ -27,6 +29,7 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <pthread.h>
 
 /* Node type IDs */
 cmark_node_type APEX_NODE_DEFINITION_LIST;
@@ -174,161 +177,44 @@ static char **extract_reference_link_ids(const char *text, size_t *count) {
 }
 
 /**
- * Extract specific reference definitions from the full reference definitions string
- * based on a list of reference IDs
+ * Collect the definition lines for the reference IDs used in text, so a
+ * fragment rendered on its own can still resolve them
  * Returns a string containing only the needed definitions, or NULL if none found
  * Caller must free the returned string
  */
-static char *extract_specific_reference_definitions(const char *all_refs, char **needed_ids) {
-    if (!all_refs || !needed_ids || !needed_ids[0]) return NULL;
+static char *select_reference_definitions(const apex_reference_defs *refs, const char *text) {
+    if (!refs || !refs->count || !text) return NULL;
 
-    size_t result_capacity = 1024;
-    size_t result_len = 0;
-    char *result = malloc(result_capacity);
-    if (!result) return NULL;
-    result[0] = '\0';
-
-    const char *p = all_refs;
-    while (*p) {
-        const char *line_start = p;
-        const char *line_end = strchr(p, '\n');
-        if (!line_end) line_end = p + strlen(p);
-
-        /* Skip leading whitespace */
-        const char *content_start = line_start;
-        while (content_start < line_end && (*content_start == ' ' || *content_start == '\t')) {
-            content_start++;
-        }
-
-        /* Check if this is a reference link definition: [id]: URL */
-        if (content_start < line_end && *content_start == '[') {
-            const char *id_end = strchr(content_start + 1, ']');
-            if (id_end && id_end < line_end && id_end[1] == ':') {
-                /* Extract the ID from this definition */
-                size_t def_id_len = id_end - (content_start + 1);
-                char *def_id = malloc(def_id_len + 1);
-                if (def_id) {
-                    memcpy(def_id, content_start + 1, def_id_len);
-                    def_id[def_id_len] = '\0';
-
-                    /* Check if this ID is in our needed list */
-                    bool needed = false;
-                    for (size_t i = 0; needed_ids[i]; i++) {
-                        if (strcmp(needed_ids[i], def_id) == 0) {
-                            needed = true;
-                            break;
-                        }
-                    }
-
-                    if (needed) {
-                        /* Include this definition */
-                        size_t line_len = line_end - line_start;
-                        if (line_end < p + strlen(p) && *line_end == '\n') {
-                            line_len++; /* Include newline */
-                        }
-
-                        /* Expand buffer if needed */
-                        if (result_len + line_len + 1 >= result_capacity) {
-                            result_capacity = (result_len + line_len + 1) * 2;
-                            char *new_result = realloc(result, result_capacity);
-                            if (!new_result) {
-                                free(def_id);
-                                break;
-                            }
-                            result = new_result;
-                        }
+    size_t id_count = 0;
+    char **needed_ids = extract_reference_link_ids(text, &id_count);
+    if (!needed_ids) return NULL;
 
-                        /* Copy the line */
-                        memcpy(result + result_len, line_start, line_len);
-                        result_len += line_len;
-                        result[result_len] = '\0';
-                    }
-
-                    free(def_id);
-                }
-            }
+    /* Look each ID up once */
+    const apex_reference_def **defs = id_count ? malloc(id_count * sizeof(*defs)) : NULL;
+    size_t def_count = 0;
+    size_t result_len = 0;
+    for (size_t i = 0; i < id_count; i++) {
+        const apex_reference_def *def = apex_reference_defs_find(refs, needed_ids[i], strlen(needed_ids[i]));
+        free(needed_ids[i]);
+        if (def && defs) {
+            defs[def_count++] = def;
+            result_len += def->length + 1;
         }
-
-        /* Move to next line */
-        p = line_end;
-        if (*p == '\n') p++;
     }
 
-    if (result_len == 0) {
-        free(result);
-        return NULL;
-    }
-
-    return result;
-}
-
-/**
- * Extract all reference link definitions from the document
- * Returns a string containing all reference definitions, or NULL if none found
- * Caller must free the returned string
- */
-static char *extract_reference_definitions(const char *text) {
-    if (!text) return NULL;
-
-    size_t text_len = strlen(text);
-    size_t refs_capacity = text_len + 1;
-    char *refs = malloc(refs_capacity);
-    if (!refs) return NULL;
-    refs[0] = '\0';
-
-    const char *p = text;
-    size_t refs_len = 0;
-
-    while (*p) {
-        const char *line_start = p;
-        const char *line_end = strchr(p, '\n');
-        if (!line_end) line_end = p + strlen(p);
-
-        /* Skip leading whitespace */
-        const char *content_start = line_start;
-        while (content_start < line_end && (*content_start == ' ' || *content_start == '\t')) {
-            content_start++;
+    char *result = def_count ? malloc(result_len + 1) : NULL;
+    if (result) {
+        char *write = result;
+        for (size_t i = 0; i < def_count; i++) {
+            memcpy(write, defs[i]->line, defs[i]->length);
+            write += defs[i]->length;
+            if (write[-1] != '\n') *write++ = '\n';
         }
-
-        /* Check if this is a reference link definition: [id]: URL */
-        if (content_start < line_end && *content_start == '[') {
-            const char *id_end = strchr(content_start + 1, ']');
-            if (id_end && id_end < line_end && id_end[1] == ':') {
-                /* This is a reference definition - extract the entire line */
-                size_t line_len = line_end - line_start;
-                if (line_end < p + strlen(p) && *line_end == '\n') {
-                    line_len++; /* Include newline */
-                }
-
-                /* Check if we need to expand the buffer */
-                if (refs_len + line_len + 1 >= refs_capacity) {
-                    refs_capacity = (refs_len + line_len + 1) * 2;
-                    char *new_refs = realloc(refs, refs_capacity);
-                    if (!new_refs) {
-                        free(refs);
-                        return NULL;
-                    }
-                    refs = new_refs;
-                }
-
-                /* Copy the line */
-                memcpy(refs + refs_len, line_start, line_len);
-                refs_len += line_len;
-                refs[refs_len] = '\0';
-            }
-        }
-
-        /* Move to next line */
-        p = line_end;
-        if (*p == '\n') p++;
-    }
-
-    if (refs_len == 0) {
-        free(refs);
-        return NULL;
+        *write = '\0';
     }
-
-    return refs;
+    free(defs);
+    free(needed_ids);
+    return result;
 }
 
 /**
@@ -490,11 +376,46 @@ static int can_contain(cmark_syntax_extension *ext,
     return 0;
 }
 
+/**
+ * Render a term or definition body with the pass's shared sub-parser and
+ * strip the wrapping <p>...</p>. Returns a newly allocated string.
+ */
+static char *render_fragment(apex_sub_parser *sub_parser, int parser_opts, int render_opts,
+                             const char *text, size_t len) {
+    char *full_html = apex_sub_parser_render(sub_parser, parser_opts, render_opts, text, len);
+    if (!full_html) return NULL;
+
+    /* Strip <p> and </p> tags if present */
+    char *content_start = full_html;
+    if (strncmp(content_start, "<p>", 3) == 0) {
+        content_start += 3;
+    }
+    char *content_end = content_start + strlen(content_start);
+    if (content_end > content_start + 4 &&
+        strcmp(content_end - 5, "</p>\n") == 0) {
+        content_end -= 5;
+        *content_end = '\0';
+    }
+    char *result = strdup(content_start);
+    free(full_html);
+    return result;
+}
+
+static char *process_definition_lists(const char *text, bool unsafe, apex_sub_parser *sub_parser);
+
 /**
  * Process definition lists - convert : syntax to HTML
- * This is a preprocessing approach
+ * This is a preprocessing approach. One sub-parser is shared by every
+ * term and definition in the document.
  */
 char *apex_process_definition_lists(const char *text, bool unsafe) {
+    apex_sub_parser sub_parser = APEX_SUB_PARSER_INIT;
+    char *result = process_definition_lists(text, unsafe, &sub_parser);
+    apex_sub_parser_free(&sub_parser);
+    return result;
+}
+
+static char *process_definition_lists(const char *text, bool unsafe, apex_sub_parser *sub_parser) {
     if (!text) return NULL;
 
     size_t text_len = strlen(text);
@@ -551,8 +472,9 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
     char *output = malloc(output_capacity + 1);  /* +1 for null terminator */
     if (!output) return NULL;
 
-    /* Extract all reference link definitions from the document */
-    char *ref_definitions = extract_reference_definitions(text);
+    /* Index the reference link definitions, so fragments rendered on their own can resolve them */
+    apex_reference_defs refs = APEX_REFERENCE_DEFS_INIT;
+    apex_reference_defs_scan(&refs, text);
 
     const char *read = text;
     char *write = output;
@@ -572,7 +494,7 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
             char *new_output = realloc(output, output_capacity + 1); \
             if (!new_output) { \
                 free(output); \
-                free(ref_definitions); \
+                apex_reference_defs_free(&refs); \
                 return NULL; \
             } \
             output = new_output; \
@@ -601,7 +523,7 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
         if (++iteration_count > MAX_ITERATIONS) {
             /* Something is wrong - return original text to avoid hanging */
             free(output);
-            free(ref_definitions);
+            apex_reference_defs_free(&refs);
             return strdup(text);
         }
 
@@ -987,63 +909,28 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
                             /* Extract only the reference definitions actually used in this term */
                             size_t final_term_len = term_content_len;
                             char *final_term_text = term_text;
-                            if (ref_definitions) {
-                                size_t id_count = 0;
-                                char **needed_ids = extract_reference_link_ids(term_text, &id_count);
-                                if (needed_ids && id_count > 0) {
-                                    char *selected_refs = extract_specific_reference_definitions(ref_definitions, needed_ids);
-                                    if (selected_refs) {
-                                        size_t ref_len = strlen(selected_refs);
-                                        size_t new_size = ref_len + term_content_len + 2;  /* +2 for newline and null */
-                                        char *new_term_text = malloc(new_size);
-                                        if (new_term_text) {
-                                            size_t offset = 0;
-                                            memcpy(new_term_text, selected_refs, ref_len);
-                                            offset = ref_len;
-                                            if (ref_len > 0 && selected_refs[ref_len - 1] != '\n') {
-                                                new_term_text[offset++] = '\n';
-                                            }
-                                            memcpy(new_term_text + offset, term_text, term_content_len);
-                                            new_term_text[offset + term_content_len] = '\0';
-                                            free(term_text);
-                                            final_term_text = new_term_text;
-                                            final_term_len = offset + term_content_len;
-                                        }
-                                        free(selected_refs);
-                                    }
-                                    /* Free the IDs array */
-                                    for (size_t i = 0; i < id_count; i++) {
-                                        free(needed_ids[i]);
-                                    }
-                                    free(needed_ids);
-                                }
-                            }
-                            cmark_parser *temp_parser = cmark_parser_new(parser_opts);
-                            if (temp_parser) {
-                                cmark_parser_feed(temp_parser, final_term_text, final_term_len);
-                                cmark_node *doc = cmark_parser_finish(temp_parser);
-                                if (doc) {
-                                    /* Render and extract just the content (strip <p> tags) */
-                                    char *full_html = cmark_render_html(doc, render_opts, NULL);
-                                    if (full_html) {
-                                        /* Strip <p> and </p> tags if present */
-                                        char *content_start = full_html;
-                                        if (strncmp(content_start, "<p>", 3) == 0) {
-                                            content_start += 3;
-                                        }
-                                        char *content_end = content_start + strlen(content_start);
-                                        if (content_end > content_start + 4 &&
-                                            strcmp(content_end - 5, "</p>\n") == 0) {
-                                            content_end -= 5;
-                                            *content_end = '\0';
-                                        }
-                                        term_html = strdup(content_start);
-                                        free(full_html);
+                            char *selected_refs = select_reference_definitions(&refs, term_text);
+                            if (selected_refs) {
+                                size_t ref_len = strlen(selected_refs);
+                                size_t new_size = ref_len + term_content_len + 2;  /* +2 for newline and null */
+                                char *new_term_text = malloc(new_size);
+                                if (new_term_text) {
+                                    size_t offset = 0;
+                                    memcpy(new_term_text, selected_refs, ref_len);
+                                    offset = ref_len;
+                                    if (ref_len > 0 && selected_refs[ref_len - 1] != '\n') {
+                                        new_term_text[offset++] = '\n';
                                     }
-                                    cmark_node_free(doc);
+                                    memcpy(new_term_text + offset, term_text, term_content_len);
+                                    new_term_text[offset + term_content_len] = '\0';
+                                    free(term_text);
+                                    final_term_text = new_term_text;
+                                    final_term_len = offset + term_content_len;
                                 }
-                                cmark_parser_free(temp_parser);
+                                free(selected_refs);
                             }
+                            term_html = render_fragment(sub_parser, parser_opts, render_opts,
+                                                        final_term_text, final_term_len);
                             free(final_term_text);
                         }
                         }
@@ -1165,64 +1052,29 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
                     /* Extract only the reference definitions actually used in this definition */
                     size_t final_def_len = def_text_len;
                     char *final_def_text = def_text;
-                    if (ref_definitions) {
-                        size_t id_count = 0;
-                        char **needed_ids = extract_reference_link_ids(def_text, &id_count);
-                        if (needed_ids && id_count > 0) {
-                            char *selected_refs = extract_specific_reference_definitions(ref_definitions, needed_ids);
-                            if (selected_refs) {
-                                size_t ref_len = strlen(selected_refs);
-                                size_t new_size = ref_len + def_text_len + 2;  /* +2 for newline and null */
-                                char *new_def_text = malloc(new_size);
-                                if (new_def_text) {
-                                    size_t offset = 0;
-                                    memcpy(new_def_text, selected_refs, ref_len);
-                                    offset = ref_len;
-                                    if (ref_len > 0 && selected_refs[ref_len - 1] != '\n') {
-                                        new_def_text[offset++] = '\n';
-                                    }
-                                    memcpy(new_def_text + offset, def_text, def_text_len);
-                                    new_def_text[offset + def_text_len] = '\0';
-                                    free(def_text);
-                                    final_def_text = new_def_text;
-                                    final_def_len = offset + def_text_len;
-                                }
-                                free(selected_refs);
-                            }
-                            /* Free the IDs array */
-                            for (size_t i = 0; i < id_count; i++) {
-                                free(needed_ids[i]);
+                    char *selected_refs = select_reference_definitions(&refs, def_text);
+                    if (selected_refs) {
+                        size_t ref_len = strlen(selected_refs);
+                        size_t new_size = ref_len + def_text_len + 2;  /* +2 for newline and null */
+                        char *new_def_text = malloc(new_size);
+                        if (new_def_text) {
+                            size_t offset = 0;
+                            memcpy(new_def_text, selected_refs, ref_len);
+                            offset = ref_len;
+                            if (ref_len > 0 && selected_refs[ref_len - 1] != '\n') {
+                                new_def_text[offset++] = '\n';
                             }
-                            free(needed_ids);
+                            memcpy(new_def_text + offset, def_text, def_text_len);
+                            new_def_text[offset + def_text_len] = '\0';
+                            free(def_text);
+                            final_def_text = new_def_text;
+                            final_def_len = offset + def_text_len;
                         }
+                        free(selected_refs);
                     }
 
-                    cmark_parser *temp_parser = cmark_parser_new(parser_opts);
-                    if (temp_parser) {
-                        cmark_parser_feed(temp_parser, final_def_text, final_def_len);
-                        cmark_node *doc = cmark_parser_finish(temp_parser);
-                        if (doc) {
-                            /* Render and extract just the content (strip <p> tags) */
-                            char *full_html = cmark_render_html(doc, render_opts, NULL);
-                            if (full_html) {
-                                /* Strip <p> and </p> tags if present */
-                                char *content_start = full_html;
-                                if (strncmp(content_start, "<p>", 3) == 0) {
-                                    content_start += 3;
-                                }
-                                char *content_end = content_start + strlen(content_start);
-                                if (content_end > content_start + 4 &&
-                                    strcmp(content_end - 5, "</p>\n") == 0) {
-                                    content_end -= 5;
-                                    *content_end = '\0';
-                                }
-                                def_html = strdup(content_start);
-                                free(full_html);
-                            }
-                            cmark_node_free(doc);
-                        }
-                        cmark_parser_free(temp_parser);
-                    }
+                    def_html = render_fragment(sub_parser, parser_opts, render_opts,
+                                               final_def_text, final_def_len);
                     free(final_def_text);
                 }
                 }
@@ -1556,11 +1408,7 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
         }
     }
 
-    /* Free reference definitions if we extracted them */
-    if (ref_definitions) {
-        free(ref_definitions);
-        ref_definitions = NULL;  /* Prevent double-free */
-    }
+    apex_reference_defs_free(&refs);
 
     /* Ensure space for null terminator */
     if (remaining < 1) {
@@ -1582,9 +1430,6 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
         /* No definition lists were created - if we processed but didn't create any DLs,
          * something went wrong. Return NULL to use original text. */
         free(output);
-        if (ref_definitions) {
-            free(ref_definitions);
-        }
         return NULL;
     }
 
@@ -1595,9 +1440,6 @@ char *apex_process_definition_lists(const char *text, bool unsafe) {
     /* If we didn't write anything, return original text to avoid empty output */
     if (write == output) {
         free(output);
-        if (ref_definitions) {
-            free(ref_definitions);
-        }
         return NULL;  /* Return NULL to indicate no processing was done */
     }
 
@@ -1647,6 +1489,19 @@ static void html_render(cmark_syntax_extension *ext,
     }
 }
 
+/**
+ * Register node types once per process. The extension is created for every
+ * conversion, and re-registering would both grow cmark's node type space
+ * and change the type ids under conversions running on other threads.
+ */
+static pthread_once_t definition_list_nodes_once = PTHREAD_ONCE_INIT;
+
+static void register_definition_list_nodes(void) {
+    APEX_NODE_DEFINITION_LIST = cmark_syntax_extension_add_node(0);
+    APEX_NODE_DEFINITION_TERM = cmark_syntax_extension_add_node(0);
+    APEX_NODE_DEFINITION_DATA = cmark_syntax_extension_add_node(0);
+}
+
 /**
  * Create definition list extension
  */
@@ -1655,9 +1510,7 @@ cmark_syntax_extension *create_definition_list_extension(void) {
     if (!ext) return NULL;
 
     /* Register node types */
-    APEX_NODE_DEFINITION_LIST = cmark_syntax_extension_add_node(0);
-    APEX_NODE_DEFINITION_TERM = cmark_syntax_extension_add_node(0);
-    APEX_NODE_DEFINITION_DATA = cmark_syntax_extension_add_node(0);
+    pthread_once(&definition_list_nodes_once, register_definition_list_nodes);
 
     /* Set callbacks */
     cmark_syntax_extension_set_open_block_func(ext, open_block);
@@ -6,8 +6,10 @@
 #include "header_ids.h"
 #include "cmark-gfm.h"
 #include "emoji.h"
+#include "ial.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <ctype.h>
 
 /**
@@ -564,7 +566,7 @@ bool apex_extract_manual_header_id(char **heading_text, char **manual_id_out) {
 
 /**
  * Process manual header IDs in a heading node
- * Extracts MMD [id] or Kramdown {#id} syntax and stores ID in user_data
+ * Extracts MMD [id] or Kramdown {#id} syntax and stores the ID in the heading's attributes
  * Updates the heading text node to remove the manual ID syntax
  */
 bool apex_process_manual_header_id(cmark_node *heading_node) {
@@ -589,27 +591,8 @@ bool apex_process_manual_header_id(cmark_node *heading_node) {
     bool found = apex_extract_manual_header_id(&text_copy, &manual_id);
 
     if (found && manual_id) {
-        /* Store ID in user_data as id="..." */
-        char *id_attr = malloc(strlen(manual_id) + 6);  /* id="" + null */
-        if (id_attr) {
-            sprintf(id_attr, "id=\"%s\"", manual_id);
-
-            /* Merge with existing user_data if present */
-            char *existing = (char *)cmark_node_get_user_data(heading_node);
-            if (existing) {
-                /* Append to existing */
-                char *combined = malloc(strlen(existing) + strlen(id_attr) + 2);  /* + space + null */
-                if (combined) {
-                    sprintf(combined, "%s %s", existing, id_attr);
-                    cmark_node_set_user_data(heading_node, combined);
-                    free(id_attr);
-                } else {
-                    cmark_node_set_user_data(heading_node, id_attr);
-                }
-            } else {
-                cmark_node_set_user_data(heading_node, id_attr);
-            }
-        }
+        /* Store the ID in the heading's attributes */
+        apex_attributes_set_id(apex_node_ensure_attributes(heading_node), manual_id);
 
         /* Update the text node to remove manual ID syntax */
         cmark_node_set_literal(text_node, text_copy);
@@ -624,3 +607,266 @@ bool apex_process_manual_header_id(cmark_node *heading_node) {
     return false;
 }
 
+
+/**
+ * IDs already taken in a document: an open-addressed hash set. Each entry
+ * remembers the next suffix to try, so many headings with the same text
+ * do not probe -1, -2, ... from the start every time. When a stream
+ * carries the set from segment to segment, each change can also be logged
+ * for apex_incremental to replay.
+ */
+typedef struct {
+    char *id;
+    unsigned next_suffix;
+} heading_id_slot;
+
+struct apex_heading_ids {
+    heading_id_slot *slots;
+    size_t capacity;        /* Power of two, or 0 before the first ID */
+    size_t count;
+    bool log_changes;
+    apex_heading_id_change *log;
+    size_t log_count;
+    size_t log_capacity;
+};
+
+static size_t heading_id_hash(const char *id) {
+    /* FNV-1a */
+    size_t hash = (size_t)2166136261u;
+    for (const unsigned char *c = (const unsigned char *)id; *c; c++) {
+        hash = (hash ^ *c) * (size_t)16777619u;
+    }
+    return hash;
+}
+
+/* Slot holding id, or the empty slot where it would go (capacity must be > 0) */
+static heading_id_slot *heading_ids_find(const apex_heading_ids *ids, const char *id) {
+    size_t mask = ids->capacity - 1;
+    for (size_t i = heading_id_hash(id) & mask;; i = (i + 1) & mask) {
+        if (!ids->slots[i].id || strcmp(ids->slots[i].id, id) == 0) return &ids->slots[i];
+    }
+}
+
+static bool heading_ids_reserve(apex_heading_ids *ids, size_t expected) {
+    if (expected * 2 <= ids->capacity) return true;
+    size_t capacity = ids->capacity ? ids->capacity : 16;
+    while (capacity < expected * 2) capacity *= 2;
+    heading_id_slot *slots = calloc(capacity, sizeof(heading_id_slot));
+    if (!slots) return false;
+
+    heading_id_slot *old_slots = ids->slots;
+    size_t old_capacity = ids->capacity;
+    ids->slots = slots;
+    ids->capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].id) *heading_ids_find(ids, old_slots[i].id) = old_slots[i];
+    }
+    free(old_slots);
+    return true;
+}
+
+static void heading_ids_log(apex_heading_ids *ids, const heading_id_slot *slot) {
+    if (!ids->log_changes) return;
+    if (ids->log_count == ids->log_capacity) {
+        size_t capacity = ids->log_capacity ? ids->log_capacity * 2 : 16;
+        apex_heading_id_change *grown = realloc(ids->log, capacity * sizeof(apex_heading_id_change));
+        if (!grown) return;
+        ids->log = grown;
+        ids->log_capacity = capacity;
+    }
+    char *copy = strdup(slot->id);
+    if (!copy) return;
+    ids->log[ids->log_count++] = (apex_heading_id_change){ copy, slot->next_suffix };
+}
+
+/* Take id; false if it was already taken (or memory ran out) */
+static bool heading_ids_add(apex_heading_ids *ids, const char *id) {
+    if (!heading_ids_reserve(ids, ids->count + 1)) return false;
+    heading_id_slot *slot = heading_ids_find(ids, id);
+    if (slot->id) return false;
+    slot->id = strdup(id);
+    if (!slot->id) return false;
+    slot->next_suffix = 1;
+    ids->count++;
+    heading_ids_log(ids, slot);
+    return true;
+}
+
+apex_heading_ids *apex_heading_ids_new(bool log_changes) {
+    apex_heading_ids *ids = calloc(1, sizeof(apex_heading_ids));
+    if (ids) ids->log_changes = log_changes;
+    return ids;
+}
+
+void apex_heading_ids_free(apex_heading_ids *ids) {
+    if (!ids) return;
+    for (size_t i = 0; i < ids->capacity; i++) free(ids->slots[i].id);
+    free(ids->slots);
+    apex_heading_id_changes_free(ids->log, ids->log_count);
+    free(ids);
+}
+
+apex_heading_id_change *apex_heading_ids_take_log(apex_heading_ids *ids, size_t *count) {
+    *count = ids ? ids->log_count : 0;
+    if (!ids) return NULL;
+    apex_heading_id_change *log = ids->log;
+    ids->log = NULL;
+    ids->log_count = 0;
+    ids->log_capacity = 0;
+    return log;
+}
+
+bool apex_heading_ids_replay(apex_heading_ids *ids, const apex_heading_id_change *changes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!heading_ids_reserve(ids, ids->count + 1)) return false;
+        heading_id_slot *slot = heading_ids_find(ids, changes[i].id);
+        if (!slot->id) {
+            slot->id = strdup(changes[i].id);
+            if (!slot->id) return false;
+            ids->count++;
+        }
+        slot->next_suffix = changes[i].next_suffix;
+    }
+    return true;
+}
+
+void apex_heading_id_changes_free(apex_heading_id_change *changes, size_t count) {
+    if (!changes) return;
+    for (size_t i = 0; i < count; i++) free(changes[i].id);
+    free(changes);
+}
+
+/* ID given by a manual ID or an IAL, if any */
+static char *heading_attribute_id(cmark_node *node) {
+    const apex_attributes *attrs = apex_node_attributes(node);
+    return attrs && attrs->id && *attrs->id ? strdup(attrs->id) : NULL;
+}
+
+static bool literal_has_heading_tag(const char *literal) {
+    for (const char *p = literal ? strchr(literal, '<') : NULL; p; p = strchr(p + 1, '<')) {
+        if ((p[1] == 'h' || p[1] == 'H') && p[2] >= '1' && p[2] <= '6') return true;
+    }
+    return false;
+}
+
+/* Heading tags in literal exactly as the HTML passes recognise them */
+static size_t literal_heading_tags(const char *literal) {
+    size_t count = 0;
+    for (const char *p = literal ? strchr(literal, '<') : NULL; p; p = strchr(p + 1, '<')) {
+        if (p[1] == 'h' && p[2] >= '1' && p[2] <= '6' &&
+            (p[3] == '>' || isspace((unsigned char)p[3]))) {
+            count++;
+        }
+    }
+    return count;
+}
+
+apex_heading_table *apex_heading_table_build(cmark_node *document, apex_id_format_t format, bool raw_html,
+                                             apex_heading_ids *taken) {
+    if (!document) return NULL;
+    apex_heading_table *table = calloc(1, sizeof(apex_heading_table));
+    if (!table) return NULL;
+
+    size_t capacity = 0;
+    size_t html_tags = 0;
+    table->html_tags_known = true;
+    cmark_iter *iter = cmark_iter_new(document);
+    cmark_event_type event;
+    while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+        if (event != CMARK_EVENT_ENTER) continue;
+        cmark_node *node = cmark_iter_get_node(iter);
+        cmark_node_type type = cmark_node_get_type(node);
+
+        if (type == CMARK_NODE_HTML_BLOCK || type == CMARK_NODE_HTML_INLINE) {
+            /* Omitted raw HTML renders as a comment, with no tags of its own */
+            if (!raw_html) continue;
+            const char *literal = cmark_node_get_literal(node);
+            if (!table->raw_html_headings && literal_has_heading_tag(literal)) {
+                table->raw_html_headings = true;
+            }
+            html_tags += literal_heading_tags(literal);
+            continue;
+        }
+        if (type == CMARK_NODE_CUSTOM_BLOCK || type == CMARK_NODE_CUSTOM_INLINE) {
+            /* Their markup is not worth inspecting; assume the worst */
+            table->raw_html_headings = true;
+            table->html_tags_known = false;
+            continue;
+        }
+        if (type != CMARK_NODE_HEADING) continue;
+
+        if (table->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            apex_heading *grown = realloc(table->headings, capacity * sizeof(apex_heading));
+            if (!grown) break;
+            table->headings = grown;
+        }
+
+        /* Headings marked with the Kramdown-style ".no_toc" class stay out
+         * of the TOC */
+        apex_heading *heading = &table->headings[table->count++];
+        heading->node = node;
+        heading->level = cmark_node_get_heading_level(node);
+        heading->line = cmark_node_get_start_line(node);
+        heading->text = apex_extract_heading_text(node);
+        heading->id = heading_attribute_id(node);
+        heading->manual_id = heading->id != NULL;
+        heading->in_toc = !apex_attributes_has_class(apex_node_attributes(node), "no_toc");
+        heading->html_tag = html_tags++;
+    }
+    cmark_iter_free(iter);
+
+    /* Manual IDs are taken first, so a generated ID never claims one that
+     * appears later in the document (or segment) */
+    apex_heading_ids *ids = taken ? taken : apex_heading_ids_new(false);
+    if (!ids || !heading_ids_reserve(ids, ids->count + table->count)) {
+        if (ids != taken) apex_heading_ids_free(ids);
+        apex_heading_table_free(table);
+        return NULL;
+    }
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->headings[i].manual_id) heading_ids_add(ids, table->headings[i].id);
+    }
+
+    for (size_t i = 0; i < table->count; i++) {
+        apex_heading *heading = &table->headings[i];
+        if (heading->manual_id) continue;
+
+        heading->id = apex_generate_header_id(heading->text, format);
+        if (!heading->id) continue;
+        heading_id_slot *base = heading_ids_find(ids, heading->id);
+        if (!base->id) {
+            heading_ids_add(ids, heading->id);
+            continue;
+        }
+
+        size_t len = strlen(heading->id) + 16;
+        char *unique = malloc(len);
+        if (!unique) continue;
+        do {
+            snprintf(unique, len, "%s-%u", heading->id, base->next_suffix++);
+        } while (heading_ids_find(ids, unique)->id);
+        heading_ids_log(ids, base);
+        free(heading->id);
+        heading->id = unique;
+        heading_ids_add(ids, unique);
+    }
+    if (ids != taken) apex_heading_ids_free(ids);
+
+    return table;
+}
+
+void apex_heading_table_free(apex_heading_table *table) {
+    if (!table) return;
+    for (size_t i = 0; i < table->count; i++) {
+        free(table->headings[i].text);
+        free(table->headings[i].id);
+    }
+    free(table->headings);
+    free(table);
+}
+
+bool apex_heading_table_is_raw_tag(const apex_heading_table *table, size_t tag, size_t next) {
+    if (!table || !table->raw_html_headings || !table->html_tags_known) return false;
+    return next >= table->count || table->headings[next].html_tag != tag;
+}
@@ -48,7 +48,7 @@ bool apex_extract_manual_header_id(char **heading_text, char **manual_id_out);
 
 /**
  * Process manual header IDs in a heading node
- * Extracts MMD [id] or Kramdown {#id} syntax and stores ID in user_data
+ * Extracts MMD [id] or Kramdown {#id} syntax and stores the ID in the heading's attributes
  * Updates the heading text node to remove the manual ID syntax
  *
  * @param heading_node The heading AST node
@@ -56,5 +56,97 @@ bool apex_extract_manual_header_id(char **heading_text, char **manual_id_out);
  */
 bool apex_process_manual_header_id(cmark_node *heading_node);
 
+/**
+ * One heading of a document, as the heading passes (IDs, TOC, widont,
+ * header level shifts) see it
+ */
+typedef struct {
+    cmark_node *node;
+    int level;          /* As parsed, before any Base Header Level shift */
+    int line;           /* Source line of the heading */
+    char *text;         /* Text and code spans, as used for IDs and the TOC */
+    char *id;           /* Manual or IAL ID, else generated; unique in the document */
+    bool manual_id;
+    bool in_toc;        /* Not marked no_toc */
+    size_t html_tag;    /* Position among all <h1>..<h6> tags of the rendered HTML */
+} apex_heading;
+
+typedef struct {
+    apex_heading *headings;     /* Document order */
+    size_t count;
+    bool raw_html_headings;     /* Raw HTML may hold <h1>..<h6> tags of its own */
+    bool html_tags_known;       /* html_tag is exact (no custom nodes with unknown markup) */
+} apex_heading_table;
+
+/**
+ * Heading IDs taken so far in a document converted in segments (a stream
+ * or apex_incremental), with the next -N suffix to try for each
+ */
+typedef struct apex_heading_ids apex_heading_ids;
+
+/**
+ * One change to an apex_heading_ids: id was taken, or its next suffix moved
+ */
+typedef struct {
+    char *id;
+    unsigned next_suffix;
+} apex_heading_id_change;
+
+/**
+ * Create an empty set. With log_changes, every change is also recorded
+ * until taken with apex_heading_ids_take_log.
+ */
+apex_heading_ids *apex_heading_ids_new(bool log_changes);
+
+/**
+ * Free a set and any log it holds
+ */
+void apex_heading_ids_free(apex_heading_ids *ids);
+
+/**
+ * Detach the changes logged since the last call, oldest first
+ * (free with apex_heading_id_changes_free)
+ */
+apex_heading_id_change *apex_heading_ids_take_log(apex_heading_ids *ids, size_t *count);
+
+/**
+ * Apply logged changes again, as if the segment that made them had been
+ * converted (nothing is logged)
+ * @return false if memory ran out
+ */
+bool apex_heading_ids_replay(apex_heading_ids *ids, const apex_heading_id_change *changes, size_t count);
+
+/**
+ * Free a change log
+ */
+void apex_heading_id_changes_free(apex_heading_id_change *changes, size_t count);
+
+/**
+ * Collect a document's headings in one walk of the tree. Generated IDs
+ * that repeat an earlier ID (or any manual ID) get -1, -2, ... appended.
+ * @param document The AST document (manual header IDs already processed)
+ * @param format ID format for generated IDs
+ * @param raw_html Raw HTML was rendered (so heading tags in it are in the HTML)
+ * @param taken IDs taken by earlier segments, updated with this document's;
+ *              NULL for a whole document
+ * @return Newly allocated table (free with apex_heading_table_free), or NULL
+ */
+apex_heading_table *apex_heading_table_build(cmark_node *document, apex_id_format_t format, bool raw_html,
+                                             apex_heading_ids *taken);
+
+/**
+ * Free a heading table
+ */
+void apex_heading_table_free(apex_heading_table *table);
+
+/**
+ * Whether a heading tag in the rendered HTML comes from raw HTML rather
+ * than from the table, so passes that match tags to the table in order
+ * can step over it
+ * @param tag Position of the tag among all <h1>..<h6> tags seen so far
+ * @param next Table index of the next heading not yet matched
+ */
+bool apex_heading_table_is_raw_tag(const apex_heading_table *table, size_t tag, size_t next);
+
 #endif
 
@@ -4,6 +4,7 @@
  */
 
 #include "html_markdown.h"
+#include "sub_parser.h"
 #include "cmark-gfm.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -137,10 +138,21 @@ static const char *find_closing_tag(const char *text, const char *tag_name) {
     return NULL;
 }
 
+static char *process_html_markdown(const char *text, apex_sub_parser *sub_parser);
+
 /**
  * Process HTML tags with markdown attributes
+ * Every markdown block, including nested ones, is parsed with one
+ * shared sub-parser.
  */
 char *apex_process_html_markdown(const char *text) {
+    apex_sub_parser sub_parser = APEX_SUB_PARSER_INIT;
+    char *result = process_html_markdown(text, &sub_parser);
+    apex_sub_parser_free(&sub_parser);
+    return result;
+}
+
+static char *process_html_markdown(const char *text, apex_sub_parser *sub_parser) {
     if (!text) return NULL;
 
     size_t text_len = strlen(text);
@@ -231,128 +243,117 @@ char *apex_process_html_markdown(const char *text) {
 
                 /* Recursively process nested divs with markdown="1" BEFORE parsing */
                 /* This ensures nested divs are processed before cmark-gfm sees them */
-                char *processed_content = apex_process_html_markdown(content);
+                char *processed_content = process_html_markdown(content, sub_parser);
                 if (processed_content) {
                     free(content);
                     content = processed_content;
                     content_len = strlen(content);
                 }
 
-                /* Create parser and parse */
+                /* Parse and render with the shared sub-parser */
                 /* Use CMARK_OPT_UNSAFE to allow raw HTML (including nested divs) */
                 int options = CMARK_OPT_DEFAULT | CMARK_OPT_UNSAFE;
-                cmark_parser *parser = cmark_parser_new(options);
-                if (parser) {
-                    cmark_parser_feed(parser, content, content_len);
-                    cmark_node *doc = cmark_parser_finish(parser);
-
-                    if (doc) {
-                        /* Render to HTML */
-                        char *html = cmark_render_html(doc, options, NULL);
-                        if (html) {
-                            /* Write opening tag (without markdown attribute) */
-                            char opening_tag[2048];
-                            size_t tag_written = 0;
-
-                            /* Reconstruct tag without markdown attribute */
-                            snprintf(opening_tag, sizeof(opening_tag), "<%s", tag_name);
-                            tag_written = strlen(opening_tag);
-
-                            /* Copy attributes except markdown */
-                            const char *attrs_start = strchr(tag_start + 1, ' ');
-                            if (attrs_start && attrs_start < content_start) {
-                                const char *attrs_end = strchr(attrs_start, '>');
-                                if (attrs_end) {
-                                    /* Parse and copy attributes, filtering out markdown attribute */
-                                    const char *attr_pos = attrs_start;
-                                    while (attr_pos < attrs_end) {
-                                        /* Skip whitespace */
-                                        while (attr_pos < attrs_end && isspace((unsigned char)*attr_pos)) {
+                char *html = apex_sub_parser_render(sub_parser, options, options, content, content_len);
+                if (html) {
+                    /* Write opening tag (without markdown attribute) */
+                    char opening_tag[2048];
+                    size_t tag_written = 0;
+
+                    /* Reconstruct tag without markdown attribute */
+                    snprintf(opening_tag, sizeof(opening_tag), "<%s", tag_name);
+                    tag_written = strlen(opening_tag);
+
+                    /* Copy attributes except markdown */
+                    const char *attrs_start = strchr(tag_start + 1, ' ');
+                    if (attrs_start && attrs_start < content_start) {
+                        const char *attrs_end = strchr(attrs_start, '>');
+                        if (attrs_end) {
+                            /* Parse and copy attributes, filtering out markdown attribute */
+                            const char *attr_pos = attrs_start;
+                            while (attr_pos < attrs_end) {
+                                /* Skip whitespace */
+                                while (attr_pos < attrs_end && isspace((unsigned char)*attr_pos)) {
+                                    attr_pos++;
+                                }
+                                if (attr_pos >= attrs_end) break;
+
+                                /* Check if this is the markdown attribute */
+                                if (strncmp(attr_pos, "markdown=", 9) == 0) {
+                                    /* Skip markdown attribute */
+                                    attr_pos += 9;
+                                    /* Skip attribute value */
+                                    if (*attr_pos == '"' || *attr_pos == '\'') {
+                                        char quote = *attr_pos++;
+                                        while (attr_pos < attrs_end && *attr_pos != quote) {
+                                            if (*attr_pos == '\\' && attr_pos + 1 < attrs_end) attr_pos++;
                                             attr_pos++;
                                         }
-                                        if (attr_pos >= attrs_end) break;
-
-                                        /* Check if this is the markdown attribute */
-                                        if (strncmp(attr_pos, "markdown=", 9) == 0) {
-                                            /* Skip markdown attribute */
-                                            attr_pos += 9;
-                                            /* Skip attribute value */
-                                            if (*attr_pos == '"' || *attr_pos == '\'') {
-                                                char quote = *attr_pos++;
-                                                while (attr_pos < attrs_end && *attr_pos != quote) {
-                                                    if (*attr_pos == '\\' && attr_pos + 1 < attrs_end) attr_pos++;
-                                                    attr_pos++;
-                                                }
-                                                if (*attr_pos == quote) attr_pos++;
-                                            } else {
-                                                while (attr_pos < attrs_end && !isspace((unsigned char)*attr_pos) && *attr_pos != '>') {
-                                                    attr_pos++;
-                                                }
-                                            }
-                                            continue;
-                                        }
-
-                                        /* Copy this attribute */
-                                        const char *attr_start = attr_pos;
-                                        while (attr_pos < attrs_end && *attr_pos != '>') {
-                                            /* Check if we've reached the start of the next attribute */
-                                            if (attr_pos > attr_start && (isspace((unsigned char)*attr_pos) || *attr_pos == '>')) {
-                                                /* Check if next token is markdown= */
-                                                const char *next = attr_pos;
-                                                while (next < attrs_end && isspace((unsigned char)*next)) next++;
-                                                if (strncmp(next, "markdown=", 9) == 0) {
-                                                    break; /* Stop before markdown attribute */
-                                                }
-                                            }
+                                        if (*attr_pos == quote) attr_pos++;
+                                    } else {
+                                        while (attr_pos < attrs_end && !isspace((unsigned char)*attr_pos) && *attr_pos != '>') {
                                             attr_pos++;
                                         }
+                                    }
+                                    continue;
+                                }
 
-                                        /* Copy attribute to opening_tag */
-                                        size_t attr_len = attr_pos - attr_start;
-                                        if (tag_written + attr_len + 1 < sizeof(opening_tag)) {
-                                            opening_tag[tag_written++] = ' ';
-                                            memcpy(opening_tag + tag_written, attr_start, attr_len);
-                                            tag_written += attr_len;
+                                /* Copy this attribute */
+                                const char *attr_start = attr_pos;
+                                while (attr_pos < attrs_end && *attr_pos != '>') {
+                                    /* Check if we've reached the start of the next attribute */
+                                    if (attr_pos > attr_start && (isspace((unsigned char)*attr_pos) || *attr_pos == '>')) {
+                                        /* Check if next token is markdown= */
+                                        const char *next = attr_pos;
+                                        while (next < attrs_end && isspace((unsigned char)*next)) next++;
+                                        if (strncmp(next, "markdown=", 9) == 0) {
+                                            break; /* Stop before markdown attribute */
                                         }
                                     }
-                                    opening_tag[tag_written++] = '>';
-                                    opening_tag[tag_written] = '\0';
+                                    attr_pos++;
                                 }
-                            } else {
-                                opening_tag[tag_written++] = '>';
-                                opening_tag[tag_written] = '\0';
-                            }
 
-                            if (tag_written < remaining) {
-                                memcpy(write_pos, opening_tag, tag_written);
-                                write_pos += tag_written;
-                                remaining -= tag_written;
+                                /* Copy attribute to opening_tag */
+                                size_t attr_len = attr_pos - attr_start;
+                                if (tag_written + attr_len + 1 < sizeof(opening_tag)) {
+                                    opening_tag[tag_written++] = ' ';
+                                    memcpy(opening_tag + tag_written, attr_start, attr_len);
+                                    tag_written += attr_len;
+                                }
                             }
+                            opening_tag[tag_written++] = '>';
+                            opening_tag[tag_written] = '\0';
+                        }
+                    } else {
+                        opening_tag[tag_written++] = '>';
+                        opening_tag[tag_written] = '\0';
+                    }
 
-                            /* Write parsed HTML (trim outer <p> tags if inline) */
-                            char *html_content = html;
-                            size_t html_len = strlen(html);
-
-                            if (parse_inline && html_len > 7 &&
-                                strncmp(html, "<p>", 3) == 0 &&
-                                strcmp(html + html_len - 5, "</p>\n") == 0) {
-                                /* Strip <p> tags for inline */
-                                html_content = html + 3;
-                                html_len -= 8;
-                                html_content[html_len] = '\0';
-                            }
+                    if (tag_written < remaining) {
+                        memcpy(write_pos, opening_tag, tag_written);
+                        write_pos += tag_written;
+                        remaining -= tag_written;
+                    }
 
-                            if (html_len < remaining) {
-                                memcpy(write_pos, html_content, html_len);
-                                write_pos += html_len;
-                                remaining -= html_len;
-                            }
+                    /* Write parsed HTML (trim outer <p> tags if inline) */
+                    char *html_content = html;
+                    size_t html_len = strlen(html);
+
+                    if (parse_inline && html_len > 7 &&
+                        strncmp(html, "<p>", 3) == 0 &&
+                        strcmp(html + html_len - 5, "</p>\n") == 0) {
+                        /* Strip <p> tags for inline */
+                        html_content = html + 3;
+                        html_len -= 8;
+                        html_content[html_len] = '\0';
+                    }
 
-                            free(html);
-                        }
-                        cmark_node_free(doc);
+                    if (html_len < remaining) {
+                        memcpy(write_pos, html_content, html_len);
+                        write_pos += html_len;
+                        remaining -= html_len;
                     }
-                    cmark_parser_free(parser);
+
+                    free(html);
                 }
                 free(content);
             }
@@ -3,18 +3,59 @@
  */
 
 #include "ial.h"
+#include "reference_defs.h"
 #include "table.h"  /* For CMARK_NODE_TABLE */
 #include "apex/apex.h"  /* For apex_mode_t */
+#include "../arena.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
 
+/* Keys Apex reads itself, compared by pointer once interned */
+static const char key_height[] = "height";
+static const char key_style[] = "style";
+static const char key_width[] = "width";
+
+/* Well-known attribute names (sorted). Keys found here share one copy
+ * instead of being duplicated for every element. */
+static const char *const interned_keys[] = {
+    "align", "alt", "colspan", "dir", key_height, "href", "lang", "loading",
+    "rel", "role", "rowspan", "src", key_style, "target", "title", key_width
+};
+
+static int compare_key(const void *key, const void *entry) {
+    return strcmp((const char *)key, *(const char *const *)entry);
+}
+
+static const char *intern_key(const char *key) {
+    const char *const *found = bsearch(key, interned_keys, sizeof(interned_keys) / sizeof(interned_keys[0]),
+                                       sizeof(interned_keys[0]), compare_key);
+    return found ? *found : NULL;
+}
+
+/* Allocations follow the attributes: from their arena, or malloc */
+static void *attrs_alloc(apex_attributes *attrs, size_t size) {
+    return attrs->arena ? apex_arena_alloc(attrs->arena, size) : malloc(size);
+}
+
+static void *attrs_realloc(apex_attributes *attrs, void *ptr, size_t size) {
+    return attrs->arena ? apex_arena_realloc(attrs->arena, ptr, size) : realloc(ptr, size);
+}
+
+static char *attrs_strdup(apex_attributes *attrs, const char *str) {
+    return attrs->arena ? apex_arena_strdup(attrs->arena, str) : strdup(str);
+}
+
+static void attrs_free(apex_attributes *attrs, void *ptr) {
+    if (!attrs->arena) free(ptr);
+}
+
 /**
  * Free attributes structure
  */
 void apex_free_attributes(apex_attributes *attrs) {
-    if (!attrs) return;
+    if (!attrs || attrs->arena) return;
 
     free(attrs->id);
 
@@ -24,11 +65,13 @@ void apex_free_attributes(apex_attributes *attrs) {
     free(attrs->classes);
 
     for (int i = 0; i < attrs->attr_count; i++) {
-        free(attrs->keys[i]);
+        if (intern_key(attrs->keys[i]) != attrs->keys[i]) free((char *)attrs->keys[i]);
         free(attrs->values[i]);
     }
     free(attrs->keys);
     free(attrs->values);
+    free(attrs->key_slots);
+    free(attrs->caption);
 
     free(attrs);
 }
@@ -46,47 +89,199 @@ void apex_free_alds(ald_entry *alds) {
     }
 }
 
+apex_attributes *apex_attributes_new(apex_arena *arena) {
+    apex_attributes *attrs = arena ? apex_arena_calloc(arena, 1, sizeof(apex_attributes))
+                                   : calloc(1, sizeof(apex_attributes));
+    if (attrs) attrs->arena = arena;
+    return attrs;
+}
+
 /**
  * Create empty attributes structure
  */
 static apex_attributes *create_attributes(void) {
-    apex_attributes *attrs = calloc(1, sizeof(apex_attributes));
-    return attrs;
+    return apex_attributes_new(NULL);
+}
+
+static size_t key_hash(const char *key) {
+    /* FNV-1a */
+    size_t hash = (size_t)2166136261u;
+    for (const unsigned char *c = (const unsigned char *)key; *c; c++) {
+        hash = (hash ^ *c) * (size_t)16777619u;
+    }
+    return hash;
+}
+
+/* Slot holding key, or the empty slot where it would go */
+static int *key_slot(const apex_attributes *attrs, const char *key) {
+    size_t mask = (size_t)attrs->slot_capacity - 1;
+    for (size_t i = key_hash(key) & mask;; i = (i + 1) & mask) {
+        int *slot = &attrs->key_slots[i];
+        if (!*slot) return slot;
+        const char *existing = attrs->keys[*slot - 1];
+        if (existing == key || strcmp(existing, key) == 0) return slot;
+    }
+}
+
+/* Double the key index (kept at most half full) and rehash */
+static bool grow_key_index(apex_attributes *attrs) {
+    int capacity = attrs->slot_capacity ? attrs->slot_capacity * 2 : 8;
+    int *slots = attrs_alloc(attrs, (size_t)capacity * sizeof(int));
+    if (!slots) return false;
+    memset(slots, 0, (size_t)capacity * sizeof(int));
+    attrs_free(attrs, attrs->key_slots);
+    attrs->key_slots = slots;
+    attrs->slot_capacity = capacity;
+    for (int i = 0; i < attrs->attr_count; i++) {
+        *key_slot(attrs, attrs->keys[i]) = i + 1;
+    }
+    return true;
+}
+
+void apex_attributes_set_id(apex_attributes *attrs, const char *id) {
+    if (!attrs || !id) return;
+    char *copy = attrs_strdup(attrs, id);
+    if (!copy) return;
+    attrs_free(attrs, attrs->id);
+    attrs->id = copy;
+}
+
+void apex_attributes_set_caption(apex_attributes *attrs, const char *caption) {
+    if (!attrs || !caption) return;
+    char *copy = attrs_strdup(attrs, caption);
+    if (!copy) return;
+    attrs_free(attrs, attrs->caption);
+    attrs->caption = copy;
 }
 
 /**
  * Add class to attributes
  */
-static void add_class(apex_attributes *attrs, const char *class_name) {
+void apex_attributes_add_class(apex_attributes *attrs, const char *class_name) {
     if (!attrs || !class_name) return;
 
-    attrs->classes = realloc(attrs->classes, sizeof(char*) * (attrs->class_count + 1));
-    attrs->classes[attrs->class_count++] = strdup(class_name);
+    if (attrs->class_count == attrs->class_capacity) {
+        int capacity = attrs->class_capacity ? attrs->class_capacity * 2 : 4;
+        char **classes = attrs_realloc(attrs, attrs->classes, (size_t)capacity * sizeof(char *));
+        if (!classes) return;
+        attrs->classes = classes;
+        attrs->class_capacity = capacity;
+    }
+    char *copy = attrs_strdup(attrs, class_name);
+    if (copy) attrs->classes[attrs->class_count++] = copy;
+}
+
+bool apex_attributes_has_class(const apex_attributes *attrs, const char *class_name) {
+    for (int i = 0; attrs && i < attrs->class_count; i++) {
+        if (strcmp(attrs->classes[i], class_name) == 0) return true;
+    }
+    return false;
+}
+
+const char *apex_attributes_get(const apex_attributes *attrs, const char *key) {
+    if (!attrs || !key || !attrs->slot_capacity) return NULL;
+    int index = *key_slot(attrs, key);
+    return index ? attrs->values[index - 1] : NULL;
 }
 
 /**
- * Add key-value attribute
+ * Set key-value attribute
  */
-static void add_attribute(apex_attributes *attrs, const char *key, const char *value) {
+void apex_attributes_set(apex_attributes *attrs, const char *key, const char *value) {
     if (!attrs || !key) return;
-
-    attrs->keys = realloc(attrs->keys, sizeof(char*) * (attrs->attr_count + 1));
-    attrs->values = realloc(attrs->values, sizeof(char*) * (attrs->attr_count + 1));
-    attrs->keys[attrs->attr_count] = strdup(key);
-    attrs->values[attrs->attr_count] = value ? strdup(value) : strdup("");
+    if (!value) value = "";
+
+    if (attrs->slot_capacity) {
+        int index = *key_slot(attrs, key);
+        if (index) {
+            char *copy = attrs_strdup(attrs, value);
+            if (!copy) return;
+            attrs_free(attrs, attrs->values[index - 1]);
+            attrs->values[index - 1] = copy;
+            return;
+        }
+    }
+
+    if ((attrs->attr_count + 1) * 2 > attrs->slot_capacity && !grow_key_index(attrs)) return;
+    if (attrs->attr_count == attrs->attr_capacity) {
+        int capacity = attrs->attr_capacity ? attrs->attr_capacity * 2 : 4;
+        const char **keys = attrs_realloc(attrs, (void *)attrs->keys, (size_t)capacity * sizeof(char *));
+        if (!keys) return;
+        attrs->keys = keys;
+        char **values = attrs_realloc(attrs, attrs->values, (size_t)capacity * sizeof(char *));
+        if (!values) return;
+        attrs->values = values;
+        attrs->attr_capacity = capacity;
+    }
+
+    const char *interned = intern_key(key);
+    char *key_copy = interned ? NULL : attrs_strdup(attrs, key);
+    char *value_copy = attrs_strdup(attrs, value);
+    if ((!interned && !key_copy) || !value_copy) {
+        attrs_free(attrs, key_copy);
+        attrs_free(attrs, value_copy);
+        return;
+    }
+    attrs->keys[attrs->attr_count] = interned ? interned : key_copy;
+    attrs->values[attrs->attr_count] = value_copy;
     attrs->attr_count++;
+    *key_slot(attrs, attrs->keys[attrs->attr_count - 1]) = attrs->attr_count;
+}
+
+void apex_attributes_merge(apex_attributes *attrs, const apex_attributes *override) {
+    if (!attrs || !override) return;
+    if (override->id) apex_attributes_set_id(attrs, override->id);
+    /* Classes are appended (duplicates allowed, HTML will handle them) */
+    for (int i = 0; i < override->class_count; i++) {
+        apex_attributes_add_class(attrs, override->classes[i]);
+    }
+    for (int i = 0; i < override->attr_count; i++) {
+        apex_attributes_set(attrs, override->keys[i], override->values[i]);
+    }
+    if (override->caption) apex_attributes_set_caption(attrs, override->caption);
+    if (override->remove) attrs->remove = true;
+}
+
+apex_attributes *apex_node_attributes(cmark_node *node) {
+    return node ? (apex_attributes *)cmark_node_get_user_data(node) : NULL;
+}
+
+apex_attributes *apex_node_ensure_attributes(cmark_node *node) {
+    if (!node) return NULL;
+    apex_attributes *attrs = apex_node_attributes(node);
+    if (!attrs) {
+        attrs = apex_attributes_new(apex_arena_current());
+        if (attrs) cmark_node_set_user_data(node, attrs);
+    }
+    return attrs;
+}
+
+void apex_free_node_attributes(cmark_node *root) {
+    if (!root) return;
+    cmark_iter *iter = cmark_iter_new(root);
+    cmark_event_type event;
+    while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+        if (event != CMARK_EVENT_ENTER) continue;
+        cmark_node *node = cmark_iter_get_node(iter);
+        apex_attributes *attrs = apex_node_attributes(node);
+        if (attrs && !attrs->arena) {
+            apex_free_attributes(attrs);
+            cmark_node_set_user_data(node, NULL);
+        }
+    }
+    cmark_iter_free(iter);
 }
 
 /**
  * Parse IAL/ALD content
  * Format: #id .class .class2 key="value" key2='value2'
  */
-static apex_attributes *parse_ial_content(const char *content, int len) {
+apex_attributes *apex_parse_ial_content(const char *content, size_t len) {
     apex_attributes *attrs = create_attributes();
     if (!attrs) return NULL;
 
     char buffer[2048];
-    if (len >= (int)sizeof(buffer)) len = (int)sizeof(buffer) - 1;
+    if (len >= sizeof(buffer)) len = sizeof(buffer) - 1;
     memcpy(buffer, content, len);
     buffer[len] = '\0';
 
@@ -104,8 +299,7 @@ static apex_attributes *parse_ial_content(const char *content, int len) {
             if (p > id_start) {
                 char saved = *p;
                 *p = '\0';
-                if (attrs->id) free(attrs->id);
-                attrs->id = strdup(id_start);
+                apex_attributes_set_id(attrs, id_start);
                 *p = saved;
             }
             continue;
@@ -119,7 +313,7 @@ static apex_attributes *parse_ial_content(const char *content, int len) {
             if (p > class_start) {
                 char saved = *p;
                 *p = '\0';
-                add_class(attrs, class_start);
+                apex_attributes_add_class(attrs, class_start);
                 *p = saved;
             }
             continue;
@@ -196,7 +390,7 @@ static apex_attributes *parse_ial_content(const char *content, int len) {
                 *p = saved_val;
             }
 
-            add_attribute(attrs, key, value);
+            apex_attributes_set(attrs, key, value);
             free(key);
             free(value);
             continue;
@@ -248,7 +442,7 @@ static bool is_ald_line(const char *line, char **ref_name, apex_attributes **att
     }
 
     /* Parse attributes */
-    *attrs = parse_ial_content(content_start, close - content_start);
+    *attrs = apex_parse_ial_content(content_start, close - content_start);
 
     return true;
 }
@@ -256,15 +450,18 @@ static bool is_ald_line(const char *line, char **ref_name, apex_attributes **att
 /**
  * Extract ALDs from text
  */
-ald_entry *apex_extract_alds(char **text_ptr) {
-    if (!text_ptr || !*text_ptr) return NULL;
+ald_entry *apex_extract_alds(const char *text, char **stripped) {
+    if (stripped) *stripped = NULL;
+    if (!text || !stripped) return NULL;
+
+    /* Fast path: no ALD can start without "{:" */
+    if (!strstr(text, "{:")) return NULL;
 
-    char *text = *text_ptr;
     ald_entry *alds = NULL;
     ald_entry **tail = &alds;
 
-    char *line_start = text;
-    char *line_end;
+    const char *line_start = text;
+    const char *line_end;
 
     char *output = malloc(strlen(text) + 1);
     char *output_write = output;
@@ -314,44 +511,57 @@ ald_entry *apex_extract_alds(char **text_ptr) {
 
     *output_write = '\0';
 
-    /* Use the output buffer as the new text */
-    size_t output_len = strlen(output);
-    if (output_len <= strlen(*text_ptr)) {
-        strcpy(*text_ptr, output);
+    if (alds) {
+        *stripped = output;
     } else {
-        /* Output is larger, need to reallocate */
-        free(*text_ptr);
-        *text_ptr = strdup(output);
+        free(output);
     }
-    free(output);
-
     return alds;
 }
 
 /**
- * Find ALD by name
+ * ALDs by name: an open-addressed hash table over the ALD list, built
+ * once per document so each reference is a single probe sequence
  */
-static apex_attributes *find_ald(ald_entry *alds, const char *name) {
+typedef struct {
+    ald_entry **slots;
+    size_t capacity;    /* Power of two, or 0 when there are no ALDs */
+} ald_map;
+
+static ald_entry **ald_map_slot(const ald_map *map, const char *name) {
+    size_t mask = map->capacity - 1;
+    for (size_t i = key_hash(name) & mask;; i = (i + 1) & mask) {
+        if (!map->slots[i] || strcmp(map->slots[i]->name, name) == 0) return &map->slots[i];
+    }
+}
+
+static void ald_map_build(ald_map *map, ald_entry *alds) {
+    map->slots = NULL;
+    map->capacity = 0;
+    size_t count = 0;
+    for (ald_entry *entry = alds; entry; entry = entry->next) count++;
+    if (count == 0) return;
+
+    size_t capacity = 16;
+    while (capacity < count * 2) capacity *= 2;
+    map->slots = calloc(capacity, sizeof(ald_entry *));
+    if (!map->slots) return;
+    map->capacity = capacity;
+
+    /* The first definition of a name wins, as it did in the list */
     for (ald_entry *entry = alds; entry; entry = entry->next) {
-        if (strcmp(entry->name, name) == 0) {
-            return entry->attrs;
-        }
+        ald_entry **slot = ald_map_slot(map, entry->name);
+        if (!*slot) *slot = entry;
     }
-    return NULL;
 }
 
 /**
- * Check if an attribute key already exists in the attributes structure
- * Returns the index if found, or -1 if not found
+ * Find ALD by name
  */
-static int find_attribute_index(apex_attributes *attrs, const char *key) {
-    if (!attrs || !key) return -1;
-    for (int i = 0; i < attrs->attr_count; i++) {
-        if (attrs->keys[i] && strcmp(attrs->keys[i], key) == 0) {
-            return i;
-        }
-    }
-    return -1;
+static apex_attributes *find_ald(const ald_map *alds, const char *name) {
+    if (!alds || !alds->capacity) return NULL;
+    ald_entry *entry = *ald_map_slot(alds, name);
+    return entry ? entry->attrs : NULL;
 }
 
 /**
@@ -362,44 +572,9 @@ static int find_attribute_index(apex_attributes *attrs, const char *key) {
  */
 static apex_attributes *merge_attributes(apex_attributes *base, apex_attributes *override) {
     apex_attributes *merged = create_attributes();
-    if (!merged) return base;
-
-    /* Copy base attributes */
-    if (base) {
-        if (base->id) merged->id = strdup(base->id);
-        for (int i = 0; i < base->class_count; i++) {
-            add_class(merged, base->classes[i]);
-        }
-        for (int i = 0; i < base->attr_count; i++) {
-            add_attribute(merged, base->keys[i], base->values[i]);
-        }
-    }
-
-    /* Override with new attributes */
-    if (override) {
-        /* Override ID if present */
-        if (override->id) {
-            free(merged->id);
-            merged->id = strdup(override->id);
-        }
-        /* Append classes (allow duplicates) */
-        for (int i = 0; i < override->class_count; i++) {
-            add_class(merged, override->classes[i]);
-        }
-        /* Override key-value attributes (replace if key exists, otherwise add) */
-        for (int i = 0; i < override->attr_count; i++) {
-            int existing_idx = find_attribute_index(merged, override->keys[i]);
-            if (existing_idx >= 0) {
-                /* Replace existing attribute */
-                free(merged->values[existing_idx]);
-                merged->values[existing_idx] = strdup(override->values[i]);
-            } else {
-                /* Add new attribute */
-                add_attribute(merged, override->keys[i], override->values[i]);
-            }
-        }
-    }
-
+    if (!merged) return NULL;
+    apex_attributes_merge(merged, base);
+    apex_attributes_merge(merged, override);
     return merged;
 }
 
@@ -407,7 +582,7 @@ static apex_attributes *merge_attributes(apex_attributes *base, apex_attributes
  * Check if text ends with IAL pattern
  * Pattern: {: attributes} or {:.class} or {: ref-name} or {: ref-name .class #id}
  */
-static bool extract_ial_from_text(const char *text, apex_attributes **attrs_out, ald_entry *alds) {
+static bool extract_ial_from_text(const char *text, apex_attributes **attrs_out, const ald_map *alds) {
     if (!text) return false;
 
     /* Find { from the end - support both {: ...} and {#id .class} formats */
@@ -504,7 +679,7 @@ static bool extract_ial_from_text(const char *text, apex_attributes **attrs_out,
     /* Parse additional attributes if any */
     apex_attributes *additional_attrs = NULL;
     if (remaining_content && remaining_len > 0) {
-        additional_attrs = parse_ial_content(remaining_content, remaining_len);
+        additional_attrs = apex_parse_ial_content(remaining_content, remaining_len);
     }
 
     /* Merge ALD with additional attributes */
@@ -513,199 +688,105 @@ static bool extract_ial_from_text(const char *text, apex_attributes **attrs_out,
         if (additional_attrs) {
             apex_free_attributes(additional_attrs);
         }
-        return true;
+        return *attrs_out != NULL;
     }
 
     /* No ALD found, parse as regular IAL */
-    *attrs_out = parse_ial_content(content_start, content_len);
+    *attrs_out = apex_parse_ial_content(content_start, content_len);
     return *attrs_out != NULL;
 }
 
-/**
- * Apply attributes to HTML tag
- * Helper function to generate attribute string
- */
-static char *attributes_to_html(apex_attributes *attrs) {
-    if (!attrs) return strdup("");
+/* How a width or height value is written out */
+typedef enum {
+    DIMENSION_ATTRIBUTE,      /* Bare integer: width="50" */
+    DIMENSION_ATTRIBUTE_PX,   /* Integer pixels: width="50" (px dropped) */
+    DIMENSION_STYLE           /* Percentage, decimal or other unit: style="width: 50%" */
+} dimension_form;
 
-    char buffer[4096];
-    char *p = buffer;
-    size_t remaining = sizeof(buffer);
-
-    #define APPEND(str) do { \
-        size_t len = strlen(str); \
-        if (len < remaining) { \
-            memcpy(p, str, len); \
-            p += len; \
-        remaining -= len; \
-        } \
-    } while(0)
-
-    bool first_attr = true;
-
-    /* Add ID */
-    if (attrs->id) {
-        char id_str[512];
-        if (first_attr) {
-            snprintf(id_str, sizeof(id_str), "id=\"%s\"", attrs->id);
-            first_attr = false;
-        } else {
-            snprintf(id_str, sizeof(id_str), " id=\"%s\"", attrs->id);
+static dimension_form dimension_form_of(const char *val) {
+    size_t val_len = strlen(val);
+    if (val_len >= 2 && val[val_len - 2] == 'p' && val[val_len - 1] == 'x') {
+        for (size_t j = 0; j < val_len - 2; j++) {
+            if (!isdigit((unsigned char)val[j])) return DIMENSION_STYLE;
         }
-        APPEND(id_str);
+        return DIMENSION_ATTRIBUTE_PX;
     }
-
-    /* Add classes */
-    if (attrs->class_count > 0) {
-        if (first_attr) {
-            APPEND("class=\"");
-            first_attr = false;
-        } else {
-            APPEND(" class=\"");
-        }
-        for (int i = 0; i < attrs->class_count; i++) {
-            if (i > 0) APPEND(" ");
-            APPEND(attrs->classes[i]);
-        }
-        APPEND("\"");
+    if (val_len >= 1 && val[val_len - 1] == '%') return DIMENSION_STYLE;
+    for (const char *c = val; *c; c++) {
+        if (!isdigit((unsigned char)*c)) return DIMENSION_STYLE;
     }
+    return DIMENSION_ATTRIBUTE;
+}
 
-    /* Check for existing style attribute to merge with */
-    const char *existing_style = NULL;
-    for (int i = 0; i < attrs->attr_count; i++) {
-        if (strcmp(attrs->keys[i], "style") == 0) {
-            existing_style = attrs->values[i];
-            break;
-        }
-    }
+static void append_attribute(apex_buffer *out, const char *key, const char *value, size_t value_len) {
+    apex_buffer_append_char(out, ' ');
+    apex_buffer_append_str(out, key);
+    apex_buffer_append_str(out, "=\"");
+    apex_buffer_append(out, value, value_len);
+    apex_buffer_append_char(out, '"');
+}
+
+/**
+ * Render attributes as HTML: id, class, integer width/height, style
+ * (any style value followed by the other widths and heights), then the
+ * remaining attributes in order
+ */
+bool apex_attributes_render(const apex_attributes *attrs, apex_buffer *out) {
+    if (!attrs || !out) return false;
+    size_t start = out->size;
 
-    /* Build style string for width/height that need to be in style */
-    char style_buffer[1024] = {0};
-    bool has_style = false;
+    if (attrs->id) append_attribute(out, "id", attrs->id, strlen(attrs->id));
 
-    /* Start with existing style if present */
-    if (existing_style && *existing_style) {
-        strncpy(style_buffer, existing_style, sizeof(style_buffer) - 1);
-        style_buffer[sizeof(style_buffer) - 1] = '\0';
-        has_style = true;
+    if (attrs->class_count > 0) {
+        apex_buffer_append_str(out, " class=\"");
+        for (int i = 0; i < attrs->class_count; i++) {
+            if (i > 0) apex_buffer_append_char(out, ' ');
+            apex_buffer_append_str(out, attrs->classes[i]);
+        }
+        apex_buffer_append_char(out, '"');
     }
 
-    /* Process width and height attributes */
+    const char *style = apex_attributes_get(attrs, key_style);
+    bool has_style = style && *style;
     for (int i = 0; i < attrs->attr_count; i++) {
         const char *key = attrs->keys[i];
+        if (key != key_width && key != key_height) continue;
         const char *val = attrs->values[i];
-
-        /* Skip style attribute - we'll handle it separately */
-        if (strcmp(key, "style") == 0) {
-            continue;
-        }
-
-        if (strcmp(key, "width") == 0 || strcmp(key, "height") == 0) {
-            size_t val_len = strlen(val);
-            bool is_px = (val_len >= 2 && val[val_len - 2] == 'p' && val[val_len - 1] == 'x');
-            bool is_percent = (val_len >= 1 && val[val_len - 1] == '%');
-            bool is_integer = true;
-            bool is_decimal_px = false;
-
-            /* Check if it's a bare integer or integer pixel value */
-            if (is_px) {
-                /* Check if the part before 'px' is a pure integer (no decimal) */
-                for (size_t j = 0; j < val_len - 2; j++) {
-                    if (val[j] == '.' || val[j] == ',') {
-                        is_decimal_px = true;
-                        is_integer = false;
-                        break;
-                    }
-                    if (!isdigit((unsigned char)val[j])) {
-                        is_integer = false;
-                        break;
-                    }
-                }
-            } else if (is_percent) {
-                is_integer = false;
-            } else {
-                /* Check if all characters are digits */
-                for (const char *c = val; *c; c++) {
-                    if (!isdigit((unsigned char)*c)) {
-                        is_integer = false;
-                        break;
-                    }
-                }
-            }
-
-            if (is_px && !is_decimal_px && is_integer) {
-                /* Convert integer Xpx to integer X for width/height attributes */
-                char int_val[64];
-                memcpy(int_val, val, val_len - 2);
-                int_val[val_len - 2] = '\0';
-
-                char attr_str[1024];
-                if (first_attr) {
-                    snprintf(attr_str, sizeof(attr_str), "%s=\"%s\"", key, int_val);
-                    first_attr = false;
-                } else {
-                    snprintf(attr_str, sizeof(attr_str), " %s=\"%s\"", key, int_val);
-                }
-                APPEND(attr_str);
-            } else if (is_integer && !is_px && !is_percent) {
-                /* Bare integer - use as width/height attribute */
-                char attr_str[1024];
-                if (first_attr) {
-                    snprintf(attr_str, sizeof(attr_str), "%s=\"%s\"", key, val);
-                    first_attr = false;
-                } else {
-                    snprintf(attr_str, sizeof(attr_str), " %s=\"%s\"", key, val);
-                }
-                APPEND(attr_str);
-            } else {
-                /* Percentage, decimal pixel, or other non-integer - add to style */
-                if (has_style) {
-                    strcat(style_buffer, "; ");
-                }
-                strcat(style_buffer, key);
-                strcat(style_buffer, ": ");
-                strcat(style_buffer, val);
-                has_style = true;
-            }
+        dimension_form form = dimension_form_of(val);
+        if (form == DIMENSION_STYLE) {
+            has_style = true;
+        } else {
+            append_attribute(out, key, val, strlen(val) - (form == DIMENSION_ATTRIBUTE_PX ? 2 : 0));
         }
     }
 
-    /* Add style attribute if we have width/height in style or existing style */
     if (has_style) {
-        char style_str[1024];
-        if (first_attr) {
-            snprintf(style_str, sizeof(style_str), "style=\"%s\"", style_buffer);
-            first_attr = false;
-        } else {
-            snprintf(style_str, sizeof(style_str), " style=\"%s\"", style_buffer);
+        apex_buffer_append_str(out, " style=\"");
+        bool first = true;
+        if (style && *style) {
+            apex_buffer_append_str(out, style);
+            first = false;
         }
-        APPEND(style_str);
+        for (int i = 0; i < attrs->attr_count; i++) {
+            const char *key = attrs->keys[i];
+            if (key != key_width && key != key_height) continue;
+            if (dimension_form_of(attrs->values[i]) != DIMENSION_STYLE) continue;
+            if (!first) apex_buffer_append_str(out, "; ");
+            apex_buffer_append_str(out, key);
+            apex_buffer_append_str(out, ": ");
+            apex_buffer_append_str(out, attrs->values[i]);
+            first = false;
+        }
+        apex_buffer_append_char(out, '"');
     }
 
-    /* Add other attributes (excluding width/height/style which we already processed) */
     for (int i = 0; i < attrs->attr_count; i++) {
         const char *key = attrs->keys[i];
-        const char *val = attrs->values[i];
-
-        /* Skip width, height, and style - we already processed them */
-        if (strcmp(key, "width") == 0 || strcmp(key, "height") == 0 || strcmp(key, "style") == 0) {
-            continue;
-        }
-
-        char attr_str[1024];
-        if (first_attr) {
-            snprintf(attr_str, sizeof(attr_str), "%s=\"%s\"", key, val);
-            first_attr = false;
-        } else {
-            snprintf(attr_str, sizeof(attr_str), " %s=\"%s\"", key, val);
-        }
-        APPEND(attr_str);
+        if (key == key_width || key == key_height || key == key_style) continue;
+        append_attribute(out, key, attrs->values[i], strlen(attrs->values[i]));
     }
 
-    #undef APPEND
-
-    *p = '\0';
-    return strdup(buffer);
+    return out->size > start;
 }
 
 /**
@@ -722,7 +803,7 @@ static char *attributes_to_html(apex_attributes *attrs) {
  *
  *   {: #id .class}     <-- This is a pure IAL paragraph
  */
-static bool extract_ial_from_paragraph(cmark_node *para, apex_attributes **attrs_out, ald_entry *alds) {
+static bool extract_ial_from_paragraph(cmark_node *para, apex_attributes **attrs_out, const ald_map *alds) {
     if (cmark_node_get_type(para) != CMARK_NODE_PARAGRAPH) return false;
 
     /* Must have exactly one child (a text node) - no links, no formatting */
@@ -765,7 +846,7 @@ static bool extract_ial_from_paragraph(cmark_node *para, apex_attributes **attrs
  * IALs can appear inline within paragraphs, not just at the end.
  * This function processes IALs recursively to handle nested inline elements.
  */
-static bool process_span_ial_in_container(cmark_node *container, ald_entry *alds) {
+static bool process_span_ial_in_container(cmark_node *container, const ald_map *alds) {
     cmark_node_type container_type = cmark_node_get_type(container);
     /* Only process paragraphs and inline elements that can contain other inline elements */
     if (container_type != CMARK_NODE_PARAGRAPH &&
@@ -926,7 +1007,7 @@ static bool process_span_ial_in_container(cmark_node *container, ald_entry *alds
         /* Parse additional attributes if any */
         apex_attributes *additional_attrs = NULL;
         if (remaining_content && remaining_len > 0) {
-            additional_attrs = parse_ial_content(remaining_content, remaining_len);
+            additional_attrs = apex_parse_ial_content(remaining_content, remaining_len);
         }
 
         /* Merge ALD with additional attributes */
@@ -937,7 +1018,7 @@ static bool process_span_ial_in_container(cmark_node *container, ald_entry *alds
             }
         } else {
             /* No ALD found, parse as regular IAL */
-            attrs = parse_ial_content(content_start, content_len);
+            attrs = apex_parse_ial_content(content_start, content_len);
         }
 
         if (!attrs) {
@@ -1003,8 +1084,7 @@ static bool process_span_ial_in_container(cmark_node *container, ald_entry *alds
         }
 
         /* Apply attributes to the target inline element */
-        char *attr_str = attributes_to_html(attrs);
-        cmark_node_set_user_data(target, attr_str);
+        apex_attributes_merge(apex_node_ensure_attributes(target), attrs);
         apex_free_attributes(attrs);
 
         /* Remove the IAL from the text node, preserving any text before/after it */
@@ -1091,7 +1171,7 @@ static bool process_span_ial_in_container(cmark_node *container, ald_entry *alds
 /**
  * Handle span-level IAL for paragraphs (wrapper for recursive function)
  */
-static bool process_span_ial(cmark_node *para, ald_entry *alds) {
+static bool process_span_ial(cmark_node *para, const ald_map *alds) {
     if (cmark_node_get_type(para) != CMARK_NODE_PARAGRAPH) return false;
     return process_span_ial_in_container(para, alds);
 }
@@ -1099,7 +1179,7 @@ static bool process_span_ial(cmark_node *para, ald_entry *alds) {
 /**
  * Extract IAL from heading text (inline syntax: ## Heading {: #id})
  */
-static bool extract_ial_from_heading(cmark_node *heading, apex_attributes **attrs_out, ald_entry *alds) {
+static bool extract_ial_from_heading(cmark_node *heading, apex_attributes **attrs_out, const ald_map *alds) {
     if (cmark_node_get_type(heading) != CMARK_NODE_HEADING) return false;
 
     /* Get the text node inside the heading */
@@ -1226,7 +1306,7 @@ static bool is_pure_ial_paragraph(cmark_node *para) {
  * Returns the node to free (if any), or NULL
  * Caller must free the returned node after iteration is complete
  */
-static cmark_node *process_node_ial(cmark_node *node, ald_entry *alds) {
+static cmark_node *process_node_ial(cmark_node *node, const ald_map *alds) {
     if (!node) return NULL;
 
     cmark_node_type type = cmark_node_get_type(node);
@@ -1236,26 +1316,8 @@ static cmark_node *process_node_ial(cmark_node *node, ald_entry *alds) {
         apex_attributes *attrs = NULL;
         bool extracted = extract_ial_from_heading(node, &attrs, alds);
         if (extracted) {
-            /* Store attributes in heading */
-            char *attr_str = attributes_to_html(attrs);
-
-            /* Merge with existing user_data if present */
-            char *existing = (char *)cmark_node_get_user_data(node);
-            if (existing) {
-                /* Append to existing */
-                char *combined = malloc(strlen(existing) + strlen(attr_str) + 1);
-                if (combined) {
-                    strcpy(combined, existing);
-                    strcat(combined, attr_str);
-                    cmark_node_set_user_data(node, combined);
-                    free(attr_str);
-                } else {
-                    cmark_node_set_user_data(node, attr_str);
-                }
-            } else {
-                cmark_node_set_user_data(node, attr_str);
-            }
-
+            /* Store attributes in heading (over any manual header ID) */
+            apex_attributes_merge(apex_node_ensure_attributes(node), attrs);
             apex_free_attributes(attrs);
             return NULL;  /* No node to free */
         }
@@ -1296,9 +1358,8 @@ static cmark_node *process_node_ial(cmark_node *node, ald_entry *alds) {
     if (is_pure_ial_paragraph(next)) {
         apex_attributes *attrs = NULL;
         if (extract_ial_from_paragraph(next, &attrs, alds)) {
-            /* Store attributes in this node */
-            char *attr_str = attributes_to_html(attrs);
-            cmark_node_set_user_data(node, attr_str);
+            /* Store attributes in this node (a table keeps its caption) */
+            apex_attributes_merge(apex_node_ensure_attributes(node), attrs);
             apex_free_attributes(attrs);
 
             /* Return node to be unlinked and freed after iteration completes */
@@ -1316,6 +1377,9 @@ static cmark_node *process_node_ial(cmark_node *node, ald_entry *alds) {
 void apex_process_ial_in_tree(cmark_node *node, ald_entry *alds) {
     if (!node) return;
 
+    ald_map ald_index;
+    ald_map_build(&ald_index, alds);
+
     /* Collect nodes to unlink and free after iteration to avoid use-after-free */
     cmark_node **nodes_to_free = NULL;
     size_t free_count = 0;
@@ -1331,7 +1395,7 @@ void apex_process_ial_in_tree(cmark_node *node, ald_entry *alds) {
         /* Only process on ENTER events */
         if (ev_type == CMARK_EVENT_ENTER) {
             /* Process node and collect any nodes that need to be freed */
-            cmark_node *node_to_free = process_node_ial(cur, alds);
+            cmark_node *node_to_free = process_node_ial(cur, &ald_index);
             if (node_to_free) {
                 /* Expand array if needed */
                 if (free_count >= free_capacity) {
@@ -1359,6 +1423,7 @@ void apex_process_ial_in_tree(cmark_node *node, ald_entry *alds) {
         cmark_node_free(nodes_to_free[i]);
     }
     free(nodes_to_free);
+    free(ald_index.slots);
 }
 
 /**
@@ -1619,7 +1684,7 @@ static apex_attributes *parse_image_attributes(const char *attr_str, int len) {
             }
             if (*p == quote) {
                 *p = '\0';
-                add_attribute(attrs, "title", title_start);
+                apex_attributes_set(attrs, "title", title_start);
                 *p = quote;
                 p++;
             }
@@ -1664,7 +1729,7 @@ static apex_attributes *parse_image_attributes(const char *attr_str, int len) {
             }
 
             if (value) {
-                add_attribute(attrs, key, value);
+                apex_attributes_set(attrs, key, value);
                 free(value);
             }
             free(key);
@@ -1679,157 +1744,146 @@ static apex_attributes *parse_image_attributes(const char *attr_str, int len) {
 }
 
 /**
- * Create a new image attribute entry (always creates a new entry, doesn't reuse)
+ * Image attribute entry (one per image or reference definition with attributes)
  */
-static image_attr_entry *create_image_attr_entry(image_attr_entry **list, const char *url, int index) {
-    if (!list || !url) return NULL;
-
-    /* Create new entry - always create new, don't reuse by URL */
-    image_attr_entry *entry = calloc(1, sizeof(image_attr_entry));
-    if (entry) {
-        entry->url = strdup(url);
-        entry->attrs = create_attributes();
-        entry->index = index;
-        entry->ref_name = NULL;
-        entry->next = *list;
-        *list = entry;
-    }
-    return entry;
-}
+typedef struct image_attr_entry {
+    apex_attributes *attrs;     /* Attributes for this image */
+    struct image_attr_entry *next;
+} image_attr_entry;
 
 /**
- * Create image attribute entry with reference name (for reference-style definitions)
+ * A reference-style image whose label is defined: its position among the
+ * document's images and the definition it resolves to
  */
-static image_attr_entry *create_image_attr_entry_with_ref(image_attr_entry **list, const char *url, const char *ref_name) {
-    if (!list || !url) return NULL;
-
-    image_attr_entry *entry = calloc(1, sizeof(image_attr_entry));
-    if (entry) {
-        entry->url = strdup(url);
-        entry->attrs = create_attributes();
-        entry->index = -1;
-        entry->ref_name = ref_name ? strdup(ref_name) : NULL;
-        entry->next = *list;
-        *list = entry;
-    }
-    return entry;
-}
+typedef struct {
+    int index;
+    size_t definition;
+} reference_image;
 
 /**
- * Free image attribute list
+ * Image attributes by image position, filled in while the preprocessor
+ * scans. Inline images have their own entries; each reference-style image
+ * shares the entry of the definition it resolves to, linked up once the
+ * scan has seen every definition.
  */
-void apex_free_image_attributes(image_attr_entry *img_attrs) {
-    while (img_attrs) {
-        image_attr_entry *next = img_attrs->next;
-        free(img_attrs->url);
-        free(img_attrs->ref_name);
-        apex_free_attributes(img_attrs->attrs);
-        free(img_attrs);
-        img_attrs = next;
-    }
+struct apex_image_attrs {
+    image_attr_entry *entries;      /* Every entry, newest first (owns them) */
+    image_attr_entry **by_index;    /* Entries by image position, NULL where there are none */
+    int index_capacity;
+    image_attr_entry **by_definition;   /* Parallel to the scanned definitions, during the scan */
+    reference_image *references;        /* Reference-style images, during the scan */
+    size_t reference_count;
+    size_t reference_capacity;
+};
+
+/* Point position index at entry; the first attributes found for an image win */
+static bool index_image_attr(apex_image_attrs *img_attrs, int index, image_attr_entry *entry) {
+    if (index >= img_attrs->index_capacity) {
+        int capacity = img_attrs->index_capacity ? img_attrs->index_capacity : 16;
+        while (capacity <= index) capacity *= 2;
+        image_attr_entry **by_index = realloc(img_attrs->by_index, (size_t)capacity * sizeof(image_attr_entry *));
+        if (!by_index) return false;
+        memset(by_index + img_attrs->index_capacity, 0,
+               (size_t)(capacity - img_attrs->index_capacity) * sizeof(image_attr_entry *));
+        img_attrs->by_index = by_index;
+        img_attrs->index_capacity = capacity;
+    }
+    if (!img_attrs->by_index[index]) img_attrs->by_index[index] = entry;
+    return true;
 }
 
 /**
- * Convert attributes to inline image format (key=value, for use inside parentheses)
- * This converts IAL attributes (ID, classes) to key=value format that parse_image_attributes can understand
+ * Add an entry holding a copy of attrs, for the inline image at index, or
+ * unindexed when index is -1 (a reference definition's, indexed later for
+ * the images that resolve to it)
  */
-static char *attributes_to_inline_format(apex_attributes *attrs) {
-    if (!attrs || (!attrs->id && attrs->class_count == 0 && attrs->attr_count == 0)) {
-        return strdup("");
-    }
-
-    char buffer[4096];
-    char *p = buffer;
-    size_t remaining = sizeof(buffer);
-
-    #define APPEND_INLINE(str) do { \
-        size_t len = strlen(str); \
-        if (len < remaining) { \
-            memcpy(p, str, len); \
-            p += len; \
-            remaining -= len; \
-        } \
-    } while(0)
-
-    bool first = true;
-
-    /* Add ID as id="value" */
-    if (attrs->id) {
-        char id_str[512];
-        snprintf(id_str, sizeof(id_str), "%sid=\"%s\"", first ? "" : " ", attrs->id);
-        first = false;
-        APPEND_INLINE(id_str);
-    }
+static image_attr_entry *add_image_attr_entry(apex_image_attrs *img_attrs, int index, const apex_attributes *attrs) {
+    if (!img_attrs) return NULL;
 
-    /* Add classes as class="class1 class2" */
-    if (attrs->class_count > 0) {
-        char class_str[1024];
-        char *class_p = class_str;
-        size_t class_remaining = sizeof(class_str);
-        snprintf(class_p, class_remaining, "%sclass=\"", first ? "" : " ");
-        class_p += strlen(class_p);
-        class_remaining -= strlen(class_p);
-
-        for (int i = 0; i < attrs->class_count; i++) {
-            if (i > 0 && class_remaining > 0) {
-                *class_p++ = ' ';
-                class_remaining--;
-            }
-            size_t class_len = strlen(attrs->classes[i]);
-            if (class_len < class_remaining) {
-                memcpy(class_p, attrs->classes[i], class_len);
-                class_p += class_len;
-                class_remaining -= class_len;
-            }
-        }
-        if (class_remaining > 0) {
-            *class_p++ = '"';
-            class_remaining--;
-        }
-        *class_p = '\0';
-        first = false;
-        APPEND_INLINE(class_str);
+    image_attr_entry *entry = calloc(1, sizeof(image_attr_entry));
+    if (!entry) return NULL;
+    entry->attrs = create_attributes();
+    if (!entry->attrs) {
+        free(entry);
+        return NULL;
     }
+    if (attrs) apex_attributes_merge(entry->attrs, attrs);
+    entry->next = img_attrs->entries;
+    img_attrs->entries = entry;
 
-    /* Add other attributes - format as key=value or key="value" */
-    for (int i = 0; i < attrs->attr_count; i++) {
-        char attr_str[1024];
-        const char *val = attrs->values[i];
-        /* Quote value if it contains spaces, semicolons, or special characters */
-        bool need_quotes = (strchr(val, ' ') != NULL || strchr(val, ';') != NULL || strchr(val, '"') != NULL);
-        if (need_quotes) {
-            snprintf(attr_str, sizeof(attr_str), "%s%s=\"%s\"", first ? "" : " ", attrs->keys[i], val);
-        } else {
-            snprintf(attr_str, sizeof(attr_str), "%s%s=%s", first ? "" : " ", attrs->keys[i], val);
-        }
-        first = false;
-        APPEND_INLINE(attr_str);
-    }
+    if (index >= 0) index_image_attr(img_attrs, index, entry);
+    return entry;
+}
 
-    #undef APPEND_INLINE
+/* Note the reference-style image at index, which resolves to definition */
+static void add_reference_image(apex_image_attrs *img_attrs, int index, const apex_reference_defs *refs,
+                                const apex_reference_def *definition) {
+    if (!img_attrs->by_definition) return;
+    if (img_attrs->reference_count == img_attrs->reference_capacity) {
+        size_t capacity = img_attrs->reference_capacity ? img_attrs->reference_capacity * 2 : 16;
+        reference_image *grown = realloc(img_attrs->references, capacity * sizeof(reference_image));
+        if (!grown) return;
+        img_attrs->references = grown;
+        img_attrs->reference_capacity = capacity;
+    }
+    reference_image *ref = &img_attrs->references[img_attrs->reference_count++];
+    ref->index = index;
+    ref->definition = (size_t)(definition - refs->defs);
+}
 
-    *p = '\0';
-    return strdup(buffer);
+/* Give each reference-style image its definition's entry, then drop the scan state */
+static void resolve_reference_images(apex_image_attrs *img_attrs) {
+    if (!img_attrs) return;
+    for (size_t i = 0; i < img_attrs->reference_count; i++) {
+        const reference_image *ref = &img_attrs->references[i];
+        image_attr_entry *entry = img_attrs->by_definition[ref->definition];
+        if (entry) index_image_attr(img_attrs, ref->index, entry);
+    }
+    free(img_attrs->by_definition);
+    free(img_attrs->references);
+    img_attrs->by_definition = NULL;
+    img_attrs->references = NULL;
+    img_attrs->reference_count = 0;
+    img_attrs->reference_capacity = 0;
 }
 
 /**
- * Convert attributes back to markdown attribute string (for expanding reference-style images)
- * Uses inline format (key=value) for compatibility with parse_image_attributes
+ * Free image attributes
  */
-static char *attributes_to_markdown(apex_attributes *attrs) {
-    return attributes_to_inline_format(attrs);
+void apex_free_image_attributes(apex_image_attrs *img_attrs) {
+    if (!img_attrs) return;
+    image_attr_entry *entry = img_attrs->entries;
+    while (entry) {
+        image_attr_entry *next = entry->next;
+        apex_free_attributes(entry->attrs);
+        free(entry);
+        entry = next;
+    }
+    free(img_attrs->by_index);
+    free(img_attrs->by_definition);
+    free(img_attrs->references);
+    free(img_attrs);
 }
 
 /**
- * Find image attribute entry by reference name
+ * The definition a reference-style image (![alt][ref], ![alt][] or ![alt])
+ * resolves to, or NULL if its label is undefined and cmark will leave it
+ * as text. alt_end is the ] closing the alt text.
  */
-static image_attr_entry *find_image_attr_by_ref(image_attr_entry *list, const char *ref_name) {
-    for (image_attr_entry *entry = list; entry; entry = entry->next) {
-        if (entry->ref_name && ref_name && strcmp(entry->ref_name, ref_name) == 0) {
-            return entry;
-        }
-    }
-    return NULL;
+static const apex_reference_def *reference_image_definition(const char *p, const char *alt_end,
+                                                            const apex_reference_defs *refs) {
+    const char *label = p + 2;
+    size_t label_len = (size_t)(alt_end - label);
+    if (alt_end[1] == '[') {
+        const char *ref_start = alt_end + 2;
+        const char *ref_end = strchr(ref_start, ']');
+        if (!ref_end) return NULL;
+        if (ref_end > ref_start) {
+            label = ref_start;
+            label_len = (size_t)(ref_end - ref_start);
+        }
+    }
+    return apex_reference_defs_find(refs, label, label_len);
 }
 
 /**
@@ -1862,24 +1916,116 @@ static bool looks_like_attribute_start(const char *p, const char *end) {
 }
 
 /**
- * Preprocess markdown to extract image attributes and URL-encode all link URLs
+ * Code blocks the image scan copies unchanged, so image syntax shown in
+ * them is neither rewritten nor counted (cmark makes no image of it)
  */
-char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_attrs, apex_mode_t mode) {
-    if (!text) return NULL;
+typedef struct {
+    char fence_char;     /* Inside a fenced block opened with this, or '\0' */
+    size_t fence_len;
+    bool after_blank;    /* The previous line was blank, or there was none */
+    bool in_indented;    /* The previous line was indented code */
+    bool in_list;        /* The last line at the margin started a list item */
+} image_scan_code;
+
+static bool line_is_list_item(const char *p) {
+    if ((*p == '-' || *p == '*' || *p == '+') && (p[1] == ' ' || p[1] == '\t')) return true;
+    const char *q = p;
+    while (*q >= '0' && *q <= '9') q++;
+    return q > p && (*q == '.' || *q == ')') && (q[1] == ' ' || q[1] == '\t');
+}
 
-    /* Check if we should do URL encoding */
-    bool do_url_encoding = (mode == APEX_MODE_UNIFIED ||
-                            mode == APEX_MODE_MULTIMARKDOWN ||
-                            mode == APEX_MODE_KRAMDOWN);
+/* Whether the line at line is code (fence lines included), updating code */
+static bool image_scan_code_line(image_scan_code *code, const char *line) {
+    size_t indent = 0;
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') {
+        indent += *p == '\t' ? 4 - indent % 4 : 1;
+        p++;
+    }
+    bool blank = *p == '\n' || *p == '\r' || *p == '\0';
 
-    /* Check if we should process image attributes */
-    bool do_image_attrs = (mode == APEX_MODE_UNIFIED ||
-                           mode == APEX_MODE_MULTIMARKDOWN);
+    if (code->fence_char) {
+        size_t run = 0;
+        while (p[run] == code->fence_char) run++;
+        const char *after = p + run;
+        while (*after == ' ' || *after == '\t' || *after == '\r') after++;
+        if (indent <= 3 && run >= code->fence_len && (*after == '\n' || *after == '\0')) code->fence_char = '\0';
+        return true;
+    }
+    if (blank) {
+        code->after_blank = true;
+        code->in_indented = false;
+        return false;
+    }
+    if (indent >= 4 && (code->after_blank || code->in_indented) && !code->in_list) {
+        code->in_indented = true;
+        code->after_blank = false;
+        return true;
+    }
 
-    if (!do_url_encoding && !do_image_attrs) {
-        /* Nothing to do */
-        return NULL;
+    code->after_blank = false;
+    code->in_indented = false;
+    if (indent >= 4) return false;
+    if (*p == '`' || *p == '~') {
+        size_t run = 0;
+        while (p[run] == *p) run++;
+        if (run >= 3) {
+            code->fence_char = *p;
+            code->fence_len = run;
+            return true;
+        }
+    }
+    code->in_list = line_is_list_item(p);
+    return false;
+}
+
+/* Length of the code span opening at p (through its closing backticks), or
+ * of the unmatched backtick run alone; spans end at a blank line */
+static size_t code_span_length(const char *p) {
+    size_t open = 0;
+    while (p[open] == '`') open++;
+    for (const char *q = p + open; *q; ) {
+        if (*q == '\n' && q[1] == '\n') break;
+        if (*q != '`') {
+            q++;
+            continue;
+        }
+        size_t run = 0;
+        while (q[run] == '`') run++;
+        if (run == open) return (size_t)(q + run - p);
+        q += run;
     }
+    return open;
+}
+
+/* Append n bytes to the output, growing it as needed */
+static bool image_output_append(char **output, char **write, size_t *remaining, const char *src, size_t n) {
+    if (n >= *remaining) {
+        size_t written = (size_t)(*write - *output);
+        size_t capacity = (written + n + 1) * 2;
+        char *grown = realloc(*output, capacity);
+        if (!grown) return false;
+        *output = grown;
+        *write = grown + written;
+        *remaining = capacity - written;
+    }
+    memcpy(*write, src, n);
+    *write += n;
+    *remaining -= n;
+    return true;
+}
+
+/**
+ * One pass over text: URL-encode link URLs and, when do_image_attrs is
+ * set, move image attributes into img_attrs. Images are numbered in
+ * document order (counting the reference-style images refs resolves) so
+ * apex_apply_image_attributes can find each by position; reference
+ * definitions with attributes are written back without them, and their
+ * attributes go to the positions of the images that use them. Code blocks
+ * and code spans are copied as they are.
+ */
+static char *preprocess_image_attributes(const char *text, apex_image_attrs **img_attrs, bool do_url_encoding,
+                                         bool do_image_attrs, const apex_reference_defs *refs) {
     size_t text_len = strlen(text);
     size_t capacity = text_len * 3 + 1; /* Extra space for URL encoding expansion */
     char *output = malloc(capacity);
@@ -1888,9 +2034,39 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
     const char *read = text;
     char *write = output;
     size_t remaining = capacity;
-    image_attr_entry *local_img_attrs = NULL;
+    apex_image_attrs *local_img_attrs = NULL;
+    int image_position = 0;  /* Images seen so far */
+    if (do_image_attrs) {
+        local_img_attrs = calloc(1, sizeof(apex_image_attrs));
+        if (!local_img_attrs) {
+            free(output);
+            return NULL;
+        }
+        if (refs->count > 0) {
+            local_img_attrs->by_definition = calloc(refs->count, sizeof(image_attr_entry *));
+        }
+    }
 
+    image_scan_code code = { '\0', 0, true, false, false };
     while (*read) {
+        /* Code is copied unchanged, a line or a span at a time */
+        size_t code_len = 0;
+        if ((read == text || read[-1] == '\n') && image_scan_code_line(&code, read)) {
+            const char *newline = strchr(read, '\n');
+            code_len = newline ? (size_t)(newline + 1 - read) : strlen(read);
+        } else if (*read == '`') {
+            code_len = code_span_length(read);
+        }
+        if (code_len > 0) {
+            if (!image_output_append(&output, &write, &remaining, read, code_len)) {
+                free(output);
+                apex_free_image_attributes(local_img_attrs);
+                return NULL;
+            }
+            read += code_len;
+            continue;
+        }
+
         /* Look for inline images: ![alt](url attributes) */
         if (*read == '!' && read[1] == '[') {
             const char *img_start = read;
@@ -1916,6 +2092,7 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                     read = img_start + 1;
                     continue;
                 }
+                int img_index = image_position++;
 
                 /* Scan forward from url_start looking for:
                  * 1. Titles: quoted string ("title" or 'title') or parentheses (title)
@@ -2013,7 +2190,7 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                                     int content_len = ial_end - content_start;
                                     if (content_len > 0) {
                                         /* Try parsing as IAL first (handles #id .class key=val) */
-                                        apex_attributes *ial_attrs = parse_ial_content(content_start, content_len);
+                                        apex_attributes *ial_attrs = apex_parse_ial_content(content_start, content_len);
                                         if (!ial_attrs || (ial_attrs->attr_count == 0 && !ial_attrs->id && ial_attrs->class_count == 0)) {
                                             /* If IAL parsing didn't work, try as image attributes (handles width=50%) */
                                             if (ial_attrs) apex_free_attributes(ial_attrs);
@@ -2051,25 +2228,8 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                         char *encoded_url = do_url_encoding ? url_encode(url) : strdup(url);
                         if (encoded_url) {
                             /* Store attributes with encoded URL - always create new entry (if image attrs enabled) */
-                            image_attr_entry *entry = NULL;
                             if (attrs && do_image_attrs) {
-                                /* Count existing entries to get index */
-                                int img_index = 0;
-                                for (image_attr_entry *e = local_img_attrs; e; e = e->next) img_index++;
-
-                                entry = create_image_attr_entry(&local_img_attrs, encoded_url, img_index);
-                                if (entry) {
-                                    /* Copy attributes (don't merge) */
-                                    for (int i = 0; i < attrs->attr_count; i++) {
-                                        add_attribute(entry->attrs, attrs->keys[i], attrs->values[i]);
-                                    }
-                                    if (attrs->id) {
-                                        entry->attrs->id = strdup(attrs->id);
-                                    }
-                                    for (int i = 0; i < attrs->class_count; i++) {
-                                        add_class(entry->attrs, attrs->classes[i]);
-                                    }
-                                }
+                                add_image_attr_entry(local_img_attrs, img_index, attrs);
                             }
 
                             /* Write the image syntax up to URL */
@@ -2109,7 +2269,8 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
 
                             /* Write the rest (title if present, but NOT attributes for images - they're stored separately) */
                             const char *rest_start = url_end;
-                            while (rest_start < paren_end) {
+                            const char *rest_end = (attr_start && do_image_attrs) ? url_end : paren_end;
+                            while (rest_start < rest_end) {
                                 if (remaining > 0) {
                                     *write++ = *rest_start++;
                                     remaining--;
@@ -2167,6 +2328,11 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                 }
             } else {
                 /* Not an inline image - might be reference-style ![ref][id] */
+                const apex_reference_def *definition =
+                    alt_end && do_image_attrs ? reference_image_definition(read, alt_end, refs) : NULL;
+                if (definition) {
+                    add_reference_image(local_img_attrs, image_position++, refs, definition);
+                }
                 /* Pass through unchanged by copying the ![ */
                 if (remaining > 0) {
                     *write++ = *read++;
@@ -2328,7 +2494,7 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                                             int content_len = ial_end - content_start;
                                             if (content_len > 0) {
                                                 /* Try parsing as IAL first (handles #id .class key=val) */
-                                                apex_attributes *ial_attrs = parse_ial_content(content_start, content_len);
+                                                apex_attributes *ial_attrs = apex_parse_ial_content(content_start, content_len);
                                                 if (!ial_attrs || (ial_attrs->attr_count == 0 && !ial_attrs->id && ial_attrs->class_count == 0)) {
                                                     /* If IAL parsing didn't work, try as image attributes (handles width=50%) */
                                                     if (ial_attrs) apex_free_attributes(ial_attrs);
@@ -2388,7 +2554,7 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                                         if (is_ial && content_start) {
                                             int content_len = ial_end - content_start;
                                             if (content_len > 0) {
-                                                apex_attributes *ial_attrs = parse_ial_content(content_start, content_len);
+                                                apex_attributes *ial_attrs = apex_parse_ial_content(content_start, content_len);
                                                 if (!ial_attrs || (ial_attrs->attr_count == 0 && !ial_attrs->id && ial_attrs->class_count == 0)) {
                                                     if (ial_attrs) apex_free_attributes(ial_attrs);
                                                     ial_attrs = parse_image_attributes(content_start, content_len);
@@ -2500,83 +2666,71 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                         /* URL encode the URL (if enabled) - always encode for reference definitions */
                         char *encoded_url = do_url_encoding ? url_encode(url) : strdup(url);
                         if (encoded_url) {
-                            /* If has attributes, store them with reference name */
-                            /* Note: ref_name will be duplicated in create_image_attr_entry_with_ref */
-                            /* Also create entry if attrs is NULL but we detected IAL (for expansion even if parsing failed) */
-                            if (do_image_attrs && ref_name) {
-                                /* Check if we should create entry - either we have attrs, or we detected IAL */
-                                bool has_attrs = (attrs != NULL);
-
-                                if (has_attrs || found_ial) {
-                                    image_attr_entry *entry = create_image_attr_entry_with_ref(&local_img_attrs, encoded_url, ref_name);
-                                    if (entry) {
-                                        if (attrs) {
-                                            /* Copy attributes (don't merge) */
-                                            for (int i = 0; i < attrs->attr_count; i++) {
-                                                add_attribute(entry->attrs, attrs->keys[i], attrs->values[i]);
-                                            }
-                                            if (attrs->id) {
-                                                entry->attrs->id = strdup(attrs->id);
-                                            }
-                                            for (int i = 0; i < attrs->class_count; i++) {
-                                                add_class(entry->attrs, attrs->classes[i]);
-                                            }
-                                        }
-                                        /* Add title if present */
-                                        if (title_text) {
-                                            add_attribute(entry->attrs, "title", title_text);
-                                        }
-                                        /* Entry created - will be used for expansion */
-                                    }
+                            /* A definition with attributes (or an IAL that did not parse) keeps
+                             * only its URL; the attributes, title included, are applied to the
+                             * images that resolve to it. A repeated label's later definitions
+                             * resolve nothing. */
+                            bool strip_attributes = do_image_attrs && ref_name && (attrs || found_ial);
+                            if (strip_attributes) {
+                                const apex_reference_def *def = apex_reference_defs_find(refs, ref_name, strlen(ref_name));
+                                image_attr_entry *entry = add_image_attr_entry(local_img_attrs, -1, attrs);
+                                if (entry && title_text) {
+                                    apex_attributes_set(entry->attrs, "title", title_text);
+                                }
+                                if (entry && def && local_img_attrs->by_definition &&
+                                    ref_start >= def->line && ref_start < def->line + def->length) {
+                                    local_img_attrs->by_definition[def - refs->defs] = entry;
                                 }
                             }
-                            /* If this reference definition has attributes, we'll remove it from output */
-                            /* (attributes are stored and will be applied via expansion) */
-                            /* If it doesn't have attributes, we need to write it back so cmark can resolve it */
-                            /* Check if we created an entry (either with attrs or detected IAL) */
-                            bool created_entry = false;
-                            if (do_image_attrs && ref_name) {
-                                bool has_attrs = (attrs != NULL);
-                                created_entry = (has_attrs || found_ial);
+                            free(title_text);
+
+                            /* Write back the reference definition with encoded URL (so cmark can resolve it) */
+                            /* Write the reference up to URL */
+                            size_t prefix_len = url_start - ref_start;
+                            if (prefix_len < remaining) {
+                                memcpy(write, ref_start, prefix_len);
+                                write += prefix_len;
+                                remaining -= prefix_len;
                             }
-                            bool should_remove = (created_entry && do_image_attrs);
-
-                            if (should_remove) {
-                                /* Reference definitions with attributes are removed from output (like ALDs) */
-                                /* Skip the entire line - don't write anything back */
-                                free(ref_name);
-                                if (title_text) free(title_text);
-                                const char *p = line_end;
-                                /* Skip the newline */
-                                if (*p == '\n') {
-                                    p++;
-                                } else if (*p == '\r') {
-                                    if (p[1] == '\n') {
-                                        p += 2;
-                                    } else {
-                                        p++;
-                                    }
-                                }
-                                read = p;
+
+                            /* Write encoded URL */
+                            size_t encoded_len = strlen(encoded_url);
+                            if (encoded_len < remaining) {
+                                memcpy(write, encoded_url, encoded_len);
+                                write += encoded_len;
+                                remaining -= encoded_len;
                             } else {
-                                /* Write back the reference definition with encoded URL (so cmark can resolve it) */
-                                /* Write the reference up to URL */
-                                size_t prefix_len = url_start - ref_start;
-                                if (prefix_len < remaining) {
-                                    memcpy(write, ref_start, prefix_len);
-                                    write += prefix_len;
-                                    remaining -= prefix_len;
+                                size_t written = write - output;
+                                capacity = (written + encoded_len + 1) * 2;
+                                char *new_output = realloc(output, capacity);
+                                if (!new_output) {
+                                    free(output);
+                                    free(url);
+                                    free(encoded_url);
+                                    free(ref_name);
+                                    if (attrs) apex_free_attributes(attrs);
+                                    apex_free_image_attributes(local_img_attrs);
+                                    return NULL;
                                 }
+                                output = new_output;
+                                write = output + written;
+                                remaining = capacity - written;
+                                memcpy(write, encoded_url, encoded_len);
+                                write += encoded_len;
+                                remaining -= encoded_len;
+                            }
 
-                                /* Write encoded URL */
-                                size_t encoded_len = strlen(encoded_url);
-                                if (encoded_len < remaining) {
-                                    memcpy(write, encoded_url, encoded_len);
-                                    write += encoded_len;
-                                    remaining -= encoded_len;
+                            /* Write the rest (title if present, but skip IAL if it was processed) */
+                            const char *rest_end = strip_attributes ? url_end : (title_end ? title_end : line_end);
+                            const char *rest_start = url_end;
+                            while (rest_start < rest_end) {
+                                if (remaining > 0) {
+                                    *write++ = *rest_start++;
+                                    remaining--;
                                 } else {
                                     size_t written = write - output;
-                                    capacity = (written + encoded_len + 1) * 2;
+                                    size_t rest_len = rest_end - rest_start;
+                                    capacity = (written + rest_len + 1) * 2;
                                     char *new_output = realloc(output, capacity);
                                     if (!new_output) {
                                         free(output);
@@ -2590,63 +2744,33 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
                                     output = new_output;
                                     write = output + written;
                                     remaining = capacity - written;
-                                    memcpy(write, encoded_url, encoded_len);
-                                    write += encoded_len;
-                                    remaining -= encoded_len;
-                                }
-
-                                /* Write the rest (title if present, but skip IAL if it was processed) */
-                                const char *rest_end = title_end ? title_end : line_end;
-                                const char *rest_start = url_end;
-                                while (rest_start < rest_end) {
-                                    if (remaining > 0) {
-                                        *write++ = *rest_start++;
-                                        remaining--;
-                                    } else {
-                                        size_t written = write - output;
-                                        size_t rest_len = rest_end - rest_start;
-                                        capacity = (written + rest_len + 1) * 2;
-                                        char *new_output = realloc(output, capacity);
-                                        if (!new_output) {
-                                            free(output);
-                                            free(url);
-                                            free(encoded_url);
-                                            free(ref_name);
-                                            if (attrs) apex_free_attributes(attrs);
-                                            apex_free_image_attributes(local_img_attrs);
-                                            return NULL;
-                                        }
-                                        output = new_output;
-                                        write = output + written;
-                                        remaining = capacity - written;
-                                    }
                                 }
+                            }
 
-                                /* Advance read past the line (including IAL if it was processed) */
-                                const char *p = title_end ? title_end : line_end;
+                            /* Advance read past the line (including IAL if it was processed) */
+                            const char *p = (strip_attributes || !title_end) ? line_end : title_end;
 
-                                /* Write newline */
-                                if (*p == '\n' && remaining > 0) {
+                            /* Write newline */
+                            if (*p == '\n' && remaining > 0) {
+                                *write++ = *p++;
+                                remaining--;
+                            } else if (*p == '\n') {
+                                p++;
+                            } else if (*p == '\r') {
+                                if (p[1] == '\n' && remaining >= 2) {
+                                    *write++ = *p++;
+                                    *write++ = *p++;
+                                    remaining -= 2;
+                                } else if (remaining > 0) {
                                     *write++ = *p++;
                                     remaining--;
-                                } else if (*p == '\n') {
+                                } else {
                                     p++;
-                                } else if (*p == '\r') {
-                                    if (p[1] == '\n' && remaining >= 2) {
-                                        *write++ = *p++;
-                                        *write++ = *p++;
-                                        remaining -= 2;
-                                    } else if (remaining > 0) {
-                                        *write++ = *p++;
-                                        remaining--;
-                                    } else {
-                                        p++;
-                                    }
                                 }
-
-                                read = p;
-                                free(ref_name);
                             }
+
+                            read = p;
+                            free(ref_name);
                             free(encoded_url);
                             if (attrs) apex_free_attributes(attrs);
                         }
@@ -2821,498 +2945,74 @@ char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_
 
     *write = '\0';
 
-    /* Second pass: expand reference-style images that have attributes */
-    /* We need to expand ![ref][img1] to ![ref](url attributes) for definitions with attributes */
-    /* After expansion, we need to reprocess the expanded inline images */
-    if (do_image_attrs && local_img_attrs) {
-        char *expanded_output = malloc(strlen(output) * 3 + 1);
-        if (expanded_output) {
-            const char *read2 = output;
-            char *write2 = expanded_output;
-            size_t remaining2 = strlen(output) * 3;
-            bool made_expansions = false;
-
-            while (*read2) {
-                /* Look for reference-style images: ![alt][ref] */
-                if (*read2 == '!' && read2[1] == '[') {
-                    const char *img_start = read2;
-                    read2 += 2; /* Skip ![ */
-
-                    /* Find closing ] for alt text */
-                    const char *alt_end = strchr(read2, ']');
-                    if (alt_end && alt_end[1] == '[') {
-                        /* Found ![alt][ */
-                        const char *ref_start = alt_end + 2; /* After ][ */
-                        const char *ref_end = strchr(ref_start, ']');
-                        if (ref_end) {
-                            /* Extract reference name */
-                            size_t ref_name_len = ref_end - ref_start;
-                            char *ref_name = malloc(ref_name_len + 1);
-                            if (ref_name) {
-                                memcpy(ref_name, ref_start, ref_name_len);
-                                ref_name[ref_name_len] = '\0';
-                                /* Trim whitespace from reference name */
-                                char *p = ref_name;
-                                while (*p && isspace((unsigned char)*p)) p++;
-                                if (p > ref_name) {
-                                    memmove(ref_name, p, strlen(p) + 1);
-                                }
-                                p = ref_name + strlen(ref_name) - 1;
-                                while (p >= ref_name && isspace((unsigned char)*p)) {
-                                    *p = '\0';
-                                    p--;
-                                }
-
-                                /* Look up if this reference has attributes */
-                                image_attr_entry *def_entry = find_image_attr_by_ref(local_img_attrs, ref_name);
-                                if (def_entry && def_entry->url) {
-                                    /* Expand to inline image: ![alt](url attributes) */
-                                    /* Extract alt text */
-                                    size_t alt_len = alt_end - read2;
-
-                                    /* Convert attributes to markdown format */
-                                    char *attr_str = attributes_to_markdown(def_entry->attrs);
-
-                                    /* Build expanded image: ![alt](url attributes) */
-                                    /* Need space for: ![ + alt + ]( + url + space + attr_str + ) */
-                                    size_t url_len = strlen(def_entry->url);
-                                    size_t attr_len = attr_str ? strlen(attr_str) : 0;
-                                    size_t needed = 4 + alt_len + url_len + (attr_len > 0 ? attr_len + 1 : 0) + 1;
-
-                                    /* Check if we need to expand buffer */
-                                    if (remaining2 < needed) {
-                                        size_t written = write2 - expanded_output;
-                                        size_t new_cap = (written + needed + 1) * 2;
-                                        char *new_expanded = realloc(expanded_output, new_cap);
-                                        if (new_expanded) {
-                                            expanded_output = new_expanded;
-                                            write2 = expanded_output + written;
-                                            remaining2 = new_cap - written;
-                                        }
-                                    }
-
-                                    if (remaining2 >= needed) {
-                                        made_expansions = true;
-
-                                        /* Write ![alt](url */
-                                        *write2++ = '!';
-                                        *write2++ = '[';
-                                        remaining2 -= 2;
-                                        memcpy(write2, read2, alt_len);
-                                        write2 += alt_len;
-                                        remaining2 -= alt_len;
-                                        *write2++ = ']';
-                                        *write2++ = '(';
-                                        remaining2 -= 2;
-
-                                        /* Write URL */
-                                        memcpy(write2, def_entry->url, url_len);
-                                        write2 += url_len;
-                                        remaining2 -= url_len;
-
-                                        /* Write attributes if present (inside parentheses for inline format) */
-                                        if (attr_str && *attr_str) {
-                                            *write2++ = ' ';
-                                            remaining2--;
-                                            memcpy(write2, attr_str, attr_len);
-                                            write2 += attr_len;
-                                            remaining2 -= attr_len;
-                                        }
-
-                                        *write2++ = ')';
-                                        remaining2--;
-
-                                        read2 = ref_end + 1;
-                                        free(ref_name);
-                                        free(attr_str);
-                                        continue;
-                                    }
-                                    free(attr_str);
-                                }
-                                free(ref_name);
-                            }
-                        }
-                    }
-                    /* Not a reference-style image with attributes, or expansion failed - copy as-is */
-                    read2 = img_start;
-                }
-
-                /* Copy character */
-                if (remaining2 > 0) {
-                    *write2++ = *read2++;
-                    remaining2--;
-                } else {
-                    read2++;
-                }
-            }
-
-            *write2 = '\0';
-            free(output);
-            output = expanded_output;
-
-            /* If we made expansions, we need to extract attributes from the expanded inline images */
-            /* Process the expanded output to extract attributes from newly created inline images */
-            if (made_expansions) {
-                /* Create a temporary buffer to process expanded inline images */
-                const char *proc_read = output;
-                char *proc_output = malloc(strlen(output) * 2 + 1);
-                if (proc_output) {
-                    char *proc_write = proc_output;
-                    size_t proc_remaining = strlen(output) * 2;
-
-                    while (*proc_read) {
-                        /* Look for inline images that were just expanded */
-                        if (*proc_read == '!' && proc_read[1] == '[') {
-                            const char *img_start = proc_read;
-                            const char *check_pos = proc_read + 2; /* After ![ */
-
-                            /* Find closing ] for alt text */
-                            const char *alt_end = strchr(check_pos, ']');
-                            if (alt_end && alt_end[1] == '(') {
-                                const char *url_start = alt_end + 2;
-                                const char *p = url_start;
-                                const char *url_end = NULL;
-                                const char *attr_start = NULL;
-                                const char *paren_end = NULL;
-
-                                /* Find closing paren */
-                                while (*p && *p != ')' && *p != '\n') p++;
-                                if (*p == ')') {
-                                    paren_end = p;
-                                    p = url_start;
-
-                                    /* Look for attributes */
-                                    while (p < paren_end) {
-                                        if (*p == ' ' || *p == '\t') {
-                                            const char *after_space = p;
-                                            while (after_space < paren_end && (*after_space == ' ' || *after_space == '\t')) after_space++;
-                                            if (after_space < paren_end && looks_like_attribute_start(after_space, paren_end)) {
-                                                attr_start = after_space;
-                                                url_end = p;
-                                                break;
-                                            }
-                                        }
-                                        p++;
-                                    }
-
-                                    if (!url_end) url_end = paren_end;
-
-                                    /* Only process images with attributes (these are the expanded reference-style images) */
-                                    /* Images without attributes were already processed in the first pass */
-                                    if (url_end > url_start && attr_start) {
-                                        /* Extract URL and attributes */
-                                        size_t url_len = url_end - url_start;
-                                        char *url = malloc(url_len + 1);
-                                        char *encoded_url = NULL;
-                                        apex_attributes *attrs = NULL;
-
-                                        if (url) {
-                                            memcpy(url, url_start, url_len);
-                                            url[url_len] = '\0';
-
-                                            size_t attr_len = paren_end - attr_start;
-                                            attrs = parse_image_attributes(attr_start, attr_len);
-
-                                            /* URL is already encoded from expansion, so use as-is */
-                                            encoded_url = strdup(url);
-                                            if (encoded_url && attrs) {
-                                                /* Count existing entries to get index */
-                                                int img_index = 0;
-                                                for (image_attr_entry *e = local_img_attrs; e; e = e->next) {
-                                                    if (e->index >= 0) img_index++;
-                                                }
-
-                                                image_attr_entry *entry = create_image_attr_entry(&local_img_attrs, encoded_url, img_index);
-                                                if (entry) {
-                                                    /* Copy attributes */
-                                                    for (int i = 0; i < attrs->attr_count; i++) {
-                                                        add_attribute(entry->attrs, attrs->keys[i], attrs->values[i]);
-                                                    }
-                                                    if (attrs->id) {
-                                                        entry->attrs->id = strdup(attrs->id);
-                                                    }
-                                                    for (int i = 0; i < attrs->class_count; i++) {
-                                                        add_class(entry->attrs, attrs->classes[i]);
-                                                    }
-                                                }
-                                            }
-
-                                            /* Write the processed image: ![alt](encoded_url) - attributes removed */
-                                            size_t prefix_len = url_start - img_start; /* Includes ![alt]( */
-                                            if (prefix_len < proc_remaining) {
-                                                memcpy(proc_write, img_start, prefix_len);
-                                                proc_write += prefix_len;
-                                                proc_remaining -= prefix_len;
-                                            } else {
-                                                /* Buffer too small - skip this image */
-                                                if (attrs) apex_free_attributes(attrs);
-                                                free(encoded_url);
-                                                free(url);
-                                                proc_read = paren_end + 1;
-                                                continue;
-                                            }
-
-                                            /* Write encoded URL (already encoded, so write as-is) */
-                                            size_t encoded_len = strlen(encoded_url ? encoded_url : url);
-                                            if (encoded_len < proc_remaining) {
-                                                memcpy(proc_write, encoded_url ? encoded_url : url, encoded_len);
-                                                proc_write += encoded_len;
-                                                proc_remaining -= encoded_len;
-                                            } else {
-                                                if (attrs) apex_free_attributes(attrs);
-                                                free(encoded_url);
-                                                free(url);
-                                                proc_read = paren_end + 1;
-                                                continue;
-                                            }
+    /* Return the image attributes */
+    resolve_reference_images(local_img_attrs);
+    *img_attrs = local_img_attrs;
 
-                                            /* Write closing paren */
-                                            if (proc_remaining > 0) {
-                                                *proc_write++ = ')';
-                                                proc_remaining--;
-                                            }
+    return output;
+}
 
-                                            /* Cleanup */
-                                            if (attrs) apex_free_attributes(attrs);
-                                            free(encoded_url);
-                                            free(url);
+/**
+ * Preprocess markdown to extract image attributes and URL-encode all link URLs
+ */
+char *apex_preprocess_image_attributes(const char *text, apex_image_attrs **img_attrs, apex_mode_t mode) {
+    if (!text || !img_attrs) return NULL;
 
-                                            /* Advance past the processed image */
-                                            proc_read = paren_end + 1;
-                                            continue;
-                                        }
-                                    }
-                                }
-                            }
-                            /* Not a valid inline image, or no attributes (already processed in first pass) - fall through to copy */
-                        }
+    /* Check if we should do URL encoding */
+    bool do_url_encoding = (mode == APEX_MODE_UNIFIED ||
+                            mode == APEX_MODE_MULTIMARKDOWN ||
+                            mode == APEX_MODE_KRAMDOWN);
 
-                        /* Copy character - this handles regular text and inline images without attributes */
-                        if (proc_remaining > 0) {
-                            *proc_write++ = *proc_read++;
-                            proc_remaining--;
-                        } else {
-                            proc_read++;
-                        }
-                    }
+    /* Check if we should process image attributes */
+    bool do_image_attrs = (mode == APEX_MODE_UNIFIED ||
+                           mode == APEX_MODE_MULTIMARKDOWN);
 
-                    *proc_write = '\0';
-                    free(output);
-                    output = proc_output;
-                }
-            }
-        }
+    if (!do_url_encoding && !do_image_attrs) {
+        /* Nothing to do */
+        return NULL;
     }
 
-    /* Return the image attributes list */
-    *img_attrs = local_img_attrs;
+    /* Reference definitions tell which ![alt][ref] images cmark will make */
+    apex_reference_defs refs = APEX_REFERENCE_DEFS_INIT;
+    if (do_image_attrs) apex_reference_defs_scan(&refs, text);
 
+    char *output = preprocess_image_attributes(text, img_attrs, do_url_encoding, do_image_attrs, &refs);
+    apex_reference_defs_free(&refs);
     return output;
 }
 
 /**
  * Apply image attributes to image nodes in AST
- * Uses two matching strategies:
- * 1. First tries to match by index (position) for inline images
- * 2. Then tries to match by URL for reference-style images
- * This ensures inline images with same URL get different attributes,
- * while reference-style images share attributes from their definition.
+ * Images are matched by position only, so an image never picks up the
+ * attributes of another image or definition that shares its URL.
  */
-void apex_apply_image_attributes(cmark_node *document, image_attr_entry *img_attrs) {
-    if (!document || !img_attrs) return;
+void apex_apply_image_attributes(cmark_node *document, const apex_image_attrs *img_attrs) {
+    if (!document || !img_attrs || !img_attrs->entries) return;
 
     cmark_iter *iter = cmark_iter_new(document);
     cmark_event_type event;
     int image_index = 0;  /* Track position of images in document */
-    bool *used_by_index = NULL;
-    int attr_count = 0;
-
-    /* Count attributes and allocate used array */
-    for (image_attr_entry *e = img_attrs; e; e = e->next) attr_count++;
-    if (attr_count > 0) {
-        used_by_index = calloc(attr_count, sizeof(bool));
-    }
 
     while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
         cmark_node *node = cmark_iter_get_node(iter);
         if (event == CMARK_EVENT_ENTER && cmark_node_get_type(node) == CMARK_NODE_IMAGE) {
-            const char *url = cmark_node_get_url(node);
-            image_attr_entry *matching = NULL;
-
-            /* First try to match by index (for inline images, index >= 0) */
-            int idx = 0;
-            for (image_attr_entry *e = img_attrs; e; e = e->next, idx++) {
-                if (e->index >= 0 && e->index == image_index && !used_by_index[idx]) {
-                    matching = e;
-                    used_by_index[idx] = true;
-                    break;
-                }
-            }
-
-            /* If no match by index, try by URL (for reference-style images, index == -1) */
-            if (!matching && url) {
-                idx = 0;
-                for (image_attr_entry *e = img_attrs; e; e = e->next, idx++) {
-                    if (e->index == -1 && !used_by_index[idx] && e->url && strcmp(e->url, url) == 0) {
-                        /* Reference-style: don't mark as used, so it can match multiple images */
-                        matching = e;
-                        /* Don't set used_by_index for reference-style - they can be reused */
-                        break;
-                    }
-                }
+            const image_attr_entry *matching = NULL;
+            if (image_index < img_attrs->index_capacity) {
+                matching = img_attrs->by_index[image_index];
             }
 
             if (matching && matching->attrs) {
                 /* Apply attributes to this image */
-                char *attr_str = attributes_to_html(matching->attrs);
-                if (attr_str) {
-                    /* Merge with existing user_data if present */
-                    char *existing = (char *)cmark_node_get_user_data(node);
-                    if (existing) {
-                        char *combined = malloc(strlen(existing) + strlen(attr_str) + 2);
-                        if (combined) {
-                            strcpy(combined, existing);
-                            strcat(combined, " ");
-                            strcat(combined, attr_str);
-                            cmark_node_set_user_data(node, combined);
-                            free(attr_str);
-                        } else {
-                            cmark_node_set_user_data(node, attr_str);
-                        }
-                    } else {
-                        cmark_node_set_user_data(node, attr_str);
-                    }
-                }
+                apex_attributes_merge(apex_node_ensure_attributes(node), matching->attrs);
             }
 
             image_index++;  /* Move to next image */
         }
     }
 
-    free(used_by_index);
     cmark_iter_free(iter);
 }
 
-/**
- * Extract reference link definition IDs from text
- * Returns a hash set (simple array) of reference IDs
- * Caller must free the returned array
- */
-static char **extract_reference_link_ids(const char *text, size_t *count) {
-    if (!text || !count) return NULL;
-
-    *count = 0;
-    size_t capacity = 16;
-    char **ids = malloc(capacity * sizeof(char*));
-    if (!ids) return NULL;
-
-    const char *p = text;
-    while (*p) {
-        const char *line_start = p;
-        const char *line_end = strchr(p, '\n');
-        if (!line_end) line_end = p + strlen(p);
-
-        /* Skip leading whitespace */
-        const char *content_start = line_start;
-        while (content_start < line_end && (*content_start == ' ' || *content_start == '\t')) {
-            content_start++;
-        }
-
-        /* Check if this is a reference link definition: [id]: URL */
-        if (content_start < line_end && *content_start == '[') {
-            const char *id_end = strchr(content_start + 1, ']');
-            if (id_end && id_end < line_end && id_end[1] == ':') {
-                /* Extract the ID from this definition */
-                size_t def_id_len = id_end - (content_start + 1);
-                if (def_id_len > 0) {
-                    char *def_id = malloc(def_id_len + 1);
-                    if (def_id) {
-                        memcpy(def_id, content_start + 1, def_id_len);
-                        def_id[def_id_len] = '\0';
-
-                        /* Check if we already have this ID */
-                        bool found = false;
-                        for (size_t i = 0; i < *count; i++) {
-                            if (strcmp(ids[i], def_id) == 0) {
-                                found = true;
-                                free(def_id);
-                                break;
-                            }
-                        }
-
-                        if (!found) {
-                            /* Add to array */
-                            if (*count >= capacity) {
-                                capacity *= 2;
-                                char **new_ids = realloc(ids, capacity * sizeof(char*));
-                                if (!new_ids) {
-                                    free(def_id);
-                                    break;
-                                }
-                                ids = new_ids;
-                            }
-                            ids[*count] = def_id;
-                            (*count)++;
-                        }
-                    }
-                }
-            }
-        }
-
-        p = (*line_end == '\n') ? line_end + 1 : line_end;
-    }
-
-    return ids;
-}
-
-/**
- * Check if a reference ID matches the given text (case-insensitive, whitespace normalized)
- */
-static bool reference_id_matches(const char *ref_id, const char *text, size_t text_len) {
-    if (!ref_id || !text) return false;
-
-    const char *p = ref_id;
-    const char *t = text;
-    size_t remaining = text_len;
-
-    /* Skip leading whitespace in both */
-    while (*p && isspace((unsigned char)*p)) p++;
-    while (remaining > 0 && isspace((unsigned char)*t)) {
-        t++;
-        remaining--;
-    }
-
-    /* Compare character by character (case-insensitive) */
-    while (*p && remaining > 0) {
-        if (tolower((unsigned char)*p) != tolower((unsigned char)*t)) {
-            /* Check if difference is just whitespace */
-            if (isspace((unsigned char)*p) && isspace((unsigned char)*t)) {
-                /* Both are whitespace - skip and continue */
-                while (*p && isspace((unsigned char)*p)) p++;
-                while (remaining > 0 && isspace((unsigned char)*t)) {
-                    t++;
-                    remaining--;
-                }
-                continue;
-            }
-            return false;
-        }
-        p++;
-        t++;
-        remaining--;
-    }
-
-    /* Skip trailing whitespace in both */
-    while (*p && isspace((unsigned char)*p)) p++;
-    while (remaining > 0 && isspace((unsigned char)*t)) {
-        t++;
-        remaining--;
-    }
-
-    /* Both should be at end */
-    return (*p == '\0' && remaining == 0);
-}
-
 /**
  * Preprocess bracketed spans [text]{IAL}
  * Converts [text]{IAL} to <span markdown="span" ...>text</span> if [text] is not a reference link
@@ -3320,21 +3020,15 @@ static bool reference_id_matches(const char *ref_id, const char *text, size_t te
 char *apex_preprocess_bracketed_spans(const char *text) {
     if (!text) return NULL;
 
-    /* First, extract all reference link definition IDs */
-    size_t ref_count = 0;
-    char **ref_ids = extract_reference_link_ids(text, &ref_count);
+    /* First, index the reference link definitions */
+    apex_reference_defs refs = APEX_REFERENCE_DEFS_INIT;
+    apex_reference_defs_scan(&refs, text);
 
     size_t text_len = strlen(text);
     size_t output_capacity = text_len * 2;  /* Worst case: every char becomes part of HTML */
     char *output = malloc(output_capacity);
     if (!output) {
-        /* Free ref_ids */
-        if (ref_ids) {
-            for (size_t i = 0; i < ref_count; i++) {
-                free(ref_ids[i]);
-            }
-            free(ref_ids);
-        }
+        apex_reference_defs_free(&refs);
         return NULL;
     }
 
@@ -3420,23 +3114,20 @@ char *apex_preprocess_bracketed_spans(const char *text) {
                             bracket_text[text_len] = '\0';
 
                             /* Check if this matches a reference link definition */
-                            bool is_reference_link = false;
-                            for (size_t i = 0; i < ref_count; i++) {
-                                if (reference_id_matches(ref_ids[i], bracket_text, text_len)) {
-                                    is_reference_link = true;
-                                    break;
-                                }
-                            }
+                            bool is_reference_link = apex_reference_defs_find(&refs, bracket_text, text_len) != NULL;
 
                             if (!is_reference_link) {
                                 /* This is a bracketed span - convert to <span> */
                                 /* Parse IAL attributes */
                                 size_t ial_len = ial_end - (ial_start + 1);
-                                apex_attributes *attrs = parse_ial_content(ial_start + 1, ial_len);
+                                apex_attributes *attrs = apex_parse_ial_content(ial_start + 1, ial_len);
 
                                 if (attrs) {
                                     /* Build span tag with attributes */
-                                    char *attr_str = attributes_to_html(attrs);
+                                    apex_buffer rendered;
+                                    apex_buffer_init(&rendered, 64);
+                                    apex_attributes_render(attrs, &rendered);
+                                    char *attr_str = rendered.data;
                                     if (attr_str) {
                                         /* Calculate space needed */
                                         size_t span_open_len = 20 + strlen(attr_str) + strlen(bracket_text) + 10; /* <span markdown="span" ...>text</span> */
@@ -3446,7 +3137,7 @@ char *apex_preprocess_bracketed_spans(const char *text) {
                                             char *new_output = realloc(output, output_capacity);
                                             if (!new_output) {
                                                 free(bracket_text);
-                                                free(attr_str);
+                                                apex_buffer_free(&rendered);
                                                 apex_free_attributes(attrs);
                                                 goto cleanup;
                                             }
@@ -3477,7 +3168,7 @@ char *apex_preprocess_bracketed_spans(const char *text) {
                                             remaining -= 7;
                                         }
 
-                                        free(attr_str);
+                                        apex_buffer_free(&rendered);
                                         read = ial_end + 1;  /* Skip past the IAL */
                                         free(bracket_text);
                                         apex_free_attributes(attrs);
@@ -3517,13 +3208,7 @@ char *apex_preprocess_bracketed_spans(const char *text) {
     *write = '\0';
 
 cleanup:
-    /* Free ref_ids */
-    if (ref_ids) {
-        for (size_t i = 0; i < ref_count; i++) {
-            free(ref_ids[i]);
-        }
-        free(ref_ids);
-    }
+    apex_reference_defs_free(&refs);
 
     /* Check if we made any changes */
     if (strcmp(output, text) == 0) {
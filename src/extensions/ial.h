@@ -12,7 +12,9 @@
 #define APEX_IAL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "cmark-gfm.h"
+#include "apex/buffer.h"
 
 /* Forward declaration - actual definition in apex/apex.h */
 #ifndef APEX_MODE_DEFINED
@@ -30,16 +32,32 @@ typedef enum {
 extern "C" {
 #endif
 
+struct apex_arena;
+
 /**
  * Attribute structure
+ *
+ * Attributes attached to a node (IAL, ALDs, image attributes, manual
+ * header IDs, table captions) are kept in this form in the node's
+ * user_data and only turned into HTML when the document is rendered.
+ * Use the functions below to change them: they keep the key index up
+ * to date.
  */
 typedef struct apex_attributes {
     char *id;                  /* Element ID */
     char **classes;            /* Array of class names */
     int class_count;
-    char **keys;               /* Key-value pairs */
+    const char **keys;         /* Key-value pairs (well-known keys are interned) */
     char **values;
     int attr_count;
+    char *caption;             /* Table caption; rendered as a figcaption, not an attribute */
+    bool remove;               /* Element is left out of the output (caption rows) */
+
+    int class_capacity;
+    int attr_capacity;
+    int *key_slots;            /* Hash index of keys: attribute index + 1, 0 when empty */
+    int slot_capacity;         /* Power of two, or 0 before the first key */
+    struct apex_arena *arena;  /* Owner of every allocation here, or NULL for malloc */
 } apex_attributes;
 
 /**
@@ -60,8 +78,10 @@ char *apex_preprocess_ial(const char *text);
 /**
  * Extract ALDs from text (preprocessing)
  * Pattern: {:ref-name: #id .class key="value"}
+ * *stripped receives a new copy of text without the ALD lines, or NULL
+ * when there were none (text is then used as is)
  */
-ald_entry *apex_extract_alds(char **text_ptr);
+ald_entry *apex_extract_alds(const char *text, char **stripped);
 
 /**
  * Process IAL in AST (postprocessing)
@@ -75,20 +95,71 @@ void apex_process_ial_in_tree(cmark_node *document, ald_entry *alds);
 void apex_free_alds(ald_entry *alds);
 
 /**
- * Free attributes structure
+ * Free attributes structure (arena-backed attributes go with their arena)
  */
 void apex_free_attributes(apex_attributes *attrs);
 
 /**
- * Image attribute entry (stored in document order for matching)
+ * Create empty attributes allocated from arena, or with malloc when NULL
+ */
+apex_attributes *apex_attributes_new(struct apex_arena *arena);
+
+/**
+ * Parse IAL/ALD content (#id .class key="value", without the braces)
+ * @return Attributes allocated with malloc, or NULL
+ */
+apex_attributes *apex_parse_ial_content(const char *content, size_t len);
+
+void apex_attributes_set_id(apex_attributes *attrs, const char *id);
+void apex_attributes_add_class(apex_attributes *attrs, const char *class_name);
+bool apex_attributes_has_class(const apex_attributes *attrs, const char *class_name);
+void apex_attributes_set_caption(apex_attributes *attrs, const char *caption);
+
+/**
+ * Set key to value, replacing an existing value for the same key
+ */
+void apex_attributes_set(apex_attributes *attrs, const char *key, const char *value);
+
+/**
+ * Value of key, or NULL
+ */
+const char *apex_attributes_get(const apex_attributes *attrs, const char *key);
+
+/**
+ * Apply override on top of attrs: its ID and values replace those in
+ * attrs and its classes are appended
+ */
+void apex_attributes_merge(apex_attributes *attrs, const apex_attributes *override);
+
+/**
+ * Attributes attached to node, or NULL
+ */
+apex_attributes *apex_node_attributes(cmark_node *node);
+
+/**
+ * Attributes attached to node, attaching empty ones first if needed.
+ * New attributes come from the current conversion arena, like the node.
+ */
+apex_attributes *apex_node_ensure_attributes(cmark_node *node);
+
+/**
+ * Free the malloc-backed attributes attached to root and its descendants.
+ * Call before freeing a tree that was not built in an arena.
+ */
+void apex_free_node_attributes(cmark_node *root);
+
+/**
+ * Append attrs as HTML attributes, each preceded by a space. The caption
+ * and removal mark are not attributes and are left out.
+ * @return true if anything was appended
+ */
+bool apex_attributes_render(const apex_attributes *attrs, apex_buffer *out);
+
+/**
+ * Image attributes found by apex_preprocess_image_attributes, indexed by
+ * image position; reference-style images share their definition's attributes
  */
-typedef struct image_attr_entry {
-    char *url;                  /* Encoded URL (for reference) */
-    apex_attributes *attrs;     /* Attributes for this image */
-    int index;                  /* Position in document (0-based for inline, -1 for reference-style) */
-    char *ref_name;             /* Reference name (for reference-style definitions) */
-    struct image_attr_entry *next;
-} image_attr_entry;
+typedef struct apex_image_attrs apex_image_attrs;
 
 /**
  * Preprocess markdown to extract image attributes and URL-encode all link URLs
@@ -98,21 +169,21 @@ typedef struct image_attr_entry {
  * - URL encoding for all links (images and regular links)
  *
  * @param text Input markdown text
- * @param img_attrs Output: list of image attributes extracted
+ * @param img_attrs Output: image attributes extracted (free with apex_free_image_attributes)
  * @param mode Processing mode to determine which features to enable
  * @return Preprocessed markdown text (must be freed by caller)
  */
-char *apex_preprocess_image_attributes(const char *text, image_attr_entry **img_attrs, apex_mode_t mode);
+char *apex_preprocess_image_attributes(const char *text, apex_image_attrs **img_attrs, apex_mode_t mode);
 
 /**
- * Free image attribute list
+ * Free image attributes
  */
-void apex_free_image_attributes(image_attr_entry *img_attrs);
+void apex_free_image_attributes(apex_image_attrs *img_attrs);
 
 /**
  * Apply image attributes to image nodes in AST
  */
-void apex_apply_image_attributes(cmark_node *document, image_attr_entry *img_attrs);
+void apex_apply_image_attributes(cmark_node *document, const apex_image_attrs *img_attrs);
 
 /**
  * Preprocess bracketed spans [text]{IAL}
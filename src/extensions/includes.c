@@ -5,14 +5,17 @@
 
 #include "includes.h"
 #include "metadata.h"
+#include "apex/apex.h"  /* For apex_include_cache_clear */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <libgen.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 #include <strings.h>
 #include <regex.h>
 #include <glob.h>
@@ -20,7 +23,7 @@
 /**
  * Read file contents
  */
-static char *read_file_contents(const char *filepath) {
+static char *read_file_uncached(const char *filepath) {
     FILE *fp = fopen(filepath, "rb");
     if (!fp) return NULL;
 
@@ -48,6 +51,157 @@ static char *read_file_contents(const char *filepath) {
     return content;
 }
 
+/**
+ * Process-level cache of included files
+ *
+ * Each included file is read once per process and revalidated against
+ * mtime and size, so batch runs and watch mode expand unchanged includes
+ * without touching the disk again. Entries are hashed by path and kept in
+ * least-recently-used order; past the byte cap the oldest are dropped.
+ * Shared by all threads and guarded by include_cache_lock.
+ */
+#define INCLUDE_CACHE_BUCKETS 256
+#define INCLUDE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct include_cache_entry {
+    char *path;
+    time_t mtime;
+    off_t size;
+    char *content;
+    size_t content_len;
+    struct include_cache_entry *next;       /* Bucket chain */
+    struct include_cache_entry *newer;      /* LRU list */
+    struct include_cache_entry *older;
+} include_cache_entry;
+
+static include_cache_entry *include_cache[INCLUDE_CACHE_BUCKETS];
+static include_cache_entry *include_cache_newest = NULL;
+static include_cache_entry *include_cache_oldest = NULL;
+static size_t include_cache_bytes = 0;
+static pthread_mutex_t include_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int include_cache_hash(const char *path) {
+    unsigned int hash = 2166136261u;  /* FNV-1a */
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash % INCLUDE_CACHE_BUCKETS;
+}
+
+/* The functions below are called with include_cache_lock held */
+
+static include_cache_entry *include_cache_find(const char *path, unsigned int bucket) {
+    include_cache_entry *entry = include_cache[bucket];
+    while (entry && strcmp(entry->path, path) != 0) entry = entry->next;
+    return entry;
+}
+
+static void include_cache_unlink_lru(include_cache_entry *entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else include_cache_newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else include_cache_oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void include_cache_push_newest(include_cache_entry *entry) {
+    entry->older = include_cache_newest;
+    entry->newer = NULL;
+    if (include_cache_newest) include_cache_newest->newer = entry;
+    include_cache_newest = entry;
+    if (!include_cache_oldest) include_cache_oldest = entry;
+}
+
+static void include_cache_remove(include_cache_entry *entry) {
+    include_cache_entry **link = &include_cache[include_cache_hash(entry->path)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+    include_cache_unlink_lru(entry);
+    include_cache_bytes -= entry->content_len;
+    free(entry->content);
+    free(entry->path);
+    free(entry);
+}
+
+static void include_deps_note(const apex_include_deps *deps, const char *path) {
+    if (deps && deps->fn) deps->fn(path, deps->user_data);
+}
+
+static char *read_file_contents(const char *filepath, const apex_include_deps *deps) {
+    include_deps_note(deps, filepath);
+
+    struct stat st;
+    if (stat(filepath, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return read_file_uncached(filepath);
+    }
+
+    unsigned int bucket = include_cache_hash(filepath);
+    pthread_mutex_lock(&include_cache_lock);
+    include_cache_entry *entry = include_cache_find(filepath, bucket);
+    if (entry && entry->mtime == st.st_mtime && entry->size == st.st_size) {
+        include_cache_unlink_lru(entry);
+        include_cache_push_newest(entry);
+        char *copy = malloc(entry->content_len + 1);
+        if (copy) memcpy(copy, entry->content, entry->content_len + 1);
+        pthread_mutex_unlock(&include_cache_lock);
+        return copy;
+    }
+    pthread_mutex_unlock(&include_cache_lock);
+
+    char *content = read_file_uncached(filepath);
+    if (!content) return NULL;
+    size_t content_len = strlen(content);
+    if (content_len > INCLUDE_CACHE_MAX_BYTES) return content;
+
+    include_cache_entry *added = calloc(1, sizeof(include_cache_entry));
+    if (!added) return content;
+    added->path = strdup(filepath);
+    added->content = malloc(content_len + 1);
+    if (!added->path || !added->content) {
+        free(added->path);
+        free(added->content);
+        free(added);
+        return content;
+    }
+    memcpy(added->content, content, content_len + 1);
+    added->content_len = content_len;
+    added->mtime = st.st_mtime;
+    added->size = st.st_size;
+
+    /* Replace a stale entry, or one another thread added meanwhile */
+    pthread_mutex_lock(&include_cache_lock);
+    entry = include_cache_find(filepath, bucket);
+    if (entry) include_cache_remove(entry);
+    while (include_cache_oldest && include_cache_bytes + content_len > INCLUDE_CACHE_MAX_BYTES) {
+        include_cache_remove(include_cache_oldest);
+    }
+    added->next = include_cache[bucket];
+    include_cache[bucket] = added;
+    include_cache_push_newest(added);
+    include_cache_bytes += content_len;
+    pthread_mutex_unlock(&include_cache_lock);
+    return content;
+}
+
+void apex_include_cache_clear(void) {
+    pthread_mutex_lock(&include_cache_lock);
+    include_cache_entry *entry = include_cache_newest;
+    memset(include_cache, 0, sizeof(include_cache));
+    include_cache_newest = NULL;
+    include_cache_oldest = NULL;
+    include_cache_bytes = 0;
+    pthread_mutex_unlock(&include_cache_lock);
+
+    while (entry) {
+        include_cache_entry *older = entry->older;
+        free(entry->content);
+        free(entry->path);
+        free(entry);
+        entry = older;
+    }
+}
+
 /**
  * Resolve relative path from base directory
  */
@@ -74,18 +228,23 @@ static char *resolve_path(const char *filepath, const char *base_dir) {
 
 /**
  * Get directory of a file path
+ * Same result as dirname(3), which may return static storage and so
+ * isn't safe with concurrent conversions.
  */
 static char *get_directory(const char *filepath) {
     if (!filepath) return strdup(".");
 
-    char *path_copy = strdup(filepath);
-    if (!path_copy) return strdup(".");
-
-    char *dir = dirname(path_copy);
-    char *result = strdup(dir);
-    free(path_copy);
-
-    return result ? result : strdup(".");
+    size_t len = strlen(filepath);
+    while (len > 1 && filepath[len - 1] == '/') len--;   /* Trailing slashes */
+    while (len > 0 && filepath[len - 1] != '/') len--;   /* Last component */
+    if (len == 0) return strdup(".");
+    while (len > 1 && filepath[len - 1] == '/') len--;   /* Separator */
+
+    char *result = malloc(len + 1);
+    if (!result) return strdup(".");
+    memcpy(result, filepath, len);
+    result[len] = '\0';
+    return result;
 }
 
 /**
@@ -452,6 +611,566 @@ char *apex_csv_to_table(const char *csv_content, bool is_tsv) {
     return output;
 }
 
+/**
+ * Streaming CSV/TSV table includes
+ *
+ * Large CSV/TSV files can be included as HTML tables without going through
+ * Markdown. During preprocessing the include is recorded in the
+ * conversion's apex_csv_tables and replaced by a paragraph holding the
+ * list's token and the include's number, which renders the same with or
+ * without unsafe HTML. After rendering, apex_expand_csv_tables() reads each
+ * file row by row and writes the table HTML in place of its paragraph.
+ * Only one row is held in memory at a time.
+ */
+
+/**
+ * Growable output buffer for streamed tables
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} csv_out_t;
+
+static bool csv_out_reserve(csv_out_t *out, size_t extra) {
+    if (out->len + extra + 1 <= out->cap) return true;
+    size_t new_cap = out->cap ? out->cap : 4096;
+    while (new_cap < out->len + extra + 1) new_cap *= 2;
+    char *tmp = realloc(out->data, new_cap);
+    if (!tmp) return false;
+    out->data = tmp;
+    out->cap = new_cap;
+    return true;
+}
+
+static bool csv_out_append(csv_out_t *out, const char *s, size_t n) {
+    if (!csv_out_reserve(out, n)) return false;
+    memcpy(out->data + out->len, s, n);
+    out->len += n;
+    out->data[out->len] = '\0';
+    return true;
+}
+
+static bool csv_out_puts(csv_out_t *out, const char *s) {
+    return csv_out_append(out, s, strlen(s));
+}
+
+/* Append cell text with HTML escaping, trimming surrounding whitespace */
+static bool csv_out_append_escaped(csv_out_t *out, const char *s, size_t n) {
+    while (n > 0 && isspace((unsigned char)*s)) { s++; n--; }
+    while (n > 0 && isspace((unsigned char)s[n - 1])) n--;
+
+    const char *run = s;
+    for (size_t i = 0; i < n; i++) {
+        const char *entity = NULL;
+        switch (s[i]) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            default: break;
+        }
+        if (entity) {
+            if (!csv_out_append(out, run, (size_t)(s + i - run))) return false;
+            if (!csv_out_puts(out, entity)) return false;
+            run = s + i + 1;
+        }
+    }
+    return csv_out_append(out, run, (size_t)(s + n - run));
+}
+
+/**
+ * Row/column selection for a streamed table include
+ *
+ * Parsed from the include address, e.g. {{data.csv}}[rows=1-100 cols=Name,City]
+ */
+typedef struct {
+    long row_start;   /* 1-based first data row */
+    long row_end;     /* 1-based last data row, -1 means to end */
+    char cols[512];   /* Comma-separated column numbers or header names, empty for all */
+} csv_table_spec_t;
+
+/* Read a key=value option (value optionally quoted) from an address string */
+static bool csv_spec_get(const char *address, const char *key, char *value, size_t value_size) {
+    size_t key_len = strlen(key);
+    const char *p = address;
+
+    while ((p = strstr(p, key)) != NULL) {
+        bool at_word_start = (p == address || isspace((unsigned char)p[-1]) || p[-1] == ';');
+        if (at_word_start && p[key_len] == '=') {
+            const char *v = p + key_len + 1;
+            const char *end;
+            if (*v == '"') {
+                v++;
+                end = strchr(v, '"');
+                if (!end) return false;
+            } else {
+                end = v;
+                while (*end && !isspace((unsigned char)*end) && *end != ';') end++;
+            }
+            size_t len = (size_t)(end - v);
+            if (len >= value_size) return false;
+            memcpy(value, v, len);
+            value[len] = '\0';
+            return true;
+        }
+        p += key_len;
+    }
+    return false;
+}
+
+/**
+ * Parse table options from an include address.
+ * Returns true if the address contained rows= and/or cols= options.
+ */
+static bool parse_csv_table_spec(const char *address, csv_table_spec_t *spec) {
+    spec->row_start = 1;
+    spec->row_end = -1;
+    spec->cols[0] = '\0';
+
+    if (!address) return false;
+
+    bool found = false;
+    char rows[64];
+    if (csv_spec_get(address, "rows", rows, sizeof(rows))) {
+        char *endptr;
+        long first = strtol(rows, &endptr, 10);
+        if (endptr != rows && first > 0) {
+            found = true;
+            if (*endptr == '-') {
+                /* rows=N-M or rows=N- */
+                const char *second_str = endptr + 1;
+                spec->row_start = first;
+                if (*second_str) {
+                    long second = strtol(second_str, &endptr, 10);
+                    if (endptr != second_str && second >= first) spec->row_end = second;
+                }
+            } else {
+                /* rows=N: first N data rows */
+                spec->row_end = first;
+            }
+        }
+    }
+
+    if (csv_spec_get(address, "cols", spec->cols, sizeof(spec->cols)) && spec->cols[0]) {
+        found = true;
+    }
+
+    return found;
+}
+
+struct apex_csv_table_include {
+    char *path;                /* Resolved path */
+    bool is_tsv;
+    csv_table_spec_t spec;
+    char *source;              /* The include as written, restored if the file cannot be read */
+};
+
+void apex_csv_tables_init(apex_csv_tables *tables) {
+    if (!tables) return;
+    memset(tables, 0, sizeof(*tables));
+
+    /* The token only has to be unknown to the document's author */
+    uint64_t bits = 0;
+    FILE *fp = fopen("/dev/urandom", "rb");
+    if (!fp || fread(&bits, sizeof(bits), 1, fp) != 1) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        bits = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 16) ^
+               (uint64_t)(uintptr_t)tables;
+    }
+    if (fp) fclose(fp);
+    snprintf(tables->token, sizeof(tables->token), "APEXCSV%016llx", (unsigned long long)bits);
+}
+
+void apex_csv_tables_free(apex_csv_tables *tables) {
+    if (!tables) return;
+    for (size_t i = 0; i < tables->count; i++) {
+        free(tables->includes[i].path);
+        free(tables->includes[i].source);
+    }
+    free(tables->includes);
+    tables->includes = NULL;
+    tables->count = 0;
+    tables->capacity = 0;
+}
+
+/**
+ * Record a streamed table include and build its placeholder paragraph.
+ * Returns NULL if the path is not CSV/TSV.
+ */
+static char *record_csv_table(apex_csv_tables *tables, const char *resolved_path, const csv_table_spec_t *spec,
+                              const char *source, size_t source_len, const apex_include_deps *deps) {
+    apex_file_type_t file_type = apex_detect_file_type(resolved_path);
+    if (file_type != FILE_TYPE_CSV && file_type != FILE_TYPE_TSV) return NULL;
+    include_deps_note(deps, resolved_path);
+
+    if (tables->count == tables->capacity) {
+        size_t capacity = tables->capacity ? tables->capacity * 2 : 4;
+        apex_csv_table_include *includes = realloc(tables->includes, capacity * sizeof(apex_csv_table_include));
+        if (!includes) return NULL;
+        tables->includes = includes;
+        tables->capacity = capacity;
+    }
+
+    apex_csv_table_include *include = &tables->includes[tables->count];
+    include->path = strdup(resolved_path);
+    include->source = malloc(source_len + 1);
+    if (!include->path || !include->source) {
+        free(include->path);
+        free(include->source);
+        return NULL;
+    }
+    memcpy(include->source, source, source_len);
+    include->source[source_len] = '\0';
+    include->is_tsv = file_type == FILE_TYPE_TSV;
+    include->spec = *spec;
+
+    char *placeholder = malloc(sizeof(tables->token) + 32);
+    if (!placeholder) {
+        free(include->path);
+        free(include->source);
+        return NULL;
+    }
+    snprintf(placeholder, sizeof(tables->token) + 32, "\n\n%sT%zu\n\n", tables->token, tables->count);
+    tables->count++;
+    return placeholder;
+}
+
+/**
+ * Incremental CSV/TSV row reader
+ *
+ * Handles quoted fields (with "" escapes and embedded newlines) and
+ * LF/CRLF/CR line endings. Cells of the current row are stored
+ * back-to-back in a reusable buffer.
+ */
+typedef struct {
+    FILE *fp;
+    char delim;
+    char *buf;
+    size_t buf_len;
+    size_t buf_cap;
+    size_t *cell_start;
+    size_t *cell_len;
+    int cell_count;
+    int cell_cap;
+} csv_reader_t;
+
+static bool csv_reader_putc(csv_reader_t *r, char c) {
+    if (r->buf_len + 1 > r->buf_cap) {
+        size_t new_cap = r->buf_cap ? r->buf_cap * 2 : 256;
+        char *tmp = realloc(r->buf, new_cap);
+        if (!tmp) return false;
+        r->buf = tmp;
+        r->buf_cap = new_cap;
+    }
+    r->buf[r->buf_len++] = c;
+    return true;
+}
+
+static bool csv_reader_end_cell(csv_reader_t *r, size_t start) {
+    if (r->cell_count >= r->cell_cap) {
+        int new_cap = r->cell_cap ? r->cell_cap * 2 : 16;
+        size_t *starts = realloc(r->cell_start, (size_t)new_cap * sizeof(size_t));
+        if (!starts) return false;
+        r->cell_start = starts;
+        size_t *lens = realloc(r->cell_len, (size_t)new_cap * sizeof(size_t));
+        if (!lens) return false;
+        r->cell_len = lens;
+        r->cell_cap = new_cap;
+    }
+    r->cell_start[r->cell_count] = start;
+    r->cell_len[r->cell_count] = r->buf_len - start;
+    r->cell_count++;
+    return true;
+}
+
+/**
+ * Read the next physical row. Returns false at end of file (or on allocation failure).
+ */
+static bool csv_read_line(csv_reader_t *r) {
+    r->buf_len = 0;
+    r->cell_count = 0;
+
+    int c = getc(r->fp);
+    if (c == EOF) return false;
+
+    size_t start = 0;
+    bool in_quotes = false;
+    bool at_cell_start = true;
+
+    while (c != EOF) {
+        if (in_quotes) {
+            if (c == '"') {
+                int next = getc(r->fp);
+                if (next == '"') {
+                    if (!csv_reader_putc(r, '"')) return false;
+                } else {
+                    in_quotes = false;
+                    c = next;
+                    continue;  /* Reprocess the character after the closing quote */
+                }
+            } else if (!csv_reader_putc(r, (char)c)) {
+                return false;
+            }
+        } else if (c == '"' && at_cell_start) {
+            in_quotes = true;
+            at_cell_start = false;
+        } else if (c == r->delim) {
+            if (!csv_reader_end_cell(r, start)) return false;
+            start = r->buf_len;
+            at_cell_start = true;
+        } else if (c == '\n' || c == '\r') {
+            if (c == '\r') {
+                int next = getc(r->fp);
+                if (next != '\n' && next != EOF) ungetc(next, r->fp);
+            }
+            break;
+        } else {
+            if (!csv_reader_putc(r, (char)c)) return false;
+            at_cell_start = false;
+        }
+        c = getc(r->fp);
+    }
+
+    return csv_reader_end_cell(r, start);
+}
+
+/**
+ * Read the next non-blank row
+ */
+static bool csv_read_row(csv_reader_t *r) {
+    while (csv_read_line(r)) {
+        if (r->cell_count > 1 || r->cell_len[0] > 0) return true;
+    }
+    return false;
+}
+
+static void csv_reader_free(csv_reader_t *r) {
+    free(r->buf);
+    free(r->cell_start);
+    free(r->cell_len);
+}
+
+/* Classify a cell as an alignment keyword: returns attribute value, "" for auto, NULL if not a keyword */
+static const char *csv_alignment_keyword(const char *s, size_t n) {
+    while (n > 0 && isspace((unsigned char)*s)) { s++; n--; }
+    while (n > 0 && isspace((unsigned char)s[n - 1])) n--;
+
+    if (n == 4 && strncasecmp(s, "left", 4) == 0) return "left";
+    if (n == 5 && strncasecmp(s, "right", 5) == 0) return "right";
+    if (n == 6 && strncasecmp(s, "center", 6) == 0) return "center";
+    if (n == 4 && strncasecmp(s, "auto", 4) == 0) return "";
+    return NULL;
+}
+
+/**
+ * Resolve the column selection against the header row.
+ * Fills columns[] with 0-based indices and returns the count.
+ */
+static int csv_select_columns(const csv_reader_t *header, const char *cols, int *columns, int max_columns) {
+    int count = 0;
+
+    if (!cols || !*cols) {
+        for (int i = 0; i < header->cell_count && count < max_columns; i++) {
+            columns[count++] = i;
+        }
+        return count;
+    }
+
+    const char *p = cols;
+    while (*p && count < max_columns) {
+        const char *tok_end = strchr(p, ',');
+        if (!tok_end) tok_end = p + strlen(p);
+
+        const char *s = p;
+        const char *e = tok_end;
+        while (s < e && isspace((unsigned char)*s)) s++;
+        while (e > s && isspace((unsigned char)e[-1])) e--;
+        size_t tok_len = (size_t)(e - s);
+
+        if (tok_len > 0) {
+            bool numeric = true;
+            for (const char *q = s; q < e; q++) {
+                if (!isdigit((unsigned char)*q)) { numeric = false; break; }
+            }
+
+            if (numeric) {
+                int index = atoi(s) - 1;
+                if (index >= 0 && index < header->cell_count) columns[count++] = index;
+            } else {
+                for (int i = 0; i < header->cell_count; i++) {
+                    const char *name = header->buf + header->cell_start[i];
+                    size_t name_len = header->cell_len[i];
+                    while (name_len > 0 && isspace((unsigned char)*name)) { name++; name_len--; }
+                    while (name_len > 0 && isspace((unsigned char)name[name_len - 1])) name_len--;
+                    if (name_len == tok_len && strncasecmp(name, s, tok_len) == 0) {
+                        columns[count++] = i;
+                        break;
+                    }
+                }
+            }
+        }
+
+        p = *tok_end ? tok_end + 1 : tok_end;
+    }
+
+    return count;
+}
+
+static bool csv_emit_row(csv_out_t *out, const csv_reader_t *row, const int *columns, int column_count,
+                         const char **align, const char *cell_tag) {
+    if (!csv_out_puts(out, "<tr>\n")) return false;
+    for (int i = 0; i < column_count; i++) {
+        int c = columns[i];
+        char open[48];
+        if (align && align[c] && align[c][0]) {
+            snprintf(open, sizeof(open), "<%s align=\"%s\">", cell_tag, align[c]);
+        } else {
+            snprintf(open, sizeof(open), "<%s>", cell_tag);
+        }
+        if (!csv_out_puts(out, open)) return false;
+        if (c < row->cell_count) {
+            if (!csv_out_append_escaped(out, row->buf + row->cell_start[c], row->cell_len[c])) return false;
+        }
+        if (!csv_out_puts(out, "</") || !csv_out_puts(out, cell_tag) || !csv_out_puts(out, ">\n")) return false;
+    }
+    return csv_out_puts(out, "</tr>\n");
+}
+
+/**
+ * Stream one CSV/TSV file into out as an HTML table.
+ * Alignment rows (left/right/center/auto) follow the same rules as apex_csv_to_table.
+ */
+static bool csv_stream_table(csv_out_t *out, const char *path, bool is_tsv, const csv_table_spec_t *spec) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    csv_reader_t header = {0};
+    csv_reader_t row = {0};
+    header.fp = row.fp = fp;
+    header.delim = row.delim = is_tsv ? '\t' : ',';
+
+    bool ok = false;
+    int *columns = NULL;
+    const char **align = NULL;
+
+    if (!csv_read_row(&header) || header.cell_count == 0) goto done;
+
+    columns = malloc((size_t)header.cell_count * sizeof(int));
+    align = calloc((size_t)header.cell_count, sizeof(char *));
+    if (!columns || !align) goto done;
+    int column_count = csv_select_columns(&header, spec->cols, columns, header.cell_count);
+    if (column_count == 0) goto done;
+
+    /* Second row may be an alignment row */
+    bool have_row = csv_read_row(&row);
+    if (have_row && row.cell_count == header.cell_count) {
+        bool all_keywords = true;
+        for (int i = 0; i < row.cell_count && all_keywords; i++) {
+            align[i] = csv_alignment_keyword(row.buf + row.cell_start[i], row.cell_len[i]);
+            if (!align[i]) all_keywords = false;
+        }
+        if (all_keywords) {
+            have_row = csv_read_row(&row);
+        } else {
+            memset(align, 0, (size_t)header.cell_count * sizeof(char *));
+        }
+    }
+
+    if (!csv_out_puts(out, "<table>\n<thead>\n")) goto done;
+    if (!csv_emit_row(out, &header, columns, column_count, align, "th")) goto done;
+    if (!csv_out_puts(out, "</thead>\n")) goto done;
+
+    long data_row = 0;
+    bool in_body = false;
+    while (have_row) {
+        data_row++;
+        if (spec->row_end >= 0 && data_row > spec->row_end) break;
+        if (data_row >= spec->row_start) {
+            if (!in_body) {
+                if (!csv_out_puts(out, "<tbody>\n")) goto done;
+                in_body = true;
+            }
+            if (!csv_emit_row(out, &row, columns, column_count, align, "td")) goto done;
+        }
+        have_row = csv_read_row(&row);
+    }
+
+    if (in_body && !csv_out_puts(out, "</tbody>\n")) goto done;
+    ok = csv_out_puts(out, "</table>\n");
+
+done:
+    free(columns);
+    free((void *)align);
+    csv_reader_free(&header);
+    csv_reader_free(&row);
+    fclose(fp);
+    return ok;
+}
+
+/**
+ * Expand streamed CSV/TSV table placeholders in rendered HTML
+ */
+char *apex_expand_csv_tables(const char *html, const apex_csv_tables *tables) {
+    if (!html || !tables || tables->count == 0) return NULL;
+
+    size_t token_len = strlen(tables->token);
+    const char *placeholder = strstr(html, tables->token);
+    if (!placeholder) return NULL;
+
+    csv_out_t out = {0};
+    const char *read = html;
+
+    while (placeholder) {
+        const char *number = placeholder + token_len;
+        char *number_end = (char *)number;
+        size_t index = tables->count;
+        if (number[0] == 'T' && isdigit((unsigned char)number[1])) {
+            index = (size_t)strtoul(number + 1, &number_end, 10);
+        }
+        if (index >= tables->count) {
+            /* Not one of ours; copy it through */
+            if (!csv_out_append(&out, read, (size_t)(number - read))) goto fail;
+            read = number;
+            placeholder = strstr(read, tables->token);
+            continue;
+        }
+
+        /* The placeholder is a paragraph of its own */
+        const char *copy_end = placeholder;
+        const char *resume = number_end;
+        if (placeholder - read >= 3 && strncmp(placeholder - 3, "<p>", 3) == 0 && strncmp(resume, "</p>", 4) == 0) {
+            copy_end = placeholder - 3;
+            resume += 4;
+        }
+        if (!csv_out_append(&out, read, (size_t)(copy_end - read))) goto fail;
+
+        const apex_csv_table_include *include = &tables->includes[index];
+        size_t before = out.len;
+        if (!csv_stream_table(&out, include->path, include->is_tsv, &include->spec)) {
+            /* Leave unreadable includes as written, like other include failures */
+            out.len = before;
+            if (out.data) out.data[out.len] = '\0';
+            if (!csv_out_append(&out, copy_end, (size_t)(placeholder - copy_end)) ||
+                !csv_out_append_escaped(&out, include->source, strlen(include->source)) ||
+                !csv_out_append(&out, number_end, (size_t)(resume - number_end))) {
+                goto fail;
+            }
+        }
+
+        read = resume;
+        placeholder = strstr(read, tables->token);
+    }
+
+    if (!csv_out_puts(&out, read)) goto fail;
+    return out.data;
+
+fail:
+    free(out.data);
+    return NULL;
+}
+
 /**
  * Free address specification
  */
@@ -978,6 +1697,11 @@ static char *get_transclude_base(const char *base_dir, apex_metadata_item *metad
  * Process file includes in text
  */
 char *apex_process_includes(const char *text, const char *base_dir, apex_metadata_item *metadata, int depth) {
+    return apex_process_includes_with_tables(text, base_dir, metadata, depth, NULL, NULL);
+}
+
+char *apex_process_includes_with_tables(const char *text, const char *base_dir, apex_metadata_item *metadata,
+                                        int depth, apex_csv_tables *tables, const apex_include_deps *deps) {
     if (!text) return NULL;
     if (depth > MAX_INCLUDE_DEPTH) {
         return strdup(text);  /* Silently return original text */
@@ -1023,7 +1747,7 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                 char *resolved_path = resolve_path(filepath, effective_base_dir);
                 if (resolved_path && apex_file_exists(resolved_path)) {
                     apex_file_type_t file_type = apex_detect_file_type(resolved_path);
-                    char *content = read_file_contents(resolved_path);
+                    char *content = read_file_contents(resolved_path, deps);
 
                     if (content) {
                         char *to_insert = NULL;
@@ -1048,7 +1772,7 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                             /* Extract metadata from transcluded file */
                             char *file_content_for_metadata = strdup(content);
                             apex_metadata_item *file_metadata = NULL;
-                            char *file_text_after_metadata = file_content_for_metadata;
+                            const char *file_text_after_metadata = file_content_for_metadata;
                             if (file_content_for_metadata) {
                                 file_metadata = apex_extract_metadata(&file_text_after_metadata);
                             }
@@ -1062,7 +1786,7 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                                 transclude_base = get_directory(resolved_path);
                             }
 
-                            to_insert = apex_process_includes(content, transclude_base, file_metadata, depth + 1);
+                            to_insert = apex_process_includes_with_tables(content, transclude_base, file_metadata, depth + 1, tables, deps);
 
                             /* Cleanup */
                             if (transclude_base) free(transclude_base);
@@ -1109,6 +1833,8 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                 const char *address_start = filepath_end + 2;
                 const char *address_end = NULL;
                 address_spec_t *address_spec = NULL;
+                csv_table_spec_t table_spec;
+                bool has_table_spec = false;
 
                 if (*address_start == '[') {
                     address_start++;
@@ -1119,7 +1845,10 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                         if (address_len > 0 && address_len < (int)sizeof(address_str)) {
                             memcpy(address_str, address_start, address_len);
                             address_str[address_len] = '\0';
-                            address_spec = parse_address_spec(address_str);
+                            has_table_spec = parse_csv_table_spec(address_str, &table_spec);
+                            if (!has_table_spec) {
+                                address_spec = parse_address_spec(address_str);
+                            }
                         }
                     }
                 }
@@ -1131,14 +1860,33 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                     resolved_path = resolve_path(filepath, effective_base_dir);
                 }
 
-                if (resolved_path) {
+                /* CSV/TSV with rows=/cols= options: stream straight to HTML after rendering */
+                char *table_marker = NULL;
+                if (resolved_path && has_table_spec && tables) {
+                    const char *include_end = address_end ? address_end + 1 : filepath_end + 2;
+                    table_marker = record_csv_table(tables, resolved_path, &table_spec, read_pos,
+                                                    (size_t)(include_end - read_pos), deps);
+                }
+                if (table_marker) {
+                    size_t marker_len = strlen(table_marker);
+                    if (marker_len < remaining) {
+                        memcpy(write_pos, table_marker, marker_len);
+                        write_pos += marker_len;
+                        remaining -= marker_len;
+                    }
+                    free(table_marker);
+                    free(resolved_path);
+                    resolved_path = NULL;
+                    read_pos = address_end ? address_end + 1 : filepath_end + 2;
+                    processed_include = true;
+                } else if (resolved_path) {
                     apex_file_type_t file_type = apex_detect_file_type(resolved_path);
-                    char *content = read_file_contents(resolved_path);
+                    char *content = read_file_contents(resolved_path, deps);
                     if (content) {
                         /* Extract metadata from original file content FIRST (before any processing) */
                         char *file_content_for_metadata = strdup(content);
                         apex_metadata_item *file_metadata = NULL;
-                        char *file_text_after_metadata = file_content_for_metadata;
+                        const char *file_text_after_metadata = file_content_for_metadata;
                         if (file_content_for_metadata) {
                             file_metadata = apex_extract_metadata(&file_text_after_metadata);
                         }
@@ -1176,7 +1924,7 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                         }
 
                         /* Recursively process with file's metadata and transclude base */
-                        char *processed = apex_process_includes(to_process, transclude_base, file_metadata, depth + 1);
+                        char *processed = apex_process_includes_with_tables(to_process, transclude_base, file_metadata, depth + 1, tables, deps);
 
                         /* Cleanup */
                         if (transclude_base) free(transclude_base);
@@ -1253,6 +2001,8 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                     while (*address_start && isspace(*address_start)) address_start++;
                     const char *address_end = NULL;
                     address_spec_t *address_spec = NULL;
+                    csv_table_spec_t table_spec;
+                    bool has_table_spec = false;
 
                     if (*address_start == '[') {
                         address_start++;
@@ -1263,21 +2013,43 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                             if (address_len > 0 && address_len < (int)sizeof(address_str)) {
                                 memcpy(address_str, address_start, address_len);
                                 address_str[address_len] = '\0';
-                                address_spec = parse_address_spec(address_str);
+                                has_table_spec = parse_csv_table_spec(address_str, &table_spec);
+                                if (!has_table_spec) {
+                                    address_spec = parse_address_spec(address_str);
+                                }
                             }
                         }
                     }
 
                     /* Resolve path */
                     char *resolved_path = resolve_path(filepath, effective_base_dir);
+
+                    /* CSV/TSV with rows=/cols= options: stream straight to HTML after rendering */
+                    if (resolved_path && has_table_spec && tables) {
+                        const char *include_end = address_end ? address_end + 1 : filepath_end + 1;
+                        char *table_marker = record_csv_table(tables, resolved_path, &table_spec, read_pos,
+                                                              (size_t)(include_end - read_pos), deps);
+                        if (table_marker) {
+                            size_t marker_len = strlen(table_marker);
+                            if (marker_len < remaining) {
+                                memcpy(write_pos, table_marker, marker_len);
+                                write_pos += marker_len;
+                                remaining -= marker_len;
+                            }
+                            free(table_marker);
+                            free(resolved_path);
+                            resolved_path = NULL;
+                        }
+                    }
+
                     if (resolved_path) {
                         apex_file_type_t file_type = apex_detect_file_type(resolved_path);
-                        char *content = read_file_contents(resolved_path);
+                        char *content = read_file_contents(resolved_path, deps);
                         if (content) {
                             /* Extract metadata from original file content FIRST (before any processing) */
                             char *file_content_for_metadata = strdup(content);
                             apex_metadata_item *file_metadata = NULL;
-                            char *file_text_after_metadata = file_content_for_metadata;
+                            const char *file_text_after_metadata = file_content_for_metadata;
                             if (file_content_for_metadata) {
                                 file_metadata = apex_extract_metadata(&file_text_after_metadata);
                             }
@@ -1318,7 +2090,7 @@ char *apex_process_includes(const char *text, const char *base_dir, apex_metadat
                                     transclude_base = get_directory(resolved_path);
                                 }
 
-                                char *processed = apex_process_includes(to_process, transclude_base, file_metadata, depth + 1);
+                                char *processed = apex_process_includes_with_tables(to_process, transclude_base, file_metadata, depth + 1, tables, deps);
 
                                 /* Cleanup */
                                 if (transclude_base) free(transclude_base);
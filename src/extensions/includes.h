@@ -16,6 +16,7 @@
 #define APEX_INCLUDES_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "metadata.h"
 
 #ifdef __cplusplus
@@ -33,6 +34,50 @@ extern "C" {
  */
 char *apex_process_includes(const char *text, const char *base_dir, apex_metadata_item *metadata, int depth);
 
+/**
+ * CSV/TSV table includes waiting to be streamed into the rendered HTML
+ *
+ * Each include with table options is recorded here, with its resolved
+ * path, and replaced by a paragraph holding this conversion's token and
+ * the include's number. Paths are only ever taken from this list, so
+ * nothing written in the document can name a file to stream.
+ */
+typedef struct apex_csv_table_include apex_csv_table_include;
+
+typedef struct {
+    char token[24];                    /* Random per conversion, letters and digits only */
+    apex_csv_table_include *includes;
+    size_t count;
+    size_t capacity;
+} apex_csv_tables;
+
+/**
+ * Start an empty list with a fresh token
+ */
+void apex_csv_tables_init(apex_csv_tables *tables);
+
+/**
+ * Release the list (the struct itself may be reused after init)
+ */
+void apex_csv_tables_free(apex_csv_tables *tables);
+
+/**
+ * Receives the path of each file an include pass reads (fn may be NULL)
+ */
+typedef struct {
+    void (*fn)(const char *path, void *user_data);
+    void *user_data;
+} apex_include_deps;
+
+/**
+ * Process file includes, recording CSV/TSV includes that have rows= or
+ * cols= options in tables so they can be streamed after rendering. With
+ * tables NULL those includes become Markdown tables. Every file read,
+ * and every file recorded in tables, is reported to deps (may be NULL).
+ */
+char *apex_process_includes_with_tables(const char *text, const char *base_dir, apex_metadata_item *metadata,
+                                        int depth, apex_csv_tables *tables, const apex_include_deps *deps);
+
 /**
  * Check if a file exists
  */
@@ -40,6 +85,17 @@ bool apex_file_exists(const char *filepath);
 
 char *apex_csv_to_table(const char *csv_content, bool is_tsv);
 
+/**
+ * Expand streamed CSV/TSV table includes in rendered HTML
+ *
+ * Includes with table options, such as {{data.csv}}[rows=1-100 cols=Name,City],
+ * leave a placeholder recorded in tables during preprocessing. This reads
+ * each file row by row and writes the table HTML in place of its
+ * placeholder, bypassing Markdown parsing.
+ * Returns newly allocated HTML, or NULL if there were no placeholders.
+ */
+char *apex_expand_csv_tables(const char *html, const apex_csv_tables *tables);
+
 /**
  * Resolve wildcard path (e.g., file.* -> file.html)
  * Tries common extensions in order: .html, .md, .txt
@@ -680,10 +680,10 @@ static apex_metadata_item *parse_pandoc_metadata(const char *text, size_t *consu
  * This modifies the input by removing the metadata section
  * Returns the extracted metadata
  */
-apex_metadata_item *apex_extract_metadata(char **text_ptr) {
+apex_metadata_item *apex_extract_metadata(const char **text_ptr) {
     if (!text_ptr || !*text_ptr || !**text_ptr) return NULL;
 
-    char *text = *text_ptr;
+    const char *text = *text_ptr;
     size_t consumed = 0;
     apex_metadata_item *items = NULL;
 
@@ -1004,7 +1004,8 @@ static apex_string_array *split_string_simple(const char *str, const char *delim
         return NULL;
     }
 
-    char *token = strtok(str_copy, delimiter);
+    char *saveptr = NULL;
+    char *token = strtok_r(str_copy, delimiter, &saveptr);
     while (token) {
         /* Trim whitespace from token */
         char *start = token;
@@ -1031,7 +1032,7 @@ static apex_string_array *split_string_simple(const char *str, const char *delim
         }
         arr->count++;
 
-        token = strtok(NULL, delimiter);
+        token = strtok_r(NULL, delimiter, &saveptr);
     }
 
     free(str_copy);
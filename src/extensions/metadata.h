@@ -42,10 +42,10 @@ cmark_syntax_extension *create_metadata_extension(void);
 
 /**
  * Extract metadata from the beginning of text (preprocessing approach)
- * Modifies *text_ptr to point past the metadata section
+ * Advances *text_ptr past the metadata section; the text is not modified
  * Returns the extracted metadata list
  */
-apex_metadata_item *apex_extract_metadata(char **text_ptr);
+apex_metadata_item *apex_extract_metadata(const char **text_ptr);
 
 /**
  * Get metadata from a document node
@@ -0,0 +1,141 @@
+/**
+ * Reference Definition Index for Apex
+ * Implementation
+ */
+
+#include "reference_defs.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Labels match case-insensitively with whitespace runs collapsed. out
+ * needs room for len + 1 bytes; returns the normalized length. */
+static size_t normalize_label(const char *label, size_t len, char *out) {
+    size_t n = 0;
+    bool pending_space = false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)label[i];
+        if (isspace(c)) {
+            pending_space = n > 0;
+            continue;
+        }
+        if (pending_space) {
+            out[n++] = ' ';
+            pending_space = false;
+        }
+        out[n++] = (char)tolower(c);
+    }
+    out[n] = '\0';
+    return n;
+}
+
+static size_t label_hash(const char *label) {
+    /* FNV-1a */
+    size_t hash = (size_t)2166136261u;
+    for (const unsigned char *c = (const unsigned char *)label; *c; c++) {
+        hash = (hash ^ *c) * (size_t)16777619u;
+    }
+    return hash;
+}
+
+static size_t *find_slot(const apex_reference_defs *refs, const char *label) {
+    size_t mask = refs->slot_capacity - 1;
+    for (size_t i = label_hash(label) & mask;; i = (i + 1) & mask) {
+        size_t *slot = &refs->slots[i];
+        if (!*slot || strcmp(refs->defs[*slot - 1].label, label) == 0) return slot;
+    }
+}
+
+static bool grow_slots(apex_reference_defs *refs) {
+    size_t capacity = refs->slot_capacity ? refs->slot_capacity * 2 : 16;
+    size_t *slots = calloc(capacity, sizeof(size_t));
+    if (!slots) return false;
+
+    free(refs->slots);
+    refs->slots = slots;
+    refs->slot_capacity = capacity;
+    /* Reinsert in document order so the first definition keeps its slot */
+    for (size_t i = 0; i < refs->count; i++) {
+        size_t *slot = find_slot(refs, refs->defs[i].label);
+        if (!*slot) *slot = i + 1;
+    }
+    return true;
+}
+
+static bool add_def(apex_reference_defs *refs, const char *line, size_t length, const char *label, size_t label_len) {
+    char *normalized = malloc(label_len + 1);
+    if (!normalized) return false;
+    if (normalize_label(label, label_len, normalized) == 0) {
+        free(normalized);
+        return true;
+    }
+
+    if (refs->count == refs->capacity) {
+        size_t capacity = refs->capacity ? refs->capacity * 2 : 16;
+        apex_reference_def *defs = realloc(refs->defs, capacity * sizeof(apex_reference_def));
+        if (!defs) {
+            free(normalized);
+            return false;
+        }
+        refs->defs = defs;
+        refs->capacity = capacity;
+    }
+    if ((refs->count + 1) * 2 > refs->slot_capacity && !grow_slots(refs)) {
+        free(normalized);
+        return false;
+    }
+
+    refs->defs[refs->count] = (apex_reference_def){ line, length, normalized };
+    refs->count++;
+    size_t *slot = find_slot(refs, normalized);
+    if (!*slot) *slot = refs->count;
+    return true;
+}
+
+bool apex_reference_defs_scan(apex_reference_defs *refs, const char *text) {
+    if (!refs || !text) return false;
+
+    const char *p = text;
+    while (*p) {
+        const char *line_start = p;
+        const char *line_end = strchr(p, '\n');
+        if (!line_end) line_end = p + strlen(p);
+        p = *line_end ? line_end + 1 : line_end;
+
+        /* [label]: after any indentation */
+        const char *content = line_start;
+        while (content < line_end && (*content == ' ' || *content == '\t')) content++;
+        if (content >= line_end || *content != '[') continue;
+
+        const char *label_end = memchr(content + 1, ']', (size_t)(line_end - content - 1));
+        if (!label_end || label_end + 1 >= line_end || label_end[1] != ':') continue;
+
+        if (!add_def(refs, line_start, (size_t)(p - line_start), content + 1, (size_t)(label_end - content - 1))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const apex_reference_def *apex_reference_defs_find(const apex_reference_defs *refs, const char *label, size_t len) {
+    if (!refs || !refs->count || !label) return NULL;
+
+    char stack_buf[256];
+    char *normalized = len < sizeof(stack_buf) ? stack_buf : malloc(len + 1);
+    if (!normalized) return NULL;
+    normalize_label(label, len, normalized);
+
+    size_t index = *find_slot(refs, normalized);
+    if (normalized != stack_buf) free(normalized);
+    return index ? &refs->defs[index - 1] : NULL;
+}
+
+void apex_reference_defs_free(apex_reference_defs *refs) {
+    if (!refs) return;
+    for (size_t i = 0; i < refs->count; i++) {
+        free(refs->defs[i].label);
+    }
+    free(refs->defs);
+    free(refs->slots);
+    *refs = (apex_reference_defs)APEX_REFERENCE_DEFS_INIT;
+}
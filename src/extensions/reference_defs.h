@@ -0,0 +1,64 @@
+/**
+ * Reference Definition Index for Apex
+ *
+ * Finds the link reference definitions ([label]: url ...) of a document
+ * in one line scan and indexes them by normalized label (case folded,
+ * inner whitespace collapsed), so preprocessors can ask whether a label
+ * is defined, or fetch its definition line, without rescanning the text.
+ *
+ * apex_reference_defs refs = APEX_REFERENCE_DEFS_INIT;
+ * apex_reference_defs_scan(&refs, text);
+ * const apex_reference_def *def = apex_reference_defs_find(&refs, label, len);
+ * ...
+ * apex_reference_defs_free(&refs);
+ */
+
+#ifndef APEX_REFERENCE_DEFS_H
+#define APEX_REFERENCE_DEFS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct apex_reference_def {
+    const char *line;   /* Definition line, pointing into the scanned text */
+    size_t length;      /* Line length, including its newline if any */
+    char *label;        /* Normalized label */
+} apex_reference_def;
+
+typedef struct apex_reference_defs {
+    apex_reference_def *defs;   /* In document order */
+    size_t count;
+    size_t capacity;
+    size_t *slots;              /* Open-addressed: index into defs + 1, 0 = empty */
+    size_t slot_capacity;       /* Power of two, or 0 before the first definition */
+} apex_reference_defs;
+
+#define APEX_REFERENCE_DEFS_INIT { NULL, 0, 0, NULL, 0 }
+
+/**
+ * Index every definition line in text. The text must outlive the index.
+ * When a label is defined twice, the first definition is found.
+ * @return false if memory ran out (definitions found so far are kept)
+ */
+bool apex_reference_defs_scan(apex_reference_defs *refs, const char *text);
+
+/**
+ * Find the definition for a label as written in a reference ([text][label])
+ * @return The definition, or NULL if the label is not defined
+ */
+const apex_reference_def *apex_reference_defs_find(const apex_reference_defs *refs, const char *label, size_t len);
+
+/**
+ * Release the index (the struct itself may be reused afterwards)
+ */
+void apex_reference_defs_free(apex_reference_defs *refs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_REFERENCE_DEFS_H */
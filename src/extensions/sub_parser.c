@@ -0,0 +1,44 @@
+/**
+ * Reusable Fragment Parser for Apex
+ * Implementation
+ */
+
+#include "sub_parser.h"
+#include <stdlib.h>
+
+cmark_node *apex_sub_parser_parse(apex_sub_parser *sub, int options, const char *text, size_t len) {
+    if (!sub || !text) return NULL;
+
+    if (sub->parser && sub->options != options) {
+        cmark_parser_free(sub->parser);
+        sub->parser = NULL;
+    }
+    if (!sub->parser) {
+        sub->parser = cmark_parser_new(options);
+        if (!sub->parser) return NULL;
+        sub->options = options;
+    }
+
+    /* finish() hands back the document and resets the parser */
+    cmark_parser_feed(sub->parser, text, len);
+    return cmark_parser_finish(sub->parser);
+}
+
+char *apex_sub_parser_render(apex_sub_parser *sub, int parse_options, int render_options,
+                             const char *text, size_t len) {
+    cmark_node *doc = apex_sub_parser_parse(sub, parse_options, text, len);
+    if (!doc) return NULL;
+
+    char *html = cmark_render_html_with_mem(doc, render_options, NULL, cmark_get_default_mem_allocator());
+    cmark_node_free(doc);
+    return html;
+}
+
+void apex_sub_parser_free(apex_sub_parser *sub) {
+    if (!sub) return;
+    if (sub->parser) {
+        cmark_parser_free(sub->parser);
+    }
+    sub->parser = NULL;
+    sub->options = 0;
+}
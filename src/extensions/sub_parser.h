@@ -0,0 +1,54 @@
+/**
+ * Reusable Fragment Parser for Apex
+ *
+ * Definition bodies, block footnotes and markdown="1" HTML blocks are
+ * parsed as separate Markdown fragments. cmark_parser_finish() resets a
+ * parser for the next document, so one parser can serve every fragment
+ * of a pass instead of constructing (and tearing down) one per fragment.
+ *
+ * apex_sub_parser sub = APEX_SUB_PARSER_INIT;
+ * cmark_node *doc = apex_sub_parser_parse(&sub, options, text, len);
+ * ...
+ * cmark_node_free(doc);
+ * apex_sub_parser_free(&sub);
+ */
+
+#ifndef APEX_SUB_PARSER_H
+#define APEX_SUB_PARSER_H
+
+#include <stddef.h>
+#include "cmark-gfm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct apex_sub_parser {
+    cmark_parser *parser;  /* Created on first use */
+    int options;           /* Options the parser was created with */
+} apex_sub_parser;
+
+#define APEX_SUB_PARSER_INIT { NULL, 0 }
+
+/**
+ * Parse a fragment. The parser is reused while options stay the same.
+ * Returns a document the caller frees with cmark_node_free(), or NULL.
+ */
+cmark_node *apex_sub_parser_parse(apex_sub_parser *sub, int options, const char *text, size_t len);
+
+/**
+ * Parse a fragment and render it to HTML (free with free()).
+ */
+char *apex_sub_parser_render(apex_sub_parser *sub, int parse_options, int render_options,
+                             const char *text, size_t len);
+
+/**
+ * Release the parser (the struct itself may be reused afterwards)
+ */
+void apex_sub_parser_free(apex_sub_parser *sub);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_SUB_PARSER_H */
@@ -7,15 +7,11 @@
  */
 
 #include "syntax_highlight.h"
+#include "../subprocess.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <errno.h>
 
 /**
  * Get the binary name for a syntax highlighting tool.
@@ -82,6 +78,10 @@ static char *unescape_html(const char *html, size_t len) {
     return result;
 }
 
+/* A highlighter that hangs on one block is killed and the block left
+ * plain rather than stalling the whole document */
+#define HIGHLIGHT_TIMEOUT_MS 30000
+
 /**
  * Run an external command with input on stdin and capture stdout.
  * Returns newly allocated string with output, or NULL on failure.
@@ -89,102 +89,17 @@ static char *unescape_html(const char *html, size_t len) {
 static char *run_command(const char *cmd, const char *input) {
     if (!cmd || !input) return NULL;
 
-    int in_pipe[2];
-    int out_pipe[2];
-    if (pipe(in_pipe) == -1 || pipe(out_pipe) == -1) {
-        return NULL;
-    }
-
-    pid_t pid = fork();
-    if (pid == -1) {
-        close(in_pipe[0]); close(in_pipe[1]);
-        close(out_pipe[0]); close(out_pipe[1]);
-        return NULL;
-    }
-
-    if (pid == 0) {
-        /* Child: stdin from in_pipe[0], stdout to out_pipe[1] */
-        dup2(in_pipe[0], STDIN_FILENO);
-        dup2(out_pipe[1], STDOUT_FILENO);
-        /* Redirect stderr to /dev/null to suppress tool warnings */
-        int devnull = open("/dev/null", O_WRONLY);
-        if (devnull != -1) {
-            dup2(devnull, STDERR_FILENO);
-            close(devnull);
-        }
-        close(in_pipe[0]); close(in_pipe[1]);
-        close(out_pipe[0]); close(out_pipe[1]);
-
-        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-        _exit(127);
-    }
-
-    /* Parent */
-    close(in_pipe[0]);
-    close(out_pipe[1]);
-
-    /* Write input to child stdin */
-    size_t input_len = strlen(input);
-    ssize_t to_write = (ssize_t)input_len;
-    const char *p = input;
-    while (to_write > 0) {
-        ssize_t written = write(in_pipe[1], p, (size_t)to_write);
-        if (written <= 0) break;
-        p += written;
-        to_write -= written;
-    }
-    close(in_pipe[1]);
-
-    /* Read all of child's stdout */
-    size_t cap = 8192;
-    size_t size = 0;
-    char *buf = malloc(cap);
-    if (!buf) {
-        close(out_pipe[0]);
-        int status;
-        waitpid(pid, &status, 0);
-        return NULL;
-    }
-
-    for (;;) {
-        if (size + 4096 > cap) {
-            cap *= 2;
-            char *nb = realloc(buf, cap);
-            if (!nb) {
-                free(buf);
-                close(out_pipe[0]);
-                int status;
-                waitpid(pid, &status, 0);
-                return NULL;
-            }
-            buf = nb;
-        }
-        ssize_t n = read(out_pipe[0], buf + size, 4096);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            free(buf);
-            close(out_pipe[0]);
-            int status;
-            waitpid(pid, &status, 0);
-            return NULL;
-        }
-        if (n == 0) break;
-        size += (size_t)n;
-    }
-    close(out_pipe[0]);
-
-    /* Reap child */
-    int status;
-    waitpid(pid, &status, 0);
+    /* Suppress tool warnings */
+    apex_subprocess_options run_options = { NULL, HIGHLIGHT_TIMEOUT_MS, true };
+    apex_subprocess_result result;
+    char *output = apex_subprocess_run(cmd, input, strlen(input), &run_options, NULL, &result);
 
     /* Check if command succeeded */
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-        free(buf);
+    if (output && result.exit_status != 0) {
+        free(output);
         return NULL;
     }
-
-    buf[size] = '\0';
-    return buf;
+    return output;
 }
 
 /**
@@ -250,6 +165,15 @@ char *apex_apply_syntax_highlighting(const char *html, const char *tool, bool li
         return strdup(html);
     }
 
+    return apex_highlight_code_blocks(html, tool, line_numbers, language_only);
+}
+
+/**
+ * Highlight code blocks with a tool already known to be available.
+ */
+char *apex_highlight_code_blocks(const char *html, const char *tool, bool line_numbers, bool language_only) {
+    if (!html || !tool) return html ? strdup(html) : NULL;
+
     size_t html_len = strlen(html);
     /* Allocate generous buffer for output (highlighted code can be larger) */
     size_t cap = html_len * 3 + 1024;
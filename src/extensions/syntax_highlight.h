@@ -33,6 +33,14 @@
  */
 char *apex_apply_syntax_highlighting(const char *html, const char *tool, bool line_numbers, bool language_only);
 
+/**
+ * Same as apex_apply_syntax_highlighting() without the PATH check (and its
+ * warning), for callers that checked once with
+ * apex_syntax_highlighter_available() and highlight in several pieces.
+ * Safe to call from several threads at once.
+ */
+char *apex_highlight_code_blocks(const char *html, const char *tool, bool line_numbers, bool language_only);
+
 /**
  * Check if a syntax highlighting tool is available in PATH.
  *
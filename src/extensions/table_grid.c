@@ -0,0 +1,620 @@
+/**
+ * Table Grid Rendering
+ * Implementation
+ *
+ * The AST walk records, per table, a row list and a cell list (flat
+ * arrays shared by every table in the document) and resolves spans with a
+ * per-column map of the cell each ^^ merges into. Tables are then matched
+ * to the k-th <table> in the HTML (raw HTML tables take their own slots,
+ * but a table nested in a cell only deepens the one around it),
+ * and each one is written out from its grid: hidden cells and separator
+ * rows dropped, span attributes added to the cells' own tags, footer rows
+ * moved to <tfoot>, and the made-up header of a relaxed table moved into
+ * <tbody>.
+ * A table whose rendered rows and cells do not line up with its grid is
+ * copied unchanged.
+ */
+
+#include "table_grid.h"
+#include "table.h"
+#include "ial.h"
+#include "apex/buffer.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_INDEX SIZE_MAX
+
+typedef enum {
+    CELL_TEXT,
+    CELL_EMPTY,          /* No content at all */
+    CELL_DASH,           /* Only dashes (---, or an em dash from smart typography) */
+    CELL_COLSPAN_MARK,   /* << */
+    CELL_ROWSPAN_MARK,   /* ^^ */
+    CELL_FOOT_MARK       /* === */
+} cell_kind;
+
+typedef struct {
+    const apex_attributes *attrs;  /* The cell's IAL and alignment, or NULL */
+    cell_kind kind;
+    bool hidden;
+    int colspan;
+    int rowspan;
+} grid_cell;
+
+typedef struct {
+    size_t first_cell;
+    size_t cell_count;
+    bool hidden;         /* Caption row, or a === row with nothing else */
+    bool separator;      /* Every cell is dashes; not rendered */
+    bool foot;
+} grid_row;
+
+typedef struct {
+    size_t first_row;
+    size_t row_count;
+    const char *caption; /* Points into the table's attributes */
+    size_t caption_len;
+    bool foreign;        /* A <table> in raw HTML, left alone */
+} grid_table;
+
+typedef struct {
+    grid_table *tables;
+    size_t table_count, table_capacity;
+    grid_row *rows;
+    size_t row_count, row_capacity;
+    grid_cell *cells;
+    size_t cell_count, cell_capacity;
+} table_grids;
+
+/* The rendered rows and cells of one table */
+typedef struct {
+    const char *open;    /* Opening tag, without its '>' */
+    size_t open_len;
+    const char *content;
+    size_t content_len;
+    bool header;         /* <th> rather than <td> */
+} html_cell;
+
+typedef struct {
+    const char *open;    /* Opening tag, including its '>' */
+    size_t open_len;
+    size_t first_cell;
+    size_t cell_count;
+    bool head;           /* Inside <thead> */
+} html_row;
+
+typedef struct {
+    html_row *rows;
+    size_t row_count, row_capacity;
+    html_cell *cells;
+    size_t cell_count, cell_capacity;
+} html_table;
+
+/* Make room for one more element; false if out of memory */
+static bool reserve(void **array, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) return true;
+    size_t grown_capacity = *capacity ? *capacity * 2 : 16;
+    void *grown = realloc(*array, grown_capacity * size);
+    if (!grown) return false;
+    *array = grown;
+    *capacity = grown_capacity;
+    return true;
+}
+
+/* text trimmed of surrounding whitespace equals marker */
+static bool text_is(const char *text, const char *marker) {
+    if (!text) return false;
+    while (isspace((unsigned char)*text)) text++;
+    size_t len = strlen(marker);
+    if (strncmp(text, marker, len) != 0) return false;
+    text += len;
+    while (isspace((unsigned char)*text)) text++;
+    return *text == '\0';
+}
+
+/* Any text in node is just << (so **<<** counts too) */
+static bool contains_colspan_marker(cmark_node *node) {
+    for (cmark_node *child = cmark_node_first_child(node); child; child = cmark_node_next(child)) {
+        if (cmark_node_get_type(child) == CMARK_NODE_TEXT) {
+            if (text_is(cmark_node_get_literal(child), "<<")) return true;
+        } else if (contains_colspan_marker(child)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* All of node's children are text made of dashes, em dashes and colons */
+static bool is_dash_cell(cmark_node *node) {
+    bool dashes = false;
+    for (cmark_node *child = cmark_node_first_child(node); child; child = cmark_node_next(child)) {
+        if (cmark_node_get_type(child) != CMARK_NODE_TEXT) return false;
+        const char *p = cmark_node_get_literal(child);
+        while (p && *p) {
+            if (strncmp(p, "—", strlen("—")) == 0) {
+                p += strlen("—");
+            } else if (*p == '-' || *p == ':') {
+                p++;
+            } else if (isspace((unsigned char)*p)) {
+                p++;
+                continue;
+            } else {
+                return false;
+            }
+            dashes = true;
+        }
+    }
+    return dashes;
+}
+
+static cell_kind classify_cell(cmark_node *cell) {
+    cmark_node *first = cmark_node_first_child(cell);
+    if (!first) return CELL_EMPTY;
+    if (is_dash_cell(cell)) return CELL_DASH;
+
+    if (cmark_node_get_type(first) == CMARK_NODE_TEXT) {
+        const char *text = cmark_node_get_literal(first);
+        if (text_is(text, "^^")) return CELL_ROWSPAN_MARK;
+
+        const char *p = text ? text : "";
+        while (isspace((unsigned char)*p)) p++;
+        size_t equals = strspn(p, "=");
+        if (equals >= 3) {
+            p += equals;
+            while (isspace((unsigned char)*p)) p++;
+            if (*p == '\0') return CELL_FOOT_MARK;
+        }
+    }
+
+    return contains_colspan_marker(cell) ? CELL_COLSPAN_MARK : CELL_TEXT;
+}
+
+/* The caption stored by the advanced tables extension, if any */
+static void find_caption(grid_table *table, cmark_node *node) {
+    const apex_attributes *attrs = apex_node_attributes(node);
+    if (!attrs || !attrs->caption || !*attrs->caption) return;
+    table->caption = attrs->caption;
+    table->caption_len = strlen(attrs->caption);
+}
+
+/* Number of <table> tags in a raw HTML literal */
+static size_t count_table_tags(const char *text) {
+    size_t count = 0;
+    for (const char *p = text ? strstr(text, "<table") : NULL; p; p = strstr(p + 6, "<table")) {
+        if (p[6] == '>' || isspace((unsigned char)p[6])) count++;
+    }
+    return count;
+}
+
+/**
+ * Hide the marker cells and add their spans to the cells they merge into.
+ * A << cell widens the nearest visible cell to its left; a ^^ cell
+ * lengthens the cell it continues in that column, which stays the target
+ * for further ^^ cells below until a regular cell replaces it. Rows from
+ * the first === row on are the footer.
+ */
+static bool resolve_spans(table_grids *grids, const grid_table *table) {
+    size_t columns = 0;
+    for (size_t r = 0; r < table->row_count; r++) {
+        size_t count = grids->rows[table->first_row + r].cell_count;
+        if (count > columns) columns = count;
+    }
+
+    size_t *active = malloc((columns ? columns : 1) * sizeof(size_t));
+    if (!active) return false;
+    for (size_t c = 0; c < columns; c++) active[c] = NO_INDEX;
+
+    const grid_row *prev_row = NULL;
+    bool in_foot = false;
+
+    for (size_t r = 0; r < table->row_count; r++) {
+        grid_row *row = &grids->rows[table->first_row + r];
+        if (row->hidden) continue;
+        grid_cell *cells = &grids->cells[row->first_cell];
+
+        bool foot_marker = false;
+        bool separator = row->cell_count > 0;
+        for (size_t c = 0; c < row->cell_count; c++) {
+            if (cells[c].kind == CELL_FOOT_MARK) {
+                foot_marker = true;
+                cells[c].hidden = true;
+            }
+            if (cells[c].kind != CELL_DASH) separator = false;  /* An all-empty row is kept */
+        }
+        in_foot = in_foot || foot_marker;
+        row->foot = in_foot;
+        row->separator = separator;
+        if (separator) continue;  /* Not a row for ^^ below to continue */
+
+        size_t left = NO_INDEX;
+        bool visible = false;
+        for (size_t c = 0; c < row->cell_count; c++) {
+            grid_cell *cell = &cells[c];
+            if (cell->hidden) continue;
+
+            if (cell->kind == CELL_COLSPAN_MARK) {
+                cell->hidden = true;
+                if (left != NO_INDEX) cells[left].colspan++;
+            } else if (cell->kind == CELL_ROWSPAN_MARK) {
+                cell->hidden = true;
+                size_t target = active[c];
+                if (target == NO_INDEX && prev_row && c < prev_row->cell_count &&
+                    !grids->cells[prev_row->first_cell + c].hidden) {
+                    target = prev_row->first_cell + c;
+                    active[c] = target;
+                }
+                if (target != NO_INDEX) grids->cells[target].rowspan++;
+            } else {
+                active[c] = row->first_cell + c;
+                left = c;
+                visible = true;
+            }
+        }
+
+        prev_row = row;
+        if (foot_marker && !visible) row->hidden = true;
+    }
+
+    free(active);
+    return true;
+}
+
+/* Build the grids for every table in document order */
+static bool build_grids(table_grids *grids, cmark_node *document, bool raw_html) {
+    cmark_iter *iter = cmark_iter_new(document);
+    if (!iter) return false;
+
+    bool ok = true;
+    grid_table *table = NULL;
+    cmark_event_type ev;
+
+    while (ok && (ev = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+        cmark_node *node = cmark_iter_get_node(iter);
+        cmark_node_type type = cmark_node_get_type(node);
+
+        if (type == CMARK_NODE_TABLE) {
+            if (ev == CMARK_EVENT_EXIT) {
+                ok = resolve_spans(grids, table);
+                table = NULL;
+                continue;
+            }
+            if (!reserve((void **)&grids->tables, &grids->table_capacity, grids->table_count, sizeof(grid_table))) {
+                ok = false;
+                break;
+            }
+            table = &grids->tables[grids->table_count++];
+            memset(table, 0, sizeof(*table));
+            table->first_row = grids->row_count;
+            find_caption(table, node);
+        } else if (ev != CMARK_EVENT_ENTER || !table) {
+            if (raw_html && ev == CMARK_EVENT_ENTER &&
+                (type == CMARK_NODE_HTML_BLOCK || type == CMARK_NODE_HTML_INLINE)) {
+                for (size_t n = count_table_tags(cmark_node_get_literal(node)); n > 0; n--) {
+                    if (!reserve((void **)&grids->tables, &grids->table_capacity, grids->table_count, sizeof(grid_table))) {
+                        ok = false;
+                        break;
+                    }
+                    grid_table *foreign = &grids->tables[grids->table_count++];
+                    memset(foreign, 0, sizeof(*foreign));
+                    foreign->foreign = true;
+                }
+            }
+        } else if (type == CMARK_NODE_TABLE_ROW) {
+            if (!reserve((void **)&grids->rows, &grids->row_capacity, grids->row_count, sizeof(grid_row))) {
+                ok = false;
+                break;
+            }
+            grid_row *row = &grids->rows[grids->row_count++];
+            memset(row, 0, sizeof(*row));
+            row->first_cell = grids->cell_count;
+            const apex_attributes *attrs = apex_node_attributes(node);
+            row->hidden = attrs && attrs->remove;  /* Caption row */
+            table->row_count++;
+        } else if (type == CMARK_NODE_TABLE_CELL && table->row_count > 0) {
+            if (!reserve((void **)&grids->cells, &grids->cell_capacity, grids->cell_count, sizeof(grid_cell))) {
+                ok = false;
+                break;
+            }
+            grid_cell *cell = &grids->cells[grids->cell_count++];
+            cell->attrs = apex_node_attributes(node);
+            cell->kind = classify_cell(node);
+            cell->hidden = false;
+            cell->colspan = 1;
+            cell->rowspan = 1;
+            grids->rows[grids->row_count - 1].cell_count++;
+        }
+    }
+
+    cmark_iter_free(iter);
+    return ok;
+}
+
+static void table_grids_free(table_grids *grids) {
+    free(grids->tables);
+    free(grids->rows);
+    free(grids->cells);
+}
+
+/* p starts the tag name followed by the end of the name */
+static bool tag_at(const char *p, const char *end, const char *name) {
+    size_t len = strlen(name);
+    if ((size_t)(end - p) <= len || strncmp(p, name, len) != 0) return false;
+    return p[len] == '>' || isspace((unsigned char)p[len]);
+}
+
+/* The </table> closing a table whose content starts at p; tables nested
+ * in it (raw HTML in a cell) are depth, not the end */
+static const char *table_close(const char *p) {
+    int depth = 0;
+    for (p = strchr(p, '<'); p; p = strchr(p + 1, '<')) {
+        if (strncmp(p, "</table>", 8) == 0) {
+            if (depth == 0) return p;
+            depth--;
+        } else if (strncmp(p, "<table", 6) == 0 && (p[6] == '>' || isspace((unsigned char)p[6]))) {
+            depth++;
+        }
+    }
+    return NULL;
+}
+
+/* The close tag ending a cell whose content starts at p, past any tables
+ * nested in the cell */
+static const char *cell_close(const char *p, const char *end, const char *close) {
+    while (p < end && (p = memchr(p, '<', (size_t)(end - p)))) {
+        if (strncmp(p, close, 5) == 0) return p;
+        if (tag_at(p, end, "<table")) {
+            const char *nested = table_close(p + 6);
+            if (!nested) return NULL;
+            p = nested + 8;
+            continue;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Scan the rendered rows and cells of the table in [start, end) */
+static bool scan_html_table(html_table *out, const char *start, const char *end) {
+    out->row_count = 0;
+    out->cell_count = 0;
+    bool in_head = false;
+
+    for (const char *p = start; p < end;) {
+        p = memchr(p, '<', (size_t)(end - p));
+        if (!p) break;
+
+        if (tag_at(p, end, "<thead")) {
+            in_head = true;
+        } else if (strncmp(p, "</thead>", 8) == 0) {
+            in_head = false;
+        } else if (tag_at(p, end, "<tr")) {
+            const char *gt = memchr(p, '>', (size_t)(end - p));
+            if (!gt) return false;
+            if (!reserve((void **)&out->rows, &out->row_capacity, out->row_count, sizeof(html_row))) return false;
+            html_row *row = &out->rows[out->row_count++];
+            row->open = p;
+            row->open_len = (size_t)(gt + 1 - p);
+            row->first_cell = out->cell_count;
+            row->cell_count = 0;
+            row->head = in_head;
+            p = gt + 1;
+            continue;
+        } else if (tag_at(p, end, "<td") || tag_at(p, end, "<th")) {
+            bool header = p[2] == 'h';
+            const char *gt = memchr(p, '>', (size_t)(end - p));
+            if (!gt || out->row_count == 0) return false;
+            const char *close = cell_close(gt + 1, end, header ? "</th>" : "</td>");
+            if (!close || close >= end) return false;
+            if (!reserve((void **)&out->cells, &out->cell_capacity, out->cell_count, sizeof(html_cell))) return false;
+            html_cell *cell = &out->cells[out->cell_count++];
+            cell->open = p;
+            cell->open_len = (size_t)(gt - p);
+            cell->content = gt + 1;
+            cell->content_len = (size_t)(close - (gt + 1));
+            cell->header = header;
+            out->rows[out->row_count - 1].cell_count++;
+            p = close + 5;
+            continue;
+        }
+        p++;
+    }
+    return true;
+}
+
+static bool shapes_match(const table_grids *grids, const grid_table *table, const html_table *html) {
+    if (html->row_count != table->row_count) return false;
+    for (size_t r = 0; r < table->row_count; r++) {
+        if (html->rows[r].cell_count != grids->rows[table->first_row + r].cell_count) return false;
+    }
+    return true;
+}
+
+static void append_escaped(apex_buffer *out, const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        switch (text[i]) {
+            case '&': apex_buffer_append_str(out, "&amp;"); break;
+            case '<': apex_buffer_append_str(out, "&lt;"); break;
+            case '>': apex_buffer_append_str(out, "&gt;"); break;
+            case '"': apex_buffer_append_str(out, "&quot;"); break;
+            default: apex_buffer_append_char(out, text[i]); break;
+        }
+    }
+}
+
+static void append_figcaption(apex_buffer *out, const grid_table *table) {
+    apex_buffer_append_str(out, "<figcaption>");
+    append_escaped(out, table->caption, table->caption_len);
+    apex_buffer_append_str(out, "</figcaption>\n");
+}
+
+/* Whitespace only */
+static bool is_blank(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isspace((unsigned char)text[i])) return false;
+    }
+    return true;
+}
+
+typedef enum { SECTION_NONE, SECTION_HEAD, SECTION_BODY, SECTION_FOOT } table_section;
+
+static const char *const section_open[] = { "", "<thead>\n", "<tbody>\n", "<tfoot>\n" };
+static const char *const section_close[] = { "", "</thead>\n", "</tbody>\n", "</tfoot>\n" };
+
+/**
+ * Write one table from its grid. tag is the rendered <table ...> tag;
+ * the rows follow from html. Separator rows are dropped, and with
+ * relaxed set a table with no separator row in its body had its header
+ * row made up by the relaxed table preprocessor, so that row is written
+ * as a body row.
+ */
+static void render_table(apex_buffer *out, const table_grids *grids, const grid_table *table,
+                         const html_table *html, const char *tag, size_t tag_len, int caption_position,
+                         bool relaxed) {
+    if (table->caption) {
+        apex_buffer_append_str(out, "<figure class=\"table-figure\">\n");
+        if (caption_position == 0) append_figcaption(out, table);
+    }
+
+    /* Attributes written straight after the tag name (<tableid=...) */
+    apex_buffer_append(out, tag, 6);
+    if (tag[6] != '>' && !isspace((unsigned char)tag[6])) apex_buffer_append_char(out, ' ');
+    apex_buffer_append(out, tag + 6, tag_len - 6);
+    apex_buffer_append_char(out, '\n');
+
+    /* An empty first header cell makes the first column row headers */
+    bool row_headers = false;
+    for (size_t r = 0; r < table->row_count; r++) {
+        const grid_row *row = &grids->rows[table->first_row + r];
+        if (!html->rows[r].head) break;
+        if (row->hidden || row->separator || row->cell_count == 0) continue;
+        const html_cell *first = &html->cells[html->rows[r].first_cell];
+        row_headers = is_blank(first->content, first->content_len);
+        break;
+    }
+
+    bool head_as_body = false;
+    if (relaxed) {
+        bool has_body = false;
+        bool body_separator = false;
+        for (size_t r = 0; r < table->row_count; r++) {
+            const grid_row *row = &grids->rows[table->first_row + r];
+            if (row->hidden || row->foot || html->rows[r].head) continue;
+            has_body = true;
+            body_separator = body_separator || row->separator;
+        }
+        head_as_body = has_body && !body_separator;
+    }
+
+    table_section section = SECTION_NONE;
+    for (size_t r = 0; r < table->row_count; r++) {
+        const grid_row *row = &grids->rows[table->first_row + r];
+        const html_row *hrow = &html->rows[r];
+        if (row->hidden || row->separator) continue;
+
+        bool head = hrow->head && !head_as_body;
+        table_section wanted = head ? SECTION_HEAD : row->foot ? SECTION_FOOT : SECTION_BODY;
+        if (wanted != section) {
+            apex_buffer_append_str(out, section_close[section]);
+            apex_buffer_append_str(out, section_open[wanted]);
+            section = wanted;
+        }
+
+        apex_buffer_append(out, hrow->open, hrow->open_len);
+        apex_buffer_append_char(out, '\n');
+
+        for (size_t c = 0; c < row->cell_count; c++) {
+            const grid_cell *cell = &grids->cells[row->first_cell + c];
+            const html_cell *hcell = &html->cells[hrow->first_cell + c];
+            if (cell->hidden) continue;
+
+            bool spans = cell->colspan > 1 || cell->rowspan > 1;
+            bool header = hcell->header && !(hrow->head && head_as_body);
+            if (row_headers && !hrow->head && section == SECTION_BODY && c == 0 && !spans) {
+                apex_buffer_append_str(out, "<th scope=\"row\"");
+                header = true;
+            } else if (header == hcell->header) {
+                apex_buffer_append(out, hcell->open, hcell->open_len);
+            } else {
+                /* <th ...> of a header row written into the body */
+                apex_buffer_append_str(out, "<td");
+                apex_buffer_append(out, hcell->open + 3, hcell->open_len - 3);
+            }
+
+            /* Every cell's own attributes (IAL, alignment), then its spans */
+            apex_attributes_render(cell->attrs, out);
+            if (cell->colspan > 1) {
+                char span[48];
+                snprintf(span, sizeof(span), " colspan=\"%d\"", cell->colspan);
+                apex_buffer_append_str(out, span);
+            }
+            if (cell->rowspan > 1) {
+                char span[48];
+                snprintf(span, sizeof(span), " rowspan=\"%d\"", cell->rowspan);
+                apex_buffer_append_str(out, span);
+            }
+            apex_buffer_append_char(out, '>');
+            apex_buffer_append(out, hcell->content, hcell->content_len);
+            apex_buffer_append_str(out, header ? "</th>\n" : "</td>\n");
+        }
+        apex_buffer_append_str(out, "</tr>\n");
+    }
+    apex_buffer_append_str(out, section_close[section]);
+    apex_buffer_append_str(out, "</table>");
+
+    if (table->caption) {
+        if (caption_position != 0) append_figcaption(out, table);
+        apex_buffer_append_str(out, "</figure>\n");
+    }
+}
+
+char *apex_render_table_grids(const char *html, cmark_node *document, int caption_position, bool raw_html,
+                              bool relaxed) {
+    if (!html || !document || !strstr(html, "<table")) return NULL;
+
+    table_grids grids;
+    memset(&grids, 0, sizeof(grids));
+    if (!build_grids(&grids, document, raw_html) || grids.table_count == 0) {
+        table_grids_free(&grids);
+        return NULL;
+    }
+
+    html_table scanned;
+    memset(&scanned, 0, sizeof(scanned));
+    apex_buffer out;
+    apex_buffer_init(&out, strlen(html) + 1024);
+    if (!out.data) {
+        table_grids_free(&grids);
+        return NULL;
+    }
+
+    size_t slot = 0;
+    const char *copied = html;
+    for (const char *p = strstr(html, "<table"); p && slot < grids.table_count; p = strstr(p + 6, "<table")) {
+        /* Also take <tableid=...>, which the attribute renderer can emit */
+        bool spaced = p[6] == '>' || isspace((unsigned char)p[6]);
+        if (!spaced && strncmp(p + 6, "id=", 3) != 0 && strncmp(p + 6, "class=", 6) != 0) continue;
+
+        const grid_table *table = &grids.tables[slot++];
+        if (table->foreign) continue;
+
+        const char *tag_end = strchr(p, '>');
+        const char *end = tag_end ? table_close(tag_end + 1) : NULL;
+        if (!end) break;
+
+        if (scan_html_table(&scanned, tag_end + 1, end) && shapes_match(&grids, table, &scanned)) {
+            apex_buffer_append(&out, copied, (size_t)(p - copied));
+            render_table(&out, &grids, table, &scanned, p, (size_t)(tag_end + 1 - p), caption_position, relaxed);
+            copied = end + strlen("</table>");
+        }
+        p = end;
+    }
+    apex_buffer_append_str(&out, copied);
+
+    free(scanned.rows);
+    free(scanned.cells);
+    table_grids_free(&grids);
+    return apex_buffer_detach(&out);
+}
@@ -0,0 +1,38 @@
+/**
+ * Table Grid Rendering
+ *
+ * Builds a row/column model of every table in the document once, from
+ * the cmark table nodes: which cells are hidden (<<, ^^ and === markers,
+ * caption rows), the colspan and rowspan of the cells they merge into,
+ * which rows belong to the footer, and which rows are only dashes. The
+ * rendered HTML for each table is then rewritten from that model in one
+ * pass, keeping cmark's markup for each cell's tag and content.
+ */
+
+#ifndef APEX_TABLE_GRID_H
+#define APEX_TABLE_GRID_H
+
+#include "cmark-gfm.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Apply spans, footers, row headers and captions to the tables in html
+ * @param html HTML rendered from document
+ * @param document AST document node
+ * @param caption_position 0=above, 1=below
+ * @param raw_html Raw HTML was rendered (so a <table> in it is in html)
+ * @param relaxed Relaxed tables are enabled (header rows may be made up)
+ * @return Newly allocated HTML, or NULL if there was nothing to change
+ */
+char *apex_render_table_grids(const char *html, cmark_node *document, int caption_position, bool raw_html,
+                              bool relaxed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_TABLE_GRID_H */
@@ -5,147 +5,137 @@
 
 #include "toc.h"
 #include "header_ids.h"
+#include "apex/buffer.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 
 /**
- * Collect headers from AST
+ * The document's headings as a tree: for each heading, the nearest
+ * earlier heading above it and the end of its section
  */
-typedef struct header_item {
-    int level;
-    char *text;
-    char *id;
-    struct header_item *next;
-} header_item;
-
-static void free_headers(header_item *headers) {
-    while (headers) {
-        header_item *next = headers->next;
-        free(headers->text);
-        free(headers->id);
-        free(headers);
-        headers = next;
+typedef struct {
+    const apex_heading_table *table;
+    size_t *parent;         /* Index of the enclosing heading, or count for none */
+    size_t *section_end;    /* Index of the next heading at its level or above, or count */
+} heading_tree;
+
+static bool heading_tree_build(heading_tree *tree, const apex_heading_table *table) {
+    size_t count = table->count;
+    tree->table = table;
+    tree->parent = malloc(count * sizeof(size_t));
+    tree->section_end = malloc(count * sizeof(size_t));
+    size_t *stack = malloc(count * sizeof(size_t));
+    if (!tree->parent || !tree->section_end || !stack) {
+        free(tree->parent);
+        free(tree->section_end);
+        free(stack);
+        return false;
     }
-}
 
+    /* The stack holds the open sections, levels strictly increasing */
+    size_t depth = 0;
+    for (size_t i = 0; i < count; i++) {
+        int level = table->headings[i].level;
+        while (depth > 0 && table->headings[stack[depth - 1]].level >= level) {
+            tree->section_end[stack[--depth]] = i;
+        }
+        tree->parent[i] = depth > 0 ? stack[depth - 1] : count;
+        stack[depth++] = i;
+    }
+    while (depth > 0) tree->section_end[stack[--depth]] = count;
+
+    free(stack);
+    return true;
+}
 
+static void heading_tree_free(heading_tree *tree) {
+    free(tree->parent);
+    free(tree->section_end);
+}
 
 /**
- * Collect all headers from document
+ * A marker lists the headings of the section it sits in when it only asks
+ * for levels below that section's heading ({{TOC:2-3}} under an H1), and
+ * the whole document otherwise. following is the number of headings
+ * before the marker.
  */
-static header_item *collect_headers(cmark_node *node, header_item **tail) {
-    if (!node) return NULL;
-
-    header_item *headers = NULL;
-    if (!tail) tail = &headers;
-
-    /* Check if current node is a header */
-    if (cmark_node_get_type(node) == CMARK_NODE_HEADING) {
-        /* Skip headings marked with the Kramdown-style ".no_toc" class.
-         * The IAL processor stores attributes as a raw HTML attribute
-         * string in the node's user_data, e.g. id="..." class="a b no_toc".
-         * If we see "no_toc" in the attribute string, we exclude this
-         * heading from the generated table of contents.
-         */
-        const char *attrs = (const char *)cmark_node_get_user_data(node);
-        if (!(attrs && strstr(attrs, "no_toc") != NULL)) {
-            header_item *item = malloc(sizeof(header_item));
-            if (item) {
-                item->level = cmark_node_get_heading_level(node);
-                item->text = apex_extract_heading_text(node);
-                item->id = NULL;  /* Will be set later with format */
-                item->next = NULL;
-
-                if (*tail) {
-                    (*tail)->next = item;
-                } else {
-                    headers = item;
-                }
-                *tail = item;
-            }
+static void toc_scope(const heading_tree *tree, size_t following, int min_level,
+                      size_t *start, size_t *end) {
+    size_t count = tree->table->count;
+    *start = 0;
+    *end = count;
+    for (size_t i = following > 0 ? following - 1 : count; i < count; i = tree->parent[i]) {
+        if (tree->table->headings[i].level < min_level) {
+            *start = i + 1;
+            *end = tree->section_end[i];
+            return;
         }
     }
-
-    /* Recursively process children */
-    for (cmark_node *child = cmark_node_first_child(node); child; child = cmark_node_next(child)) {
-        header_item *child_headers = collect_headers(child, tail);
-        if (!headers) headers = child_headers;
-    }
-
-    return headers;
 }
 
 /**
- * Generate TOC HTML from headers
+ * Generate TOC HTML for headings [start, end)
  */
-static char *generate_toc_html(header_item *headers, int min_level, int max_level) {
-    if (!headers) return strdup("");
-
-    size_t capacity = 4096;
-    char *html = malloc(capacity);
-    if (!html) return strdup("");
-
-    char *write = html;
-    size_t remaining = capacity;
+static char *generate_toc_html(const apex_heading_table *headings, size_t start, size_t end,
+                               int min_level, int max_level) {
+    apex_buffer out;
+    apex_buffer_init(&out, 1024);
+    if (!out.data) return NULL;
     int current_level = 0;
 
-    #define APPEND(str) do { \
-        size_t len = strlen(str); \
-        if (len < remaining) { \
-            memcpy(write, str, len); \
-            write += len; \
-            remaining -= len; \
-        } \
-    } while(0)
+    apex_buffer_append_str(&out, "<nav class=\"toc\">\n");
 
-    APPEND("<nav class=\"toc\">\n");
+    for (size_t i = start; i < end; i++) {
+        const apex_heading *h = &headings->headings[i];
 
-    for (header_item *h = headers; h; h = h->next) {
-        /* Skip headers outside min/max range */
-        if (h->level < min_level || h->level > max_level) continue;
+        /* Skip headers outside min/max range, and those marked no_toc */
+        if (!h->in_toc || h->level < min_level || h->level > max_level) continue;
 
         /* Close lists if going up levels */
         while (current_level > h->level) {
-            APPEND("</ul>\n");
+            apex_buffer_append_str(&out, "</ul>\n");
             current_level--;
         }
 
         /* Open lists if going down levels */
         while (current_level < h->level) {
-            APPEND("<ul>\n");
+            apex_buffer_append_str(&out, "<ul>\n");
             current_level++;
         }
 
         /* Add list item */
-        char item[1024];
-        snprintf(item, sizeof(item), "<li><a href=\"#%s\">%s</a></li>\n",
-                 h->id, h->text);
-        APPEND(item);
+        apex_buffer_append_str(&out, "<li><a href=\"#");
+        apex_buffer_append_str(&out, h->id ? h->id : "");
+        apex_buffer_append_str(&out, "\">");
+        apex_buffer_append_str(&out, h->text ? h->text : "");
+        apex_buffer_append_str(&out, "</a></li>\n");
     }
 
     /* Close remaining lists */
     while (current_level > 0) {
-        APPEND("</ul>\n");
+        apex_buffer_append_str(&out, "</ul>\n");
         current_level--;
     }
 
-    APPEND("</nav>\n");
-
-    #undef APPEND
-
-    *write = '\0';
-    return html;
+    apex_buffer_append_str(&out, "</nav>\n");
+    return apex_buffer_detach(&out);
 }
 
 /**
- * Parse TOC marker for min/max levels
+ * Parse TOC marker (len bytes) for min/max levels
  */
-static void parse_toc_marker(const char *marker, int *min_level, int *max_level) {
+static void parse_toc_marker(const char *marker_text, size_t len, int *min_level, int *max_level) {
     *min_level = 1;
     *max_level = 6;
 
+    /* Only look inside the marker itself */
+    char marker[256];
+    if (len >= sizeof(marker)) len = sizeof(marker) - 1;
+    memcpy(marker, marker_text, len);
+    marker[len] = '\0';
+
     /* Look for max and min parameters */
     const char *max_str = strstr(marker, "max");
     const char *min_str = strstr(marker, "min");
@@ -181,75 +171,174 @@ static void parse_toc_marker(const char *marker, int *min_level, int *max_level)
 }
 
 /**
- * Process TOC markers in HTML
+ * TOCs already generated, so markers with the same scope and range share
+ * one copy
  */
-char *apex_process_toc(const char *html, cmark_node *document, int id_format) {
-    if (!html || !document) return html ? strdup(html) : NULL;
-
-    /* Check if there are any TOC markers */
-    const char *toc_marker = strstr(html, "<!--TOC");
-    const char *toc_mmd = strstr(html, "{{TOC");
+typedef struct {
+    size_t start;
+    size_t end;
+    int min_level;
+    int max_level;
+    char *html;
+} toc_cache_entry;
+
+typedef struct {
+    toc_cache_entry *entries;
+    size_t count;
+    size_t capacity;
+} toc_cache;
+
+static const char *toc_cache_get(toc_cache *cache, const apex_heading_table *headings,
+                                 size_t start, size_t end, int min_level, int max_level) {
+    for (size_t i = 0; i < cache->count; i++) {
+        toc_cache_entry *e = &cache->entries[i];
+        if (e->start == start && e->end == end && e->min_level == min_level && e->max_level == max_level) {
+            return e->html;
+        }
+    }
 
-    if (!toc_marker && !toc_mmd) {
-        return strdup(html);  /* No TOC markers, return as-is */
+    if (cache->count == cache->capacity) {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 8;
+        toc_cache_entry *grown = realloc(cache->entries, capacity * sizeof(toc_cache_entry));
+        if (!grown) return NULL;
+        cache->entries = grown;
+        cache->capacity = capacity;
     }
 
-    /* Collect headers from document */
-    header_item *tail = NULL;
-    header_item *headers = collect_headers(document, &tail);
-    if (!headers) return strdup(html);
+    char *html = generate_toc_html(headings, start, end, min_level, max_level);
+    if (!html) return NULL;
+    toc_cache_entry *e = &cache->entries[cache->count++];
+    e->start = start;
+    e->end = end;
+    e->min_level = min_level;
+    e->max_level = max_level;
+    e->html = html;
+    return html;
+}
+
+static void toc_cache_free(toc_cache *cache) {
+    for (size_t i = 0; i < cache->count; i++) free(cache->entries[i].html);
+    free(cache->entries);
+}
 
-    /* Generate IDs for all headers using the specified format */
-    for (header_item *h = headers; h; h = h->next) {
-        h->id = apex_generate_header_id(h->text, (apex_id_format_t)id_format);
+/* Length of the TOC marker at p ("<!--TOC ...-->" or "{{TOC...}}"), or 0 */
+static size_t toc_marker_length(const char *p) {
+    const char *end = NULL;
+    if (strncmp(p, "<!--TOC", 7) == 0) {
+        end = strstr(p + 7, "-->");
+        if (end) end += 3;
+    } else if (strncmp(p, "{{TOC", 5) == 0) {
+        end = strstr(p + 5, "}}");
+        if (end) end += 2;
     }
+    return end ? (size_t)(end - p) : 0;
+}
 
-    /* Find the marker and parse it */
-    const char *marker = toc_marker ? toc_marker : toc_mmd;
-    int min_level, max_level;
-    parse_toc_marker(marker, &min_level, &max_level);
+/* End of the <pre> or <code> element opening at p (past its closing
+ * tag), or NULL if p does not open one: markers shown in code stay text */
+static const char *code_element_end(const char *p) {
+    const char *close;
+    if (strncmp(p, "<pre", 4) == 0 && (p[4] == '>' || isspace((unsigned char)p[4]))) {
+        close = "</pre>";
+    } else if (strncmp(p, "<code", 5) == 0 && (p[5] == '>' || isspace((unsigned char)p[5]))) {
+        close = "</code>";
+    } else {
+        return NULL;
+    }
+    const char *end = strstr(p, close);
+    return end ? end + strlen(close) : p + strlen(p);
+}
 
-    /* Generate TOC HTML */
-    char *toc_html = generate_toc_html(headers, min_level, max_level);
-    free_headers(headers);
+/* Headings following the heading tag at p when tags can't be matched to
+ * the table by position: the tag counts only if its id is a table ID still
+ * ahead, so raw HTML headings without one are stepped over */
+static size_t heading_following_by_id(const apex_heading_table *headings, size_t following, const char *p) {
+    const char *end = strchr(p, '>');
+    if (!end) return following;
+    const char *id = p + 3;
+    while ((id = strstr(id, "id=\"")) && id < end && !isspace((unsigned char)id[-1])) id += 4;
+    if (!id || id >= end) return following;
+    id += 4;
+    const char *id_end = memchr(id, '"', (size_t)(end - id));
+    if (!id_end) return following;
+
+    size_t len = (size_t)(id_end - id);
+    for (size_t i = following; i < headings->count; i++) {
+        const char *want = headings->headings[i].id;
+        if (want && strlen(want) == len && memcmp(want, id, len) == 0) return i + 1;
+    }
+    return following;
+}
 
-    if (!toc_html) return strdup(html);
+/**
+ * Process TOC markers in HTML
+ */
+char *apex_process_toc(const char *html, const apex_heading_table *headings) {
+    if (!html || !headings) return html ? strdup(html) : NULL;
 
-    /* Replace marker with TOC */
-    size_t html_len = strlen(html);
-    size_t toc_len = strlen(toc_html);
-    size_t output_capacity = html_len + toc_len + 100;
-    char *output = malloc(output_capacity);
-    if (!output) {
-        free(toc_html);
-        return strdup(html);
+    /* Check if there are any TOC markers */
+    if (!strstr(html, "<!--TOC") && !strstr(html, "{{TOC")) {
+        return strdup(html);  /* No TOC markers, return as-is */
     }
 
-    /* Find end of marker */
-    const char *marker_end = NULL;
-    if (toc_marker) {
-        marker_end = strstr(marker, "-->");
-        if (marker_end) marker_end += 3;
-    } else if (toc_mmd) {
-        marker_end = strstr(marker, "}}");
-        if (marker_end) marker_end += 2;
-    }
+    if (headings->count == 0) return strdup(html);
 
-    if (!marker_end) {
-        free(toc_html);
-        free(output);
+    heading_tree tree;
+    if (!heading_tree_build(&tree, headings)) return strdup(html);
+    toc_cache cache = { NULL, 0, 0 };
+
+    apex_buffer out;
+    apex_buffer_init(&out, strlen(html) + 4096);
+    if (!out.data) {
+        heading_tree_free(&tree);
         return strdup(html);
     }
 
-    /* Build output: before + TOC + after */
-    size_t before_len = marker - html;
-    size_t after_len = strlen(marker_end);
+    /* One pass: match heading tags to the table (in document order,
+     * stepping over raw HTML headings) and replace each marker outside
+     * code with the TOC for its scope */
+    bool by_id = headings->raw_html_headings && !headings->html_tags_known;
+    size_t following = 0;
+    size_t tag = 0;
+    const char *copied = html;
+    for (const char *p = html; *p; p++) {
+        if (*p != '<' && *p != '{') continue;
+
+        if (p[0] == '<' && p[1] == 'h' && p[2] >= '1' && p[2] <= '6' &&
+            (p[3] == '>' || isspace((unsigned char)p[3]))) {
+            if (by_id) {
+                following = heading_following_by_id(headings, following, p);
+            } else if (following < headings->count && !apex_heading_table_is_raw_tag(headings, tag, following)) {
+                following++;
+            }
+            tag++;
+            continue;
+        }
+
+        const char *code_end = *p == '<' ? code_element_end(p) : NULL;
+        if (code_end) {
+            p = code_end - 1;
+            continue;
+        }
 
-    memcpy(output, html, before_len);
-    memcpy(output + before_len, toc_html, toc_len);
-    memcpy(output + before_len + toc_len, marker_end, after_len + 1);
+        size_t marker_len = toc_marker_length(p);
+        if (marker_len == 0) continue;
 
-    free(toc_html);
-    return output;
-}
+        int min_level, max_level;
+        parse_toc_marker(p, marker_len, &min_level, &max_level);
+        size_t start, end;
+        toc_scope(&tree, following, min_level, &start, &end);
+        const char *toc_html = toc_cache_get(&cache, headings, start, end, min_level, max_level);
+        if (!toc_html) continue;
 
+        apex_buffer_append(&out, copied, (size_t)(p - copied));
+        apex_buffer_append_str(&out, toc_html);
+        p += marker_len - 1;
+        copied = p + 1;
+    }
+    apex_buffer_append_str(&out, copied);
+
+    toc_cache_free(&cache);
+    heading_tree_free(&tree);
+    return apex_buffer_detach(&out);
+}
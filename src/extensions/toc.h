@@ -12,6 +12,7 @@
 #define APEX_TOC_H
 
 #include "cmark-gfm.h"
+#include "header_ids.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,10 +22,9 @@ extern "C" {
  * Process TOC markers and generate table of contents
  * Returns new HTML with TOC inserted at markers
  * @param html The HTML output
- * @param document The AST document
- * @param id_format 0=GFM (with dashes), 1=MMD (no dashes)
+ * @param headings The document's heading table (levels, text and IDs)
  */
-char *apex_process_toc(const char *html, cmark_node *document, int id_format);
+char *apex_process_toc(const char *html, const apex_heading_table *headings);
 
 #ifdef __cplusplus
 }
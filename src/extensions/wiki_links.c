@@ -17,8 +17,8 @@
 __attribute__((unused))
 static const char WIKI_OPEN_CHAR = '[';
 
-/* Default configuration */
-static wiki_link_config default_config = {
+/* Default configuration (read-only: shared by concurrent conversions) */
+static const wiki_link_config default_config = {
     .base_path = "",
     .extension = "",
     .space_mode = WIKILINK_SPACE_DASH  /* Default: convert spaces to dashes */
@@ -88,7 +88,7 @@ static void parse_wiki_link(const char *content, int len,
 /**
  * Convert page name to URL
  */
-static char *page_to_url(const char *page, const char *section, wiki_link_config *config) {
+static char *page_to_url(const char *page, const char *section, const wiki_link_config *config) {
     if (!page) return NULL;
 
     /* Default configuration if none provided */
@@ -199,8 +199,7 @@ static cmark_node *match_wiki_link(cmark_syntax_extension *self,
     if (!page) return NULL;
 
     /* Get configuration */
-    wiki_link_config *config = (wiki_link_config *)cmark_syntax_extension_get_private(self);
-    if (!config) config = &default_config;
+    const wiki_link_config *config = (const wiki_link_config *)cmark_syntax_extension_get_private(self);
 
     /* Create URL */
     char *url = page_to_url(page, section, config);
@@ -266,9 +265,6 @@ void apex_process_wiki_links_in_tree(cmark_node *node, wiki_link_config *config)
         const char *first_marker = strstr(literal, "[[");
         if (!first_marker) goto recurse;
 
-        /* Default configuration if none provided */
-        if (!config) config = &default_config;
-
         /* Rebuild this text node in a single pass to avoid repeated rescans */
         const char *cursor = literal;
         cmark_node *insert_after = NULL;
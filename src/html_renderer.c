@@ -6,7 +6,14 @@
 #include "html_renderer.h"
 #include "table.h"  /* For CMARK_NODE_TABLE */
 #include "extensions/header_ids.h"
+#include "extensions/ial.h"
+#include "apex/buffer.h"
+#include "cmark-gfm-extension_api.h"
+#include "syntax_extension.h"
+#include "html.h"
+#include "houdini.h"
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -31,878 +38,399 @@ static char *inject_attributes_in_html(const char *html, cmark_node *document) {
 }
 
 /**
- * Walk AST and collect nodes with attributes
+ * Nodes with attributes are rendered through a stand-in syntax extension,
+ * so each node's attributes go into its own tag as cmark writes it. Core
+ * nodes are written here the way cmark's HTML renderer writes them;
+ * extension nodes are written by their extension and have the attributes
+ * added after the tag name. Table rows and cells are left to
+ * apex_render_table_grids(), which writes their attributes itself.
  */
-typedef struct attr_node {
-    cmark_node *node;
-    char *attrs;
-    cmark_node_type node_type;
-    int element_index;  /* nth element of this type (0=first p, 1=second p, etc.) */
-    char *text_fingerprint;  /* First 50 chars of text content for matching */
-    struct attr_node *next;
-} attr_node;
 
-/**
- * Extract IAL attributes (id, class, key="value") from attribute string,
- * excluding internal attributes like data-caption, data-remove, colspan, rowspan
- * Returns a newly allocated string with just the IAL attributes, or NULL if none found
- */
-static char *extract_ial_from_table_attrs(const char *attrs) {
-    if (!attrs) return NULL;
-
-    size_t result_cap = strlen(attrs) + 1;
-    char *result = malloc(result_cap);
-    if (!result) return NULL;
-    char *write = result;
-    *write = '\0';
-
-    const char *p = attrs;
-
-    /* Skip leading whitespace */
-    while (*p && isspace((unsigned char)*p)) p++;
-
-    while (*p) {
-        const char *attr_start = p;
-
-        /* Find end of attribute name or = */
-        const char *attr_name_end = p;
-        while (*attr_name_end && *attr_name_end != '=' && *attr_name_end != ' ' && *attr_name_end != '\t') {
-            attr_name_end++;
-        }
-
-        size_t attr_name_len = attr_name_end - attr_start;
-
-        /* Check if this is an internal attribute we should skip */
-        bool skip = false;
-        if (attr_name_len == 11 && strncmp(attr_start, "data-caption", 11) == 0) skip = true;
-        else if (attr_name_len == 11 && strncmp(attr_start, "data-remove", 11) == 0) skip = true;
-        else if (attr_name_len == 7 && strncmp(attr_start, "colspan", 7) == 0) skip = true;
-        else if (attr_name_len == 7 && strncmp(attr_start, "rowspan", 7) == 0) skip = true;
-
-        if (!skip) {
-            /* This is an IAL attribute - find the full attribute (name="value" or name='value') */
-            const char *attr_end = attr_name_end;
-            if (*attr_end == '=') {
-                attr_end++;
-                if (*attr_end == '"' || *attr_end == '\'') {
-                    char q = *attr_end;
-                    attr_end++;
-                    while (*attr_end && *attr_end != q) {
-                        if (*attr_end == '\\' && *(attr_end + 1)) attr_end++;
-                        attr_end++;
-                    }
-                    if (*attr_end == q) attr_end++;
-                } else {
-                    /* Unquoted value */
-                    while (*attr_end && *attr_end != ' ' && *attr_end != '\t') attr_end++;
-                }
-            }
-
-            /* Copy this attribute to result */
-            size_t attr_len = attr_end - attr_start;
-            if ((size_t)(write - result) + attr_len + 2 >= result_cap) {
-                /* Need to realloc */
-                size_t current_len = write - result;
-                result_cap = (current_len + attr_len + 2) * 2;
-                char *new_result = realloc(result, result_cap);
-                if (!new_result) {
-                    free(result);
-                    return NULL;
-                }
-                result = new_result;
-                write = result + current_len;
-            }
-
-            /* Add space before attribute if needed (always for first attribute, or if previous doesn't end with space) */
-            if (write == result || (write > result && write[-1] != ' ')) {
-                *write++ = ' ';
-            }
-            memcpy(write, attr_start, attr_len);
-            write += attr_len;
-            *write = '\0';
+/* A node's attributes, each after a space */
+static void put_attributes(cmark_strbuf *html, cmark_node *node) {
+    apex_buffer rendered;
+    apex_buffer_init(&rendered, 64);
+    if (!rendered.data) return;
+    apex_attributes_render(apex_node_attributes(node), &rendered);
+    cmark_strbuf_put(html, (const unsigned char *)rendered.data, (bufsize_t)rendered.size);
+    apex_buffer_free(&rendered);
+}
 
-            p = attr_end;
-        } else {
-            /* Skip this attribute - find its end */
-            if (*attr_name_end == '=') {
-                attr_name_end++;
-                if (*attr_name_end == '"' || *attr_name_end == '\'') {
-                    char q = *attr_name_end;
-                    attr_name_end++;
-                    while (*attr_name_end && *attr_name_end != q) {
-                        if (*attr_name_end == '\\' && *(attr_name_end + 1)) attr_name_end++;
-                        attr_name_end++;
-                    }
-                    if (*attr_name_end == q) attr_name_end++;
-                } else {
-                    while (*attr_name_end && *attr_name_end != ' ' && *attr_name_end != '\t') attr_name_end++;
-                }
-            }
-            p = attr_name_end;
-        }
+static void put_escaped(cmark_strbuf *html, const char *text) {
+    if (text) houdini_escape_html0(html, (const uint8_t *)text, (bufsize_t)strlen(text), 0);
+}
 
-        /* Skip whitespace before next attribute */
-        while (*p && isspace((unsigned char)*p)) p++;
+/* cmark's test for URLs it leaves out unless raw HTML is allowed */
+static bool url_is_dangerous(const char *url) {
+    static const char *const schemes[] = { "javascript:", "vbscript:", "file:" };
+    static const char *const data_images[] = { "image/png", "image/gif", "image/jpeg", "image/webp" };
+    for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); i++) {
+        if (strncasecmp(url, schemes[i], strlen(schemes[i])) == 0) return true;
     }
-
-    if (write == result) {
-        /* No IAL attributes found */
-        free(result);
-        return NULL;
+    if (strncasecmp(url, "data:", 5) != 0) return false;
+    for (size_t i = 0; i < sizeof(data_images) / sizeof(data_images[0]); i++) {
+        if (strncasecmp(url + 5, data_images[i], strlen(data_images[i])) == 0) return false;
     }
+    return true;
+}
 
-    return result;
+static void put_url(cmark_strbuf *html, const char *url, int options) {
+    if (!url || (!(options & CMARK_OPT_UNSAFE) && url_is_dangerous(url))) return;
+    houdini_escape_href(html, (const uint8_t *)url, (bufsize_t)strlen(url));
 }
 
-/* Counters for element indexing */
-typedef struct {
-    int para_count;
-    int heading_count;
-    int table_count;
-    int blockquote_count;
-    int list_count;
-    int item_count;
-    int code_count;
-    int link_count;
-    int image_count;
-    int strong_count;
-    int emph_count;
-    int code_inline_count;
-} element_counters;
+/* "\" title=\"...\"" when the link or image has a title */
+static void put_title(cmark_strbuf *html, cmark_node *node) {
+    const char *title = cmark_node_get_title(node);
+    if (!title || !*title) return;
+    cmark_strbuf_puts(html, "\" title=\"");
+    put_escaped(html, title);
+}
 
-/**
- * Get text fingerprint from node (first 50 chars for matching)
- */
-static char *get_node_text_fingerprint(cmark_node *node) {
-    if (!node) return NULL;
-
-    cmark_node_type type = cmark_node_get_type(node);
-
-    /* For headings, get the literal */
-    if (type == CMARK_NODE_HEADING) {
-        cmark_node *text = cmark_node_first_child(node);
-        if (text && cmark_node_get_type(text) == CMARK_NODE_TEXT) {
-            const char *literal = cmark_node_get_literal(text);
-            if (literal) {
-                size_t len = strlen(literal);
-                if (len > 50) len = 50;
-                char *fingerprint = malloc(len + 1);
-                if (fingerprint) {
-                    memcpy(fingerprint, literal, len);
-                    fingerprint[len] = '\0';
-                    return fingerprint;
-                }
-            }
+static void put_code_block(cmark_strbuf *html, cmark_node *node, int options) {
+    const char *info = cmark_node_get_fence_info(node);
+    size_t first_tag = 0;
+    while (info && info[first_tag] && !isspace((unsigned char)info[first_tag])) first_tag++;
+
+    cmark_html_render_cr(html);
+    cmark_strbuf_puts(html, "<pre");
+    put_attributes(html, node);
+    cmark_html_render_sourcepos(node, html, options);
+    if (!info || !*info) {
+        cmark_strbuf_puts(html, "><code>");
+    } else {
+        cmark_strbuf_puts(html, (options & CMARK_OPT_GITHUB_PRE_LANG) ? " lang=\"" : "><code class=\"language-");
+        houdini_escape_html0(html, (const uint8_t *)info, (bufsize_t)first_tag, 0);
+        if (info[first_tag] && (options & CMARK_OPT_FULL_INFO_STRING)) {
+            cmark_strbuf_puts(html, "\" data-meta=\"");
+            put_escaped(html, info + first_tag + 1);
         }
+        cmark_strbuf_puts(html, (options & CMARK_OPT_GITHUB_PRE_LANG) ? "\"><code>" : "\">");
     }
+    put_escaped(html, cmark_node_get_literal(node));
+    cmark_strbuf_puts(html, "</code></pre>\n");
+}
 
-    /* For paragraphs, get text from first text node */
-    if (type == CMARK_NODE_PARAGRAPH) {
-        cmark_node *child = cmark_node_first_child(node);
-        if (child && cmark_node_get_type(child) == CMARK_NODE_TEXT) {
-            const char *literal = cmark_node_get_literal(child);
-            if (literal) {
-                size_t len = strlen(literal);
-                if (len > 50) len = 50;
-                char *fingerprint = malloc(len + 1);
-                if (fingerprint) {
-                    memcpy(fingerprint, literal, len);
-                    fingerprint[len] = '\0';
-                    return fingerprint;
-                }
+/* Write a core node with its attributes, as cmark would without them */
+static void render_core_node(cmark_html_renderer *renderer, cmark_node *node, bool entering, int options) {
+    cmark_strbuf *html = renderer->html;
+
+    switch (cmark_node_get_type(node)) {
+        case CMARK_NODE_PARAGRAPH:
+            if (entering) {
+                cmark_html_render_cr(html);
+                cmark_strbuf_puts(html, "<p");
+                put_attributes(html, node);
+                cmark_html_render_sourcepos(node, html, options);
+                cmark_strbuf_putc(html, '>');
+            } else {
+                cmark_strbuf_puts(html, "</p>\n");
+            }
+            break;
+        case CMARK_NODE_HEADING: {
+            char tag[] = "</h0>\n";
+            tag[3] = (char)('0' + cmark_node_get_heading_level(node));
+            if (entering) {
+                cmark_html_render_cr(html);
+                cmark_strbuf_putc(html, '<');
+                cmark_strbuf_put(html, (const unsigned char *)tag + 2, 2);
+                put_attributes(html, node);
+                cmark_html_render_sourcepos(node, html, options);
+                cmark_strbuf_putc(html, '>');
+            } else {
+                cmark_strbuf_puts(html, tag);
             }
+            break;
         }
-    }
-
-    /* For links, use the URL */
-    if (type == CMARK_NODE_LINK) {
-        const char *url = cmark_node_get_url(node);
-        if (url) {
-            size_t len = strlen(url);
-            if (len > 50) len = 50;
-            char *fingerprint = malloc(len + 1);
-            if (fingerprint) {
-                memcpy(fingerprint, url, len);
-                fingerprint[len] = '\0';
-                return fingerprint;
+        case CMARK_NODE_BLOCK_QUOTE:
+            cmark_html_render_cr(html);
+            if (entering) {
+                cmark_strbuf_puts(html, "<blockquote");
+                put_attributes(html, node);
+                cmark_html_render_sourcepos(node, html, options);
+                cmark_strbuf_puts(html, ">\n");
+            } else {
+                cmark_strbuf_puts(html, "</blockquote>\n");
+            }
+            break;
+        case CMARK_NODE_LIST: {
+            bool bullet = cmark_node_get_list_type(node) == CMARK_BULLET_LIST;
+            if (entering) {
+                cmark_html_render_cr(html);
+                cmark_strbuf_puts(html, bullet ? "<ul" : "<ol");
+                put_attributes(html, node);
+                int start = cmark_node_get_list_start(node);
+                if (!bullet && start != 1) {
+                    char start_attr[32];
+                    snprintf(start_attr, sizeof(start_attr), " start=\"%d\"", start);
+                    cmark_strbuf_puts(html, start_attr);
+                }
+                cmark_html_render_sourcepos(node, html, options);
+                cmark_strbuf_puts(html, ">\n");
+            } else {
+                cmark_strbuf_puts(html, bullet ? "</ul>\n" : "</ol>\n");
             }
+            break;
         }
+        case CMARK_NODE_ITEM:
+            if (entering) {
+                cmark_html_render_cr(html);
+                cmark_strbuf_puts(html, "<li");
+                put_attributes(html, node);
+                cmark_html_render_sourcepos(node, html, options);
+                cmark_strbuf_putc(html, '>');
+            } else {
+                cmark_strbuf_puts(html, "</li>\n");
+            }
+            break;
+        case CMARK_NODE_CODE_BLOCK:
+            put_code_block(html, node, options);
+            break;
+        case CMARK_NODE_CODE:
+            cmark_strbuf_puts(html, "<code");
+            put_attributes(html, node);
+            cmark_strbuf_putc(html, '>');
+            put_escaped(html, cmark_node_get_literal(node));
+            cmark_strbuf_puts(html, "</code>");
+            break;
+        case CMARK_NODE_STRONG:
+            if (entering) {
+                cmark_strbuf_puts(html, "<strong");
+                put_attributes(html, node);
+                cmark_strbuf_putc(html, '>');
+            } else {
+                cmark_strbuf_puts(html, "</strong>");
+            }
+            break;
+        case CMARK_NODE_EMPH:
+            if (entering) {
+                cmark_strbuf_puts(html, "<em");
+                put_attributes(html, node);
+                cmark_strbuf_putc(html, '>');
+            } else {
+                cmark_strbuf_puts(html, "</em>");
+            }
+            break;
+        case CMARK_NODE_LINK:
+            if (entering) {
+                cmark_strbuf_puts(html, "<a href=\"");
+                put_url(html, cmark_node_get_url(node), options);
+                put_title(html, node);
+                cmark_strbuf_putc(html, '"');
+                put_attributes(html, node);
+                cmark_strbuf_putc(html, '>');
+            } else {
+                cmark_strbuf_puts(html, "</a>");
+            }
+            break;
+        case CMARK_NODE_IMAGE:
+            if (entering) {
+                cmark_strbuf_puts(html, "<img src=\"");
+                put_url(html, cmark_node_get_url(node), options);
+                cmark_strbuf_puts(html, "\" alt=\"");
+                renderer->plain = node;  /* Children are the alt text */
+            } else {
+                put_title(html, node);
+                cmark_strbuf_putc(html, '"');
+                put_attributes(html, node);
+                cmark_strbuf_puts(html, " />");
+            }
+            break;
+        default:
+            break;
     }
+}
 
-    /* For images, use the URL */
-    if (type == CMARK_NODE_IMAGE) {
-        const char *url = cmark_node_get_url(node);
-        if (url) {
-            size_t len = strlen(url);
-            if (len > 50) len = 50;
-            char *fingerprint = malloc(len + 1);
-            if (fingerprint) {
-                memcpy(fingerprint, url, len);
-                fingerprint[len] = '\0';
-                return fingerprint;
-            }
-        }
+/* Add the node's attributes after the name of the first tag written since start */
+static void splice_attributes(cmark_strbuf *html, bufsize_t start, cmark_node *node) {
+    bufsize_t name_end = start;
+    while (name_end < html->size && !(html->ptr[name_end] == '<' && name_end + 1 < html->size &&
+                                       isalpha(html->ptr[name_end + 1]))) {
+        name_end++;
     }
-
-    return NULL;
+    if (name_end >= html->size) return;
+    name_end++;
+    while (name_end < html->size && isalnum(html->ptr[name_end])) name_end++;
+
+    size_t tail_len = (size_t)(html->size - name_end);
+    unsigned char *tail = malloc(tail_len ? tail_len : 1);
+    if (!tail) return;
+    memcpy(tail, html->ptr + name_end, tail_len);
+    cmark_strbuf_truncate(html, name_end);
+    put_attributes(html, node);
+    cmark_strbuf_put(html, tail, (bufsize_t)tail_len);
+    free(tail);
 }
 
-static void collect_nodes_with_attrs_recursive(cmark_node *node, attr_node **list, element_counters *counters) {
-    if (!node) return;
-
-    cmark_node_type type = cmark_node_get_type(node);
-
-    /* Increment counter for this element type */
-    int elem_idx = -1;
-    if (type == CMARK_NODE_PARAGRAPH) elem_idx = counters->para_count++;
-    else if (type >= CMARK_NODE_HEADING && type <= CMARK_NODE_HEADING + 5) elem_idx = counters->heading_count++;
-    else if (type == CMARK_NODE_TABLE) {
-        /* For tables, increment the counter first, then use (count - 1) as the index */
-        /* This ensures the index matches the HTML renderer's count of <table> tags */
-        elem_idx = counters->table_count++;
+/* html_render_func of the stand-in extension; its private data is the
+ * node's own extension, NULL for a core node */
+static void render_with_attributes(cmark_syntax_extension *ext, cmark_html_renderer *renderer, cmark_node *node,
+                                   cmark_event_type ev_type, int options) {
+    cmark_syntax_extension *own = cmark_syntax_extension_get_private(ext);
+    if (!own || !own->html_render_func) {
+        render_core_node(renderer, node, ev_type == CMARK_EVENT_ENTER, options);
+        return;
     }
-    else if (type == CMARK_NODE_BLOCK_QUOTE) elem_idx = counters->blockquote_count++;
-    else if (type == CMARK_NODE_LIST) elem_idx = counters->list_count++;
-    else if (type == CMARK_NODE_ITEM) elem_idx = counters->item_count++;
-    else if (type == CMARK_NODE_CODE_BLOCK) elem_idx = counters->code_count++;
-    /* Inline elements need indices too - each type has its own counter */
-    else if (type == CMARK_NODE_LINK) elem_idx = counters->link_count++;
-    else if (type == CMARK_NODE_IMAGE) elem_idx = counters->image_count++;
-    else if (type == CMARK_NODE_STRONG) elem_idx = counters->strong_count++;
-    else if (type == CMARK_NODE_EMPH) elem_idx = counters->emph_count++;
-    else if (type == CMARK_NODE_CODE) elem_idx = counters->code_inline_count++;
-
-    /* Check if this node has attributes */
-    void *user_data = cmark_node_get_user_data(node);
-    if (user_data) {
-        attr_node *new_node = malloc(sizeof(attr_node));
-        if (new_node) {
-            new_node->node = node;
-            new_node->attrs = (char *)user_data;
-            new_node->node_type = type;
-            new_node->element_index = elem_idx;
-            new_node->text_fingerprint = get_node_text_fingerprint(node);
-            new_node->next = *list;
-            *list = new_node;
-        }
+    bufsize_t start = renderer->html->size;
+    own->html_render_func(own, renderer, node, ev_type, options);
+    if (ev_type == CMARK_EVENT_ENTER) splice_attributes(renderer->html, start, node);
+}
 
-        /* If node is marked for removal, don't traverse children */
-        if (strstr((char *)user_data, "data-remove")) {
-            return;
+/* Whether cmark writes a tag of the core node's own that attributes can go on */
+static bool core_node_has_tag(cmark_node *node) {
+    cmark_node *parent = cmark_node_parent(node);
+    switch (cmark_node_get_type(node)) {
+        case CMARK_NODE_PARAGRAPH: {
+            cmark_node *grandparent = parent ? cmark_node_parent(parent) : NULL;
+            if (grandparent && cmark_node_get_type(grandparent) == CMARK_NODE_LIST &&
+                cmark_node_get_list_tight(grandparent)) {
+                return false;  /* Tight list items have no <p> */
+            }
+            /* The last paragraph of a footnote carries its backlink, which
+             * only cmark's renderer can number */
+            return !(parent && cmark_node_get_type(parent) == CMARK_NODE_FOOTNOTE_DEFINITION && !cmark_node_next(node));
         }
-    }
-
-    /* Recurse */
-    for (cmark_node *child = cmark_node_first_child(node); child; child = cmark_node_next(child)) {
-        collect_nodes_with_attrs_recursive(child, list, counters);
+        case CMARK_NODE_STRONG:
+            return !(parent && cmark_node_get_type(parent) == CMARK_NODE_STRONG);  /* Nested strong has no tag */
+        case CMARK_NODE_HEADING:
+        case CMARK_NODE_BLOCK_QUOTE:
+        case CMARK_NODE_LIST:
+        case CMARK_NODE_ITEM:
+        case CMARK_NODE_CODE_BLOCK:
+        case CMARK_NODE_CODE:
+        case CMARK_NODE_EMPH:
+        case CMARK_NODE_LINK:
+        case CMARK_NODE_IMAGE:
+            return true;
+        default:
+            return false;
     }
 }
 
-static void collect_nodes_with_attrs(cmark_node *node, attr_node **list) {
-    element_counters counters = {0};
-    collect_nodes_with_attrs_recursive(node, list, &counters);
-
-    /* Reverse the list to get document order */
-    attr_node *reversed = NULL;
-    while (*list) {
-        attr_node *next = (*list)->next;
-        (*list)->next = reversed;
-        reversed = *list;
-        *list = next;
-    }
-    *list = reversed;
+typedef struct {
+    cmark_syntax_extension *core;      /* Stand-in for core nodes */
+    cmark_syntax_extension **wrapped;  /* Stand-ins for extension nodes, one per extension */
+    size_t wrapped_count;
+} attribute_renderers;
+
+static cmark_syntax_extension *new_stand_in(cmark_syntax_extension *own) {
+    cmark_syntax_extension *ext = cmark_syntax_extension_new("apex_attributes");
+    if (!ext) return NULL;
+    cmark_syntax_extension_set_html_render_func(ext, render_with_attributes);
+    cmark_syntax_extension_set_private(ext, own, NULL);
+    return ext;
 }
 
-/**
- * Enhanced HTML rendering with attribute support
- */
-char *apex_render_html_with_attributes(cmark_node *document, int options) {
-    if (!document) return NULL;
-
-    /* First, render normally */
-    char *html = cmark_render_html(document, options, NULL);
-    if (!html) return NULL;
-
-    /* Collect all nodes with attributes */
-    attr_node *attr_list = NULL;
-    collect_nodes_with_attrs(document, &attr_list);
-
-    if (!attr_list) {
-        return html; /* No attributes to inject */
-    }
-
-    /* Build new HTML with attributes injected */
-    size_t html_len = strlen(html);
-
-    /* Calculate needed capacity: original HTML + all attribute strings */
-    size_t attrs_size = 0;
-    for (attr_node *a = attr_list; a; a = a->next) {
-        attrs_size += strlen(a->attrs);
-    }
-    size_t capacity = html_len + attrs_size + 1024; /* +1KB buffer */
-    char *output = malloc(capacity);
-    if (!output) {
-        /* Clean up attr list */
-        while (attr_list) {
-            attr_node *next = attr_list->next;
-            free(attr_list);
-            attr_list = next;
+/* The stand-in for a node with attributes, or NULL to render it as it is */
+static cmark_syntax_extension *stand_in_for(attribute_renderers *renderers, cmark_node *node) {
+    /* Nodes an extension made but cmark renders are core nodes here */
+    cmark_syntax_extension *own = cmark_node_get_syntax_extension(node);
+    if (!own || !own->html_render_func) {
+        if (!core_node_has_tag(node)) return NULL;
+        if (!own) {
+            if (!renderers->core) renderers->core = new_stand_in(NULL);
+            return renderers->core;
         }
-        return html;
+    } else {
+        cmark_node_type type = cmark_node_get_type(node);
+        if (type == CMARK_NODE_TABLE_ROW || type == CMARK_NODE_TABLE_CELL) return NULL;
     }
 
-    const char *read = html;
-    char *write = output;
-    size_t remaining = capacity;
-
-    /* Track which attributes we've used */
-    int attr_count = 0;
-    for (attr_node *a = attr_list; a; a = a->next) attr_count++;
-    bool *used = calloc(attr_count + 1, sizeof(bool));
-
-    /* Track element counts in HTML (same as AST walker) */
-    element_counters html_counters = {0};
-
-    /* Process HTML, injecting attributes */
-    while (*read) {
-        /* Check if we're at an opening tag */
-        if (*read == '<' && read[1] != '/' && read[1] != '!') {
-            const char *tag_start = read + 1;
-            const char *tag_name_end = tag_start;
-
-            /* Get tag name */
-            while (*tag_name_end && !isspace((unsigned char)*tag_name_end) &&
-                   *tag_name_end != '>' && *tag_name_end != '/') {
-                tag_name_end++;
-            }
-
-            /* Find the end of the tag (> or />) */
-            const char *tag_end = tag_name_end;
-            while (*tag_end && *tag_end != '>') tag_end++;
-
-            /* Check if this is a block tag or table cell we care about */
-            int tag_len = tag_name_end - tag_start;
-
-            /* Determine element type and increment counter */
-            cmark_node_type elem_type = 0;
-            int elem_idx = -1;
-
-            if (tag_len == 1 && *tag_start == 'p') {
-                elem_type = CMARK_NODE_PARAGRAPH;
-                elem_idx = html_counters.para_count++;
-            } else if (tag_len == 2 && tag_start[0] == 'h' && tag_start[1] >= '1' && tag_start[1] <= '6') {
-                elem_type = CMARK_NODE_HEADING;
-                elem_idx = html_counters.heading_count++;
-            } else if (tag_len == 10 && memcmp(tag_start, "blockquote", 10) == 0) {
-                elem_type = CMARK_NODE_BLOCK_QUOTE;
-                elem_idx = html_counters.blockquote_count++;
-            } else if (tag_len == 5 && memcmp(tag_start, "table", 5) == 0) {
-                elem_type = CMARK_NODE_TABLE;
-                elem_idx = html_counters.table_count++;
-            } else if (tag_len == 2 && (memcmp(tag_start, "ul", 2) == 0 || memcmp(tag_start, "ol", 2) == 0)) {
-                elem_type = CMARK_NODE_LIST;
-                elem_idx = html_counters.list_count++;
-            } else if (tag_len == 2 && memcmp(tag_start, "li", 2) == 0) {
-                elem_type = CMARK_NODE_ITEM;
-                elem_idx = html_counters.item_count++;
-            } else if (tag_len == 3 && memcmp(tag_start, "pre", 3) == 0) {
-                elem_type = CMARK_NODE_CODE_BLOCK;
-                elem_idx = html_counters.code_count++;
-            } else if (tag_len == 1 && *tag_start == 'a') {
-                /* Links - inline elements */
-                elem_type = CMARK_NODE_LINK;
-                elem_idx = html_counters.link_count++;
-            } else if (tag_len == 3 && memcmp(tag_start, "img", 3) == 0) {
-                /* Images - inline elements */
-                elem_type = CMARK_NODE_IMAGE;
-                elem_idx = html_counters.image_count++;
-            } else if (tag_len == 6 && memcmp(tag_start, "strong", 6) == 0) {
-                /* Strong - inline elements */
-                elem_type = CMARK_NODE_STRONG;
-                elem_idx = html_counters.strong_count++;
-            } else if (tag_len == 2 && memcmp(tag_start, "em", 2) == 0) {
-                /* Emphasis - inline elements */
-                elem_type = CMARK_NODE_EMPH;
-                elem_idx = html_counters.emph_count++;
-            } else if (tag_len == 4 && memcmp(tag_start, "code", 4) == 0) {
-                /* Code - inline elements */
-                elem_type = CMARK_NODE_CODE;
-                elem_idx = html_counters.code_inline_count++;
-            }
-
-            /* Check if we should skip this element (marked for removal) */
-            /* We do this BEFORE the main matching to remove elements first */
-            bool should_remove = false;
-            int removal_idx = -1;
-            if (elem_type != 0) {
-                int check_idx = 0;
-                for (attr_node *a = attr_list; a; a = a->next, check_idx++) {
-                    /* Check by element type and index for removal */
-                    if (!used[check_idx] &&
-                        (a->node_type == elem_type ||
-                         (elem_type == CMARK_NODE_HEADING && a->node_type >= CMARK_NODE_HEADING && a->node_type <= CMARK_NODE_HEADING + 5)) &&
-                        a->element_index == elem_idx) {
-                        if (strstr(a->attrs, "data-remove")) {
-                            should_remove = true;
-                            removal_idx = check_idx;
-                            break;
-                        }
-                        /* Found matching element but not for removal - stop checking */
-                        break;
-                    }
-                }
-            }
-
-            if (should_remove) {
-                /* Skip this entire element */
-                const char *close_start = read;
-                int depth = 1;
-                while (*close_start && depth > 0) {
-                    if (*close_start == '<') {
-                        if (close_start[1] == '/') {
-                            /* Closing tag */
-                            const char *tag_check = close_start + 2;
-                            if (memcmp(tag_check, tag_start, tag_len) == 0 &&
-                                (tag_check[tag_len] == '>' || isspace((unsigned char)tag_check[tag_len]))) {
-                                depth--;
-                                if (depth == 0) {
-                                    /* Found matching close tag */
-                                    while (*close_start && *close_start != '>') close_start++;
-                                    if (*close_start == '>') close_start++;
-                                    read = close_start;
-                                    if (removal_idx >= 0) used[removal_idx] = true;
-                                    goto skip_element;
-                                }
-                            }
-                        } else if (close_start[1] != '!' && close_start[1] != '?') {
-                            /* Another opening tag of same type */
-                            const char *tag_check = close_start + 1;
-                            if (memcmp(tag_check, tag_start, tag_len) == 0 &&
-                                (tag_check[tag_len] == '>' || tag_check[tag_len] == ' ')) {
-                                depth++;
-                            }
-                        }
-                    }
-                    close_start++;
-                }
-            }
-
-            skip_element:
-            if (read != html && *read != '<') {
-                continue; /* We skipped an element */
-            }
-
-            /* Handle both block and inline elements with attributes */
-            if (elem_type != 0) {
-                /* Extract fingerprint for matching */
-                char html_fingerprint[51] = {0};
-                int fp_idx = 0;
-
-                if (elem_type == CMARK_NODE_LINK || elem_type == CMARK_NODE_IMAGE) {
-                    /* For links/images, extract the href/src attribute */
-                    const char *url_attr = (elem_type == CMARK_NODE_LINK) ? "href=\"" : "src=\"";
-                    const char *url_start = strstr(read, url_attr);
-                    if (url_start) {
-                        url_start += strlen(url_attr);
-                        const char *url_end = strchr(url_start, '"');
-                        if (url_end) {
-                            size_t url_len = url_end - url_start;
-                            if (url_len > 50) url_len = 50;
-                            memcpy(html_fingerprint, url_start, url_len);
-                            html_fingerprint[url_len] = '\0';
-                            fp_idx = url_len;
-                        }
-                    }
-                } else if (elem_type == CMARK_NODE_STRONG || elem_type == CMARK_NODE_EMPH || elem_type == CMARK_NODE_CODE) {
-                    /* For inline elements (strong, emph, code), extract text content */
-                    const char *content_start = tag_name_end;
-                    while (*content_start && *content_start != '>') content_start++;
-                    if (*content_start == '>') content_start++;
-
-                    const char *text_p = content_start;
-                    while (*text_p && *text_p != '<' && fp_idx < 50) {
-                        html_fingerprint[fp_idx++] = *text_p++;
-                    }
-                    html_fingerprint[fp_idx] = '\0';
-                } else {
-                    /* For block elements, extract text content */
-                    const char *content_start = tag_name_end;
-                    while (*content_start && *content_start != '>') content_start++;
-                    if (*content_start == '>') content_start++;
-
-                    const char *text_p = content_start;
-                    while (*text_p && *text_p != '<' && fp_idx < 50) {
-                        html_fingerprint[fp_idx++] = *text_p++;
-                    }
-                    html_fingerprint[fp_idx] = '\0';
-                }
-
-                /* Find matching attribute - try fingerprint first, then index */
-                attr_node *matching = NULL;
-                int idx = 0;
-
-                /* For tables, use sequential matching (first unused table) since index may not match */
-                if (elem_type == CMARK_NODE_TABLE) {
-                    for (attr_node *a = attr_list; a; a = a->next, idx++) {
-                        if (used[idx]) continue;
-                        if (a->node_type == CMARK_NODE_TABLE) {
-                            matching = a;
-                            used[idx] = true;
-                            break;
-                        }
-                    }
-                } else {
-                    /* For other elements, use the existing matching logic */
-                    for (attr_node *a = attr_list; a; a = a->next, idx++) {
-                        if (used[idx]) continue;
-
-                        /* Check type match (including inline elements) */
-                        bool type_match = (a->node_type == elem_type ||
-                             (elem_type == CMARK_NODE_HEADING && a->node_type >= CMARK_NODE_HEADING && a->node_type <= CMARK_NODE_HEADING + 5));
-
-                        if (!type_match) continue;
-
-                        /* Try fingerprint match first (works for both block and inline) */
-                        if (a->text_fingerprint && fp_idx > 0 &&
-                            strncmp(a->text_fingerprint, html_fingerprint, 50) == 0) {
-                            /* For inline elements, also check element_index to handle duplicates */
-                            if (elem_type == CMARK_NODE_LINK || elem_type == CMARK_NODE_IMAGE ||
-                                elem_type == CMARK_NODE_STRONG || elem_type == CMARK_NODE_EMPH ||
-                                elem_type == CMARK_NODE_CODE) {
-                                if (a->element_index == elem_idx) {
-                                    matching = a;
-                                    used[idx] = true;
-                                    break;
-                                }
-                            } else {
-                                /* For other elements, fingerprint match is sufficient */
-                                matching = a;
-                                used[idx] = true;
-                                break;
-                            }
-                        }
-
-                        /* Fall back to index match if no fingerprint */
-                        if (!a->text_fingerprint && a->element_index == elem_idx) {
-                            matching = a;
-                            used[idx] = true;
-                            break;
-                        }
-                    }
-                }
-
-                if (matching) {
-                    /* Skip internal attributes and table span attributes */
-                    /* Table spans are handled by apex_inject_table_attributes() */
-                    /* For tables, we need to extract IAL attributes even if data-caption is present */
-                    bool skip_all = false;
-                    bool extract_ial_from_caption = false;
-
-                    if (strstr(matching->attrs, "data-remove") ||
-                        strstr(matching->attrs, "colspan=") ||
-                        strstr(matching->attrs, "rowspan=")) {
-                        skip_all = true;
-                    } else if (strstr(matching->attrs, "data-caption") && elem_type == CMARK_NODE_TABLE) {
-                        /* For tables with captions, extract IAL attributes (id, class, etc.) but skip data-caption */
-                        extract_ial_from_caption = true;
-                    }
-
-                    if (skip_all) {
-                        /* These are handled elsewhere, don't inject here */
-                    } else if (extract_ial_from_caption) {
-                        /* Extract IAL attributes from the attribute string, excluding data-caption */
-                        char *ial_attrs = extract_ial_from_table_attrs(matching->attrs);
-                        if (ial_attrs && *ial_attrs) {
-                            /* Find where to inject attributes (before closing > of <table> tag) */
-                            const char *inject_point = tag_end;
-                            if (*inject_point == '>') {
-                                /* Copy up to injection point */
-                                size_t prefix_len = inject_point - read;
-                                if (prefix_len <= remaining) {
-                                    memcpy(write, read, prefix_len);
-                                    write += prefix_len;
-                                    remaining -= prefix_len;
-                                }
-
-                                /* Inject IAL attributes - ensure leading space */
-                                /* Check if we need to add a space before the attributes */
-                                bool needs_leading_space = (ial_attrs[0] != ' ');
-                                size_t ial_len = strlen(ial_attrs);
-                                size_t total_len = ial_len + (needs_leading_space ? 1 : 0);
-
-                                if (total_len <= remaining) {
-                                    if (needs_leading_space) {
-                                        *write++ = ' ';
-                                        remaining--;
-                                    }
-                                    memcpy(write, ial_attrs, ial_len);
-                                    write += ial_len;
-                                    remaining -= ial_len;
-                                } else {
-                                    /* Buffer too small - need to expand */
-                                    size_t current_pos = write - output;
-                                    size_t new_cap = (current_pos + total_len + 1) * 2;
-                                    char *new_output = realloc(output, new_cap);
-                                    if (new_output) {
-                                        output = new_output;
-                                        write = output + current_pos;
-                                        remaining = new_cap - current_pos;
-                                        if (needs_leading_space) {
-                                            *write++ = ' ';
-                                            remaining--;
-                                        }
-                                        memcpy(write, ial_attrs, ial_len);
-                                        write += ial_len;
-                                        remaining -= ial_len;
-                                    }
-                                }
-                                if (remaining > 0) {
-                                    *write++ = '>';
-                                    remaining--;
-                                }
-                                read = inject_point + 1;
-                                free(ial_attrs);
-                                continue;
-                            }
-                        }
-                        if (ial_attrs) free(ial_attrs);
-                        /* No IAL attributes to inject, but table still needs to be copied - fall through */
-                    } else {
-                        /* Find where to inject attributes */
-                        const char *inject_point = NULL;
-
-                        if (elem_type == CMARK_NODE_IMAGE || elem_type == CMARK_NODE_LINK ||
-                            elem_type == CMARK_NODE_STRONG || elem_type == CMARK_NODE_EMPH ||
-                            elem_type == CMARK_NODE_CODE) {
-                            /* For inline elements (img, a), inject before the closing > or /> */
-                            /* Find the closing > for this tag */
-                            const char *close_pos = tag_end;
-                            bool is_self_closing = false;
-                            if (*close_pos == '>') {
-                                /* Check if it's a self-closing tag /> */
-                                if (close_pos > tag_name_end && close_pos[-1] == '/') {
-                                    inject_point = close_pos - 1; /* Before /> */
-                                    is_self_closing = true;
-                                } else {
-                                    inject_point = close_pos; /* Before > */
-                                }
-                            } else {
-                                /* Fallback: after tag name if we can't find > */
-                                inject_point = tag_name_end;
-                                while (*inject_point && isspace((unsigned char)*inject_point) && *inject_point != '>') inject_point++;
-                            }
-
-                            /* Copy up to injection point (but for self-closing tags, don't include the space before /) */
-                            size_t prefix_len;
-                            if (is_self_closing && inject_point > read && inject_point[-1] == ' ') {
-                                /* Don't copy the space before / - we'll add it back after attributes */
-                                prefix_len = inject_point - read - 1;
-                            } else {
-                                prefix_len = inject_point - read;
-                            }
-
-                            if (prefix_len < remaining && prefix_len > 0) {
-                                memcpy(write, read, prefix_len);
-                                write += prefix_len;
-                                remaining -= prefix_len;
-                            }
-
-                            /* Always add a space before attributes (they need to be separated from existing attributes) */
-                            /* The only exception is if inject_point is at > and there's already a space before it */
-                            /* But since we're injecting attributes, we always need a space before them */
-                            if (remaining > 0) {
-                                *write++ = ' ';
-                                remaining--;
-                            }
-
-                            /* Inject attributes */
-                            size_t attr_len = strlen(matching->attrs);
-                            if (attr_len <= remaining) {
-                                memcpy(write, matching->attrs, attr_len);
-                                write += attr_len;
-                                remaining -= attr_len;
-                            }
-
-                            /* For self-closing tags, ensure space before / */
-                            if (is_self_closing && remaining > 0) {
-                                *write++ = ' ';
-                                remaining--;
-                            }
-
-                            read = inject_point;
-                        } else {
-                            /* For block elements, inject after tag name */
-                            inject_point = tag_name_end;
-                            while (*inject_point && isspace((unsigned char)*inject_point)) inject_point++;
-
-                            /* Copy up to injection point */
-                            size_t prefix_len = inject_point - read;
-                            if (prefix_len < remaining) {
-                                memcpy(write, read, prefix_len);
-                                write += prefix_len;
-                                remaining -= prefix_len;
-                            }
-
-                            /* Always add space before attributes for block elements */
-                            /* We're injecting right after the tag name, so we need a space */
-                            /* Check if there's already whitespace to avoid doubling spaces */
-                            bool needs_space = true;
-                            if (inject_point > read) {
-                                /* Check the character immediately before inject_point */
-                                const char *before_inject = inject_point - 1;
-                                if (isspace((unsigned char)*before_inject)) {
-                                    /* There's already whitespace, don't add another */
-                                    needs_space = false;
-                                }
-                            }
+    for (size_t i = 0; i < renderers->wrapped_count; i++) {
+        if (cmark_syntax_extension_get_private(renderers->wrapped[i]) == own) return renderers->wrapped[i];
+    }
+    cmark_syntax_extension **grown = realloc(renderers->wrapped,
+                                             (renderers->wrapped_count + 1) * sizeof(*grown));
+    if (!grown) return NULL;
+    renderers->wrapped = grown;
+    cmark_syntax_extension *ext = new_stand_in(own);
+    if (ext) renderers->wrapped[renderers->wrapped_count++] = ext;
+    return ext;
+}
 
-                            if (needs_space && remaining > 0) {
-                                *write++ = ' ';
-                                remaining--;
-                            }
+static bool is_stand_in(const attribute_renderers *renderers, const cmark_syntax_extension *ext) {
+    if (!ext) return false;
+    if (ext == renderers->core) return true;
+    for (size_t i = 0; i < renderers->wrapped_count; i++) {
+        if (ext == renderers->wrapped[i]) return true;
+    }
+    return false;
+}
 
-                            /* Inject attributes */
-                            size_t attr_len = strlen(matching->attrs);
-                            if (attr_len <= remaining) {
-                                memcpy(write, matching->attrs, attr_len);
-                                write += attr_len;
-                                remaining -= attr_len;
-                            }
+/* Point nodes with attributes at their stand-ins (install), or back at
+ * their own extensions */
+static bool swap_stand_ins(cmark_node *document, attribute_renderers *renderers, bool install) {
+    bool any = false;
+    cmark_iter *iter = cmark_iter_new(document);
+    if (!iter) return false;
+    cmark_event_type ev;
+    while ((ev = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+        if (ev != CMARK_EVENT_ENTER) continue;
+        cmark_node *node = cmark_iter_get_node(iter);
+        if (!apex_node_attributes(node)) continue;
 
-                            read = inject_point;
-                        }
-                        continue;
-                    }
-                }
+        if (install) {
+            cmark_syntax_extension *ext = stand_in_for(renderers, node);
+            if (ext) {
+                cmark_node_set_syntax_extension(node, ext);
+                any = true;
             }
-        }
-
-        /* Copy character */
-        if (remaining > 0) {
-            *write++ = *read++;
-            remaining--;
         } else {
-            read++;
+            cmark_syntax_extension *ext = cmark_node_get_syntax_extension(node);
+            if (is_stand_in(renderers, ext)) cmark_node_set_syntax_extension(node, cmark_syntax_extension_get_private(ext));
         }
     }
+    cmark_iter_free(iter);
+    return any;
+}
 
-    free(used);
+/**
+ * Enhanced HTML rendering with attribute support
+ */
+char *apex_render_html_with_attributes(cmark_node *document, int options) {
+    if (!document) return NULL;
 
-    *write = '\0';
+    attribute_renderers renderers = { NULL, NULL, 0 };
+    bool swapped = swap_stand_ins(document, &renderers, true);
 
-    /* Clean up */
-    while (attr_list) {
-        attr_node *next = attr_list->next;
-        free(attr_list->text_fingerprint);
-        free(attr_list);
-        attr_list = next;
-    }
+    /* Rendered with malloc: the result is freed with free() */
+    cmark_mem *mem = cmark_get_default_mem_allocator();
+    char *html = cmark_render_html_with_mem(document, options, NULL, mem);
 
-    free(html);
-    return output;
+    if (swapped) swap_stand_ins(document, &renderers, false);
+    if (renderers.core) cmark_syntax_extension_free(mem, renderers.core);
+    for (size_t i = 0; i < renderers.wrapped_count; i++) {
+        cmark_syntax_extension_free(mem, renderers.wrapped[i]);
+    }
+    free(renderers.wrapped);
+    return html;
 }
 
 /**
  * Inject header IDs into HTML output
  */
-char *apex_inject_header_ids(const char *html, cmark_node *document, bool generate_ids, bool use_anchors, int id_format) {
-    if (!html || !document || !generate_ids) {
+char *apex_inject_header_ids(const char *html, const apex_heading_table *headings, bool use_anchors) {
+    if (!html || !headings || headings->count == 0) {
         return html ? strdup(html) : NULL;
     }
 
-    /* Collect all headers from AST with their IDs */
-    typedef struct header_id_map {
-        char *text;
-        char *id;
-        int index;
-        struct header_id_map *next;
-    } header_id_map;
-
-    header_id_map *header_map = NULL;
-    int header_count = 0;
-
-    /* Walk AST to collect headers */
-    cmark_iter *iter = cmark_iter_new(document);
-    cmark_event_type event;
-    while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-        cmark_node *node = cmark_iter_get_node(iter);
-        if (event == CMARK_EVENT_ENTER && cmark_node_get_type(node) == CMARK_NODE_HEADING) {
-            char *text = apex_extract_heading_text(node);
-            char *id = NULL;
-
-            /* Check if ID already exists from IAL or manual ID (stored in user_data) */
-            char *user_data = (char *)cmark_node_get_user_data(node);
-            if (user_data) {
-                /* Look for id="..." in user_data */
-                const char *id_attr = strstr(user_data, "id=\"");
-                if (id_attr) {
-                    const char *id_start = id_attr + 4;
-                    const char *id_end = strchr(id_start, '"');
-                    if (id_end && id_end > id_start) {
-                        size_t id_len = id_end - id_start;
-                        id = malloc(id_len + 1);
-                        if (id) {
-                            memcpy(id, id_start, id_len);
-                            id[id_len] = '\0';
-                        }
-                    }
-                }
-            }
-
-            /* If no manual/IAL ID, generate one automatically */
-            if (!id) {
-                id = apex_generate_header_id(text, (apex_id_format_t)id_format);
-            }
-
-            header_id_map *entry = malloc(sizeof(header_id_map));
-            if (entry) {
-                entry->text = text;
-                entry->id = id;
-                entry->index = header_count++;
-                entry->next = header_map;
-                header_map = entry;
-            } else {
-                free(text);
-                free(id);
-            }
-        }
-    }
-    cmark_iter_free(iter);
-
-    if (!header_map) {
-        return strdup(html);
-    }
-
-    /* Reverse the list to get document order */
-    header_id_map *reversed = NULL;
-    while (header_map) {
-        header_id_map *next = header_map->next;
-        header_map->next = reversed;
-        reversed = header_map;
-        header_map = next;
-    }
-    header_map = reversed;
+    /* Heading tags in the HTML are matched to the table in document order;
+     * tags from raw HTML are copied as they are */
+    size_t header_count = headings->count;
 
     /* Process HTML to inject IDs */
     size_t html_len = strlen(html);
     size_t capacity = html_len + header_count * 100;  /* Extra space for IDs */
     char *output = malloc(capacity + 1);  /* +1 for null terminator */
     if (!output) {
-        /* Clean up */
-        while (header_map) {
-            header_id_map *next = header_map->next;
-            free(header_map->text);
-            free(header_map->id);
-            free(header_map);
-            header_map = next;
-        }
         return strdup(html);
     }
 
     const char *read = html;
     char *write = output;
     size_t remaining = capacity;  /* Reserve 1 byte for null terminator */
-    int current_header_idx = 0;
+    size_t current_header_idx = 0;
+    size_t tag_idx = 0;
 
     while (*read) {
         /* Look for header opening tags: <h1>, <h2>, etc. */
@@ -944,12 +472,10 @@ char *apex_inject_header_ids(const char *html, cmark_node *document, bool genera
             }
 
             /* Get the header ID - always get it so we can replace existing IDs */
-            header_id_map *header = NULL;
-            if (current_header_idx < header_count) {
-                header = header_map;
-                for (int i = 0; i < current_header_idx && header; i++) {
-                    header = header->next;
-                }
+            const apex_heading *header = NULL;
+            bool raw_tag = apex_heading_table_is_raw_tag(headings, tag_idx++, current_header_idx);
+            if (!raw_tag && current_header_idx < header_count) {
+                header = &headings->headings[current_header_idx];
             }
 
             if (use_anchors && header && header->id) {
@@ -1099,7 +625,7 @@ char *apex_inject_header_ids(const char *html, cmark_node *document, bool genera
                     remaining -= tag_len;
                 }
                 read = tag_end + 1;
-                if (!has_id) {
+                if (!has_id && !raw_tag) {
                     current_header_idx++;
                 }
             }
@@ -1127,15 +653,6 @@ char *apex_inject_header_ids(const char *html, cmark_node *document, bool genera
     }
     *write = '\0';
 
-    /* Clean up */
-    while (header_map) {
-        header_id_map *next = header_map->next;
-        free(header_map->text);
-        free(header_map->id);
-        free(header_map);
-        header_map = next;
-    }
-
     return output;
 }
 
@@ -1255,466 +772,11 @@ char *apex_collapse_intertag_newlines(const char *html) {
     return output;
 }
 
-/**
- * Check if a table cell contains only em dashes and whitespace
- */
-static bool cell_contains_only_dashes(const char *cell_start, const char *cell_end) {
-    const char *p = cell_start;
-    bool has_content = false;
-
-    while (p < cell_end) {
-        /* Check for em dash (—) U+2014: 0xE2 0x80 0x94 */
-        if ((unsigned char)*p == 0xE2 && p + 2 < cell_end &&
-            (unsigned char)p[1] == 0x80 && (unsigned char)p[2] == 0x94) {
-            has_content = true;
-            p += 3;
-        } else if (*p == ':' || *p == '-' || *p == '|') {
-            /* Colons, dashes, and pipes are OK in separator rows (for alignment: |:----|:---:|----:|) */
-            if (*p == '-' || *p == ':') {
-                has_content = true;  /* Dashes and colons count as content */
-            }
-            p++;
-        } else if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
-            /* Whitespace is OK */
-            p++;
-        } else if (*p == '<') {
-            /* HTML tags are OK (opening/closing tags) */
-            if (strncmp(p, "<td", 3) == 0 || strncmp(p, "</td>", 5) == 0 ||
-                strncmp(p, "<th", 3) == 0 || strncmp(p, "</th>", 5) == 0) {
-                /* Skip the tag */
-                if (strncmp(p, "</td>", 5) == 0 || strncmp(p, "</th>", 5) == 0) {
-                    p += 5;
-                } else {
-                    /* Skip to > */
-                    while (p < cell_end && *p != '>') p++;
-                    if (p < cell_end) p++;
-                }
-            } else {
-                /* Other content - not a separator cell */
-                return false;
-            }
-        } else {
-            /* Non-dash, non-whitespace, non-tag content */
-            return false;
-        }
-    }
-
-    return has_content;  /* Must have at least one em dash */
-}
-
-/**
- * Convert thead to tbody for relaxed tables ONLY
- * Converts <thead><tr><th>...</th></tr></thead> to <tbody><tr><td>...</td></tr></tbody>
- * ONLY for tables that were created from relaxed table input (no separator rows in original)
- *
- * Strategy: Check if there's a separator row (with em dashes) in the tbody.
- * - If there IS a separator row in tbody → regular table (keep thead)
- * - If there is NO separator row in tbody → relaxed table (convert thead to tbody)
- *
- * This works because:
- * - Regular tables: separator row is in tbody (between header and data)
- * - Relaxed tables: separator row was inserted by preprocessing, but we removed it
- *   (or it was converted to em dashes and removed)
- */
-char *apex_convert_relaxed_table_headers(const char *html) {
-    if (!html) return NULL;
-
-    size_t len = strlen(html);
-    char *output = malloc(len * 2);
-    if (!output) return NULL;
-
-    const char *read = html;
-    char *write = output;
-    size_t remaining = len * 2;
-
-    while (*read) {
-        /* Expand buffer if needed */
-        if (remaining < 100) {
-            size_t written = write - output;
-            size_t new_capacity = (write - output) * 2;
-            if (new_capacity < written + 100) {
-                new_capacity = written + 1000;  /* Ensure we have enough space */
-            }
-            char *old_output = output;  /* Save old pointer */
-            char *new_output = realloc(output, new_capacity);
-            if (!new_output) {
-                /* realloc failed - original pointer is still valid, free it */
-                free(old_output);
-                return NULL;
-            }
-            /* realloc succeeded - update pointers */
-            output = new_output;
-            write = output + written;
-            remaining = new_capacity - written;
-        }
-
-        /* Check for <thead> */
-        if (strncmp(read, "<thead>", 7) == 0) {
-            const char *after_thead = read + 7;
-            const char *thead_end = strstr(after_thead, "</thead>");
-            const char *tbody_start = strstr(after_thead, "<tbody>");
-
-            if (thead_end) {
-                /* Check if thead contains only empty cells (dummy headers from headerless tables) */
-                bool all_cells_empty = true;
-                bool found_any_th = false;
-
-                /* Search for all <th> or <th ...> tags in thead */
-                const char *search = after_thead;
-                while (search < thead_end) {
-                    /* Check for <th> without attributes */
-                    if (strncmp(search, "<th>", 4) == 0) {
-                        found_any_th = true;
-                        const char *th_end = strstr(search, "</th>");
-                        if (!th_end || th_end >= thead_end) {
-                            all_cells_empty = false;
-                            break;
-                        }
-                        /* Check if content between > and </th> is empty */
-                        const char *content_start = search + 4; /* After <th>, which is > */
-                        if (content_start < th_end) {
-                            while (content_start < th_end) {
-                                if (!isspace((unsigned char)*content_start)) {
-                                    all_cells_empty = false;
-                                    break;
-                                }
-                                content_start++;
-                            }
-                        }
-                        /* If content_start >= th_end, tags are adjacent (empty) - OK */
-                        if (!all_cells_empty) break;
-                        search = th_end + 5; /* Move past </th> */
-                    }
-                    /* Check for <th with attributes */
-                    else if (strncmp(search, "<th", 3) == 0 &&
-                             (search[3] == ' ' || search[3] == '\t' || search[3] == '>')) {
-                        found_any_th = true;
-                        /* Find the closing > of opening tag */
-                        const char *tag_end = strchr(search, '>');
-                        if (!tag_end || tag_end >= thead_end) {
-                            all_cells_empty = false;
-                            break;
-                        }
-                        const char *th_end = strstr(tag_end, "</th>");
-                        if (!th_end || th_end >= thead_end) {
-                            all_cells_empty = false;
-                            break;
-                        }
-                        /* Check content between > and </th> */
-                        const char *content_start = tag_end + 1;
-                        if (content_start < th_end) {
-                            while (content_start < th_end) {
-                                if (!isspace((unsigned char)*content_start)) {
-                                    all_cells_empty = false;
-                                    break;
-                                }
-                                content_start++;
-                            }
-                        }
-                        /* If content_start >= th_end, tags are adjacent (empty) - OK */
-                        if (!all_cells_empty) break;
-                        search = th_end + 5; /* Move past </th> */
-                    } else {
-                        search++;
-                    }
-                }
-
-                /* If we found th cells and they're all empty, remove the entire thead */
-                if (found_any_th && all_cells_empty) {
-                    read = thead_end + 8; /* Skip <thead>...</thead> */
-                    continue;
-                }
-            }
-
-            if (thead_end && tbody_start && thead_end < tbody_start) {
-                /* Check if tbody contains a separator row (row with only em dashes) */
-                bool has_separator_row = false;
-                const char *tbody_end = strstr(tbody_start, "</tbody>");
-                const char *table_end = strstr(tbody_start, "</table>");
-
-                if (tbody_end && (!table_end || tbody_end < table_end)) {
-                    /* Look for rows with only em dashes in tbody */
-                    const char *search = tbody_start;
-                    while (search < tbody_end) {
-                        if (strncmp(search, "<tr>", 4) == 0) {
-                            const char *tr_end = strstr(search, "</tr>");
-                            if (tr_end && tr_end < tbody_end) {
-                                /* Check if this row contains only em dashes */
-                                bool row_is_separator = true;
-                                const char *cell_start = search + 4;
-                                while (cell_start < tr_end) {
-                                    if (strncmp(cell_start, "<td", 3) == 0 || strncmp(cell_start, "<th", 3) == 0) {
-                                        const char *tag_end = strstr(cell_start, ">");
-                                        if (!tag_end) break;
-                                        tag_end++;
-
-                                        const char *cell_end = NULL;
-                                        if (strncmp(cell_start, "<td", 3) == 0) {
-                                            cell_end = strstr(tag_end, "</td>");
-                                            if (cell_end) cell_end += 5;
-                                        } else {
-                                            cell_end = strstr(tag_end, "</th>");
-                                            if (cell_end) cell_end += 5;
-                                        }
-
-                                        if (cell_end && cell_end <= tr_end) {
-                                            if (!cell_contains_only_dashes(tag_end, cell_end - 5)) {
-                                                row_is_separator = false;
-                                                break;
-                                            }
-                                            cell_start = cell_end;
-                                        } else {
-                                            break;
-                                        }
-                                    } else {
-                                        cell_start++;
-                                    }
-                                }
-
-                                if (row_is_separator) {
-                                    has_separator_row = true;
-                                    break;
-                                }
-
-                                search = tr_end + 5;
-                            } else {
-                                break;
-                            }
-                        } else {
-                            search++;
-                        }
-                    }
-                }
-
-                /* If there's a separator row, it's a regular table - keep thead */
-                /* If there's no separator row, it's a relaxed table - convert thead to tbody */
-                if (!has_separator_row) {
-                    /* Convert thead to tbody */
-                    memcpy(write, "<tbody>", 7);
-                    write += 7;
-                    remaining -= 7;
-                    read += 7;  /* Skip <thead> */
-
-                    /* Convert <th> to <td> and skip </thead> */
-                    while (read < thead_end + 8) {
-                        if (strncmp(read, "<th>", 4) == 0) {
-                            memcpy(write, "<td>", 4);
-                            write += 4;
-                            remaining -= 4;
-                            read += 4;
-                        } else if (strncmp(read, "</th>", 5) == 0) {
-                            memcpy(write, "</td>", 5);
-                            write += 5;
-                            remaining -= 5;
-                            read += 5;
-                        } else if (strncmp(read, "<th ", 4) == 0) {
-                            memcpy(write, "<td", 3);
-                            write += 3;
-                            remaining -= 3;
-                            read += 3;
-                            /* Copy attributes until > */
-                            while (*read && *read != '>') {
-                                *write++ = *read++;
-                                remaining--;
-                            }
-                            if (*read == '>') {
-                                *write++ = *read++;
-                                remaining--;
-                            }
-                        } else if (strncmp(read, "</thead>", 8) == 0) {
-                            /* Skip </thead> - we'll close tbody later if needed */
-                            read += 8;
-                            /* Check if next is <tbody> - if so, skip opening tbody */
-                            const char *next = read;
-                            while (*next && (*next == ' ' || *next == '\n' || *next == '\t')) next++;
-                            if (strncmp(next, "<tbody>", 7) == 0) {
-                                read = next + 7;
-                            }
-                            break;
-                        } else {
-                            *write++ = *read++;
-                            remaining--;
-                        }
-                    }
-                    continue;
-                }
-            }
-        }
-
-        /* Copy character */
-        *write++ = *read++;
-        remaining--;
-    }
-
-    *write = '\0';
-    return output;
-}
-
-/**
- * Remove blank lines within tables
- * Removes lines containing only whitespace/newlines between <table> and </table> tags
- */
-char *apex_remove_table_blank_lines(const char *html) {
-    if (!html) return NULL;
-
-    size_t len = strlen(html);
-    char *output = malloc(len + 1);
-    if (!output) return NULL;
-
-    const char *read = html;
-    char *write = output;
-    bool in_table = false;
-    const char *line_start = read;
-    bool line_is_blank = true;
-
-    while (*read) {
-        /* Check for table tags */
-        if (strncmp(read, "<table", 6) == 0 && (read[6] == '>' || read[6] == ' ')) {
-            in_table = true;
-        } else if (strncmp(read, "</table>", 8) == 0) {
-            in_table = false;
-        }
-
-        /* On newline, check if the line was blank */
-        if (*read == '\n') {
-            if (in_table && line_is_blank) {
-                /* Blank line in table - skip it */
-                read++;
-                line_start = read;
-                line_is_blank = true;
-                continue;
-            }
-            /* Not blank or not in table - write the line including newline */
-            while (line_start <= read) {
-                *write++ = *line_start++;
-            }
-            read++;
-            line_start = read;
-            line_is_blank = true;
-            continue;
-        }
-
-        /* Check if line has non-whitespace content */
-        if (*read != ' ' && *read != '\t' && *read != '\r') {
-            line_is_blank = false;
-        }
-
-        read++;
-    }
-
-    /* Write any remaining content */
-    while (*line_start) {
-        *write++ = *line_start++;
-    }
-
-    *write = '\0';
-    return output;
-}
-
-/**
- * Remove table rows that contain only em dashes (separator rows incorrectly rendered as data rows)
- * This happens when smart typography converts --- to — in separator rows
- * @param html The HTML to process
- * @return Newly allocated HTML with separator rows removed (must be freed)
- */
-char *apex_remove_table_separator_rows(const char *html) {
-    if (!html) return NULL;
-
-    size_t len = strlen(html);
-    char *output = malloc(len + 1);
-    if (!output) return NULL;
-
-    const char *read = html;
-    char *write = output;
-    bool in_table = false;
-    const char *row_start = NULL;
-
-    while (*read) {
-        /* Check for table tags */
-        if (strncmp(read, "<table", 6) == 0 && (read[6] == '>' || read[6] == ' ')) {
-            in_table = true;
-        } else if (strncmp(read, "</table>", 8) == 0) {
-            in_table = false;
-        } else if (in_table && strncmp(read, "<tr>", 4) == 0) {
-            row_start = read;
-            read += 4;
-
-            /* Check all cells in this row */
-            bool is_separator_row = true;
-            const char *row_end = NULL;
-
-            /* Find the end of this row */
-            const char *search = read;
-            while (*search) {
-                if (strncmp(search, "</tr>", 5) == 0) {
-                    row_end = search + 5;
-                    break;
-                }
-                search++;
-            }
-
-            if (row_end) {
-                /* Check each cell in the row */
-                const char *cell_start = read;
-                while (cell_start < row_end) {
-                    if (strncmp(cell_start, "<td", 3) == 0 || strncmp(cell_start, "<th", 3) == 0) {
-                        /* Find the closing tag */
-                        const char *tag_end = strstr(cell_start, ">");
-                        if (!tag_end) break;
-                        tag_end++;
-
-                        /* Find the closing </td> or </th> */
-                        const char *cell_end = NULL;
-                        if (strncmp(cell_start, "<td", 3) == 0) {
-                            cell_end = strstr(tag_end, "</td>");
-                            if (cell_end) cell_end += 5;
-                        } else {
-                            cell_end = strstr(tag_end, "</th>");
-                            if (cell_end) cell_end += 5;
-                        }
-
-                        if (cell_end && cell_end <= row_end) {
-                            /* Check if this cell contains only dashes */
-                            if (!cell_contains_only_dashes(tag_end, cell_end - 5)) {
-                                is_separator_row = false;
-                                break;
-                            }
-                            cell_start = cell_end;
-                        } else {
-                            break;
-                        }
-                    } else {
-                        cell_start++;
-                    }
-                }
-            }
-
-            if (is_separator_row && row_end) {
-                /* Skip this entire row */
-                read = row_end;
-                continue;
-            } else {
-                /* Write the row start */
-                while (row_start < read) {
-                    *write++ = *row_start++;
-                }
-            }
-            continue;
-        }
-
-        /* Copy character */
-        *write++ = *read++;
-    }
-
-    *write = '\0';
-    return output;
-}
-
 /**
  * Adjust header levels in HTML based on Base Header Level metadata
- * Shifts all headers by the specified offset (e.g., Base Header Level: 2 means h1->h2, h2->h3, etc.)
+ * Shifts the document's headings by the specified offset (e.g., Base Header Level: 2 means h1->h2, h2->h3, etc.)
  */
-char *apex_adjust_header_levels(const char *html, int base_header_level) {
+char *apex_adjust_header_levels(const char *html, int base_header_level, const apex_heading_table *headings) {
     if (!html || base_header_level <= 0 || base_header_level > 6) {
         return html ? strdup(html) : NULL;
     }
@@ -1733,6 +795,13 @@ char *apex_adjust_header_levels(const char *html, int base_header_level) {
     char *write = output;
     size_t remaining = capacity;
 
+    /* Heading tags are matched to the table in document order; tags from
+     * raw HTML, and their closing tags, are copied as they are */
+    size_t tag_idx = 0;
+    size_t next_heading = 0;
+    int open_level = 0;  /* Tag level of the heading whose closing tag is due */
+    int shift_level = 0;  /* Its level as parsed */
+
     while (*read) {
         /* Look for header opening tags: <h1>, <h2>, etc. or closing tags: </h1>, </h2>, etc. */
         bool is_closing_tag = false;
@@ -1740,16 +809,21 @@ char *apex_adjust_header_levels(const char *html, int base_header_level) {
 
         if (*read == '<') {
             /* Check for closing tag </h1> first */
-            if (read[1] == '/' && read[2] == 'h' &&
-                read[3] >= '1' && read[3] <= '6' && read[4] == '>') {
+            if (open_level && read[1] == '/' && read[2] == 'h' && read[3] - '0' == open_level && read[4] == '>') {
                 is_closing_tag = true;
-                header_level = read[3] - '0';
+                header_level = shift_level;
+                open_level = 0;
             }
             /* Check for opening tag <h1> or <h1 ...> */
             else if (read[1] == 'h' && read[2] >= '1' && read[2] <= '6' &&
-                     (read[3] == '>' || isspace((unsigned char)read[3]))) {
+                     (read[3] == '>' || isspace((unsigned char)read[3])) &&
+                     !apex_heading_table_is_raw_tag(headings, tag_idx++, next_heading)) {
                 is_closing_tag = false;
-                header_level = read[2] - '0';
+                open_level = read[2] - '0';
+                header_level = headings && headings->html_tags_known && next_heading < headings->count ?
+                               headings->headings[next_heading].level : open_level;
+                shift_level = header_level;
+                next_heading++;
             }
         }
 
@@ -7,6 +7,7 @@
 #define APEX_HTML_RENDERER_H
 
 #include "cmark-gfm.h"
+#include "extensions/header_ids.h"
 #include <stdbool.h>
 
 #ifdef __cplusplus
@@ -15,20 +16,19 @@ extern "C" {
 
 /**
  * Render document to HTML with IAL attribute support
- * This is a wrapper around cmark_render_html that injects attributes
+ * Each node's attributes are written into its own tag as cmark renders it
+ * (table rows and cells excepted; see apex_render_table_grids)
  */
 char *apex_render_html_with_attributes(cmark_node *document, int options);
 
 /**
  * Inject header IDs into HTML output
  * @param html The HTML output
- * @param document The AST document
- * @param generate_ids Whether to generate IDs
+ * @param headings The document's heading table (IDs already deduplicated)
  * @param use_anchors Whether to use <a> anchor tags instead of header IDs
- * @param id_format 0=GFM (with dashes), 1=MMD (no dashes)
  * @return Newly allocated HTML with IDs injected
  */
-char *apex_inject_header_ids(const char *html, cmark_node *document, bool generate_ids, bool use_anchors, int id_format);
+char *apex_inject_header_ids(const char *html, const apex_heading_table *headings, bool use_anchors);
 
 /**
  * Clean up HTML tag spacing
@@ -51,39 +51,16 @@ char *apex_clean_html_tag_spacing(const char *html);
  */
 char *apex_collapse_intertag_newlines(const char *html);
 
-/**
- * Convert thead to tbody for relaxed tables
- * Converts <thead><tr><th>...</th></tr></thead> to <tbody><tr><td>...</td></tr></tbody>
- * for tables that were created from relaxed table input (no separator rows)
- * @param html The HTML to process
- * @return Newly allocated HTML with relaxed table thead converted to tbody (must be freed)
- */
-char *apex_convert_relaxed_table_headers(const char *html);
-
-/**
- * Remove blank lines within tables
- * Removes lines containing only whitespace/newlines between <table> and </table> tags
- * @param html The HTML to process
- * @return Newly allocated HTML with blank lines removed from tables (must be freed)
- */
-char *apex_remove_table_blank_lines(const char *html);
-
-/**
- * Remove table rows that contain only em dashes (separator rows incorrectly rendered as data rows)
- * This happens when smart typography converts --- to — in separator rows
- * @param html The HTML to process
- * @return Newly allocated HTML with separator rows removed (must be freed)
- */
-char *apex_remove_table_separator_rows(const char *html);
-
 /**
  * Adjust header levels in HTML based on Base Header Level metadata
- * Shifts all headers by the specified offset (e.g., Base Header Level: 2 means h1->h2, h2->h3, etc.)
+ * Shifts the document's headings by the specified offset (e.g., Base Header Level: 2 means h1->h2, h2->h3, etc.);
+ * headings written in raw HTML keep their level
  * @param html The HTML to process
  * @param base_header_level The base header level (1-6, or 0 to disable)
+ * @param headings The document's headings; NULL shifts every heading tag
  * @return Newly allocated HTML with adjusted header levels (must be freed)
  */
-char *apex_adjust_header_levels(const char *html, int base_header_level);
+char *apex_adjust_header_levels(const char *html, int base_header_level, const apex_heading_table *headings);
 
 /**
  * Adjust quote styles in HTML based on Quotes Language metadata
@@ -0,0 +1,240 @@
+/**
+ * Conversion metrics
+ * Monotonic timing, cmark allocation counting and batch aggregation
+ */
+
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define APEX_THREAD_LOCAL __thread
+#else
+#define APEX_THREAD_LOCAL
+#endif
+
+double apex_metrics_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Counting cmark allocator                                                  */
+/* ------------------------------------------------------------------------- */
+
+static APEX_THREAD_LOCAL size_t apex_cmark_allocations = 0;
+
+static void *apex_counting_calloc(size_t count, size_t size) {
+    apex_cmark_allocations++;
+    return calloc(count, size);
+}
+
+static void *apex_counting_realloc(void *ptr, size_t size) {
+    apex_cmark_allocations++;
+    return realloc(ptr, size);
+}
+
+static cmark_mem apex_counting_mem = {
+    apex_counting_calloc,
+    apex_counting_realloc,
+    free
+};
+
+cmark_mem *apex_metrics_counting_mem(void) {
+    return &apex_counting_mem;
+}
+
+size_t apex_metrics_allocation_count(void) {
+    return apex_cmark_allocations;
+}
+
+void apex_metrics_count_allocation(void) {
+    apex_cmark_allocations++;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Batch aggregation                                                         */
+/* ------------------------------------------------------------------------- */
+
+/* Histogram bucket i counts durations below 2^i microseconds; the last
+ * bucket collects everything slower. */
+#define APEX_METRICS_BUCKETS 26
+
+typedef struct {
+    char *stage;
+    size_t runs;
+    size_t skipped;
+    double total_ms;
+    double min_ms;
+    double max_ms;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long allocations;
+    size_t histogram[APEX_METRICS_BUCKETS];
+} apex_stage_stats;
+
+struct apex_metrics_batch {
+    apex_stage_stats *stages;  /* In first-seen (pipeline) order */
+    size_t count;
+    size_t capacity;
+    size_t documents;
+};
+
+apex_metrics_batch *apex_metrics_batch_new(void) {
+    return calloc(1, sizeof(apex_metrics_batch));
+}
+
+static apex_stage_stats *apex_metrics_batch_stage(apex_metrics_batch *batch, const char *stage) {
+    for (size_t i = 0; i < batch->count; i++) {
+        if (strcmp(batch->stages[i].stage, stage) == 0) return &batch->stages[i];
+    }
+
+    if (batch->count == batch->capacity) {
+        size_t new_capacity = batch->capacity ? batch->capacity * 2 : 64;
+        apex_stage_stats *grown = realloc(batch->stages, new_capacity * sizeof(apex_stage_stats));
+        if (!grown) return NULL;
+        batch->stages = grown;
+        batch->capacity = new_capacity;
+    }
+
+    apex_stage_stats *stats = &batch->stages[batch->count];
+    memset(stats, 0, sizeof(*stats));
+    stats->stage = strdup(stage);
+    if (!stats->stage) return NULL;
+    batch->count++;
+    return stats;
+}
+
+void apex_metrics_batch_record(const apex_stage_metrics *metrics, void *user_data) {
+    apex_metrics_batch *batch = (apex_metrics_batch *)user_data;
+    if (!batch || !metrics || !metrics->stage) return;
+
+    apex_stage_stats *stats = apex_metrics_batch_stage(batch, metrics->stage);
+    if (!stats) return;
+
+    if (metrics->skipped) {
+        stats->skipped++;
+        return;
+    }
+
+    if (strcmp(metrics->stage, "total") == 0) {
+        batch->documents++;
+    }
+
+    if (stats->runs == 0 || metrics->duration_ms < stats->min_ms) stats->min_ms = metrics->duration_ms;
+    if (stats->runs == 0 || metrics->duration_ms > stats->max_ms) stats->max_ms = metrics->duration_ms;
+    stats->runs++;
+    stats->total_ms += metrics->duration_ms;
+    stats->bytes_in += metrics->bytes_in;
+    stats->bytes_out += metrics->bytes_out;
+    stats->allocations += metrics->allocations;
+
+    double us = metrics->duration_ms * 1000.0;
+    int bucket = 0;
+    while (bucket < APEX_METRICS_BUCKETS - 1 && us >= (double)(1UL << bucket)) bucket++;
+    stats->histogram[bucket]++;
+}
+
+/* Growable output buffer for the JSON dump */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} metrics_json;
+
+static void metrics_json_printf(metrics_json *out, const char *fmt, ...) {
+    if (out->failed) return;
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(out->data + out->len, out->cap - out->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            out->failed = true;
+            return;
+        }
+        if ((size_t)n < out->cap - out->len) {
+            out->len += (size_t)n;
+            return;
+        }
+        size_t new_cap = out->cap * 2 + (size_t)n;
+        char *grown = realloc(out->data, new_cap);
+        if (!grown) {
+            out->failed = true;
+            return;
+        }
+        out->data = grown;
+        out->cap = new_cap;
+    }
+}
+
+/* Stage names are pipeline identifiers or plugin ids; escape defensively */
+static void metrics_json_string(metrics_json *out, const char *s) {
+    metrics_json_printf(out, "\"");
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            metrics_json_printf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            metrics_json_printf(out, "\\u%04x", *p);
+        } else {
+            metrics_json_printf(out, "%c", *p);
+        }
+    }
+    metrics_json_printf(out, "\"");
+}
+
+char *apex_metrics_batch_to_json(const apex_metrics_batch *batch) {
+    if (!batch) return NULL;
+
+    metrics_json out = { malloc(4096), 0, 4096, false };
+    if (!out.data) return NULL;
+    out.data[0] = '\0';
+
+    metrics_json_printf(&out, "{\n  \"documents\": %zu,\n  \"stages\": [", batch->documents);
+    for (size_t i = 0; i < batch->count; i++) {
+        const apex_stage_stats *stats = &batch->stages[i];
+        metrics_json_printf(&out, "%s\n    {\"stage\": ", i ? "," : "");
+        metrics_json_string(&out, stats->stage);
+        metrics_json_printf(&out,
+                            ", \"runs\": %zu, \"skipped\": %zu"
+                            ", \"total_ms\": %.3f, \"mean_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f"
+                            ", \"bytes_in\": %llu, \"bytes_out\": %llu, \"allocations\": %llu"
+                            ", \"histogram_us\": {",
+                            stats->runs, stats->skipped,
+                            stats->total_ms, stats->runs ? stats->total_ms / (double)stats->runs : 0.0,
+                            stats->min_ms, stats->max_ms,
+                            stats->bytes_in, stats->bytes_out, stats->allocations);
+        bool first = true;
+        for (int b = 0; b < APEX_METRICS_BUCKETS; b++) {
+            if (!stats->histogram[b]) continue;
+            if (b == APEX_METRICS_BUCKETS - 1) {
+                metrics_json_printf(&out, "%s\"inf\": %zu", first ? "" : ", ", stats->histogram[b]);
+            } else {
+                metrics_json_printf(&out, "%s\"%lu\": %zu", first ? "" : ", ", 1UL << b, stats->histogram[b]);
+            }
+            first = false;
+        }
+        metrics_json_printf(&out, "}}");
+    }
+    metrics_json_printf(&out, "%s]\n}\n", batch->count ? "\n  " : "");
+
+    if (out.failed) {
+        free(out.data);
+        return NULL;
+    }
+    return out.data;
+}
+
+void apex_metrics_batch_free(apex_metrics_batch *batch) {
+    if (!batch) return;
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->stages[i].stage);
+    }
+    free(batch->stages);
+    free(batch);
+}
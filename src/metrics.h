@@ -0,0 +1,43 @@
+/**
+ * Conversion metrics
+ * Monotonic timing and cmark allocation counting shared by the pipeline
+ * in apex.c and the plugin runner
+ */
+
+#ifndef APEX_METRICS_H
+#define APEX_METRICS_H
+
+#include "apex/apex.h"
+#include "cmark-gfm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Milliseconds from a monotonic clock (only differences are meaningful)
+ */
+double apex_metrics_now_ms(void);
+
+/**
+ * cmark allocator that counts calloc/realloc calls made on this thread.
+ * Used for parsers created while metrics are being collected.
+ */
+cmark_mem *apex_metrics_counting_mem(void);
+
+/**
+ * Number of allocations made through apex_metrics_counting_mem() (or the
+ * arena allocator) on this thread so far
+ */
+size_t apex_metrics_allocation_count(void);
+
+/**
+ * Count one allocation made by another cmark allocator on this thread
+ */
+void apex_metrics_count_allocation(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_METRICS_H */
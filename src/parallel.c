@@ -0,0 +1,256 @@
+/**
+ * Block-parallel HTML passes
+ */
+
+#include "parallel.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Chunks handed to each thread, so uneven blocks still balance out */
+#define CHUNKS_PER_THREAD 4
+#define MIN_CHUNK_BYTES (16 * 1024)
+#define MAX_THREADS 64
+
+static const char *const void_elements[] = {
+    "area", "base", "br", "col", "embed", "hr", "img", "input",
+    "link", "meta", "param", "source", "track", "wbr", NULL
+};
+
+/* Elements whose content is not HTML and is skipped to the closing tag */
+static const char *const raw_elements[] = { "script", "style", "textarea", NULL };
+
+static bool name_in(const char *name, const char *const *list) {
+    for (; *list; list++) {
+        if (strcmp(name, *list) == 0) return true;
+    }
+    return false;
+}
+
+/* memmem for needle within [p, end), optionally ignoring ASCII case */
+static const char *find_in(const char *p, const char *end, const char *needle, bool nocase) {
+    size_t n = strlen(needle);
+    for (; p + n <= end; p++) {
+        if (nocase ? strncasecmp(p, needle, n) == 0 : memcmp(p, needle, n) == 0) return p;
+    }
+    return NULL;
+}
+
+/* End of the tag starting at p ('>' position), honouring quoted attribute values */
+static const char *tag_end(const char *p, const char *end) {
+    char quote = 0;
+    for (p++; p < end; p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == '>') {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Skip past the closing </name ...> of a raw element; NULL if missing */
+static const char *skip_raw(const char *p, const char *end, const char *name) {
+    char closing[16];
+    snprintf(closing, sizeof(closing), "</%s", name);
+    const char *close = find_in(p, end, closing, true);
+    if (!close) return NULL;
+    const char *gt = tag_end(close, end);
+    return gt ? gt + 1 : NULL;
+}
+
+size_t apex_html_block_cuts(const char *html, size_t len, size_t min_chunk,
+                            size_t *cuts, size_t max_cuts) {
+    const char *p = html;
+    const char *end = html + len;
+    size_t next_cut = min_chunk;
+    size_t count = 0;
+    int depth = 0;
+
+    while (p < end && count < max_cuts) {
+        if (*p != '<') {
+            p++;
+            continue;
+        }
+
+        if (p + 4 <= end && memcmp(p, "<!--", 4) == 0) {
+            const char *close = find_in(p + 4, end, "-->", false);
+            if (!close) break;
+            p = close + 3;
+        } else if (p + 1 < end && (p[1] == '!' || p[1] == '?')) {
+            const char *gt = memchr(p, '>', (size_t)(end - p));
+            if (!gt) break;
+            p = gt + 1;
+        } else {
+            bool closing = p + 1 < end && p[1] == '/';
+            const char *n = p + 1 + (closing ? 1 : 0);
+            if (n >= end || !isalpha((unsigned char)*n)) {
+                /* A bare '<' in text */
+                p++;
+                continue;
+            }
+
+            char name[16];
+            size_t name_len = 0;
+            while (n < end && (isalnum((unsigned char)*n) || *n == '-') && name_len < sizeof(name) - 1) {
+                name[name_len++] = (char)tolower((unsigned char)*n++);
+            }
+            name[name_len] = '\0';
+
+            const char *gt = tag_end(p, end);
+            if (!gt) break;
+            bool self_closing = gt[-1] == '/';
+            p = gt + 1;
+
+            if (closing) {
+                if (--depth < 0) break;
+            } else if (self_closing || name_in(name, void_elements)) {
+                /* No content */
+            } else if (strcmp(name, "pre") == 0) {
+                /* Syntax highlighting takes everything up to the first
+                 * </code></pre> after <pre><code>, so never cut inside it */
+                const char *q = p;
+                while (q < end && (*q == ' ' || *q == '\t' || *q == '\n' || *q == '\r')) q++;
+                if (end - q >= 5 && memcmp(q, "<code", 5) == 0) {
+                    const char *close = find_in(q, end, "</code></pre>", false);
+                    if (!close) break;
+                    p = close + 13;
+                } else {
+                    p = skip_raw(p, end, name);
+                    if (!p) break;
+                }
+            } else if (name_in(name, raw_elements)) {
+                p = skip_raw(p, end, name);
+                if (!p) break;
+            } else {
+                depth++;
+            }
+        }
+
+        /* Back at the top level: cut after the newline if a tag follows */
+        if (depth == 0 && end - p >= 3 && p[0] == '\n' && p[1] == '<' && p[2] != '/' &&
+            (size_t)(p + 1 - html) >= next_cut && p + 1 - html + min_chunk <= len) {
+            cuts[count++] = (size_t)(p + 1 - html);
+            next_cut = cuts[count - 1] + min_chunk;
+        }
+    }
+
+    return count;
+}
+
+typedef struct {
+    const char *html;
+    const size_t *starts;       /* count + 1 offsets; the last is the length */
+    char **results;
+    size_t count;
+    size_t next;                /* Next chunk to hand out, under lock */
+    pthread_mutex_t lock;
+    apex_block_pass pass;
+    void *context;
+} block_job;
+
+static void *block_worker(void *arg) {
+    block_job *job = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->count) break;
+
+        size_t chunk_len = job->starts[i + 1] - job->starts[i];
+        char *chunk = malloc(chunk_len + 1);
+        if (!chunk) continue;
+        memcpy(chunk, job->html + job->starts[i], chunk_len);
+        chunk[chunk_len] = '\0';
+
+        char *result = job->pass(chunk, job->context);
+        if (result) {
+            free(chunk);
+            job->results[i] = result;
+        } else {
+            job->results[i] = chunk;
+        }
+    }
+    return NULL;
+}
+
+char *apex_parallel_block_pass(const char *html, int threads, apex_block_pass pass, void *context) {
+    if (!html || !pass || threads < 2) return NULL;
+
+    size_t len = strlen(html);
+    if (len < APEX_PARALLEL_MIN_BYTES) return NULL;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    size_t max_chunks = (size_t)threads * CHUNKS_PER_THREAD;
+    size_t min_chunk = len / max_chunks;
+    if (min_chunk < MIN_CHUNK_BYTES) min_chunk = MIN_CHUNK_BYTES;
+
+    size_t *starts = malloc((max_chunks + 1) * sizeof(size_t));
+    char **results = calloc(max_chunks, sizeof(char *));
+    if (!starts || !results) {
+        free(starts);
+        free(results);
+        return NULL;
+    }
+
+    starts[0] = 0;
+    size_t count = apex_html_block_cuts(html, len, min_chunk, starts + 1, max_chunks - 1) + 1;
+    starts[count] = len;
+    if (count < 2) {
+        free(starts);
+        free(results);
+        return NULL;
+    }
+
+    block_job job = { html, starts, results, count, 0, PTHREAD_MUTEX_INITIALIZER, pass, context };
+    size_t workers = (size_t)threads < count ? (size_t)threads : count;
+    pthread_t tids[MAX_THREADS];
+    size_t started = 0;
+
+    /* The calling thread is one of the workers */
+    for (size_t i = 1; i < workers; i++) {
+        if (pthread_create(&tids[started], NULL, block_worker, &job) != 0) break;
+        started++;
+    }
+    block_worker(&job);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    /* Join in document order; any missing chunk means the split failed */
+    size_t total = 0;
+    bool complete = true;
+    for (size_t i = 0; i < count; i++) {
+        if (!results[i]) {
+            complete = false;
+            break;
+        }
+        total += strlen(results[i]);
+    }
+
+    char *joined = complete ? malloc(total + 1) : NULL;
+    if (joined) {
+        char *w = joined;
+        for (size_t i = 0; i < count; i++) {
+            size_t n = strlen(results[i]);
+            memcpy(w, results[i], n);
+            w += n;
+        }
+        *w = '\0';
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(results[i]);
+    }
+    free(results);
+    free(starts);
+    return joined;
+}
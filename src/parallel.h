@@ -0,0 +1,58 @@
+/**
+ * Block-parallel HTML passes
+ *
+ * Large documents spend most of their post-render time in passes that
+ * only ever look at one top-level block at a time (syntax highlighting,
+ * abbreviations, emoji). These helpers cut the rendered HTML between
+ * top-level blocks and run such a pass on the pieces from a small pool
+ * of threads, then join the results in document order.
+ */
+
+#ifndef APEX_PARALLEL_H
+#define APEX_PARALLEL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Documents smaller than this are not worth splitting */
+#define APEX_PARALLEL_MIN_BYTES (64 * 1024)
+
+/**
+ * A block-local pass: returns a newly allocated replacement for chunk, or
+ * NULL to keep it unchanged. Called concurrently on different chunks.
+ */
+typedef char *(*apex_block_pass)(const char *chunk, void *context);
+
+/**
+ * Find cut points between top-level blocks of rendered HTML.
+ *
+ * A cut is placed after the newline that follows a tag closing back to
+ * nesting depth 0, and only where the next block opens with a tag.
+ * Comments, <script>/<style>/<textarea> and <pre><code> blocks are
+ * skipped whole. Cuts are at least min_chunk bytes apart. Scanning stops
+ * (keeping the cuts found so far) as soon as the nesting can't be
+ * followed, e.g. at an unterminated tag or a stray closing tag.
+ *
+ * @return Number of offsets written to cuts (at most max_cuts)
+ */
+size_t apex_html_block_cuts(const char *html, size_t len, size_t min_chunk,
+                            size_t *cuts, size_t max_cuts);
+
+/**
+ * Run pass over html split at top-level blocks using up to threads
+ * threads. The result is the concatenation of the per-chunk results.
+ *
+ * @return Newly allocated HTML, or NULL if the document was not split
+ *         (too small, no cut points, threads < 2 or allocation failure);
+ *         the caller then runs the pass over the whole document itself
+ */
+char *apex_parallel_block_pass(const char *html, int threads, apex_block_pass pass, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_PARALLEL_H */
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 
 typedef struct {
     const apex_options *options;
@@ -34,85 +35,211 @@ void apex_parser_free(void *parser) {
     }
 }
 
-static apex_node *apex_node_new(apex_node_type type) {
-    apex_node *node = (apex_node *)calloc(1, sizeof(apex_node));
-    if (node) {
-        node->type = type;
+#define TREE_INITIAL_NODES 64
+#define TREE_INITIAL_STRINGS 16
+
+/* Grow one node column to capacity entries, zeroing the new ones */
+static bool grow_column(void **column, size_t entry_size, uint32_t old_capacity, uint32_t capacity) {
+    void *grown = realloc(*column, entry_size * capacity);
+    if (!grown) return false;
+    memset((char *)grown + entry_size * old_capacity, 0, entry_size * (capacity - old_capacity));
+    *column = grown;
+    return true;
+}
+
+static bool tree_reserve(apex_tree *tree, uint32_t needed) {
+    if (needed <= tree->capacity) return true;
+    uint32_t capacity = tree->capacity ? tree->capacity : TREE_INITIAL_NODES;
+    while (capacity < needed) {
+        if (capacity > UINT32_MAX / 2) return false;
+        capacity *= 2;
+    }
+
+    uint32_t old = tree->capacity;
+    if (!grow_column((void **)&tree->type, sizeof(*tree->type), old, capacity) ||
+        !grow_column((void **)&tree->flags, sizeof(*tree->flags), old, capacity) ||
+        !grow_column((void **)&tree->parent, sizeof(*tree->parent), old, capacity) ||
+        !grow_column((void **)&tree->first_child, sizeof(*tree->first_child), old, capacity) ||
+        !grow_column((void **)&tree->last_child, sizeof(*tree->last_child), old, capacity) ||
+        !grow_column((void **)&tree->next, sizeof(*tree->next), old, capacity) ||
+        !grow_column((void **)&tree->line, sizeof(*tree->line), old, capacity) ||
+        !grow_column((void **)&tree->column, sizeof(*tree->column), old, capacity) ||
+        !grow_column((void **)&tree->literal, sizeof(*tree->literal), old, capacity) ||
+        !grow_column((void **)&tree->data, sizeof(*tree->data), old, capacity)) {
+        /* Columns that did grow keep their larger blocks; capacity stays
+         * at the size all of them have */
+        return false;
+    }
+    tree->capacity = capacity;
+    return true;
+}
+
+static apex_tree *tree_new(const char *source, size_t length) {
+    apex_tree *tree = (apex_tree *)calloc(1, sizeof(apex_tree));
+    if (!tree) return NULL;
+    tree->source = source;
+    tree->source_length = length;
+
+    /* Slot 0 stands for "no node" */
+    tree->count = 1;
+    if (!tree_reserve(tree, TREE_INITIAL_NODES)) {
+        apex_tree_free(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+void apex_tree_free(apex_tree *tree) {
+    if (!tree) return;
+    free(tree->type);
+    free(tree->flags);
+    free(tree->parent);
+    free(tree->first_child);
+    free(tree->last_child);
+    free(tree->next);
+    free(tree->line);
+    free(tree->column);
+    free(tree->literal);
+    free(tree->data);
+    free(tree->strings);
+    free(tree->string_offsets);
+    free(tree->string_slots);
+    free(tree);
+}
+
+/* Move the position tracker forward to pos (nodes are added in source order) */
+static void advance_to(parser_state *state, size_t pos) {
+    const char *p = state->input + state->pos;
+    const char *end = state->input + pos;
+    const char *nl;
+
+    while (p < end && (nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        state->line++;
+        state->column = 1;
+        p = nl + 1;
+    }
+    state->column += (int)(end - p);
+    state->pos = pos;
+}
+
+/* Append a new node starting at source offset pos; returns 0 on failure */
+static apex_node_id tree_add(apex_tree *tree, parser_state *state, apex_node_type type,
+                             apex_node_id parent, size_t pos) {
+    if (!tree_reserve(tree, tree->count + 1)) return APEX_NODE_NONE;
+
+    apex_node_id node = tree->count++;
+    tree->type[node] = (uint8_t)type;
+    advance_to(state, pos);
+    tree->line[node] = (uint32_t)state->line;
+    tree->column[node] = (uint32_t)state->column;
+
+    if (parent) {
+        tree->parent[node] = parent;
+        if (tree->last_child[parent]) {
+            tree->next[tree->last_child[parent]] = node;
+        } else {
+            tree->first_child[parent] = node;
+        }
+        tree->last_child[parent] = node;
     }
     return node;
 }
 
-static void apex_node_append_child(apex_node *parent, apex_node *child) {
-    if (!parent || !child) return;
+static void tree_set_literal(apex_tree *tree, apex_node_id node, size_t start, size_t end) {
+    tree->literal[node].offset = (uint32_t)start;
+    tree->literal[node].length = (uint32_t)(end - start);
+}
 
-    child->parent = parent;
-    child->next = NULL;
+/* FNV-1a */
+static uint32_t hash_bytes(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    if (parent->last_child) {
-        parent->last_child->next = child;
-        child->prev = parent->last_child;
-        parent->last_child = child;
-    } else {
-        parent->first_child = child;
-        parent->last_child = child;
-        child->prev = NULL;
+static bool intern_rehash(apex_tree *tree, uint32_t slot_count) {
+    uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+    if (!slots) return false;
+    for (uint32_t id = 1; id < tree->string_count; id++) {
+        const char *text = tree->strings + tree->string_offsets[id];
+        uint32_t slot = hash_bytes(text, strlen(text)) & (slot_count - 1);
+        while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = id;
     }
+    free(tree->string_slots);
+    tree->string_slots = slots;
+    tree->string_slot_count = slot_count;
+    return true;
 }
 
-void apex_node_free(apex_node *node) {
-    if (!node) return;
+/**
+ * Intern a string: equal strings share one copy and one id. Returns 0
+ * on allocation failure.
+ */
+static uint32_t tree_intern(apex_tree *tree, const char *text, size_t length) {
+    if (tree->string_count == 0) {
+        /* Id 0 stands for "no string" */
+        tree->string_offsets = (uint32_t *)malloc(TREE_INITIAL_STRINGS * sizeof(uint32_t));
+        if (!tree->string_offsets) return 0;
+        tree->string_capacity = TREE_INITIAL_STRINGS;
+        tree->string_offsets[0] = 0;
+        tree->string_count = 1;
+    }
 
-    /* Free all children recursively */
-    apex_node *child = node->first_child;
-    while (child) {
-        apex_node *next = child->next;
-        apex_node_free(child);
-        child = next;
+    /* Keep the table at most half full */
+    if (tree->string_count * 2 >= tree->string_slot_count &&
+        !intern_rehash(tree, tree->string_slot_count ? tree->string_slot_count * 2 : 32)) {
+        return 0;
     }
 
-    /* Free node data */
-    if (node->literal) {
-        free(node->literal);
+    uint32_t hash = hash_bytes(text, length);
+    uint32_t mask = tree->string_slot_count - 1;
+    uint32_t slot = hash & mask;
+    while (tree->string_slots[slot]) {
+        uint32_t id = tree->string_slots[slot];
+        const char *existing = tree->strings + tree->string_offsets[id];
+        if (strncmp(existing, text, length) == 0 && existing[length] == '\0') return id;
+        slot = (slot + 1) & mask;
     }
 
-    /* Free type-specific data */
-    switch (node->type) {
-        case APEX_NODE_CODE_BLOCK:
-            if (node->data.code_block.info) {
-                free(node->data.code_block.info);
-            }
-            break;
-        case APEX_NODE_LINK:
-        case APEX_NODE_IMAGE:
-            if (node->data.link.url) {
-                free(node->data.link.url);
-            }
-            if (node->data.link.title) {
-                free(node->data.link.title);
-            }
-            break;
-        case APEX_NODE_CALLOUT:
-            if (node->data.callout.type) {
-                free(node->data.callout.type);
-            }
-            if (node->data.callout.title) {
-                free(node->data.callout.title);
-            }
-            break;
-        default:
-            break;
+    if (tree->strings_size + length + 1 > tree->strings_capacity) {
+        size_t capacity = tree->strings_capacity ? tree->strings_capacity : 256;
+        while (capacity < tree->strings_size + length + 1) capacity *= 2;
+        char *grown = (char *)realloc(tree->strings, capacity);
+        if (!grown) return 0;
+        tree->strings = grown;
+        tree->strings_capacity = capacity;
+    }
+    if (tree->string_count == tree->string_capacity) {
+        uint32_t *grown = (uint32_t *)realloc(tree->string_offsets,
+                                              tree->string_capacity * 2 * sizeof(uint32_t));
+        if (!grown) return 0;
+        tree->string_offsets = grown;
+        tree->string_capacity *= 2;
     }
 
-    free(node);
+    uint32_t id = tree->string_count++;
+    tree->string_offsets[id] = (uint32_t)tree->strings_size;
+    memcpy(tree->strings + tree->strings_size, text, length);
+    tree->strings[tree->strings_size + length] = '\0';
+    tree->strings_size += length + 1;
+    tree->string_slots[slot] = id;
+    return id;
 }
 
 /* Simple line-based parser for basic Markdown */
-static apex_node *parse_simple(parser_state *state) {
-    apex_node *doc = apex_node_new(APEX_NODE_DOCUMENT);
+static apex_tree *parse_simple(parser_state *state) {
     const char *input = state->input;
     size_t len = state->length;
     size_t pos = 0;
 
+    apex_tree *tree = tree_new(input, len);
+    if (!tree) return NULL;
+    apex_node_id doc = tree_add(tree, state, APEX_NODE_DOCUMENT, APEX_NODE_NONE, 0);
+
     while (pos < len) {
         /* Skip empty lines */
         while (pos < len && (input[pos] == '\n' || input[pos] == '\r')) {
@@ -141,10 +268,10 @@ static apex_node *parse_simple(parser_state *state) {
                     pos++;
                 }
 
-                apex_node *heading = apex_node_new(APEX_NODE_HEADING);
-                heading->data.heading.level = level;
-                heading->literal = strndup(input + text_start, pos - text_start);
-                apex_node_append_child(doc, heading);
+                apex_node_id heading = tree_add(tree, state, APEX_NODE_HEADING, doc, start);
+                if (!heading) goto fail;
+                tree->data[heading].a = (uint32_t)level;
+                tree_set_literal(tree, heading, text_start, pos);
                 continue;
             }
 
@@ -154,6 +281,7 @@ static apex_node *parse_simple(parser_state *state) {
 
         /* Check for code fence */
         if (pos + 3 <= len && input[pos] == '`' && input[pos+1] == '`' && input[pos+2] == '`') {
+            size_t fence_start = pos;
             pos += 3;
             size_t info_start = pos;
 
@@ -162,7 +290,7 @@ static apex_node *parse_simple(parser_state *state) {
                 pos++;
             }
 
-            char *info = (info_start < pos) ? strndup(input + info_start, pos - info_start) : NULL;
+            size_t info_end = pos;
             if (pos < len) pos++; /* Skip newline */
 
             size_t code_start = pos;
@@ -170,11 +298,14 @@ static apex_node *parse_simple(parser_state *state) {
             /* Find closing fence */
             while (pos + 3 <= len) {
                 if (input[pos] == '`' && input[pos+1] == '`' && input[pos+2] == '`') {
-                    apex_node *code_block = apex_node_new(APEX_NODE_CODE_BLOCK);
-                    code_block->data.code_block.fenced = true;
-                    code_block->data.code_block.info = info;
-                    code_block->literal = strndup(input + code_start, pos - code_start);
-                    apex_node_append_child(doc, code_block);
+                    apex_node_id code_block = tree_add(tree, state, APEX_NODE_CODE_BLOCK, doc, fence_start);
+                    if (!code_block) goto fail;
+                    tree->flags[code_block] |= APEX_NODE_FLAG_FENCED;
+                    if (info_start < info_end) {
+                        tree->data[code_block].a = tree_intern(tree, input + info_start, info_end - info_start);
+                        if (!tree->data[code_block].a) goto fail;
+                    }
+                    tree_set_literal(tree, code_block, code_start, pos);
 
                     pos += 3;
                     /* Skip to end of line */
@@ -201,19 +332,31 @@ static apex_node *parse_simple(parser_state *state) {
         }
 
         if (pos > para_start) {
-            apex_node *para = apex_node_new(APEX_NODE_PARAGRAPH);
-            para->literal = strndup(input + para_start, pos - para_start);
-            apex_node_append_child(doc, para);
+            apex_node_id para = tree_add(tree, state, APEX_NODE_PARAGRAPH, doc, para_start);
+            if (!para) goto fail;
+            tree_set_literal(tree, para, para_start, pos);
         }
     }
 
-    return doc;
+    return tree;
+
+fail:
+    apex_tree_free(tree);
+    return NULL;
+}
+
+void apex_node_free(apex_node *node) {
+    apex_tree_free(node);
 }
 
-apex_node *apex_parse(void *parser, const char *markdown, size_t length) {
+apex_tree *apex_parse(void *parser, const char *markdown, size_t length) {
     if (!parser || !markdown) {
         return NULL;
     }
+    /* Spans and node ids are 32-bit */
+    if (length > UINT32_MAX) {
+        return NULL;
+    }
 
     parser_state *state = (parser_state *)parser;
     state->input = markdown;
@@ -224,4 +367,3 @@ apex_node *apex_parse(void *parser, const char *markdown, size_t length) {
 
     return parse_simple(state);
 }
-
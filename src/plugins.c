@@ -1,26 +1,24 @@
 #include "plugins.h"
+#include "metrics.h"
 #include "extensions/metadata.h"
+#include "extensions/ial.h"
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <regex.h>
-#include <sys/time.h>
 #include <stdio.h>
 
 #ifdef APEX_HAVE_LIBYAML
 #include <yaml.h>
 #endif
 
-/* External command runner for plugins (from plugins_env.c) */
-char *apex_run_external_plugin_command(const char *cmd,
-                                       const char *phase,
-                                       const char *plugin_id,
-                                       const char *text,
-                                       int timeout_ms);
-
 /* ------------------------------------------------------------------------- */
 /* Profiling helpers                                                         */
 /*                                                                           */
@@ -30,6 +28,8 @@ char *apex_run_external_plugin_command(const char *cmd,
 /*                                                                           */
 /* When enabled, we emit timing for each plugin invocation and for the       */
 /* overall phase run (pre_parse/post_render). Output goes to stderr.         */
+/* Independently, each invocation is reported as a "plugin:<id>" stage to    */
+/* options->metrics_callback when one is set.                                */
 /* ------------------------------------------------------------------------- */
 
 static int apex_plugins_profiling_enabled(void) {
@@ -43,12 +43,6 @@ static int apex_plugins_profiling_enabled(void) {
             strcmp(env, "true") == 0);
 }
 
-static double apex_plugins_time_ms(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
-}
-
 struct apex_plugin {
     char *id;
     char *title;
@@ -59,12 +53,18 @@ struct apex_plugin {
     apex_plugin_phase_mask phases;
     int priority;
     char *handler_command;
+    apex_plugin_protocol protocol;
     int timeout_ms;
     /* Declarative regex support */
     char *pattern;
     char *replacement;
     regex_t regex;
+    int regex_cflags;
     int has_regex;
+    /* Block/inline phases: cmark node types handled, and for code blocks
+     * the fence languages (both comma- or space-separated lists) */
+    char *node_types;
+    char *info;
     /* Owning directory for this plugin (used for APEX_PLUGIN_DIR) */
     char *dir_path;
     /* Per-plugin support directory (used for APEX_SUPPORT_DIR) */
@@ -75,6 +75,7 @@ struct apex_plugin {
 struct apex_plugin_manager {
     struct apex_plugin *pre_parse;
     struct apex_plugin *post_render;
+    struct apex_plugin *nodes;          /* Block and inline phases */
 };
 
 static void free_plugin(struct apex_plugin *p) {
@@ -89,6 +90,8 @@ static void free_plugin(struct apex_plugin *p) {
         free(p->handler_command);
         free(p->pattern);
         free(p->replacement);
+        free(p->node_types);
+        free(p->info);
         free(p->dir_path);
         free(p->support_dir);
         if (p->has_regex) {
@@ -103,9 +106,19 @@ void apex_plugins_free(apex_plugin_manager *manager) {
     if (!manager) return;
     free_plugin(manager->pre_parse);
     free_plugin(manager->post_render);
+    free_plugin(manager->nodes);
     free(manager);
 }
 
+/* "framed" (or "2") selects the framed request format; anything else,
+ * including no setting, keeps the JSON format existing plugins expect */
+static apex_plugin_protocol plugin_protocol_from_string(const char *protocol) {
+    if (protocol && (strcmp(protocol, "framed") == 0 || strcmp(protocol, "2") == 0)) {
+        return APEX_PLUGIN_PROTOCOL_FRAMED;
+    }
+    return APEX_PLUGIN_PROTOCOL_JSON;
+}
+
 static int plugin_phase_mask_from_string(const char *phase) {
     if (!phase) return 0;
     if (strcmp(phase, "pre_parse") == 0) return APEX_PLUGIN_PHASE_PRE_PARSE;
@@ -115,6 +128,15 @@ static int plugin_phase_mask_from_string(const char *phase) {
     return 0;
 }
 
+/* Block and inline plugins only run for the node types they list */
+static bool plugin_phase_usable(int phase_mask, const char *nodes) {
+    if (phase_mask & (APEX_PLUGIN_PHASE_PRE_PARSE | APEX_PLUGIN_PHASE_POST_RENDER)) return true;
+    if (phase_mask & (APEX_PLUGIN_PHASE_BLOCK | APEX_PLUGIN_PHASE_INLINE)) {
+        return nodes && nodes[strspn(nodes, ", \t")] != '\0';
+    }
+    return false;
+}
+
 static int read_file_into_buffer(const char *path, char **out) {
     *out = NULL;
     FILE *fp = fopen(path, "rb");
@@ -201,11 +223,100 @@ static char *apex_get_support_base_dir(void) {
     return path;
 }
 
-static void load_plugins_from_dir(apex_plugin_manager *manager,
-                                  const char *dirpath) {
-    if (!manager || !dirpath) return;
+/* ------------------------------------------------------------------------- */
+/* Plugin discovery index                                                    */
+/*                                                                           */
+/* Walking a plugin directory means a readdir, a stat per entry, probing     */
+/* for plugin.yml/plugin.yaml and parsing every manifest, on every           */
+/* conversion. The result of a walk is kept in a small binary file under     */
+/* $XDG_CACHE_HOME/apex/plugin-index (or ~/.cache/apex/plugin-index) along   */
+/* with the stat() of every file and directory it was built from. Loading    */
+/* then costs one mmap and one stat per plugin, and any change to a          */
+/* manifest or to the directory layout makes the index stale, so the next    */
+/* load walks the directory again and rewrites it.                           */
+/* ------------------------------------------------------------------------- */
+
+#define PLUGIN_INDEX_MAGIC "APEXPIDX"
+#define PLUGIN_INDEX_VERSION 2
+#define PLUGIN_INDEX_NONE UINT32_MAX   /* A NULL string */
+
+typedef struct {
+    char *path;
+    bool exists;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+} plugin_index_dep;
+
+/* The plugins found in one directory, in discovery order, and what they
+ * were read from */
+typedef struct {
+    struct apex_plugin *head;
+    struct apex_plugin **tail;
+    size_t count;
+    plugin_index_dep *deps;
+    size_t dep_count;
+    size_t dep_capacity;
+    bool deps_incomplete;   /* A dependency could not be recorded; never index this scan */
+} plugin_scan;
+
+static void plugin_scan_init(plugin_scan *scan) {
+    memset(scan, 0, sizeof(*scan));
+    scan->tail = &scan->head;
+}
+
+static void plugin_scan_add(plugin_scan *scan, struct apex_plugin *p) {
+    p->next = NULL;
+    *scan->tail = p;
+    scan->tail = &p->next;
+    scan->count++;
+}
+
+static void plugin_scan_depend_stat(plugin_scan *scan, const char *path, const struct stat *st) {
+    if (scan->dep_count == scan->dep_capacity) {
+        size_t capacity = scan->dep_capacity ? scan->dep_capacity * 2 : 16;
+        plugin_index_dep *grown = realloc(scan->deps, capacity * sizeof(plugin_index_dep));
+        if (!grown) {
+            scan->deps_incomplete = true;
+            return;
+        }
+        scan->deps = grown;
+        scan->dep_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        scan->deps_incomplete = true;
+        return;
+    }
+    plugin_index_dep *dep = &scan->deps[scan->dep_count++];
+    dep->path = copy;
+    dep->exists = st != NULL;
+    dep->ino = st ? st->st_ino : 0;
+    dep->mtime = st ? st->st_mtime : 0;
+    dep->size = st ? st->st_size : 0;
+}
+
+static void plugin_scan_depend(plugin_scan *scan, const char *path) {
+    struct stat st;
+    plugin_scan_depend_stat(scan, path, stat(path, &st) == 0 ? &st : NULL);
+}
+
+/* Free the dependency list; plugins still in the scan are freed too */
+static void plugin_scan_free(plugin_scan *scan) {
+    free_plugin(scan->head);
+    for (size_t i = 0; i < scan->dep_count; i++) {
+        free(scan->deps[i].path);
+    }
+    free(scan->deps);
+    plugin_scan_init(scan);
+}
+
+/* Parse every manifest under dirpath into scan, noting each file and
+ * directory the result depends on */
+static void scan_plugin_dir(plugin_scan *scan, const char *dirpath) {
     DIR *dir = opendir(dirpath);
     if (!dir) return;
+    plugin_scan_depend(scan, dirpath);
 
     char *support_base = apex_get_support_base_dir();
 
@@ -223,13 +334,21 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
 
         char manifest_path[1024];
         if (S_ISDIR(st.st_mode)) {
-            /* New style: each subdirectory is a plugin, with plugin.yml/yaml */
-            snprintf(manifest_path, sizeof(manifest_path), "%s/plugin.yml", plugin_dir);
-            if (!file_has_yaml_front_matter(manifest_path)) {
-                snprintf(manifest_path, sizeof(manifest_path), "%s/plugin.yaml", plugin_dir);
-                if (!file_has_yaml_front_matter(manifest_path)) {
-                    continue;
-                }
+            /* New style: each subdirectory is a plugin, with plugin.yml/yaml.
+             * The directory's mtime changes when a manifest appears in it.
+             * Both candidates are recorded, present or not, before either is
+             * read: an edit that adds or drops front matter in plugin.yml
+             * switches which one is used. */
+            char yml_path[1024];
+            plugin_scan_depend(scan, plugin_dir);
+            snprintf(yml_path, sizeof(yml_path), "%s/plugin.yml", plugin_dir);
+            snprintf(manifest_path, sizeof(manifest_path), "%s/plugin.yaml", plugin_dir);
+            plugin_scan_depend(scan, yml_path);
+            plugin_scan_depend(scan, manifest_path);
+            if (file_has_yaml_front_matter(yml_path)) {
+                snprintf(manifest_path, sizeof(manifest_path), "%s", yml_path);
+            } else if (!file_has_yaml_front_matter(manifest_path)) {
+                continue;
             }
         } else {
             /* Backwards compatibility: flat *.yml / *.yaml manifests */
@@ -238,6 +357,7 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                    (len > 5 && strcmp(ent->d_name + len - 5, ".yaml") == 0))) {
                 continue;
             }
+            plugin_scan_depend(scan, plugin_dir);
             if (!file_has_yaml_front_matter(plugin_dir)) {
                 continue;
             }
@@ -268,11 +388,14 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                 const char *description = NULL;
                 const char *phase = NULL;
                 const char *handler_command = NULL;
+                const char *protocol_str = NULL;
                 const char *priority_str = NULL;
                 const char *timeout_str = NULL;
                 const char *pattern_str = NULL;
                 const char *replacement_str = NULL;
                 const char *flags_str = NULL;
+                const char *nodes_str = NULL;
+                const char *info_str = NULL;
                 const char *homepage = NULL;
                 const char *repo = NULL;
 
@@ -294,11 +417,15 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                     else if (strcmp(m->key, "phase") == 0) phase = m->value;
                     else if (strcmp(m->key, "handler.command") == 0) handler_command = m->value;
                     else if (strcmp(m->key, "handler_command") == 0) handler_command = m->value;
+                    else if (strcmp(m->key, "handler.protocol") == 0) protocol_str = m->value;
+                    else if (strcmp(m->key, "handler_protocol") == 0) protocol_str = m->value;
                     else if (strcmp(m->key, "priority") == 0) priority_str = m->value;
                     else if (strcmp(m->key, "timeout_ms") == 0) timeout_str = m->value;
                     else if (strcmp(m->key, "pattern") == 0) pattern_str = m->value;
                     else if (strcmp(m->key, "replacement") == 0) replacement_str = m->value;
                     else if (strcmp(m->key, "flags") == 0) flags_str = m->value;
+                    else if (strcmp(m->key, "nodes") == 0) nodes_str = m->value;
+                    else if (strcmp(m->key, "info") == 0) info_str = m->value;
                 }
 
                 if (!id || !phase) {
@@ -307,7 +434,7 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                 }
 
                 int phase_mask = plugin_phase_mask_from_string(phase);
-                if (!(phase_mask & (APEX_PLUGIN_PHASE_PRE_PARSE | APEX_PLUGIN_PHASE_POST_RENDER))) {
+                if (!plugin_phase_usable(phase_mask, nodes_str)) {
                     apex_free_metadata(merged);
                     continue;
                 }
@@ -325,8 +452,11 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                 p->repo = repo ? strdup(repo) : NULL;
                 p->phases = phase_mask;
                 p->handler_command = handler_command ? strdup(handler_command) : NULL;
+                p->protocol = plugin_protocol_from_string(protocol_str);
                 p->priority = priority_str ? atoi(priority_str) : 100;
                 p->timeout_ms = timeout_str ? atoi(timeout_str) : 0;
+                p->node_types = nodes_str ? strdup(nodes_str) : NULL;
+                p->info = info_str ? strdup(info_str) : NULL;
                 p->has_regex = 0;
                 p->dir_path = strdup(plugin_dir);
 
@@ -353,26 +483,19 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                         free(p->description);
                         free(p->homepage);
                         free(p->repo);
+                        free(p->node_types);
+                        free(p->info);
                         free(p);
                         apex_free_metadata(merged);
                         continue;
                     }
                     p->pattern = strdup(pattern_str);
                     p->replacement = strdup(replacement_str);
+                    p->regex_cflags = cflags;
                     p->has_regex = 1;
                 }
 
-                /* Attach to appropriate phase lists */
-                if (phase_mask & APEX_PLUGIN_PHASE_PRE_PARSE) {
-                    if (!plugin_id_exists(manager->pre_parse, id)) {
-                        append_plugin_sorted(&manager->pre_parse, p);
-                    }
-                }
-                if (phase_mask & APEX_PLUGIN_PHASE_POST_RENDER) {
-                    if (!plugin_id_exists(manager->post_render, id)) {
-                        append_plugin_sorted(&manager->post_render, p);
-                    }
-                }
+                plugin_scan_add(scan, p);
 
                 apex_free_metadata(merged);
             }
@@ -398,11 +521,14 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
         const char *description = NULL;
         const char *phase = NULL;
         const char *handler_command = NULL;
+        const char *protocol_str = NULL;
         const char *priority_str = NULL;
         const char *timeout_str = NULL;
         const char *pattern_str = NULL;
         const char *replacement_str = NULL;
         const char *flags_str = NULL;
+        const char *nodes_str = NULL;
+        const char *info_str = NULL;
         const char *homepage = NULL;
         const char *repo = NULL;
 
@@ -416,11 +542,15 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
             else if (strcmp(m->key, "phase") == 0) phase = m->value;
             else if (strcmp(m->key, "handler.command") == 0) handler_command = m->value;
             else if (strcmp(m->key, "handler_command") == 0) handler_command = m->value;
+            else if (strcmp(m->key, "handler.protocol") == 0) protocol_str = m->value;
+            else if (strcmp(m->key, "handler_protocol") == 0) protocol_str = m->value;
             else if (strcmp(m->key, "priority") == 0) priority_str = m->value;
             else if (strcmp(m->key, "timeout_ms") == 0) timeout_str = m->value;
             else if (strcmp(m->key, "pattern") == 0) pattern_str = m->value;
             else if (strcmp(m->key, "replacement") == 0) replacement_str = m->value;
             else if (strcmp(m->key, "flags") == 0) flags_str = m->value;
+            else if (strcmp(m->key, "nodes") == 0) nodes_str = m->value;
+            else if (strcmp(m->key, "info") == 0) info_str = m->value;
         }
 
         if (!phase) {
@@ -429,7 +559,7 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
         }
 
         int phase_mask = plugin_phase_mask_from_string(phase);
-        if (!(phase_mask & (APEX_PLUGIN_PHASE_PRE_PARSE | APEX_PLUGIN_PHASE_POST_RENDER))) {
+        if (!plugin_phase_usable(phase_mask, nodes_str)) {
             apex_free_metadata(meta);
             continue;
         }
@@ -448,8 +578,11 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
         p->repo = repo ? strdup(repo) : NULL;
         p->phases = phase_mask;
         p->handler_command = handler_command ? strdup(handler_command) : NULL;
+        p->protocol = plugin_protocol_from_string(protocol_str);
         p->priority = priority_str ? atoi(priority_str) : 100;
         p->timeout_ms = timeout_str ? atoi(timeout_str) : 0;
+        p->node_types = nodes_str ? strdup(nodes_str) : NULL;
+        p->info = info_str ? strdup(info_str) : NULL;
         p->has_regex = 0;
         p->dir_path = strdup(S_ISDIR(st.st_mode) ? plugin_dir : dirpath);
 
@@ -475,26 +608,19 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
                 free(p->description);
                 free(p->homepage);
                 free(p->repo);
+                free(p->node_types);
+                free(p->info);
                 free(p);
                 apex_free_metadata(meta);
                 continue;
             }
             p->pattern = strdup(pattern_str);
             p->replacement = strdup(replacement_str);
+            p->regex_cflags = cflags;
             p->has_regex = 1;
         }
 
-        /* Attach to appropriate phase lists, enforcing per-list id uniqueness */
-        if (phase_mask & APEX_PLUGIN_PHASE_PRE_PARSE) {
-            if (!plugin_id_exists(manager->pre_parse, final_id)) {
-                append_plugin_sorted(&manager->pre_parse, p);
-            }
-        }
-        if (phase_mask & APEX_PLUGIN_PHASE_POST_RENDER) {
-            if (!plugin_id_exists(manager->post_render, final_id)) {
-                append_plugin_sorted(&manager->post_render, p);
-            }
-        }
+        plugin_scan_add(scan, p);
 
         apex_free_metadata(meta);
     }
@@ -503,6 +629,378 @@ static void load_plugins_from_dir(apex_plugin_manager *manager,
     closedir(dir);
 }
 
+/* Index file for dirpath: a hash of its absolute path under the cache dir */
+static char *plugin_index_path(const char *dirpath, bool create_dir) {
+    char base[1024];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        snprintf(base, sizeof(base), "%s/apex/plugin-index", xdg);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !*home) return NULL;
+        snprintf(base, sizeof(base), "%s/.cache/apex/plugin-index", home);
+    }
+
+    if (create_dir) {
+        /* mkdir -p */
+        for (char *slash = strchr(base + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            mkdir(base, 0700);
+            *slash = '/';
+        }
+        mkdir(base, 0700);
+    }
+
+    char cwd[1024] = "";
+    if (dirpath[0] != '/' && !getcwd(cwd, sizeof(cwd))) return NULL;
+
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *parts[] = { cwd, "/", dirpath }, **part = parts; part < parts + 3; part++) {
+        for (const unsigned char *c = (const unsigned char *)*part; *c; c++) {
+            hash = (hash ^ *c) * 1099511628211ULL;
+        }
+    }
+
+    size_t len = strlen(base) + 18;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/%016llx", base, (unsigned long long)hash);
+    return path;
+}
+
+static void index_put_u32(FILE *fp, uint32_t value) {
+    fwrite(&value, sizeof(value), 1, fp);
+}
+
+static void index_put_i64(FILE *fp, int64_t value) {
+    fwrite(&value, sizeof(value), 1, fp);
+}
+
+static void index_put_str(FILE *fp, const char *s) {
+    if (!s) {
+        index_put_u32(fp, PLUGIN_INDEX_NONE);
+        return;
+    }
+    uint32_t len = (uint32_t)strlen(s);
+    index_put_u32(fp, len);
+    fwrite(s, 1, len, fp);
+}
+
+/* Build flags that change how manifests parse */
+static uint32_t plugin_index_flags(void) {
+#ifdef APEX_HAVE_LIBYAML
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Write scan to path through a temporary file, so readers never see a
+ * partial index */
+static bool plugin_index_write(const char *path, const char *dirpath, const plugin_scan *scan) {
+    /* An index missing a dependency would never notice that file change;
+     * drop any older one too so the next load scans in full */
+    if (scan->deps_incomplete) {
+        unlink(path);
+        return false;
+    }
+    if (scan->dep_count == 0) return false;
+
+    size_t tmp_len = strlen(path) + 8;
+    char *tmp = malloc(tmp_len);
+    if (!tmp) return false;
+    snprintf(tmp, tmp_len, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!fp) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return false;
+    }
+
+    fwrite(PLUGIN_INDEX_MAGIC, 1, 8, fp);
+    index_put_u32(fp, PLUGIN_INDEX_VERSION);
+    index_put_u32(fp, plugin_index_flags());
+    index_put_str(fp, dirpath);
+
+    index_put_u32(fp, (uint32_t)scan->dep_count);
+    for (size_t i = 0; i < scan->dep_count; i++) {
+        const plugin_index_dep *dep = &scan->deps[i];
+        index_put_str(fp, dep->path);
+        index_put_u32(fp, dep->exists ? 1 : 0);
+        index_put_i64(fp, (int64_t)dep->ino);
+        index_put_i64(fp, (int64_t)dep->mtime);
+        index_put_i64(fp, (int64_t)dep->size);
+    }
+
+    index_put_u32(fp, (uint32_t)scan->count);
+    for (struct apex_plugin *p = scan->head; p; p = p->next) {
+        index_put_str(fp, p->id);
+        index_put_str(fp, p->title);
+        index_put_str(fp, p->author);
+        index_put_str(fp, p->description);
+        index_put_str(fp, p->homepage);
+        index_put_str(fp, p->repo);
+        index_put_str(fp, p->handler_command);
+        index_put_str(fp, p->pattern);
+        index_put_str(fp, p->replacement);
+        index_put_str(fp, p->node_types);
+        index_put_str(fp, p->info);
+        index_put_str(fp, p->dir_path);
+        index_put_u32(fp, (uint32_t)p->phases);
+        index_put_u32(fp, (uint32_t)p->priority);
+        index_put_u32(fp, (uint32_t)p->timeout_ms);
+        index_put_u32(fp, (uint32_t)p->protocol);
+        index_put_u32(fp, (uint32_t)p->regex_cflags);
+        index_put_u32(fp, (uint32_t)p->has_regex);
+    }
+
+    bool ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok;
+}
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool ok;
+} plugin_index_reader;
+
+static uint32_t index_get_u32(plugin_index_reader *r) {
+    uint32_t value = 0;
+    if (r->end - r->p < (ptrdiff_t)sizeof(value)) {
+        r->ok = false;
+        return 0;
+    }
+    memcpy(&value, r->p, sizeof(value));
+    r->p += sizeof(value);
+    return value;
+}
+
+static int64_t index_get_i64(plugin_index_reader *r) {
+    int64_t value = 0;
+    if (r->end - r->p < (ptrdiff_t)sizeof(value)) {
+        r->ok = false;
+        return 0;
+    }
+    memcpy(&value, r->p, sizeof(value));
+    r->p += sizeof(value);
+    return value;
+}
+
+/* Borrow a string from the mapping; NULL for a NULL string */
+static const char *index_get_bytes(plugin_index_reader *r, uint32_t *len) {
+    *len = index_get_u32(r);
+    if (!r->ok || *len == PLUGIN_INDEX_NONE) return NULL;
+    if ((size_t)(r->end - r->p) < *len) {
+        r->ok = false;
+        return NULL;
+    }
+    const char *s = (const char *)r->p;
+    r->p += *len;
+    return s;
+}
+
+static char *index_get_str(plugin_index_reader *r) {
+    uint32_t len;
+    const char *s = index_get_bytes(r, &len);
+    if (!s) return NULL;
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        r->ok = false;
+        return NULL;
+    }
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static bool index_str_equals(plugin_index_reader *r, const char *expected) {
+    uint32_t len;
+    const char *s = index_get_bytes(r, &len);
+    return s && len == strlen(expected) && memcmp(s, expected, len) == 0;
+}
+
+/* Check every recorded file and directory against the disk. The first
+ * is dirpath itself, already stat()ed by the caller as dir_st. */
+static bool plugin_index_deps_current(plugin_index_reader *r, const char *dirpath,
+                                      const struct stat *dir_st) {
+    uint32_t count = index_get_u32(r);
+    for (uint32_t i = 0; r->ok && i < count; i++) {
+        uint32_t len;
+        const char *path = index_get_bytes(r, &len);
+        bool exists = index_get_u32(r) != 0;
+        int64_t ino = index_get_i64(r);
+        int64_t mtime = index_get_i64(r);
+        int64_t size = index_get_i64(r);
+        if (!r->ok || !path) return false;
+
+        struct stat st;
+        const struct stat *current = NULL;
+        if (i == 0) {
+            if (len != strlen(dirpath) || memcmp(path, dirpath, len) != 0) return false;
+            current = dir_st;
+        } else {
+            char buf[1024];
+            if (len >= sizeof(buf)) return false;
+            memcpy(buf, path, len);
+            buf[len] = '\0';
+            if (stat(buf, &st) == 0) current = &st;
+        }
+
+        if (exists != (current != NULL)) return false;
+        if (current && ((int64_t)current->st_ino != ino ||
+                        (int64_t)current->st_mtime != mtime ||
+                        (int64_t)current->st_size != size)) {
+            return false;
+        }
+    }
+    return r->ok && count > 0;
+}
+
+/* Load the plugins recorded for dirpath into scan; false if there is no
+ * index or it is stale */
+static bool plugin_index_read(const char *path, const char *dirpath,
+                              const struct stat *dir_st, plugin_scan *scan) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 16) {
+        close(fd);
+        return false;
+    }
+    size_t map_len = (size_t)st.st_size;
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    plugin_index_reader r = { map, (const unsigned char *)map + map_len, true };
+    bool current = memcmp(map, PLUGIN_INDEX_MAGIC, 8) == 0;
+    r.p += 8;
+    current = current && index_get_u32(&r) == PLUGIN_INDEX_VERSION;
+    current = current && index_get_u32(&r) == plugin_index_flags();
+    current = current && index_str_equals(&r, dirpath);
+    current = current && plugin_index_deps_current(&r, dirpath, dir_st);
+
+    char *support_base = current ? apex_get_support_base_dir() : NULL;
+    uint32_t count = current ? index_get_u32(&r) : 0;
+    for (uint32_t i = 0; current && r.ok && i < count; i++) {
+        struct apex_plugin *p = calloc(1, sizeof(struct apex_plugin));
+        if (!p) {
+            r.ok = false;
+            break;
+        }
+        p->id = index_get_str(&r);
+        p->title = index_get_str(&r);
+        p->author = index_get_str(&r);
+        p->description = index_get_str(&r);
+        p->homepage = index_get_str(&r);
+        p->repo = index_get_str(&r);
+        p->handler_command = index_get_str(&r);
+        p->pattern = index_get_str(&r);
+        p->replacement = index_get_str(&r);
+        p->node_types = index_get_str(&r);
+        p->info = index_get_str(&r);
+        p->dir_path = index_get_str(&r);
+        p->phases = (apex_plugin_phase_mask)index_get_u32(&r);
+        p->priority = (int)index_get_u32(&r);
+        p->timeout_ms = (int)index_get_u32(&r);
+        p->protocol = (apex_plugin_protocol)index_get_u32(&r);
+        p->regex_cflags = (int)index_get_u32(&r);
+        bool has_regex = index_get_u32(&r) != 0;
+
+        /* The pattern compiled when the index was written */
+        if (r.ok && has_regex && p->pattern) {
+            if (regcomp(&p->regex, p->pattern, p->regex_cflags) != 0) r.ok = false;
+            else p->has_regex = 1;
+        }
+
+        if (support_base && p->id) {
+            char supp[1024];
+            snprintf(supp, sizeof(supp), "%s/%s", support_base, p->id);
+            mkdir(supp, 0700);
+            p->support_dir = strdup(supp);
+        }
+        plugin_scan_add(scan, p);
+    }
+    free(support_base);
+    munmap(map, map_len);
+
+    if (!current || !r.ok) {
+        plugin_scan_free(scan);
+        return false;
+    }
+    return true;
+}
+
+/* A file changed within the last moments could change again within the
+ * same mtime second without the index noticing */
+static bool plugin_scan_racy(const plugin_scan *scan) {
+    time_t now = time(NULL);
+    for (size_t i = 0; i < scan->dep_count; i++) {
+        if (scan->deps[i].mtime + 2 > now) return true;
+    }
+    return false;
+}
+
+static void attach_plugin(apex_plugin_manager *manager, struct apex_plugin *p) {
+    bool attached = false;
+    p->next = NULL;
+    /* Enforce per-list id uniqueness; the project directory is loaded first */
+    if (p->phases & APEX_PLUGIN_PHASE_PRE_PARSE) {
+        if (!plugin_id_exists(manager->pre_parse, p->id)) {
+            append_plugin_sorted(&manager->pre_parse, p);
+            attached = true;
+        }
+    }
+    if (p->phases & APEX_PLUGIN_PHASE_POST_RENDER) {
+        if (!plugin_id_exists(manager->post_render, p->id)) {
+            append_plugin_sorted(&manager->post_render, p);
+            attached = true;
+        }
+    }
+    if (p->phases & (APEX_PLUGIN_PHASE_BLOCK | APEX_PLUGIN_PHASE_INLINE)) {
+        if (!plugin_id_exists(manager->nodes, p->id)) {
+            append_plugin_sorted(&manager->nodes, p);
+            attached = true;
+        }
+    }
+    if (!attached) free_plugin(p);
+}
+
+static void load_plugins_from_dir(apex_plugin_manager *manager,
+                                  const char *dirpath) {
+    if (!manager || !dirpath) return;
+    struct stat st;
+    if (stat(dirpath, &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+    plugin_scan scan;
+    plugin_scan_init(&scan);
+    char *index_path = plugin_index_path(dirpath, false);
+    if (!index_path || !plugin_index_read(index_path, dirpath, &st, &scan)) {
+        scan_plugin_dir(&scan, dirpath);
+        if (index_path && !plugin_scan_racy(&scan)) {
+            free(index_path);
+            index_path = plugin_index_path(dirpath, true);
+            if (index_path) plugin_index_write(index_path, dirpath, &scan);
+        }
+    }
+    free(index_path);
+
+    for (struct apex_plugin *p = scan.head, *next; p; p = next) {
+        next = p->next;
+        attach_plugin(manager, p);
+    }
+    scan.head = NULL;
+    plugin_scan_free(&scan);
+}
+
 static char *dup_join(const char *a, const char *b) {
     size_t la = a ? strlen(a) : 0;
     size_t lb = b ? strlen(b) : 0;
@@ -519,19 +1017,15 @@ static char *dup_join(const char *a, const char *b) {
     return res;
 }
 
-apex_plugin_manager *apex_plugins_load(const apex_options *options) {
-    if (!options || !options->enable_plugins) return NULL;
-
-    apex_plugin_manager *manager = calloc(1, sizeof(apex_plugin_manager));
-    if (!manager) return NULL;
+/* Plugin directories in load order: the project's base_directory/.apex/plugins,
+ * then $XDG_CONFIG_HOME/apex/plugins or $HOME/.config/apex/plugins */
+static size_t plugin_search_dirs(const apex_options *options, char *dirs[2]) {
+    size_t count = 0;
 
     /* Project-scoped: base_directory/.apex/plugins */
     if (options->base_directory && options->base_directory[0] != '\0') {
         char *proj_dir = dup_join(options->base_directory, ".apex/plugins");
-        if (proj_dir) {
-            load_plugins_from_dir(manager, proj_dir);
-            free(proj_dir);
-        }
+        if (proj_dir) dirs[count++] = proj_dir;
     }
 
     /* User-global: $XDG_CONFIG_HOME/apex/plugins or $HOME/.config/apex/plugins */
@@ -549,18 +1043,63 @@ apex_plugin_manager *apex_plugins_load(const apex_options *options) {
             global_dir = strdup(buf);
         }
     }
-    if (global_dir) {
-        load_plugins_from_dir(manager, global_dir);
-        free(global_dir);
+    if (global_dir) dirs[count++] = global_dir;
+
+    return count;
+}
+
+apex_plugin_manager *apex_plugins_load(const apex_options *options) {
+    if (!options || !options->enable_plugins) return NULL;
+
+    apex_plugin_manager *manager = calloc(1, sizeof(apex_plugin_manager));
+    if (!manager) return NULL;
+
+    char *dirs[2];
+    size_t dir_count = plugin_search_dirs(options, dirs);
+    for (size_t i = 0; i < dir_count; i++) {
+        load_plugins_from_dir(manager, dirs[i]);
+        free(dirs[i]);
     }
 
-    if (!manager->pre_parse && !manager->post_render) {
+    if (!manager->pre_parse && !manager->post_render && !manager->nodes) {
         apex_plugins_free(manager);
         return NULL;
     }
     return manager;
 }
 
+int apex_plugins_rebuild_index(const apex_options *options) {
+    if (!options) return -1;
+
+    int total = 0;
+    bool failed = false;
+    char *dirs[2];
+    size_t dir_count = plugin_search_dirs(options, dirs);
+    for (size_t i = 0; i < dir_count; i++) {
+        char *index_path = plugin_index_path(dirs[i], true);
+        struct stat st;
+        if (!index_path) {
+            failed = true;
+        } else if (stat(dirs[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            /* Nothing to index; drop any index left from before */
+            unlink(index_path);
+        } else {
+            plugin_scan scan;
+            plugin_scan_init(&scan);
+            scan_plugin_dir(&scan, dirs[i]);
+            if (plugin_index_write(index_path, dirs[i], &scan)) {
+                total += (int)scan.count;
+            } else {
+                failed = true;
+            }
+            plugin_scan_free(&scan);
+        }
+        free(index_path);
+        free(dirs[i]);
+    }
+    return failed ? -1 : total;
+}
+
 /* Apply declarative regex replacement: pattern compiled in p->regex,
  * replacement template may reference $0..$9 for capture groups.
  */
@@ -678,6 +1217,97 @@ static char *apply_regex_replacement(struct apex_plugin *p, const char *input) {
     return out;
 }
 
+/**
+ * Format a "NAME=value" environment entry for a plugin child process
+ */
+static char *apex_plugin_env_var(const char *name, const char *value) {
+    size_t len = strlen(name) + 1 + strlen(value) + 1;
+    char *var = malloc(len);
+    if (var) {
+        snprintf(var, len, "%s=%s", name, value);
+    }
+    return var;
+}
+
+/* APEX_PLUGIN_DIR, APEX_SUPPORT_DIR and APEX_FILE_PATH are passed in the
+ * child's environment only; the host environment is shared by every
+ * thread and must not be modified during conversion. */
+typedef struct {
+    char *vars[3];
+    const char *overrides[4];   /* NULL-terminated */
+} plugin_child_env;
+
+static void plugin_child_env_init(plugin_child_env *env, const struct apex_plugin *p,
+                                  const apex_options *options) {
+    size_t count = 0;
+    memset(env, 0, sizeof(*env));
+
+    if (p->dir_path) {
+        env->vars[0] = apex_plugin_env_var("APEX_PLUGIN_DIR", p->dir_path);
+        if (env->vars[0]) env->overrides[count++] = env->vars[0];
+    }
+    if (p->support_dir) {
+        env->vars[1] = apex_plugin_env_var("APEX_SUPPORT_DIR", p->support_dir);
+        if (env->vars[1]) env->overrides[count++] = env->vars[1];
+    }
+
+    /* APEX_FILE_PATH: full path to input file, or base dir / empty for stdin */
+    const char *file_path = (options && options->input_file_path)
+                              ? options->input_file_path
+                              : "";
+    env->vars[2] = apex_plugin_env_var("APEX_FILE_PATH", file_path);
+    if (env->vars[2]) env->overrides[count++] = env->vars[2];
+    env->overrides[count] = NULL;
+}
+
+static void plugin_child_env_free(plugin_child_env *env) {
+    for (size_t i = 0; i < 3; i++) free(env->vars[i]);
+}
+
+/* Print the profile line for one plugin run and/or report its metrics */
+static void plugin_report_run(const struct apex_plugin *p, const char *phase_name,
+                              double elapsed, const apex_subprocess_result *run_result,
+                              size_t bytes_in, size_t bytes_out,
+                              int do_profile, const apex_options *options) {
+    const char *plugin_id = p->id ? p->id : "plugin";
+    if (do_profile) {
+        if (run_result->timed_out) {
+            fprintf(stderr,
+                    "[PROFILE] plugin %-24s (%s): %8.2f ms (timed out at %d ms, text kept)\n",
+                    plugin_id,
+                    phase_name,
+                    elapsed,
+                    p->timeout_ms);
+        } else if (run_result->exit_status > 0) {
+            fprintf(stderr,
+                    "[PROFILE] plugin %-24s (%s): %8.2f ms (exit %d)\n",
+                    plugin_id,
+                    phase_name,
+                    elapsed,
+                    run_result->exit_status);
+        } else {
+            fprintf(stderr,
+                    "[PROFILE] plugin %-24s (%s): %8.2f ms\n",
+                    plugin_id,
+                    phase_name,
+                    elapsed);
+        }
+    }
+    if (options->metrics_callback) {
+        char stage[256];
+        snprintf(stage, sizeof(stage), "plugin:%s", plugin_id);
+        apex_stage_metrics metrics;
+        metrics.stage = stage;
+        metrics.duration_ms = elapsed;
+        metrics.bytes_in = bytes_in;
+        metrics.bytes_out = bytes_out;
+        metrics.allocations = 0;
+        metrics.skipped = false;
+        metrics.timed_out = run_result->timed_out;
+        options->metrics_callback(&metrics, options->metrics_user_data);
+    }
+}
+
 char *apex_plugins_run_text_phase(apex_plugin_manager *manager,
                                   apex_plugin_phase_mask phase,
                                   const char *text,
@@ -685,9 +1315,10 @@ char *apex_plugins_run_text_phase(apex_plugin_manager *manager,
     if (!manager || !text || !options) return NULL;
 
     int do_profile = apex_plugins_profiling_enabled();
+    int do_metrics = options->metrics_callback != NULL;
     double phase_start = 0.0;
     if (do_profile) {
-        phase_start = apex_plugins_time_ms();
+        phase_start = apex_metrics_now_ms();
     }
 
     const char *phase_name = "unknown";
@@ -708,92 +1339,33 @@ char *apex_plugins_run_text_phase(apex_plugin_manager *manager,
 
         char *next = NULL;
         const char *plugin_id = p->id ? p->id : "plugin";
+        apex_subprocess_result run_result = { 0, false, 0.0 };
 
         double plugin_start = 0.0;
-        if (do_profile) {
-            plugin_start = apex_plugins_time_ms();
+        if (do_profile || do_metrics) {
+            plugin_start = apex_metrics_now_ms();
         }
 
         if (p->handler_command) {
-            /* Temporarily set APEX_PLUGIN_DIR, APEX_SUPPORT_DIR, and APEX_FILE_PATH for this plugin */
-            char *old_dir = NULL;
-            char *old_support = NULL;
-            char *old_file_path = NULL;
-
-            const char *prev_dir = getenv("APEX_PLUGIN_DIR");
-            if (prev_dir) {
-                old_dir = strdup(prev_dir);
-            }
-            if (p->dir_path) {
-                setenv("APEX_PLUGIN_DIR", p->dir_path, 1);
-            }
-
-            const char *prev_support = getenv("APEX_SUPPORT_DIR");
-            if (prev_support) {
-                old_support = strdup(prev_support);
-            }
-            if (p->support_dir) {
-                setenv("APEX_SUPPORT_DIR", p->support_dir, 1);
-            }
-
-            /* APEX_FILE_PATH: full path to input file, or base dir / empty for stdin */
-            const char *prev_file = getenv("APEX_FILE_PATH");
-            if (prev_file) {
-                old_file_path = strdup(prev_file);
-            }
-            const char *file_path = (options && options->input_file_path)
-                                      ? options->input_file_path
-                                      : "";
-            setenv("APEX_FILE_PATH", file_path, 1);
-
+            plugin_child_env env;
+            plugin_child_env_init(&env, p, options);
             next = apex_run_external_plugin_command(p->handler_command,
                                                     phase_name,
                                                     plugin_id,
                                                     current,
-                                                    p->timeout_ms);
-
-            /* Restore previous APEX_PLUGIN_DIR */
-            if (p->dir_path) {
-                if (old_dir) {
-                    setenv("APEX_PLUGIN_DIR", old_dir, 1);
-                    free(old_dir);
-                } else {
-                    unsetenv("APEX_PLUGIN_DIR");
-                }
-            } else if (old_dir) {
-                free(old_dir);
-            }
-
-            /* Restore previous APEX_SUPPORT_DIR */
-            if (p->support_dir) {
-                if (old_support) {
-                    setenv("APEX_SUPPORT_DIR", old_support, 1);
-                    free(old_support);
-                } else {
-                    unsetenv("APEX_SUPPORT_DIR");
-                }
-            } else if (old_support) {
-                free(old_support);
-            }
-
-            /* Restore previous APEX_FILE_PATH */
-            if (old_file_path) {
-                setenv("APEX_FILE_PATH", old_file_path, 1);
-                free(old_file_path);
-            } else {
-                unsetenv("APEX_FILE_PATH");
-            }
+                                                    p->protocol,
+                                                    p->timeout_ms,
+                                                    env.overrides,
+                                                    &run_result);
+            plugin_child_env_free(&env);
         } else if (p->has_regex) {
             next = apply_regex_replacement(p, current);
         }
 
-        if (do_profile) {
-            double plugin_elapsed = apex_plugins_time_ms() - plugin_start;
-            fprintf(stderr,
-                    "[PROFILE] plugin %-24s (%s): %8.2f ms\n",
-                    plugin_id,
-                    phase_name,
-                    plugin_elapsed);
+        if (do_profile || do_metrics) {
+            size_t bytes_in = strlen(current);
+            plugin_report_run(p, phase_name, apex_metrics_now_ms() - plugin_start, &run_result,
+                              bytes_in, next ? strlen(next) : bytes_in, do_profile, options);
         }
 
         if (next) {
@@ -803,7 +1375,7 @@ char *apex_plugins_run_text_phase(apex_plugin_manager *manager,
     }
 
     if (do_profile) {
-        double phase_elapsed = apex_plugins_time_ms() - phase_start;
+        double phase_elapsed = apex_metrics_now_ms() - phase_start;
         fprintf(stderr,
                 "[PROFILE] plugins_phase (%s):       %8.2f ms\n",
                 phase_name,
@@ -817,3 +1389,336 @@ char *apex_plugins_run_text_phase(apex_plugin_manager *manager,
     return current;
 }
 
+
+bool apex_plugins_have_phase(const apex_plugin_manager *manager,
+                             apex_plugin_phase_mask phases) {
+    if (!manager) return false;
+    const struct apex_plugin *lists[] = { manager->pre_parse, manager->post_render, manager->nodes };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        for (const struct apex_plugin *p = lists[i]; p; p = p->next) {
+            if (p->phases & phases) return true;
+        }
+    }
+    return false;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Node phases                                                               */
+/*                                                                           */
+/* Block and inline plugins list the cmark node types they handle (`nodes`) */
+/* and, for code blocks, may narrow that to fence languages (`info`). After  */
+/* parsing, each plugin is sent all of its nodes in one framed request:      */
+/*                                                                           */
+/*   APEX-PLUGIN 2 / plugin_id / phase / "nodes: N", a blank line, then per  */
+/*   node "type:", optional "info:" and "level:", "length: L", a blank line  */
+/*   and L bytes of content                                                  */
+/*                                                                           */
+/* and answers with one "length: L", blank line, L bytes of HTML per node,   */
+/* in order. The HTML replaces the node; an empty or missing answer keeps    */
+/* it. A matched container is sent whole, so its descendants are never sent  */
+/* on their own.                                                             */
+/* ------------------------------------------------------------------------- */
+
+/* Nodes a raw HTML node can stand in for (not list items or table parts) */
+static const char *const plugin_block_node_types[] = {
+    "block_quote", "list", "code_block", "html_block", "paragraph",
+    "heading", "thematic_break", "table", NULL
+};
+
+static const char *const plugin_inline_node_types[] = {
+    "text", "code", "html_inline", "emph", "strong", "link", "image",
+    "strikethrough", NULL
+};
+
+/* Whether word (len bytes) is in a comma- or space-separated list */
+static bool plugin_list_has(const char *list, const char *word, size_t len) {
+    if (!list || len == 0) return false;
+    for (const char *p = list; *p;) {
+        p += strspn(p, ", \t");
+        size_t n = strcspn(p, ", \t");
+        if (n == len && strncmp(p, word, len) == 0) return true;
+        p += n;
+    }
+    return false;
+}
+
+static bool plugin_wants_node(const struct apex_plugin *p, apex_plugin_phase_mask phase,
+                              cmark_node *node) {
+    const char *type = cmark_node_get_type_string(node);
+    if (!type || !plugin_list_has(p->node_types, type, strlen(type))) return false;
+
+    const char *const *allowed = phase == APEX_PLUGIN_PHASE_BLOCK
+                                   ? plugin_block_node_types
+                                   : plugin_inline_node_types;
+    while (*allowed && strcmp(*allowed, type) != 0) allowed++;
+    if (!*allowed) return false;
+
+    /* The language is the first word of the fence info */
+    if (p->info && cmark_node_get_type(node) == CMARK_NODE_CODE_BLOCK) {
+        const char *info = cmark_node_get_fence_info(node);
+        return info && plugin_list_has(p->info, info, strcspn(info, " \t{"));
+    }
+    return true;
+}
+
+/* Every node p subscribes to, in document order */
+static cmark_node **plugin_collect_nodes(const struct apex_plugin *p, apex_plugin_phase_mask phase,
+                                         cmark_node *document, size_t *count) {
+    cmark_node **nodes = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    cmark_iter *iter = cmark_iter_new(document);
+    cmark_event_type event;
+    while ((event = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+        cmark_node *node = cmark_iter_get_node(iter);
+        if (event != CMARK_EVENT_ENTER || !plugin_wants_node(p, phase, node)) continue;
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            cmark_node **grown = realloc(nodes, capacity * sizeof(cmark_node *));
+            if (!grown) break;
+            nodes = grown;
+        }
+        nodes[(*count)++] = node;
+
+        /* Its descendants go with it */
+        if (cmark_node_first_child(node)) cmark_iter_reset(iter, node, CMARK_EVENT_EXIT);
+    }
+    cmark_iter_free(iter);
+    return nodes;
+}
+
+/* What a plugin is sent for a node: the text of a leaf, HTML for the rest.
+ * *owned is set when the result must be freed. */
+static const char *plugin_node_content(cmark_node *node, int cmark_options, char **owned) {
+    *owned = NULL;
+    cmark_node_type type = cmark_node_get_type(node);
+    if (type == CMARK_NODE_CODE_BLOCK || type == CMARK_NODE_HTML_BLOCK ||
+        type == CMARK_NODE_TEXT || type == CMARK_NODE_CODE || type == CMARK_NODE_HTML_INLINE) {
+        const char *literal = cmark_node_get_literal(node);
+        return literal ? literal : "";
+    }
+    *owned = cmark_render_html_with_mem(node, cmark_options, NULL, cmark_get_default_mem_allocator());
+    return *owned ? *owned : "";
+}
+
+/* Header lines for one node of a request */
+static char *plugin_node_header(cmark_node *node, size_t length, size_t *header_len) {
+    const char *type = cmark_node_get_type_string(node);
+    const char *info = cmark_node_get_type(node) == CMARK_NODE_CODE_BLOCK
+                         ? cmark_node_get_fence_info(node)
+                         : NULL;
+    char level[32] = "";
+    if (cmark_node_get_type(node) == CMARK_NODE_HEADING) {
+        snprintf(level, sizeof(level), "level: %d\n", cmark_node_get_heading_level(node));
+    }
+
+    size_t size = strlen(type) + (info ? strlen(info) : 0) + strlen(level) + 64;
+    char *header = malloc(size);
+    if (!header) return NULL;
+    int n = snprintf(header, size, "type: %s\n%s%s%s%slength: %zu\n\n",
+                     type,
+                     info && *info ? "info: " : "",
+                     info && *info ? info : "",
+                     info && *info ? "\n" : "",
+                     level,
+                     length);
+    *header_len = n > 0 ? (size_t)n : 0;
+    return header;
+}
+
+/* Find the answer for each of count nodes in a response; answers the
+ * plugin left out, or that run past the end, stay NULL */
+static void plugin_parse_node_response(const char *out, size_t out_len, size_t count,
+                                       const char **answers, size_t *lengths) {
+    const char *p = out;
+    const char *end = out + out_len;
+    for (size_t i = 0; i < count && p < end; i++) {
+        bool have_length = false;
+        size_t length = 0;
+        while (p < end) {
+            const char *eol = memchr(p, '\n', (size_t)(end - p));
+            if (!eol) eol = end;
+            if (eol == p) {
+                p = eol + 1;
+                break;
+            }
+            if ((size_t)(eol - p) > 7 && strncmp(p, "length:", 7) == 0) {
+                length = strtoul(p + 7, NULL, 10);
+                have_length = true;
+            }
+            p = eol < end ? eol + 1 : end;
+        }
+        if (!have_length || length > (size_t)(end - p)) return;
+        answers[i] = p;
+        lengths[i] = length;
+        p += length;
+    }
+}
+
+/* Put raw HTML in place of node */
+static bool plugin_replace_node(cmark_node *node, apex_plugin_phase_mask phase,
+                                const char *html, size_t len) {
+    char *literal = malloc(len + 1);
+    if (!literal) return false;
+    memcpy(literal, html, len);
+    literal[len] = '\0';
+
+    cmark_node *replacement = cmark_node_new(phase == APEX_PLUGIN_PHASE_BLOCK
+                                               ? CMARK_NODE_HTML_BLOCK
+                                               : CMARK_NODE_HTML_INLINE);
+    bool replaced = replacement && cmark_node_set_literal(replacement, literal) &&
+                    cmark_node_insert_before(node, replacement);
+    free(literal);
+    if (!replaced) {
+        if (replacement) cmark_node_free(replacement);
+        return false;
+    }
+    cmark_node_unlink(node);
+    apex_free_node_attributes(node);
+    cmark_node_free(node);
+    return true;
+}
+
+/* Run one block or inline plugin; returns the number of nodes replaced */
+static size_t plugin_run_nodes(struct apex_plugin *p, apex_plugin_phase_mask phase,
+                               const char *phase_name, cmark_node *document,
+                               int cmark_options, int do_profile, const apex_options *options) {
+    size_t count = 0;
+    cmark_node **nodes = plugin_collect_nodes(p, phase, document, &count);
+    if (count == 0) {
+        free(nodes);
+        return 0;
+    }
+
+    double plugin_start = apex_metrics_now_ms();
+    apex_subprocess_result run_result = { 0, false, 0.0 };
+    const char **contents = calloc(count, sizeof(char *));
+    char **owned = calloc(count, sizeof(char *));
+    const char **answers = calloc(count, sizeof(char *));
+    size_t *lengths = calloc(count, sizeof(size_t));
+    char **regex_out = p->handler_command ? NULL : calloc(count, sizeof(char *));
+    char *output = NULL;
+    size_t bytes_in = 0;
+    size_t bytes_out = 0;
+    size_t replaced = 0;
+    if (!contents || !owned || !answers || !lengths || (!p->handler_command && !regex_out)) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        contents[i] = plugin_node_content(nodes[i], cmark_options, &owned[i]);
+        bytes_in += strlen(contents[i]);
+    }
+
+    if (p->handler_command) {
+        /* One request for all of them: the request header, then a header
+         * and the content for each node, written without copying */
+        char **headers = calloc(count, sizeof(char *));
+        struct iovec *parts = calloc(1 + 2 * count, sizeof(struct iovec));
+        const char *plugin_id = p->id ? p->id : "plugin";
+        size_t request_size = strlen(plugin_id) + strlen(phase_name) + 96;
+        char *request = malloc(request_size);
+        bool ok = headers && parts && request;
+        if (ok) {
+            int n = snprintf(request, request_size,
+                             "APEX-PLUGIN 2\nplugin_id: %s\nphase: %s\nnodes: %zu\n\n",
+                             plugin_id, phase_name, count);
+            parts[0].iov_base = request;
+            parts[0].iov_len = n > 0 ? (size_t)n : 0;
+        }
+        for (size_t i = 0; ok && i < count; i++) {
+            size_t length = strlen(contents[i]);
+            headers[i] = plugin_node_header(nodes[i], length, &parts[1 + 2 * i].iov_len);
+            ok = headers[i] != NULL;
+            parts[1 + 2 * i].iov_base = headers[i];
+            parts[2 + 2 * i].iov_base = (void *)contents[i];
+            parts[2 + 2 * i].iov_len = length;
+        }
+
+        if (ok) {
+            plugin_child_env env;
+            plugin_child_env_init(&env, p, options);
+            size_t out_len = 0;
+            output = apex_run_external_plugin_parts(p->handler_command, parts, 1 + 2 * count,
+                                                    p->timeout_ms, env.overrides,
+                                                    &out_len, &run_result);
+            plugin_child_env_free(&env);
+            if (output) plugin_parse_node_response(output, out_len, count, answers, lengths);
+        }
+
+        for (size_t i = 0; headers && i < count; i++) free(headers[i]);
+        free(headers);
+        free(parts);
+        free(request);
+    } else if (p->has_regex) {
+        for (size_t i = 0; i < count; i++) {
+            regex_out[i] = apply_regex_replacement(p, contents[i]);
+            if (regex_out[i]) {
+                answers[i] = regex_out[i];
+                lengths[i] = strlen(regex_out[i]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!answers[i] || lengths[i] == 0) {
+            bytes_out += strlen(contents[i]);
+        } else if (plugin_replace_node(nodes[i], phase, answers[i], lengths[i])) {
+            bytes_out += lengths[i];
+            replaced++;
+        }
+    }
+
+done:
+    if (do_profile || options->metrics_callback) {
+        plugin_report_run(p, phase_name, apex_metrics_now_ms() - plugin_start, &run_result,
+                          bytes_in, bytes_out, do_profile, options);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (owned) free(owned[i]);
+        if (regex_out) free(regex_out[i]);
+    }
+    free(owned);
+    free(regex_out);
+    free(contents);
+    free(answers);
+    free(lengths);
+    free(output);
+    free(nodes);
+    return replaced;
+}
+
+bool apex_plugins_run_node_phases(apex_plugin_manager *manager,
+                                  cmark_node *document,
+                                  int cmark_options,
+                                  const apex_options *options) {
+    if (!manager || !document || !options || !manager->nodes) return false;
+
+    int do_profile = apex_plugins_profiling_enabled();
+    size_t replaced = 0;
+
+    /* Block plugins first, so inline plugins see the blocks that remain */
+    static const apex_plugin_phase_mask phases[] = { APEX_PLUGIN_PHASE_BLOCK, APEX_PLUGIN_PHASE_INLINE };
+    for (size_t i = 0; i < 2; i++) {
+        const char *phase_name = phases[i] == APEX_PLUGIN_PHASE_BLOCK ? "block" : "inline";
+        double phase_start = do_profile ? apex_metrics_now_ms() : 0.0;
+        bool ran = false;
+
+        for (struct apex_plugin *p = manager->nodes; p; p = p->next) {
+            if (!(p->phases & phases[i])) continue;
+            replaced += plugin_run_nodes(p, phases[i], phase_name, document,
+                                         cmark_options, do_profile, options);
+            ran = true;
+        }
+
+        if (do_profile && ran) {
+            fprintf(stderr,
+                    "[PROFILE] plugins_phase (%s):       %8.2f ms\n",
+                    phase_name,
+                    apex_metrics_now_ms() - phase_start);
+        }
+    }
+    return replaced > 0;
+}
@@ -2,6 +2,8 @@
 #define APEX_PLUGINS_H
 
 #include "../include/apex/apex.h"
+#include "cmark-gfm.h"
+#include "subprocess.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,12 +17,47 @@ typedef enum {
     APEX_PLUGIN_PHASE_POST_RENDER= 1 << 3
 } apex_plugin_phase_mask;
 
+/* Request format for external handler plugins (manifest `handler.protocol`) */
+typedef enum {
+    APEX_PLUGIN_PROTOCOL_JSON   = 1,  /* JSON object with the text escaped (default) */
+    APEX_PLUGIN_PROTOCOL_FRAMED = 2   /* Header lines, a blank line, then the raw text */
+} apex_plugin_protocol;
+
+/* Run an external handler command over text for a text phase. Returns the
+ * command's stdout, or NULL if it could not be run or timed out (see
+ * plugins_env.c). */
+char *apex_run_external_plugin_command(const char *cmd,
+                                       const char *phase,
+                                       const char *plugin_id,
+                                       const char *text,
+                                       apex_plugin_protocol protocol,
+                                       int timeout_ms,
+                                       const char *const *env_overrides,
+                                       apex_subprocess_result *result);
+
+/* Run an external handler command with a request the caller has already
+ * framed, written piece by piece (see apex_subprocess_run_parts). */
+char *apex_run_external_plugin_parts(const char *cmd,
+                                     const struct iovec *parts,
+                                     size_t part_count,
+                                     int timeout_ms,
+                                     const char *const *env_overrides,
+                                     size_t *out_len,
+                                     apex_subprocess_result *result);
+
 typedef struct apex_plugin_manager apex_plugin_manager;
 
-/* Discover and load plugins from project and user config dirs.
+/* Discover and load plugins from project and user config dirs, through
+ * each directory's discovery index when it is still current.
  * Returns NULL if no plugins are found or an error occurs. */
 apex_plugin_manager *apex_plugins_load(const apex_options *options);
 
+/* Rescan the project and user plugin directories and rewrite their
+ * discovery indexes (normally kept up to date by apex_plugins_load).
+ * Returns the number of plugins indexed, or -1 if an index could not be
+ * written. */
+int apex_plugins_rebuild_index(const apex_options *options);
+
 /* Free all plugin resources. */
 void apex_plugins_free(apex_plugin_manager *manager);
 
@@ -32,6 +69,20 @@ char *apex_plugins_run_text_phase(apex_plugin_manager *manager,
                                   const char *text,
                                   const apex_options *options);
 
+/* Whether any loaded plugin runs in one of the given phases. */
+bool apex_plugins_have_phase(const apex_plugin_manager *manager,
+                             apex_plugin_phase_mask phases);
+
+/* Run the block and inline plugins over a parsed document. Each plugin is
+ * sent every node it subscribes to in one batched request, and the HTML
+ * it returns for a node replaces that node in the tree.
+ * Returns true if any node was replaced.
+ */
+bool apex_plugins_run_node_phases(apex_plugin_manager *manager,
+                                  cmark_node *document,
+                                  int cmark_options,
+                                  const apex_options *options);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,12 +1,17 @@
 #include "../include/apex/apex.h"
+#include "plugins.h"
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <errno.h>
 #include <stdio.h>
 
+#ifdef __APPLE__
+#include <crt_externs.h>
+#define apex_environ (*_NSGetEnviron())
+#else
+extern char **environ;
+#define apex_environ environ
+#endif
+
 /**
  * Very small helper to JSON-escape a string for inclusion as a value.
  * We only need to support the characters that can reasonably appear
@@ -48,20 +53,44 @@ char *apex_json_escape(const char *text) {
 }
 
 /**
- * Run a single external plugin command for a text-based phase.
- * Protocol:
- *  - Host sends JSON on stdin with fields: version, plugin_id, phase, text.
- *  - Plugin writes transformed text to stdout (no JSON response parsing).
+ * Build the environment for a plugin child: the current environment with
+ * each "NAME=value" entry of overrides replacing (or adding) NAME.
+ * Only the pointer array is allocated; the strings are borrowed. Built in
+ * the parent so the host's own environment is never modified (setenv is
+ * not safe while other threads are converting).
  */
-char *apex_run_external_plugin_command(const char *cmd,
-                                       const char *phase,
-                                       const char *plugin_id,
-                                       const char *text,
-                                       int timeout_ms) {
-    (void)timeout_ms; /* Reserved for future timeout handling */
-    if (!cmd || !*cmd || !text || !phase || !plugin_id) return NULL;
+static char **apex_plugin_build_env(const char *const *overrides) {
+    char **env = apex_environ;
+    size_t env_count = 0;
+    size_t override_count = 0;
+    while (env && env[env_count]) env_count++;
+    while (overrides && overrides[override_count]) override_count++;
+
+    char **out = malloc((env_count + override_count + 1) * sizeof(char *));
+    if (!out) return NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < env_count; i++) {
+        bool replaced = false;
+        for (size_t j = 0; j < override_count && !replaced; j++) {
+            const char *eq = strchr(overrides[j], '=');
+            size_t name_len = eq ? (size_t)(eq - overrides[j]) : strlen(overrides[j]);
+            replaced = strncmp(env[i], overrides[j], name_len) == 0 && env[i][name_len] == '=';
+        }
+        if (!replaced) out[n++] = env[i];
+    }
+    for (size_t j = 0; j < override_count; j++) {
+        out[n++] = (char *)overrides[j];
+    }
+    out[n] = NULL;
+    return out;
+}
 
-    /* Build JSON request */
+/**
+ * Build the JSON request: { "version": 1, "plugin_id", "phase", "text" }
+ */
+static char *apex_plugin_json_request(const char *phase, const char *plugin_id,
+                                      const char *text, size_t *out_len) {
     char *escaped = apex_json_escape(text);
     if (!escaped) return NULL;
 
@@ -80,95 +109,92 @@ char *apex_run_external_plugin_command(const char *cmd,
     snprintf(json, json_len + 1, "%s%s%s%s%s%s%s",
              prefix, plugin_id, mid1, phase, mid2, escaped, suffix);
     free(escaped);
+    *out_len = json_len;
+    return json;
+}
 
-    int in_pipe[2];
-    int out_pipe[2];
-    if (pipe(in_pipe) == -1 || pipe(out_pipe) == -1) {
-        free(json);
-        return NULL;
-    }
-
-    pid_t pid = fork();
-    if (pid == -1) {
-        free(json);
-        close(in_pipe[0]); close(in_pipe[1]);
-        close(out_pipe[0]); close(out_pipe[1]);
-        return NULL;
-    }
-
-    if (pid == 0) {
-        /* Child: stdin from in_pipe[0], stdout to out_pipe[1] */
-        dup2(in_pipe[0], STDIN_FILENO);
-        dup2(out_pipe[1], STDOUT_FILENO);
-        close(in_pipe[0]); close(in_pipe[1]);
-        close(out_pipe[0]); close(out_pipe[1]);
-
-        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-        /* If exec fails */
-        _exit(127);
-    }
-
-    /* Parent */
-    close(in_pipe[0]);
-    close(out_pipe[1]);
-
-    /* Write JSON to child stdin */
-    ssize_t to_write = (ssize_t)json_len;
-    const char *p = json;
-    while (to_write > 0) {
-        ssize_t written = write(in_pipe[1], p, (size_t)to_write);
-        if (written <= 0) break;
-        p += written;
-        to_write -= written;
-    }
-    close(in_pipe[1]);
-    free(json);
-
-    /* Read all of child's stdout */
-    size_t cap = 8192;
-    size_t size = 0;
-    char *buf = malloc(cap);
-    if (!buf) {
-        close(out_pipe[0]);
-        /* Reap child */
-        int status;
-        waitpid(pid, &status, 0);
-        return NULL;
-    }
+/**
+ * Run a single external plugin command for a text-based phase.
+ * Protocols (chosen by the manifest's handler.protocol):
+ *  - json (default): host sends JSON on stdin with fields version,
+ *    plugin_id, phase and text.
+ *  - framed: host sends "APEX-PLUGIN 2", then "plugin_id: ...",
+ *    "phase: ..." and "length: N" lines, a blank line, and exactly N
+ *    bytes of raw text. Nothing is escaped, so large documents cost the
+ *    host no more than writing them.
+ * Either way the plugin writes the transformed text to stdout (no JSON
+ * response parsing).
+ * env_overrides is an optional NULL-terminated list of "NAME=value"
+ * strings set in the child's environment only. A plugin still running
+ * after timeout_ms (if > 0) is killed and NULL returned, so the phase
+ * keeps its text. result (optional) receives the exit status and timing.
+ */
+char *apex_run_external_plugin_command(const char *cmd,
+                                       const char *phase,
+                                       const char *plugin_id,
+                                       const char *text,
+                                       apex_plugin_protocol protocol,
+                                       int timeout_ms,
+                                       const char *const *env_overrides,
+                                       apex_subprocess_result *result) {
+    if (!cmd || !*cmd || !text || !phase || !plugin_id) return NULL;
 
-    for (;;) {
-        if (size + 4096 > cap) {
-            cap *= 2;
-            char *nb = realloc(buf, cap);
-            if (!nb) {
-                free(buf);
-                close(out_pipe[0]);
-                int status;
-                waitpid(pid, &status, 0);
-                return NULL;
-            }
-            buf = nb;
-        }
-        ssize_t n = read(out_pipe[0], buf + size, 4096);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            free(buf);
-            close(out_pipe[0]);
-            int status;
-            waitpid(pid, &status, 0);
+    /* Build the request: one JSON buffer, or a header followed by the
+     * caller's text as is */
+    char *request;
+    struct iovec parts[2];
+    size_t part_count;
+    if (protocol == APEX_PLUGIN_PROTOCOL_FRAMED) {
+        size_t text_len = strlen(text);
+        size_t header_len = strlen(plugin_id) + strlen(phase) + 96;
+        request = malloc(header_len);
+        if (!request) return NULL;
+        int n = snprintf(request, header_len,
+                         "APEX-PLUGIN 2\nplugin_id: %s\nphase: %s\nlength: %zu\n\n",
+                         plugin_id, phase, text_len);
+        if (n < 0 || (size_t)n >= header_len) {
+            free(request);
             return NULL;
         }
-        if (n == 0) break;
-        size += (size_t)n;
+        parts[0].iov_base = request;
+        parts[0].iov_len = (size_t)n;
+        parts[1].iov_base = (void *)text;
+        parts[1].iov_len = text_len;
+        part_count = 2;
+    } else {
+        size_t json_len = 0;
+        request = apex_plugin_json_request(phase, plugin_id, text, &json_len);
+        if (!request) return NULL;
+        parts[0].iov_base = request;
+        parts[0].iov_len = json_len;
+        part_count = 1;
     }
-    close(out_pipe[0]);
 
-    /* Reap child; ignore status for now but ensure no zombies */
-    int status;
-    waitpid(pid, &status, 0);
+    char *output = apex_run_external_plugin_parts(cmd, parts, part_count, timeout_ms,
+                                                  env_overrides, NULL, result);
+    free(request);
+    return output;
+}
 
-    buf[size] = '\0';
-    return buf;
+char *apex_run_external_plugin_parts(const char *cmd,
+                                     const struct iovec *parts,
+                                     size_t part_count,
+                                     int timeout_ms,
+                                     const char *const *env_overrides,
+                                     size_t *out_len,
+                                     apex_subprocess_result *result) {
+    if (out_len) *out_len = 0;
+    if (!cmd || !*cmd) return NULL;
+
+    char **child_env = apex_plugin_build_env(env_overrides);
+    if (!child_env) return NULL;
+
+    /* The exit status is not checked; whatever the plugin printed is used */
+    apex_subprocess_options run_options = { child_env, timeout_ms, false };
+    char *output = apex_subprocess_run_parts(cmd, parts, part_count, &run_options, out_len, result);
+
+    free(child_env);
+    return output;
 }
 
 /**
@@ -182,6 +208,7 @@ char *apex_run_preparse_plugin_env(const char *text, const apex_options *options
     if (!cmd || !*cmd || !text) {
         return NULL;
     }
-    return apex_run_external_plugin_command(cmd, "pre_parse", "env-pre-parse", text, 0);
+    return apex_run_external_plugin_command(cmd, "pre_parse", "env-pre-parse", text,
+                                            APEX_PLUGIN_PROTOCOL_JSON, 0, NULL, NULL);
 }
 
@@ -1,358 +1,424 @@
 /**
  * Pretty HTML Formatter
  * Adds proper indentation and whitespace to HTML output
+ *
+ * The formatter is a streaming sink: HTML is written into it in any
+ * number of chunks and indented as it arrives, so callers that assemble
+ * output from parts (e.g. the standalone document wrapper) can format
+ * while writing instead of building the document and copying it again.
  */
 
 #include "apex/apex.h"
+#include "pretty_html.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-/* Block-level tags that should be indented */
-static const char *block_tags[] = {
-    "html", "head", "body", "div", "section", "article", "nav", "header", "footer",
-    "main", "aside", "h1", "h2", "h3", "h4", "h5", "h6",
-    "p", "blockquote", "pre", "ul", "ol", "li", "dl", "dt", "dd",
-    "table", "thead", "tbody", "tfoot", "tr", "th", "td",
-    "figure", "figcaption", "details", "summary",
-    NULL
-};
-
-/* Tags that should keep content on same line (no newline before closing) */
-static const char *inline_tags[] = {
-    "a", "strong", "em", "code", "span", "abbr", "mark", "del", "ins",
-    "sup", "sub", "small", "i", "b", "u",
-    NULL
-};
+/* Tag classification flags */
+#define TAG_BLOCK  0x01  /* Block-level tags that should be indented */
+#define TAG_INLINE 0x02  /* Tags that keep content on the same line */
+#define TAG_VOID   0x04  /* Self-closing tags */
+#define TAG_PRE    0x08  /* <pre>/<code>: content is left untouched */
+#define TAG_TR     0x10  /* Table rows get special newline handling */
 
-/* Self-closing tags */
-static const char *void_tags[] = {
-    "meta", "link", "br", "hr", "img", "input",
-    NULL
-};
+typedef struct {
+    const char *name;
+    size_t len;
+    unsigned char flags;
+} pretty_tag;
 
 /**
- * Check if tag is in list
+ * Perfect hash over the known tag names: first, second and last
+ * character plus length, mixed by one multiply. Every known tag maps to
+ * its own slot, so a lookup is one hash and one memcmp.
  */
-static bool is_tag_in_list(const char *tag, const char **list) {
-    for (int i = 0; list[i]; i++) {
-        if (strcmp(tag, list[i]) == 0) return true;
+#define PRETTY_TAG_HASH_MULT 0x8d323d9fu
+
+static const pretty_tag pretty_tags[256] = {
+    [1] = { "details", 7, TAG_BLOCK },
+    [3] = { "h1", 2, TAG_BLOCK },
+    [6] = { "tfoot", 5, TAG_BLOCK },
+    [7] = { "div", 3, TAG_BLOCK },
+    [9] = { "tr", 2, TAG_BLOCK | TAG_TR },
+    [11] = { "ins", 3, TAG_INLINE },
+    [19] = { "section", 7, TAG_BLOCK },
+    [21] = { "dt", 2, TAG_BLOCK },
+    [23] = { "dd", 2, TAG_BLOCK },
+    [27] = { "br", 2, TAG_VOID },
+    [30] = { "main", 4, TAG_BLOCK },
+    [46] = { "code", 4, TAG_INLINE | TAG_PRE },
+    [50] = { "h6", 2, TAG_BLOCK },
+    [53] = { "footer", 6, TAG_BLOCK },
+    [54] = { "sup", 3, TAG_INLINE },
+    [67] = { "b", 1, TAG_INLINE },
+    [80] = { "u", 1, TAG_INLINE },
+    [82] = { "pre", 3, TAG_BLOCK | TAG_PRE },
+    [83] = { "h4", 2, TAG_BLOCK },
+    [89] = { "header", 6, TAG_BLOCK },
+    [90] = { "p", 1, TAG_BLOCK },
+    [94] = { "span", 4, TAG_INLINE },
+    [101] = { "mark", 4, TAG_INLINE },
+    [105] = { "link", 4, TAG_VOID },
+    [106] = { "hr", 2, TAG_VOID },
+    [110] = { "table", 5, TAG_BLOCK },
+    [113] = { "tbody", 5, TAG_BLOCK },
+    [114] = { "body", 4, TAG_BLOCK },
+    [115] = { "h2", 2, TAG_BLOCK },
+    [120] = { "a", 1, TAG_INLINE },
+    [124] = { "aside", 5, TAG_BLOCK },
+    [135] = { "input", 5, TAG_VOID },
+    [136] = { "article", 7, TAG_BLOCK },
+    [141] = { "figcaption", 10, TAG_BLOCK },
+    [144] = { "thead", 5, TAG_BLOCK },
+    [147] = { "em", 2, TAG_INLINE },
+    [150] = { "dl", 2, TAG_BLOCK },
+    [155] = { "html", 4, TAG_BLOCK },
+    [167] = { "ol", 2, TAG_BLOCK },
+    [168] = { "abbr", 4, TAG_INLINE },
+    [170] = { "th", 2, TAG_BLOCK },
+    [176] = { "li", 2, TAG_BLOCK },
+    [182] = { "strong", 6, TAG_INLINE },
+    [188] = { "head", 4, TAG_BLOCK },
+    [195] = { "h5", 2, TAG_BLOCK },
+    [196] = { "blockquote", 10, TAG_BLOCK },
+    [197] = { "meta", 4, TAG_VOID },
+    [206] = { "i", 1, TAG_INLINE },
+    [214] = { "del", 3, TAG_INLINE },
+    [215] = { "sub", 3, TAG_INLINE },
+    [220] = { "summary", 7, TAG_BLOCK },
+    [227] = { "h3", 2, TAG_BLOCK },
+    [231] = { "figure", 6, TAG_BLOCK },
+    [234] = { "td", 2, TAG_BLOCK },
+    [235] = { "small", 5, TAG_INLINE },
+    [245] = { "img", 3, TAG_VOID },
+    [247] = { "ul", 2, TAG_BLOCK },
+    [249] = { "nav", 3, TAG_BLOCK },
+};
+
+static unsigned int pretty_tag_hash(const char *name, size_t len) {
+    uint32_t key = (uint32_t)(unsigned char)name[0]
+                 | (uint32_t)(len > 1 ? (unsigned char)name[1] : 0) << 8
+                 | (uint32_t)(unsigned char)name[len - 1] << 16
+                 | (uint32_t)(len & 0xff) << 24;
+    return (uint32_t)(key * PRETTY_TAG_HASH_MULT) >> 24;
+}
+
+static unsigned char pretty_tag_flags(const char *name, size_t len) {
+    const pretty_tag *tag = &pretty_tags[pretty_tag_hash(name, len)];
+    if (tag->name && tag->len == len && memcmp(tag->name, name, len) == 0) {
+        return tag->flags;
     }
-    return false;
+    return 0;
 }
 
-/**
- * Extract tag name from opening or closing tag
- */
-static char *extract_tag_name(const char *tag_start, bool *is_closing, bool *is_self_closing) {
-    const char *p = tag_start;
-    if (*p != '<') return NULL;
-    p++;
+struct apex_pretty_sink {
+    /* Formatted output */
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    int newline_run;  /* Trailing newlines written; runs are capped at two */
+    bool failed;
+
+    /* Input held back until a tag (or </tr> lookahead) is complete */
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+
+    /* Formatter state */
+    int indent_level;
+    bool at_line_start;
+    bool in_pre;
+    bool in_inline;
+    bool last_was_table_row;
+};
 
-    *is_closing = (*p == '/');
-    if (*is_closing) p++;
+static bool pretty_reserve(apex_pretty_sink *sink, size_t extra) {
+    if (sink->failed) return false;
+    if (sink->out_len + extra + 1 <= sink->out_cap) return true;
 
-    const char *name_start = p;
-    while (*p && !isspace((unsigned char)*p) && *p != '>' && *p != '/') p++;
+    size_t new_cap = sink->out_cap ? sink->out_cap : 256;
+    while (sink->out_len + extra + 1 > new_cap) new_cap *= 2;
+    char *new_out = realloc(sink->out, new_cap);
+    if (!new_out) {
+        sink->failed = true;
+        return false;
+    }
+    sink->out = new_out;
+    sink->out_cap = new_cap;
+    return true;
+}
 
-    int len = p - name_start;
-    if (len == 0) return NULL;
+/**
+ * Append formatted bytes, never letting more than two newlines in a row
+ * through (at most one blank line between blocks).
+ */
+static void pretty_emit(apex_pretty_sink *sink, const char *data, size_t len) {
+    if (len == 0 || !pretty_reserve(sink, len)) return;
+
+    if (!memchr(data, '\n', len)) {
+        memcpy(sink->out + sink->out_len, data, len);
+        sink->out_len += len;
+        sink->newline_run = 0;
+        return;
+    }
 
-    char *name = malloc(len + 1);
-    if (name) {
-        memcpy(name, name_start, len);
-        name[len] = '\0';
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            if (sink->newline_run >= 2) continue;
+            sink->newline_run++;
+        } else {
+            sink->newline_run = 0;
+        }
+        sink->out[sink->out_len++] = data[i];
     }
+}
 
-    /* Check for self-closing */
-    while (*p && isspace((unsigned char)*p)) p++;
-    if (*p == '/') *is_self_closing = true;
+static void pretty_emit_char(apex_pretty_sink *sink, char c) {
+    pretty_emit(sink, &c, 1);
+}
 
-    return name;
+static void pretty_emit_indent(apex_pretty_sink *sink) {
+    if (sink->at_line_start && !sink->in_pre) {
+        if (sink->indent_level > 0 && pretty_reserve(sink, (size_t)sink->indent_level * 2)) {
+            memset(sink->out + sink->out_len, ' ', (size_t)sink->indent_level * 2);
+            sink->out_len += (size_t)sink->indent_level * 2;
+            sink->newline_run = 0;
+        }
+        sink->at_line_start = false;
+    }
 }
 
 /**
- * Pretty-print HTML
+ * Format as much of buf as possible. Returns the number of bytes
+ * consumed; unless final, processing stops before a tag whose closing
+ * '>' (or the lookahead after </tr>) has not arrived yet.
  */
-char *apex_pretty_print_html(const char *html) {
-    if (!html) return NULL;
+static size_t pretty_process(apex_pretty_sink *sink, const char *buf, size_t len, bool final) {
+    size_t i = 0;
 
-    size_t input_len = strlen(html);
-    size_t capacity = input_len * 2;  /* Room for indentation */
-    char *output = malloc(capacity);
-    if (!output) return strdup(html);
-
-    const char *read = html;
-    char *write = output;
-    size_t remaining = capacity;
-    int indent_level = 0;
-    bool at_line_start = true;
-    bool in_pre = false;
-    bool in_inline = false;
-    bool last_was_table_row = false;
-
-    #define WRITE_STR(str) do { \
-        size_t len = strlen(str); \
-        if (len < remaining) { \
-            memcpy(write, str, len); \
-            write += len; \
-            remaining -= len; \
-        } \
-    } while(0)
-
-    #define WRITE_CHAR(c) do { \
-        if (remaining > 0) { \
-            *write++ = c; \
-            remaining--; \
-        } \
-    } while(0)
-
-    #define WRITE_INDENT() do { \
-        if (at_line_start && !in_pre) { \
-            for (int i = 0; i < indent_level; i++) { \
-                WRITE_STR("  "); \
-            } \
-            at_line_start = false; \
-        } \
-    } while(0)
-
-    while (*read) {
-        /* Expand buffer if needed */
-        if (remaining < 100) {
-            size_t written = write - output;
-            capacity *= 2;
-            char *new_output = realloc(output, capacity);
-            if (!new_output) break;
-            output = new_output;
-            write = output + written;
-            remaining = capacity - written;
-        }
+    while (i < len) {
+        char c = buf[i];
+
+        if (c == '<') {
+            if (!final && !memchr(buf + i, '>', len - i)) {
+                return i;
+            }
 
-        /* Check for HTML tags */
-        if (*read == '<') {
-            bool is_closing = false;
-            bool is_self_closing = false;
-            char *tag_name = extract_tag_name(read, &is_closing, &is_self_closing);
+            /* Tag name runs to whitespace, '>' or '/' */
+            size_t p = i + 1;
+            bool is_closing = (p < len && buf[p] == '/');
+            if (is_closing) p++;
+            size_t name_start = p;
+            while (p < len && buf[p] && !isspace((unsigned char)buf[p]) && buf[p] != '>' && buf[p] != '/') p++;
+            size_t name_len = p - name_start;
 
-            if (tag_name) {
-                bool is_block = is_tag_in_list(tag_name, block_tags);
-                bool is_inline = is_tag_in_list(tag_name, inline_tags);
-                bool is_void = is_tag_in_list(tag_name, void_tags);
-                bool is_pre_tag = strcmp(tag_name, "pre") == 0 || strcmp(tag_name, "code") == 0;
+            if (name_len > 0) {
+                bool is_self_closing = false;
+                while (p < len && isspace((unsigned char)buf[p])) p++;
+                if (p < len && buf[p] == '/') is_self_closing = true;
+
+                size_t tag_end = i;
+                while (tag_end < len && buf[tag_end] && buf[tag_end] != '>') tag_end++;
+                if (tag_end < len && buf[tag_end] == '>') tag_end++;
+
+                unsigned char flags = pretty_tag_flags(buf + name_start, name_len);
+                bool is_block = (flags & TAG_BLOCK) != 0;
+                bool is_inline = (flags & TAG_INLINE) != 0;
+                bool is_void = (flags & TAG_VOID) != 0;
 
                 /* Track pre/code context */
-                if (is_pre_tag && !is_closing) {
-                    in_pre = true;
-                } else if (is_pre_tag && is_closing) {
-                    in_pre = false;
+                if (flags & TAG_PRE) {
+                    sink->in_pre = !is_closing;
                 }
 
                 /* Handle block tags */
-                if (is_block && !in_pre) {
-                    bool is_table_row = (strcmp(tag_name, "tr") == 0);
+                if (is_block && !sink->in_pre) {
+                    bool is_table_row = (flags & TAG_TR) != 0;
+
+                    /* For closing table rows, look past whitespace for another row or </tbody> */
+                    bool next_is_table_row = false;
+                    bool next_is_tbody_close = false;
+                    size_t next = tag_end;
+                    if (is_closing && is_table_row) {
+                        while (next < len && (buf[next] == ' ' || buf[next] == '\t' ||
+                                              buf[next] == '\n' || buf[next] == '\r')) {
+                            next++;
+                        }
+                        if (!final && len - next < 8) {
+                            return i;
+                        }
+                        if (len - next >= 3 && strncmp(buf + next, "<tr", 3) == 0) {
+                            next_is_table_row = true;
+                        } else if (len - next >= 8 && strncmp(buf + next, "</tbody>", 8) == 0) {
+                            next_is_tbody_close = true;
+                        }
+                    }
 
                     if (is_closing) {
                         /* Closing tag: decrease indent first */
-                        indent_level--;
-                        if (indent_level < 0) indent_level = 0;
-
-                        /* Add newline before closing tag if not at line start */
-                        /* But don't add blank lines for table rows */
-                        if (!at_line_start && !in_inline) {
-                            if (!is_table_row) {
-                                WRITE_CHAR('\n');
-                                at_line_start = true;
-                            }
+                        sink->indent_level--;
+                        if (sink->indent_level < 0) sink->indent_level = 0;
+
+                        /* Newline before closing tag, but no blank lines for table rows */
+                        if (!sink->at_line_start && !sink->in_inline && !is_table_row) {
+                            pretty_emit_char(sink, '\n');
+                            sink->at_line_start = true;
                         }
 
-                        WRITE_INDENT();
+                        pretty_emit_indent(sink);
 
-                        /* Track if this was a table row closing */
                         if (is_table_row) {
-                            last_was_table_row = true;
+                            sink->last_was_table_row = true;
                         }
                     } else {
-                        /* Opening tag */
-                        /* Don't add blank line before table row if last tag was also a table row */
-                        if (!at_line_start) {
-                            if (is_table_row && last_was_table_row) {
-                                /* Skip newline - no blank line between table rows */
-                                /* We're already at line start from the previous </tr> (which didn't add newline) */
-                            } else if (!is_table_row) {
-                                WRITE_CHAR('\n');
-                                at_line_start = true;
-                            }
+                        /* Opening tag: no blank line between consecutive table rows */
+                        if (!sink->at_line_start && !is_table_row) {
+                            pretty_emit_char(sink, '\n');
+                            sink->at_line_start = true;
                         }
-                        /* If we're at line start and this is a table row after another table row,
-                         * we don't need to do anything - the previous </tr> already positioned us correctly */
-                        WRITE_INDENT();
+                        pretty_emit_indent(sink);
 
-                        /* Reset flag when opening a new row */
                         if (is_table_row) {
-                            last_was_table_row = false;
-                        }
-                    }
-
-                    /* Copy the tag */
-                    const char *tag_end = read;
-                    while (*tag_end && *tag_end != '>') tag_end++;
-                    if (*tag_end == '>') tag_end++;
-
-                    /* For closing table rows, check if next tag is also a table row or tbody closing BEFORE copying */
-                    bool next_is_table_row = false;
-                    bool next_is_tbody_close = false;
-                    const char *whitespace_end = tag_end;
-                    if (is_closing && is_table_row) {
-                        const char *next = tag_end;
-                        while (*next && (*next == ' ' || *next == '\t' || *next == '\n' || *next == '\r')) {
-                            next++;
-                        }
-                        if (strncmp(next, "<tr", 3) == 0) {
-                            next_is_table_row = true;
-                            /* Skip whitespace between </tr> and <tr> */
-                            whitespace_end = next;
-                        } else if (strncmp(next, "</tbody>", 8) == 0) {
-                            next_is_tbody_close = true;
-                            /* Skip whitespace between </tr> and </tbody> */
-                            whitespace_end = next;
+                            sink->last_was_table_row = false;
                         }
                     }
 
-                    size_t tag_len = tag_end - read;
-                    if (tag_len < remaining) {
-                        memcpy(write, read, tag_len);
-                        write += tag_len;
-                        remaining -= tag_len;
-                    }
+                    pretty_emit(sink, buf + i, tag_end - i);
                     /* Skip whitespace if next tag is a table row or tbody closing */
-                    read = (next_is_table_row || next_is_tbody_close) ? whitespace_end : tag_end;
+                    i = (next_is_table_row || next_is_tbody_close) ? next : tag_end;
 
-                    /* After opening block tag, increase indent */
                     if (!is_closing && !is_self_closing && !is_void) {
-                        indent_level++;
-                        /* Always add newline after opening tag for proper indentation */
-                        WRITE_CHAR('\n');
-                        at_line_start = true;
-                    } else if (is_closing || is_self_closing || is_void) {
-                        /* For table rows, check if next tag is also a table row or tbody closing */
-                        if (is_table_row && (next_is_table_row || next_is_tbody_close)) {
-                            /* Next tag is <tr> or </tbody> - add single newline (no blank line) */
-                            WRITE_CHAR('\n');
-                            at_line_start = true;
-                            if (next_is_table_row) {
-                                last_was_table_row = true;
-                            }
-                        } else if (is_table_row) {
-                            /* Table row closing but next is not <tr> or </tbody> - add newline normally */
-                            WRITE_CHAR('\n');
-                            at_line_start = true;
-                            last_was_table_row = true;
-                        } else {
-                            WRITE_CHAR('\n');
-                            at_line_start = true;
-                        }
+                        /* After opening block tag, increase indent */
+                        sink->indent_level++;
+                    } else if (is_table_row && (next_is_table_row || !next_is_tbody_close)) {
+                        sink->last_was_table_row = true;
                     }
-
-                    free(tag_name);
+                    pretty_emit_char(sink, '\n');
+                    sink->at_line_start = true;
                     continue;
                 }
 
                 /* Track inline context */
                 if (is_inline) {
-                    if (!is_closing) {
-                        in_inline = true;
-                    } else {
-                        in_inline = false;
-                    }
-
-                    /* Copy inline tag as-is */
-                    const char *tag_end = read;
-                    while (*tag_end && *tag_end != '>') tag_end++;
-                    if (*tag_end == '>') tag_end++;
-
-                    size_t tag_len = tag_end - read;
-                    if (tag_len < remaining) {
-                        memcpy(write, read, tag_len);
-                        write += tag_len;
-                        remaining -= tag_len;
-                    }
-                    read = tag_end;
-
-                    free(tag_name);
-                    continue;
-                }
-
-                /* Unknown tag - copy as-is */
-                const char *tag_end = read;
-                while (*tag_end && *tag_end != '>') tag_end++;
-                if (*tag_end == '>') tag_end++;
-
-                size_t tag_len = tag_end - read;
-                if (tag_len < remaining) {
-                    memcpy(write, read, tag_len);
-                    write += tag_len;
-                    remaining -= tag_len;
+                    sink->in_inline = !is_closing;
                 }
-                read = tag_end;
 
-                free(tag_name);
+                /* Inline and unknown tags are copied as-is */
+                pretty_emit(sink, buf + i, tag_end - i);
+                i = tag_end;
                 continue;
             }
         }
 
         /* Regular content */
-        if (!at_line_start || in_pre || *read != '\n') {
-            WRITE_INDENT();
+        if (!sink->at_line_start || sink->in_pre || c != '\n') {
+            pretty_emit_indent(sink);
         }
 
-        WRITE_CHAR(*read);
+        pretty_emit_char(sink, c);
 
-        if (*read == '\n') {
-            at_line_start = true;
-        } else if (!isspace((unsigned char)*read)) {
-            at_line_start = false;
+        if (c == '\n') {
+            sink->at_line_start = true;
+        } else if (!isspace((unsigned char)c)) {
+            sink->at_line_start = false;
         }
 
-        read++;
+        i++;
     }
 
-    *write = '\0';
-
-    /* Collapse sequences of more than two consecutive newlines down to
-     * exactly two, so we never produce more than a single blank line
-     * between blocks in pretty-printed output.
-     */
-    size_t out_len = strlen(output);
-    char *collapsed = malloc(out_len + 1);
-    if (collapsed) {
-        const char *r = output;
-        char *w = collapsed;
-        int newline_run = 0;
-
-        while (*r) {
-            if (*r == '\n') {
-                newline_run++;
-                if (newline_run <= 2) {
-                    *w++ = *r++;
-                } else {
-                    /* Skip extra newlines beyond two */
-                    r++;
-                }
-            } else {
-                newline_run = 0;
-                *w++ = *r++;
-            }
+    return i;
+}
+
+apex_pretty_sink *apex_pretty_sink_new(size_t size_hint) {
+    apex_pretty_sink *sink = calloc(1, sizeof(apex_pretty_sink));
+    if (!sink) return NULL;
+
+    sink->at_line_start = true;
+    /* Indentation typically adds well under half again the input size */
+    if (size_hint > 0 && !pretty_reserve(sink, size_hint + size_hint / 2)) {
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+void apex_pretty_sink_write(apex_pretty_sink *sink, const char *data, size_t len) {
+    if (!sink || !data || len == 0 || sink->failed) return;
+
+    if (sink->pending_len == 0) {
+        size_t used = pretty_process(sink, data, len, false);
+        data += used;
+        len -= used;
+        if (len == 0) return;
+    }
+
+    /* Hold back the incomplete tail (or join new data onto it) */
+    if (sink->pending_len + len > sink->pending_cap) {
+        size_t new_cap = sink->pending_cap ? sink->pending_cap : 256;
+        while (sink->pending_len + len > new_cap) new_cap *= 2;
+        char *new_pending = realloc(sink->pending, new_cap);
+        if (!new_pending) {
+            sink->failed = true;
+            return;
         }
-        *w = '\0';
-        free(output);
-        output = collapsed;
+        sink->pending = new_pending;
+        sink->pending_cap = new_cap;
+    }
+    memcpy(sink->pending + sink->pending_len, data, len);
+    sink->pending_len += len;
+
+    if (sink->pending_len > len) {
+        size_t used = pretty_process(sink, sink->pending, sink->pending_len, false);
+        memmove(sink->pending, sink->pending + used, sink->pending_len - used);
+        sink->pending_len -= used;
     }
+}
 
-    #undef WRITE_STR
-    #undef WRITE_CHAR
-    #undef WRITE_INDENT
+const char *apex_pretty_sink_take(apex_pretty_sink *sink, size_t *out_len) {
+    *out_len = 0;
+    if (!sink || sink->failed || !sink->out) return NULL;
 
-    return output;
+    /* Formatting never looks back at emitted bytes, so the buffer can be
+     * handed out and reused */
+    *out_len = sink->out_len;
+    sink->out_len = 0;
+    return sink->out;
 }
 
+char *apex_pretty_sink_finish(apex_pretty_sink *sink, size_t *out_len) {
+    if (!sink) return NULL;
+
+    if (sink->pending_len > 0) {
+        pretty_process(sink, sink->pending, sink->pending_len, true);
+    }
+
+    char *result = NULL;
+    if (!sink->failed && pretty_reserve(sink, 0)) {
+        sink->out[sink->out_len] = '\0';
+        result = sink->out;
+        if (out_len) *out_len = sink->out_len;
+    } else {
+        free(sink->out);
+    }
+
+    free(sink->pending);
+    free(sink);
+    return result;
+}
+
+/**
+ * Pretty-print HTML
+ */
+char *apex_pretty_print_html(const char *html) {
+    if (!html) return NULL;
+
+    size_t len = strlen(html);
+    apex_pretty_sink *sink = apex_pretty_sink_new(len);
+    if (!sink) return strdup(html);
+
+    apex_pretty_sink_write(sink, html, len);
+    char *output = apex_pretty_sink_finish(sink, NULL);
+    return output ? output : strdup(html);
+}
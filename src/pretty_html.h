@@ -0,0 +1,48 @@
+/**
+ * Pretty HTML Formatter
+ * Streaming interface used internally to indent HTML while it is written
+ */
+
+#ifndef APEX_PRETTY_HTML_H
+#define APEX_PRETTY_HTML_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct apex_pretty_sink apex_pretty_sink;
+
+/**
+ * Create a pretty-printing sink
+ * @param size_hint Expected input size, used to presize the output (0 if unknown)
+ * @return New sink, or NULL on allocation failure
+ */
+apex_pretty_sink *apex_pretty_sink_new(size_t size_hint);
+
+/**
+ * Write a chunk of HTML into the sink. Chunks may split tags anywhere;
+ * incomplete tags are held back until the rest arrives.
+ */
+void apex_pretty_sink_write(apex_pretty_sink *sink, const char *data, size_t len);
+
+/**
+ * Take the output formatted so far and keep the sink open for more input
+ * @param out_len Receives the number of bytes returned
+ * @return Formatted bytes owned by the sink, valid until the next write
+ */
+const char *apex_pretty_sink_take(apex_pretty_sink *sink, size_t *out_len);
+
+/**
+ * Flush remaining input and free the sink
+ * @param out_len Receives the output length (may be NULL)
+ * @return Newly allocated formatted HTML, or NULL on allocation failure
+ */
+char *apex_pretty_sink_finish(apex_pretty_sink *sink, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_PRETTY_HTML_H */
@@ -30,32 +30,33 @@ static void escape_html(apex_buffer *buf, const char *str, size_t len) {
     }
 }
 
-static void render_node_html(apex_node *node, apex_buffer *buf, const apex_options *options) {
+static void render_children_html(const apex_tree *tree, apex_node_id node, apex_buffer *buf,
+                                 const apex_options *options);
+
+static void render_node_html(const apex_tree *tree, apex_node_id node, apex_buffer *buf,
+                             const apex_options *options) {
     if (!node) return;
 
-    switch (node->type) {
+    size_t len;
+    const char *text = apex_tree_literal(tree, node, &len);
+
+    switch (apex_tree_node_type(tree, node)) {
         case APEX_NODE_DOCUMENT:
             /* Render all children */
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             break;
 
         case APEX_NODE_HEADING: {
-            int level = node->data.heading.level;
+            int level = (int)tree->data[node].a;
             apex_buffer_append_str(buf, "<h");
             apex_buffer_append_char(buf, '0' + level);
             apex_buffer_append_char(buf, '>');
 
-            if (node->literal) {
-                /* Trim whitespace */
-                const char *text = node->literal;
-                size_t len = strlen(text);
-                while (len > 0 && (text[len-1] == ' ' || text[len-1] == '\n' || text[len-1] == '\r')) {
-                    len--;
-                }
-                escape_html(buf, text, len);
+            /* Trim whitespace */
+            while (len > 0 && (text[len-1] == ' ' || text[len-1] == '\n' || text[len-1] == '\r')) {
+                len--;
             }
+            escape_html(buf, text, len);
 
             apex_buffer_append_str(buf, "</h");
             apex_buffer_append_char(buf, '0' + level);
@@ -65,25 +66,21 @@ static void render_node_html(apex_node *node, apex_buffer *buf, const apex_optio
 
         case APEX_NODE_PARAGRAPH:
             apex_buffer_append_str(buf, "<p>");
-            if (node->literal) {
-                /* Trim trailing newlines */
-                const char *text = node->literal;
-                size_t len = strlen(text);
-                while (len > 0 && (text[len-1] == '\n' || text[len-1] == '\r')) {
-                    len--;
-                }
-                escape_html(buf, text, len);
+            /* Trim trailing newlines */
+            while (len > 0 && (text[len-1] == '\n' || text[len-1] == '\r')) {
+                len--;
             }
+            escape_html(buf, text, len);
             apex_buffer_append_str(buf, "</p>\n");
             break;
 
         case APEX_NODE_CODE_BLOCK: {
             apex_buffer_append_str(buf, "<pre><code");
 
-            if (node->data.code_block.info) {
+            const char *info = apex_tree_string(tree, tree->data[node].a);
+            if (info) {
                 apex_buffer_append_str(buf, " class=\"language-");
                 /* Extract first word from info string */
-                const char *info = node->data.code_block.info;
                 const char *end = info;
                 while (*end && *end != ' ') end++;
                 escape_html(buf, info, end - info);
@@ -91,11 +88,7 @@ static void render_node_html(apex_node *node, apex_buffer *buf, const apex_optio
             }
 
             apex_buffer_append_char(buf, '>');
-
-            if (node->literal) {
-                escape_html(buf, node->literal, strlen(node->literal));
-            }
-
+            escape_html(buf, text, len);
             apex_buffer_append_str(buf, "</code></pre>\n");
             break;
         }
@@ -106,98 +99,86 @@ static void render_node_html(apex_node *node, apex_buffer *buf, const apex_optio
 
         case APEX_NODE_BLOCK_QUOTE:
             apex_buffer_append_str(buf, "<blockquote>\n");
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             apex_buffer_append_str(buf, "</blockquote>\n");
             break;
 
         case APEX_NODE_LIST:
             /* TODO: detect ordered vs unordered */
             apex_buffer_append_str(buf, "<ul>\n");
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             apex_buffer_append_str(buf, "</ul>\n");
             break;
 
         case APEX_NODE_LIST_ITEM:
             apex_buffer_append_str(buf, "<li>");
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             apex_buffer_append_str(buf, "</li>\n");
             break;
 
         case APEX_NODE_TEXT:
-            if (node->literal) {
-                escape_html(buf, node->literal, strlen(node->literal));
-            }
+            escape_html(buf, text, len);
             break;
 
         case APEX_NODE_EMPH:
             apex_buffer_append_str(buf, "<em>");
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             apex_buffer_append_str(buf, "</em>");
             break;
 
         case APEX_NODE_STRONG:
             apex_buffer_append_str(buf, "<strong>");
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             apex_buffer_append_str(buf, "</strong>");
             break;
 
         case APEX_NODE_CODE:
             apex_buffer_append_str(buf, "<code>");
-            if (node->literal) {
-                escape_html(buf, node->literal, strlen(node->literal));
-            }
+            escape_html(buf, text, len);
             apex_buffer_append_str(buf, "</code>");
             break;
 
-        case APEX_NODE_LINK:
+        case APEX_NODE_LINK: {
+            const char *url = apex_tree_string(tree, tree->data[node].a);
+            const char *title = apex_tree_string(tree, tree->data[node].b);
             apex_buffer_append_str(buf, "<a href=\"");
-            if (node->data.link.url) {
-                escape_html(buf, node->data.link.url, strlen(node->data.link.url));
+            if (url) {
+                escape_html(buf, url, strlen(url));
             }
             apex_buffer_append_char(buf, '"');
 
-            if (node->data.link.title) {
+            if (title) {
                 apex_buffer_append_str(buf, " title=\"");
-                escape_html(buf, node->data.link.title, strlen(node->data.link.title));
+                escape_html(buf, title, strlen(title));
                 apex_buffer_append_char(buf, '"');
             }
 
             apex_buffer_append_char(buf, '>');
-            for (apex_node *child = node->first_child; child; child = child->next) {
-                render_node_html(child, buf, options);
-            }
+            render_children_html(tree, node, buf, options);
             apex_buffer_append_str(buf, "</a>");
             break;
+        }
 
-        case APEX_NODE_IMAGE:
+        case APEX_NODE_IMAGE: {
+            const char *url = apex_tree_string(tree, tree->data[node].a);
+            const char *title = apex_tree_string(tree, tree->data[node].b);
             apex_buffer_append_str(buf, "<img src=\"");
-            if (node->data.link.url) {
-                escape_html(buf, node->data.link.url, strlen(node->data.link.url));
+            if (url) {
+                escape_html(buf, url, strlen(url));
             }
             apex_buffer_append_str(buf, "\" alt=\"");
-            if (node->literal) {
-                escape_html(buf, node->literal, strlen(node->literal));
-            }
+            escape_html(buf, text, len);
             apex_buffer_append_char(buf, '"');
 
-            if (node->data.link.title) {
+            if (title) {
                 apex_buffer_append_str(buf, " title=\"");
-                escape_html(buf, node->data.link.title, strlen(node->data.link.title));
+                escape_html(buf, title, strlen(title));
                 apex_buffer_append_char(buf, '"');
             }
 
             apex_buffer_append_str(buf, " />");
             break;
+        }
 
         case APEX_NODE_LINEBREAK:
             apex_buffer_append_str(buf, "<br />\n");
@@ -219,22 +200,29 @@ static void render_node_html(apex_node *node, apex_buffer *buf, const apex_optio
     }
 }
 
-char *apex_render_html(apex_node *root, const apex_options *options) {
-    if (!root || !options) {
+static void render_children_html(const apex_tree *tree, apex_node_id node, apex_buffer *buf,
+                                 const apex_options *options) {
+    for (apex_node_id child = apex_tree_first_child(tree, node); child; child = apex_tree_next(tree, child)) {
+        render_node_html(tree, child, buf, options);
+    }
+}
+
+char *apex_render_html(const apex_tree *tree, const apex_options *options) {
+    if (!tree || !options) {
         return NULL;
     }
 
     apex_buffer buf;
     apex_buffer_init(&buf, 4096);
 
-    render_node_html(root, &buf, options);
+    render_node_html(tree, APEX_TREE_ROOT, &buf, options);
 
     return apex_buffer_detach(&buf);
 }
 
-char *apex_render_xml(apex_node *root, const apex_options *options) {
+char *apex_render_xml(const apex_tree *tree, const apex_options *options) {
     /* TODO: Implement XML rendering */
-    (void)root;
+    (void)tree;
     (void)options;
     return strdup("<xml>Not implemented yet</xml>");
 }
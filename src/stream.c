@@ -0,0 +1,864 @@
+/**
+ * Streaming conversion
+ *
+ * Input is cut into segments at top-level block boundaries: a line at the
+ * left margin that follows a blank line, outside fenced code, HTML blocks,
+ * comments, fenced divs, display math and front matter, and that cannot
+ * continue the block before it (list items, definitions, captions and
+ * attribute lines can). Closed segments go through the regular pipeline
+ * as soon as a chunk has been scanned; the document's metadata is taken
+ * from the first segment and reused for the rest, and the heading IDs
+ * each segment takes are carried to the next so repeated headings still
+ * get -1, -2, ... suffixes (a manual ID can only keep generated IDs in its
+ * own and later segments off it).
+ *
+ * Constructs whose output depends on the whole document (footnotes, TOC
+ * markers, reference links, abbreviations, includes, ALDs) switch the
+ * stream to deferred mode: everything from that segment on is converted
+ * in one piece by apex_stream_finish().
+ *
+ * apex_incremental runs the same scanner over each version of a whole
+ * document and renders only the segments that differ from the previous
+ * version's, plus any later segment with headings whose IDs the edit
+ * may have changed.
+ */
+
+#include "apex/apex.h"
+#include "stream.h"
+#include "pretty_html.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+struct apex_stream {
+    apex_options options;          /* As given; used for whole-document fallback */
+    apex_options segment_options;  /* Fragment output, no pretty-printing or scripts */
+    apex_stream_write_fn write;
+    void *user_data;
+    apex_pretty_sink *sink;        /* Formats written HTML when options.pretty is set */
+    apex_segment_context segment;
+
+    /* Input not yet converted; NUL-terminated at len */
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t scanned;    /* Bytes of buf classified so far (always at a line start) */
+    size_t cut;        /* End of the closed segments at the front of buf */
+    size_t total_in;
+
+    /* Line scanner state */
+    bool whole_document;   /* Options need the whole document; convert at finish */
+    bool deferred;         /* A global construct was seen; convert the rest at finish */
+    bool first_line;
+    bool block_seen;       /* A non-blank line has been scanned */
+    bool after_blank;      /* The previous line was blank */
+    bool after_definition; /* The last line at the margin started a definition */
+    bool in_front_matter;
+    bool in_comment;
+    bool in_extension;     /* Kramdown {::name} ... {:/} */
+    bool in_math;
+    char fence_char;
+    size_t fence_len;
+    int div_depth;
+    char html_tag[16];
+    int html_depth;
+
+    char last_char;        /* Last byte written, for the script separator */
+    bool finished;
+    bool failed;
+
+    /* Every cut, when scanning a whole document for apex_incremental */
+    size_t *cut_log;
+    size_t cut_log_count;
+    size_t cut_log_cap;
+};
+
+/* The document head needs the title before any content; plugins,
+ * citations and indices see the whole text; hashed footnote IDs depend
+ * on all of it */
+static bool stream_needs_whole_document(const apex_options *opts) {
+    return opts->standalone || opts->enable_plugins ||
+           opts->enable_citations || opts->bibliography_files || opts->csl_file ||
+           opts->enable_indices || opts->random_footnote_ids;
+}
+
+apex_stream *apex_stream_new(const apex_options *options, apex_stream_write_fn write, void *user_data) {
+    if (!write) return NULL;
+
+    apex_stream *stream = calloc(1, sizeof(apex_stream));
+    if (!stream) return NULL;
+
+    stream->options = options ? *options : apex_options_default();
+    stream->write = write;
+    stream->user_data = user_data;
+    stream->first_line = true;
+
+    stream->segment_options = stream->options;
+    stream->segment_options.standalone = false;
+    stream->segment_options.pretty = false;
+    stream->segment_options.script_tags = NULL;
+
+    stream->whole_document = stream_needs_whole_document(&stream->options);
+
+    stream->segment.heading_ids = apex_heading_ids_new(false);
+    if (!stream->segment.heading_ids) {
+        free(stream);
+        return NULL;
+    }
+
+    if (stream->options.pretty && !stream->whole_document) {
+        stream->sink = apex_pretty_sink_new(0);
+        if (!stream->sink) {
+            apex_heading_ids_free(stream->segment.heading_ids);
+            free(stream);
+            return NULL;
+        }
+    }
+    return stream;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Line scanner                                                              */
+/* ------------------------------------------------------------------------- */
+
+static bool stream_line_blank(const char *line, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r') return false;
+    }
+    return true;
+}
+
+static bool stream_line_contains(const char *line, size_t len, const char *needle) {
+    size_t n = strlen(needle);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (line[i] == needle[0] && memcmp(line + i, needle, n) == 0) return true;
+    }
+    return false;
+}
+
+/* Skip up to three spaces of indentation */
+static size_t stream_indent(const char *line, size_t len) {
+    size_t i = 0;
+    while (i < len && i < 3 && line[i] == ' ') i++;
+    return i;
+}
+
+/**
+ * A bracket that cmark may resolve against a reference definition
+ * elsewhere in the document: anything but inline links, spans and IALs,
+ * wiki links, task markers, callouts and metadata variables.
+ */
+static bool stream_line_has_reference(const char *line, size_t len) {
+    size_t open = len;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '\\') {
+            i++;
+        } else if (line[i] == '[') {
+            open = i;
+        } else if (line[i] == ']' && open < i) {
+            char next = i + 1 < len ? line[i + 1] : '\0';
+            char first = line[open + 1];
+            size_t content = i - open - 1;
+            bool inline_target = next == '(' || next == '{';
+            bool wiki = first == '[' || next == ']' || (i > 0 && line[i - 1] == ']');
+            bool task = content == 1 && (first == ' ' || first == 'x' || first == 'X');
+            if (!inline_target && !wiki && !task && first != '!' && first != '%') return true;
+            open = len;
+        }
+    }
+    return false;
+}
+
+/* Whether a line's output depends on text outside its segment */
+static bool stream_line_needs_document(const apex_stream *stream, const char *line, size_t len) {
+    const apex_options *opts = &stream->options;
+
+    if (stream_line_contains(line, len, "[^") || stream_line_contains(line, len, "^[")) return true;
+    if (stream_line_contains(line, len, "<!--TOC") || stream_line_contains(line, len, "{{")) return true;
+    if (opts->enable_file_includes &&
+        (stream_line_contains(line, len, "<<[") || stream_line_contains(line, len, "<<(") ||
+         stream_line_contains(line, len, "<<{"))) {
+        return true;
+    }
+    if (opts->mode == APEX_MODE_KRAMDOWN || opts->mode == APEX_MODE_UNIFIED) {
+        /* ALD definitions and references; plain IALs start with . # or space */
+        size_t i = stream_indent(line, len);
+        if (i + 2 < len && line[i] == '{' && line[i + 1] == ':' && isalpha((unsigned char)line[i + 2])) {
+            return true;
+        }
+    }
+    return stream_line_has_reference(line, len);
+}
+
+/* Lines that may continue the previous block across a blank line */
+static bool stream_line_continues(const char *line, size_t len) {
+    switch (line[0]) {
+        case ':': case '[': case '{': case '|': case '^':
+        case '*': case '-': case '+':
+            return true;
+        default:
+            break;
+    }
+
+    /* Ordered or alpha list marker: 1. 1) a. A) ii. */
+    size_t i = 0;
+    while (i < len && isalnum((unsigned char)line[i])) i++;
+    if (i > 0 && i < len && (line[i] == '.' || line[i] == ')')) {
+        return i + 1 == len || line[i + 1] == ' ' || line[i + 1] == '\t' || line[i + 1] == '\r';
+    }
+    return false;
+}
+
+static bool stream_html_void_tag(const char *name) {
+    static const char *const void_tags[] = {
+        "area", "base", "br", "col", "embed", "hr", "img", "input",
+        "link", "meta", "source", "track", "wbr", NULL
+    };
+    for (size_t i = 0; void_tags[i]; i++) {
+        if (strcmp(name, void_tags[i]) == 0) return true;
+    }
+    return false;
+}
+
+/* Net number of name elements opened on a line */
+static int stream_html_balance(const char *line, size_t len, const char *name) {
+    size_t n = strlen(name);
+    int balance = 0;
+    for (size_t i = 0; i + n + 1 < len; i++) {
+        if (line[i] != '<') continue;
+        bool closing = line[i + 1] == '/';
+        size_t start = i + 1 + (closing ? 1 : 0);
+        if (start + n > len || strncasecmp(line + start, name, n) != 0) continue;
+        char after = start + n < len ? line[start + n] : '\0';
+        if (after != '>' && after != ' ' && after != '\t' && after != '\r' && after != '\0') continue;
+        balance += closing ? -1 : 1;
+    }
+    return balance;
+}
+
+/* Update the multi-line block state for a non-blank line */
+static void stream_track_line(apex_stream *stream, const char *line, size_t len) {
+    size_t indent = stream_indent(line, len);
+    const char *rest = line + indent;
+    size_t rest_len = len - indent;
+
+    if (stream->in_front_matter) {
+        if ((rest_len >= 3 && strncmp(rest, "---", 3) == 0 && stream_line_blank(rest + 3, rest_len - 3)) ||
+            (rest_len >= 3 && strncmp(rest, "...", 3) == 0 && stream_line_blank(rest + 3, rest_len - 3))) {
+            stream->in_front_matter = false;
+        }
+        return;
+    }
+    if (stream->fence_char) {
+        size_t run = 0;
+        while (run < rest_len && rest[run] == stream->fence_char) run++;
+        if (run >= stream->fence_len && stream_line_blank(rest + run, rest_len - run)) {
+            stream->fence_char = '\0';
+        }
+        return;
+    }
+    if (stream->in_comment) {
+        if (stream_line_contains(line, len, "-->")) stream->in_comment = false;
+        return;
+    }
+    if (stream->in_extension) {
+        if (stream_line_contains(line, len, "{:/")) stream->in_extension = false;
+        return;
+    }
+    if (stream->in_math) {
+        if (stream_line_contains(line, len, "$$")) stream->in_math = false;
+        return;
+    }
+
+    if (stream_line_needs_document(stream, line, len)) {
+        stream->deferred = true;
+        return;
+    }
+
+    if (stream->html_depth > 0) {
+        stream->html_depth += stream_html_balance(line, len, stream->html_tag);
+        if (stream->html_depth <= 0) stream->html_depth = 0;
+        return;
+    }
+
+    if (stream->first_line && rest_len >= 3 && strncmp(rest, "---", 3) == 0 &&
+        stream_line_blank(rest + 3, rest_len - 3) &&
+        (stream->options.mode == APEX_MODE_MULTIMARKDOWN ||
+         stream->options.mode == APEX_MODE_KRAMDOWN ||
+         stream->options.mode == APEX_MODE_UNIFIED)) {
+        stream->in_front_matter = true;
+        return;
+    }
+
+    if (rest_len >= 3 && (rest[0] == '`' || rest[0] == '~')) {
+        size_t run = 0;
+        while (run < rest_len && rest[run] == rest[0]) run++;
+        if (run >= 3) {
+            stream->fence_char = rest[0];
+            stream->fence_len = run;
+            return;
+        }
+    }
+
+    if (rest_len >= 2 && rest[0] == '$' && rest[1] == '$' &&
+        !stream_line_contains(rest + 2, rest_len - 2, "$$")) {
+        stream->in_math = true;
+        return;
+    }
+
+    if (rest_len >= 3 && rest[0] == '{' && rest[1] == ':' && rest[2] == ':' &&
+        !stream_line_contains(rest, rest_len, "{:/")) {
+        stream->in_extension = true;
+        return;
+    }
+
+    if (rest_len >= 3 && strncmp(rest, ":::", 3) == 0) {
+        size_t i = 3;
+        while (i < rest_len && rest[i] == ':') i++;
+        if (stream_line_blank(rest + i, rest_len - i)) {
+            if (stream->div_depth > 0) stream->div_depth--;
+        } else {
+            stream->div_depth++;
+        }
+        return;
+    }
+
+    if (rest_len >= 4 && strncmp(rest, "<!--", 4) == 0) {
+        if (!stream_line_contains(rest + 4, rest_len - 4, "-->")) stream->in_comment = true;
+        return;
+    }
+
+    if (rest_len >= 2 && rest[0] == '<' && isalpha((unsigned char)rest[1])) {
+        size_t n = 0;
+        while (1 + n < rest_len && n + 1 < sizeof(stream->html_tag) &&
+               (isalnum((unsigned char)rest[1 + n]) || rest[1 + n] == '-')) {
+            stream->html_tag[n] = (char)tolower((unsigned char)rest[1 + n]);
+            n++;
+        }
+        stream->html_tag[n] = '\0';
+        if (!stream_html_void_tag(stream->html_tag)) {
+            int balance = stream_html_balance(line, len, stream->html_tag);
+            if (balance > 0) stream->html_depth = balance;
+        }
+    }
+}
+
+/**
+ * Classify the complete lines added since the last scan and move the cut
+ * to the start of the last block that begins a new segment.
+ */
+static void stream_scan(apex_stream *stream) {
+    while (!stream->deferred && !stream->whole_document) {
+        const char *line = stream->buf + stream->scanned;
+        const char *newline = memchr(line, '\n', stream->len - stream->scanned);
+        if (!newline) break;
+        size_t len = (size_t)(newline - line);
+
+        if (stream_line_blank(line, len)) {
+            stream->after_blank = true;
+        } else {
+            bool open_block = stream->in_front_matter || stream->fence_char || stream->in_comment ||
+                              stream->in_extension || stream->in_math || stream->div_depth > 0 ||
+                              stream->html_depth > 0;
+            if (stream->block_seen && stream->after_blank && !open_block && !stream->after_definition &&
+                line[0] != ' ' && line[0] != '\t' && !stream_line_continues(line, len)) {
+                stream->cut = stream->scanned;
+                if (stream->cut_log) {
+                    if (stream->cut_log_count == stream->cut_log_cap) {
+                        size_t cap = stream->cut_log_cap * 2;
+                        size_t *grown = realloc(stream->cut_log, cap * sizeof(size_t));
+                        if (!grown) {
+                            stream->deferred = true;
+                            break;
+                        }
+                        stream->cut_log = grown;
+                        stream->cut_log_cap = cap;
+                    }
+                    stream->cut_log[stream->cut_log_count++] = stream->cut;
+                }
+            }
+
+            stream_track_line(stream, line, len);
+            if (line[0] != ' ' && line[0] != '\t') stream->after_definition = line[0] == ':';
+            stream->after_blank = false;
+            stream->block_seen = true;
+            stream->first_line = false;
+        }
+
+        stream->scanned = (size_t)(newline + 1 - stream->buf);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Output                                                                    */
+/* ------------------------------------------------------------------------- */
+
+static int stream_emit(apex_stream *stream, const char *html, size_t len) {
+    if (len == 0) return 0;
+    stream->last_char = html[len - 1];
+
+    if (stream->sink) {
+        /* The sink holds back an incomplete trailing tag; write what is done */
+        apex_pretty_sink_write(stream->sink, html, len);
+        html = apex_pretty_sink_take(stream->sink, &len);
+        if (len == 0) return 0;
+    }
+
+    if (stream->write(html, len, stream->user_data) != 0) {
+        stream->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/* Convert the first len bytes of the buffer as one segment and drop them */
+static int stream_convert(apex_stream *stream, size_t len) {
+    char saved = stream->buf[len];
+    stream->buf[len] = '\0';
+    char *html = apex_markdown_to_html_segment(stream->buf, len, true, &stream->segment_options, &stream->segment);
+    stream->buf[len] = saved;
+    if (!html) {
+        stream->failed = true;
+        return -1;
+    }
+
+    /* Bibliography metadata turns on citations, which need the whole text */
+    if (!stream->segment.continuation && stream->segment.metadata &&
+        (apex_metadata_get(stream->segment.metadata, "bibliography") ||
+         apex_metadata_get(stream->segment.metadata, "csl"))) {
+        free(html);
+        apex_free_metadata(stream->segment.metadata);
+        stream->segment.metadata = NULL;
+        stream->whole_document = true;
+        return 0;
+    }
+    stream->segment.continuation = true;
+
+    int status = stream_emit(stream, html, strlen(html));
+    free(html);
+    if (status != 0) return status;
+
+    memmove(stream->buf, stream->buf + len, stream->len - len + 1);
+    stream->len -= len;
+    stream->scanned -= len;
+    stream->cut = 0;
+    return 0;
+}
+
+int apex_stream_feed(apex_stream *stream, const char *chunk, size_t len) {
+    if (!stream || stream->failed || stream->finished) return -1;
+    if (!chunk || len == 0) return 0;
+
+    if (stream->len + len + 1 > stream->cap) {
+        size_t new_cap = stream->cap ? stream->cap : 4096;
+        while (stream->len + len + 1 > new_cap) new_cap *= 2;
+        char *grown = realloc(stream->buf, new_cap);
+        if (!grown) {
+            stream->failed = true;
+            return -1;
+        }
+        stream->buf = grown;
+        stream->cap = new_cap;
+    }
+    memcpy(stream->buf + stream->len, chunk, len);
+    stream->len += len;
+    stream->buf[stream->len] = '\0';
+    stream->total_in += len;
+
+    stream_scan(stream);
+    if (stream->cut > 0 && !stream->whole_document) {
+        return stream_convert(stream, stream->cut);
+    }
+    return 0;
+}
+
+/* Join script tags the way apex_markdown_to_html appends them to a fragment */
+static int stream_emit_scripts(apex_stream *stream) {
+    char **scripts = stream->options.script_tags;
+    if (!scripts) return 0;
+
+    bool first = true;
+    for (char **p = scripts; *p; ++p) {
+        size_t len = strlen(*p);
+        if (len == 0) continue;
+        if (first && stream->last_char && stream->last_char != '\n') {
+            if (stream_emit(stream, "\n", 1) != 0) return -1;
+        }
+        first = false;
+        if (stream_emit(stream, *p, len) != 0) return -1;
+        if (stream_emit(stream, "\n", 1) != 0) return -1;
+    }
+    return 0;
+}
+
+int apex_stream_finish(apex_stream *stream) {
+    if (!stream || stream->failed || stream->finished) return -1;
+    stream->finished = true;
+
+    if (!stream->whole_document && stream->len > 0 && stream_convert(stream, stream->len) != 0) {
+        return -1;
+    }
+
+    /* Set up front, or by bibliography metadata found in the first segment */
+    if (stream->whole_document) {
+        char *html = apex_markdown_to_html(stream->buf ? stream->buf : "", stream->len, &stream->options);
+        if (!html) return -1;
+        int status = 0;
+        if (html[0] && stream->write(html, strlen(html), stream->user_data) != 0) status = -1;
+        free(html);
+        return status;
+    }
+
+    if (stream->total_in > 0 && stream_emit_scripts(stream) != 0) return -1;
+
+    if (stream->sink) {
+        size_t out_len = 0;
+        char *rest = apex_pretty_sink_finish(stream->sink, &out_len);
+        stream->sink = NULL;
+        if (!rest) return -1;
+        int status = 0;
+        if (out_len > 0 && stream->write(rest, out_len, stream->user_data) != 0) status = -1;
+        free(rest);
+        return status;
+    }
+    return 0;
+}
+
+void apex_stream_free(apex_stream *stream) {
+    if (!stream) return;
+    if (stream->sink) {
+        free(apex_pretty_sink_finish(stream->sink, NULL));
+    }
+    apex_free_metadata(stream->segment.metadata);
+    apex_heading_ids_free(stream->segment.heading_ids);
+    free(stream->buf);
+    free(stream);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Incremental rendering                                                     */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    size_t start;   /* Offset in the source */
+    size_t len;
+    char *html;     /* Fragment HTML; NULL until rendered */
+    apex_heading_id_change *id_changes;   /* Heading IDs it took, replayed when it is reused */
+    size_t id_change_count;
+    char **dependencies;                  /* Files it included, reported again when it is reused */
+    size_t dependency_count;
+} incremental_segment;
+
+struct apex_incremental {
+    apex_context *context;             /* For whole-document renders; may be NULL */
+    char *source;                      /* The previous render's document */
+    incremental_segment *segments;
+    size_t segment_count;
+    apex_segment_context segment;      /* Metadata from the first segment, heading IDs so far */
+    size_t reused;
+};
+
+apex_incremental *apex_incremental_new(apex_context *context) {
+    apex_incremental *inc = calloc(1, sizeof(apex_incremental));
+    if (inc) inc->context = context;
+    return inc;
+}
+
+static void incremental_free_dependencies(incremental_segment *segment) {
+    for (size_t i = 0; i < segment->dependency_count; i++) free(segment->dependencies[i]);
+    free(segment->dependencies);
+    segment->dependencies = NULL;
+    segment->dependency_count = 0;
+}
+
+static void incremental_free_segments(incremental_segment *segments, size_t count) {
+    if (!segments) return;
+    for (size_t i = 0; i < count; i++) {
+        free(segments[i].html);
+        apex_heading_id_changes_free(segments[i].id_changes, segments[i].id_change_count);
+        incremental_free_dependencies(&segments[i]);
+    }
+    free(segments);
+}
+
+/* Dependency callback while a segment renders: keep each file once */
+static void incremental_note_dependency(const char *path, void *user_data) {
+    incremental_segment *segment = user_data;
+    for (size_t i = 0; i < segment->dependency_count; i++) {
+        if (strcmp(segment->dependencies[i], path) == 0) return;
+    }
+    char **grown = realloc(segment->dependencies, (segment->dependency_count + 1) * sizeof(char *));
+    if (!grown) return;
+    segment->dependencies = grown;
+    grown[segment->dependency_count] = strdup(path);
+    if (grown[segment->dependency_count]) segment->dependency_count++;
+}
+
+/* Move a kept segment's output from the previous render */
+static void incremental_keep(incremental_segment *segment, incremental_segment *old) {
+    segment->html = old->html;
+    segment->id_changes = old->id_changes;
+    segment->id_change_count = old->id_change_count;
+    segment->dependencies = old->dependencies;
+    segment->dependency_count = old->dependency_count;
+    old->html = NULL;
+    old->id_changes = NULL;
+    old->id_change_count = 0;
+    old->dependencies = NULL;
+    old->dependency_count = 0;
+}
+
+void apex_incremental_reset(apex_incremental *inc) {
+    if (!inc) return;
+    incremental_free_segments(inc->segments, inc->segment_count);
+    inc->segments = NULL;
+    inc->segment_count = 0;
+    free(inc->source);
+    inc->source = NULL;
+    apex_free_metadata(inc->segment.metadata);
+    inc->segment.metadata = NULL;
+    apex_heading_ids_free(inc->segment.heading_ids);
+    inc->segment.heading_ids = NULL;
+    inc->segment.continuation = false;
+}
+
+size_t apex_incremental_reused(const apex_incremental *inc) {
+    return inc ? inc->reused : 0;
+}
+
+void apex_incremental_free(apex_incremental *inc) {
+    if (!inc) return;
+    apex_incremental_reset(inc);
+    free(inc);
+}
+
+/* Render without segments; nothing is kept for the next render */
+static char *incremental_whole(apex_incremental *inc, const char *markdown, size_t len,
+                               const apex_options *options) {
+    apex_incremental_reset(inc);
+    if (inc->context) return apex_context_convert(inc->context, markdown, len, options);
+    return apex_markdown_to_html(markdown, len, options);
+}
+
+/* Split a whole document where a stream fed all of it would cut */
+static incremental_segment *incremental_split(const char *markdown, size_t len,
+                                              const apex_options *options, size_t *count) {
+    apex_stream scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.options = *options;
+    scan.first_line = true;
+    scan.buf = (char *)markdown;   /* The scanner only reads */
+    scan.len = len;
+    scan.cut_log_cap = 64;
+    scan.cut_log = malloc(scan.cut_log_cap * sizeof(size_t));
+    if (!scan.cut_log) return NULL;
+    stream_scan(&scan);
+
+    *count = scan.cut_log_count + 1;
+    incremental_segment *segments = calloc(*count, sizeof(incremental_segment));
+    if (segments) {
+        for (size_t i = 0; i < *count; i++) {
+            segments[i].start = i == 0 ? 0 : scan.cut_log[i - 1];
+            size_t end = i + 1 < *count ? scan.cut_log[i] : len;
+            segments[i].len = end - segments[i].start;
+        }
+    }
+    free(scan.cut_log);
+    return segments;
+}
+
+static bool incremental_same(const apex_incremental *inc, size_t old_index,
+                             const char *markdown, const incremental_segment *segment) {
+    const incremental_segment *old = &inc->segments[old_index];
+    return old->len == segment->len &&
+           memcmp(inc->source + old->start, markdown + segment->start, segment->len) == 0;
+}
+
+/* Next heading ID change in a run of segments, or NULL at its end */
+static const apex_heading_id_change *incremental_next_change(const incremental_segment *segments, size_t count,
+                                                             size_t *segment, size_t *change) {
+    while (*segment < count && *change >= segments[*segment].id_change_count) {
+        (*segment)++;
+        *change = 0;
+    }
+    return *segment < count ? &segments[*segment].id_changes[(*change)++] : NULL;
+}
+
+/* Whether two runs of segments took the same heading IDs, in the same order */
+static bool incremental_same_ids(const incremental_segment *a, size_t a_count,
+                                 const incremental_segment *b, size_t b_count) {
+    size_t a_segment = 0, a_change = 0, b_segment = 0, b_change = 0;
+    for (;;) {
+        const apex_heading_id_change *x = incremental_next_change(a, a_count, &a_segment, &a_change);
+        const apex_heading_id_change *y = incremental_next_change(b, b_count, &b_segment, &b_change);
+        if (!x || !y) return !x && !y;
+        if (x->next_suffix != y->next_suffix || strcmp(x->id, y->id) != 0) return false;
+    }
+}
+
+char *apex_incremental_render(apex_incremental *inc, const char *markdown, size_t len,
+                              const apex_options *options) {
+    if (!inc || !markdown) return NULL;
+    apex_options opts = options ? *options : apex_options_default();
+    inc->reused = 0;
+
+    if (stream_needs_whole_document(&opts)) {
+        return incremental_whole(inc, markdown, len, &opts);
+    }
+
+    size_t count = 0;
+    incremental_segment *segments = incremental_split(markdown, len, &opts, &count);
+    if (!segments) return incremental_whole(inc, markdown, len, &opts);
+
+    /* Segments unchanged at either end keep their HTML. Every segment is
+     * rendered with the first one's metadata, so if the first segment
+     * changed nothing can be kept */
+    size_t prefix = 0, suffix = 0;
+    if (inc->segment_count > 0 && incremental_same(inc, 0, markdown, &segments[0])) {
+        while (prefix < count && prefix < inc->segment_count &&
+               incremental_same(inc, prefix, markdown, &segments[prefix])) {
+            prefix++;
+        }
+        while (suffix < count - prefix && suffix < inc->segment_count - prefix &&
+               incremental_same(inc, inc->segment_count - 1 - suffix, markdown,
+                                &segments[count - 1 - suffix])) {
+            suffix++;
+        }
+        for (size_t i = 0; i < prefix; i++) {
+            incremental_keep(&segments[i], &inc->segments[i]);
+        }
+        for (size_t i = 0; i < suffix; i++) {
+            incremental_keep(&segments[count - 1 - i], &inc->segments[inc->segment_count - 1 - i]);
+        }
+    } else {
+        apex_free_metadata(inc->segment.metadata);
+        inc->segment.metadata = NULL;
+    }
+
+    /* Heading IDs are taken again from the start; reused segments replay theirs */
+    apex_heading_ids_free(inc->segment.heading_ids);
+    inc->segment.heading_ids = apex_heading_ids_new(true);
+    char *source = malloc(len + 1);
+    if (!source || !inc->segment.heading_ids) {
+        free(source);
+        incremental_free_segments(segments, count);
+        return incremental_whole(inc, markdown, len, &opts);
+    }
+    memcpy(source, markdown, len);
+    source[len] = '\0';
+
+    /* The edited run of the previous version, kept to compare heading IDs */
+    incremental_segment *old_segments = inc->segments;
+    size_t old_count = inc->segment_count;
+    free(inc->source);
+    inc->segments = segments;
+    inc->segment_count = count;
+    inc->source = source;
+
+    apex_options segment_options = opts;
+    segment_options.pretty = false;
+    segment_options.script_tags = NULL;
+
+    size_t total = 0;
+    size_t invalidated = 0;
+    for (size_t i = 0; i < count; i++) {
+        /* Kept segments after the edit number their headings from the IDs
+         * taken before them; if the edited run took different ones, those
+         * with headings are rendered again */
+        if (suffix > 0 && i == count - suffix &&
+            !incremental_same_ids(segments + prefix, count - suffix - prefix,
+                                  old_segments + prefix, old_count - suffix - prefix)) {
+            for (size_t j = i; j < count; j++) {
+                if (segments[j].id_change_count == 0) continue;
+                free(segments[j].html);
+                apex_heading_id_changes_free(segments[j].id_changes, segments[j].id_change_count);
+                incremental_free_dependencies(&segments[j]);
+                segments[j].html = NULL;
+                segments[j].id_changes = NULL;
+                segments[j].id_change_count = 0;
+                invalidated++;
+            }
+        }
+
+        if (!segments[i].html) {
+            inc->segment.continuation = i > 0;
+            if (opts.dependency_callback) {
+                segment_options.dependency_callback = incremental_note_dependency;
+                segment_options.dependency_user_data = &segments[i];
+            }
+            segments[i].html = apex_markdown_to_html_segment(source + segments[i].start, segments[i].len,
+                                                             false, &segment_options, &inc->segment);
+            if (!segments[i].html) {
+                incremental_free_segments(old_segments, old_count);
+                apex_incremental_reset(inc);
+                return NULL;
+            }
+            segments[i].id_changes = apex_heading_ids_take_log(inc->segment.heading_ids,
+                                                               &segments[i].id_change_count);
+
+            /* Bibliography metadata turns on citations, which need the whole text */
+            if (i == 0 && inc->segment.metadata &&
+                (apex_metadata_get(inc->segment.metadata, "bibliography") ||
+                 apex_metadata_get(inc->segment.metadata, "csl"))) {
+                incremental_free_segments(old_segments, old_count);
+                return incremental_whole(inc, markdown, len, &opts);
+            }
+        } else if (!apex_heading_ids_replay(inc->segment.heading_ids, segments[i].id_changes,
+                                            segments[i].id_change_count)) {
+            incremental_free_segments(old_segments, old_count);
+            apex_incremental_reset(inc);
+            return NULL;
+        }
+        total += strlen(segments[i].html);
+    }
+    incremental_free_segments(old_segments, old_count);
+
+    /* Kept segments did not read their includes this time */
+    for (size_t i = 0; opts.dependency_callback && i < count; i++) {
+        for (size_t j = 0; j < segments[i].dependency_count; j++) {
+            opts.dependency_callback(segments[i].dependencies[j], opts.dependency_user_data);
+        }
+    }
+
+    size_t scripts_len = 0;
+    if (len > 0 && opts.script_tags) {
+        for (char **p = opts.script_tags; *p; ++p) {
+            if (**p) scripts_len += strlen(*p) + 2;
+        }
+    }
+
+    char *html = malloc(total + scripts_len + 1);
+    if (!html) return NULL;
+    char *w = html;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = strlen(segments[i].html);
+        memcpy(w, segments[i].html, n);
+        w += n;
+    }
+
+    /* Scripts are appended as apex_stream_finish() writes them */
+    if (scripts_len > 0) {
+        bool first = true;
+        for (char **p = opts.script_tags; *p; ++p) {
+            size_t n = strlen(*p);
+            if (n == 0) continue;
+            if (first && w > html && w[-1] != '\n') *w++ = '\n';
+            first = false;
+            memcpy(w, *p, n);
+            w += n;
+            *w++ = '\n';
+        }
+    }
+    *w = '\0';
+    inc->reused = prefix + suffix - invalidated;
+
+    if (opts.pretty) {
+        char *pretty = apex_pretty_print_html(html);
+        if (pretty) {
+            free(html);
+            html = pretty;
+        }
+    }
+    return html;
+}
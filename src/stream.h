@@ -0,0 +1,43 @@
+/**
+ * Streaming conversion
+ * Segment state shared by the stream driver (stream.c) and the
+ * conversion pipeline in apex.c
+ */
+
+#ifndef APEX_STREAM_H
+#define APEX_STREAM_H
+
+#include "apex/apex.h"
+#include "extensions/metadata.h"
+#include "extensions/header_ids.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * State carried from one segment of a streamed document to the next
+ */
+typedef struct {
+    apex_metadata_item *metadata;  /* Document metadata, owned by the stream */
+    apex_heading_ids *heading_ids; /* IDs of earlier segments' headings, or NULL; owned by the stream */
+    bool continuation;             /* The segment does not start the document */
+} apex_segment_context;
+
+/**
+ * Convert one segment of a document. The first segment's metadata is
+ * stored in segment; continuation segments reuse it instead of looking
+ * for a metadata block of their own. Generated heading IDs are made
+ * unique against segment->heading_ids, which then takes this segment's.
+ * With segment NULL this converts a whole document. in_place promises
+ * markdown[len] is readable and NUL, so the input is read directly
+ * instead of being copied first.
+ */
+char *apex_markdown_to_html_segment(const char *markdown, size_t len, bool in_place,
+                                    const apex_options *options, apex_segment_context *segment);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_STREAM_H */
@@ -0,0 +1,347 @@
+/**
+ * External command runner
+ */
+
+#include "subprocess.h"
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <crt_externs.h>
+#define apex_environ (*_NSGetEnviron())
+#else
+extern char **environ;
+#define apex_environ environ
+#endif
+
+/* Largest single write, so reads get a turn on big inputs */
+#define WRITE_CHUNK (64 * 1024)
+#define READ_CHUNK (16 * 1024)
+#define MAX_WRITE_PARTS 8
+
+/**
+ * Commands may be run from several threads at once (parallel block
+ * passes, the server). Pipes are made close-on-exec so one child never
+ * holds another's stdin open (it would never see EOF), and creating them
+ * is serialized with spawning so no child starts before the flag is set.
+ */
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static apex_subprocess_stats stats;
+
+static int open_pipe(int fds[2]) {
+    if (pipe(fds) == -1) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags != -1) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void close_fd(int *fd) {
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+static pid_t spawn_shell(const char *cmd, const apex_subprocess_options *options,
+                         int in_pipe[2], int out_pipe[2]) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    if (posix_spawn_file_actions_init(&actions) != 0) return -1;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    if (options && options->discard_stderr) {
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    /* The child starts with no blocked signals and default SIGPIPE, even
+     * though the host (a server, say) may ignore it */
+    sigset_t empty, pipe_only;
+    sigemptyset(&empty);
+    sigemptyset(&pipe_only);
+    sigaddset(&pipe_only, SIGPIPE);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setsigdefault(&attr, &pipe_only);
+
+    /* With a time limit the child leads its own process group, so
+     * anything its shell starts is killed along with it */
+    if (options && options->timeout_ms > 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    char *const argv[] = { "sh", "-c", (char *)cmd, NULL };
+    pid_t pid;
+    int rc = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv,
+                         options && options->env ? options->env : apex_environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return rc == 0 ? pid : -1;
+}
+
+/* Wait for pid until deadline (0 for none); false if it is still running */
+static bool reap(pid_t pid, double deadline, int *status) {
+    for (;;) {
+        pid_t r = waitpid(pid, status, deadline > 0 ? WNOHANG : 0);
+        if (r == pid) return true;
+        if (r < 0 && errno != EINTR) return true;
+        if (r == 0) {
+            if (apex_metrics_now_ms() >= deadline) return false;
+            sleep_ms(1);
+        }
+    }
+}
+
+static void record(const apex_subprocess_result *result, bool failed) {
+    pthread_mutex_lock(&stats_lock);
+    stats.runs++;
+    if (failed) stats.failures++;
+    if (result->timed_out) stats.timeouts++;
+    stats.total_ms += result->elapsed_ms;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void apex_subprocess_stats_get(apex_subprocess_stats *out) {
+    if (!out) return;
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Write what the pipe will take from parts, starting at part and offset */
+static ssize_t write_parts(int fd, const struct iovec *parts, size_t count,
+                           size_t *part, size_t *offset) {
+    struct iovec vec[MAX_WRITE_PARTS];
+    int nvec = 0;
+    size_t total = 0;
+    for (size_t i = *part, skip = *offset; i < count && nvec < MAX_WRITE_PARTS && total < WRITE_CHUNK; i++, skip = 0) {
+        size_t len = parts[i].iov_len - skip;
+        if (len == 0) continue;
+        if (len > WRITE_CHUNK - total) len = WRITE_CHUNK - total;
+        vec[nvec].iov_base = (char *)parts[i].iov_base + skip;
+        vec[nvec++].iov_len = len;
+        total += len;
+    }
+
+    ssize_t n = writev(fd, vec, nvec);
+    for (size_t left = n > 0 ? (size_t)n : 0; left > 0;) {
+        size_t avail = parts[*part].iov_len - *offset;
+        if (left < avail) {
+            *offset += left;
+            break;
+        }
+        left -= avail;
+        (*part)++;
+        *offset = 0;
+    }
+    return n;
+}
+
+char *apex_subprocess_run(const char *cmd, const char *input, size_t input_len,
+                          const apex_subprocess_options *options,
+                          size_t *out_len, apex_subprocess_result *result) {
+    struct iovec part = { (void *)input, input_len };
+    if (!input && input_len > 0) part.iov_len = 0;
+    return apex_subprocess_run_parts(cmd, &part, 1, options, out_len, result);
+}
+
+char *apex_subprocess_run_parts(const char *cmd, const struct iovec *parts, size_t part_count,
+                                const apex_subprocess_options *options,
+                                size_t *out_len, apex_subprocess_result *result) {
+    apex_subprocess_result local;
+    if (!result) result = &local;
+    result->exit_status = -1;
+    result->timed_out = false;
+    result->elapsed_ms = 0;
+    if (out_len) *out_len = 0;
+    if (!cmd || !*cmd || (!parts && part_count > 0)) return NULL;
+
+    size_t input_len = 0;
+    for (size_t i = 0; i < part_count; i++) input_len += parts[i].iov_len;
+
+    double start = apex_metrics_now_ms();
+    int timeout_ms = options ? options->timeout_ms : 0;
+    double deadline = timeout_ms > 0 ? start + timeout_ms : 0;
+
+    int in_pipe[2];
+    int out_pipe[2];
+    pthread_mutex_lock(&spawn_lock);
+    if (open_pipe(in_pipe) == -1) {
+        pthread_mutex_unlock(&spawn_lock);
+        record(result, true);
+        return NULL;
+    }
+    if (open_pipe(out_pipe) == -1) {
+        pthread_mutex_unlock(&spawn_lock);
+        close(in_pipe[0]); close(in_pipe[1]);
+        record(result, true);
+        return NULL;
+    }
+    pid_t pid = spawn_shell(cmd, options, in_pipe, out_pipe);
+    pthread_mutex_unlock(&spawn_lock);
+
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    if (pid == -1) {
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        result->elapsed_ms = apex_metrics_now_ms() - start;
+        record(result, true);
+        return NULL;
+    }
+
+    int in_fd = in_pipe[1];
+    int out_fd = out_pipe[0];
+    set_nonblocking(in_fd);
+    set_nonblocking(out_fd);
+    if (input_len == 0) close_fd(&in_fd);
+
+    /* A child that exits without reading everything makes our next write
+     * fail with EPIPE; keep the signal off this thread meanwhile */
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    bool broke_pipe = false;
+
+    size_t cap = 8192;
+    size_t size = 0;
+    size_t written = 0;
+    size_t part = 0;
+    size_t offset = 0;
+    char *buf = malloc(cap);
+    bool failed = buf == NULL;
+
+    while (!failed && out_fd != -1) {
+        int wait_ms = -1;
+        if (deadline > 0) {
+            double left = deadline - apex_metrics_now_ms();
+            if (left <= 0) {
+                result->timed_out = true;
+                break;
+            }
+            wait_ms = (int)left + 1;
+        }
+
+        struct pollfd pfds[2];
+        nfds_t nfds = 0;
+        pfds[nfds].fd = out_fd;
+        pfds[nfds].events = POLLIN;
+        pfds[nfds++].revents = 0;
+        if (in_fd != -1) {
+            pfds[nfds].fd = in_fd;
+            pfds[nfds].events = POLLOUT;
+            pfds[nfds++].revents = 0;
+        }
+
+        int ready = poll(pfds, nfds, wait_ms);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            failed = true;
+            break;
+        }
+        if (ready == 0) continue;
+
+        if (in_fd != -1 && pfds[1].revents) {
+            if (pfds[1].revents & POLLOUT) {
+                ssize_t n = write_parts(in_fd, parts, part_count, &part, &offset);
+                if (n > 0) {
+                    written += (size_t)n;
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    /* The child stopped reading; its output still counts */
+                    if (errno == EPIPE) broke_pipe = true;
+                    close_fd(&in_fd);
+                }
+            } else {
+                close_fd(&in_fd);
+            }
+            if (in_fd != -1 && written == input_len) close_fd(&in_fd);
+        }
+
+        if (pfds[0].revents) {
+            if (size + READ_CHUNK + 1 > cap) {
+                while (size + READ_CHUNK + 1 > cap) cap *= 2;
+                char *grown = realloc(buf, cap);
+                if (!grown) {
+                    failed = true;
+                    break;
+                }
+                buf = grown;
+            }
+            ssize_t n = read(out_fd, buf + size, READ_CHUNK);
+            if (n > 0) {
+                size += (size_t)n;
+            } else if (n == 0) {
+                close_fd(&out_fd);
+            } else if (errno != EAGAIN && errno != EINTR) {
+                failed = true;
+            }
+        }
+    }
+
+    close_fd(&in_fd);
+    close_fd(&out_fd);
+
+    if (broke_pipe && !sigismember(&old_set, SIGPIPE)) {
+        /* Discard the SIGPIPE our write raised before unblocking it */
+        sigset_t pending;
+        int sig;
+        if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+            sigwait(&pipe_set, &sig);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+    int status = 0;
+    if (result->timed_out || failed || !reap(pid, deadline, &status)) {
+        if (!failed) result->timed_out = true;
+        kill(timeout_ms > 0 ? -pid : pid, SIGKILL);
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+    result->elapsed_ms = apex_metrics_now_ms() - start;
+    if (!result->timed_out && !failed && WIFEXITED(status)) {
+        result->exit_status = WEXITSTATUS(status);
+    }
+
+    if (result->timed_out || failed) {
+        free(buf);
+        record(result, true);
+        return NULL;
+    }
+
+    record(result, result->exit_status != 0);
+    buf[size] = '\0';
+    if (out_len) *out_len = size;
+    return buf;
+}
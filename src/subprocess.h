@@ -0,0 +1,73 @@
+/**
+ * External command runner
+ *
+ * Plugins and syntax highlighters run as `/bin/sh -c CMD` children that
+ * read a document on stdin and write a replacement on stdout. The child
+ * is started with posix_spawn (no copy of a large host's page tables, as
+ * fork would need) and driven with poll(), writing input and reading
+ * output as each side becomes ready, so a child that starts answering
+ * before it has read all of its input never deadlocks against the host.
+ * An optional time limit kills the child's whole process group.
+ */
+
+#ifndef APEX_SUBPROCESS_H
+#define APEX_SUBPROCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    char *const *env;       /* Child environment; NULL for the host's */
+    int timeout_ms;         /* Kill the child after this long; <= 0 for no limit */
+    bool discard_stderr;    /* Send the child's stderr to /dev/null */
+} apex_subprocess_options;
+
+typedef struct {
+    int exit_status;        /* Exit code, or -1 if it did not exit normally */
+    bool timed_out;         /* Killed at the time limit */
+    double elapsed_ms;      /* Spawn to reap */
+} apex_subprocess_result;
+
+/* Running totals across every command run by this process */
+typedef struct {
+    size_t runs;
+    size_t failures;        /* Spawn failures and non-zero exits */
+    size_t timeouts;
+    double total_ms;
+} apex_subprocess_stats;
+
+/**
+ * Run cmd with input on its stdin and capture its stdout.
+ * result (optional) is filled in whether or not output is returned.
+ * @return Newly allocated, NUL-terminated output (out_len optional), or
+ *         NULL if the command could not be run or was killed at the time
+ *         limit. Output from a non-zero exit is still returned; callers
+ *         that care check result->exit_status.
+ */
+char *apex_subprocess_run(const char *cmd, const char *input, size_t input_len,
+                          const apex_subprocess_options *options,
+                          size_t *out_len, apex_subprocess_result *result);
+
+/**
+ * apex_subprocess_run with the input given as consecutive pieces, written
+ * with writev so a caller can frame a large text without copying it
+ */
+char *apex_subprocess_run_parts(const char *cmd, const struct iovec *parts, size_t part_count,
+                                const apex_subprocess_options *options,
+                                size_t *out_len, apex_subprocess_result *result);
+
+/**
+ * Copy the process-wide totals
+ */
+void apex_subprocess_stats_get(apex_subprocess_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEX_SUBPROCESS_H */
@@ -0,0 +1,267 @@
+/**
+ * AST layout benchmark
+ *
+ * Compares the apex_tree node pool against the pointer-per-node layout it
+ * replaced: time to build the tree, time to walk it, and bytes per node.
+ * The legacy parser below is the old parse_simple() kept verbatim apart
+ * from names, so both sides do the same scanning work.
+ *
+ * Usage: apex_ast_bench [blocks] [iterations]
+ */
+
+#include "apex/parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Previous layout: one calloc per node, literals and info strings copied */
+typedef struct legacy_node {
+    apex_node_type type;
+    struct legacy_node *parent;
+    struct legacy_node *first_child;
+    struct legacy_node *last_child;
+    struct legacy_node *prev;
+    struct legacy_node *next;
+    char *literal;
+    int start_line;
+    int start_column;
+    int end_line;
+    int end_column;
+    union {
+        struct { int level; } heading;
+        struct { char *info; bool fenced; } code_block;
+        struct { char *url; char *title; } link;
+        struct { bool checked; } task_item;
+        struct { char *type; char *title; bool collapsible; bool default_open; } callout;
+        struct { bool is_inline; } math;
+    } data;
+} legacy_node;
+
+static size_t legacy_bytes;
+
+static char *legacy_strndup(const char *s, size_t n) {
+    legacy_bytes += n + 1;
+    return strndup(s, n);
+}
+
+static legacy_node *legacy_node_new(apex_node_type type) {
+    legacy_node *node = calloc(1, sizeof(legacy_node));
+    if (node) {
+        node->type = type;
+        legacy_bytes += sizeof(legacy_node);
+    }
+    return node;
+}
+
+static void legacy_append_child(legacy_node *parent, legacy_node *child) {
+    child->parent = parent;
+    child->next = NULL;
+    if (parent->last_child) {
+        parent->last_child->next = child;
+        child->prev = parent->last_child;
+        parent->last_child = child;
+    } else {
+        parent->first_child = child;
+        parent->last_child = child;
+    }
+}
+
+static void legacy_free(legacy_node *node) {
+    legacy_node *child = node->first_child;
+    while (child) {
+        legacy_node *next = child->next;
+        legacy_free(child);
+        child = next;
+    }
+    free(node->literal);
+    if (node->type == APEX_NODE_CODE_BLOCK) free(node->data.code_block.info);
+    free(node);
+}
+
+static legacy_node *legacy_parse(const char *input, size_t len) {
+    legacy_node *doc = legacy_node_new(APEX_NODE_DOCUMENT);
+    size_t pos = 0;
+
+    while (pos < len) {
+        while (pos < len && (input[pos] == '\n' || input[pos] == '\r')) pos++;
+        if (pos >= len) break;
+
+        if (input[pos] == '#') {
+            int level = 0;
+            size_t start = pos;
+            while (pos < len && input[pos] == '#' && level < 6) {
+                level++;
+                pos++;
+            }
+            if (pos < len && input[pos] == ' ') {
+                pos++;
+                size_t text_start = pos;
+                while (pos < len && input[pos] != '\n') pos++;
+                legacy_node *heading = legacy_node_new(APEX_NODE_HEADING);
+                heading->data.heading.level = level;
+                heading->literal = legacy_strndup(input + text_start, pos - text_start);
+                legacy_append_child(doc, heading);
+                continue;
+            }
+            pos = start;
+        }
+
+        if (pos + 3 <= len && input[pos] == '`' && input[pos+1] == '`' && input[pos+2] == '`') {
+            pos += 3;
+            size_t info_start = pos;
+            while (pos < len && input[pos] != '\n') pos++;
+            char *info = (info_start < pos) ? legacy_strndup(input + info_start, pos - info_start) : NULL;
+            if (pos < len) pos++;
+            size_t code_start = pos;
+            while (pos + 3 <= len) {
+                if (input[pos] == '`' && input[pos+1] == '`' && input[pos+2] == '`') {
+                    legacy_node *code_block = legacy_node_new(APEX_NODE_CODE_BLOCK);
+                    code_block->data.code_block.fenced = true;
+                    code_block->data.code_block.info = info;
+                    code_block->literal = legacy_strndup(input + code_start, pos - code_start);
+                    legacy_append_child(doc, code_block);
+                    pos += 3;
+                    while (pos < len && input[pos] != '\n') pos++;
+                    break;
+                }
+                pos++;
+            }
+            continue;
+        }
+
+        size_t para_start = pos;
+        while (pos < len) {
+            if (input[pos] == '\n' && pos + 1 < len && input[pos + 1] == '\n') break;
+            pos++;
+        }
+        if (pos > para_start) {
+            legacy_node *para = legacy_node_new(APEX_NODE_PARAGRAPH);
+            para->literal = legacy_strndup(input + para_start, pos - para_start);
+            legacy_append_child(doc, para);
+        }
+    }
+
+    return doc;
+}
+
+/* Both walks touch the type and literal of every node, depth first */
+static size_t legacy_walk(const legacy_node *node, size_t *nodes) {
+    size_t sum = (size_t)node->type;
+    (*nodes)++;
+    if (node->literal) sum += strlen(node->literal);
+    for (const legacy_node *child = node->first_child; child; child = child->next) {
+        sum += legacy_walk(child, nodes);
+    }
+    return sum;
+}
+
+static size_t tree_walk(const apex_tree *tree, apex_node_id node, size_t *nodes) {
+    size_t length;
+    size_t sum = (size_t)apex_tree_node_type(tree, node);
+    (*nodes)++;
+    apex_tree_literal(tree, node, &length);
+    sum += length;
+    for (apex_node_id child = apex_tree_first_child(tree, node); child; child = apex_tree_next(tree, child)) {
+        sum += tree_walk(tree, child, nodes);
+    }
+    return sum;
+}
+
+static size_t tree_bytes(const apex_tree *tree) {
+    size_t per_node = sizeof(uint8_t) * 2 + sizeof(apex_node_id) * 4 + sizeof(uint32_t) * 2 +
+                      sizeof(apex_span) + sizeof(apex_node_data);
+    return sizeof(apex_tree) + per_node * tree->capacity + tree->strings_capacity +
+           sizeof(uint32_t) * (tree->string_capacity + tree->string_slot_count);
+}
+
+static char *make_document(int blocks, size_t *length) {
+    static const char *languages[] = { "c", "python", "ruby", "javascript" };
+    size_t capacity = (size_t)blocks * 160 + 1;
+    char *doc = malloc(capacity);
+    size_t len = 0;
+    if (!doc) return NULL;
+
+    for (int i = 0; i < blocks; i++) {
+        switch (i % 3) {
+            case 0:
+                len += snprintf(doc + len, capacity - len, "## Section %d\n\n", i);
+                break;
+            case 1:
+                len += snprintf(doc + len, capacity - len, "```%s\nint x = %d;\n```\n\n",
+                                languages[i % 4], i);
+                break;
+            default:
+                len += snprintf(doc + len, capacity - len,
+                                "Paragraph %d with a few words of text\nspanning two lines.\n\n", i);
+                break;
+        }
+    }
+    *length = len;
+    return doc;
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int blocks = argc > 1 ? atoi(argv[1]) : 100000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if (blocks <= 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [blocks] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    size_t length;
+    char *doc = make_document(blocks, &length);
+    if (!doc) return 1;
+
+    apex_options options;
+    memset(&options, 0, sizeof(options));
+    void *parser = apex_parser_new(&options);
+    double legacy_build = 0, legacy_traverse = 0, tree_build = 0, tree_traverse = 0;
+    size_t legacy_nodes = 0, tree_nodes = 0, checksum = 0, pool_bytes = 0;
+    struct timespec start;
+
+    for (int i = 0; i < iterations; i++) {
+        legacy_bytes = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        legacy_node *root = legacy_parse(doc, length);
+        legacy_build += seconds_since(&start);
+
+        legacy_nodes = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        checksum += legacy_walk(root, &legacy_nodes);
+        legacy_traverse += seconds_since(&start);
+        legacy_free(root);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        apex_tree *tree = apex_parse(parser, doc, length);
+        tree_build += seconds_since(&start);
+        if (!tree) return 1;
+
+        tree_nodes = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        checksum += tree_walk(tree, APEX_TREE_ROOT, &tree_nodes);
+        tree_traverse += seconds_since(&start);
+        pool_bytes = tree_bytes(tree);
+        apex_tree_free(tree);
+    }
+
+    printf("%d blocks, %zu bytes of input, %d iterations (checksum %zx)\n",
+           blocks, length, iterations, checksum);
+    printf("%-8s %10s %12s %12s %14s\n", "layout", "nodes", "build ms", "walk ms", "bytes/node");
+    printf("%-8s %10zu %12.2f %12.2f %14.1f\n", "legacy", legacy_nodes,
+           legacy_build * 1000 / iterations, legacy_traverse * 1000 / iterations,
+           (double)legacy_bytes / legacy_nodes);
+    printf("%-8s %10zu %12.2f %12.2f %14.1f\n", "pool", tree_nodes,
+           tree_build * 1000 / iterations, tree_traverse * 1000 / iterations,
+           (double)pool_bytes / tree_nodes);
+
+    apex_parser_free(parser);
+    free(doc);
+    return 0;
+}
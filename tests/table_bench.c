@@ -0,0 +1,88 @@
+/**
+ * Advanced table benchmark
+ *
+ * Converts one large generated table that uses every grid feature (<<
+ * colspans, ^^ rowspans, a === footer and a caption) and reports the
+ * time per conversion, so the cost of the table passes can be compared
+ * against a plain table of the same size.
+ *
+ * Usage: apex_table_bench [rows] [iterations]
+ */
+
+#include "apex/apex.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* A table of rows body rows, with spans when spans is set */
+static char *make_table(int rows, bool spans, size_t *length) {
+    size_t capacity = (size_t)rows * 64 + 256;
+    char *doc = malloc(capacity);
+    if (!doc) return NULL;
+    size_t len = 0;
+
+    len += (size_t)snprintf(doc + len, capacity - len,
+                            "[Generated table]\n\n| Key | A | B | C |\n|-----|---|---|---|\n");
+    for (int i = 0; i < rows; i++) {
+        if (spans && i % 4 == 1) {
+            len += (size_t)snprintf(doc + len, capacity - len, "| ^^ | a%d | b%d ||\n", i, i);
+        } else if (spans && i % 4 == 3) {
+            len += (size_t)snprintf(doc + len, capacity - len, "| k%d | ^^ | b%d | c%d |\n", i, i, i);
+        } else {
+            len += (size_t)snprintf(doc + len, capacity - len, "| k%d | a%d | b%d | c%d |\n", i, i, i, i);
+        }
+    }
+    if (spans) {
+        len += (size_t)snprintf(doc + len, capacity - len, "| === | === | === | === |\n| Total |||  %d |\n", rows);
+    }
+
+    *length = len;
+    return doc;
+}
+
+static double time_conversion(const char *doc, size_t length, const apex_options *options,
+                              int iterations, size_t *out_bytes) {
+    struct timespec start;
+    double total = 0;
+    for (int i = 0; i < iterations; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        char *html = apex_markdown_to_html(doc, length, options);
+        total += seconds_since(&start);
+        if (!html) return -1;
+        *out_bytes = strlen(html);
+        apex_free_string(html);
+    }
+    return total * 1000 / iterations;
+}
+
+int main(int argc, char **argv) {
+    int rows = argc > 1 ? atoi(argv[1]) : 5000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if (rows <= 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [rows] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    apex_options options = apex_options_default();
+    printf("%d rows, %d iterations\n", rows, iterations);
+    printf("%-8s %12s %12s %12s\n", "table", "input bytes", "output bytes", "ms");
+
+    for (int spans = 0; spans <= 1; spans++) {
+        size_t length, out_bytes = 0;
+        char *doc = make_table(rows, spans, &length);
+        if (!doc) return 1;
+        double ms = time_conversion(doc, length, &options, iterations, &out_bytes);
+        free(doc);
+        if (ms < 0) return 1;
+        printf("%-8s %12zu %12zu %12.2f\n", spans ? "spans" : "plain", length, out_bytes, ms);
+    }
+    return 0;
+}
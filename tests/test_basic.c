@@ -4,7 +4,10 @@
 
 #include "test_helpers.h"
 #include "apex/apex.h"
+#include "apex/renderer.h"
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 void test_basic_markdown(void) {
     int suite_failures = suite_start();
@@ -36,6 +39,445 @@ void test_basic_markdown(void) {
     print_suite_title("Basic Markdown Tests", had_failures, false);
 }
 
+/**
+ * Test per-stage conversion metrics
+ */
+
+typedef struct {
+    int stages;
+    int skipped;
+    bool saw_parsing;
+    bool saw_total;
+    bool total_last;
+    size_t total_bytes_in;
+    size_t parsing_allocations;
+} metrics_capture;
+
+static void capture_metrics(const apex_stage_metrics *metrics, void *user_data) {
+    metrics_capture *capture = (metrics_capture *)user_data;
+    capture->stages++;
+    capture->total_last = false;
+    if (metrics->skipped) {
+        capture->skipped++;
+    } else if (strcmp(metrics->stage, "parsing") == 0) {
+        capture->saw_parsing = true;
+        capture->parsing_allocations = metrics->allocations;
+    } else if (strcmp(metrics->stage, "total") == 0) {
+        capture->saw_total = true;
+        capture->total_last = true;
+        capture->total_bytes_in = metrics->bytes_in;
+    }
+}
+
+void test_conversion_metrics(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Conversion Metrics Tests", false, true);
+
+    apex_options opts = apex_options_default();
+    metrics_capture capture = {0};
+    opts.metrics_callback = capture_metrics;
+    opts.metrics_user_data = &capture;
+
+    char *html = apex_markdown_to_html("# Header\n\nText", 16, &opts);
+    assert_contains(html, "<h1", "Conversion with metrics callback");
+    test_result(capture.saw_parsing, "Parsing stage reported");
+    test_result(capture.parsing_allocations > 0, "Parsing stage counts cmark allocations");
+    test_result(capture.skipped > 0, "Stages that did not run reported as skipped");
+    test_result(capture.saw_total && capture.total_last, "Total reported last");
+    test_result(capture.total_bytes_in == 16, "Total bytes_in matches input length");
+    apex_free_string(html);
+
+    /* Aggregate two documents in a batch and dump as JSON */
+    apex_metrics_batch *batch = apex_metrics_batch_new();
+    opts.metrics_callback = apex_metrics_batch_record;
+    opts.metrics_user_data = batch;
+    html = apex_markdown_to_html("One", 3, &opts);
+    apex_free_string(html);
+    html = apex_markdown_to_html("Two", 3, &opts);
+    apex_free_string(html);
+    char *json = apex_metrics_batch_to_json(batch);
+    assert_contains(json, "\"documents\": 2", "Batch counts documents");
+    assert_contains(json, "{\"stage\": \"parsing\", \"runs\": 2", "Batch aggregates stage runs");
+    assert_contains(json, "\"histogram_us\": {", "Batch includes duration histogram");
+    apex_free_string(json);
+    apex_metrics_batch_free(batch);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Conversion Metrics Tests", had_failures, false);
+}
+
+/**
+ * Test that the per-conversion arena doesn't change output
+ */
+void test_conversion_arena(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Conversion Arena Tests", false, true);
+
+    const char *docs[] = {
+        "# Title {#main .big}\n\nPara with *emph*, [link](http://x.com){: .ext} and `code`.\n",
+        "| A | B |\n|---|---|\n| 1 | 2 |\n\nTerm\n: Definition\n\nText[^n]\n\n[^n]: Note\n\n    indented\n",
+        "> quote\n>\n> - item one\n> - item two\n\n```c\nint x;\n```\n\n![img](a.png){width=20}\n",
+    };
+
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        apex_options opts = apex_options_default();
+        char *with_arena = apex_markdown_to_html(docs[i], strlen(docs[i]), &opts);
+        opts.use_arena = false;
+        char *without_arena = apex_markdown_to_html(docs[i], strlen(docs[i]), &opts);
+        char name[64];
+        snprintf(name, sizeof(name), "Arena output matches malloc output (doc %zu)", i + 1);
+        test_result(with_arena && without_arena && strcmp(with_arena, without_arena) == 0, name);
+        apex_free_string(with_arena);
+        apex_free_string(without_arena);
+    }
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Conversion Arena Tests", had_failures, false);
+}
+
+/* Write text to a temporary file; returns the path (static buffer) */
+static const char *length_test_file(const char *text, size_t len) {
+    static char path[] = "/tmp/apex_length_test_XXXXXX";
+    strcpy(path, "/tmp/apex_length_test_XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) return NULL;
+    bool ok = write(fd, text, len) == (ssize_t)len;
+    close(fd);
+    return ok ? path : NULL;
+}
+
+void test_length_based_input(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Length-Based Input Tests", false, true);
+
+    apex_options opts = apex_options_default();
+    const char *doc = "# Title\n\nSome *text* and an ABBR.\n\n*[ABBR]: Abbreviation\n";
+    char *expected = apex_markdown_to_html(doc, strlen(doc), &opts);
+    assert_contains(expected, "<abbr title=\"Abbreviation\">ABBR</abbr>", "Abbreviation extracted");
+
+    /* A slice of a larger buffer with no NUL after it */
+    size_t len = strlen(doc);
+    char *slice = malloc(len + 16);
+    memcpy(slice, doc, len);
+    memset(slice + len, 'x', 16);
+    char *html = apex_markdown_to_html(slice, len, &opts);
+    test_result(expected && html && strcmp(expected, html) == 0, "Unterminated slice converts like the string");
+    apex_free_string(html);
+    free(slice);
+
+    /* Memory-mapped file entry point */
+    const char *path = length_test_file(doc, len);
+    html = path ? apex_markdown_file_to_html(path, &opts) : NULL;
+    test_result(expected && html && strcmp(expected, html) == 0, "Mapped file converts like the string");
+    apex_free_string(html);
+    if (path) unlink(path);
+
+    /* A file that ends exactly on a page boundary is not terminated by the mapping */
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0) {
+        char *full = malloc((size_t)page);
+        memset(full, 'a', (size_t)page);
+        full[0] = '#';
+        full[1] = ' ';
+        full[(size_t)page - 1] = '\n';
+        char *page_expected = apex_markdown_to_html(full, (size_t)page, &opts);
+        path = length_test_file(full, (size_t)page);
+        html = path ? apex_markdown_file_to_html(path, &opts) : NULL;
+        test_result(page_expected && html && strcmp(page_expected, html) == 0, "Page-sized file converts");
+        apex_free_string(html);
+        apex_free_string(page_expected);
+        if (path) unlink(path);
+        free(full);
+    }
+
+    test_result(apex_markdown_file_to_html("/nonexistent/apex.md", &opts) == NULL, "Missing file returns NULL");
+    apex_free_string(expected);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Length-Based Input Tests", had_failures, false);
+}
+
+/* Collects streamed output; stops after limit writes when limit > 0 */
+typedef struct {
+    char *data;
+    size_t len;
+    int writes;
+    int limit;
+} stream_capture;
+
+static int stream_capture_write(const char *html, size_t len, void *user_data) {
+    stream_capture *capture = (stream_capture *)user_data;
+    char *grown = realloc(capture->data, capture->len + len + 1);
+    if (!grown) return -1;
+    memcpy(grown + capture->len, html, len);
+    capture->data = grown;
+    capture->len += len;
+    capture->data[capture->len] = '\0';
+    capture->writes++;
+    return capture->limit > 0 && capture->writes >= capture->limit ? 1 : 0;
+}
+
+static char *stream_convert_in_chunks(const char *markdown, size_t chunk, const apex_options *opts, int *writes) {
+    stream_capture capture = { NULL, 0, 0, 0 };
+    apex_stream *stream = apex_stream_new(opts, stream_capture_write, &capture);
+    if (!stream) return NULL;
+    size_t len = strlen(markdown);
+    for (size_t pos = 0; pos < len; pos += chunk) {
+        apex_stream_feed(stream, markdown + pos, len - pos < chunk ? len - pos : chunk);
+    }
+    apex_stream_finish(stream);
+    apex_stream_free(stream);
+    if (writes) *writes = capture.writes;
+    return capture.data ? capture.data : strdup("");
+}
+
+void test_streaming_conversion(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Streaming Conversion Tests", false, true);
+
+    const char *docs[] = {
+        "Title: Streamed\n\n# [%title]\n\nFirst *para*.\n\n```\ncode\n\nstill code\n```\n\nLast para.\n",
+        "# One\n\n<div markdown=\"1\">\n\n**inside**\n\n</div>\n\n- a\n\n- b\n\nTerm\n: Def\n\nDone\n",
+        "Intro\n\nText[^n] with [a ref][r].\n\n[^n]: Note\n\n[r]: http://example.com\n",
+        "| A | B |\n|---|---|\n| 1 | 2 |\n\n> quote\n\n::: note\nDiv\n\nbody\n:::\n\nend",
+    };
+    size_t chunks[] = { 1, 7, 4096 };
+
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        apex_options opts = apex_options_default();
+        char *expected = apex_markdown_to_html(docs[i], strlen(docs[i]), &opts);
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            char *streamed = stream_convert_in_chunks(docs[i], chunks[c], &opts, NULL);
+            char name[80];
+            snprintf(name, sizeof(name), "Streamed output matches (doc %zu, %zu-byte chunks)", i + 1, chunks[c]);
+            test_result(expected && streamed && strcmp(expected, streamed) == 0, name);
+            free(streamed);
+        }
+        apex_free_string(expected);
+    }
+
+    /* Closed blocks are written before the input ends */
+    const char *long_doc = "# One\n\nPara one\n\n# Two\n\nPara two\n\n# Three\n";
+    apex_options opts = apex_options_default();
+    int writes = 0;
+    char *streamed = stream_convert_in_chunks(long_doc, 8, &opts, &writes);
+    test_result(writes > 1, "Blocks are written incrementally");
+    assert_contains(streamed, "Three</h1>", "Last block written at finish");
+    free(streamed);
+
+    /* Repeated headings in different segments still get unique IDs */
+    const char *repeated = "# Intro\n\nText\n\n# Intro\n\nMore\n\n## Intro\n\nEnd\n";
+    char *whole = apex_markdown_to_html(repeated, strlen(repeated), &opts);
+    streamed = stream_convert_in_chunks(repeated, 5, &opts, NULL);
+    test_result(whole && streamed && strcmp(whole, streamed) == 0, "Streamed repeated headings match");
+    assert_contains(streamed, "id=\"intro-2\"", "Streamed repeated heading gets a suffix");
+    apex_free_string(whole);
+    free(streamed);
+
+    /* Pretty output matches the one-shot formatter */
+    opts.pretty = true;
+    char *expected = apex_markdown_to_html(long_doc, strlen(long_doc), &opts);
+    streamed = stream_convert_in_chunks(long_doc, 3, &opts, NULL);
+    test_result(expected && streamed && strcmp(expected, streamed) == 0, "Streamed pretty output matches");
+    apex_free_string(expected);
+    free(streamed);
+
+    /* A write callback can stop the stream */
+    stream_capture capture = { NULL, 0, 0, 1 };
+    apex_stream *stream = apex_stream_new(NULL, stream_capture_write, &capture);
+    int status = apex_stream_feed(stream, long_doc, strlen(long_doc));
+    test_result(status == -1, "Stopped write fails the feed");
+    test_result(apex_stream_finish(stream) == -1, "Stopped stream cannot finish");
+    apex_stream_free(stream);
+    free(capture.data);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Streaming Conversion Tests", had_failures, false);
+}
+
+void test_incremental_render(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Incremental Render Tests", false, true);
+
+    const char *versions[] = {
+        "Title: Live\n\n# [%title]\n\nFirst para.\n\n```\ncode\n\nmore\n```\n\nMiddle para.\n\n- a\n- b\n\nLast para.\n",
+        "Title: Live\n\n# [%title]\n\nFirst para.\n\n```\ncode\n\nmore\n```\n\nMiddle *edited* para.\n\n- a\n- b\n\nLast para.\n",
+        "Title: Live\n\n# [%title]\n\nFirst para.\n\n```\ncode\n\nmore\n```\n\nMiddle *edited* para.\n\nInserted.\n\n- a\n- b\n\nLast para.\n",
+        "Title: Renamed\n\n# [%title]\n\nFirst para.\n\n```\ncode\n\nmore\n```\n\nMiddle *edited* para.\n\nInserted.\n\n- a\n- b\n\nLast para.\n",
+        "Title: Renamed\n\n# [%title]\n\nFirst para with [a ref][r].\n\nLast para.\n\n[r]: http://example.com\n",
+    };
+    size_t min_reused[] = { 0, 4, 4, 0, 0 };
+
+    apex_options opts = apex_options_default();
+    apex_incremental *inc = apex_incremental_new(NULL);
+    test_result(inc != NULL, "Incremental renderer created");
+
+    for (size_t i = 0; inc && i < sizeof(versions) / sizeof(versions[0]); i++) {
+        char *expected = apex_markdown_to_html(versions[i], strlen(versions[i]), &opts);
+        char *html = apex_incremental_render(inc, versions[i], strlen(versions[i]), &opts);
+        char name[80];
+        snprintf(name, sizeof(name), "Incremental output matches (version %zu)", i + 1);
+        test_result(expected && html && strcmp(expected, html) == 0, name);
+        snprintf(name, sizeof(name), "Unchanged blocks reused (version %zu)", i + 1);
+        test_result(apex_incremental_reused(inc) >= min_reused[i], name);
+        apex_free_string(html);
+        apex_free_string(expected);
+    }
+
+    /* Renaming a heading changes the suffixes of later repeats, which are
+     * rendered again even though their text did not change */
+    const char *headings[] = {
+        "Lead para.\n\n# Intro\n\nA\n\n# Other\n\nB\n\n# Intro\n\nC\n",
+        "Lead para.\n\n# Intro\n\nA\n\n# Intro\n\nB\n\n# Intro\n\nC\n",
+        "Lead para.\n\n# Intro\n\nA\n\n# Other\n\nB\n\n# Intro\n\nC\n",
+        "Lead para.\n\n# Intro\n\nA\n\n# Other\n\nB edited\n\n# Intro\n\nC\n",
+    };
+    apex_incremental_reset(inc);
+    for (size_t i = 0; inc && i < sizeof(headings) / sizeof(headings[0]); i++) {
+        char *expected = apex_markdown_to_html(headings[i], strlen(headings[i]), &opts);
+        char *html = apex_incremental_render(inc, headings[i], strlen(headings[i]), &opts);
+        char name[80];
+        snprintf(name, sizeof(name), "Incremental heading IDs match (version %zu)", i + 1);
+        test_result(expected && html && strcmp(expected, html) == 0, name);
+        apex_free_string(html);
+        apex_free_string(expected);
+    }
+    test_result(apex_incremental_reused(inc) >= 5, "Edit that keeps heading IDs reuses later headings");
+
+    /* Options that need the whole document still render correctly */
+    opts.standalone = true;
+    apex_incremental_reset(inc);
+    char *html = apex_incremental_render(inc, versions[0], strlen(versions[0]), &opts);
+    assert_contains(html, "<!DOCTYPE html>", "Standalone render is whole");
+    test_result(apex_incremental_reused(inc) == 0, "Whole render reuses nothing");
+    apex_free_string(html);
+
+    apex_incremental_free(inc);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Incremental Render Tests", had_failures, false);
+}
+
+void test_parsed_documents(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Parsed Document Tests", false, true);
+
+    const char *docs[] = {
+        "Title: Cached\n\n# [%title] {#top}\n\nA *para* with an ABBR and a [link](http://example.com \"T\").\n\n"
+        "| A | B |\n|:--|--:|\n| 1 | 2 |\n\n- [x] done\n- [ ] todo\n\n~~gone~~ and {% raw %}kept{% endraw %}\n\n"
+        "```c\nint x;\n```\n\n*[ABBR]: Abbreviation\n",
+        "{:note: .special}\n\nPara\n{: note}\n\nTerm\n: Definition\n\n> quote\n\n1. one\n2. two\n",
+    };
+
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        apex_options opts = apex_options_default();
+        apex_document *doc = apex_parse_document(docs[i], strlen(docs[i]), &opts);
+        test_result(doc != NULL, "Document parsed");
+        if (!doc) continue;
+
+        /* One parse, rendered with different output options */
+        for (int variant = 0; variant < 3; variant++) {
+            apex_options render_opts = opts;
+            render_opts.standalone = variant == 1;
+            render_opts.pretty = variant == 1;
+            render_opts.enable_aria = variant == 2;
+            char *expected = apex_markdown_to_html(docs[i], strlen(docs[i]), &render_opts);
+            char *rendered = apex_render_document(doc, &render_opts);
+            char name[80];
+            snprintf(name, sizeof(name), "Rendered document matches (doc %zu, variant %d)", i + 1, variant);
+            test_result(expected && rendered && strcmp(expected, rendered) == 0, name);
+            apex_free_string(rendered);
+            apex_free_string(expected);
+        }
+
+        /* Round trip through a cache file */
+        char path[] = "/tmp/apex_document_test_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd >= 0) close(fd);
+        test_result(fd >= 0 && apex_document_save(doc, path) == 0, "Document saved");
+
+        apex_document *loaded = apex_document_load(path, &opts);
+        char *expected = apex_render_document(doc, &opts);
+        char *rendered = loaded ? apex_render_document(loaded, &opts) : NULL;
+        test_result(expected && rendered && strcmp(expected, rendered) == 0, "Loaded document renders the same");
+        apex_free_string(rendered);
+        apex_free_string(expected);
+        apex_document_free(loaded);
+
+        apex_options other_opts = opts;
+        other_opts.mode = APEX_MODE_COMMONMARK;
+        loaded = apex_document_load(path, &other_opts);
+        test_result(loaded == NULL, "Cache parsed with other options is rejected");
+        apex_document_free(loaded);
+
+        unlink(path);
+        apex_document_free(doc);
+    }
+
+    /* Footnotes render from a parsed document but are not cached */
+    const char *footnotes = "Text[^n].\n\n[^n]: Note\n";
+    apex_options opts = apex_options_default();
+    apex_document *doc = apex_parse_document(footnotes, strlen(footnotes), &opts);
+    char *expected = apex_markdown_to_html(footnotes, strlen(footnotes), &opts);
+    char *rendered = doc ? apex_render_document(doc, &opts) : NULL;
+    test_result(expected && rendered && strcmp(expected, rendered) == 0, "Footnote document renders");
+    test_result(doc && apex_document_save(doc, "/tmp/apex_document_footnotes") == -1, "Footnote document is not saved");
+    apex_free_string(rendered);
+    apex_free_string(expected);
+    apex_document_free(doc);
+
+    test_result(apex_document_load("/nonexistent/apex.cache", &opts) == NULL, "Missing cache returns NULL");
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Parsed Document Tests", had_failures, false);
+}
+
+void test_conversion_contexts(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Conversion Context Tests", false, true);
+
+    apex_options opts = apex_options_default();
+    opts.enable_citations = true;
+    opts.base_directory = "tests";
+    const char *bib_files[] = { "test_refs.bib", NULL };
+    opts.bibliography_files = (char **)bib_files;
+
+    apex_context *context = apex_context_new(&opts);
+    test_result(context != NULL, "Context created");
+
+    /* A warm context converts exactly like a cold conversion, repeatedly */
+    const char *docs[] = {
+        "See [@doe99] and [@smith2000].\n",
+        "# Heading\n\nPlain *text* only.\n",
+        "---\ntitle: Meta\n---\n\n[%title] cites [@doe99].\n",
+    };
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+            char *expected = apex_markdown_to_html(docs[i], strlen(docs[i]), &opts);
+            char *html = apex_context_convert(context, docs[i], strlen(docs[i]), NULL);
+            char name[80];
+            snprintf(name, sizeof(name), "Context output matches (doc %zu, round %d)", i + 1, round + 1);
+            test_result(expected && html && strcmp(expected, html) == 0, name);
+            apex_free_string(html);
+            apex_free_string(expected);
+        }
+    }
+
+    /* Per-call options override everything except the loaded state */
+    apex_options standalone = opts;
+    standalone.standalone = true;
+    char *html = apex_context_convert(context, docs[0], strlen(docs[0]), &standalone);
+    assert_contains(html, "<!DOCTYPE html>", "Per-call options apply");
+    assert_contains(html, "doe99", "Shared bibliography still used");
+    apex_free_string(html);
+
+    apex_context_free(context);
+    apex_context_free(NULL);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Conversion Context Tests", had_failures, false);
+}
+
 /**
  * Test GFM features
  */
@@ -72,3 +514,53 @@ void test_gfm_features(void) {
 /**
  * Test metadata
  */
+
+void test_standalone_parser(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Standalone Parser Tests", false, true);
+
+    /* Expected output is what the pointer-per-node parser produced */
+    static const struct {
+        const char *markdown;
+        const char *html;
+    } cases[] = {
+        { "# Title\n\nA paragraph\nspanning lines.\n\n## Sub & <more>\n",
+          "<h1>Title</h1>\n<p>A paragraph\nspanning lines.</p>\n<h2>Sub &amp; &lt;more&gt;</h2>\n" },
+        { "```c\nint x < 1;\n```\n\nAfter\n",
+          "<pre><code class=\"language-c\">int x &lt; 1;\n</code></pre>\n<p>After</p>\n" },
+        { "###### Six\n####### Seven\n",
+          "<h6>Six</h6>\n<p>####### Seven</p>\n" },
+        { "#NoSpace\n\n\n\nLast",
+          "<p>#NoSpace</p>\n<p>Last</p>\n" },
+        { "```\nplain\n```",
+          "<pre><code>plain\n</code></pre>\n" },
+        { "", "" },
+    };
+
+    apex_options opts = apex_options_default();
+    void *parser = apex_parser_new(&opts);
+    test_result(parser != NULL, "Parser created");
+
+    for (size_t i = 0; parser && i < sizeof(cases) / sizeof(cases[0]); i++) {
+        apex_tree *tree = apex_parse(parser, cases[i].markdown, strlen(cases[i].markdown));
+        char *html = tree ? apex_render_html(tree, &opts) : NULL;
+        char name[64];
+        snprintf(name, sizeof(name), "apex_parse output matches (case %zu)", i + 1);
+        test_result(html && strcmp(html, cases[i].html) == 0, name);
+        free(html);
+        apex_tree_free(tree);
+    }
+
+    /* Old names still work on the tree */
+    const char *text = "# Old API\n";
+    apex_node *root = parser ? apex_parse(parser, text, strlen(text)) : NULL;
+    char *html = root ? apex_render_html(root, &opts) : NULL;
+    test_result(html && strcmp(html, "<h1>Old API</h1>\n") == 0, "apex_node alias renders");
+    free(html);
+    apex_node_free(root);
+
+    apex_parser_free(parser);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Standalone Parser Tests", had_failures, false);
+}
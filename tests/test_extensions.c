@@ -174,6 +174,19 @@ void test_processor_modes(void) {
     print_suite_title("Processor Modes Tests", had_failures, false);
 }
 
+/* Dependency callback for the include tests: counts the fixtures reported */
+typedef struct {
+    int simple;
+    int csv;
+} include_dependencies;
+
+static void note_include_dependency(const char *path, void *user_data) {
+    include_dependencies *deps = user_data;
+    size_t len = strlen(path);
+    if (len >= 9 && strcmp(path + len - 9, "simple.md") == 0) deps->simple++;
+    if (len >= 8 && strcmp(path + len - 8, "data.csv") == 0) deps->csv++;
+}
+
 /**
  * Test file includes
  */
@@ -232,6 +245,48 @@ void test_file_includes(void) {
     assert_contains(html, "Widget", "TSV data in table");
     apex_free_string(html);
 
+    /* Test streamed CSV include of the whole file */
+    html = apex_markdown_to_html("{{data.csv}}[rows=1-]", 21, &opts);
+    assert_contains(html, "<th>Name</th>", "Streamed CSV header cell");
+    assert_contains(html, "<td>Charlie</td>", "Streamed CSV data cell");
+    assert_not_contains(html, "APEXCSV", "Streamed CSV placeholder replaced");
+    apex_free_string(html);
+
+    /* Test streamed CSV include survives safe mode */
+    opts.unsafe = false;
+    html = apex_markdown_to_html("{{data.csv}}[rows=1-]", 21, &opts);
+    assert_contains(html, "<td>Charlie</td>", "Streamed CSV in safe mode");
+    assert_not_contains(html, "APEXCSV", "Streamed CSV placeholder replaced in safe mode");
+    apex_free_string(html);
+    opts.unsafe = true;
+
+    /* Test that an HTML comment in the source cannot request a table */
+    const char *forged = "<!--APEX_CSV_TABLE tsv=0 rows=1- cols=\"\" path=\"data.csv\"-->";
+    html = apex_markdown_to_html(forged, strlen(forged), &opts);
+    assert_not_contains(html, "<td>Alice</td>", "Forged table comment is not expanded");
+    apex_free_string(html);
+
+    /* Test that <<{} stays a raw include and does not stream CSV */
+    html = apex_markdown_to_html("<<{data.csv}", 12, &opts);
+    assert_not_contains(html, "<th>Name</th>", "Raw CSV include is not streamed");
+    apex_free_string(html);
+
+    /* Test streamed CSV include with row limit and column selection */
+    html = apex_markdown_to_html("{{data.csv}}[rows=1 cols=City,Name]", 35, &opts);
+    assert_contains(html, "<th>City</th>\n<th>Name</th>", "Streamed CSV selects columns in order");
+    assert_contains(html, "<td>Alice</td>", "Streamed CSV includes first row");
+    assert_not_contains(html, "Bob", "Streamed CSV honors row limit");
+    assert_not_contains(html, "<th>Age</th>", "Streamed CSV drops unselected columns");
+    apex_free_string(html);
+
+    /* Test streamed TSV include with row range */
+    html = apex_markdown_to_html("<<[data.tsv][rows=2-3 cols=1,3]", 31, &opts);
+    assert_contains(html, "<td>Gadget</td>", "Streamed TSV row range start");
+    assert_contains(html, "<td>75</td>", "Streamed TSV row range end");
+    assert_not_contains(html, "Widget", "Streamed TSV skips rows before range");
+    assert_not_contains(html, "$25", "Streamed TSV drops unselected column");
+    apex_free_string(html);
+
     /* Test iA Writer image include */
     html = apex_markdown_to_html("/image.png", 10, &opts);
     assert_contains(html, "<img", "iA Writer image include");
@@ -360,6 +415,28 @@ void test_file_includes(void) {
     }
     apex_free_string(html);
 
+    /* Every file a conversion includes is reported, also when an
+     * incremental render keeps the blocks that included them */
+    include_dependencies deps = {0, 0};
+    apex_options dep_opts = opts;
+    dep_opts.dependency_callback = note_include_dependency;
+    dep_opts.dependency_user_data = &deps;
+    const char *dep_doc = "<<[simple.md]\n\nPara.\n\n{{data.csv}}[rows=1-]\n";
+    html = apex_markdown_to_html(dep_doc, strlen(dep_doc), &dep_opts);
+    test_result(deps.simple > 0, "Markdown include reported as a dependency");
+    test_result(deps.csv > 0, "Streamed CSV include reported as a dependency");
+    apex_free_string(html);
+
+    apex_incremental *inc = apex_incremental_new(NULL);
+    html = apex_incremental_render(inc, dep_doc, strlen(dep_doc), &dep_opts);
+    apex_free_string(html);
+    const char *dep_edited = "<<[simple.md]\n\nPara, edited.\n\n{{data.csv}}[rows=1-]\n";
+    deps.simple = deps.csv = 0;
+    html = apex_incremental_render(inc, dep_edited, strlen(dep_edited), &dep_opts);
+    test_result(deps.simple > 0 && deps.csv > 0, "Kept incremental blocks report their includes");
+    apex_free_string(html);
+    apex_incremental_free(inc);
+
     bool had_failures = suite_end(suite_failures);
     print_suite_title("File Includes Tests", had_failures, false);
 }
@@ -665,6 +742,17 @@ void test_html_markdown_attributes(void) {
     assert_contains(html, "<div>", "HTML preserved without markdown attribute");
     apex_free_string(html);
 
+    /* Several blocks share one fragment parser; each must parse independently */
+    const char *several = "<div markdown=\"1\">\n# First\n</div>\n\n"
+                          "<span markdown=\"span\">*second*</span>\n\n"
+                          "<div markdown=\"1\">\n- third\n</div>";
+    html = apex_markdown_to_html(several, strlen(several), &opts);
+    assert_contains(html, "<h1>First</h1>", "First markdown block parsed");
+    assert_contains(html, "<em>second</em>", "Span block after block parsed");
+    assert_contains(html, "<li>third</li>", "Third markdown block parsed");
+    assert_not_contains(html, "<h1>third", "Blocks do not leak into each other");
+    apex_free_string(html);
+
     bool had_failures = suite_end(suite_failures);
     print_suite_title("HTML Markdown Attributes Tests", had_failures, false);
 }
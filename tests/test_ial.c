@@ -34,6 +34,13 @@ void test_ial(void) {
     assert_contains(html, "class=\"myclass\"", "Block IAL class with ID");
     apex_free_string(html);
 
+    /* Next-line IAL merges with a manual header ID instead of replacing it */
+    const char *merged_md = "# Title {#main}\n{: .note}";
+    html = apex_markdown_to_html(merged_md, strlen(merged_md), &opts);
+    assert_contains(html, "id=\"main\"", "Next-line IAL keeps manual header ID");
+    assert_contains(html, "class=\"note\"", "Next-line IAL adds class to header with ID");
+    apex_free_string(html);
+
     /* Test block IAL with custom attributes - skip for now (complex quoting) */
     // html = apex_markdown_to_html("Para\n{: data-value=\"test\"}", 27, &opts);
     // assert_contains(html, "data-value=\"test\"", "Block IAL custom attribute");
@@ -145,6 +152,12 @@ void test_ial(void) {
     assert_contains(html, "class=\"spaced-class\"", "Inline IAL with spaces");
     apex_free_string(html);
 
+    /* Attributes go on their own node even when an earlier one reads the same */
+    const char *same_text = "Same text\n\nSame text\n\n{: .second}";
+    html = apex_markdown_to_html(same_text, strlen(same_text), &opts);
+    assert_contains(html, "<p>Same text</p>\n<p class=\"second\">Same text</p>", "Block IAL on the second of two like paragraphs");
+    apex_free_string(html);
+
     bool had_failures = suite_end(suite_failures);
     print_suite_title("IAL Tests", had_failures, false);
 }
@@ -265,6 +265,18 @@ void test_image_embedding(void) {
     assert_contains(html, "data:image/png;base64,", "Absolute path image embedded regardless of base_directory");
     apex_free_string(html);
 
+    /* Test that repeated embeds come from the image cache and encode correctly */
+    opts.base_directory = TEST_FIXTURES_DIR;
+    const char *repeat_image_md = "![One](test_image.png)\n\n![Two](test_image.png)";
+    html = apex_markdown_to_html(repeat_image_md, strlen(repeat_image_md), &opts);
+    assert_contains(html, "MDB+tE4YAAAAAElFTkSuQmCC\"", "Embedded image base64 payload is complete");
+    assert_not_contains(html, "test_image.png", "Repeated image embedded each time");
+    char *second_html = apex_markdown_to_html(repeat_image_md, strlen(repeat_image_md), &opts);
+    test_result(html && second_html && strcmp(html, second_html) == 0, "Cached image embedding matches first encoding");
+    apex_free_string(second_html);
+    apex_free_string(html);
+    apex_image_cache_clear();
+
     bool had_failures = suite_end(suite_failures);
     print_suite_title("Image Embedding Tests", had_failures, false);
 }
@@ -360,6 +372,43 @@ void test_image_width_height_conversion(void) {
     assert_contains(html, "width=\"0\"", "Zero pixel converted to integer");
     apex_free_string(html);
 
+    /* Test 15: Attributes stay with their image when an earlier image has none */
+    const char *positions = "![a](first.jpg) ![b](second.jpg width=120)";
+    html = apex_markdown_to_html(positions, strlen(positions), &opts);
+    const char *width_at = html ? strstr(html, "width=\"120\"") : NULL;
+    const char *second_at = html ? strstr(html, "second.jpg") : NULL;
+    test_result(width_at && second_at && width_at > second_at, "Width applied to the image that declared it");
+    apex_free_string(html);
+
+    /* Test 16: Reference definition attributes apply to every image using it */
+    const char *shared = "![one][logo] and ![two][logo]\n\n[logo]: logo.png width=40";
+    html = apex_markdown_to_html(shared, strlen(shared), &opts);
+    const char *first_width = html ? strstr(html, "width=\"40\"") : NULL;
+    test_result(first_width && strstr(first_width + 1, "width=\"40\""), "Reference attributes on each image");
+    assert_not_contains(html, "[logo]", "Reference definition resolved");
+    apex_free_string(html);
+
+    /* Test 17: An inline image sharing a definition's URL keeps its own attributes */
+    const char *same_url = "![inline](logo.png) and ![ref][logo]\n\n[logo]: logo.png width=40";
+    html = apex_markdown_to_html(same_url, strlen(same_url), &opts);
+    const char *inline_img = html ? strstr(html, "<img") : NULL;
+    const char *inline_end = inline_img ? strchr(inline_img, '>') : NULL;
+    const char *ref_img = inline_end ? strstr(inline_end, "<img") : NULL;
+    const char *ref_width = ref_img ? strstr(ref_img, "width=\"40\"") : NULL;
+    const char *inline_width = inline_img ? strstr(inline_img, "width=\"40\"") : NULL;
+    test_result(inline_width && inline_width == ref_width, "Definition attributes only on the reference image");
+    apex_free_string(html);
+
+    /* Test 18: Image syntax in code is not counted among the document's images */
+    const char *code_example = "```\n![example](x.png)\n```\n\nSee `![span](y.png)` here.\n\n![real](a.png width=10)";
+    html = apex_markdown_to_html(code_example, strlen(code_example), &opts);
+    const char *real_img = html ? strstr(html, "<img src=\"a.png\"") : NULL;
+    const char *real_end = real_img ? strchr(real_img, '>') : NULL;
+    const char *real_width = real_img ? strstr(real_img, "width=\"10\"") : NULL;
+    test_result(real_width && real_width < real_end, "Attributes land on the image after a code example");
+    assert_contains(html, "![example](x.png)", "Image example left as code");
+    apex_free_string(html);
+
     bool had_failures = suite_end(suite_failures);
     print_suite_title("Image Width/Height Conversion Tests", had_failures, false);
 }
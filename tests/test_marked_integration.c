@@ -34,6 +34,12 @@ void test_marked_integration_features(void) {
     }
     apex_free_string(html);
 
+    const char *widont_raw = "<h2>raw is me</h2>\n\n# woe is me";
+    html = apex_markdown_to_html(widont_raw, strlen(widont_raw), &opts);
+    assert_contains(html, "<h2>raw is me</h2>", "Widont leaves raw HTML headings alone");
+    assert_contains(html, "woe&nbsp;is&nbsp;me", "Widont applies to the heading after a raw one");
+    apex_free_string(html);
+
     /* Test code-is-poetry feature */
     opts = apex_options_default();
     opts.code_is_poetry = true;
@@ -116,6 +116,13 @@ void test_mmd_metadata_keys(void) {
     assert_contains(html, "Header 2</h3>", "Base Header Level: h2 content in h3 tag");
     apex_free_string(html);
 
+    /* Headings written in raw HTML keep their level */
+    const char *base_header_raw = "Base Header Level: 2\n\n<h1>Raw</h1>\n\n# Header 1";
+    html = apex_markdown_to_html(base_header_raw, strlen(base_header_raw), &opts);
+    assert_contains(html, "<h1>Raw</h1>", "Base Header Level: raw HTML heading unchanged");
+    assert_contains(html, "Header 1</h2>", "Base Header Level: h1 after raw heading becomes h2");
+    apex_free_string(html);
+
     /* Test HTML Header Level (format-specific) */
     const char *html_header_level_doc = "HTML Header Level: 3\n\n# Header 1";
     html = apex_markdown_to_html(html_header_level_doc, strlen(html_header_level_doc), &opts);
@@ -71,6 +71,73 @@ void test_toc(void) {
     assert_contains(html, "Level 3", "L3 nested in TOC");
     apex_free_string(html);
 
+    /* Several markers: a full TOC, then one per chapter listing only the
+     * chapter's own sections */
+    const char *chapters =
+        "{{TOC}}\n\n"
+        "# Chapter One\n\n{{TOC:2-3}}\n\n## Alpha\n\n### Alpha Detail\n\n"
+        "# Chapter Two\n\n{{TOC:2-3}}\n\n## Beta\n";
+    html = apex_markdown_to_html(chapters, strlen(chapters), &opts);
+    test_result(html && strstr(html, "{{TOC") == NULL, "Every TOC marker replaced");
+    {
+        const char *full = html ? strstr(html, "<nav class=\"toc\">") : NULL;
+        const char *first = full ? strstr(full + 1, "<nav class=\"toc\">") : NULL;
+        const char *second = first ? strstr(first + 1, "<nav class=\"toc\">") : NULL;
+        const char *first_end = first ? strstr(first, "</nav>") : NULL;
+        const char *second_end = second ? strstr(second, "</nav>") : NULL;
+        const char *full_end = full ? strstr(full, "</nav>") : NULL;
+        const char *full_beta = full ? strstr(full, "href=\"#beta\"") : NULL;
+        const char *first_alpha = first ? strstr(first, "href=\"#alpha-detail\"") : NULL;
+        const char *first_beta = first ? strstr(first, "href=\"#beta\"") : NULL;
+        const char *second_beta = second ? strstr(second, "href=\"#beta\"") : NULL;
+        const char *second_alpha = second ? strstr(second, "href=\"#alpha\"") : NULL;
+        test_result(full_beta && full_beta < full_end, "Top TOC lists the whole document");
+        test_result(first_alpha && first_alpha < first_end && (!first_beta || first_beta > first_end),
+                    "Chapter TOC lists only its own sections");
+        test_result(second_beta && second_beta < second_end && !second_alpha,
+                    "Second chapter TOC scoped to its chapter");
+    }
+    apex_free_string(html);
+
+    /* A raw HTML heading is not one of the document's headings: it must not
+     * move a scoped marker into the next chapter or take a heading's ID */
+    const char *raw_heading =
+        "# Chapter One\n\n## Alpha\n\n<h2>Raw</h2>\n\n{{TOC:2-3}}\n\n"
+        "# Chapter Two\n\n## Beta\n";
+    html = apex_markdown_to_html(raw_heading, strlen(raw_heading), &opts);
+    {
+        const char *toc = html ? strstr(html, "<nav class=\"toc\">") : NULL;
+        const char *toc_end = toc ? strstr(toc, "</nav>") : NULL;
+        const char *alpha = toc ? strstr(toc, "href=\"#alpha\"") : NULL;
+        const char *beta = toc ? strstr(toc, "href=\"#beta\"") : NULL;
+        test_result(alpha && alpha < toc_end && (!beta || beta > toc_end),
+                    "Raw HTML heading does not shift TOC scope");
+    }
+    assert_contains(html, "<h2>Raw</h2>", "Raw HTML heading keeps its markup");
+    assert_contains(html, "id=\"chapter-two\"", "Heading after raw HTML heading keeps its ID");
+    apex_free_string(html);
+
+    /* Markers shown in code blocks and code spans are left as text */
+    const char *code_markers =
+        "# Title\n\n{{TOC}}\n\n## Section\n\n```\n{{TOC}}\n```\n\nWrite `{{TOC:2-3}}` to scope it.\n";
+    html = apex_markdown_to_html(code_markers, strlen(code_markers), &opts);
+    {
+        const char *nav = html ? strstr(html, "<nav class=\"toc\">") : NULL;
+        test_result(nav && !strstr(nav + 1, "<nav class=\"toc\">"), "Only the marker outside code becomes a TOC");
+    }
+    assert_contains(html, "<code>{{TOC}}\n</code>", "Marker in code block left as text");
+    assert_contains(html, "<code>{{TOC:2-3}}</code>", "Marker in code span left as text");
+    apex_free_string(html);
+
+    /* Omitted raw HTML (GFM renders it as a comment) holds no heading tag */
+    apex_options gfm_opts = apex_options_for_mode(APEX_MODE_GFM);
+    const char *omitted_heading = "<h2>Raw</h2>\n\n# Real Heading\n\n## Second\n";
+    html = apex_markdown_to_html(omitted_heading, strlen(omitted_heading), &gfm_opts);
+    assert_not_contains(html, "<h2>Raw</h2>", "GFM omits raw HTML heading");
+    assert_contains(html, "id=\"real-heading\"", "Heading after omitted raw HTML keeps its ID");
+    assert_contains(html, "id=\"second\"", "Later heading after omitted raw HTML keeps its ID");
+    apex_free_string(html);
+
     /* Kramdown-specific TOC syntax: {:toc} and {:.no_toc} */
     apex_options kram_opts = apex_options_for_mode(APEX_MODE_KRAMDOWN);
     /* Ensure marked extensions (including TOC) are enabled in Kramdown mode */
@@ -177,6 +244,33 @@ void test_standalone_output(void) {
     }
     apex_free_string(html);
 
+    /* Test embedded stylesheet (read once, then served from the cache) */
+    const char *embed_paths[] = { "embed.css", NULL };
+#ifdef TEST_FIXTURES_DIR
+    opts.base_directory = TEST_FIXTURES_DIR;
+#else
+    opts.base_directory = "tests/fixtures/includes";
+#endif
+    opts.stylesheet_paths = embed_paths;
+    opts.stylesheet_count = 1;
+    opts.embed_stylesheet = true;
+    html = apex_markdown_to_html("Content", 7, &opts);
+    assert_contains(html, "  <style>\n/* Embedded stylesheet fixture */\nbody {", "Embedded CSS in style tag");
+    assert_not_contains(html, "href=\"embed.css\"", "No link tag for embedded CSS");
+    char *again = apex_markdown_to_html("Content", 7, &opts);
+    test_result(html && again && strcmp(html, again) == 0, "Cached stylesheet produces identical output");
+    apex_free_string(again);
+    apex_free_string(html);
+
+    opts.minify_embedded_stylesheet = true;
+    html = apex_markdown_to_html("Content", 7, &opts);
+    assert_contains(html, "  <style>\nbody{color: #333}p,li{margin: 0 0 1em}\n  </style>", "Minified embedded CSS");
+    apex_free_string(html);
+    apex_stylesheet_cache_clear();
+    opts.embed_stylesheet = false;
+    opts.minify_embedded_stylesheet = false;
+    opts.base_directory = NULL;
+
     /* Test default title */
     opts.document_title = NULL;
     opts.stylesheet_paths = NULL;
@@ -250,6 +344,20 @@ void test_pretty_html(void) {
     assert_contains(html, "    <tr>", "Table rows further indented");
     apex_free_string(html);
 
+    /* Test standalone documents are formatted the same as a separate pass */
+    apex_options doc_opts = apex_options_default();
+    doc_opts.standalone = true;
+    doc_opts.relaxed_tables = false;
+    html = apex_markdown_to_html(table, strlen(table), &doc_opts);
+    char *expected = apex_pretty_print_html(html);
+    apex_free_string(html);
+    doc_opts.pretty = true;
+    html = apex_markdown_to_html(table, strlen(table), &doc_opts);
+    test_result(html && expected && strcmp(html, expected) == 0, "Standalone pretty output matches pretty-print pass");
+    assert_contains(html, "  <head>\n", "Standalone head indented");
+    apex_free_string(expected);
+    apex_free_string(html);
+
     /* Test that non-pretty mode is compact */
     apex_options compact_opts = apex_options_default();
     compact_opts.pretty = false;
@@ -406,6 +514,16 @@ void test_header_ids(void) {
     assert_contains(html, "href=\"#main-title\"", "TOC link uses GFM ID");
     apex_free_string(html);
 
+    /* Repeated headings get unique IDs, and the TOC links to them */
+    const char *dup_doc = "# Notes\n\n<!--TOC-->\n\n## Notes\n\n## Notes\n\n## Other [notes-1]";
+    html = apex_markdown_to_html(dup_doc, strlen(dup_doc), &opts);
+    assert_contains(html, "<h1 id=\"notes\">", "First repeated heading keeps its ID");
+    assert_contains(html, "<h2 id=\"notes-2\">", "Repeated heading skips an ID taken manually");
+    assert_contains(html, "<h2 id=\"notes-3\">", "Third repeated heading gets next suffix");
+    assert_contains(html, "href=\"#notes-3\"", "TOC links to deduplicated ID");
+    assert_contains(html, "href=\"#notes-1\"", "TOC links to manual ID");
+    apex_free_string(html);
+
     /* Test TOC with MMD format */
     opts.id_format = 1;  /* MMD format */
     html = apex_markdown_to_html(toc_doc, strlen(toc_doc), &opts);
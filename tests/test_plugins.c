@@ -15,10 +15,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Not in a public header, but we want to cover it. */
 char *apex_run_preparse_plugin_env(const char *text, const apex_options *options);
+int apex_plugins_rebuild_index(const apex_options *options);
 
 static int mkdir_p(const char *path) {
     if (!path || !*path) return -1;
@@ -71,6 +73,9 @@ static void plugin_test_cb(void *vctx) {
      *  $XDG_CONFIG_HOME/apex/plugins/a-regex/plugin.yml
      *  $XDG_CONFIG_HOME/apex/plugins/b-handler/plugin.yml + handler.py
      *  $XDG_CONFIG_HOME/apex/plugins/c-post/plugin.yml + handler.py
+     *  $XDG_CONFIG_HOME/apex/plugins/d-slow/plugin.yml
+     *  $XDG_CONFIG_HOME/apex/plugins/e-framed/plugin.yml + handler.py
+     *  $XDG_CONFIG_HOME/apex/plugins/f-mermaid/plugin.yml + handler.py
      */
     char plugins_root[1024];
     snprintf(plugins_root, sizeof(plugins_root), "%s/apex/plugins", ctx->xdg_home);
@@ -156,25 +161,169 @@ static void plugin_test_cb(void *vctx) {
         write_file(manifest, yml);
     }
 
+    /* d-slow: pre_parse handler that never answers within its timeout */
+    {
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%s/d-slow", plugins_root);
+        mkdir_p(dir);
+
+        char manifest[1024];
+        snprintf(manifest, sizeof(manifest), "%s/plugin.yml", dir);
+        const char *yml =
+            "---\n"
+            "id: d-slow\n"
+            "phase: pre_parse\n"
+            "priority: 30\n"
+            "handler.command: \"sleep 10; echo SLOW_PLUGIN_OUTPUT\"\n"
+            "timeout_ms: 200\n"
+            "---\n";
+        write_file(manifest, yml);
+    }
+
+    /* e-framed: pre_parse handler using the framed protocol (raw text) */
+    {
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%s/e-framed", plugins_root);
+        mkdir_p(dir);
+
+        char script[1024];
+        snprintf(script, sizeof(script), "%s/handler.py", dir);
+        const char *py =
+            "import sys\n"
+            "inp = sys.stdin.buffer\n"
+            "if inp.readline() != b'APEX-PLUGIN 2\\n': sys.exit(1)\n"
+            "headers = {}\n"
+            "while True:\n"
+            "    line = inp.readline().decode().strip()\n"
+            "    if not line: break\n"
+            "    key, value = line.split(': ', 1)\n"
+            "    headers[key] = value\n"
+            "text = inp.read(int(headers['length'])).decode()\n"
+            "sys.stdout.write(text.replace('BAZ', 'BAZ FRAMED_' + headers['phase']))\n";
+        write_file(script, py);
+
+        char manifest[1024];
+        snprintf(manifest, sizeof(manifest), "%s/plugin.yml", dir);
+        const char *yml =
+            "---\n"
+            "id: e-framed\n"
+            "phase: pre_parse\n"
+            "priority: 40\n"
+            "handler.command: \"/usr/bin/env python3 ${APEX_PLUGIN_DIR}/handler.py\"\n"
+            "handler.protocol: framed\n"
+            "timeout_ms: 500\n"
+            "---\n";
+        write_file(manifest, yml);
+    }
+
+    /* f-mermaid: block handler for code blocks fenced as mermaid only */
+    {
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%s/f-mermaid", plugins_root);
+        mkdir_p(dir);
+
+        char script[1024];
+        snprintf(script, sizeof(script), "%s/handler.py", dir);
+        const char *py =
+            "import sys\n"
+            "inp = sys.stdin.buffer\n"
+            "def headers():\n"
+            "    fields = {}\n"
+            "    while True:\n"
+            "        line = inp.readline().decode().strip()\n"
+            "        if not line: return fields\n"
+            "        key, value = line.split(': ', 1)\n"
+            "        fields[key] = value\n"
+            "if inp.readline() != b'APEX-PLUGIN 2\\n': sys.exit(1)\n"
+            "request = headers()\n"
+            "for _ in range(int(request['nodes'])):\n"
+            "    node = headers()\n"
+            "    code = inp.read(int(node['length'])).decode()\n"
+            "    html = '<div class=\"mermaid\">' + code.strip() + '</div>'\n"
+            "    sys.stdout.write('length: %d\\n\\n%s' % (len(html.encode()), html))\n";
+        write_file(script, py);
+
+        char manifest[1024];
+        snprintf(manifest, sizeof(manifest), "%s/plugin.yml", dir);
+        const char *yml =
+            "---\n"
+            "id: f-mermaid\n"
+            "phase: block\n"
+            "nodes: code_block\n"
+            "info: mermaid\n"
+            "handler.command: \"/usr/bin/env python3 ${APEX_PLUGIN_DIR}/handler.py\"\n"
+            "timeout_ms: 500\n"
+            "---\n";
+        write_file(manifest, yml);
+    }
+
     /* Run a conversion that should exercise:
      * - plugin discovery (XDG_CONFIG_HOME path)
      * - regex plugin application (FOO->BAR)
      * - handler plugin application (BAR->BAZ plus markers)
      * - post_render handler append marker
+     * - a handler killed at its timeout, keeping the text it was given
+     * - a handler speaking the framed protocol
+     * - a block handler replacing only the code blocks it subscribed to
      */
     apex_options opts = apex_options_for_mode(APEX_MODE_UNIFIED);
     opts.enable_plugins = true;
     opts.input_file_path = "/tmp/apex-test-input.md";
 
-    const char *md = "FOO\n";
+    const char *md = "FOO\n\n```mermaid\ngraph TD\n```\n\n```c\nint x;\n```\n";
+    time_t started = time(NULL);
     char *html = apex_markdown_to_html(md, strlen(md), &opts);
 
+    test_result(time(NULL) - started < 5, "plugins: slow handler killed at timeout_ms");
+    test_result(html && strstr(html, "SLOW_PLUGIN_OUTPUT") == NULL, "plugins: timed-out handler leaves text unchanged");
+
     assert_contains(html, "BAZ", "plugins: regex + handler transformed text (FOO->BAR->BAZ)");
+    assert_contains(html, "FRAMED_pre_parse", "plugins: framed handler read header and raw text");
     assert_contains(html, "PLUGIN_DIR=", "plugins: handler saw APEX_PLUGIN_DIR");
     assert_contains(html, "SUPPORT_DIR=", "plugins: handler saw APEX_SUPPORT_DIR");
     assert_contains(html, "POST_RENDER_FILE=/tmp/apex-test-input.md", "plugins: post_render saw APEX_FILE_PATH");
+    assert_contains(html, "<div class=\"mermaid\">graph TD</div>", "plugins: block handler replaced the mermaid code block");
+    assert_contains(html, "int x;", "plugins: block handler left other code blocks alone");
+    test_result(html && strstr(html, "<code class=\"language-mermaid\">") == NULL, "plugins: mermaid block not rendered as code");
 
     apex_free_string(html);
+
+    /* Discovery index: rebuilt explicitly, then noticed as stale when a
+     * manifest changes */
+    char cache_home[1024];
+    snprintf(cache_home, sizeof(cache_home), "%s/cache", ctx->xdg_home);
+    const char *old_cache = getenv("XDG_CACHE_HOME");
+    char *old_cache_dup = old_cache ? strdup(old_cache) : NULL;
+    setenv("XDG_CACHE_HOME", cache_home, 1);
+
+    test_result(apex_plugins_rebuild_index(&opts) == 6, "plugins: index rebuilt with every plugin");
+    html = apex_markdown_to_html(md, strlen(md), &opts);
+    assert_contains(html, "BAZ", "plugins: loaded from the index");
+    apex_free_string(html);
+
+    {
+        char manifest[1024];
+        snprintf(manifest, sizeof(manifest), "%s/a-regex/plugin.yml", plugins_root);
+        const char *yml =
+            "---\n"
+            "id: a-regex\n"
+            "phase: pre_parse\n"
+            "priority: 10\n"
+            "pattern: \"FOO\"\n"
+            "replacement: \"INDEX_STALE\"\n"
+            "---\n";
+        write_file(manifest, yml);
+    }
+    html = apex_markdown_to_html(md, strlen(md), &opts);
+    assert_contains(html, "INDEX_STALE", "plugins: edited manifest invalidates the index");
+    apex_free_string(html);
+
+    if (old_cache_dup) {
+        setenv("XDG_CACHE_HOME", old_cache_dup, 1);
+        free(old_cache_dup);
+    } else {
+        unsetenv("XDG_CACHE_HOME");
+    }
 }
 
 void test_plugins_integration(void) {
@@ -196,6 +345,26 @@ void test_plugins_integration(void) {
         unsetenv("APEX_PRE_PARSE_PLUGIN");
     }
 
+    /* A plugin that streams its output while still reading must not
+     * deadlock once the text is larger than a pipe buffer */
+    {
+        setenv("APEX_PRE_PARSE_PLUGIN", "cat", 1);
+
+        size_t len = 1024 * 1024;
+        char *big = malloc(len + 1);
+        if (big) {
+            memset(big, 'x', len);
+            big[len] = '\0';
+            apex_options opts = apex_options_default();
+            char *out = apex_run_preparse_plugin_env(big, &opts);
+            test_result(out && strlen(out) > len, "APEX_PRE_PARSE_PLUGIN streams large text without deadlock");
+            free(out);
+            free(big);
+        }
+
+        unsetenv("APEX_PRE_PARSE_PLUGIN");
+    }
+
     /* Create temp XDG_CONFIG_HOME and run full plugin integration. */
     char tmp_template[] = "/tmp/apex-xdg-plugins-XXXXXX";
     char *tmp = mkdtemp(tmp_template);
@@ -27,6 +27,14 @@ static void sigabrt_handler(int sig) {
 /* Forward declarations for individual test suites */
 void test_basic_markdown(void);
 void test_gfm_features(void);
+void test_conversion_metrics(void);
+void test_conversion_arena(void);
+void test_length_based_input(void);
+void test_streaming_conversion(void);
+void test_incremental_render(void);
+void test_parsed_documents(void);
+void test_conversion_contexts(void);
+void test_standalone_parser(void);
 void test_metadata(void);
 void test_mmd_metadata_keys(void);
 void test_metadata_transforms(void);
@@ -71,6 +79,8 @@ void test_citations(void);
 void test_aria_labels(void);
 void test_marked_integration_features(void);
 void test_plugins_integration(void);
+void test_thread_safety(void);
+void test_parallel_render(void);
 
 /**
  * Test suite registry
@@ -89,6 +99,14 @@ static test_suite suites[] = {
     { "tests_basic",                   test_basic_markdown },
     { "basic",                         test_basic_markdown },
     { "gfm",                           test_gfm_features },
+    { "metrics",                       test_conversion_metrics },
+    { "arena",                         test_conversion_arena },
+    { "length_input",                  test_length_based_input },
+    { "stream",                        test_streaming_conversion },
+    { "incremental",                   test_incremental_render },
+    { "parsed_document",               test_parsed_documents },
+    { "context",                       test_conversion_contexts },
+    { "parser",                        test_standalone_parser },
     { "metadata",                      test_metadata },
     { "metadata_transforms",           test_metadata_transforms },
     { "mmd_metadata_keys",             test_mmd_metadata_keys },
@@ -134,6 +152,8 @@ static test_suite suites[] = {
     { "marked_integration",            test_marked_integration_features },
     { "marked",                        test_marked_integration_features },
     { "plugins_integration",           test_plugins_integration },
+    { "thread_safety",                 test_thread_safety },
+    { "parallel_render",               test_parallel_render },
 };
 
 static const size_t suite_count = sizeof(suites) / sizeof(suites[0]);
@@ -76,6 +76,16 @@ void test_advanced_tables(void) {
     assert_contains(html, "<td colspan=\"3\">A</td>", "Colspan applied to first row A spanning 3 columns with consecutive pipes");
     apex_free_string(html);
 
+    /* A cell spanning columns and several rows keeps both spans */
+    const char *block_span_table = "| H1 | H2 | H3 |\n|----|----|----|"
+                                   "\n| A  || B  |"
+                                   "\n| ^^ | ^^ | C  |"
+                                   "\n| ^^ | ^^ | D  |";
+    html = apex_markdown_to_html(block_span_table, strlen(block_span_table), &opts);
+    assert_contains(html, "<td colspan=\"2\" rowspan=\"3\">A</td>", "Colspan kept when rowspan grows past 2");
+    assert_not_contains(html, "^^", "Rowspan markers removed from block span");
+    apex_free_string(html);
+
     /* Test colspan marker detection inside nested inline nodes (e.g., emphasis around <<).
      * This exercises recursive marker detection for colspan cells.
      */
@@ -111,9 +121,21 @@ void test_advanced_tables(void) {
     assert_not_contains(html, "<td>—</td>", "Dash row: em-dash-only row removed");
     apex_free_string(html);
 
+    /* Test that an all-empty row is kept (only dash rows are separators) */
+    const char *blank_row =
+        "| H1 | H2 |\n"
+        "|----|----|\n"
+        "| A  | B  |\n"
+        "|    |    |\n"
+        "| C  | D  |\n";
+    html = apex_markdown_to_html(blank_row, strlen(blank_row), &opts);
+    assert_contains(html, "<td></td>\n<td></td>", "Blank row: all-empty row kept");
+    assert_contains(html, "<td>C</td>", "Blank row: row after blank row present");
+    apex_free_string(html);
+
     /* Test per-cell alignment marker parsing in cell content:
-     * these markers should be stripped from the rendered cell content.
-     * (Alignment styling is handled in HTML postprocessing; here we assert the markers don't leak.)
+     * these markers should be stripped from the rendered cell content
+     * and become the cell's text-align style.
      */
     apex_options cell_align_opts = opts;
     cell_align_opts.enable_emoji_autocorrect = false; /* Avoid :x: / :X: emoji autocorrect interference */
@@ -125,9 +147,28 @@ void test_advanced_tables(void) {
     assert_not_contains(html, ":L", "Cell alignment marker: leading colon stripped");
     assert_not_contains(html, ":X:", "Cell alignment marker: both colons stripped");
     assert_not_contains(html, "R:", "Cell alignment marker: trailing colon stripped");
-    assert_contains(html, "<td>L</td>", "Cell alignment marker: left content preserved");
-    assert_contains(html, "<td>X</td>", "Cell alignment marker: center content preserved");
-    assert_contains(html, "<td>R</td>", "Cell alignment marker: right content preserved");
+    assert_contains(html, "<td style=\"text-align: left\">L</td>", "Cell alignment marker: left content preserved");
+    assert_contains(html, "<td style=\"text-align: center\">X</td>", "Cell alignment marker: center content preserved");
+    assert_contains(html, "<td style=\"text-align: right\">R</td>", "Cell alignment marker: right content preserved");
+    apex_free_string(html);
+
+    /* A spanning cell keeps its alignment alongside its span */
+    const char *span_align =
+        "| H1 | H2 | H3 |\n"
+        "|----|----|----|\n"
+        "| :A: | << | B |\n";
+    html = apex_markdown_to_html(span_align, strlen(span_align), &cell_align_opts);
+    assert_contains(html, "<td style=\"text-align: center\" colspan=\"2\">A</td>", "Span cell: alignment and colspan");
+    assert_contains(html, "<td>B</td>", "Span cell: next cell unchanged");
+    apex_free_string(html);
+
+    /* A row header cell keeps its own attributes */
+    const char *row_header_align =
+        "|   | H1 |\n"
+        "|----|----|\n"
+        "| Row 1: | A1 |\n";
+    html = apex_markdown_to_html(row_header_align, strlen(row_header_align), &cell_align_opts);
+    assert_contains(html, "<th scope=\"row\" style=\"text-align: right\">Row 1</th>", "Row header: alignment kept");
     apex_free_string(html);
 
     /* Test per-cell alignment using colons */
@@ -159,6 +200,16 @@ void test_advanced_tables(void) {
     assert_contains(html, "<td>C1</td>", "Table cell");
     apex_free_string(html);
 
+    /* A raw HTML table in a cell does not end the table around it */
+    const char *nested_table =
+        "| H1 | H2 | H3 |\n"
+        "|----|----|----|\n"
+        "| <table><tr><td>in</td></tr></table> | A | << |\n";
+    html = apex_markdown_to_html(nested_table, strlen(nested_table), &opts);
+    assert_contains(html, "<td colspan=\"2\">A</td>", "Nested raw table: outer spans applied");
+    assert_contains(html, "<table><tr><td>in</td></tr></table>", "Nested raw table: kept in its cell");
+    apex_free_string(html);
+
     /* Test row header column when first header cell is empty */
     const char *row_header_table =
         "|   | H1 | H2 |\n"
@@ -317,6 +368,21 @@ void test_relaxed_tables(void) {
     assert_contains(html, "<p>Paragraph text</p>", "Paragraph after blank line");
     apex_free_string(html);
 
+    /* A single pipe row before a blank line stays where it is */
+    const char *split_rows = "A | B\n\nParagraph text\n\n1 | 2";
+    html = apex_markdown_to_html(split_rows, strlen(split_rows), &opts);
+    assert_not_contains(html, "<table>", "Pipe rows split by blank lines are not a table");
+    assert_contains(html, "<p>A | B</p>", "Single pipe row stays a paragraph");
+    apex_free_string(html);
+
+    /* Headerless table: the made-up header row is not rendered */
+    const char *headerless = "|---|---|\n| x | y |\n| z | w |";
+    html = apex_markdown_to_html(headerless, strlen(headerless), &opts);
+    assert_contains(html, "<td>x</td>", "Headerless table body cell");
+    assert_not_contains(html, "<thead>", "Headerless table has no thead");
+    assert_not_contains(html, "<th>", "Headerless table has no header cells");
+    apex_free_string(html);
+
     /* Test relaxed table with leading pipe */
     const char *relaxed_table_leading = "| A | B |\n| 1 | 2 |";
     html = apex_markdown_to_html(relaxed_table_leading, strlen(relaxed_table_leading), &opts);
@@ -0,0 +1,218 @@
+/**
+ * Thread Safety Tests
+ */
+
+#include "test_helpers.h"
+#include "apex/apex.h"
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#ifdef TEST_FIXTURES_DIR
+#define THREAD_FIXTURES_DIR TEST_FIXTURES_DIR
+#else
+#define THREAD_FIXTURES_DIR "tests/fixtures/includes"
+#endif
+
+#define STRESS_THREADS 16
+#define STRESS_ROUNDS 8
+#define STRESS_VARIANTS 4
+
+/* Documents touching the extensions that used to keep process-global state */
+static const char *stress_documents[] = {
+    "---\ntitle: Threads\n---\n\n# [%title]\n\nSee [[Home Page]] and [[Other#Part|there]].\n",
+    "| H1 | H2 | H3 |\n|----|----|----|\n| :L | :X: | R: |\n| a  | b  | c  |\n",
+    "| A | B |\n|---|---|\n| span ||\n| ^^ | x |\n[Caption]\n",
+    "Term\n: Definition with **bold**\n\nOther\n: More\n",
+    "Text[^1] and $E = mc^2$.\n\n[^1]: A footnote\n\n    with code\n",
+    "![Alt](image.png)\n\n## Section {#sec .big}\n\nTags: a, b, c\n",
+    "{{TOC}}\n\n# One\n\n## Two\n\n> [!NOTE]\n> Callout\n\n==highlight== and H~2~O\n",
+};
+
+#define STRESS_DOCUMENT_COUNT (sizeof(stress_documents) / sizeof(stress_documents[0]))
+
+static const char *stress_stylesheets[] = { "embed.css", NULL };
+
+/* Options differ between variants so per-conversion settings are exercised */
+static apex_options stress_options(int variant) {
+    apex_options opts = apex_options_default();
+    opts.base_directory = THREAD_FIXTURES_DIR;
+    opts.enable_emoji_autocorrect = false;
+    switch (variant) {
+        case 0:
+            opts.per_cell_alignment = true;
+            break;
+        case 1:
+            opts.per_cell_alignment = false;
+            opts.embed_images = true;
+            break;
+        case 2:
+            opts.standalone = true;
+            opts.stylesheet_paths = stress_stylesheets;
+            opts.stylesheet_count = 1;
+            opts.embed_stylesheet = true;
+            opts.pretty = true;
+            break;
+        default:
+            opts = apex_options_for_mode(APEX_MODE_GFM);
+            break;
+    }
+    return opts;
+}
+
+typedef struct {
+    char *expected[STRESS_VARIANTS][STRESS_DOCUMENT_COUNT];
+} stress_baseline;
+
+typedef struct {
+    const stress_baseline *baseline;
+    int seed;
+    int mismatches;
+} stress_worker;
+
+static void *stress_worker_run(void *arg) {
+    stress_worker *worker = (stress_worker *)arg;
+    size_t total = STRESS_VARIANTS * STRESS_DOCUMENT_COUNT;
+
+    for (int round = 0; round < STRESS_ROUNDS; round++) {
+        for (size_t i = 0; i < total; i++) {
+            /* Each thread walks the cases in a different order */
+            size_t k = (i * 5 + (size_t)worker->seed + (size_t)round) % total;
+            int variant = (int)(k / STRESS_DOCUMENT_COUNT);
+            size_t doc = k % STRESS_DOCUMENT_COUNT;
+
+            apex_options opts = stress_options(variant);
+            const char *md = stress_documents[doc];
+            char *html = apex_markdown_to_html(md, strlen(md), &opts);
+            const char *expected = worker->baseline->expected[variant][doc];
+            if (!html || !expected || strcmp(html, expected) != 0) {
+                worker->mismatches++;
+            }
+            apex_free_string(html);
+        }
+    }
+    return NULL;
+}
+
+void test_thread_safety(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Thread Safety Tests", false, true);
+
+    /* Serial run gives the expected output for every case */
+    stress_baseline baseline;
+    for (int v = 0; v < STRESS_VARIANTS; v++) {
+        for (size_t d = 0; d < STRESS_DOCUMENT_COUNT; d++) {
+            apex_options opts = stress_options(v);
+            baseline.expected[v][d] = apex_markdown_to_html(stress_documents[d], strlen(stress_documents[d]), &opts);
+        }
+    }
+    assert_contains(baseline.expected[0][0], "href=\"Home-Page\"", "Serial baseline converts wiki links");
+    test_result(baseline.expected[0][1] && baseline.expected[1][1] &&
+                strcmp(baseline.expected[0][1], baseline.expected[1][1]) != 0,
+                "Serial baseline depends on per-cell alignment option");
+    assert_contains(baseline.expected[1][5], "data:image/png;base64,", "Serial baseline embeds image");
+    assert_contains(baseline.expected[2][0], "<style>", "Serial baseline embeds stylesheet");
+
+    /* Start with cold caches so threads race on first use */
+    apex_image_cache_clear();
+    apex_stylesheet_cache_clear();
+
+    pthread_t threads[STRESS_THREADS];
+    stress_worker workers[STRESS_THREADS];
+    int started = 0;
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        workers[t].baseline = &baseline;
+        workers[t].seed = t * 7;
+        workers[t].mismatches = 0;
+        if (pthread_create(&threads[t], NULL, stress_worker_run, &workers[t]) == 0) {
+            started++;
+        } else {
+            break;
+        }
+    }
+
+    int mismatches = 0;
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        mismatches += workers[t].mismatches;
+    }
+
+    test_result(started == STRESS_THREADS, "Started all stress threads");
+    if (mismatches != 0) {
+        printf("  %d of %d conversions differed from the serial run\n", mismatches,
+               started * STRESS_ROUNDS * STRESS_VARIANTS * (int)STRESS_DOCUMENT_COUNT);
+    }
+    test_result(mismatches == 0, "Concurrent output matches serial output");
+
+    for (int v = 0; v < STRESS_VARIANTS; v++) {
+        for (size_t d = 0; d < STRESS_DOCUMENT_COUNT; d++) {
+            apex_free_string(baseline.expected[v][d]);
+        }
+    }
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Thread Safety Tests", had_failures, false);
+}
+
+/* Large document mixing block-local passes with document-global ones */
+static char *parallel_document(size_t blocks) {
+    size_t cap = blocks * 160 + 256;
+    char *md = malloc(cap);
+    if (!md) return NULL;
+
+    size_t len = (size_t)snprintf(md, cap, "{{TOC}}\n\n*[HTML]: Hyper Text Markup Language\n\n");
+    for (size_t i = 0; i < blocks && len < cap; i++) {
+        switch (i % 5) {
+            case 0:
+                len += (size_t)snprintf(md + len, cap - len, "## Part %zu :rocket:\n\n", i);
+                break;
+            case 1:
+                len += (size_t)snprintf(md + len, cap - len, "HTML is :smile: here[^n%zu] and a:b:c.\n\n", i);
+                break;
+            case 2:
+                len += (size_t)snprintf(md + len, cap - len, "```c\nint x = %zu; /* :tada: */\n```\n\n", i);
+                break;
+            case 3:
+                len += (size_t)snprintf(md + len, cap - len, "- item :+1:\n- HTML\n\n> quoted :heart:\n\n");
+                break;
+            default:
+                len += (size_t)snprintf(md + len, cap - len, "[^n%zu]: Note %zu :star:\n\n", i - 3, i);
+                break;
+        }
+    }
+    return md;
+}
+
+void test_parallel_render(void) {
+    int suite_failures = suite_start();
+    print_suite_title("Parallel Render Tests", false, true);
+
+    char *md = parallel_document(3000);
+    apex_options serial = apex_options_for_mode(APEX_MODE_UNIFIED);
+    apex_options parallel = serial;
+    parallel.render_threads = 4;
+
+    char *expected = md ? apex_markdown_to_html(md, strlen(md), &serial) : NULL;
+    char *html = md ? apex_markdown_to_html(md, strlen(md), &parallel) : NULL;
+
+    test_result(expected && strlen(expected) > 64 * 1024, "Document is large enough to be split");
+    assert_contains(expected, "<abbr title=\"Hyper Text Markup Language\">HTML</abbr>", "Serial run replaces abbreviations");
+    test_result(expected && html && strcmp(expected, html) == 0, "Parallel output matches serial output");
+
+    /* Small documents stay on the serial path */
+    const char *small = "# Hi :smile:\n";
+    char *small_serial = apex_markdown_to_html(small, strlen(small), &serial);
+    char *small_parallel = apex_markdown_to_html(small, strlen(small), &parallel);
+    test_result(small_serial && small_parallel && strcmp(small_serial, small_parallel) == 0,
+                "Small document output unchanged");
+
+    apex_free_string(small_serial);
+    apex_free_string(small_parallel);
+    apex_free_string(expected);
+    apex_free_string(html);
+    free(md);
+
+    bool had_failures = suite_end(suite_failures);
+    print_suite_title("Parallel Render Tests", had_failures, false);
+}